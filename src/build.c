@@ -11,6 +11,11 @@
  * The two model construction strategies simply label which columns
  * are supposed to be match states, and then hand this info to
  * matassign2hmm().
+ *
+ * p7_MatassignCount() and p7_MatassignAnnotate() do the same job
+ * for an alignment that's read in chunks (see p7_StreamBuilder()):
+ * the caller decides the match columns, then adds each chunk's
+ * counts to one model.
  * 
  * 
  * Contents:
@@ -30,11 +35,13 @@
 #include "esl_alphabet.h"
 #include "esl_msa.h"
 #include "esl_msafile.h"
+#include "esl_vectorops.h"
 
 #include "hmmer.h"
 
 static int do_modelmask( ESL_MSA *msa);
 static int matassign2hmm(ESL_MSA *msa, int *matassign, P7_HMM **ret_hmm, P7_TRACE ***opt_tr);
+static int count_traces (ESL_MSA *msa, int *matassign, P7_HMM *hmm, P7_TRACE **tr);
 static int annotate_model(P7_HMM *hmm, int *matassign, ESL_MSA *msa);
 
 /*****************************************************************
@@ -202,6 +209,75 @@ p7_Fastmodelmaker(ESL_MSA *msa, float symfrac, P7_BUILDER *bld, P7_HMM **ret_hmm
   return status;
 }
 
+
+/* Function: p7_MatassignCount()
+ * 
+ * Purpose:  Add the weighted counts from alignment <msa> to the
+ *           counts-form model <hmm>, given an assignment of columns
+ *           to match vs. insert in <matassign[1..alen]>, the way
+ *           the model makers do for a whole alignment: mask columns
+ *           marked in <msa->mm>, make faux traces, doctor them, and
+ *           count them.
+ *
+ *           Used to build a model from an alignment too large to
+ *           hold in memory: <msa> is one chunk of its sequences
+ *           (with weights set, and fragments marked), <matassign>
+ *           was decided from the whole alignment, and <hmm> was
+ *           created with one match state per assigned column and
+ *           zeroed before the first chunk.
+ *
+ *           Like the model makers, may revise <msa> if the column
+ *           assignment implies DI and ID transitions.
+ *
+ * Return:   <eslOK> on success.
+ *
+ * Throws:   <eslEMEM> on allocation failure; <eslEINVAL> if the
+ *           <msa> isn't in digital mode; <eslFAIL> if a faux trace
+ *           doesn't validate.
+ */
+int
+p7_MatassignCount(ESL_MSA *msa, int *matassign, P7_HMM *hmm)
+{
+  P7_TRACE **tr = NULL;
+  int        idx;
+  int        status;
+
+  if (! (msa->flags & eslMSA_DIGITAL)) ESL_XEXCEPTION(eslEINVAL, "need digital MSA");
+
+  do_modelmask(msa);
+
+  ESL_ALLOC(tr, sizeof(P7_TRACE *) * msa->nseq);
+  for (idx = 0; idx < msa->nseq; idx++) tr[idx] = NULL;
+  if ((status = count_traces(msa, matassign, hmm, tr)) != eslOK) goto ERROR;
+
+  p7_trace_DestroyArray(tr, msa->nseq);
+  return eslOK;
+
+ ERROR:
+  if (tr != NULL) p7_trace_DestroyArray(tr, msa->nseq);
+  return status;
+}
+
+
+/* Function: p7_MatassignAnnotate()
+ * 
+ * Purpose:  Transfer the per-column annotation of alignment <msa>
+ *           (RF, MM, SS_cons, SA_cons) and the alignment map to
+ *           new model <hmm>, given the column assignment
+ *           <matassign[1..alen]>. The counterpart of
+ *           <p7_MatassignCount()>; <msa> need not have any
+ *           sequences.
+ *
+ * Return:   <eslOK> on success.
+ *
+ * Throws:   <eslEMEM> on allocation error.
+ */
+int
+p7_MatassignAnnotate(ESL_MSA *msa, int *matassign, P7_HMM *hmm)
+{
+  return annotate_model(hmm, matassign, msa);
+}
+
 /*-------------------- end, exported API -------------------------*/
 
 
@@ -270,7 +346,6 @@ matassign2hmm(ESL_MSA *msa, int *matassign, P7_HMM **ret_hmm, P7_TRACE ***opt_tr
   int      M;                   /* length of new model in match states */
   int      idx;                 /* counter over sequences              */
   int      apos;                /* counter for aligned columns         */
-  char errbuf[eslERRBUFSIZE];
 
   /* apply the model mask in the 'GC MM' row */
   do_modelmask(msa);
@@ -280,23 +355,12 @@ matassign2hmm(ESL_MSA *msa, int *matassign, P7_HMM **ret_hmm, P7_TRACE ***opt_tr
     if (matassign[apos]) M++;
   if (M == 0) { status = eslENORESULT; goto ERROR; }
 
-  /* Make fake tracebacks for each seq */
+  /* Make fake tracebacks for each seq, and build count model from them */
   ESL_ALLOC(tr, sizeof(P7_TRACE *) * msa->nseq);
-  if ((status = p7_trace_FauxFromMSA(msa, matassign, p7_MSA_COORDS, tr))        != eslOK) goto ERROR;
-  for (idx = 0; idx < msa->nseq; idx++)
-    {
-      if ((status = p7_trace_Doctor(tr[idx], NULL, NULL))                       != eslOK) goto ERROR;
-      if ((status = p7_trace_Validate(tr[idx], msa->abc, msa->ax[idx], errbuf)) != eslOK) 
-	ESL_XEXCEPTION(eslFAIL, "validation failed: %s", errbuf);
-    }
-
-  /* Build count model from tracebacks */
-  if ((hmm    = p7_hmm_Create(M, msa->abc)) == NULL)  { status = eslEMEM; goto ERROR; }
-  if ((status = p7_hmm_Zero(hmm))           != eslOK) goto ERROR;
-  for (idx = 0; idx < msa->nseq; idx++) {
-    if (tr[idx] == NULL) continue; /* skip rare examples of empty sequences */
-    if ((status = p7_trace_Count(hmm, msa->ax[idx], msa->wgt[idx], tr[idx])) != eslOK) goto ERROR;
-  }
+  for (idx = 0; idx < msa->nseq; idx++) tr[idx] = NULL;
+  if ((hmm    = p7_hmm_Create(M, msa->abc))           == NULL)  { status = eslEMEM; goto ERROR; }
+  if ((status = p7_hmm_Zero(hmm))                     != eslOK) goto ERROR;
+  if ((status = count_traces(msa, matassign, hmm, tr)) != eslOK) goto ERROR;
 
   hmm->nseq     = msa->nseq;
   hmm->eff_nseq = msa->nseq;
@@ -329,6 +393,42 @@ matassign2hmm(ESL_MSA *msa, int *matassign, P7_HMM **ret_hmm, P7_TRACE ***opt_tr
   
 
 
+/* Function: count_traces()
+ * 
+ * Purpose:  Make faux tracebacks <tr[0..nseq-1]> for the sequences
+ *           in <msa> from column assignment <matassign>, doctor and
+ *           validate them, and add their weighted counts to <hmm>.
+ *           Caller provides the <tr> array; the traces in it are
+ *           allocated here, and the caller frees them.
+ *
+ * Return:   <eslOK> on success.
+ *
+ * Throws:   <eslEMEM> on allocation failure; <eslFAIL> if a trace
+ *           doesn't validate.
+ */
+static int
+count_traces(ESL_MSA *msa, int *matassign, P7_HMM *hmm, P7_TRACE **tr)
+{
+  int  idx;
+  int  status;
+  char errbuf[eslERRBUFSIZE];
+
+  if ((status = p7_trace_FauxFromMSA(msa, matassign, p7_MSA_COORDS, tr))        != eslOK) return status;
+  for (idx = 0; idx < msa->nseq; idx++)
+    {
+      if ((status = p7_trace_Doctor(tr[idx], NULL, NULL))                       != eslOK) return status;
+      if ((status = p7_trace_Validate(tr[idx], msa->abc, msa->ax[idx], errbuf)) != eslOK) 
+	ESL_EXCEPTION(eslFAIL, "validation failed: %s", errbuf);
+    }
+
+  for (idx = 0; idx < msa->nseq; idx++) {
+    if (tr[idx] == NULL) continue; /* skip rare examples of empty sequences */
+    if ((status = p7_trace_Count(hmm, msa->ax[idx], msa->wgt[idx], tr[idx])) != eslOK) return status;
+  }
+  return eslOK;
+}
+
+
 /* Function: annotate_model()
  * 
  * Purpose:  Transfer rf, cs, and other optional annotation from the alignment
@@ -528,6 +628,84 @@ utest_fragments(void)
   return;
 }
 
+/* utest_chunked()
+ * Counting an alignment two chunks at a time with p7_MatassignCount()
+ * gives the same counts as p7_Fastmodelmaker() on the whole thing.
+ */
+static void
+utest_chunked(void)
+{
+  char         *failmsg      = "failure in build.c::utest_chunked() unit test";
+  char          msafile[16]  = "p7tmpXXXXXX"; /* tmpfile name template */
+  FILE         *ofp          = NULL;
+  ESL_ALPHABET *abc          = esl_alphabet_Create(eslAMINO);
+  ESL_MSAFILE  *afp          = NULL;
+  ESL_MSA      *msa          = NULL;
+  ESL_MSA      *chunk        = NULL;
+  P7_HMM       *hmm1         = NULL;
+  P7_HMM       *hmm2         = NULL;
+  int          *matassign    = NULL;
+  int          *useme        = NULL;
+  int           b, i, k;
+
+  if (esl_tmpfile_named(msafile, &ofp) != eslOK) esl_fatal(failmsg);
+  fprintf(ofp, "# STOCKHOLM 1.0\n");
+  fprintf(ofp, "#=GC MM ......m...................\n");
+  fprintf(ofp, "seq1    --ACDEFGHIKLMNPZXS-TVW-Yyy\n");
+  fprintf(ofp, "seq2    aaACDEFGHIKLMNPQRS-TVWw---\n");
+  fprintf(ofp, "seq3    aaAC-EFGHIKLMNPQRS-TVW-Y--\n");
+  fprintf(ofp, "seq4    ~~AC-EFGHIKLMNPQRS-TVW-Y~~\n");
+  fprintf(ofp, "seq5    aaACDEFGHIKLMNPQRSTTVW-Y--\n");
+  fprintf(ofp, "//\n");
+  fclose(ofp);
+
+  if (esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp) != eslOK) esl_fatal(failmsg);
+  if (esl_msafile_Read(afp, &msa)                                           != eslOK) esl_fatal(failmsg);
+  if ((useme     = malloc(sizeof(int) * msa->nseq))                         == NULL)  esl_fatal(failmsg);
+  if ((matassign = malloc(sizeof(int) * (msa->alen+1)))                     == NULL)  esl_fatal(failmsg);
+
+  /* the chunks must be cut before p7_Fastmodelmaker() masks <msa> */
+  if (p7_Fastmodelmaker(msa, 0.5, NULL, &hmm1, NULL)                        != eslOK) esl_fatal(failmsg);
+  for (i = 1; i <= msa->alen; i++) matassign[i] = FALSE;
+  for (k = 1; k <= hmm1->M;   k++) matassign[hmm1->map[k]] = TRUE;
+
+  esl_msa_Destroy(msa);
+  esl_msafile_Close(afp);
+  if (esl_msafile_Open(&abc, msafile, NULL, eslMSAFILE_UNKNOWN, NULL, &afp) != eslOK) esl_fatal(failmsg);
+  if (esl_msafile_Read(afp, &msa)                                           != eslOK) esl_fatal(failmsg);
+
+  if ((hmm2 = p7_hmm_Create(hmm1->M, abc)) == NULL)  esl_fatal(failmsg);
+  if (p7_hmm_Zero(hmm2)                    != eslOK) esl_fatal(failmsg);
+  for (b = 0; b < msa->nseq; b += 2)
+    {
+      for (i = 0; i < msa->nseq; i++) useme[i] = (i == b || i == b+1) ? TRUE : FALSE;
+      if (esl_msa_SequenceSubset(msa, useme, &chunk)  != eslOK) esl_fatal(failmsg);
+      if (chunk->mm == NULL && esl_strdup(msa->mm, -1, &(chunk->mm)) != eslOK) esl_fatal(failmsg);
+      if (p7_MatassignCount(chunk, matassign, hmm2)   != eslOK) esl_fatal(failmsg);
+      esl_msa_Destroy(chunk);
+    }
+  if (p7_MatassignAnnotate(msa, matassign, hmm2)      != eslOK) esl_fatal(failmsg);
+
+  for (k = 0; k <= hmm1->M; k++)
+    {
+      if (esl_vec_FCompare(hmm1->t[k],   hmm2->t[k],   p7H_NTRANSITIONS, 1e-5) != eslOK) esl_fatal(failmsg);
+      if (esl_vec_FCompare(hmm1->mat[k], hmm2->mat[k], abc->K,           1e-5) != eslOK) esl_fatal(failmsg);
+      if (esl_vec_FCompare(hmm1->ins[k], hmm2->ins[k], abc->K,           1e-5) != eslOK) esl_fatal(failmsg);
+      if (hmm1->map[k] != hmm2->map[k])                                                  esl_fatal(failmsg);
+    }
+  if (strcmp(hmm1->mm, hmm2->mm) != 0) esl_fatal(failmsg);
+
+  free(useme);
+  free(matassign);
+  p7_hmm_Destroy(hmm1);
+  p7_hmm_Destroy(hmm2);
+  esl_msa_Destroy(msa);
+  esl_msafile_Close(afp);
+  esl_alphabet_Destroy(abc);
+  remove(msafile);
+  return;
+}
+
 #endif /*p7BUILD_TESTDRIVE*/
 /*---------------------- end of unit tests -----------------------*/
 
@@ -551,6 +729,7 @@ main(int argc, char **argv)
 {  
   utest_basic();
   utest_fragments();
+  utest_chunked();
 
   return eslOK;
 }
@@ -2,6 +2,7 @@
  * 
  * Contents:
  *   2. P7_CACHEDB_SEQS: a daemon's cached sequence database
+ *   3. Caching an arbitrary sequence file (jackhmmer --cache)
  *   x. Benchmark driver
  *   x. Unit tests
  *   x. License and copyright information.
@@ -189,6 +190,7 @@ p7_seqcache_Open(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf)
     cache->list[inx].n      = sq->n;
     cache->list[inx].idx    = inx;
     cache->list[inx].db_key = db_key;
+    cache->list[inx].acc    = NULL;
     if(desc_ptr != NULL) esl_strdup(desc_ptr, -1, &(cache->list[inx].desc));
 
     /* copy the digitized sequence */
@@ -278,11 +280,106 @@ p7_seqcache_Open(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf)
   return eslEMEM;
 }
 
+/* Function:  p7_seqcache_Append()
+ * Synopsis:  Add a delta of new sequences to a loaded cache.
+ *
+ * Purpose:   Append the sequences of <delta>, a cache opened with
+ *            <p7_seqcache_Open()> from a file holding only new
+ *            sequences, to <cache> without reloading or copying
+ *            <cache>'s residues. The delta's sequences are
+ *            renumbered to follow <cache>'s (their <idx> and numeric
+ *            names become <cache->count>+1..), each sub-database's
+ *            list grows by the delta's, and <cache> takes the delta's
+ *            unique id. <cache> takes ownership of <delta>, which
+ *            stays on the <next> chain until <cache> is closed.
+ *
+ *            Nothing in <cache> changes until the new sub-database
+ *            lists have been allocated, so on any error <cache> is
+ *            still usable as it was and the caller still owns
+ *            <delta>.
+ *
+ * Args:      cache  - loaded sequence cache to grow
+ *            delta  - cache of new sequences; not itself appended to
+ *            errbuf - optional: room for an error message
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            <eslEINCOMPAT> if <delta> has a different number of
+ *            sub-databases; <eslEINVAL> if <delta> already has
+ *            deltas of its own; <eslERANGE> if the combined cache
+ *            would need more than nine-digit names.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_seqcache_Append(P7_SEQCACHE *cache, P7_SEQCACHE *delta, char *errbuf)
+{
+  P7_SEQCACHE  *last;
+  char         *id  = NULL;
+  void         *tmp;
+  uint32_t      i;
+  int           status;
+
+  if (errbuf) errbuf[0] = '\0';
+
+  if (delta->db_cnt != cache->db_cnt) {
+    if (errbuf) sprintf(errbuf, "delta %s has %d databases, not %d", delta->name, delta->db_cnt, cache->db_cnt);
+    return eslEINCOMPAT;
+  }
+  if (delta->next != NULL) {
+    if (errbuf) sprintf(errbuf, "delta %s has deltas of its own", delta->name);
+    return eslEINVAL;
+  }
+  if ((uint64_t) cache->count + delta->count > 999999999) {
+    if (errbuf) sprintf(errbuf, "too many sequences with delta %s", delta->name);
+    return eslERANGE;
+  }
+
+  /* grow everything first; a failure here leaves <cache> as it was,
+   * only with roomier lists.
+   */
+  if ((status = esl_strdup(delta->id, -1, &id)) != eslOK) goto ERROR;
+  for (i = 0; i < cache->db_cnt; ++i) {
+    if (delta->db[i].count == 0) continue;
+    ESL_RALLOC(cache->db[i].list, tmp, sizeof(HMMER_SEQ *) * (cache->db[i].count + delta->db[i].count));
+  }
+
+  /* the delta's names are the same ten byte slots p7_seqcache_Open() made;
+   * Open() numbers <idx> 1..count just like the names, so after the
+   * shift both run <cache->count>+1..
+   */
+  for (i = 0; i < delta->count; ++i) {
+    delta->list[i].idx += cache->count;
+    sprintf(delta->list[i].name, "%09d", (int) delta->list[i].idx);
+  }
+
+  for (i = 0; i < cache->db_cnt; ++i) {
+    memcpy(cache->db[i].list + cache->db[i].count, delta->db[i].list, sizeof(HMMER_SEQ *) * delta->db[i].count);
+    cache->db[i].count += delta->db[i].count;
+    cache->db[i].K     += delta->db[i].K;
+  }
+  cache->count += delta->count;
+
+  free(cache->id);
+  cache->id = id;
+
+  for (last = cache; last->next != NULL; last = last->next) ;
+  last->next = delta;
+
+  return eslOK;
+
+ ERROR:
+  if (id != NULL) free(id);
+  if (errbuf) sprintf(errbuf, "out of memory appending %s", delta->name);
+  return status;
+}
+
 void
 p7_seqcache_Close(P7_SEQCACHE *cache)
 {
   int i;
 
+  if (cache->next)        p7_seqcache_Close(cache->next);
   if (cache->name)        free(cache->name);
   if (cache->id)          free(cache->id);
   if (cache->db) 
@@ -296,9 +393,155 @@ p7_seqcache_Close(P7_SEQCACHE *cache)
   if (cache->list)        free(cache->list);
   if (cache->residue_mem) free(cache->residue_mem);
   if (cache->header_mem)  free(cache->header_mem);
+  if (cache->part_mem)
+    {
+      for (i = 0; i < cache->nparts; ++i) {
+	if (cache->part_mem[i] != NULL) free(cache->part_mem[i]);
+      }
+      free(cache->part_mem);
+    }
+  if (cache->part_end)    free(cache->part_end);
   free(cache);
 }
 
+/* Function:  p7_seqcache_Read()
+ * Synopsis:  Load every sequence of an open sequence file into memory.
+ *
+ * Purpose:   Read all remaining sequences from open digital sequence
+ *            file <sqfp> into a new cache <*ret_cache>. Residues are
+ *            packed end to end in one allocation (<residue_mem>,
+ *            sentinels shared between neighbours), and each
+ *            sequence's name, accession and description in another
+ *            (<header_mem>).
+ *
+ *            Unlike <p7_seqcache_Open()>, this takes any format
+ *            <sqfp> was opened in, including stdin and gzip'ed
+ *            files, because it reads in one pass without rewinding.
+ *            Sequences stay in file order, <idx> is each sequence's
+ *            1..count index in the file, and there are no
+ *            sub-databases (<db_cnt> is 0, <db_key> is 0).
+ *
+ * Args:      sqfp      - open digital sequence file
+ *            ret_cache - RETURN: the new cache
+ *            errbuf    - optional: room for a parse error message
+ *
+ * Returns:   <eslOK> on success; caller frees <*ret_cache> with
+ *            <p7_seqcache_Close()>.
+ *
+ *            <eslEFORMAT> on a parse error, with the parser's message
+ *            in <errbuf> if it was provided; <*ret_cache> is NULL.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_seqcache_Read(ESL_SQFILE *sqfp, P7_SEQCACHE **ret_cache, char *errbuf)
+{
+  P7_SEQCACHE *cache     = NULL;
+  ESL_SQ      *sq        = NULL;
+  ESL_DSQ     *res;
+  char        *hdr;
+  uint64_t     res_alloc = 1024 * 1024;
+  uint64_t     hdr_alloc = 64 * 1024;
+  uint32_t     list_alloc = 1024;
+  uint64_t     need;
+  uint32_t     i;
+  int          nlen, alen, dlen;
+  void        *tmp;
+  int          status;
+
+  if (errbuf) errbuf[0] = '\0';
+
+  ESL_ALLOC(cache, sizeof(P7_SEQCACHE));
+  memset(cache, 0, sizeof(P7_SEQCACHE));
+  if ((status = esl_strdup(sqfp->filename, -1, &cache->name)) != eslOK) goto ERROR;
+  if ((cache->abc = esl_alphabet_Create(sqfp->abc->type))    == NULL)  { status = eslEMEM; goto ERROR; }
+
+  ESL_ALLOC(cache->list,        sizeof(HMMER_SEQ) * list_alloc);
+  ESL_ALLOC(cache->residue_mem, res_alloc);
+  ESL_ALLOC(cache->header_mem,  hdr_alloc);
+
+  /* residue_mem holds  <sentinel> seq1 <sentinel> seq2 ... seqN <sentinel>:
+   * each sequence adds n+1, plus the leading sentinel.
+   */
+  res = (ESL_DSQ *) cache->residue_mem;
+  res[0] = eslDSQ_SENTINEL;
+  cache->res_size = 1;
+  cache->hdr_size = 0;
+
+  sq = esl_sq_CreateDigital(sqfp->abc);
+  while ((status = esl_sqio_Read(sqfp, sq)) == eslOK)
+    {
+      if (cache->count == list_alloc) {
+	list_alloc *= 2;
+	ESL_RALLOC(cache->list, tmp, sizeof(HMMER_SEQ) * list_alloc);
+      }
+
+      need = cache->res_size + sq->n + 1;
+      if (need > res_alloc) {
+	while (need > res_alloc) res_alloc *= 2;
+	ESL_RALLOC(cache->residue_mem, tmp, res_alloc);
+      }
+      nlen = strlen(sq->name);
+      alen = strlen(sq->acc);
+      dlen = strlen(sq->desc);
+      need = cache->hdr_size + nlen + alen + dlen + 3;
+      if (need > hdr_alloc) {
+	while (need > hdr_alloc) hdr_alloc *= 2;
+	ESL_RALLOC(cache->header_mem, tmp, hdr_alloc);
+      }
+
+      res = (ESL_DSQ *) cache->residue_mem + cache->res_size;
+      memcpy(res, sq->dsq+1, sq->n);
+      res[sq->n] = eslDSQ_SENTINEL;
+      cache->res_size += sq->n + 1;
+
+      hdr = cache->header_mem + cache->hdr_size;
+      memcpy(hdr, sq->name, nlen+1);  hdr += nlen+1;
+      memcpy(hdr, sq->acc,  alen+1);  hdr += alen+1;
+      memcpy(hdr, sq->desc, dlen+1);
+      cache->hdr_size += nlen + alen + dlen + 3;
+
+      cache->list[cache->count].n      = sq->n;
+      cache->list[cache->count].idx    = cache->count + 1;
+      cache->list[cache->count].db_key = 0;
+      cache->count++;
+      esl_sq_Reuse(sq);
+    }
+  if (status == eslEFORMAT) {
+    if (errbuf) strcpy(errbuf, esl_sqfile_GetErrorBuf(sqfp));
+    goto ERROR;
+  }
+  else if (status != eslEOF) goto ERROR;
+
+  /* Trim the allocations to size; only now, when nothing moves any
+   * more, set each sequence's pointers into them.
+   */
+  if (cache->count > 0) ESL_RALLOC(cache->list, tmp, sizeof(HMMER_SEQ) * cache->count);
+  ESL_RALLOC(cache->residue_mem, tmp, cache->res_size);
+  if (cache->hdr_size > 0) ESL_RALLOC(cache->header_mem, tmp, cache->hdr_size);
+
+  res = (ESL_DSQ *) cache->residue_mem;
+  hdr = cache->header_mem;
+  for (i = 0; i < cache->count; i++)
+    {
+      cache->list[i].dsq  = res;   res += cache->list[i].n + 1;
+      cache->list[i].name = hdr;   hdr += strlen(hdr) + 1;
+      cache->list[i].acc  = hdr;   hdr += strlen(hdr) + 1;
+      cache->list[i].desc = hdr;   hdr += strlen(hdr) + 1;
+    }
+
+  esl_sq_Destroy(sq);
+  *ret_cache = cache;
+  return eslOK;
+
+ ERROR:
+  if (sq    != NULL) esl_sq_Destroy(sq);
+  if (cache != NULL) p7_seqcache_Close(cache);
+  *ret_cache = NULL;
+  return status;
+}
+
+
 
 
 
@@ -656,6 +899,163 @@ main(int argc, char **argv)
 #endif /*CACHEDB_UTEST2*/
 
 
+/*****************************************************************
+ * x. Test driver
+ *****************************************************************/
+
+#ifdef p7CACHEDB_TESTDRIVE
+/*
+  gcc -o cachedb_utest -std=gnu99 -g -O2 -I. -L. -I../easel -L../easel -Dp7CACHEDB_TESTDRIVE cachedb.c -lhmmer -leasel -lm 
+  ./cachedb_utest
+*/
+#include "p7_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_sqio.h"
+
+#include "hmmer.h"
+#include "cachedb.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",             0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for the sequence cache";
+
+/* write_cachefile()
+ * Write a one-database cache file of <nseq> short sequences to a new
+ * named tmpfile; <tmpfile> is its name template, filled in.
+ */
+static void
+write_cachefile(char *tmpfile, int nseq, char *id)
+{
+  FILE *fp;
+  int   i;
+
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal("cachedb: tmpfile failed");
+  fprintf(fp, "#%d %d 1 %d %d %s\n", nseq * 10, nseq, nseq, nseq, id);
+  for (i = 1; i <= nseq; i++)
+    fprintf(fp, ">%09d 1\nACDEFGHIK%c\n", i, "LMNPQRSTVW"[i % 10]);
+  fclose(fp);
+}
+
+/* Append a delta to a cache: every sequence must keep a unique
+ * numeric name, the names must be exactly 1..count, and each
+ * sequence's <idx> must match its name.
+ */
+static void
+utest_append(void)
+{
+  char         msg[]         = "cachedb append unit test failed";
+  char         basefile[16]  = "esltmpXXXXXX";
+  char         deltafile[16] = "esltmpXXXXXX";
+  P7_SEQCACHE *cache         = NULL;
+  P7_SEQCACHE *delta         = NULL;
+  char        *seen          = NULL;
+  int          nbase         = 7;
+  int          ndelta        = 4;
+  int          i, k;
+  char         errbuf[eslERRBUFSIZE];
+
+  write_cachefile(basefile,  nbase,  "base");
+  write_cachefile(deltafile, ndelta, "delta");
+  if (p7_seqcache_Open(basefile,  &cache, errbuf)  != eslOK) esl_fatal(msg);
+  if (p7_seqcache_Open(deltafile, &delta, errbuf)  != eslOK) esl_fatal(msg);
+  if (p7_seqcache_Append(cache, delta, errbuf)     != eslOK) esl_fatal(msg);
+  if (cache->count != nbase + ndelta)                        esl_fatal(msg);
+  if (cache->db[0].count != nbase + ndelta)                  esl_fatal(msg);
+  for (i = 0; i < cache->count; i++)
+    if (cache->db[0].list[i]->acc != NULL)                   esl_fatal(msg);
+
+  if ((seen = calloc(cache->count + 1, sizeof(char))) == NULL) esl_fatal(msg);
+  for (i = 0; i < cache->db[0].count; i++)
+    {
+      k = atoi(cache->db[0].list[i]->name);
+      if (k < 1 || k > cache->count)        esl_fatal(msg);
+      if (seen[k])                          esl_fatal(msg);
+      if (cache->db[0].list[i]->idx != k)   esl_fatal(msg);
+      seen[k] = TRUE;
+    }
+
+  free(seen);
+  p7_seqcache_Close(cache);   /* closes <delta> too */
+  remove(basefile);
+  remove(deltafile);
+}
+
+/* Read a small FASTA file: names, accessions and descriptions come
+ * back in file order, and each sequence's residues sit between
+ * sentinels.
+ */
+static void
+utest_read(void)
+{
+  char          msg[]        = "cachedb read unit test failed";
+  char          tmpfile[16]  = "esltmpXXXXXX";
+  char         *name[]       = { "seq1", "seq2", "seq3" };
+  char         *desc[]       = { "first sequence", "", "third one" };
+  char         *seq[]        = { "ACDEFGHIKL", "MNPQRSTVWY", "ACDXYW" };
+  int           nseq         = 3;
+  ESL_ALPHABET *abc          = esl_alphabet_Create(eslAMINO);
+  ESL_SQFILE   *sqfp         = NULL;
+  P7_SEQCACHE  *cache        = NULL;
+  ESL_DSQ      *dsq          = NULL;
+  FILE         *fp;
+  int           i;
+  char          errbuf[eslERRBUFSIZE];
+
+  if (esl_tmpfile_named(tmpfile, &fp) != eslOK) esl_fatal(msg);
+  for (i = 0; i < nseq; i++)
+    fprintf(fp, ">%s%s%s\n%s\n", name[i], (desc[i][0] ? " " : ""), desc[i], seq[i]);
+  fclose(fp);
+
+  if (esl_sqfile_OpenDigital(abc, tmpfile, eslSQFILE_FASTA, NULL, &sqfp) != eslOK) esl_fatal(msg);
+  if (p7_seqcache_Read(sqfp, &cache, errbuf) != eslOK)                             esl_fatal(msg);
+  if (cache->count != nseq)                                                        esl_fatal(msg);
+
+  for (i = 0; i < nseq; i++)
+    {
+      if (strcmp(cache->list[i].name, name[i]) != 0)                  esl_fatal(msg);
+      if (cache->list[i].acc == NULL || cache->list[i].acc[0] != '\0') esl_fatal(msg);
+      if (strcmp(cache->list[i].desc, desc[i]) != 0)                  esl_fatal(msg);
+      if (cache->list[i].idx != i+1)                                  esl_fatal(msg);
+      if (cache->list[i].n   != (int64_t) strlen(seq[i]))                       esl_fatal(msg);
+
+      if (esl_abc_CreateDsq(abc, seq[i], &dsq) != eslOK)              esl_fatal(msg);
+      if (cache->list[i].dsq[0]                    != eslDSQ_SENTINEL) esl_fatal(msg);
+      if (cache->list[i].dsq[cache->list[i].n + 1] != eslDSQ_SENTINEL) esl_fatal(msg);
+      if (memcmp(cache->list[i].dsq, dsq, cache->list[i].n + 2) != 0) esl_fatal(msg);
+      free(dsq);
+    }
+
+  p7_seqcache_Close(cache);
+  esl_sqfile_Close(sqfp);
+  esl_alphabet_Destroy(abc);
+  remove(tmpfile);
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS *go = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+
+  utest_append();
+  utest_read();
+
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*p7CACHEDB_TESTDRIVE*/
+
+
 
 /*****************************************************************
  * @LICENSE@
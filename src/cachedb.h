@@ -8,6 +8,7 @@ typedef struct {
   int64_t  idx;	                   /* ctr for this seq                      */
   uint64_t db_key;                 /* flag for included databases           */
   char    *desc;                   /* description                           */
+  char    *acc;                    /* accession; NULL if not kept           */
 } HMMER_SEQ;
 
 typedef struct {
@@ -16,7 +17,7 @@ typedef struct {
   HMMER_SEQ         **list;        /* list of sequences [0 .. count-1]      */
 } SEQ_DB;
 
-typedef struct {
+typedef struct p7_seqcache_s {
   char               *name;        /* name of the seq database              */
   char               *id;          /* unique identifier string              */
   uint32_t            db_cnt;      /* number of sub databases               */
@@ -25,17 +26,25 @@ typedef struct {
   ESL_ALPHABET       *abc;         /* alphabet for database                 */
 
   uint32_t            count;       /* total number of sequences             */
-  HMMER_SEQ          *list;        /* complete list of sequences (count)    */
+  HMMER_SEQ          *list;        /* list of sequences (count, less any in <next>) */
   void               *residue_mem; /* memory holding the residues           */
   char               *header_mem;  /* memory holding the header strings     */
 
   uint64_t            res_size;    /* size of residue memory allocation     */
   uint64_t            hdr_size;    /* size of header memory allocation      */
+
+  int                 nparts;      /* # of parts residue_mem was split into, or 0   */
+  uint32_t           *part_end;    /* part k holds list[part_end[k-1]..part_end[k]-1] */
+  void              **part_mem;    /* residues of each part; residue_mem is then NULL */
+
+  struct p7_seqcache_s *next;      /* deltas appended to this cache, or NULL */
 } P7_SEQCACHE;
 
 
 
 extern int    p7_seqcache_Open(char *seqfile, P7_SEQCACHE **ret_cache, char *errbuf);
+extern int    p7_seqcache_Read(ESL_SQFILE *sqfp, P7_SEQCACHE **ret_cache, char *errbuf);
+extern int    p7_seqcache_Append(P7_SEQCACHE *cache, P7_SEQCACHE *delta, char *errbuf);
 extern void   p7_seqcache_Close(P7_SEQCACHE *cache);
 
 #endif /*P7_CACHEDB_INCLUDED*/
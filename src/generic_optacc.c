@@ -3,11 +3,12 @@
  * Contents:
  *   1. Optimal alignment accuracy fill.
  *   2. Optimal alignment accuracy traceback.
- *   3. Benchmark driver
- *   4. Unit tests
- *   5. Test driver
- *   6. Example
- *   7. Copyright and license information
+ *   3. Optimal accuracy alignment in checkpointed memory.
+ *   4. Benchmark driver
+ *   5. Unit tests
+ *   6. Test driver
+ *   7. Example
+ *   8. Copyright and license information
  * 
  * SRE, Fri Feb 29 12:48:46 2008 [Janelia]
  * SVN $Id$
@@ -16,6 +17,8 @@
 #include "p7_config.h"
 
 #include <float.h>
+#include <math.h>
+#include <string.h>
 
 #include "easel.h"
 #include "esl_vectorops.h"
@@ -369,10 +372,528 @@ select_b(const P7_PROFILE *gm, const P7_GMX *gx, int i)
 /*------------------------ end, oa traceback --------------------*/
 
 
+/*****************************************************************
+ * 3. Optimal accuracy alignment in checkpointed memory
+ *****************************************************************/
+
+/* p7_GOptimalAccuracy() and p7_GOATrace() need a posterior decoding
+ * matrix and an OA matrix, each M x L; for a titin against a large
+ * model that's more memory than we may have. p7_GOATraceCheckpointed()
+ * obtains the same trace in O(M sqrt(L)) memory.
+ *
+ * The target is cut into <nb> blocks of <B> ~ sqrt(L) rows. Forward
+ * and Backward are each run once in two rolling rows, saving the last
+ * Forward row and the first Backward row of each block. The special
+ * states (ENJBC) of all four matrices are kept for every row, since
+ * they're only O(L). Then each block is recomputed from its
+ * checkpoints -- Backward, Forward, decoding, OA fill -- first for
+ * blocks 1..nb in order, to save the last OA row of each block, and
+ * again for blocks nb..1 as the traceback passes through them.
+ *
+ * Each row is calculated with exactly the arithmetic of
+ * p7_GForward(), p7_GBackward(), p7_GDecoding() and
+ * p7_GOptimalAccuracy(), so every cell the traceback looks at has the
+ * same value it has in the full matrices, and the trace is identical.
+ *
+ * The row calculations work on "view" P7_GMX's, whose dp[0..L] row
+ * pointers are only valid for the block that's currently loaded (and
+ * the checkpoint row before it). That way the {MDI}MX() macros and the
+ * select_*() traceback routines above work unchanged.
+ */
+typedef struct {
+  int      M, L;
+  int      B;			/* block height, in rows                         */
+  int      nb;			/* number of blocks: rows 1..L in blocks 0..nb-1  */
+  int      s, e;		/* block currently loaded covers rows s..e        */
+
+  P7_GMX   fwd;			/* views. pp.dp is bck.dp: decoding overwrites the */
+  P7_GMX   bck;			/*   Backward rows of a block in place, as         */
+  P7_GMX   pp;			/*   p7_GDecoding() allows.                        */
+  P7_GMX   oa;
+
+  float   *fwd0;		/* Forward row 0                                  */
+  float   *oa0;			/* OA row 0                                       */
+  float  **fwdblk;		/* [0..B-1] rows of the loaded block              */
+  float  **bckblk;
+  float  **oablk;
+  float  **fwdck;		/* [j] = Forward row e_j, last row of block j     */
+  float  **bckck;		/* [j] = Backward row s_j, first row of block j   */
+  float  **oack;		/* [j] = OA row e_j                               */
+
+  float   *dp_mem;		/* all the rows above                             */
+  float  **rowp;		/* pointers into dp_mem for blk/ck arrays         */
+  float  **dpp_mem;		/* row pointer arrays of the views                */
+  float   *xmx_mem;		/* special states of the views                    */
+} OACHK;
+
+static inline void
+chk_fwd_row0(const P7_PROFILE *gm, P7_GMX *gx)
+{
+  float **dp  = gx->dp;
+  float  *xmx = gx->xmx;
+  int     M   = gm->M;
+  int     k;
+
+  XMX(0,p7G_N) = 0;                                           /* S->N, p=1            */
+  XMX(0,p7G_B) = gm->xsc[p7P_N][p7P_MOVE];                    /* S->N->B, no N-tail   */
+  XMX(0,p7G_E) = XMX(0,p7G_C) = XMX(0,p7G_J) = -eslINFINITY;  /* need seq to get here */
+  for (k = 0; k <= M; k++)
+    MMX(0,k) = IMX(0,k) = DMX(0,k) = -eslINFINITY;            /* need seq to get here */
+}
+
+/* Forward row i from row i-1; same as the recursion in p7_GForward() */
+static inline void
+chk_fwd_row(const ESL_DSQ *dsq, const P7_PROFILE *gm, P7_GMX *gx, int i)
+{
+  float const *tsc  = gm->tsc;
+  float const *rsc  = gm->rsc[dsq[i]];
+  float      **dp   = gx->dp;
+  float       *xmx  = gx->xmx;
+  int          M    = gm->M;
+  float        esc  = p7_profile_IsLocal(gm) ? 0 : -eslINFINITY;
+  float        sc;
+  int          k;
+
+  MMX(i,0) = IMX(i,0) = DMX(i,0) = -eslINFINITY;
+  XMX(i, p7G_E) = -eslINFINITY;
+
+  for (k = 1; k < M; k++)
+    {
+      sc = p7_FLogsum(p7_FLogsum(MMX(i-1,k-1)   + TSC(p7P_MM,k-1), 
+				 IMX(i-1,k-1)   + TSC(p7P_IM,k-1)),
+		      p7_FLogsum(XMX(i-1,p7G_B) + TSC(p7P_BM,k-1),
+				 DMX(i-1,k-1)   + TSC(p7P_DM,k-1)));
+      MMX(i,k) = sc + MSC(k);
+
+      sc = p7_FLogsum(MMX(i-1,k) + TSC(p7P_MI,k),
+		      IMX(i-1,k) + TSC(p7P_II,k));
+      IMX(i,k) = sc + ISC(k);
+
+      DMX(i,k) = p7_FLogsum(MMX(i,k-1) + TSC(p7P_MD,k-1),
+			    DMX(i,k-1) + TSC(p7P_DD,k-1));
+
+      XMX(i,p7G_E) = p7_FLogsum(p7_FLogsum(MMX(i,k) + esc,
+					   DMX(i,k) + esc),
+			                   XMX(i,p7G_E));
+    }
+  sc = p7_FLogsum(p7_FLogsum(MMX(i-1,M-1)   + TSC(p7P_MM,M-1), 
+			     IMX(i-1,M-1)   + TSC(p7P_IM,M-1)),
+		  p7_FLogsum(XMX(i-1,p7G_B) + TSC(p7P_BM,M-1),
+			     DMX(i-1,M-1)   + TSC(p7P_DM,M-1)));
+  MMX(i,M) = sc + MSC(M);
+  IMX(i,M) = -eslINFINITY;
+
+  DMX(i,M) = p7_FLogsum(MMX(i,M-1) + TSC(p7P_MD,M-1),
+			DMX(i,M-1) + TSC(p7P_DD,M-1));
+
+  XMX(i,p7G_E) = p7_FLogsum(p7_FLogsum(MMX(i,M),
+				       DMX(i,M)),
+			               XMX(i,p7G_E));
+
+  XMX(i,p7G_J) = p7_FLogsum(XMX(i-1,p7G_J) + gm->xsc[p7P_J][p7P_LOOP],
+			    XMX(i,  p7G_E) + gm->xsc[p7P_E][p7P_LOOP]);
+  XMX(i,p7G_C) = p7_FLogsum(XMX(i-1,p7G_C) + gm->xsc[p7P_C][p7P_LOOP],
+			    XMX(i,  p7G_E) + gm->xsc[p7P_E][p7P_MOVE]);
+  XMX(i,p7G_N) = XMX(i-1,p7G_N) + gm->xsc[p7P_N][p7P_LOOP];
+  XMX(i,p7G_B) = p7_FLogsum(XMX(i,  p7G_N) + gm->xsc[p7P_N][p7P_MOVE],
+			    XMX(i,  p7G_J) + gm->xsc[p7P_J][p7P_MOVE]);
+}
+
+/* Backward row L; same as the initialization in p7_GBackward() */
+static inline void
+chk_bck_rowL(const P7_PROFILE *gm, P7_GMX *gx, int L)
+{
+  float const *tsc  = gm->tsc;
+  float      **dp   = gx->dp;
+  float       *xmx  = gx->xmx;
+  int          M    = gm->M;
+  float        esc  = p7_profile_IsLocal(gm) ? 0 : -eslINFINITY;
+  int          k;
+
+  XMX(L,p7G_J) = XMX(L,p7G_B) = XMX(L,p7G_N) = -eslINFINITY;
+  XMX(L,p7G_C) = gm->xsc[p7P_C][p7P_MOVE];
+  XMX(L,p7G_E) = XMX(L,p7G_C) + gm->xsc[p7P_E][p7P_MOVE];
+  
+  MMX(L,M) = DMX(L,M) = XMX(L,p7G_E);
+  IMX(L,M) = -eslINFINITY;
+  for (k = M-1; k >= 1; k--) {
+    MMX(L,k) = p7_FLogsum( XMX(L,p7G_E) + esc,
+			   DMX(L, k+1)  + TSC(p7P_MD,k));
+    DMX(L,k) = p7_FLogsum( XMX(L,p7G_E) + esc,
+			   DMX(L, k+1)  + TSC(p7P_DD,k));
+    IMX(L,k) = -eslINFINITY;
+  }
+}
+
+/* Backward row i<L from row i+1; same as the recursion in p7_GBackward() */
+static inline void
+chk_bck_row(const ESL_DSQ *dsq, const P7_PROFILE *gm, P7_GMX *gx, int i)
+{
+  float const *tsc  = gm->tsc;
+  float const *rsc  = gm->rsc[dsq[i+1]];
+  float      **dp   = gx->dp;
+  float       *xmx  = gx->xmx;
+  int          M    = gm->M;
+  float        esc  = p7_profile_IsLocal(gm) ? 0 : -eslINFINITY;
+  int          k;
+
+  XMX(i,p7G_B) = MMX(i+1,1) + TSC(p7P_BM,0) + MSC(1);
+  for (k = 2; k <= M; k++)
+    XMX(i,p7G_B) = p7_FLogsum(XMX(i, p7G_B), MMX(i+1,k) + TSC(p7P_BM,k-1) + MSC(k));
+
+  XMX(i,p7G_J) = p7_FLogsum( XMX(i+1,p7G_J) + gm->xsc[p7P_J][p7P_LOOP],
+			     XMX(i,  p7G_B) + gm->xsc[p7P_J][p7P_MOVE]);
+  XMX(i,p7G_C) = XMX(i+1,p7G_C) + gm->xsc[p7P_C][p7P_LOOP];
+  XMX(i,p7G_E) = p7_FLogsum( XMX(i, p7G_J)  + gm->xsc[p7P_E][p7P_LOOP],
+			     XMX(i, p7G_C)  + gm->xsc[p7P_E][p7P_MOVE]);
+  XMX(i,p7G_N) = p7_FLogsum( XMX(i+1,p7G_N) + gm->xsc[p7P_N][p7P_LOOP],
+			     XMX(i,  p7G_B) + gm->xsc[p7P_N][p7P_MOVE]);
+
+  MMX(i,M) = DMX(i,M) = XMX(i,p7G_E);
+  IMX(i,M) = -eslINFINITY;
+  for (k = M-1; k >= 1; k--)
+    {
+      MMX(i,k) = p7_FLogsum( p7_FLogsum(MMX(i+1,k+1) + TSC(p7P_MM,k) + MSC(k+1),
+					IMX(i+1,k)   + TSC(p7P_MI,k) + ISC(k)),
+			     p7_FLogsum(XMX(i,p7G_E) + esc,
+					DMX(i,  k+1) + TSC(p7P_MD,k)));
+      IMX(i,k) = p7_FLogsum( MMX(i+1,k+1) + TSC(p7P_IM,k) + MSC(k+1),
+			     IMX(i+1,k)   + TSC(p7P_II,k) + ISC(k));
+      DMX(i,k) = p7_FLogsum( MMX(i+1,k+1) + TSC(p7P_DM,k) + MSC(k+1),
+			     p7_FLogsum( DMX(i,  k+1)  + TSC(p7P_DD,k),
+					 XMX(i, p7G_E) + esc));
+    }
+}
+
+/* Posterior decoding of row i; same as the loop body in p7_GDecoding() */
+static inline void
+chk_decode_row(const P7_PROFILE *gm, const P7_GMX *fwd, const P7_GMX *bck, P7_GMX *pp, int i, float overall_sc)
+{
+  float **dp   = pp->dp;
+  float  *xmx  = pp->xmx;
+  int     M    = gm->M;
+  float   denom = 0.0;
+  int     k;
+
+  MMX(i,0) = IMX(i,0) = DMX(i,0) = 0.0;
+  for (k = 1; k < M; k++)
+    {
+      MMX(i,k) = expf(fwd->dp[i][k*p7G_NSCELLS + p7G_M] + bck->dp[i][k*p7G_NSCELLS + p7G_M] - overall_sc); denom += MMX(i,k);
+      IMX(i,k) = expf(fwd->dp[i][k*p7G_NSCELLS + p7G_I] + bck->dp[i][k*p7G_NSCELLS + p7G_I] - overall_sc); denom += IMX(i,k);
+      DMX(i,k) = 0.;
+    }
+  MMX(i,M)     = expf(fwd->dp[i][M*p7G_NSCELLS + p7G_M] + bck->dp[i][M*p7G_NSCELLS + p7G_M] - overall_sc); denom += MMX(i,M);
+  IMX(i,M)     = 0.;
+  DMX(i,M)     = 0.;
+      
+  XMX(i,p7G_E) = 0.;
+  XMX(i,p7G_N) = expf(fwd->xmx[p7G_NXCELLS*(i-1) + p7G_N] + bck->xmx[p7G_NXCELLS*i + p7G_N] + gm->xsc[p7P_N][p7P_LOOP] - overall_sc);
+  XMX(i,p7G_J) = expf(fwd->xmx[p7G_NXCELLS*(i-1) + p7G_J] + bck->xmx[p7G_NXCELLS*i + p7G_J] + gm->xsc[p7P_J][p7P_LOOP] - overall_sc);
+  XMX(i,p7G_B) = 0.;
+  XMX(i,p7G_C) = expf(fwd->xmx[p7G_NXCELLS*(i-1) + p7G_C] + bck->xmx[p7G_NXCELLS*i + p7G_C] + gm->xsc[p7P_C][p7P_LOOP] - overall_sc);
+  denom += XMX(i,p7G_N) + XMX(i,p7G_J) + XMX(i,p7G_C);
+      
+  denom = 1.0 / denom;
+  for (k = 1; k < M; k++) {  MMX(i,k) *= denom; IMX(i,k) *= denom; }
+  MMX(i,M)     *= denom;
+  XMX(i,p7G_N) *= denom;
+  XMX(i,p7G_J) *= denom;
+  XMX(i,p7G_C) *= denom;
+}
+
+static inline void
+chk_oa_row0(const P7_PROFILE *gm, P7_GMX *gx)
+{
+  float **dp  = gx->dp;
+  float  *xmx = gx->xmx;
+  int     M   = gm->M;
+  int     k;
+
+  XMX(0,p7G_N) = 0.;
+  XMX(0,p7G_B) = 0.;
+  XMX(0,p7G_E) = XMX(0,p7G_C) = XMX(0,p7G_J) = -eslINFINITY;
+  for (k = 0; k <= M; k++)
+    MMX(0,k) = IMX(0,k) = DMX(0,k) = -eslINFINITY;
+}
+
+/* OA row i from row i-1; same as the loop body in p7_GOptimalAccuracy() */
+static inline void
+chk_oa_row(const P7_PROFILE *gm, const P7_GMX *pp, P7_GMX *gx, int i)
+{
+  float      **dp   = gx->dp;
+  float       *xmx  = gx->xmx;
+  float const *tsc  = gm->tsc;
+  int          M    = gm->M;
+  float        esc  = p7_profile_IsLocal(gm) ? 1.0 : 0.0;
+  float        t1, t2;
+  int          k;
+
+  MMX(i,0) = IMX(i,0) = DMX(i,0) = XMX(i,p7G_E) = -eslINFINITY;
+
+  for (k = 1; k < M; k++)
+    {
+      MMX(i,k)     = ESL_MAX(ESL_MAX(TSCDELTA(p7P_MM, k-1) * (MMX(i-1,k-1)  + pp->dp[i][k*p7G_NSCELLS + p7G_M]),
+				     TSCDELTA(p7P_IM, k-1) * (IMX(i-1,k-1)  + pp->dp[i][k*p7G_NSCELLS + p7G_M])),
+			     ESL_MAX(TSCDELTA(p7P_DM, k-1) * (DMX(i-1,k-1)  + pp->dp[i][k*p7G_NSCELLS + p7G_M]),
+				     TSCDELTA(p7P_BM, k-1) * (XMX(i-1,p7G_B)+ pp->dp[i][k*p7G_NSCELLS + p7G_M])));
+
+      XMX(i,p7G_E) = ESL_MAX(XMX(i,p7G_E), 
+			     esc * MMX(i,k));
+
+      IMX(i,k)     = ESL_MAX(TSCDELTA(p7P_MI, k) * (MMX(i-1,k) + pp->dp[i][k*p7G_NSCELLS + p7G_I]),
+			     TSCDELTA(p7P_II, k) * (IMX(i-1,k) + pp->dp[i][k*p7G_NSCELLS + p7G_I]));
+
+      DMX(i,k)     = ESL_MAX(TSCDELTA(p7P_MD, k-1) * MMX(i,k-1),
+			     TSCDELTA(p7P_DD, k-1) * DMX(i,k-1));
+    } 
+
+  MMX(i,M)     = ESL_MAX(ESL_MAX(TSCDELTA(p7P_MM, M-1) * (MMX(i-1,M-1)  + pp->dp[i][M*p7G_NSCELLS + p7G_M]),
+				 TSCDELTA(p7P_IM, M-1) * (IMX(i-1,M-1)  + pp->dp[i][M*p7G_NSCELLS + p7G_M])),
+			 ESL_MAX(TSCDELTA(p7P_DM, M-1) * (DMX(i-1,M-1)  + pp->dp[i][M*p7G_NSCELLS + p7G_M]),
+				 TSCDELTA(p7P_BM, M-1) * (XMX(i-1,p7G_B)+ pp->dp[i][M*p7G_NSCELLS + p7G_M])));
+
+  DMX(i,M)     = ESL_MAX(TSCDELTA(p7P_MD, M-1) * MMX(i,M-1),
+			 TSCDELTA(p7P_DD, M-1) * DMX(i,M-1));
+
+  XMX(i,p7G_E) = ESL_MAX(XMX(i,p7G_E), ESL_MAX(MMX(i,M), DMX(i, M)));
+
+  t1 = ( (gm->xsc[p7P_J][p7P_LOOP] == -eslINFINITY) ? FLT_MIN : 1.0);
+  t2 = ( (gm->xsc[p7P_E][p7P_LOOP] == -eslINFINITY) ? FLT_MIN : 1.0);
+  XMX(i, p7G_J) = ESL_MAX( t1 * (XMX(i-1,p7G_J) + pp->xmx[i*p7G_NXCELLS + p7G_J]),
+			   t2 * XMX(i,  p7G_E));
+
+  t1 = ( (gm->xsc[p7P_C][p7P_LOOP] == -eslINFINITY) ? FLT_MIN : 1.0);
+  t2 = ( (gm->xsc[p7P_E][p7P_MOVE] == -eslINFINITY) ? FLT_MIN : 1.0);
+  XMX(i,p7G_C) = ESL_MAX( t1 * (XMX(i-1,p7G_C) + pp->xmx[i*p7G_NXCELLS + p7G_C]),
+			  t2 * XMX(i,  p7G_E));
+      
+  t1 = ( (gm->xsc[p7P_N][p7P_LOOP] == -eslINFINITY) ? FLT_MIN : 1.0);
+  XMX(i,p7G_N) = t1 *  (XMX(i-1,p7G_N) + pp->xmx[i*p7G_NXCELLS + p7G_N]);
+
+  t1 = ( (gm->xsc[p7P_N][p7P_MOVE] == -eslINFINITY) ? FLT_MIN : 1.0);
+  t2 = ( (gm->xsc[p7P_J][p7P_MOVE] == -eslINFINITY) ? FLT_MIN : 1.0);
+  XMX(i,p7G_B) = ESL_MAX( t1 * XMX(i,  p7G_N), 
+			  t2 * XMX(i,  p7G_J));
+}
+
+/* chk_load_block()
+ * Recompute Backward, Forward, posterior decoding, and OA rows for
+ * block <j>, rows s..e, from the checkpoints; afterwards the views
+ * are valid for rows s..e, plus row s-1 of <fwd> and <oa>.
+ */
+static void
+chk_load_block(OACHK *c, const ESL_DSQ *dsq, const P7_PROFILE *gm, int j)
+{
+  float overall_sc = c->fwd.xmx[p7G_NXCELLS*c->L + p7G_C] + gm->xsc[p7P_C][p7P_MOVE];
+  int   s          = j * c->B + 1;
+  int   e          = ESL_MIN(s + c->B - 1, c->L);
+  int   i;
+
+  for (i = s; i <= e; i++) c->bck.dp[i] = c->bckblk[i-s];
+  if (e == c->L) { chk_bck_rowL(gm, &(c->bck), c->L); i = e-1; }
+  else           { c->bck.dp[e+1] = c->bckck[j+1];   i = e;   }
+  for (; i >= s; i--) chk_bck_row(dsq, gm, &(c->bck), i);
+
+  c->fwd.dp[s-1] = (j == 0 ? c->fwd0 : c->fwdck[j-1]);
+  for (i = s; i <= e; i++) 
+    {
+      c->fwd.dp[i] = c->fwdblk[i-s];
+      chk_fwd_row(dsq, gm, &(c->fwd), i);
+    }
+
+  for (i = s; i <= e; i++) 
+    chk_decode_row(gm, &(c->fwd), &(c->bck), &(c->pp), i, overall_sc);
+
+  c->oa.dp[s-1] = (j == 0 ? c->oa0 : c->oack[j-1]);
+  for (i = s; i <= e; i++)
+    {
+      c->oa.dp[i] = c->oablk[i-s];
+      chk_oa_row(gm, &(c->pp), &(c->oa), i);
+    }
+
+  c->s = s;
+  c->e = e;
+}
+
+
+/* Function:  p7_GOATraceCheckpointed()
+ * Synopsis:  Optimal accuracy alignment of one sequence, in O(M sqrt(L)) memory.
+ *
+ * Purpose:   Align digital sequence <dsq> of length <L> to profile <gm>
+ *            by optimal accuracy, and put the traceback in <tr>. Gives
+ *            the same trace as <p7_GForward()>, <p7_GBackward()>,
+ *            <p7_GDecoding()>, <p7_GOptimalAccuracy()>, and
+ *            <p7_GOATrace()> do in full matrices, but keeps only about
+ *            $6\sqrt{L}$ DP rows of <(M+1)*p7G_NSCELLS> floats, at the
+ *            cost of computing Forward and Backward about three times
+ *            and the OA fill twice. See the notes above.
+ *
+ *            Caller has configured the length model of <gm> for <L>
+ *            (<p7_ReconfigLength()>) and provides an empty trace <tr>,
+ *            allocated with posterior probability annotation
+ *            (<p7_trace_CreateWithPP()>).
+ *
+ *            Like <p7_GForward()>, this calls <p7_FLogsumInit()>.
+ *
+ * Args:      dsq      - digital target sequence, 1..L
+ *            L        - length of <dsq>; >= 1
+ *            gm       - query profile
+ *            tr       - RESULT: OA traceback, with posterior probs
+ *            opt_oasc - optRETURN: OA score, the expected number of
+ *                       correctly aligned residues
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslEINVAL> if the
+ *            traceback fails. <tr> is undefined.
+ */
+int
+p7_GOATraceCheckpointed(const ESL_DSQ *dsq, int L, const P7_PROFILE *gm, P7_TRACE *tr, float *opt_oasc)
+{
+  OACHK   c;
+  int     M    = gm->M;
+  int     W    = (M+1) * p7G_NSCELLS;	/* floats per DP row */
+  int     nrows;
+  float  *roll[2];
+  int     i, j, k, r;
+  float   postprob;
+  int     sprv, scur;
+  int     status;
+
+  c.dp_mem  = NULL;
+  c.rowp    = NULL;
+  c.dpp_mem = NULL;
+  c.xmx_mem = NULL;
+
+#ifdef p7_DEBUGGING
+  if (tr->N != 0) ESL_EXCEPTION(eslEINVAL, "trace isn't empty: forgot to Reuse()?");
+#endif
+
+  p7_FLogsumInit();
+
+  c.M  = M;
+  c.L  = L;
+  c.B  = ESL_MAX(1, (int) ceil(sqrt((double) L)));
+  c.nb = (L + c.B - 1) / c.B;
+  c.s  = c.e = -1;
+  nrows = 3*c.B + 3*c.nb + 2;
+
+  ESL_ALLOC(c.dp_mem,  sizeof(float)   * (size_t) nrows * (size_t) W);
+  ESL_ALLOC(c.rowp,    sizeof(float *) * nrows);
+  ESL_ALLOC(c.dpp_mem, sizeof(float *) * 3 * (L+1));
+  ESL_ALLOC(c.xmx_mem, sizeof(float)   * 4 * (L+1) * p7G_NXCELLS);
+
+  for (r = 0; r < nrows; r++) c.rowp[r] = c.dp_mem + (size_t) r * (size_t) W;
+  c.fwdblk = c.rowp;
+  c.bckblk = c.fwdblk + c.B;
+  c.oablk  = c.bckblk + c.B;
+  c.fwdck  = c.oablk  + c.B;
+  c.bckck  = c.fwdck  + c.nb;
+  c.oack   = c.bckck  + c.nb;
+  c.fwd0   = c.oack[c.nb];
+  c.oa0    = c.oack[c.nb+1];
+
+  for (i = 0; i < 3*(L+1); i++) c.dpp_mem[i] = NULL;
+  c.fwd.M   = c.bck.M  = c.pp.M  = c.oa.M  = M;
+  c.fwd.L   = c.bck.L  = c.pp.L  = c.oa.L  = L;
+  c.fwd.dp  = c.dpp_mem;
+  c.bck.dp  = c.dpp_mem + (L+1);
+  c.pp.dp   = c.bck.dp;
+  c.oa.dp   = c.dpp_mem + 2*(L+1);
+  c.fwd.xmx = c.xmx_mem;
+  c.bck.xmx = c.xmx_mem +   (L+1) * p7G_NXCELLS;
+  c.pp.xmx  = c.xmx_mem + 2*(L+1) * p7G_NXCELLS;
+  c.oa.xmx  = c.xmx_mem + 3*(L+1) * p7G_NXCELLS;
+
+  /* Forward, in two rolling rows, saving the last row of each block but the last */
+  roll[0] = c.fwdblk[0];
+  roll[1] = c.oablk[0];
+  c.fwd.dp[0] = c.fwd0;
+  chk_fwd_row0(gm, &(c.fwd));
+  for (i = 1; i <= L; i++)
+    {
+      c.fwd.dp[i] = roll[i%2];
+      chk_fwd_row(dsq, gm, &(c.fwd), i);
+      if (i % c.B == 0 && i < L) memcpy(c.fwdck[i/c.B - 1], c.fwd.dp[i], sizeof(float) * W);
+    }
+
+  /* Backward, likewise, saving the first row of each block but the first */
+  for (i = L; i >= 1; i--)
+    {
+      c.bck.dp[i] = roll[i%2];
+      if (i == L) chk_bck_rowL(gm, &(c.bck), L);
+      else        chk_bck_row(dsq, gm, &(c.bck), i);
+      if (i > 1 && (i-1) % c.B == 0) memcpy(c.bckck[(i-1)/c.B], c.bck.dp[i], sizeof(float) * W);
+    }
+
+  /* OA fill, block by block, saving the last OA row of each block but the last */
+  c.oa.dp[0] = c.oa0;
+  chk_oa_row0(gm, &(c.oa));
+  for (j = 0; j < c.nb; j++)
+    {
+      chk_load_block(&c, dsq, gm, j);
+      if (j < c.nb-1) memcpy(c.oack[j], c.oa.dp[c.e], sizeof(float) * W);
+    }
+
+  /* Traceback, as in p7_GOATrace(), reloading blocks as <i> leaves them.
+   * The last block is still loaded from the fill.
+   */
+  i = L;
+  k = 0;
+  if ((status = p7_trace_AppendWithPP(tr, p7T_T, k, i, 0.0)) != eslOK) goto ERROR;
+  if ((status = p7_trace_AppendWithPP(tr, p7T_C, k, i, 0.0)) != eslOK) goto ERROR;
+
+  sprv = p7T_C;
+  while (sprv != p7T_S) 
+    {
+      if (i >= 1 && i < c.s) chk_load_block(&c, dsq, gm, (i-1) / c.B);
+
+      switch (sprv) {
+      case p7T_M: scur = select_m(gm,           &(c.oa), i, k);  k--; i--; break;
+      case p7T_D: scur = select_d(gm,           &(c.oa), i, k);  k--;      break;
+      case p7T_I: scur = select_i(gm,           &(c.oa), i, k);       i--; break;
+      case p7T_N: scur = select_n(i);                                      break;
+      case p7T_C: scur = select_c(gm, &(c.pp), &(c.oa), i);                break;
+      case p7T_J: scur = select_j(gm, &(c.pp), &(c.oa), i);                break;
+      case p7T_E: scur = select_e(gm,           &(c.oa), i, &k);           break;
+      case p7T_B: scur = select_b(gm,           &(c.oa), i);               break;
+      default: ESL_XEXCEPTION(eslEINVAL, "bogus state in traceback");
+      }
+      if (scur == -1) ESL_XEXCEPTION(eslEINVAL, "OA traceback choice failed");
+
+      if (i >= 1 && i < c.s) chk_load_block(&c, dsq, gm, (i-1) / c.B);
+      postprob = get_postprob(&(c.pp), scur, sprv, k, i);
+      if ((status = p7_trace_AppendWithPP(tr, scur, k, i, postprob)) != eslOK) goto ERROR;
+
+      if ( (scur == p7T_N || scur == p7T_J || scur == p7T_C) && scur == sprv) i--;
+      sprv = scur;
+    }
+  tr->M = M;
+  tr->L = L;
+  if ((status = p7_trace_Reverse(tr)) != eslOK) goto ERROR;
+
+  if (opt_oasc) *opt_oasc = c.oa.xmx[L*p7G_NXCELLS + p7G_C];
+  free(c.dp_mem);
+  free(c.rowp);
+  free(c.dpp_mem);
+  free(c.xmx_mem);
+  return eslOK;
+
+ ERROR:
+  if (c.dp_mem)  free(c.dp_mem);
+  if (c.rowp)    free(c.rowp);
+  if (c.dpp_mem) free(c.dpp_mem);
+  if (c.xmx_mem) free(c.xmx_mem);
+  if (opt_oasc) *opt_oasc = 0.;
+  return status;
+}
+/*------------- end, checkpointed oa alignment ------------------*/
+
+
 
 
 /*****************************************************************
- * 3. Benchmark driver
+ * 4. Benchmark driver
  *****************************************************************/
 #ifdef p7GENERIC_OPTACC_BENCHMARK
 /*
@@ -481,19 +1002,144 @@ main(int argc, char **argv)
 
 
 /*****************************************************************
- * 4. Unit tests
+ * 5. Unit tests
  *****************************************************************/
 #ifdef p7GENERIC_OPTACC_TESTDRIVE
+#include "esl_random.h"
+#include "esl_randomseq.h"
+#include "esl_sq.h"
+
+/* utest_checkpointed()
+ * The checkpointed OA alignment must give exactly the trace that the
+ * full-matrix OA alignment does, on emitted (homologous) sequences
+ * and on random ones, in all configuration modes.
+ */
+static void
+utest_checkpointed(ESL_RANDOMNESS *rng, ESL_ALPHABET *abc, P7_HMM *hmm, P7_BG *bg, int mode, int nseq, int L)
+{
+  char        msg[] = "generic_optacc: checkpointed OA test failure";
+  P7_PROFILE *gm    = p7_profile_Create(hmm->M, abc);
+  ESL_SQ     *sq    = esl_sq_CreateDigital(abc);
+  ESL_DSQ    *dsq   = malloc(sizeof(ESL_DSQ) * (L+2));
+  P7_GMX     *gx1   = p7_gmx_Create(hmm->M, L);
+  P7_GMX     *gx2   = p7_gmx_Create(hmm->M, L);
+  P7_TRACE   *tr1   = p7_trace_CreateWithPP();
+  P7_TRACE   *tr2   = p7_trace_CreateWithPP();
+  ESL_DSQ    *tdsq;
+  int         tL;
+  float       oasc1, oasc2;
+  int         idx;
+
+  if (p7_ProfileConfig(hmm, bg, gm, L, mode) != eslOK) esl_fatal(msg);
+
+  for (idx = 0; idx < 2*nseq; idx++)
+    {
+      if (idx % 2) 
+	{ 
+	  do {
+	    if (p7_ProfileEmit(rng, hmm, gm, bg, sq, NULL) != eslOK) esl_fatal(msg);
+	  } while (sq->n == 0);
+	  tdsq = sq->dsq; tL = sq->n; 
+	}
+      else
+	{
+	  tL = 1 + esl_rnd_Roll(rng, L);
+	  if (esl_rsq_xfIID(rng, bg->f, abc->K, tL, dsq) != eslOK) esl_fatal(msg);
+	  tdsq = dsq;
+	}
+
+      if (p7_ReconfigLength(gm, tL)                     != eslOK) esl_fatal(msg);
+      if (p7_gmx_GrowTo(gx1, gm->M, tL)                 != eslOK) esl_fatal(msg);
+      if (p7_gmx_GrowTo(gx2, gm->M, tL)                 != eslOK) esl_fatal(msg);
+      if (p7_GForward (tdsq, tL, gm, gx1, NULL)         != eslOK) esl_fatal(msg);
+      if (p7_GBackward(tdsq, tL, gm, gx2, NULL)         != eslOK) esl_fatal(msg);
+      if (p7_GDecoding(gm, gx1, gx2, gx2)               != eslOK) esl_fatal(msg);
+      if (p7_GOptimalAccuracy(gm, gx2, gx1, &oasc1)     != eslOK) esl_fatal(msg);
+      if (p7_GOATrace(gm, gx2, gx1, tr1)                != eslOK) esl_fatal(msg);
+
+      if (p7_GOATraceCheckpointed(tdsq, tL, gm, tr2, &oasc2) != eslOK) esl_fatal(msg);
+
+      if (oasc1 != oasc2)                    esl_fatal(msg);
+      if (p7_trace_Compare(tr1, tr2, 0.0) != eslOK) esl_fatal(msg);
+
+      p7_trace_Reuse(tr1);
+      p7_trace_Reuse(tr2);
+      p7_gmx_Reuse(gx1);
+      p7_gmx_Reuse(gx2);
+      esl_sq_Reuse(sq);
+    }
 
+  p7_trace_Destroy(tr1);
+  p7_trace_Destroy(tr2);
+  p7_gmx_Destroy(gx1);
+  p7_gmx_Destroy(gx2);
+  p7_profile_Destroy(gm);
+  esl_sq_Destroy(sq);
+  free(dsq);
+}
 #endif /*p7GENERIC_OPTACC_TESTDRIVE*/
 /*------------------- end, unit tests ---------------------------*/
 
 
 /*****************************************************************
- * 5. Test driver
+ * 6. Test driver
  *****************************************************************/
 #ifdef p7GENERIC_OPTACC_TESTDRIVE
+/*
+   gcc -g -Wall -o generic_optacc_utest -Dp7GENERIC_OPTACC_TESTDRIVE -I. -I../easel -L. -L../easel generic_optacc.c -lhmmer -leasel -lm
+   ./generic_optacc_utest
+*/
+#include "p7_config.h"
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+
+#include "hmmer.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",           0 },
+  { "-s",        eslARG_INT,      "0", NULL, NULL,  NULL,  NULL, NULL, "set random number seed to <n>",                  0 },
+  { "-L",        eslARG_INT,    "200", NULL, "n>0", NULL,  NULL, NULL, "max length of random target seqs",               0 },
+  { "-M",        eslARG_INT,     "60", NULL, "n>0", NULL,  NULL, NULL, "length of sampled model",                        0 },
+  { "-N",        eslARG_INT,     "10", NULL, "n>0", NULL,  NULL, NULL, "number of target seqs of each kind",             0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "unit test driver for the generic optimal accuracy implementation";
 
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go   = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng  = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc  = NULL;
+  P7_HMM         *hmm  = NULL;
+  P7_BG          *bg   = NULL;
+  int             M    = esl_opt_GetInteger(go, "-M");
+  int             L    = esl_opt_GetInteger(go, "-L");
+  int             N    = esl_opt_GetInteger(go, "-N");
+
+  p7_FLogsumInit();
+
+  if ((abc = esl_alphabet_Create(eslAMINO))  == NULL)  esl_fatal("failed to create alphabet");
+  if (p7_hmm_Sample(rng, M, abc, &hmm)       != eslOK) esl_fatal("failed to sample an HMM");
+  if ((bg = p7_bg_Create(abc))               == NULL)  esl_fatal("failed to create null model");
+
+  utest_checkpointed(rng, abc, hmm, bg, p7_LOCAL,    N, L);
+  utest_checkpointed(rng, abc, hmm, bg, p7_UNILOCAL, N, L);
+  utest_checkpointed(rng, abc, hmm, bg, p7_GLOCAL,   N, L);
+  utest_checkpointed(rng, abc, hmm, bg, p7_UNIGLOCAL,N, L);
+
+  p7_bg_Destroy(bg);
+  p7_hmm_Destroy(hmm);
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
 #endif /*p7GENERIC_OPTACC_TESTDRIVE*/
 /*------------------ end, test driver ---------------------------*/
 
@@ -501,7 +1147,7 @@ main(int argc, char **argv)
 
 
 /*****************************************************************
- * 6. Example
+ * 7. Example
  *****************************************************************/
 #ifdef p7GENERIC_OPTACC_EXAMPLE
 /* 
@@ -15,6 +15,10 @@
 #include "esl_sqio.h"
 #include "esl_vectorops.h"
 
+#ifdef HMMER_THREADS
+#include "esl_threads.h"
+#endif /*HMMER_THREADS*/
+
 #include "hmmer.h"
 
 static int map_alignment(const char *msafile, const P7_HMM *hmm, ESL_SQ ***ret_sq, P7_TRACE ***ret_tr, int *ret_ntot);
@@ -34,6 +38,10 @@ static ESL_OPTIONS options[] = {
   { "--rna",       eslARG_NONE,     FALSE,     NULL, NULL, ALPHOPTS,  NULL,  NULL, "assert <seqfile>, <hmmfile> both RNA: no autodetection",      2 },
   { "--informat",  eslARG_STRING,    NULL,     NULL, NULL,   NULL,    NULL,  NULL, "assert <seqfile> is in format <s>: no autodetection",            2 },
   { "--outformat", eslARG_STRING, "Stockholm", NULL, NULL,   NULL,    NULL,  NULL, "output alignment in format <s>",                                    2 },
+  { "--mxsize",    eslARG_REAL,        "0", NULL, "x>=0",  NULL,    NULL,  NULL, "use checkpointed DP for seqs needing > <x> Mb of DP matrix (0=never)", 2 },
+#ifdef HMMER_THREADS
+  { "--cpu",       eslARG_INT,       NULL,"HMMER_NCPU","n>=0",NULL,   NULL,  NULL, "number of parallel CPU workers to use for multithreads",            2 },
+#endif
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
 
@@ -95,6 +103,8 @@ main(int argc, char **argv)
   P7_TRACE    **tr      = NULL;	/* array of tracebacks             */
   ESL_MSA      *msa     = NULL;	/* resulting multiple alignment    */
   int           msaopts = 0;	/* flags to p7_tracealign_Seqs()   */
+  int           ncpus   = 0;	/* # of worker threads; 0=serial   */
+  int64_t       ramlimit;	/* max DP matrix bytes per thread  */
   int           idx;		/* counter over seqs, traces       */
   int           status;		/* easel/hmmer return code         */
   char          errbuf[eslERRBUFSIZE];
@@ -197,7 +207,16 @@ main(int argc, char **argv)
   for (idx = mapseq; idx < totseq; idx++)
     tr[idx] = p7_trace_CreateWithPP();
 
-  p7_tracealign_computeTraces(hmm, sq, mapseq, totseq - mapseq, tr);
+#ifdef HMMER_THREADS
+  if (esl_opt_IsOn(go, "--cpu")) ncpus = esl_opt_GetInteger(go, "--cpu");
+  else                           esl_threads_CPUCount(&ncpus);
+#endif
+
+  ramlimit = (int64_t) (esl_opt_GetReal(go, "--mxsize") * 1024. * 1024.);
+
+  /* Traces land in tr[] by sequence index, so the MSA is the same for any <ncpus> */
+  if ((status = p7_tracealign_computeTracesThreaded(hmm, sq, mapseq, totseq - mapseq, tr, ncpus, ramlimit)) != eslOK)
+    p7_Fail("Failed to compute alignment traces (error %d)\n", status);
 
   p7_tracealign_Seqs(sq, tr, totseq, hmm->M, msaopts, hmm, &msa);
 
@@ -0,0 +1,77 @@
+/* hmmbin2tbl: convert binary hit output (--binout) to tabular form.
+ *
+ * Reads the compact per-query hit blocks written by hmmsearch/hmmscan
+ * --binout, and prints them in the same format as --tblout (default)
+ * or --domtblout (with --dom).
+ *
+ * Example:
+ *  ./hmmscan --binout hits.bin Pfam seqs.fa
+ *  ./hmmbin2tbl --dom hits.bin > hits.domtbl
+ */
+#include "p7_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "easel.h"
+#include "esl_getopts.h"
+
+#include "hmmer.h"
+
+static ESL_OPTIONS options[] = {
+  /* name           type       default   env  range    toggles    reqs       incomp  help   docgroup*/
+  { "-h",        eslARG_NONE,    FALSE,  NULL, NULL,    NULL,  NULL,           NULL, "show brief help on version and usage",                      0 },
+  { "-o",        eslARG_OUTFILE,  NULL,  NULL, NULL,    NULL,  NULL,           NULL, "direct output to file <f>, not stdout",                     0 },
+  { "--dom",     eslARG_NONE,    FALSE,  NULL, NULL,    NULL,  NULL,           NULL, "output per-domain table (as --domtblout), not per-target",  0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+
+static char usage[]  = "[-options] <binfile>";
+static char banner[] = "convert binary hit output to tabular form";
+
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS     *go      = p7_CreateDefaultApp(options, 1, argc, argv, banner, usage);
+  char            *binfile = esl_opt_GetArg(go, 1);
+  FILE            *ifp     = NULL;
+  FILE            *ofp     = stdout;
+  P7_TOPHITS      *th      = NULL;
+  P7_PIPELINE      pli;		/* only Z, domZ, mode, long_targets are used by the tabular writers */
+  char            *qname   = NULL;
+  char            *qacc    = NULL;
+  int              do_dom  = esl_opt_GetBoolean(go, "--dom");
+  int              nquery  = 0;
+  int              status;
+
+  if (strcmp(binfile, "-") == 0) ifp = stdin;
+  else if ((ifp = fopen(binfile, "rb")) == NULL) p7_Fail("Failed to open binary hit file %s for reading\n", binfile);
+  if (esl_opt_IsOn(go, "-o") && (ofp = fopen(esl_opt_GetString(go, "-o"), "w")) == NULL)
+    p7_Fail("Failed to open output file %s for writing\n", esl_opt_GetString(go, "-o"));
+
+  memset(&pli, 0, sizeof(P7_PIPELINE));
+  while ((status = p7_tophits_ReadBinary(ifp, &qname, &qacc, &th, &pli)) == eslOK)
+    {
+      nquery++;
+      if (do_dom) status = p7_tophits_TabularDomains(ofp, qname, qacc, th, &pli, (nquery == 1));
+      else        status = p7_tophits_TabularTargets(ofp, qname, qacc, th, &pli, (nquery == 1));
+      if (status != eslOK) p7_Fail("Failed writing tabular output\n");
+
+      p7_tophits_Destroy(th);
+      free(qname);
+      if (qacc) free(qacc);
+    }
+  if      (status == eslEFORMAT) p7_Fail("%s is truncated, or not a binary hit file from this platform (block %d)\n", binfile, nquery+1);
+  else if (status != eslEOF)     p7_Fail("Unexpected error %d reading binary hit file %s\n", status, binfile);
+
+  if (ofp != stdout) fclose(ofp);
+  if (ifp != stdin)  fclose(ifp);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+
+/*****************************************************************
+ * @LICENSE@
+ *****************************************************************/
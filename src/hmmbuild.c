@@ -23,15 +23,30 @@
 
 #ifdef HMMER_THREADS
 #include <unistd.h>
+#include <pthread.h>
 #include "esl_threads.h"
 #include "esl_workqueue.h"
 #endif /*HMMER_THREADS*/
 
 #include "hmmer.h"
 
+#ifdef HMMER_THREADS
+/* The --cpu threads are one budget shared by both levels of
+ * parallelism: each MSA worker holds one while it builds, and a
+ * worker with a deep MSA borrows whatever is idle for its own
+ * weighting/clustering threads. No more than <ncpus> are ever busy.
+ */
+typedef struct {
+  pthread_mutex_t   mutex;
+  pthread_cond_t    cond;
+  int               nfree;	/* # of the <ncpus> threads not held by a worker */
+} CPU_POOL;
+#endif /*HMMER_THREADS*/
+
 typedef struct {
 #ifdef HMMER_THREADS
   ESL_WORK_QUEUE   *queue;
+  CPU_POOL         *pool;
 #endif /*HMMER_THREADS*/
   P7_BG	           *bg;
   P7_BUILDER       *bld;
@@ -95,6 +110,7 @@ static ESL_OPTIONS options[] = {
   { "--ere",     eslARG_REAL,   NULL,  NULL,"x>0",       NULL,    NULL,     NULL, "for --eent[exp]: set minimum rel entropy/position to <x>",  5 },
   { "--esigma",  eslARG_REAL, "45.0",  NULL,"x>0",       NULL,    NULL,     NULL, "for --eent[exp]: set sigma param to <x>",                   5 },
   { "--eid",     eslARG_REAL, "0.62",  NULL,"0<=x<=1",   NULL,"--eclust",    NULL, "for --eclust: set fractional identity cutoff to <x>",  5 },
+  { "--egreedy", eslARG_NONE,  FALSE,  NULL, NULL,       NULL,"--eclust",    NULL, "for --eclust: count greedy clusters (faster on deep MSAs)", 5 },
 /* Alternative prior strategies */
   { "--pnone",   eslARG_NONE,  FALSE,  NULL, NULL,       NULL,  NULL,"--plaplace", "don't use any prior; parameters are frequencies",      9 },
   { "--plaplace",eslARG_NONE,  FALSE,  NULL, NULL,       NULL,  NULL,   "--pnone", "use a Laplace +1 prior",                               9 },
@@ -140,6 +156,7 @@ static ESL_OPTIONS options[] = {
   { "--w_beta",   eslARG_REAL,       NULL, NULL, NULL,    NULL,     NULL,    NULL, "tail mass at which window length is determined",        8 },
   { "--w_length", eslARG_INT,        NULL, NULL, NULL,    NULL,     NULL,    NULL, "window length ",                                        8 },
   { "--maxinsertlen",  eslARG_INT,   NULL, NULL, "n>=5",  NULL,     NULL,    NULL, "pretend all inserts are length <= <n>",   8 },
+  { "--stream",   eslARG_NONE,      FALSE, NULL, NULL,    NULL,     NULL, "-O,--wgsc,--wblosum,--wgiven,--eclust,--singlemx,--seq_weights_r,--seq_weights_e", "read one huge alignment in chunks, in bounded memory", 8 },
 
   /* expert-only option (for now), hidden from view. May not keep. */
   { "--seq_weights_r",  eslARG_OUTFILE,FALSE, NULL, NULL,      NULL,      NULL,    NULL, "write seq weights after relative seq weighting to file <f>",   99 },
@@ -190,10 +207,15 @@ static char usage[]  = "[-options] <hmmfile_out> <msafile>";
 static char banner[] = "profile HMM construction from multiple sequence alignments";
 
 static int  usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg);
+static void stream_master(const ESL_GETOPTS *go, struct cfg_s *cfg);
+static void configure_builder(const ESL_GETOPTS *go, const struct cfg_s *cfg, P7_BUILDER *bld, P7_BG *bg, int ncpus);
 static void serial_loop  (WORKER_INFO *info, struct cfg_s *cfg, const ESL_GETOPTS *go);
 #ifdef HMMER_THREADS
 static void thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, struct cfg_s *cfg, const ESL_GETOPTS *go);
 static void pipeline_thread(void *arg);
+static int  pool_take  (CPU_POOL *pool, int nseq);
+static void pool_return(CPU_POOL *pool, int n);
+static void pool_release(void *arg, int n);
 #endif /*HMMER_THREADS*/
 
 #ifdef HAVE_MPI
@@ -205,6 +227,7 @@ static void  mpi_init_other_failure(char *format, ...);
 
 static int output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg);
 static int output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P7_HMM *hmm, ESL_MSA *postmsa, double entropy);
+static int output_model (const struct cfg_s *cfg, char *errbuf, int msaidx, const char *name, const char *desc, int nseq, int64_t alen, P7_HMM *hmm, double entropy);
 static int set_msa_name (      struct cfg_s *cfg, char *errbuf, ESL_MSA *msa);
 
 
@@ -262,6 +285,10 @@ process_commandline(int argc, char **argv, ESL_GETOPTS **ret_go, char **ret_hmmf
     { if (puts("Can't write <hmmfile_out> to stdout: don't use '-'")         < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
   if (strcmp(*ret_alifile, "-") == 0 && ! esl_opt_IsOn(go, "--informat"))
     { if (puts("Must specify --informat to read <alifile> from stdin ('-')") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+  if (esl_opt_IsOn(go, "--stream") && strcmp(*ret_alifile, "-") == 0)
+    { if (puts("--stream reads <alifile> more than once: can't read it from stdin ('-')") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
+  if (esl_opt_IsOn(go, "--stream") && ! esl_opt_IsOn(go, "--amino") && ! esl_opt_IsOn(go, "--dna") && ! esl_opt_IsOn(go, "--rna"))
+    { if (puts("--stream requires the alphabet to be given with --amino, --dna, or --rna") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
 
 #ifdef HAVE_MPI
   if (esl_opt_IsOn(go, "--mpi") && esl_opt_IsOn(go, "--cpu")) 
@@ -274,6 +301,8 @@ process_commandline(int argc, char **argv, ESL_GETOPTS **ret_go, char **ret_hmmf
 	goto FAILURE;
       }
     }
+  if (esl_opt_IsOn(go, "--mpi") && esl_opt_IsOn(go, "--stream"))
+    { if (puts("Options --stream and --mpi are incompatible.") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed"); goto FAILURE; }
 #endif
 
   *ret_go = go;
@@ -325,6 +354,7 @@ output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
   if (esl_opt_IsUsed(go, "--ere")        && fprintf(cfg->ofp, "# minimum rel entropy target:       %f bits\n",   esl_opt_GetReal(go, "--ere"))        < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--esigma")     && fprintf(cfg->ofp, "# entropy target sigma parameter:   %f bits\n",   esl_opt_GetReal(go, "--esigma"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--eid")        && fprintf(cfg->ofp, "# frac id cutoff for --eclust:      %f\n",        esl_opt_GetReal(go, "--eid"))        < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--egreedy")    && fprintf(cfg->ofp, "# clustering for --eclust:          greedy representatives\n")                        < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--pnone")      && fprintf(cfg->ofp, "# prior scheme:                     none\n")                                           < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--plaplace")   && fprintf(cfg->ofp, "# prior scheme:                     Laplace +1\n")                                     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--EmL")        && fprintf(cfg->ofp, "# seq length for MSV Gumbel mu fit: %d\n",        esl_opt_GetInteger(go, "--EmL"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -340,6 +370,7 @@ output_header(const ESL_GETOPTS *go, const struct cfg_s *cfg)
   if (esl_opt_IsUsed(go, "--mx")         && fprintf(cfg->ofp, "# subst score matrix (built-in):    %s\n",         esl_opt_GetString (go, "--mx"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--mxfile")     && fprintf(cfg->ofp, "# subst score matrix (file):        %s\n",         esl_opt_GetString (go, "--mxfile"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--maxinsertlen")  && fprintf(cfg->ofp, "# max insert length:                %d\n",         esl_opt_GetInteger (go, "--maxinsertlen"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--stream")     && fprintf(cfg->ofp, "# alignment read in chunks of:      %d seqs\n",  p7_BUILDER_STREAMCHUNK)                  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 
 
 #ifdef HMMER_THREADS
@@ -469,7 +500,8 @@ main(int argc, char **argv)
   else
 #endif /*HAVE_MPI*/
     {
-      usual_master(go, &cfg);
+      if (esl_opt_GetBoolean(go, "--stream")) stream_master(go, &cfg);
+      else                                    usual_master(go, &cfg);
       esl_stopwatch_Stop(w);
     }
 
@@ -509,6 +541,7 @@ usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
   WORK_ITEM       *item     = NULL;
   ESL_THREADS     *threadObj= NULL;
   ESL_WORK_QUEUE  *queue    = NULL;
+  CPU_POOL         pool;
 #endif
   int              i;
   int              status;
@@ -563,6 +596,10 @@ usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
     {
       threadObj = esl_threads_Create(&pipeline_thread);
       queue = esl_workqueue_Create(ncpus * 2);
+
+      if (pthread_mutex_init(&pool.mutex, NULL) != 0) p7_Fail("mutex init failed");
+      if (pthread_cond_init (&pool.cond,  NULL) != 0) p7_Fail("cond init failed");
+      pool.nfree = ncpus;
     }
 #endif
 
@@ -597,67 +634,16 @@ usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
 
       if (info[i].bld == NULL)  p7_Fail("p7_builder_Create failed");
 
-
-
-      //do this here instead of in p7_builder_Create(), because it's an hmmbuild-specific option
-
-      if ( esl_opt_IsOn(go, "--maxinsertlen") )
-        info[i].bld->max_insert_len    = esl_opt_GetInteger(go, "--maxinsertlen");
-
-      if( !esl_opt_GetBoolean(go, "--pnone") && !esl_opt_GetBoolean(go, "--plaplace") )
-      {
-           if (esl_opt_IsUsed(go, "--tmm"))  info[i].bld->prior->tm->alpha[0][0] = esl_opt_GetReal(go, "--tmm"); // TMM
-           if (esl_opt_IsUsed(go, "--tmi"))  info[i].bld->prior->tm->alpha[0][1] = esl_opt_GetReal(go, "--tmi"); // TMM
-           if (esl_opt_IsUsed(go, "--tmd"))  info[i].bld->prior->tm->alpha[0][2] = esl_opt_GetReal(go, "--tmd"); // TMM
-
-           if (esl_opt_IsUsed(go, "--tim"))  info[i].bld->prior->ti->alpha[0][0] = esl_opt_GetReal(go, "--tim"); // TMM
-           if (esl_opt_IsUsed(go, "--tii"))  info[i].bld->prior->ti->alpha[0][1] = esl_opt_GetReal(go, "--tii"); // TMM
-
-           if (esl_opt_IsUsed(go, "--tdm"))  info[i].bld->prior->td->alpha[0][0] = esl_opt_GetReal(go, "--tdm"); // TMM
-           if (esl_opt_IsUsed(go, "--tdd"))  info[i].bld->prior->td->alpha[0][1] = esl_opt_GetReal(go, "--tdd"); // TMM
-
-      }
-
-
-
-      double popen;
-      double pextend;
-      if ( cfg->abc->type == eslDNA || cfg->abc->type == eslRNA ) {
-        //If user hasn't overridden defaults, assign the nucleotide defaults
-        popen   = esl_opt_IsUsed(go, "--popen")   ? esl_opt_GetReal(go, "--popen") : 0.03125;
-        pextend = esl_opt_IsUsed(go, "--pextend") ? esl_opt_GetReal(go, "--pextend") : 0.75;
-      } else {
-        //protein defaults
-        popen   = esl_opt_IsUsed(go, "--popen")   ? esl_opt_GetReal(go, "--popen") : 0.02;
-        pextend = esl_opt_IsUsed(go, "--pextend") ? esl_opt_GetReal(go, "--pextend") : 0.4;
-      }
-
-      /* Default matrix is stored in the --mx option, so it's always IsOn().
-       * Check --mxfile first; then go to the --mx option and the default.
-       */
-      if ( esl_opt_IsUsed(go, "--singlemx") ) {
-        char  *mx      = esl_opt_GetString(go, "--mx");
-
-        if ( cfg->abc->type == eslDNA || cfg->abc->type == eslRNA ) {
-          //If user hasn't overridden defaults, assign the nucleotide defaults
-          if ( !esl_opt_IsUsed(go, "--mx") )       mx      = "DNA1";
-        }
-        if (esl_opt_IsOn(go, "--mxfile")) status = p7_builder_SetScoreSystem (info[i].bld, esl_opt_GetString(go, "--mxfile"), NULL, popen, pextend, info[i].bg);
-        else                              status = p7_builder_LoadScoreSystem(info[i].bld, mx,                                      popen, pextend, info[i].bg);
-        if (status != eslOK) p7_Fail("Failed to set single query seq score system:\n%s\n", info[i].bld->errbuf);
-      } else {
-        if (esl_opt_IsUsed(go, "--popen") )  info[i].bld->popen   = popen;
-        if (esl_opt_IsUsed(go, "--pextend")) info[i].bld->pextend = pextend;
-      }
-
-      /* special arguments for hmmbuild */
-      info[i].bld->w_len      = (go != NULL && esl_opt_IsOn (go, "--w_length")) ?  esl_opt_GetInteger(go, "--w_length"): -1;
-      info[i].bld->w_beta     = (go != NULL && esl_opt_IsOn (go, "--w_beta"))   ?  esl_opt_GetReal   (go, "--w_beta")    : p7_DEFAULT_WINDOW_BETA;
-      if ( info[i].bld->w_beta < 0 || info[i].bld->w_beta > 1  ) esl_fatal("Invalid window-length beta value\n");
+      configure_builder(go, cfg, info[i].bld, info[i].bg, ncpus);
 
 #ifdef HMMER_THREADS
       info[i].queue = queue;
-      if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
+      info[i].pool  = &pool;
+      if (ncpus > 0) {
+        info[i].bld->release_cpus = pool_release;
+        info[i].bld->release_arg  = &pool;
+        esl_threads_AddThread(threadObj, &info[i]);
+      }
 #endif
   }
 
@@ -701,6 +687,8 @@ usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
       }
       esl_workqueue_Destroy(queue);
       esl_threads_Destroy(threadObj);
+      pthread_mutex_destroy(&pool.mutex);
+      pthread_cond_destroy(&pool.cond);
   }
 #endif
 
@@ -711,6 +699,140 @@ usual_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
   return eslFAIL;
 }
 
+/* stream_master()
+ * hmmbuild --stream: build one HMM from one alignment too big to hold
+ * in memory, reading it p7_BUILDER_STREAMCHUNK sequences at a time
+ * with p7_StreamBuilder(). The alignment is read several times, so it
+ * must be a file, and its alphabet must be given on the command line.
+ * 
+ * All errors are fatal.
+ */
+static void
+stream_master(const ESL_GETOPTS *go, struct cfg_s *cfg)
+{
+  P7_ALISTREAM *as  = NULL;
+  P7_BUILDER   *bld = NULL;
+  P7_BG        *bg  = NULL;
+  P7_HMM       *hmm = NULL;
+  char          errmsg[eslERRBUFSIZE];
+  double        entropy;
+  int           status;
+
+  if      (esl_opt_GetBoolean(go, "--amino"))   cfg->abc = esl_alphabet_Create(eslAMINO);
+  else if (esl_opt_GetBoolean(go, "--dna"))     cfg->abc = esl_alphabet_Create(eslDNA);
+  else if (esl_opt_GetBoolean(go, "--rna"))     cfg->abc = esl_alphabet_Create(eslRNA);
+  if (cfg->abc == NULL) p7_Fail("--stream requires --amino, --dna, or --rna");
+
+  status = p7_alistream_Open(cfg->alifile, cfg->abc, cfg->fmt, errmsg, &as);
+  if      (status == eslENOTFOUND || status == eslEFORMAT || status == eslEINVAL) p7_Fail("%s\n", errmsg);
+  else if (status != eslOK) p7_Fail("Failed to open alignment file %s for streaming", cfg->alifile);
+  if (cfg->hmmName && p7_alistream_SetName(as, cfg->hmmName) != eslOK) p7_Fail("allocation failed");
+
+  cfg->hmmfp = fopen(cfg->hmmfile, "w");
+  if (cfg->hmmfp == NULL) p7_Fail("Failed to open HMM file %s for writing", cfg->hmmfile);
+
+  if (esl_opt_IsUsed(go, "-o")) 
+    {
+      cfg->ofp = fopen(esl_opt_GetString(go, "-o"), "w");
+      if (cfg->ofp == NULL) p7_Fail("Failed to open -o output file %s\n", esl_opt_GetString(go, "-o"));
+    } 
+  else cfg->ofp = stdout;
+
+  output_header(go, cfg);                                  /* cheery output header                                */
+  output_result(cfg, NULL, 0, NULL, NULL, NULL, 0.0);	   /* tabular results header (with no args, special-case) */
+
+  bg  = p7_bg_Create(cfg->abc);
+  bld = p7_builder_Create(go, cfg->abc);
+  if (bg == NULL || bld == NULL) p7_Fail("p7_builder_Create failed");
+  configure_builder(go, cfg, bld, bg, 0);
+
+  if ((status = p7_StreamBuilder(bld, as, bg, &hmm, NULL, NULL)) != eslOK) p7_Fail("build failed: %s", bld->errbuf);
+  if (bld->popen != -1 || bld->pextend != -1) apply_fixed_gap_params(hmm, bld->popen, bld->pextend);
+  entropy = p7_MeanMatchRelativeEntropy(hmm, bg);
+
+  cfg->nali = 1;
+  if ((status = output_model(cfg, errmsg, cfg->nali, as->hdr->name, as->hdr->desc, as->nseq_total, as->hdr->alen, hmm, entropy)) != eslOK) p7_Fail(errmsg);
+
+  p7_hmm_Destroy(hmm);
+  p7_builder_Destroy(bld);
+  p7_bg_Destroy(bg);
+  p7_alistream_Close(as);
+}
+
+
+/* configure_builder()
+ * Apply hmmbuild-specific command line options to a new builder,
+ * <bld>, and its null model <bg>. Shared by usual_master() and
+ * stream_master(). Errors are fatal.
+ */
+static void
+configure_builder(const ESL_GETOPTS *go, const struct cfg_s *cfg, P7_BUILDER *bld, P7_BG *bg, int ncpus)
+{
+  int status;
+
+  //do this here instead of in p7_builder_Create(), because it's an hmmbuild-specific option
+  if ( esl_opt_IsOn(go, "--maxinsertlen") )
+    bld->max_insert_len    = esl_opt_GetInteger(go, "--maxinsertlen");
+
+  /* a deep MSA may also use up to <ncpus> threads of its own for
+   * weighting/clustering; threaded MSA workers lower this per MSA
+   * (see pool_take()), and give the extra ones back before calibration
+   * (see pool_release())
+   */
+  bld->eclust_greedy = esl_opt_GetBoolean(go, "--egreedy");
+  bld->ncpus         = ncpus;
+
+  if( !esl_opt_GetBoolean(go, "--pnone") && !esl_opt_GetBoolean(go, "--plaplace") )
+  {
+       if (esl_opt_IsUsed(go, "--tmm"))  bld->prior->tm->alpha[0][0] = esl_opt_GetReal(go, "--tmm"); // TMM
+       if (esl_opt_IsUsed(go, "--tmi"))  bld->prior->tm->alpha[0][1] = esl_opt_GetReal(go, "--tmi"); // TMM
+       if (esl_opt_IsUsed(go, "--tmd"))  bld->prior->tm->alpha[0][2] = esl_opt_GetReal(go, "--tmd"); // TMM
+
+       if (esl_opt_IsUsed(go, "--tim"))  bld->prior->ti->alpha[0][0] = esl_opt_GetReal(go, "--tim"); // TMM
+       if (esl_opt_IsUsed(go, "--tii"))  bld->prior->ti->alpha[0][1] = esl_opt_GetReal(go, "--tii"); // TMM
+
+       if (esl_opt_IsUsed(go, "--tdm"))  bld->prior->td->alpha[0][0] = esl_opt_GetReal(go, "--tdm"); // TMM
+       if (esl_opt_IsUsed(go, "--tdd"))  bld->prior->td->alpha[0][1] = esl_opt_GetReal(go, "--tdd"); // TMM
+
+  }
+
+  double popen;
+  double pextend;
+  if ( cfg->abc->type == eslDNA || cfg->abc->type == eslRNA ) {
+    //If user hasn't overridden defaults, assign the nucleotide defaults
+    popen   = esl_opt_IsUsed(go, "--popen")   ? esl_opt_GetReal(go, "--popen") : 0.03125;
+    pextend = esl_opt_IsUsed(go, "--pextend") ? esl_opt_GetReal(go, "--pextend") : 0.75;
+  } else {
+    //protein defaults
+    popen   = esl_opt_IsUsed(go, "--popen")   ? esl_opt_GetReal(go, "--popen") : 0.02;
+    pextend = esl_opt_IsUsed(go, "--pextend") ? esl_opt_GetReal(go, "--pextend") : 0.4;
+  }
+
+  /* Default matrix is stored in the --mx option, so it's always IsOn().
+   * Check --mxfile first; then go to the --mx option and the default.
+   */
+  if ( esl_opt_IsUsed(go, "--singlemx") ) {
+    char  *mx      = esl_opt_GetString(go, "--mx");
+
+    if ( cfg->abc->type == eslDNA || cfg->abc->type == eslRNA ) {
+      //If user hasn't overridden defaults, assign the nucleotide defaults
+      if ( !esl_opt_IsUsed(go, "--mx") )       mx      = "DNA1";
+    }
+    if (esl_opt_IsOn(go, "--mxfile")) status = p7_builder_SetScoreSystem (bld, esl_opt_GetString(go, "--mxfile"), NULL, popen, pextend, bg);
+    else                              status = p7_builder_LoadScoreSystem(bld, mx,                                      popen, pextend, bg);
+    if (status != eslOK) p7_Fail("Failed to set single query seq score system:\n%s\n", bld->errbuf);
+  } else {
+    if (esl_opt_IsUsed(go, "--popen") )  bld->popen   = popen;
+    if (esl_opt_IsUsed(go, "--pextend")) bld->pextend = pextend;
+  }
+
+  /* special arguments for hmmbuild */
+  bld->w_len      = (go != NULL && esl_opt_IsOn (go, "--w_length")) ?  esl_opt_GetInteger(go, "--w_length"): -1;
+  bld->w_beta     = (go != NULL && esl_opt_IsOn (go, "--w_beta"))   ?  esl_opt_GetReal   (go, "--w_beta")    : p7_DEFAULT_WINDOW_BETA;
+  if ( bld->w_beta < 0 || bld->w_beta > 1  ) esl_fatal("Invalid window-length beta value\n");
+}
+
+
 #ifdef HAVE_MPI
 /* mpi_master()
  * The MPI version of hmmbuild.
@@ -984,6 +1106,7 @@ mpi_worker(const ESL_GETOPTS *go, struct cfg_s *cfg)
   if (xstatus == eslOK) { if ((bld = p7_builder_Create(go, cfg->abc))     == NULL)    xstatus = eslEMEM; }
 
   //special arguments for hmmbuild
+  if (xstatus == eslOK) bld->eclust_greedy = esl_opt_GetBoolean(go, "--egreedy");
   bld->w_len      = (go != NULL && esl_opt_IsOn (go, "--w_length")) ?  esl_opt_GetInteger(go, "--w_length"): -1;
   bld->w_beta     = (go != NULL && esl_opt_IsOn (go, "--w_beta"))   ?  esl_opt_GetReal   (go, "--w_beta")    : p7_DEFAULT_WINDOW_BETA;
   if ( bld->w_beta < 0 || bld->w_beta > 1  ) goto ERROR;
@@ -1274,6 +1397,7 @@ pipeline_thread(void *arg)
   item = (WORK_ITEM *) newItem;
   while (item->msa != NULL)
     {
+      info->bld->ncpus = pool_take(info->pool, item->msa->nseq);
 
       if ( item->msa->nseq == 1 && item->force_single) {
         status = esl_sq_FetchFromMSA(item->msa, 0, &sq);
@@ -1295,6 +1419,8 @@ pipeline_thread(void *arg)
         }
       }
 
+      pool_return(info->pool, info->bld->ncpus);
+
       item->entropy   = p7_MeanMatchRelativeEntropy(item->hmm, info->bg);
       item->processed = TRUE;
 
@@ -1310,6 +1436,49 @@ pipeline_thread(void *arg)
   esl_threads_Finished(obj, workeridx);
   return;
 }
+
+/* pool_take()
+ * Wait for one of the <ncpus> threads to be free and take it, for a
+ * worker to build one MSA of <nseq> sequences. A deep MSA also takes
+ * all the others that are idle, for its weighting/clustering threads.
+ * Returns the number taken, which the worker's builder may use.
+ */
+static int
+pool_take(CPU_POOL *pool, int nseq)
+{
+  int n = 1;
+
+  if (pthread_mutex_lock(&pool->mutex) != 0) p7_Fail("mutex lock failed");
+  while (pool->nfree == 0)
+    if (pthread_cond_wait(&pool->cond, &pool->mutex) != 0) p7_Fail("cond wait failed");
+  if (nseq >= p7_BUILDER_MINPARNSEQ) n = pool->nfree;
+  pool->nfree -= n;
+  if (pthread_mutex_unlock(&pool->mutex) != 0) p7_Fail("mutex unlock failed");
+  return n;
+}
+
+/* pool_return()
+ * Give back <n> of the threads a worker took with pool_take().
+ */
+static void
+pool_return(CPU_POOL *pool, int n)
+{
+  if (pthread_mutex_lock(&pool->mutex) != 0) p7_Fail("mutex lock failed");
+  pool->nfree += n;
+  if (pthread_cond_broadcast(&pool->cond) != 0) p7_Fail("cond broadcast failed");
+  if (pthread_mutex_unlock(&pool->mutex) != 0) p7_Fail("mutex unlock failed");
+}
+
+/* pool_release()
+ * The builder's <release_cpus> callback: p7_Builder() is done with
+ * the threads for weighting/clustering, and hands back all but the
+ * worker's own, for other workers to use while it calibrates.
+ */
+static void
+pool_release(void *arg, int n)
+{
+  pool_return((CPU_POOL *) arg, n);
+}
 #endif   /* HMMER_THREADS */
  
 
@@ -1336,43 +1505,58 @@ output_result(const struct cfg_s *cfg, char *errbuf, int msaidx, ESL_MSA *msa, P
     return eslOK;
   }
 //  if ((status = p7_hmm_Validate(hmm, errbuf, 0.0001))       != eslOK) return status;
+  if ((status = output_model(cfg, errbuf, msaidx, msa->name, msa->desc, msa->nseq, msa->alen, hmm, entropy)) != eslOK) return status;
+
+  if (cfg->postmsafp != NULL && postmsa != NULL) {
+    esl_msafile_Write(cfg->postmsafp, postmsa, eslMSAFILE_STOCKHOLM);
+  }
+
+  return eslOK;
+}
+
+
+
+/* output_model()
+ * Save one HMM and print its line of the tabular results. Split out
+ * of output_result() for stream_master(), which has no complete MSA
+ * to describe the model with.
+ */
+static int
+output_model(const struct cfg_s *cfg, char *errbuf, int msaidx, const char *name, const char *desc, int nseq, int64_t alen, P7_HMM *hmm, double entropy)
+{
+  int status;
+
   if ((status = p7_hmmfile_WriteASCII(cfg->hmmfp, -1, hmm)) != eslOK) ESL_FAIL(status, errbuf, "HMM save failed");
 
 	             /* #   name nseq alen M max_length eff_nseq re/pos description */
   if (cfg->abc->type == eslAMINO) {
     if (fprintf(cfg->ofp, "%-5d %-20s %5d %5" PRId64 " %5d %8.2f %6.3f %s\n",
           msaidx,
-          (msa->name != NULL) ? msa->name : "",
-          msa->nseq,
-          msa->alen,
+          (name != NULL) ? name : "",
+          nseq,
+          alen,
           hmm->M,
           hmm->eff_nseq,
           entropy,
-          (msa->desc != NULL) ? msa->desc : "") < 0)
-      ESL_EXCEPTION_SYS(eslEWRITE, "output_result: write failed");
+          (desc != NULL) ? desc : "") < 0)
+      ESL_EXCEPTION_SYS(eslEWRITE, "output_model: write failed");
   } else {
     if (fprintf(cfg->ofp, "%-5d %-20s %5d %5" PRId64 " %5d %5d %8.2f %6.3f %s\n",
           msaidx,
-          (msa->name != NULL) ? msa->name : "",
-          msa->nseq,
-          msa->alen,
+          (name != NULL) ? name : "",
+          nseq,
+          alen,
           hmm->M,
           hmm->max_length,
           hmm->eff_nseq,
           entropy,
-          (msa->desc != NULL) ? msa->desc : "") < 0)
-      ESL_EXCEPTION_SYS(eslEWRITE, "output_result: write failed");
+          (desc != NULL) ? desc : "") < 0)
+      ESL_EXCEPTION_SYS(eslEWRITE, "output_model: write failed");
   }
-
-  if (cfg->postmsafp != NULL && postmsa != NULL) {
-    esl_msafile_Write(cfg->postmsafp, postmsa, eslMSAFILE_STOCKHOLM);
-  }
-
   return eslOK;
 }
 
 
-
 /* set_msa_name() 
  * Make sure the alignment has a name; this name will
  * then be transferred to the model.
@@ -176,7 +176,7 @@ usage(char *pgm)
 
 int main(int argc, char *argv[])
 {
-  int              i, j;
+  int              i;
   int              n;
   int              eod;
   int              size;
@@ -198,7 +198,6 @@ int main(int argc, char *argv[])
   ESL_STOPWATCH   *w       = NULL;
   P7_PIPELINE     *pli     = NULL;
   P7_TOPHITS      *th      = NULL;
-  P7_DOMAIN       *dcl     = NULL;
 
   HMMD_SEARCH_STATS   *stats;
   HMMD_SEARCH_STATUS   sstatus;
@@ -348,6 +347,17 @@ int main(int argc, char *argv[])
         }
         fprintf(stderr, "ERROR (%d): %s\n", sstatus.status, ebuf);
         free(ebuf);
+      } else if (sstatus.msg_size > 0) {
+        char *mbuf;
+        n = sstatus.msg_size;
+        total += n; 
+        mbuf = malloc(n);
+        if ((size = readn(sock, mbuf, n)) == -1) {
+          fprintf(stderr, "[%s:%d] read error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+          exit(1);
+        }
+        fprintf(stdout, "%s", mbuf);
+        free(mbuf);
       }
 
       continue;
@@ -491,85 +501,17 @@ int main(int argc, char *argv[])
         pli->Z_setby     = stats->Z_setby;
         pli->domZ_setby  = stats->domZ_setby;
 
-        th = p7_tophits_Create(); 
-
-        free(th->unsrt);
-        free(th->hit);
-
-        th->N         = stats->nhits;
-        th->unsrt     = (P7_HIT *)(data + sizeof(HMMD_SEARCH_STATS));
-        th->nreported = stats->nreported;
-        th->nincluded = stats->nincluded;
-        th->is_sorted_by_seqidx  = FALSE;
-        th->is_sorted_by_sortkey = TRUE;
-
-        if ((th->hit = malloc(sizeof(void *) * stats->nhits)) == NULL) {
-          fprintf(stderr, "[%s:%d] malloc error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+        /* the hits follow the stats as a packed block; names and
+         * descriptions come back as the strings the daemon read from its
+         * database (on hmmpgmd databases, the sequence index and the
+         * architecture/taxonomy fields of the description line).
+         */
+        if (p7_tophits_Unpack(data + sizeof(HMMD_SEARCH_STATS), sstatus.msg_size - sizeof(HMMD_SEARCH_STATS), &th, NULL) != eslOK) {
+          fprintf(stderr, "[%s:%d] unreadable hit data from server\n", __FILE__, __LINE__);
           exit(1);
         }
-        for (i = 0; i < stats->nhits; i++) th->hit[i] = th->unsrt + i;
-        
-        /* loop through the hit list adjusting the pointers */
-        for (i = 0; i < stats->nhits; ++i) {
-          char   *ptr;
-          char   *base;
-          P7_HIT *hit = th->unsrt + i;
-
-
-          /* Given the sequence header:
-           * >1 000101001 12343829483298 1234
-           * hmmpgmd hijacks the desc and acc fields to pass back domain
-           * architecture and taxonomy id information to the hmmer webserver.
-           * This means the fields are non-NULL, but don't point to real
-           * addresses, so will break any attempt to print non-NULL desc
-           * or acc fields. So we simply clear them out here
-           */
-          hit->desc = NULL;
-          hit->acc  = NULL;
-
-
-          hit->dcl = (P7_DOMAIN *)(data + ((char *)hit->dcl - (char *)NULL));
-
-          /* the hit string pointers contain the length of the string including
-           * the null terminator at the end.
-           */
-          if (hit->name != NULL) {
-            char *name = malloc(16);
-            sprintf(name, "%d", (int)(hit->name - (char *)NULL));
-            hit->name = name;
-          }
-
-          /* send the domains for this hit */
-          dcl  = hit->dcl;
-          base = (char *)dcl;
-          ptr  = (char *)(dcl + hit->ndom);
-          for (j = 0; j < hit->ndom; ++j) {
-            P7_ALIDISPLAY *ad = (P7_ALIDISPLAY *)ptr;
-
-            dcl->ad  = ad;
-            ad->mem  = ptr + sizeof(P7_ALIDISPLAY);
-                        
-            /* readjust all the pointers to the new memory block */
-            if (ad->rfline  != NULL) ad->rfline  = base + (ad->rfline  - (char *)NULL);
-            if (ad->mmline  != NULL) ad->mmline  = base + (ad->mmline  - (char *)NULL);
-            if (ad->csline  != NULL) ad->csline  = base + (ad->csline  - (char *)NULL);
-            if (ad->model   != NULL) ad->model   = base + (ad->model   - (char *)NULL);
-            if (ad->mline   != NULL) ad->mline   = base + (ad->mline   - (char *)NULL);
-            if (ad->aseq    != NULL) ad->aseq    = base + (ad->aseq    - (char *)NULL);
-            if (ad->ntseq   != NULL) ad->ntseq   = base + (ad->ntseq   - (char *)NULL);
-            if (ad->ppline  != NULL) ad->ppline  = base + (ad->ppline  - (char *)NULL);
-            if (ad->hmmname != NULL) ad->hmmname = base + (ad->hmmname - (char *)NULL);
-            if (ad->hmmacc  != NULL) ad->hmmacc  = base + (ad->hmmacc  - (char *)NULL);
-            if (ad->hmmdesc != NULL) ad->hmmdesc = base + (ad->hmmdesc - (char *)NULL);
-            if (ad->sqname  != NULL) ad->sqname  = base + (ad->sqname  - (char *)NULL);
-            if (ad->sqacc   != NULL) ad->sqacc   = base + (ad->sqacc   - (char *)NULL);
-            if (ad->sqdesc  != NULL) ad->sqdesc  = base + (ad->sqdesc  - (char *)NULL);
-
-            ptr += sizeof(P7_ALIDISPLAY) + ad->memsize;
-            ++dcl;
-			
-          }
-        }
+        th->nreported = stats->nreported;
+        th->nincluded = stats->nincluded;
 
         /* adjust the reported and included hits */
         //th->is_sorted = FALSE;
@@ -581,9 +523,8 @@ int main(int argc, char *argv[])
         p7_pli_Statistics(stdout, pli, w);  
 
         p7_pipeline_Destroy(pli); 
-        free(th->hit);
+        p7_tophits_Destroy(th);
         free(data);
-        free(th);
 
         fprintf(stdout, "//\n");  fflush(stdout);
 
@@ -13,10 +13,16 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
 #include <setjmp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>     /* On FreeBSD, you need netinet/in.h for struct sockaddr_in            */
 #endif                      /* On OpenBSD, netinet/in.h is required for (must precede) arpa/inet.h */
@@ -34,7 +40,6 @@
 #include "esl_getopts.h"
 #include "esl_sq.h"
 #include "esl_sqio.h"
-#include "esl_stack.h"
 #include "esl_stopwatch.h"
 #include "esl_threads.h"
 
@@ -45,33 +50,126 @@
 
 #define MAX_WORKERS  64
 #define MAX_BUFFER   4096
+#define MAX_EVENTS   64         /* socket events handled per pass of the client event loop */
+#define NPRIORITY    3          /* request priority classes; see CMD_QUEUE */
+#define RELOAD_POLL  1.0        /* seconds between asking workers if a preload is done */
 
-#define CONF_FILE "/etc/hmmpgmd.conf"
+#define RELOAD_IDLE     0       /* no "!load" under way                    */
+#define RELOAD_MASTER   1       /* the master is loading the new databases */
+#define RELOAD_WORKERS  2       /* the workers are loading them            */
 
-typedef struct {
-  uint32_t        count;
-  uint32_t        data_size;
-  P7_HIT         *hit;
-  char           *data;
-} HIT_LIST;
+#define CONF_FILE "/etc/hmmpgmd.conf"
 
 typedef struct {
   HMMD_SEARCH_STATS   stats;
   HMMD_SEARCH_STATUS  status;
-  HIT_LIST           *hits;
-  int                 nhits;
+  P7_TOPHITS         *th;           /* hits merged from all workers; NULL if none */
   int                 db_inx;
   int                 db_cnt;
   int                 errors;
 } SEARCH_RESULTS;
 
+/* Requests wait for the master in one FIFO queue per priority class:
+ * 0 interactive, 1 normal, 2 batch, chosen with --priority in a
+ * search's options string; server commands are class 0. The master
+ * takes the oldest request of the most urgent class that has one. A
+ * client address may have at most <max_client> searches queued or
+ * running (0: no limit); more are turned away. The counts and times
+ * kept per class are reported by the "!stats" server command.
+ */
+typedef struct {
+  pthread_mutex_t  mutex;
+  pthread_cond_t   cond;
+  QUEUE_DATA      *head[NPRIORITY];
+  QUEUE_DATA      *tail[NPRIORITY];
+  QUEUE_DATA      *running;                 /* request the master is working on; NULL if none */
+  double           started;                 /* time <running> was taken off the queue         */
+  int              max_client;
+
+  int              depth[NPRIORITY];        /* # of requests waiting                          */
+  int              max_depth[NPRIORITY];
+  uint64_t         nserved[NPRIORITY];
+  uint64_t         nrejected[NPRIORITY];
+  double           wait_sum[NPRIORITY];     /* seconds from queuing to starting, summed       */
+  double           wait_max[NPRIORITY];
+  double           run_sum[NPRIORITY];      /* seconds from starting to finishing, summed     */
+} CMD_QUEUE;
+
 typedef struct {
   int             sock_fd;
   char            ip_addr[64];
 
-  ESL_STACK      *cmdstack;	/* stack of commands that clients want done */
+  CMD_QUEUE      *cmdqueue;	/* queue of commands that clients want done */
+
+  /* buffered I/O on the (non-blocking) client socket */
+  char           *ibuf;         /* request bytes read, [0..ilen-1]               */
+  int             ilen;
+  int             ialloc;
+  int             iscan;        /* no request ends in ibuf[0..iscan-1]           */
+  char           *obuf;         /* reply bytes not yet sent, [opos..olen-1]      */
+  size_t          opos;
+  size_t          olen;
+  size_t          oalloc;
+  int             want_write;   /* TRUE while the event loop waits to send obuf  */
 } CLIENTSIDE_ARGS;
 
+/* Client connections are served by one thread, client_comm_thread(),
+ * running an event loop over the listening socket and every client
+ * socket: epoll where there is one, poll() otherwise. Other threads
+ * (the master, sending results) reach a client by its socket through
+ * client_write(). The connection table and every connection's output
+ * buffer are guarded by <mutex>; only the loop thread adds or removes
+ * connections, or touches their input buffers.
+ */
+typedef struct {
+  pthread_mutex_t   mutex;
+  CLIENTSIDE_ARGS **conn;       /* connections indexed by socket; NULL if none   */
+  int               nalloc;
+#ifdef HAVE_SYS_EPOLL_H
+  int               epfd;
+#else
+  int               wake[2];    /* a byte written to wake[1] wakes the loop      */
+  struct pollfd    *pfd;        /* sockets polled, rebuilt on each pass          */
+  int               pfd_alloc;
+#endif
+} CLIENT_LOOP;
+
+static CLIENT_LOOP clients;
+
+/* Results of recent searches, kept so a repeated query is answered
+ * without going to the workers. Entries are found by a hash of the
+ * query, its options and the database searched (see rcache_key()),
+ * and evicted least recently used first once there are more than
+ * <max_n> of them or they take more than <max_size> bytes. Only the
+ * master thread uses the cache, so it has no lock.
+ */
+typedef struct rcache_entry_s {
+  uint64_t                hash;
+  char                   *key;
+  uint64_t                nkey;
+  HMMD_SEARCH_STATUS      status;
+  HMMD_SEARCH_STATS       stats;
+  char                   *buf;       /* packed hits, as sent to the client */
+  uint64_t                nbuf;
+
+  struct rcache_entry_s  *hnext;     /* next entry in the same hash bucket */
+  struct rcache_entry_s  *prev;      /* LRU list, most recently used first */
+  struct rcache_entry_s  *next;
+} RCACHE_ENTRY;
+
+typedef struct {
+  RCACHE_ENTRY   **bucket;
+  int              nbuckets;         /* power of 2; 0 if caching is off    */
+  RCACHE_ENTRY    *head;
+  RCACHE_ENTRY    *tail;
+  int              n;
+  int              max_n;
+  uint64_t         size;             /* bytes held by the entries          */
+  uint64_t         max_size;
+  uint64_t         nhits;
+  uint64_t         nmisses;
+} RESULT_CACHE;
+
 typedef struct {
   int              sock_fd;
 
@@ -96,7 +194,40 @@ typedef struct {
 
   RANGE_LIST       *range_list;  /* (optional) list of ranges searched within the seqdb */
 
+  RESULT_CACHE     rcache;       /* results of recent searches of the databases above */
+
+  /* A "!load" runs in the background: reload_thread() loads the new
+   * databases while searches go on against the ones above, then
+   * reload_poll() has every worker preload them too, and swaps them
+   * in on the master and the workers together, between two searches.
+   */
+  int              reload;       /* RELOAD_IDLE, RELOAD_MASTER or RELOAD_WORKERS */
+  int              reload_done;  /* TRUE once reload_thread() has finished       */
+  int              reload_status;
+  char             reload_errbuf[eslERRBUFSIZE];
+  int              reload_sock;  /* client that asked for the load               */
+  double           reload_polled;/* when the workers were last asked             */
+  pthread_t        reload_tid;
+  HMMD_COMMAND    *reload_cmd;   /* the "!load", then the PRELOAD for the workers */
+  P7_SEQCACHE     *next_seq_db;  /* loaded, not in use yet; a delta if appending */
+  P7_HMMCACHE     *next_hmm_db;
+
   int              completed;
+
+  /* The search in progress is handed out in chunks, as workers ask
+   * for them; see next_chunk().
+   */
+  int              nchunks;      /* chunks are >= 1/<nchunks> of a worker's share */
+  uint32_t         next_inx;     /* next database index not yet handed out     */
+  uint32_t         end_inx;      /* end of the database being searched         */
+  uint32_t         min_chunk;    /* smallest chunk handed out                  */
+  int              outstanding;  /* # of chunks handed out, not yet returned   */
+  int              search_failed;/* TRUE if a worker reported a search error   */
+  int              nretry;       /* # of failed workers' chunks to hand out again */
+  int              retry_alloc;
+  uint32_t        *retry_inx;    /* failed chunks, [0..nretry-1]               */
+  uint32_t        *retry_cnt;
+  uint32_t         cmd_gen;      /* bumped when a search starts and ends; see workerside_loop() */
 } WORKERSIDE_ARGS;
 
 typedef struct worker_s {
@@ -106,17 +237,23 @@ typedef struct worker_s {
   int                   completed;
   int                   terminated;
   HMMD_COMMAND         *cmd;
+  uint32_t              cmd_gen;      /* <cmd> is stale once this differs from the master's */
 
-  uint32_t              srch_inx;
+  uint32_t              srch_inx;     /* chunk being searched; srch_cnt = 0 if none */
   uint32_t              srch_cnt;
 
-  HMMD_SEARCH_STATS     stats;
+  HMMD_SEARCH_STATS     stats;        /* summed over the chunks of this search */
   HMMD_SEARCH_STATUS    status;
   char                 *err_buf;
-  P7_HIT               *hit;
-  void                 *hit_data;
+  char                 *hit_data;     /* packed hits of the chunk being received */
   int                   total;
 
+  P7_TOPHITS           *th;           /* hits of the chunks searched, merged; NULL if none */
+  int                   nchunks;      /* # of chunks searched */
+  double                busy;         /* seconds spent on chunks of this search */
+  uint64_t              ndone;        /* # of database entries in those chunks  */
+  double                speed;        /* throughput relative to the other workers; 0 = unknown */
+
   WORKERSIDE_ARGS      *parent;
 
   struct worker_s      *next;
@@ -129,10 +266,12 @@ static void setup_workerside_comm(ESL_GETOPTS *opts, WORKERSIDE_ARGS  *args);
 
 static void destroy_worker(WORKER_DATA *worker);
 
+static size_t client_write(int fd, const void *buf, size_t n);
+
 static void init_results(SEARCH_RESULTS *results);
 static void clear_results(WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results);
 static void gather_results(QUEUE_DATA *query, WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results);
-static void forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results);
+static void forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results, RESULT_CACHE *cache, char *key, uint64_t nkey);
 
 static void
 print_client_msg(int fd, int status, char *format, va_list ap)
@@ -146,15 +285,16 @@ print_client_msg(int fd, int status, char *format, va_list ap)
 
   s.status   = status;
   s.msg_size = vsnprintf(ebuf, sizeof(ebuf), format, ap) +1; /* +1 because we send the \0 */
+  if (s.msg_size > sizeof(ebuf)) s.msg_size = sizeof(ebuf);  /* message was truncated */
   p7_syslog(LOG_ERR, ebuf);
 
   /* send back an unsuccessful status message */
   n = sizeof(s);
-  if (writen(fd, &s, n) != n) {
+  if (client_write(fd, &s, n) != n) {
     p7_syslog(LOG_ERR,"[%s:%d] - writing (%d) error %d - %s\n", __FILE__, __LINE__, fd, errno, strerror(errno));
     return;
   }
-  if (writen(fd, ebuf, s.msg_size) != s.msg_size)  {
+  if (client_write(fd, ebuf, s.msg_size) != s.msg_size)  {
     p7_syslog(LOG_ERR,"[%s:%d] - writing (%d) error %d - %s\n", __FILE__, __LINE__, fd, errno, strerror(errno));
     return;
   }
@@ -292,25 +432,565 @@ update_workers(WORKERSIDE_ARGS *args)
   assert(validate_workers(args));
 }
 
+/* live_workers()
+ * Count the workers in the ready list that have not terminated.
+ * Caller holds <args->work_mutex>.
+ */
+static int
+live_workers(WORKERSIDE_ARGS *args)
+{
+  WORKER_DATA *worker;
+  int          live = 0;
+
+  for (worker = args->head; worker != NULL; worker = worker->next)
+    if (! worker->terminated) ++live;
+  return live;
+}
+
+/* next_chunk()
+ * Hand <worker> the next chunk of the search in progress, setting
+ * its <srch_inx> and <srch_cnt>. A failed worker's chunk is handed
+ * out again first. Otherwise chunks are cut from the unsearched
+ * part of the database, guided self-scheduling style: half of
+ * the worker's share of what is left, its share weighted by its
+ * speed relative to the other live workers. Chunks shrink as the
+ * search proceeds, so the last ones finish close together, and
+ * faster workers pull more of them. Chunks are no smaller than
+ * <args->min_chunk>, to bound the number of round trips.
+ * 
+ * Caller holds <args->work_mutex>. Returns 1 if a chunk was
+ * handed out, 0 if none are left.
+ */
+static int
+next_chunk(WORKERSIDE_ARGS *args, WORKER_DATA *worker)
+{
+  WORKER_DATA *w;
+  uint32_t     left = args->end_inx - args->next_inx;
+  uint32_t     n;
+  double       sum  = 0.0;
+
+  if (args->search_failed) return 0;
+
+  if (args->nretry > 0) {
+    --args->nretry;
+    worker->srch_inx = args->retry_inx[args->nretry];
+    worker->srch_cnt = args->retry_cnt[args->nretry];
+  } else if (left > 0) {
+    for (w = args->head; w != NULL; w = w->next)
+      if (! w->terminated) sum += (w->speed > 0.0) ? w->speed : 1.0;
+
+    n = (uint32_t) ((double) left * ((worker->speed > 0.0) ? worker->speed : 1.0) / (2.0 * sum));
+    n = ESL_MAX(n, args->min_chunk);
+    n = ESL_MIN(n, left);
+
+    worker->srch_inx = args->next_inx;
+    worker->srch_cnt = n;
+    args->next_inx  += n;
+  } else {
+    return 0;
+  }
+
+  ++args->outstanding;
+  return 1;
+}
+
+/* requeue_chunk()
+ * <worker> failed while searching its chunk: put the chunk back,
+ * for the other workers to search, and wake the ones that ran out
+ * of chunks. Caller holds <args->work_mutex>.
+ */
+static void
+requeue_chunk(WORKERSIDE_ARGS *args, WORKER_DATA *worker)
+{
+  int n;
+
+  if (worker->srch_cnt == 0) return;
+
+  if (args->nretry == args->retry_alloc) {
+    args->retry_alloc += MAX_WORKERS;
+    if ((args->retry_inx = realloc(args->retry_inx, sizeof(uint32_t) * args->retry_alloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+    if ((args->retry_cnt = realloc(args->retry_cnt, sizeof(uint32_t) * args->retry_alloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+  }
+  args->retry_inx[args->nretry] = worker->srch_inx;
+  args->retry_cnt[args->nretry] = worker->srch_cnt;
+  ++args->nretry;
+
+  --args->outstanding;
+  worker->srch_cnt = 0;
+
+  /* wake the workers waiting for a chunk */
+  if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+}
+
+/* wall_clock()
+ * Current time, in seconds.
+ */
+static double
+wall_clock(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec * 1e-6;
+}
+
+static void
+cmdqueue_init(CMD_QUEUE *q, int max_client)
+{
+  int n;
+
+  memset(q, 0, sizeof(CMD_QUEUE));
+  if ((n = pthread_mutex_init(&q->mutex, NULL)) != 0) LOG_FATAL_MSG("mutex init", n);
+  if ((n = pthread_cond_init(&q->cond, NULL))   != 0) LOG_FATAL_MSG("cond init", n);
+  q->max_client = max_client;
+}
+
+/* cmdqueue_push()
+ * Queue request <parms> in its priority class. Unless <parms> is a
+ * server command, turn it away if its client address already has
+ * <max_client> searches queued or running. Returns <eslOK> if queued;
+ * <eslFAIL> if not, and the caller still owns <parms>.
+ */
+static int
+cmdqueue_push(CMD_QUEUE *q, QUEUE_DATA *parms)
+{
+  QUEUE_DATA *p;
+  int         c     = parms->priority;
+  int         count = 0;
+  int         n;
+
+  if ((n = pthread_mutex_lock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+
+  if (q->max_client > 0 && (parms->cmd_type == HMMD_CMD_SEARCH || parms->cmd_type == HMMD_CMD_SCAN)) {
+    if (q->running && strcmp(q->running->ip_addr, parms->ip_addr) == 0) ++count;
+    for (n = 0; n < NPRIORITY; ++n)
+      for (p = q->head[n]; p != NULL; p = p->next)
+        if (strcmp(p->ip_addr, parms->ip_addr) == 0) ++count;
+
+    if (count >= q->max_client) {
+      q->nrejected[c]++;
+      if ((n = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+      return eslFAIL;
+    }
+  }
+
+  parms->queued = wall_clock();
+  parms->next   = NULL;
+  if (q->tail[c]) q->tail[c]->next = parms; else q->head[c] = parms;
+  q->tail[c] = parms;
+  q->depth[c]++;
+  if (q->depth[c] > q->max_depth[c]) q->max_depth[c] = q->depth[c];
+
+  if ((n = pthread_cond_signal(&q->cond))    != 0) LOG_FATAL_MSG("cond signal", n);
+  if ((n = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+  return eslOK;
+}
+
+/* cmdqueue_pop()
+ * Wait for a request and take the next one off the queue: the oldest
+ * of the most urgent class. It stays the running request until
+ * cmdqueue_done(). With <timeout> > 0, give up after that many
+ * seconds and return NULL.
+ */
+static QUEUE_DATA *
+cmdqueue_pop(CMD_QUEUE *q, double timeout)
+{
+  QUEUE_DATA      *parms = NULL;
+  struct timespec  deadline;
+  double           wait;
+  double           until;
+  int              c;
+  int              n;
+
+  if (timeout > 0.0) {
+    until = wall_clock() + timeout;
+    deadline.tv_sec  = (time_t) until;
+    deadline.tv_nsec = (long) ((until - (double) deadline.tv_sec) * 1e9);
+  }
+
+  if ((n = pthread_mutex_lock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+
+  while (parms == NULL) {
+    for (c = 0; c < NPRIORITY; ++c)
+      if (q->head[c] != NULL) break;
+    if (c == NPRIORITY) {
+      if (timeout <= 0.0) {
+        if ((n = pthread_cond_wait(&q->cond, &q->mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+      } else if ((n = pthread_cond_timedwait(&q->cond, &q->mutex, &deadline)) == ETIMEDOUT) {
+        break;
+      } else if (n != 0) LOG_FATAL_MSG("cond wait", n);
+      continue;
+    }
+
+    parms = q->head[c];
+    q->head[c] = parms->next;
+    if (q->head[c] == NULL) q->tail[c] = NULL;
+    parms->next = NULL;
+    q->depth[c]--;
+  }
+
+  if (parms == NULL) {
+    if ((n = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    return NULL;
+  }
+
+  q->running = parms;
+  q->started = wall_clock();
+
+  wait = q->started - parms->queued;
+  q->wait_sum[c] += wait;
+  if (wait > q->wait_max[c]) q->wait_max[c] = wait;
+
+  if ((n = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+  return parms;
+}
+
+/* cmdqueue_done()
+ * The master has finished its running request.
+ */
+static void
+cmdqueue_done(CMD_QUEUE *q)
+{
+  int n;
+
+  if ((n = pthread_mutex_lock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  if (q->running != NULL) {
+    q->nserved[q->running->priority]++;
+    q->run_sum[q->running->priority] += wall_clock() - q->started;
+    q->running = NULL;
+  }
+  if ((n = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+}
+
+/* cmdqueue_discard()
+ * Remove and free all the requests queued by the client on socket
+ * <fd>, because we're closing that client down. With <fd> -1, remove
+ * every request.
+ */
+static void
+cmdqueue_discard(CMD_QUEUE *q, int fd)
+{
+  QUEUE_DATA **pp;
+  QUEUE_DATA  *p;
+  int          c;
+  int          n;
+
+  if ((n = pthread_mutex_lock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  for (c = 0; c < NPRIORITY; ++c) {
+    q->tail[c] = NULL;
+    for (pp = &q->head[c]; (p = *pp) != NULL; ) {
+      if (fd == -1 || p->sock == fd) {
+        *pp = p->next;
+        q->depth[c]--;
+        free_QueueData(p);
+      } else {
+        q->tail[c] = p;
+        pp = &p->next;
+      }
+    }
+  }
+  if ((n = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+}
+
+/* cmdqueue_report()
+ * Write a table of the queue's counts and times into <buf> of length <n>.
+ */
+static void
+cmdqueue_report(CMD_QUEUE *q, char *buf, int n)
+{
+  static char *cname[NPRIORITY] = { "interactive", "normal", "batch" };
+  uint64_t     nstarted;
+  int          len;
+  int          c;
+  int          k;
+
+  if ((k = pthread_mutex_lock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex lock", k);
+
+  len = snprintf(buf, n, "%-12s %7s %7s %10s %10s %10s %10s %10s\n",
+                 "class", "queued", "maxq", "served", "rejected", "mean wait", "max wait", "mean run");
+  for (c = 0; c < NPRIORITY && len < n; ++c) {
+    nstarted = q->nserved[c] + (q->running && q->running->priority == c ? 1 : 0);
+    len += snprintf(buf + len, n - len, "%-12s %7d %7d %10" PRIu64 " %10" PRIu64 " %10.3f %10.3f %10.3f\n",
+                    cname[c], q->depth[c], q->max_depth[c], q->nserved[c], q->nrejected[c],
+                    (nstarted     > 0 ? q->wait_sum[c] / nstarted     : 0.0), q->wait_max[c],
+                    (q->nserved[c] > 0 ? q->run_sum[c]  / q->nserved[c] : 0.0));
+  }
+
+  if ((k = pthread_mutex_unlock(&q->mutex)) != 0) LOG_FATAL_MSG("mutex unlock", k);
+}
+
+/* rcache_init()
+ * Set up an empty result cache of at most <max_n> entries and
+ * <max_size> bytes. With <max_n> or <max_size> 0, nothing is cached.
+ */
+static int
+rcache_init(RESULT_CACHE *cache, int max_n, uint64_t max_size)
+{
+  int status;
+
+  memset(cache, 0, sizeof(RESULT_CACHE));
+  if (max_n == 0 || max_size == 0) return eslOK;
+
+  cache->max_n    = max_n;
+  cache->max_size = max_size;
+  for (cache->nbuckets = 16; cache->nbuckets < max_n; cache->nbuckets <<= 1) ;
+  ESL_ALLOC(cache->bucket, sizeof(RCACHE_ENTRY *) * cache->nbuckets);
+  memset(cache->bucket, 0, sizeof(RCACHE_ENTRY *) * cache->nbuckets);
+  return eslOK;
+
+ ERROR:
+  cache->nbuckets = 0;
+  return status;
+}
+
+/* rcache_hash()
+ * FNV-1a hash of a cache key.
+ */
+static uint64_t
+rcache_hash(const char *key, uint64_t nkey)
+{
+  uint64_t h = 14695981039346656037ULL;
+  uint64_t i;
+
+  for (i = 0; i < nkey; i++) {
+    h ^= (unsigned char) key[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* rcache_unlink()
+ * Take entry <e> off the LRU list and out of its hash bucket, and free it.
+ */
+static void
+rcache_unlink(RESULT_CACHE *cache, RCACHE_ENTRY *e)
+{
+  RCACHE_ENTRY **pp = &cache->bucket[e->hash & (cache->nbuckets - 1)];
+
+  while (*pp != e) pp = &(*pp)->hnext;
+  *pp = e->hnext;
+
+  if (e->prev) e->prev->next = e->next; else cache->head = e->next;
+  if (e->next) e->next->prev = e->prev; else cache->tail = e->prev;
+
+  cache->n    -= 1;
+  cache->size -= sizeof(RCACHE_ENTRY) + e->nkey + e->nbuf;
+
+  free(e->key);
+  free(e->buf);
+  free(e);
+}
+
+/* rcache_clear()
+ * Drop every cached result: the databases or the workers changed.
+ */
+static void
+rcache_clear(RESULT_CACHE *cache)
+{
+  while (cache->head != NULL) rcache_unlink(cache, cache->head);
+}
+
+/* rcache_key()
+ * Build the cache key of a search: what was searched (command, query
+ * type and database), the options string, and the query itself. The
+ * query is taken from the parsed sequence or HMM, not the command
+ * sent to the workers, whose copy of the P7_HMM structure holds
+ * pointers. The key is allocated here; caller frees it.
+ */
+static int
+rcache_key(QUEUE_DATA *query, char **ret_key, uint64_t *ret_nkey)
+{
+  HMMD_SEARCH_CMD *srch  = &query->cmd->srch;
+  P7_HMM          *hmm   = query->hmm;
+  char            *key   = NULL;
+  char            *ptr;
+  uint32_t         hdr[4];
+  uint64_t         ndata;
+  uint64_t         nkey;
+  int              status;
+
+  hdr[0] = query->cmd_type;
+  hdr[1] = query->query_type;
+  hdr[2] = srch->db_inx;
+  hdr[3] = srch->opts_length;
+
+  /* the command's data: the options string, then the query */
+  ndata = query->cmd->hdr.length - (sizeof(HMMD_SEARCH_CMD) - 1);
+  nkey  = sizeof(hdr) + ndata;
+  if (hmm != NULL) {
+    ndata -= srch->opts_length + sizeof(P7_HMM);
+    nkey   = sizeof(hdr) + srch->opts_length + sizeof(int) * 3 + sizeof(float) * (p7_NEVPARAM + p7_NCUTOFFS + p7_MAXABET) + ndata;
+  }
+
+  ESL_ALLOC(key, nkey);
+  ptr = key;
+  memcpy(ptr, hdr, sizeof(hdr));                    ptr += sizeof(hdr);
+  if (hmm == NULL) {
+    memcpy(ptr, srch->data, ndata);                 ptr += ndata;
+  } else {
+    /* the HMM's values that searches use, then the arrays and strings
+     * the command carries after its copy of the structure
+     */
+    memcpy(ptr, srch->data, srch->opts_length);     ptr += srch->opts_length;
+    memcpy(ptr, &hmm->M,          sizeof(int));     ptr += sizeof(int);
+    memcpy(ptr, &hmm->flags,      sizeof(int));     ptr += sizeof(int);
+    memcpy(ptr, &hmm->max_length, sizeof(int));     ptr += sizeof(int);
+    memcpy(ptr, hmm->evparam, sizeof(float) * p7_NEVPARAM); ptr += sizeof(float) * p7_NEVPARAM;
+    memcpy(ptr, hmm->cutoff,  sizeof(float) * p7_NCUTOFFS); ptr += sizeof(float) * p7_NCUTOFFS;
+    memcpy(ptr, hmm->compo,   sizeof(float) * p7_MAXABET);  ptr += sizeof(float) * p7_MAXABET;
+    memcpy(ptr, srch->data + srch->opts_length + sizeof(P7_HMM), ndata);
+  }
+
+  *ret_key  = key;
+  *ret_nkey = nkey;
+  return eslOK;
+
+ ERROR:
+  *ret_key  = NULL;
+  *ret_nkey = 0;
+  return status;
+}
+
+/* rcache_lookup()
+ * Return the cached result for <key>, marking it most recently used,
+ * or NULL if there is none. Counts the hit or miss.
+ */
+static RCACHE_ENTRY *
+rcache_lookup(RESULT_CACHE *cache, const char *key, uint64_t nkey)
+{
+  uint64_t      h = rcache_hash(key, nkey);
+  RCACHE_ENTRY *e;
+
+  for (e = cache->bucket[h & (cache->nbuckets - 1)]; e != NULL; e = e->hnext)
+    if (e->hash == h && e->nkey == nkey && memcmp(e->key, key, nkey) == 0) break;
+
+  if (e == NULL) { cache->nmisses++; return NULL; }
+  cache->nhits++;
+
+  if (e != cache->head) {
+    e->prev->next = e->next;
+    if (e->next) e->next->prev = e->prev; else cache->tail = e->prev;
+    e->prev = NULL;
+    e->next = cache->head;
+    cache->head->prev = e;
+    cache->head = e;
+  }
+  return e;
+}
+
+/* rcache_store()
+ * Cache the result of a search: its status, stats and packed hits
+ * <buf>. Takes ownership of <key> and <buf>, freeing them if the
+ * result is too large to cache. Evicts least recently used results
+ * to make room.
+ */
+static void
+rcache_store(RESULT_CACHE *cache, char *key, uint64_t nkey, HMMD_SEARCH_STATUS *status, HMMD_SEARCH_STATS *stats, char *buf, uint64_t nbuf)
+{
+  RCACHE_ENTRY *e;
+  uint64_t      size = sizeof(RCACHE_ENTRY) + nkey + nbuf;
+  uint64_t      h;
+
+  if (size > cache->max_size || (e = malloc(sizeof(RCACHE_ENTRY))) == NULL) {
+    free(key);
+    free(buf);
+    return;
+  }
+
+  while (cache->n >= cache->max_n || cache->size + size > cache->max_size)
+    rcache_unlink(cache, cache->tail);
+
+  h = rcache_hash(key, nkey);
+  e->hash   = h;
+  e->key    = key;
+  e->nkey   = nkey;
+  e->status = *status;
+  e->stats  = *stats;
+  e->buf    = buf;
+  e->nbuf   = nbuf;
+
+  e->hnext  = cache->bucket[h & (cache->nbuckets - 1)];
+  cache->bucket[h & (cache->nbuckets - 1)] = e;
+
+  e->prev   = NULL;
+  e->next   = cache->head;
+  if (cache->head) cache->head->prev = e; else cache->tail = e;
+  cache->head = e;
+
+  cache->n    += 1;
+  cache->size += size;
+}
+
+/* forward_cached()
+ * Send a client the cached result <e> of its query. The stats report
+ * the time taken by this search, i.e. the lookup.
+ */
+static void
+forward_cached(QUEUE_DATA *query, RCACHE_ENTRY *e, ESL_STOPWATCH *w)
+{
+  HMMD_SEARCH_STATS stats = e->stats;
+  int               fd    = query->sock;
+  int               n;
+
+  esl_stopwatch_Stop(w);
+  stats.elapsed = w->elapsed;
+  stats.user    = w->user;
+  stats.sys     = w->sys;
+
+  n = sizeof(HMMD_SEARCH_STATUS);
+  if (client_write(fd, &e->status, n) != n) {
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
+    return;
+  }
+
+  n = sizeof(HMMD_SEARCH_STATS);
+  if (client_write(fd, &stats, n) != n) {
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
+    return;
+  }
+
+  if (client_write(fd, e->buf, e->nbuf) != e->nbuf) {
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
+    return;
+  }
+
+  printf("Cached results for %s (%d) sent %" PRId64 " bytes\n", query->ip_addr, fd, e->status.msg_size);
+  printf("Hits:%"PRId64 "  reported:%" PRId64 "  included:%"PRId64 "\n", stats.nhits, stats.nreported, stats.nincluded);
+  fflush(stdout);
+}
+
 static void
 process_search(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
 {
   ESL_STOPWATCH  *w          = NULL;      /* timer used for profiling statistics             */
   WORKER_DATA    *worker     = NULL;
+  RCACHE_ENTRY   *cached     = NULL;
   SEARCH_RESULTS  results;
+  char           *key        = NULL;      /* result cache key of the query; NULL if not caching */
+  uint64_t        nkey       = 0;
   int n;
   int cnt;
-  int inx;
-  int ready_workers;    /* counter variable used to track the number of workers currently available to receive work; short for "remaining", I imagine */
-  int tries;
-  int i;
-
+  int ready_workers;    /* number of workers available when the search started */
+  int unfinished = 0;   /* TRUE if chunks were left unsearched, for lack of workers */
 
   memset(&results, 0, sizeof(SEARCH_RESULTS)); /* avoid valgrind bitching about uninit bytes; remove, if we ever serialize structs properly */
 
   w = esl_stopwatch_Create();
   esl_stopwatch_Start(w);
 
+  /* a query seen recently is answered from the result cache */
+  if (args->rcache.nbuckets > 0 && rcache_key(query, &key, &nkey) == eslOK) {
+    cached = rcache_lookup(&args->rcache, key, nkey);
+    printf("Result cache: %d results, %" PRIu64 " bytes; %" PRIu64 " hits, %" PRIu64 " misses\n",
+           args->rcache.n, args->rcache.size, args->rcache.nhits, args->rcache.nmisses);
+    if (cached != NULL) {
+      forward_cached(query, cached, w);
+      free(key);
+      esl_stopwatch_Destroy(w);
+      return;
+    }
+  }
+
   /* figure out the size of the database we are searching */
   if (query->cmd_type == HMMD_CMD_SEARCH) {
     cnt = args->seq_db->db[query->dbx].count;
@@ -320,94 +1000,62 @@ process_search(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
 
   init_results(&results);
 
-  //if range(s) are given, count how many of the seqdb's sequences are within supplied range(s)
-  if (args->range_list) { // can only happen in HMMD_CMD_SEARCH case
-    int range_cnt = 0; // this will now count how many of the seqs in the db are within the range
-    for (i=0; i<cnt; i++) {
-      if ( hmmpgmd_IsWithinRanges(args->seq_db->list[i].idx, args->range_list ) )
-        range_cnt++;
-    }
-    cnt = range_cnt;
-  }
-
-
-  inx = 0;
-  tries = 0;
-  do {
-    /* process any changes to the available workers */
-    if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
-
-    /* build a list of the currently available workers */
-    update_workers(args);
-
-    /* if there are no workers, report an error */
-    if (args->ready > 0) {
-      ready_workers = args->ready;
-
-      /* update the workers search information */
-      worker = args->head;
-
-      while (worker != NULL) {
-        worker->cmd        = query->cmd;
-        worker->completed  = 0;
-        worker->total      = 0;
-
-        /* assign each worker a portion of the database */
-        worker->srch_inx = inx;
-        if (args->range_list) {
-          // if ranges are given, need to split the db list based on which elements in the list are within the given range(s)
-          int goal = cnt / ready_workers; //how many within-range sequences do I want to ask this worker to handle
-          int curr = 0;                   //how many within-range sequences have I seen since the start of this full-db range
-          worker->srch_cnt = 0;
-          while (curr < goal) {
-            if ( hmmpgmd_IsWithinRanges (args->seq_db->list[inx].idx, args->range_list ) )
-                curr++;
-            worker->srch_cnt++;
-            inx++;
-          }
-          cnt -= curr;
-        } else {
-          // default - split evenly among workers
-          worker->srch_cnt = cnt / ready_workers;
-          inx += worker->srch_cnt;
-          cnt -= worker->srch_cnt;
-        }
-
-        --ready_workers;
-        worker            = worker->next;
-      }
-
-      args->completed = 0;
+  /* process any changes to the available workers */
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-      /* notify all the worker threads of the new query */
-      if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  /* build a list of the currently available workers */
+  update_workers(args);
+  ready_workers = args->ready;
+
+  /* if there are no workers, report an error */
+  if (ready_workers > 0) {
+    /* Workers pull chunks of the database until none are left, rather
+     * than each taking a fixed slice: a slow or busy node then holds up
+     * the search by one small chunk at most, and a failed worker's
+     * chunk is searched again by the others. With ranges
+     * (--seqdb_ranges), the workers skip sequences outside them.
+     */
+    args->next_inx      = 0;
+    args->end_inx       = cnt;
+    args->min_chunk     = ESL_MAX(1, cnt / (ready_workers * args->nchunks));
+    args->outstanding   = 0;
+    args->nretry        = 0;
+    args->search_failed = FALSE;
+
+    /* update the workers search information */
+    ++args->cmd_gen;
+    for (worker = args->head; worker != NULL; worker = worker->next) {
+      worker->cmd           = query->cmd;
+      worker->cmd_gen       = args->cmd_gen;
+      worker->completed     = 0;
+      worker->total         = 0;
+      worker->srch_cnt      = 0;
+      worker->nchunks       = 0;
+      worker->busy          = 0.0;
+      worker->ndone         = 0;
+      worker->status.status = eslOK;
+      memset(&worker->stats, 0, sizeof(HMMD_SEARCH_STATS));
     }
 
-    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
-
-    if (args->ready > 0) {
-      /* Wait for all the workers to complete */
-      if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
-
-      while (args->completed < args->ready) {
-        if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
-      }
+    /* notify all the worker threads of the new query */
+    if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
 
-      if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    /* Wait until every chunk has been searched, or no workers are left to search them */
+    while (args->outstanding > 0 ||
+           ((args->nretry > 0 || args->next_inx < args->end_inx) && ! args->search_failed && live_workers(args) > 0)) {
+      if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
     }
+    unfinished = (args->nretry > 0 || args->next_inx < args->end_inx);
 
-    /* gather up the results from all the workers */
-    gather_results(query, args, &results);
-
-    /* we can recover from one worker crashing.  get the block that worker ran on
-     * and redistribute its load to all the remaining workers.
-     */
-    inx = results.db_inx;
-    cnt = results.db_cnt;
-    ++tries;
+    /* the search is over: workers still holding its command must let go of it */
+    ++args->cmd_gen;
+    if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+  }
 
-  } while (args->ready > 0 && results.errors == 1 && tries < 2);
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
 
+  /* gather up the results from all the workers */
+  gather_results(query, args, &results);
 
   esl_stopwatch_Stop(w);
 
@@ -416,14 +1064,15 @@ process_search(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   results.stats.user    = w->user;
   results.stats.sys     = w->sys;
 
-  /* TODO: check for errors */
-  if (args->ready == 0) {
+  if (ready_workers == 0) {
     client_msg(query->sock, eslFAIL, "No compute nodes available\n");
-  } else if (args->failed > 0) {
+    free(key);
+  } else if (unfinished || results.errors > 0) {
     client_msg(query->sock, eslFAIL, "Errors running search\n");
     clear_results(args, &results);
+    free(key);
   } else {
-    forward_results(query, &results);  
+    forward_results(query, &results, &args->rcache, key, nkey);
   }
 
   esl_stopwatch_Destroy(w);
@@ -437,6 +1086,9 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
 
   WORKER_DATA *worker = NULL;
 
+  /* don't answer from results computed before the reset */
+  rcache_clear(&args->rcache);
+
   /* process any changes to the available workers */
   if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
@@ -450,6 +1102,7 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   while (worker != NULL) {
     if (strcmp(worker->ip_addr, query->cmd->reset.ip_addr) == 0) {
       worker->cmd        = query->cmd;
+      worker->cmd_gen    = args->cmd_gen;
       worker->completed  = 0;
       worker->total      = 0;
 
@@ -464,6 +1117,7 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   while (worker != NULL) {
     if (strcmp(worker->ip_addr, query->cmd->reset.ip_addr) == 0) {
       worker->cmd        = query->cmd;
+      worker->cmd_gen    = args->cmd_gen;
       worker->completed  = 0;
       worker->total      = 0;
 
@@ -504,130 +1158,332 @@ process_reset(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
 
     /* send back a successful status message */
     n = sizeof(status);
-    if (writen(query->sock, &status, n) != n) {
+    if (client_write(query->sock, &status, n) != n) {
       p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
     }
   }
 }
 
+/* broadcast_cmd()
+ * Send <cmd> to every ready worker and wait for all of them to
+ * answer. Of the <*ret_n> workers asked, <*ret_nok> answered eslOK
+ * and <*ret_nerr> answered with an error; the others answered
+ * eslENORESULT or have gone.
+ */
 static void
-process_load(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
+broadcast_cmd(WORKERSIDE_ARGS *args, HMMD_COMMAND *cmd, int *ret_n, int *ret_nok, int *ret_nerr)
 {
-  void          *tmp;
-  P7_SEQCACHE   *seq_db  = NULL;
-  P7_HMMCACHE   *hmm_db  = NULL;
-  WORKER_DATA   *worker  = NULL;
-  HMMD_COMMAND   cmd;
-  int            n, cnt;
-  char           errbuf[eslERRBUFSIZE];
-  int            status;
+  WORKER_DATA *worker;
+  int          cnt  = 0;
+  int          nok  = 0;
+  int          nerr = 0;
+  int          n;
 
-  client_msg(query->sock, eslOK, "Loading databases...\n");
+  if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-  if (query->cmd->init.seqdb_off) {
-    char *name = (char *)&query->cmd;
-    name += query->cmd->init.seqdb_off;
+  /* build a list of the currently available workers */
+  update_workers(args);
 
-    if ((status = p7_seqcache_Open(name, &seq_db, errbuf)) != eslOK) {
-      client_msg(query->sock, status, "Failed to load sequence database %s\n  %s", name, errbuf);
-      return;
+  for (worker = args->head; worker != NULL; worker = worker->next) {
+    worker->cmd           = cmd;
+    worker->cmd_gen       = args->cmd_gen;
+    worker->status.status = eslENORESULT;
+    ++cnt;
+  }
+
+  if (cnt > 0) {
+    args->completed = 0;
+
+    /* notify all the worker threads of the command, and wait for their answers */
+    if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+    while (args->completed < cnt) {
+      if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
     }
   }
 
-  if (query->cmd->init.hmmdb_off) {
-    char *name = (char *)&query->cmd;
-    name += query->cmd->init.hmmdb_off;
+  for (worker = args->head; worker != NULL; worker = worker->next) {
+    if (worker->terminated) continue;
+    if      (worker->status.status == eslOK)        ++nok;
+    else if (worker->status.status != eslENORESULT) ++nerr;
+  }
 
-    status = p7_hmmcache_Open(name, &hmm_db, errbuf);
-    if      (status == eslENOTFOUND) { client_msg(query->sock, status, "Failed to open profile database %s\n  %s\n",    name, errbuf); goto ERROR; }
-    else if (status == eslEFORMAT)   { client_msg(query->sock, status, "Failed to parse profile database %s\n  %s\n",   name, errbuf); goto ERROR; }
-    else if (status == eslEINCOMPAT) { client_msg(query->sock, status, "Mismatched alphabets in profile db %s\n  %s\n", name, errbuf); goto ERROR; }
-    else if (status != eslOK)        { client_msg(query->sock, status, "Failed to load profile db %s : code %d\n",      name, status); goto ERROR; }
+  update_workers(args);
+
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+  *ret_n    = cnt;
+  *ret_nok  = nok;
+  *ret_nerr = nerr;
+}
 
-    if ( (status = p7_hmmcache_SetNumericNames(hmm_db)) != eslOK) goto ERROR;
+/* reload_thread()
+ * Load the databases named by the "!load" in <args->reload_cmd>, and
+ * leave them in <args->next_seq_db> and <args->next_hmm_db> for
+ * reload_poll().
+ */
+static void *
+reload_thread(void *arg)
+{
+  WORKERSIDE_ARGS *args   = (WORKERSIDE_ARGS *) arg;
+  HMMD_INIT_CMD   *init   = &args->reload_cmd->init;
+  P7_SEQCACHE     *seq_db = NULL;
+  P7_HMMCACHE     *hmm_db = NULL;
+  char             errbuf[eslERRBUFSIZE];
+  char             msg[eslERRBUFSIZE];
+  char            *name;
+  int              status = eslOK;
+  int              n;
+
+  errbuf[0] = 0;
+  msg[0]    = 0;
+
+  if (init->db_cnt != 0) {
+    name = init->data + init->seqdb_off;
+    if ((status = p7_seqcache_Open(name, &seq_db, errbuf)) != eslOK)
+      snprintf(msg, sizeof(msg), "Failed to load sequence database %s (%d)\n", name, status);
+  }
+
+  if (status == eslOK && init->hmm_cnt != 0) {
+    name = init->data + init->hmmdb_off;
 
-    client_msg(query->sock, eslOK, "Loaded profile db %s;  models: %d  memory: %" PRId64 "\n",
-	       name, hmm_db->n, p7_hmmcache_Sizeof(hmm_db));
+    status = p7_hmmcache_Open(name, &hmm_db, errbuf);
+    if      (status == eslENOTFOUND) snprintf(msg, sizeof(msg), "Failed to open profile database %s\n  %s\n",    name, errbuf);
+    else if (status == eslEFORMAT)   snprintf(msg, sizeof(msg), "Failed to parse profile database %s\n  %s\n",   name, errbuf);
+    else if (status == eslEINCOMPAT) snprintf(msg, sizeof(msg), "Mismatched alphabets in profile db %s\n  %s\n", name, errbuf);
+    else if (status != eslOK)        snprintf(msg, sizeof(msg), "Failed to load profile db %s : code %d\n",      name, status);
+    else if ((status = p7_hmmcache_SetNumericNames(hmm_db)) != eslOK)
+      snprintf(msg, sizeof(msg), "Failed to number profile db %s : code %d\n", name, status);
+  }
+
+  if (status != eslOK) {
+    if (seq_db != NULL) p7_seqcache_Close(seq_db);
+    if (hmm_db != NULL) p7_hmmcache_Close(hmm_db);
+    seq_db = NULL;
+    hmm_db = NULL;
   }
 
-  /* process any changes to the available workers */
   if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  args->next_seq_db   = seq_db;
+  args->next_hmm_db   = hmm_db;
+  args->reload_status = status;
+  strcpy(args->reload_errbuf, msg);
+  args->reload_done   = TRUE;
+  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  /* swap in the new cached databases */
-  tmp = args->seq_db;
-  args->seq_db = seq_db;
-  seq_db = tmp;
+  return NULL;
+}
 
-  tmp = args->seq_db;
-  args->seq_db = seq_db;
-  seq_db = tmp;
+/* reload_finish()
+ * A "!load" is over: free whatever it leaves behind.
+ */
+static void
+reload_finish(WORKERSIDE_ARGS *args)
+{
+  if (args->next_seq_db != NULL) p7_seqcache_Close(args->next_seq_db);
+  if (args->next_hmm_db != NULL) p7_hmmcache_Close(args->next_hmm_db);
+  if (args->reload_cmd  != NULL) free(args->reload_cmd);
+
+  args->next_seq_db = NULL;
+  args->next_hmm_db = NULL;
+  args->reload_cmd  = NULL;
+  args->reload      = RELOAD_IDLE;
+}
 
-  args->db_version++;
+/* process_load()
+ * Start loading the databases a "!load" names, in the background.
+ * Searches go on against the databases in use; reload_poll() swaps
+ * in the new ones when the master and every worker have them, and
+ * tells the client. With --seqdelta, the sequences of the file
+ * named are added to the sequence database in use instead.
+ */
+static void
+process_load(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
+{
+  int n;
 
-  /* build a list of the currently available workers */
-  update_workers(args);
+  if (args->reload != RELOAD_IDLE) {
+    client_msg(query->sock, eslFAIL, "A load is already in progress\n");
+    return;
+  }
+  if (query->cmd->init.append && args->seq_db == NULL) {
+    client_msg(query->sock, eslEINVAL, "No sequence database to add the delta to\n");
+    return;
+  }
 
-  /* reset all the idle and active workers */
-  cnt = 0;
+  n = MSG_SIZE(query->cmd);
+  if ((args->reload_cmd = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memcpy(args->reload_cmd, query->cmd, n);
 
-  /* build a reset command */
-  cmd.hdr.length  = 0;
-  cmd.hdr.command = HMMD_CMD_RESET;
+  args->reload        = RELOAD_MASTER;
+  args->reload_done   = FALSE;
+  args->reload_status = eslOK;
+  args->reload_sock   = query->sock;
+  args->reload_polled = 0.0;
+  args->next_seq_db   = NULL;
+  args->next_hmm_db   = NULL;
 
-  /* look for the active workers to reset */
-  worker = args->head;
-  while (worker != NULL) {
-    worker->cmd        = &cmd;
-    worker->completed  = 0;
-    worker->total      = 0;
+  if ((n = pthread_create(&args->reload_tid, NULL, reload_thread, args)) != 0) LOG_FATAL_MSG("thread create", n);
 
-    worker = worker->next;
-    ++cnt;
+  client_msg(query->sock, eslOK, "Loading databases...\n");
+}
+
+/* reload_preload_cmd()
+ * Build the PRELOAD telling the workers to load what the master has
+ * loaded for the "!load" under way.
+ */
+static HMMD_COMMAND *
+reload_preload_cmd(WORKERSIDE_ARGS *args)
+{
+  HMMD_COMMAND *cmd;
+  int           append = args->reload_cmd->init.append;
+  char         *p;
+  int           n;
+
+  n = sizeof(HMMD_COMMAND);
+  if (args->next_seq_db != NULL) n += strlen(args->next_seq_db->name) + 1;
+  if (args->next_hmm_db != NULL) n += strlen(args->next_hmm_db->name) + 1;
+
+  if ((cmd = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+  memset(cmd, 0, n);
+  cmd->hdr.length  = n - sizeof(HMMD_HEADER);
+  cmd->hdr.command = HMMD_CMD_PRELOAD;
+
+  p = cmd->init.data;
+
+  if (args->next_seq_db != NULL) {
+    cmd->init.db_cnt  = args->next_seq_db->db_cnt;
+    cmd->init.seq_cnt = args->next_seq_db->count;
+    if (append) {
+      cmd->init.append     = TRUE;
+      cmd->init.seq_cnt   += args->seq_db->count;
+      cmd->init.delta_off  = p - cmd->init.data;
+      cmd->init.delta_cnt  = 1;
+    } else {
+      cmd->init.seqdb_off  = p - cmd->init.data;
+    }
+
+    strncpy(cmd->init.sid, args->next_seq_db->id, sizeof(cmd->init.sid));
+    cmd->init.sid[sizeof(cmd->init.sid)-1] = 0;
+
+    strcpy(p, args->next_seq_db->name);
+    p += strlen(args->next_seq_db->name) + 1;
   }
 
-  /* look for the idle workers to reset */
-  worker = args->idling;
-  while (worker != NULL) {
-    worker->cmd        = &cmd;
-    worker->completed  = 0;
-    worker->total      = 0;
+  if (args->next_hmm_db != NULL) {
+    cmd->init.hmm_cnt   = 1;
+    cmd->init.model_cnt = args->next_hmm_db->n;
+    cmd->init.hmmdb_off = p - cmd->init.data;
+
+    strcpy(p, args->next_hmm_db->name);
+    p += strlen(args->next_hmm_db->name) + 1;
+  }
+
+  return cmd;
+}
+
+/* reload_poll()
+ * Move a "!load" along, if one is under way; the master calls this
+ * between requests. Once the master has loaded the new databases,
+ * the workers are asked to preload them, every RELOAD_POLL seconds
+ * until all have. Then the master and the workers swap them in, all
+ * before the next search, so no search sees a mix of old and new.
+ * If anyone fails to load them, everyone keeps the old ones.
+ */
+static void
+reload_poll(WORKERSIDE_ARGS *args)
+{
+  HMMD_COMMAND  swap;
+  HMMD_COMMAND *cmd;
+  void         *tmp;
+  char          errbuf[eslERRBUFSIZE];
+  int           cnt, nok, nerr;
+  int           done;
+  int           status = eslOK;
+  int           n;
+
+  if (args->reload == RELOAD_IDLE) return;
+
+  if (args->reload == RELOAD_MASTER) {
+    if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+    done = args->reload_done;
+    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    if (! done) return;
+
+    pthread_join(args->reload_tid, NULL);
+
+    if (args->reload_status != eslOK) {
+      client_msg(args->reload_sock, args->reload_status, "%s", args->reload_errbuf);
+      reload_finish(args);
+      return;
+    }
+    if (args->reload_cmd->init.append && args->next_seq_db->db_cnt != args->seq_db->db_cnt) {
+      client_msg(args->reload_sock, eslEINCOMPAT, "Delta %s has %d databases, not %d\n",
+                 args->next_seq_db->name, args->next_seq_db->db_cnt, args->seq_db->db_cnt);
+      reload_finish(args);
+      return;
+    }
 
-    worker = worker->next;
-    ++cnt;
+    cmd = reload_preload_cmd(args);
+    free(args->reload_cmd);
+    args->reload_cmd = cmd;
+    args->reload     = RELOAD_WORKERS;
+
+    client_msg(args->reload_sock, eslOK, "Master loaded the databases; loading them on the workers...\n");
   }
 
-  /* check if there are any worker matching the ip address */
-  if (cnt > 0) {
-    args->completed = 0;
+  if (wall_clock() - args->reload_polled < RELOAD_POLL) return;
 
-    /* notify all the worker threads of the new query */
-    if ((n = pthread_cond_broadcast(&args->start_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
-    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
+  broadcast_cmd(args, args->reload_cmd, &cnt, &nok, &nerr);
+  args->reload_polled = wall_clock();
+  if (nerr == 0 && nok < cnt) return;
 
-    /* Wait for all the workers to complete */
+  if (nerr > 0) {
+    status = eslFAIL;
+    snprintf(errbuf, sizeof(errbuf), "%d of %d workers failed to load the databases", nerr, cnt);
+  }
+
+  /* swap the master's own first; if that fails, the workers throw theirs away */
+  if (status == eslOK) {
     if ((n = pthread_mutex_lock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-    while (args->completed < cnt) {
-      if ((n = pthread_cond_wait (&args->complete_cond, &args->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
+    if (args->next_seq_db != NULL) {
+      if (args->reload_cmd->init.append) {
+        if ((status = p7_seqcache_Append(args->seq_db, args->next_seq_db, errbuf)) == eslOK) args->next_seq_db = NULL;
+      } else {
+        tmp = args->seq_db;
+        args->seq_db = args->next_seq_db;
+        args->next_seq_db = tmp;
+      }
+    }
+    if (status == eslOK && args->next_hmm_db != NULL) {
+      tmp = args->hmm_db;
+      args->hmm_db = args->next_hmm_db;
+      args->next_hmm_db = tmp;
     }
-  }
 
-  /* build a list of the currently available workers */
-  update_workers(args);
+    /* workers still connecting start over with the new databases */
+    if (status == eslOK) args->db_version++;
 
-  if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+    if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+  }
 
-  /* free up the old copies */
-  if (seq_db != NULL) p7_seqcache_Close(seq_db);
-  if (hmm_db != NULL) p7_hmmcache_Close(hmm_db);
+  memset(&swap, 0, sizeof(HMMD_HEADER));
+  swap.hdr.length  = 0;
+  swap.hdr.command = HMMD_CMD_SWAP;
+  swap.hdr.status  = status;
+  broadcast_cmd(args, &swap, &cnt, &nok, &nerr);
 
-  client_msg(query->sock, eslOK, "Load complete\n");
-  return;
+  if (status == eslOK) {
+    /* results cached for the old databases no longer hold */
+    rcache_clear(&args->rcache);
 
- ERROR:
-  if (seq_db) p7_seqcache_Close(seq_db);
-  if (hmm_db) p7_hmmcache_Close(hmm_db);
-  return;
+    if (nok < cnt) p7_syslog(LOG_ERR,"[%s:%d] - %d of %d workers dropped, failed to swap databases\n", __FILE__, __LINE__, cnt - nok, cnt);
+    client_msg(args->reload_sock, eslOK, "Load complete\n");
+  } else {
+    client_msg(args->reload_sock, status, "Load failed: %s\n", errbuf);
+  }
+
+  reload_finish(args);
 }
 
 static void
@@ -657,6 +1513,7 @@ process_shutdown(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   worker = args->head;
   while (worker != NULL) {
     worker->cmd        = &cmd;
+    worker->cmd_gen    = args->cmd_gen;
     worker->completed  = 0;
     worker->total      = 0;
 
@@ -668,6 +1525,7 @@ process_shutdown(WORKERSIDE_ARGS *args, QUEUE_DATA *query)
   worker = args->idling;
   while (worker != NULL) {
     worker->cmd        = &cmd;
+    worker->cmd_gen    = args->cmd_gen;
     worker->completed  = 0;
     worker->total      = 0;
 
@@ -703,7 +1561,7 @@ master_process(ESL_GETOPTS *go)
 {
   P7_SEQCACHE        *seq_db     = NULL;
   P7_HMMCACHE        *hmm_db     = NULL;
-  ESL_STACK          *cmdstack   = NULL; /* stack of commands that clients want done */
+  CMD_QUEUE           cmdqueue;          /* queue of commands that clients want done */
   QUEUE_DATA         *query      = NULL;
   CLIENTSIDE_ARGS     client_comm;
   WORKERSIDE_ARGS     worker_comm;
@@ -745,13 +1603,11 @@ master_process(ESL_GETOPTS *go)
   printf("Data loaded into memory. Master is ready.\n");
   setvbuf (stdout, NULL, _IOFBF, BUFSIZ);
 
-  /* initialize the search stack, set it up for interthread communication  */
-  cmdstack = esl_stack_PCreate();
-  esl_stack_UseMutex(cmdstack);
-  esl_stack_UseCond(cmdstack);
+  /* initialize the request queue, for interthread communication  */
+  cmdqueue_init(&cmdqueue, esl_opt_GetInteger(go, "--climit"));
 
   /* start the communications with the web clients */
-  client_comm.cmdstack = cmdstack;
+  client_comm.cmdqueue = &cmdqueue;
   setup_clientside_comm(go, &client_comm);
 
   /* initialize the worker structure */
@@ -773,14 +1629,35 @@ master_process(ESL_GETOPTS *go)
   worker_comm.pend_cnt   = 0;
   worker_comm.idle_cnt   = 0;
 
+  worker_comm.nchunks       = esl_opt_GetInteger(go, "--chunks");
+  worker_comm.outstanding   = 0;
+  worker_comm.search_failed = FALSE;
+  worker_comm.nretry        = 0;
+  worker_comm.retry_alloc   = 0;
+  worker_comm.retry_inx     = NULL;
+  worker_comm.retry_cnt     = NULL;
+  worker_comm.cmd_gen       = 0;
+
+  worker_comm.reload        = RELOAD_IDLE;
+  worker_comm.reload_cmd    = NULL;
+  worker_comm.next_seq_db   = NULL;
+  worker_comm.next_hmm_db   = NULL;
+
+  if (rcache_init(&worker_comm.rcache, esl_opt_GetInteger(go, "--rcache_n"), (uint64_t) esl_opt_GetInteger(go, "--rcache_mb") * 1024 * 1024) != eslOK)
+    LOG_FATAL_MSG("malloc", errno);
+
   setup_workerside_comm(go, &worker_comm);
 
   /* read query hmm/sequence 
-   * the PPop() will wait until a client pushes a command to the queue
+   * the pop will wait until a client pushes a command to the queue,
+   * or while a load is under way, until it's time to check on it
    */
   shutdown = 0;
-  while (!shutdown &&  esl_stack_PPop(cmdstack, (void **) &query) == eslOK) {
-    printf("Processing command %d from %s\n", query->cmd_type, query->ip_addr);
+  while (!shutdown) {
+    reload_poll(&worker_comm);
+    if ((query = cmdqueue_pop(&cmdqueue, (worker_comm.reload != RELOAD_IDLE) ? RELOAD_POLL : 0.0)) == NULL) continue;
+
+    printf("Processing command %d from %s (priority %d, waited %.3f s)\n", query->cmd_type, query->ip_addr, query->priority, wall_clock() - query->queued);
     fflush(stdout);
 
     worker_comm.range_list = NULL;
@@ -805,20 +1682,30 @@ master_process(ESL_GETOPTS *go)
       break;
     }
 
+    cmdqueue_done(&cmdqueue);
     free_QueueData(query);
   }
 
-  esl_stack_ReleaseCond(cmdstack);
+  /* drop requests still waiting */
+  cmdqueue_discard(&cmdqueue, -1);
 
-  if (hmm_db) p7_hmmcache_Close(hmm_db);
-  if (seq_db) p7_seqcache_Close(seq_db);
+  /* and any load under way */
+  if (worker_comm.reload == RELOAD_MASTER) pthread_join(worker_comm.reload_tid, NULL);
+  reload_finish(&worker_comm);
 
-  esl_stack_Destroy(cmdstack);
+  /* a load may have swapped these since startup */
+  if (worker_comm.hmm_db) p7_hmmcache_Close(worker_comm.hmm_db);
+  if (worker_comm.seq_db) p7_seqcache_Close(worker_comm.seq_db);
 
   pthread_mutex_destroy(&worker_comm.work_mutex);
   pthread_cond_destroy(&worker_comm.start_cond);
   pthread_cond_destroy(&worker_comm.complete_cond);
 
+  if (worker_comm.retry_inx) free(worker_comm.retry_inx);
+  if (worker_comm.retry_cnt) free(worker_comm.retry_cnt);
+
+  rcache_clear(&worker_comm.rcache);
+  if (worker_comm.rcache.bucket) free(worker_comm.rcache.bucket);
 
   if (worker_comm.range_list) {
     if (worker_comm.range_list->starts)  free(worker_comm.range_list->starts);
@@ -834,20 +1721,6 @@ ERROR:
 
 }
 
-static int
-hit_sorter(const void *p1, const void *p2)
-{
-  int cmp;
-
-  const P7_HIT *h1 = p1;
-  const P7_HIT *h2 = p2;
-
-  cmp  = (h1->sortkey < h2->sortkey);
-  cmp -= (h1->sortkey > h2->sortkey);
-
-  return cmp;
-}
-
 static void
 init_results(SEARCH_RESULTS *results)
 {
@@ -866,8 +1739,7 @@ init_results(SEARCH_RESULTS *results)
   results->stats.n_past_fwd  = 0;
   results->stats.Z           = 0;
 
-  results->hits              = NULL;
-  results->nhits             = 0;
+  results->th                = NULL;
   results->db_inx            = 0;
   results->db_cnt            = 0;
   results->errors            = 0;
@@ -876,23 +1748,20 @@ init_results(SEARCH_RESULTS *results)
 static void
 gather_results(QUEUE_DATA *query, WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results)
 {
-  int cnt;
-  int n;
+  int     n;
+  int     nrated = 0;
+  double  mean   = 0.0;
+  double  rate;
 
   WORKER_DATA        *worker;
 
-  /* allocate spaces to hold all the hits */
-  cnt = results->nhits + MAX_WORKERS;
-  if ((results->hits = realloc(results->hits, sizeof(HIT_LIST) * cnt)) == NULL) LOG_FATAL_MSG("malloc", errno);
-
   /* lock the workers until we have merged the results */
   if ((n = pthread_mutex_lock (&comm->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-  /* count the number of hits */
-  cnt = results->nhits;
+  /* merge the chunks; those of a worker that failed later in the search are still good */
   worker = comm->head;
   while (worker != NULL) {
-    if (worker->completed) {
+    if (worker->nchunks > 0) {
       results->stats.nhits        += worker->stats.nhits;
       results->stats.nreported    += worker->stats.nreported;
       results->stats.nincluded    += worker->stats.nincluded;
@@ -906,27 +1775,40 @@ gather_results(QUEUE_DATA *query, WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results
       results->stats.domZ_setby    = worker->stats.domZ_setby;
       results->stats.domZ          = worker->stats.domZ;
       results->stats.Z             = worker->stats.Z;
+    }
 
-      results->status.msg_size    += worker->status.msg_size - sizeof(HMMD_SEARCH_STATS);
-
-      results->hits[cnt].count     = worker->stats.nhits;
-      results->hits[cnt].data_size = worker->status.msg_size - sizeof(HMMD_SEARCH_STATS) - sizeof(P7_HIT) * worker->stats.nhits;
-      results->hits[cnt].hit       = worker->hit;
-      results->hits[cnt].data      = worker->hit_data;
-
-      worker->hit         = NULL;
-      worker->hit_data    = NULL;
+    if (worker->th != NULL) {
+      if (results->th == NULL) {
+        results->th = worker->th;
+      } else {
+        if (p7_tophits_Merge(results->th, worker->th) != eslOK) LOG_FATAL_MSG("malloc", errno);
+        p7_tophits_Destroy(worker->th);
+      }
+      worker->th = NULL;
+    }
+    worker->nchunks = 0;
 
-      worker->completed   = 0;
-      ++cnt;
-    } else {
-      results->errors++;
-      results->db_inx            = worker->srch_inx;
-      results->db_cnt            = worker->srch_cnt;
+    if (worker->busy > 0.0) {
+      mean += (double) worker->ndone / worker->busy;
+      ++nrated;
     }
 
     worker = worker->next;
   }
+  if (comm->search_failed) results->errors++;
+
+  /* update each worker's speed relative to the others, which sizes its
+   * chunks in later searches. Relative speeds carry over from one query
+   * to the next, where absolute rates would not.
+   */
+  if (nrated > 1) {
+    mean /= nrated;
+    for (worker = comm->head; worker != NULL; worker = worker->next) {
+      if (worker->busy <= 0.0) continue;
+      rate = (double) worker->ndone / worker->busy / mean;
+      worker->speed = (worker->speed > 0.0) ? 0.75 * worker->speed + 0.25 * rate : rate;
+    }
+  }
 
   if ((n = pthread_mutex_unlock (&comm->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
@@ -941,66 +1823,35 @@ gather_results(QUEUE_DATA *query, WORKERSIDE_ARGS *comm, SEARCH_RESULTS *results
   if (results->stats.Z_setby == p7_ZSETBY_NTARGETS) {
     results->stats.Z = (query->cmd_type == HMMD_CMD_SEARCH) ? results->stats.nseqs : results->stats.nmodels;
   }
-
-  results->nhits = cnt;
 }
 
+/* forward_results()
+ * Send the merged results of a search to the client. If <key> is
+ * non-NULL, the result is also kept in <cache> under <key>, which
+ * this takes ownership of.
+ */
 static void
-forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results)
+forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results, RESULT_CACHE *cache, char *key, uint64_t nkey)
 {
-  uint32_t           adj;
-  esl_pos_t          offset;
-  P7_TOPHITS         th;
   P7_PIPELINE        *pli   = NULL;
-  P7_DOMAIN         **dcl   = NULL;
-  P7_HIT             *hits  = NULL;
-  HIT_LIST           *list  = NULL;
+  char               *buf   = NULL;
+  uint64_t            nbuf  = 0;
+  uint64_t            nhits = 0;	/* 0 = send all the hits */
   int fd;
-  int i, j;
   int n;
+  int pruned;
   enum p7_pipemodes_e mode;
 
   fd    = query->sock;
-  list  = results->hits;
 
   if (query->cmd_type == HMMD_CMD_SEARCH) mode = p7_SEARCH_SEQS;
   else                                    mode = p7_SCAN_MODELS;
+
+  /* a search without hits still sends an (empty) hit block */
+  if (results->th == NULL && (results->th = p7_tophits_Create()) == NULL) LOG_FATAL_MSG("malloc", errno);
     
   /* sort the hits and apply score and E-value thresholds */
-  if (results->nhits > 0) {
-    P7_HIT *h1;
-
-    /* at this point h1->offset's are the offset of the domain structure
-     * in the block of memory pointed to by "list[n]->data".  now we will change
-     * that offset to be the true pointers back to the dcl data.
-     */
-    for (i = 0; i < results->nhits; ++i) {
-      h1 = list[i].hit;
-      for (j = 0; j < list[i].count; ++j) {
-        esl_pos_t off = h1->offset - sizeof(HMMD_SEARCH_STATS) - (sizeof(P7_HIT) * list[i].count);
-        h1->dcl = (P7_DOMAIN *)(list[i].data + off);
-        ++h1;
-      }
-    }
-
-    /* combine all the hits into a single list */
-    offset = 0;
-    if ((hits = malloc(sizeof(P7_HIT) * results->stats.nhits)) == NULL) LOG_FATAL_MSG("malloc", errno);
-    memset(hits, 0, sizeof(P7_HIT) * results->stats.nhits); /* avoiding valgrind bitching; remove if structs serialized properly */
-    for (i = 0; i < results->nhits; ++i) {
-      memcpy(hits + offset, list[i].hit, sizeof(P7_HIT) * list[i].count);
-      offset += list[i].count;
-    }
-
-    qsort(hits, results->stats.nhits, sizeof(P7_HIT), hit_sorter);
-
-    th.unsrt     = NULL;
-    th.N         = results->stats.nhits;
-    th.nreported = 0;
-    th.nincluded = 0;
-    th.is_sorted_by_sortkey = 0;
-    th.is_sorted_by_seqidx  = 0;
-      
+  if (results->th->N > 0) {
     pli = p7_pipeline_Create(query->opts, 100, 100, FALSE, mode);
     pli->nmodels     = results->stats.nmodels;
     pli->nseqs       = results->stats.nseqs;
@@ -1014,77 +1865,58 @@ forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results)
     pli->Z_setby     = results->stats.Z_setby;
     pli->domZ_setby  = results->stats.domZ_setby;
 
-    if ((dcl = malloc(sizeof(void *) * results->stats.nhits)) == NULL) LOG_FATAL_MSG("malloc", errno);
-    th.hit = (P7_HIT **)dcl;
+    p7_tophits_SortBySortkey(results->th);
 
-    for (i = 0; i < th.N; ++i) th.hit[i] = hits + i;
-    p7_tophits_Threshold(&th, pli);
+    /* pruned workers dropped hits the list can't count any more, but
+     * told us how many were reportable; those totals set domZ, and
+     * stand as the numbers reported and included.
+     */
+    pruned = esl_opt_GetBoolean(query->opts, "--prune") || esl_opt_IsOn(query->opts, "--top");
+    if (pruned && pli->domZ_setby == p7_ZSETBY_NTARGETS) {
+      pli->domZ       = (double) results->stats.nreported;
+      pli->domZ_setby = p7_ZSETBY_OPTION;
+      p7_tophits_Threshold(results->th, pli);
+      pli->domZ_setby = p7_ZSETBY_NTARGETS;
+    } else {
+      p7_tophits_Threshold(results->th, pli);
+    }
 
     /* after the top hits thresholds are checked, the number of sequences
      * and domains to be reported can change. */
-    results->stats.nreported = th.nreported;
-    results->stats.nincluded = th.nincluded;
+    if (! pruned) {
+      results->stats.nreported = results->th->nreported;
+      results->stats.nincluded = results->th->nincluded;
+    }
     results->stats.domZ      = pli->domZ;
     results->stats.Z         = pli->Z;
 
-    /* at this point the domain pointers need to be converted back to offsets
-     * within the binary data stream.
-     */
-    adj = sizeof(HMMD_SEARCH_STATS) + sizeof(P7_HIT) * results->stats.nhits;
-    h1 = hits;
-    for (i = 0; i < results->stats.nhits; ++i) {
-      char *ptr;
-
-      dcl[i] = h1->dcl;
-      h1->dcl = (P7_DOMAIN *)(((char *)NULL) + adj);
-
-      /* figure out the size of the domain and alignment info */
-      adj += sizeof(P7_DOMAIN) * h1->ndom;
-      ptr = (char *)(dcl[i] + h1->ndom);
-      for (j = 0; j < h1->ndom; ++j) {
-        n = sizeof(P7_ALIDISPLAY) + ((P7_ALIDISPLAY *)ptr)->memsize;
-        adj += n;
-        ptr += n;
-      }
-      ++h1;
-    }
+    /* each worker sent its own top <n>; keep the best <n> of those */
+    if (esl_opt_IsOn(query->opts, "--top") && results->th->N > (uint64_t) esl_opt_GetInteger(query->opts, "--top"))
+      nhits = esl_opt_GetInteger(query->opts, "--top");
   }
 
-  /* add the size of the status structure to the message size */
-  results->status.msg_size += sizeof(HMMD_SEARCH_STATS);
+  /* the hits past a --top cut aren't sent */
+  if (p7_tophits_Pack(results->th, nhits, &buf, &nbuf) != eslOK) LOG_FATAL_MSG("malloc", errno);
+  results->stats.nhits     = (nhits > 0 ? nhits : results->th->N);
+  results->status.msg_size = sizeof(HMMD_SEARCH_STATS) + nbuf;
 
   /* send back a successful status message */
   n = sizeof(HMMD_SEARCH_STATUS);
-  if (writen(fd, &results->status, n) != n) {
+  if (client_write(fd, &results->status, n) != n) {
     p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
     goto CLEAR;
   }
 
   n = sizeof(HMMD_SEARCH_STATS);
-  if (writen(fd, &results->stats, n) != n) {
+  if (client_write(fd, &results->stats, n) != n) {
     p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
     goto CLEAR;
   }
 
-  if (results->stats.nhits > 0) {
-    /* send all the hit data */
-    n = sizeof(P7_HIT) * results->stats.nhits;
-    if (writen(fd, hits, n) != n) {
-      p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
-      goto CLEAR;
-    }
-
-    for (i = 0; i < results->stats.nhits; ++i) {
-      if (i + 1 < results->stats.nhits) {
-        n = (char *)hits[i+1].dcl - (char *)hits[i].dcl;
-      } else {
-        n = ((char *)NULL) + results->status.msg_size - (char *)hits[i].dcl;
-      }
-      if (writen(fd, dcl[i], n) != n) {
-        p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
-        goto CLEAR;
-      }
-    }
+  /* send all the hit data */
+  if (client_write(fd, buf, nbuf) != nbuf) {
+    p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, query->ip_addr, errno, strerror(errno));
+    goto CLEAR;
   }
 
   printf("Results for %s (%d) sent %" PRId64 " bytes\n", query->ip_addr, fd, results->status.msg_size);
@@ -1092,18 +1924,16 @@ forward_results(QUEUE_DATA *query, SEARCH_RESULTS *results)
   fflush(stdout);
 
  CLEAR:
-  /* free all the data */
-  for (i = 0; i < results->nhits; ++i) {
-    if (list[i].hit  != NULL) free(list[i].hit);
-    if (list[i].data != NULL) free(list[i].data);
-    list[i].hit  = NULL;
-    list[i].data = NULL;
+  /* keep the result for the next time the query comes in */
+  if (key != NULL) {
+    rcache_store(cache, key, nkey, &results->status, &results->stats, buf, nbuf);
+    buf = NULL;
   }
 
-  if (pli)  p7_pipeline_Destroy(pli);
-  if (list) free(list);
-  if (hits) free(hits);
-  if (dcl)  free(dcl);
+  /* free all the data */
+  if (pli)         p7_pipeline_Destroy(pli);
+  if (buf)         free(buf);
+  if (results->th) p7_tophits_Destroy(results->th);
 
   init_results(results);
 }
@@ -1112,9 +1942,9 @@ static void
 destroy_worker(WORKER_DATA *worker)
 {
   if (worker == NULL) {
-    if (worker->hit      != NULL) free(worker->hit);
     if (worker->hit_data != NULL) free(worker->hit_data);
     if (worker->err_buf  != NULL) free(worker->err_buf);
+    if (worker->th       != NULL) p7_tophits_Destroy(worker->th);
 
     memset(worker, 0, sizeof(WORKER_DATA));
     free(worker);
@@ -1124,7 +1954,6 @@ destroy_worker(WORKER_DATA *worker)
 static void
 clear_results(WORKERSIDE_ARGS *args, SEARCH_RESULTS *results)
 {
-  int i;
   int n;
   WORKER_DATA *worker;
 
@@ -1136,13 +1965,13 @@ clear_results(WORKERSIDE_ARGS *args, SEARCH_RESULTS *results)
   /* free all the results */
   worker = args->head;
   while (worker != NULL) {
-    if (worker->hit      != NULL) free(worker->hit);
     if (worker->hit_data != NULL) free(worker->hit_data);
     if (worker->err_buf  != NULL) free(worker->err_buf);
+    if (worker->th       != NULL) p7_tophits_Destroy(worker->th);
 
-    worker->hit      = NULL;
     worker->hit_data = NULL;
     worker->err_buf  = NULL;
+    worker->th       = NULL;
       
     worker->completed = 0;
     worker = worker->next;
@@ -1150,14 +1979,7 @@ clear_results(WORKERSIDE_ARGS *args, SEARCH_RESULTS *results)
 
   if ((n = pthread_mutex_unlock (&args->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
 
-  for (i = 0; i < results->nhits; ++i) {
-    if (results->hits[i].hit  != NULL) free(results->hits[i].hit);
-    if (results->hits[i].data != NULL) free(results->hits[i].data);
-    results->hits[i].hit  = NULL;
-    results->hits[i].data = NULL;
-  }
-
-  if (results->hits != NULL) free(results->hits);
+  if (results->th != NULL) p7_tophits_Destroy(results->th);
   init_results(results);
 }
 
@@ -1167,7 +1989,7 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
   QUEUE_DATA    *parms    = NULL;     /* cmd to queue           */
   HMMD_COMMAND  *cmd      = NULL;     /* parsed cmd to process  */
   int            fd       = data->sock_fd;
-  ESL_STACK     *cmdstack = data->cmdstack;
+  CMD_QUEUE     *cmdqueue = data->cmdqueue;
   int            n;
   char          *s;
   time_t         date;
@@ -1184,7 +2006,16 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
 
   /* process the different commands */
   s = strsep(&ptr, " \t");
-  if (strcmp(s, "shutdown") == 0) 
+  if (strcmp(s, "stats") == 0)
+    {
+      char report[MAX_BUFFER];
+
+      /* answered right away, not queued */
+      cmdqueue_report(cmdqueue, report, sizeof(report));
+      client_msg(fd, eslOK, "%s", report);
+      return;
+    }
+  else if (strcmp(s, "shutdown") == 0) 
     {
       if ((cmd = malloc(sizeof(HMMD_HEADER))) == NULL) LOG_FATAL_MSG("malloc", errno);
       memset(cmd, 0, sizeof(HMMD_HEADER)); /* avoid uninit bytes & valgrind bitching. Remove, if we ever serialize structs correctly. */
@@ -1196,12 +2027,13 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
       char **db;
       char  *hmmdb = NULL;
       char  *seqdb = NULL;
+      char  *delta = NULL;
 
       /* skip leading white spaces */
       while (*ptr == ' ' || *ptr == '\t') ++ptr;
       if (!*ptr) 
 	{
-	  client_msg(fd, eslEINVAL, "Load command missing --seqdb or --hmmdb option\n");
+	  client_msg(fd, eslEINVAL, "Load command missing --seqdb, --seqdelta or --hmmdb option\n");
 	  return;
 	}
 
@@ -1211,6 +2043,7 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
 
 	  db = NULL;
 	  if      (strcmp (s, "--seqdb") == 0) db = &seqdb;
+	  else if (strcmp (s, "--seqdelta") == 0) db = &delta;
 	  else if (strcmp (s, "--hmmdb") == 0) db = &hmmdb;
     
 	  if       (db == NULL) { client_msg(fd, eslEINVAL, "Unknown option %s for load command\n", s);         return; }
@@ -1224,6 +2057,8 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
 	  /* skip leading white spaces */
 	  while (*ptr == ' ' || *ptr == '\t') ++ptr;
 	}
+      if (seqdb != NULL && delta != NULL) { client_msg(fd, eslEINVAL, "Options --seqdb and --seqdelta for load command are incompatible\n"); return; }
+      if (delta != NULL) seqdb = delta;
 
       n = sizeof(HMMD_COMMAND);
       if (seqdb) n += strlen(seqdb) + 1;
@@ -1236,13 +2071,17 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
 
       s = cmd->init.data;
 
+      /* the counts only say which databases are named; offsets can be 0 */
       if (seqdb != NULL) {
+	cmd->init.db_cnt    = 1;
+	cmd->init.append    = (delta != NULL);
 	cmd->init.seqdb_off = s - cmd->init.data;
 	strcpy(s, seqdb);
 	s += strlen(seqdb) + 1;
       }
 
       if (hmmdb != NULL) {
+	cmd->init.hmm_cnt   = 1;
 	cmd->init.hmmdb_off = s - cmd->init.data;
 	strcpy(s, hmmdb);
 	s += strlen(hmmdb) + 1;
@@ -1294,6 +2133,7 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
   parms->sock       = fd;
   parms->cmd_type   = cmd->hdr.command;
   parms->query_type = 0;
+  parms->priority   = 0;
 
   date = time(NULL);
   ctime_r(&date, timestamp);
@@ -1301,23 +2141,23 @@ process_ServerCmd(char *ptr, CLIENTSIDE_ARGS *data)
   printf("Queuing command %d from %s (%d)\n", cmd->hdr.command, parms->ip_addr, parms->sock);
   fflush(stdout);
 
-  esl_stack_PPush(cmdstack, parms);
+  cmdqueue_push(cmdqueue, parms);
 }
 
-static int
-clientside_loop(CLIENTSIDE_ARGS *data)
+/* client_request()
+ * Parse one complete request <buffer> from a client, a '!' server
+ * command or a '@' search, and queue it. Problems with the request
+ * are reported back to the client. The caller owns <buffer>.
+ */
+static void
+client_request(CLIENTSIDE_ARGS *data, char *buffer)
 {
   int                status;
 
   char              *ptr;
-  char              *buffer;
   char               opt_str[MAX_BUFFER];
 
   int                dbx;
-  int                buf_size;
-  int                remaining;
-  int                amount;
-  int                eod;
   int                n;
 
   P7_HMM            *hmm     = NULL;     /* query HMM                      */
@@ -1328,7 +2168,7 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   ESL_GETOPTS       *opts    = NULL;     /* search specific options        */
   HMMD_COMMAND      *cmd     = NULL;     /* search cmd to send to workers  */
 
-  ESL_STACK         *cmdstack = data->cmdstack;
+  CMD_QUEUE         *cmdqueue = data->cmdqueue;
   QUEUE_DATA        *parms;
   jmp_buf            jmp_env;
   time_t             date;
@@ -1336,52 +2176,6 @@ clientside_loop(CLIENTSIDE_ARGS *data)
 
   ESL_ALPHABET      *abcDNA = NULL;       /* DNA sequence alphabet         */
 
-  buf_size = MAX_BUFFER;
-  if ((buffer  = malloc(buf_size))   == NULL) LOG_FATAL_MSG("malloc", errno);
-  ptr = buffer;
-  remaining = buf_size;
-  amount = 0;
-
-  eod = 0;
-  while (!eod) {
-    int   l;
-    char *s;
-
-    /* Receive message from client */
-    if ((n = read(data->sock_fd, ptr, remaining)) < 0) {
-      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, data->ip_addr, errno, strerror(errno));
-      return 1;
-    }
-
-    if (n == 0) return 1;
-
-    ptr += n;
-    amount += n;
-    remaining -= n;
-
-    /* scan backwards till we hit the start of the line */
-    l = amount;
-    s = ptr - 1;
-    while (l-- > 0 && (*s == '\n' || *s == '\r')) --s;
-    while (l-- > 0 && (*s != '\n' && *s != '\r')) --s;
-    eod = (amount > 1 && *(s + 1) == '/' && *(s + 2) == '/' );
-
-    /* if the buffer is full, make it larger */
-    if (!eod && remaining == 0) {
-      if ((buffer = realloc(buffer, buf_size * 2)) == NULL) LOG_FATAL_MSG("realloc", errno);
-      ptr = buffer + buf_size;
-      remaining = buf_size;
-      buf_size *= 2;
-    }
-  }
-
-  /* zero terminate the buffer */
-  if (remaining == 0) {
-    if ((buffer = realloc(buffer, buf_size + 1)) == NULL) LOG_FATAL_MSG("realloc", errno);
-    ptr = buffer + buf_size;
-  }
-  *ptr = 0;
-
   /* skip all leading white spaces */
   ptr = buffer;
   while (*ptr && isspace(*ptr)) ++ptr;
@@ -1389,8 +2183,7 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   opt_str[0] = 0;
   if (*ptr == '!') {
     process_ServerCmd(ptr, data);
-    free(buffer);
-    return 0;
+    return;
   } else if (*ptr == '@') {
     char *s = ++ptr;
 
@@ -1407,14 +2200,12 @@ clientside_loop(CLIENTSIDE_ARGS *data)
     while (*ptr && isspace(*ptr)) ++ptr;
   } else {
     client_msg(data->sock_fd, eslEFORMAT, "Missing options string");
-    free(buffer);
-    return 0;
+    return;
   }
 
   if (strncmp(ptr, "//", 2) == 0) {
     client_msg(data->sock_fd, eslEFORMAT, "Missing search sequence/hmm");
-    free(buffer);
-    return 0;
+    return;
   }
 
   if (!setjmp(jmp_env)) {
@@ -1477,8 +2268,7 @@ clientside_loop(CLIENTSIDE_ARGS *data)
     if (seq  != NULL) esl_sq_Destroy(seq);
     if (sco  != NULL) esl_scorematrix_Destroy(sco);
 
-    free(buffer);
-    return 0;
+    return;
   }
 
   if ((parms = malloc(sizeof(QUEUE_DATA))) == NULL) LOG_FATAL_MSG("malloc", errno);
@@ -1581,6 +2371,7 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   parms->sock       = data->sock_fd;
   parms->cmd_type   = cmd->hdr.command;
   parms->query_type = (seq != NULL) ? HMMD_SEQUENCE : HMMD_HMM;
+  parms->priority   = esl_opt_GetInteger(opts, "--priority");
 
   date = time(NULL);
   ctime_r(&date, timestamp);
@@ -1594,89 +2385,366 @@ clientside_loop(CLIENTSIDE_ARGS *data)
   printf("%s", opt_str);	/* note opt_str already has trailing \n */
   fflush(stdout);
 
-  esl_stack_PPush(cmdstack, parms);
-
-  free(buffer);
-  return 0;
+  if (cmdqueue_push(cmdqueue, parms) != eslOK) {
+    printf("Rejected: %s has %d searches queued or running\n", data->ip_addr, cmdqueue->max_client);
+    fflush(stdout);
+    client_msg(data->sock_fd, eslFAIL, "Too many searches queued from %s; at most %d are allowed\n", data->ip_addr, cmdqueue->max_client);
+    free_QueueData(parms);
+  }
 }
 
 
-/* discard_function()
- * function handed to esl_stack_DiscardSelected() to remove
- * all commands in the stack that are associated with a
- * particular client socket, because we're closing that
- * client down. Prototype to this is dictate by the generalized
- * interface to esl_stack_DiscardSelected().
+/* client_nonblock()
+ * Put socket <fd> in non-blocking mode.
  */
 static int
-discard_function(void *elemp, void *args)
+client_nonblock(int fd)
 {
-  QUEUE_DATA  *elem = (QUEUE_DATA *) elemp;
-  int          fd   = * (int *) args;
+  int flags;
 
-  if (elem->sock == fd) 
-    {
-      free_QueueData(elem);
-      return TRUE;
+  if ((flags = fcntl(fd, F_GETFL, 0)) < 0)           return eslFAIL;
+  if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)   return eslFAIL;
+  return eslOK;
+}
+
+/* client_watch()
+ * Tell the event loop what to wait for on socket <fd>: input always,
+ * and room for output too if <want_write> is TRUE. <add> is TRUE for
+ * a socket the loop is not watching yet.
+ */
+static void
+client_watch(int fd, int add, int want_write)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events  = EPOLLIN | (want_write ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  if (epoll_ctl(clients.epfd, (add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD), fd, &ev) < 0) {
+    p7_syslog(LOG_ERR,"[%s:%d] - epoll_ctl (%d) error %d - %s\n", __FILE__, __LINE__, fd, errno, strerror(errno));
+  }
+#else
+  char c = 0;
+
+  /* the poll set is rebuilt on every pass, so only wake the loop up
+   * when it has to start waiting to send.
+   */
+  if (want_write && write(clients.wake[1], &c, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    p7_syslog(LOG_ERR,"[%s:%d] - waking client loop error %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+  }
+#endif
+}
+
+/* client_flush()
+ * Send as much of a connection's pending output as the socket will
+ * take without blocking, and set <want_write> if any is left. Caller
+ * holds <clients.mutex>. Returns <eslOK> on success, <eslEWRITE> if
+ * the connection is broken.
+ */
+static int
+client_flush(CLIENTSIDE_ARGS *c)
+{
+  ssize_t n;
+
+  while (c->opos < c->olen) {
+    if ((n = write(c->sock_fd, c->obuf + c->opos, c->olen - c->opos)) < 0) {
+      if (errno == EINTR)                         continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, c->ip_addr, errno, strerror(errno));
+      return eslEWRITE;
     }
-  return FALSE;
+    c->opos += n;
+  }
+
+  if (c->opos == c->olen) c->opos = c->olen = 0;
+  c->want_write = (c->olen > 0);
+  return eslOK;
 }
 
-static void *
-clientside_thread(void *arg)
+/* client_write()
+ * Send <n> bytes of <buf> to the client on socket <fd>. The bytes are
+ * queued on the connection and sent as the socket allows, so this
+ * never blocks on a slow client. Callable from any thread. Returns
+ * <n>, or -1 (with errno set) if the connection is closed or broken;
+ * a broken connection is shut down so that the event loop closes it.
+ */
+static size_t
+client_write(int fd, const void *buf, size_t n)
 {
-  int              eof;
-  CLIENTSIDE_ARGS *data = (CLIENTSIDE_ARGS *)arg;
+  CLIENTSIDE_ARGS *c;
+  size_t           ret = n;
+  int              err = 0;
+  int              k;
 
-  /* Guarantees that thread resources are deallocated upon return */
-  pthread_detach(pthread_self()); 
+  if ((k = pthread_mutex_lock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex lock", k);
 
-  eof = 0;
-  while (!eof) {
-    eof = clientside_loop(data);
+  c = (fd >= 0 && fd < clients.nalloc) ? clients.conn[fd] : NULL;
+  if (c == NULL) {
+    err = ENOTCONN;
+    ret = -1;
+  } else {
+    if (c->opos > 0) {
+      memmove(c->obuf, c->obuf + c->opos, c->olen - c->opos);
+      c->olen -= c->opos;
+      c->opos  = 0;
+    }
+    if (c->olen + n > c->oalloc) {
+      c->oalloc = ESL_MAX(c->olen + n, 2 * c->oalloc);
+      if ((c->obuf = realloc(c->obuf, c->oalloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+    }
+    memcpy(c->obuf + c->olen, buf, n);
+    c->olen += n;
+
+    /* unless the loop is already waiting to send, try right away */
+    if (! c->want_write) {
+      if (client_flush(c) != eslOK) {
+        err = EPIPE;
+        ret = -1;
+        c->opos = c->olen = 0;
+        shutdown(fd, SHUT_RDWR);
+      } else if (c->want_write) {
+        client_watch(fd, FALSE, TRUE);
+      }
+    }
   }
 
-  /* remove any commands in stack associated with this client's socket */
-  esl_stack_DiscardSelected(data->cmdstack, discard_function, &(data->sock_fd));
+  if ((k = pthread_mutex_unlock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex unlock", k);
+
+  if (err) errno = err;
+  return ret;
+}
+
+/* client_close()
+ * Drop a client connection: discard any commands it still has queued,
+ * stop watching its socket and close it.
+ */
+static void
+client_close(CLIENTSIDE_ARGS *c)
+{
+  int fd = c->sock_fd;
+  int n;
+
+  /* remove any commands in the queue associated with this client's socket */
+  cmdqueue_discard(c->cmdqueue, fd);
 
-  printf("Closing %s (%d)\n", data->ip_addr, data->sock_fd);
+  printf("Closing %s (%d)\n", c->ip_addr, fd);
   fflush(stdout);
 
-  close(data->sock_fd);
-  free(data);
+  if ((n = pthread_mutex_lock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  clients.conn[fd] = NULL;
+#ifdef HAVE_SYS_EPOLL_H
+  epoll_ctl(clients.epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+  close(fd);
+  if ((n = pthread_mutex_unlock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
-  pthread_exit(NULL);
+  free(c->ibuf);
+  free(c->obuf);
+  free(c);
 }
 
-static void *
-client_comm_thread(void *arg)
+/* client_accept()
+ * Accept every connection waiting on the listening socket.
+ */
+static void
+client_accept(CLIENTSIDE_ARGS *data)
 {
   int                  n;
   int                  fd;
   int                  addrlen;
-  pthread_t            thread_id;
-
   struct sockaddr_in   addr;
+  CLIENTSIDE_ARGS     *c;
+
+  for ( ;; ) {
+    n = sizeof(addr);
+    if ((fd = accept(data->sock_fd, (struct sockaddr *)&addr, (unsigned int *)&n)) < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      LOG_FATAL_MSG("accept", errno);
+    }
+    if (client_nonblock(fd) != eslOK) LOG_FATAL_MSG("fcntl", errno);
+
+    if ((c = malloc(sizeof(CLIENTSIDE_ARGS))) == NULL) LOG_FATAL_MSG("malloc", errno);
+    memset(c, 0, sizeof(CLIENTSIDE_ARGS));
+    c->cmdqueue   = data->cmdqueue;
+    c->sock_fd    = fd;
+
+    addrlen = sizeof(c->ip_addr);
+    strncpy(c->ip_addr, inet_ntoa(addr.sin_addr), addrlen);
+    c->ip_addr[addrlen-1] = 0;
+
+    c->ialloc = MAX_BUFFER;
+    if ((c->ibuf = malloc(c->ialloc)) == NULL) LOG_FATAL_MSG("malloc", errno);
+
+    if ((n = pthread_mutex_lock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+    if (fd >= clients.nalloc) {
+      int nalloc = ESL_MAX(fd + 1, 2 * clients.nalloc);
+      if ((clients.conn = realloc(clients.conn, sizeof(CLIENTSIDE_ARGS *) * nalloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+      memset(clients.conn + clients.nalloc, 0, sizeof(CLIENTSIDE_ARGS *) * (nalloc - clients.nalloc));
+      clients.nalloc = nalloc;
+    }
+    clients.conn[fd] = c;
+    if ((n = pthread_mutex_unlock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+    client_watch(fd, TRUE, FALSE);
+  }
+}
+
+/* client_read()
+ * Read whatever a client has sent, and hand each complete request in
+ * it to client_request(). A request runs up to the end of a line
+ * starting with "//". Returns <eslOK>, or <eslEOF> if the client has
+ * closed the connection or it is broken.
+ */
+static int
+client_read(CLIENTSIDE_ARGS *c)
+{
+  int     start;
+  int     p, q;
+  int     eof = FALSE;
+  char    save;
+  ssize_t n;
+
+  for ( ;; ) {
+    /* if the buffer is full, make it larger; keep a byte for the terminating zero */
+    if (c->ialloc - c->ilen < MAX_BUFFER) {
+      c->ialloc *= 2;
+      if ((c->ibuf = realloc(c->ibuf, c->ialloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+    }
+
+    if ((n = read(c->sock_fd, c->ibuf + c->ilen, c->ialloc - c->ilen - 1)) < 0) {
+      if (errno == EINTR)                          continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, c->ip_addr, errno, strerror(errno));
+      return eslEOF;
+    }
+    if (n == 0) { eof = TRUE; break; }
+    c->ilen += n;
+  }
+
+  /* p always sits at the start of a line; lines before iscan were
+   * looked at on an earlier call.
+   */
+  start = 0;
+  p     = c->iscan;
+  while (p < c->ilen) {
+    if (c->ibuf[p] == '/' && (p + 1 == c->ilen || c->ibuf[p+1] == '/')) {
+      if (p + 1 == c->ilen) break;  /* maybe the start of "//"; wait for more */
+
+      q = p + 2;
+      while (q < c->ilen && c->ibuf[q] != '\n' && c->ibuf[q] != '\r') ++q;
+
+      /* zero terminate the request in place while it is parsed */
+      save = c->ibuf[q];
+      c->ibuf[q] = 0;
+      client_request(c, c->ibuf + start);
+      c->ibuf[q] = save;
+
+      start = p = q;
+      continue;
+    }
+
+    q = p;
+    while (q < c->ilen && c->ibuf[q] != '\n' && c->ibuf[q] != '\r') ++q;
+    if (q == c->ilen) break;        /* incomplete line; look again when more arrives */
+    p = q + 1;
+  }
+
+  /* drop the requests handled, keep the start of the next one */
+  if (start > 0) {
+    memmove(c->ibuf, c->ibuf + start, c->ilen - start);
+    c->ilen -= start;
+    p       -= start;
+  }
+  c->iscan = p;
+
+  return (eof ? eslEOF : eslOK);
+}
+
+/* client_event()
+ * Handle readiness on client socket <fd>.
+ */
+static void
+client_event(int fd, int readable, int writable)
+{
+  CLIENTSIDE_ARGS *c = clients.conn[fd];  /* only this thread changes the table */
+  int              status;
+  int              n;
+
+  if (c == NULL) return;
+
+  if (writable) {
+    if ((n = pthread_mutex_lock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+    status = client_flush(c);
+    if (status == eslOK && ! c->want_write) client_watch(fd, FALSE, FALSE);
+    if ((n = pthread_mutex_unlock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+    if (status != eslOK) { client_close(c); return; }
+  }
+
+  if (readable && client_read(c) != eslOK) client_close(c);
+}
 
-  CLIENTSIDE_ARGS     *targs    = NULL;
+static void *
+client_comm_thread(void *arg)
+{
+  int                  i;
+  int                  n;
   CLIENTSIDE_ARGS     *data     = (CLIENTSIDE_ARGS *)arg;
 
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event   ev[MAX_EVENTS];
+
   for ( ;; ) {
+    if ((n = epoll_wait(clients.epfd, ev, MAX_EVENTS, -1)) < 0) {
+      if (errno == EINTR) continue;
+      LOG_FATAL_MSG("epoll_wait", errno);
+    }
 
-    /* Wait for a client to connect */
-    n = sizeof(addr);
-    if ((fd = accept(data->sock_fd, (struct sockaddr *)&addr, (unsigned int *)&n)) < 0) LOG_FATAL_MSG("accept", errno);
+    for (i = 0; i < n; ++i) {
+      if (ev[i].data.fd == data->sock_fd) client_accept(data);
+      else client_event(ev[i].data.fd, (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)), (ev[i].events & EPOLLOUT));
+    }
+  }
+#else
+  int                  k;
+  int                  npfd;
+  char                 drain[64];
 
-    if ((targs = malloc(sizeof(CLIENTSIDE_ARGS))) == NULL) LOG_FATAL_MSG("malloc", errno);
-    targs->cmdstack   = data->cmdstack;
-    targs->sock_fd    = fd;
+  for ( ;; ) {
+    /* build the poll set: the listening socket, the wake up pipe, then every client */
+    if ((k = pthread_mutex_lock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex lock", k);
+    if (clients.pfd_alloc < clients.nalloc + 2) {
+      clients.pfd_alloc = clients.nalloc + 2;
+      if ((clients.pfd = realloc(clients.pfd, sizeof(struct pollfd) * clients.pfd_alloc)) == NULL) LOG_FATAL_MSG("realloc", errno);
+    }
+    clients.pfd[0].fd     = data->sock_fd;
+    clients.pfd[0].events = POLLIN;
+    clients.pfd[1].fd     = clients.wake[0];
+    clients.pfd[1].events = POLLIN;
+    npfd = 2;
+    for (i = 0; i < clients.nalloc; ++i) {
+      if (clients.conn[i] == NULL) continue;
+      clients.pfd[npfd].fd     = i;
+      clients.pfd[npfd].events = POLLIN | (clients.conn[i]->want_write ? POLLOUT : 0);
+      ++npfd;
+    }
+    if ((k = pthread_mutex_unlock(&clients.mutex)) != 0) LOG_FATAL_MSG("mutex unlock", k);
 
-    addrlen = sizeof(targs->ip_addr);
-    strncpy(targs->ip_addr, inet_ntoa(addr.sin_addr), addrlen);
-    targs->ip_addr[addrlen-1] = 0;
+    if ((n = poll(clients.pfd, npfd, -1)) < 0) {
+      if (errno == EINTR) continue;
+      LOG_FATAL_MSG("poll", errno);
+    }
 
-    if ((n = pthread_create(&thread_id, NULL, clientside_thread, targs)) != 0) LOG_FATAL_MSG("thread create", n);
+    if (clients.pfd[0].revents) client_accept(data);
+    if (clients.pfd[1].revents) while (read(clients.wake[0], drain, sizeof(drain)) > 0) ;
+    for (i = 2; i < npfd; ++i) {
+      if (clients.pfd[i].revents == 0 || (clients.pfd[i].revents & POLLNVAL)) continue;
+      client_event(clients.pfd[i].fd, (clients.pfd[i].revents & (POLLIN | POLLHUP | POLLERR)), (clients.pfd[i].revents & POLLOUT));
+    }
   }
+#endif
   
   pthread_exit(NULL);
 }
@@ -1719,8 +2787,23 @@ setup_clientside_comm(ESL_GETOPTS *opts, CLIENTSIDE_ARGS *args)
 
   /* Mark the socket so it will listen for incoming connections */
   if (listen(sock_fd, esl_opt_GetInteger(opts, "--ccncts")) < 0) LOG_FATAL_MSG("listen", errno);
+  if (client_nonblock(sock_fd) != eslOK) LOG_FATAL_MSG("fcntl", errno);
   args->sock_fd = sock_fd;
 
+  /* set up the client event loop, watching the listening socket */
+  if ((n = pthread_mutex_init(&clients.mutex, NULL)) != 0) LOG_FATAL_MSG("mutex init", n);
+  clients.conn   = NULL;
+  clients.nalloc = 0;
+#ifdef HAVE_SYS_EPOLL_H
+  if ((clients.epfd = epoll_create(MAX_EVENTS)) < 0) LOG_FATAL_MSG("epoll_create", errno);
+#else
+  if (pipe(clients.wake) < 0) LOG_FATAL_MSG("pipe", errno);
+  if (client_nonblock(clients.wake[0]) != eslOK || client_nonblock(clients.wake[1]) != eslOK) LOG_FATAL_MSG("fcntl", errno);
+  clients.pfd       = NULL;
+  clients.pfd_alloc = 0;
+#endif
+  client_watch(sock_fd, TRUE, FALSE);
+
   if ((n = pthread_create(&thread_id, NULL, client_comm_thread, (void *)args)) != 0) LOG_FATAL_MSG("socket", n);
 }
 
@@ -1728,8 +2811,9 @@ static void
 workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
 {
   ESL_STOPWATCH      *w     = NULL;
-  HMMD_SEARCH_STATS  *stats = NULL;
+  HMMD_SEARCH_STATS   stats;
   HMMD_COMMAND        cmd;
+  P7_TOPHITS         *th    = NULL;
   int    n;
   int    size;
   int    total;
@@ -1743,8 +2827,18 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
     /* wait for the next search object */
     if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-    /* wait for the master's signal to start the calculations */
-    while (worker->cmd == NULL) {
+    /* Wait for the master's signal to start the calculations. A
+     * worker out of chunks stays on its search until the search is
+     * over, i.e. until the master bumps <cmd_gen>: a failed worker's
+     * chunk may still be requeued for it to take.
+     */
+    for ( ; ; ) {
+      if (worker->cmd != NULL && worker->cmd_gen != data->cmd_gen) worker->cmd = NULL;
+
+      if (worker->cmd != NULL) {
+        if (worker->cmd->hdr.command != HMMD_CMD_SEARCH && worker->cmd->hdr.command != HMMD_CMD_SCAN) break;
+        if (next_chunk(data, worker)) break;
+      }
       if ((n = pthread_cond_wait(&data->start_cond, &data->work_mutex)) != 0) LOG_FATAL_MSG("cond wait", n);
     }
 
@@ -1754,8 +2848,7 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
     if (worker->cmd->hdr.command == HMMD_CMD_RESET) {
       break;
     } else if (worker->cmd->hdr.command == HMMD_CMD_SHUTDOWN) {
-      fd_set rset;
-      struct timeval tv;
+      struct pollfd pfd;
       
       n = MSG_SIZE(worker->cmd);
       if (writen(worker->sock_fd, worker->cmd, n) != n) {
@@ -1763,14 +2856,12 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
         break;
       }
 
-      FD_ZERO(&rset);
-      FD_SET(worker->sock_fd, &rset);
+      /* give the worker 2 seconds to acknowledge */
+      pfd.fd     = worker->sock_fd;
+      pfd.events = POLLIN;
 
-      tv.tv_sec = 2;
-      tv.tv_usec = 0;
-
-      if ((n = select(worker->sock_fd + 1, &rset, NULL, NULL, &tv)) < 0) {
-        p7_syslog(LOG_ERR,"[%s:%d] - select %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+      if ((n = poll(&pfd, 1, 2000)) < 0) {
+        p7_syslog(LOG_ERR,"[%s:%d] - poll %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
       } else {
         if (n == 0) {
           p7_syslog(LOG_ERR,"[%s:%d] - shutdown %s is not responding\n", __FILE__, __LINE__, worker->ip_addr);
@@ -1787,6 +2878,32 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
         }
       }
       break;
+    } else if (worker->cmd->hdr.command == HMMD_CMD_PRELOAD || worker->cmd->hdr.command == HMMD_CMD_SWAP) {
+
+      /* the worker answers with a bare header carrying its status */
+      n = MSG_SIZE(worker->cmd);
+      if (writen(worker->sock_fd, worker->cmd, n) != n) {
+        p7_syslog(LOG_ERR,"[%s:%d] - writing %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+        break;
+      }
+      if (readn(worker->sock_fd, &cmd, sizeof(HMMD_HEADER)) == -1) {
+        p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
+        break;
+      }
+
+      /* a worker that could not swap no longer has the master's databases; drop it */
+      if (cmd.hdr.command == HMMD_CMD_SWAP && cmd.hdr.status != eslOK) {
+        p7_syslog(LOG_ERR,"[%s:%d] - %s failed to swap databases (%d)\n", __FILE__, __LINE__, worker->ip_addr, cmd.hdr.status);
+        break;
+      }
+
+      if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+      worker->status.status = cmd.hdr.status;
+      worker->cmd           = NULL;
+      ++data->completed;
+      if ((n = pthread_cond_broadcast(&data->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
+      if ((n = pthread_mutex_unlock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+      continue;
     }
 
     //printf ("Writing %d bytes to %s [MSG = %d/%d]\n", (int)MSG_SIZE(worker->cmd), worker->ip_addr, worker->cmd->hdr.command, worker->cmd->hdr.length);
@@ -1825,6 +2942,7 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
     if (worker->status.status != eslOK) {
       n = worker->status.msg_size;
       total += n; 
+      if (worker->err_buf != NULL) free(worker->err_buf);
       if ((worker->err_buf = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
       worker->err_buf[0] = 0;
       if ((size = readn(worker->sock_fd, worker->err_buf, n)) == -1) {
@@ -1833,43 +2951,69 @@ workerside_loop(WORKERSIDE_ARGS *data, WORKER_DATA *worker)
       }
     } else {
 
-      n = sizeof(worker->stats);
+      n = sizeof(stats);
       total += n;
-      if ((size = readn(worker->sock_fd, &worker->stats, n)) == -1) {
-        p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
-        break;
-      }
-
-      stats = &worker->stats;
-
-      /* read in the hits */
-      n = sizeof(P7_HIT) * stats->nhits;
-      if ((worker->hit = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
-      if ((size = readn(worker->sock_fd, worker->hit, n)) == -1) {
+      if ((size = readn(worker->sock_fd, &stats, n)) == -1) {
         p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
         break;
       }
 
-      /* read in the domain and alignment info */
-      n = worker->status.msg_size - sizeof(worker->stats) - n;
+      /* read in the packed hits, domains and alignments */
+      n = worker->status.msg_size - sizeof(stats);
+      total += n;
       if ((worker->hit_data = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
       if ((size = readn(worker->sock_fd, worker->hit_data, n)) == -1) {
         p7_syslog(LOG_ERR,"[%s:%d] - reading %s error %d - %s\n", __FILE__, __LINE__, worker->ip_addr, errno, strerror(errno));
         break;
       }
+
+      /* unpack them outside the lock; a block we can't read fails the chunk */
+      if (p7_tophits_Unpack(worker->hit_data, n, &th, NULL) != eslOK) {
+        p7_syslog(LOG_ERR,"[%s:%d] - unreadable hit block from %s\n", __FILE__, __LINE__, worker->ip_addr);
+        worker->status.status = eslEFORMAT;
+      }
+      free(worker->hit_data);
+      worker->hit_data = NULL;
     }
 
     esl_stopwatch_Stop(w);
 
     if ((n = pthread_mutex_lock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
 
-    /* set the state of the worker to completed */
-    worker->cmd       = NULL;
-    worker->completed = 1;
-    worker->total     = total;
-    ++data->completed;
+    if (worker->status.status != eslOK) {
+      data->search_failed = TRUE;
+    } else {
+      /* merge the chunk's hits into the worker's, and add its stats to the worker's */
+      if (worker->th == NULL) {
+        worker->th = th;
+      } else {
+        if (p7_tophits_Merge(worker->th, th) != eslOK) LOG_FATAL_MSG("malloc", errno);
+        p7_tophits_Destroy(th);
+      }
+      th = NULL;
+      worker->nchunks++;
+
+      worker->stats.nhits        += stats.nhits;
+      worker->stats.nreported    += stats.nreported;
+      worker->stats.nincluded    += stats.nincluded;
+      worker->stats.n_past_msv   += stats.n_past_msv;
+      worker->stats.n_past_bias  += stats.n_past_bias;
+      worker->stats.n_past_vit   += stats.n_past_vit;
+      worker->stats.n_past_fwd   += stats.n_past_fwd;
+      worker->stats.Z             = stats.Z;
+      worker->stats.domZ          = stats.domZ;
+      worker->stats.Z_setby       = stats.Z_setby;
+      worker->stats.domZ_setby    = stats.domZ_setby;
+    }
+
+    /* the chunk is done */
+    worker->busy  += w->elapsed;
+    worker->ndone += worker->srch_cnt;
+    worker->total += total;
+    worker->srch_cnt = 0;
+    --data->outstanding;
 
-    /* notify the master that a worker has completed */
+    /* notify the master that a chunk has completed */
     if ((n = pthread_cond_broadcast(&data->complete_cond)) != 0) LOG_FATAL_MSG("cond broadcast", n);
     if ((n = pthread_mutex_unlock (&data->work_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
 
@@ -1889,6 +3033,7 @@ workerside_thread(void *arg)
   WORKER_DATA      *worker  = (WORKER_DATA *)arg;
   WORKERSIDE_ARGS  *parent  = (WORKERSIDE_ARGS *)worker->parent;
   HMMD_HEADER       hdr;
+  P7_SEQCACHE      *delta;
   int               n;
   int               fd = 0;
   int               version;
@@ -1906,18 +3051,21 @@ workerside_thread(void *arg)
 
   updated = 0;
   while (!updated) {
-    /* get the database version to load */
+    /* get the database version to load, and describe it while a load can't swap it */
     if ((n = pthread_mutex_lock (&parent->work_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
     version = parent->db_version;
-    if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
 
     n = sizeof(HMMD_COMMAND);
-    if (parent->seq_db != NULL) n += strlen(parent->seq_db->name) + 1;
+    if (parent->seq_db != NULL) {
+      for (delta = parent->seq_db; delta != NULL; delta = delta->next)
+        n += strlen(delta->name) + 1;
+    }
     if (parent->hmm_db != NULL) n += strlen(parent->hmm_db->name) + 1;
 
     cmd = malloc(n);
     if (cmd == NULL) {
       p7_syslog(LOG_ERR,"[%s:%d] - malloc %d - %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
       goto EXIT;
     }
     memset(cmd, 0, n);
@@ -1937,6 +3085,14 @@ workerside_thread(void *arg)
 
       strcpy(p, parent->seq_db->name);
       p += strlen(parent->seq_db->name) + 1;
+
+      /* followed by the deltas added to it since, oldest first */
+      cmd->init.delta_off   = p - cmd->init.data;
+      for (delta = parent->seq_db->next; delta != NULL; delta = delta->next) {
+        strcpy(p, delta->name);
+        p += strlen(delta->name) + 1;
+        cmd->init.delta_cnt++;
+      }
     }
 
     if (parent->hmm_db != NULL) {
@@ -1951,6 +3107,9 @@ workerside_thread(void *arg)
       p += strlen(parent->hmm_db->name) + 1;
     }
 
+    if ((n = pthread_mutex_unlock (&parent->work_mutex)) != 0)  LOG_FATAL_MSG("mutex unlock", n);
+
+    n = MSG_SIZE(cmd);
     if (writen(worker->sock_fd, cmd, n) != n) {
       p7_syslog(LOG_ERR,"[%s:%d] - writing (%d) error %d - %s\n", __FILE__, __LINE__, worker->sock_fd, errno, strerror(errno));
       status = eslFAIL;
@@ -2030,6 +3189,9 @@ workerside_thread(void *arg)
   ++parent->failed;
   ++parent->completed;
 
+  /* hand the chunk it was searching, if any, to the other workers */
+  requeue_chunk(parent, worker);
+
   worker->terminated = 1;
   worker->total      = 0;
   worker->sock_fd    = -1;
@@ -94,6 +94,10 @@ static ESL_OPTIONS searchOpts[] = {
   { "--hmmdb",      eslARG_INT,         NULL,  NULL, "n>0",   NULL,  NULL,  "--seqdb",       "hmm database to search",                                      12 },
   { "--seqdb",      eslARG_INT,         NULL,  NULL, "n>0",   NULL,  NULL,  "--hmmdb",       "protein database to search",                                  12 },
   { "--seqdb_ranges",eslARG_STRING,     NULL,  NULL,  NULL,   NULL, "--seqdb", NULL,         "range(s) of sequences within --seqdb that will be searched",  12 },
+  { "--prune",      eslARG_NONE,       FALSE, NULL, NULL,      NULL,  NULL, NULL,        "workers send back only hits that can be reported",            12 },
+  { "--top",        eslARG_INT,         NULL, NULL, "n>0",     NULL,  NULL, NULL,        "report only the <n> top hits (implies --prune)",              12 },
+  { "--priority",   eslARG_INT,          "1", NULL, "0<=n<=2", NULL,  NULL, NULL,        "queue at priority <n>: 0 interactive, 1 normal, 2 batch",     12 },
+  { "--lsort",      eslARG_NONE,       FALSE, NULL, NULL,      NULL,  NULL, NULL,        "workers hand out targets longest first, across threads",      12 },
 
   /* name           type        default  env  range toggles reqs incomp  help                                          docgroup*/
   { "-c",         eslARG_INT,       "1", NULL, NULL, NULL,  NULL, NULL,  "use alt genetic code of NCBI transl table <n>", 99 },
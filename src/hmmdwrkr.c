@@ -1,5 +1,6 @@
 /* worker side of the hmmer daemon
  */
+#define _GNU_SOURCE             /* pthread_setaffinity_np(), cpu_set_t */
 #include "p7_config.h"
 
 #ifdef HMMER_THREADS
@@ -19,6 +20,7 @@
 #include <arpa/inet.h>
 #include <syslog.h>
 #include <time.h>
+#include <sched.h>
 
 #ifndef HMMER_THREADS
 #error "Program requires pthreads be enabled."
@@ -42,18 +44,51 @@
 
 #define CONF_FILE "/etc/hmmpgmd.conf"
 
+/* A stretch of the target list, handed out in blocks that shrink as
+ * it is used up; see next_block(). With --numa there is one per
+ * node, holding the targets whose residues are on that node, and one
+ * more for targets on none (deltas appended after placement).
+ */
+typedef struct {
+  int               start;
+  int               end;
+  int               inx;         /* next target to hand out          */
+  int               blk_size;
+  int               limit;       /* shrink blocks past start + limit */
+} WORK_RANGE;
+
+/* A NUMA node (--numa): its cores, and the search work done by the
+ * threads pinned to them, summed over all searches.
+ */
+typedef struct {
+  int               id;          /* node number, as in /sys/devices/system/node */
+  int              *cpus;        /* its cores [0..ncpus-1]           */
+  int               ncpus;
+
+  uint64_t          nsearches;
+  uint64_t          nseqs;       /* targets searched                 */
+  uint64_t          nres;        /* residues searched                */
+  uint64_t          nlocal;      /* blocks taken from its own range  */
+  uint64_t          nremote;     /* blocks taken from others'        */
+  double            busy;        /* thread seconds spent searching   */
+} NUMA_NODE;
+
 typedef struct {
   HMMER_SEQ       **sq_list;     /* list of sequences to process     */
   int               sq_cnt;      /* number of sequences              */
-  int               db_Z;        /* true number of sequences         */
+  int               db_Z;        /* true number of targets           */
 
   P7_OPROFILE     **om_list;     /* list of profiles to process      */
   int               om_cnt;      /* number of profiles               */
 
   pthread_mutex_t  *inx_mutex;   /* protect data                     */
-  int              *blk_size;    /* sequences per block              */
-  int              *limit;       /* point to decrease block size     */
-  int              *inx;         /* next index to process            */
+  WORK_RANGE       *ranges;      /* work shared by all the threads   */
+  int               nranges;
+  int               home;        /* range to take work from first    */
+  int               node;        /* with --numa, its node's index    */
+  int               cpu;         /* core to pin the thread to, or -1 */
+  uint64_t          nlocal;      /* blocks taken from <home>         */
+  uint64_t          nremote;     /* blocks taken from other ranges   */
 
   P7_HMM           *hmm;         /* query HMM                        */
   ESL_SQ           *seq;         /* query sequence                   */
@@ -77,9 +112,25 @@ typedef struct {
 
   P7_SEQCACHE *seq_db;           /* cached sequence database         */
   P7_HMMCACHE *hmm_db;           /* cached hmm database              */
+
+  /* databases named by a PRELOAD, loaded by load_thread() while
+   * searches go on against the ones above; put in use by a SWAP.
+   */
+  pthread_t        loader;
+  int              loading;      /* TRUE from the first PRELOAD to the SWAP   */
+  pthread_mutex_t  load_mutex;   /* protects load_status                      */
+  int              load_status;  /* eslENORESULT until load_thread() is done  */
+  HMMD_COMMAND    *load_cmd;     /* copy of the PRELOAD being served          */
+  P7_SEQCACHE     *next_seq_db;  /* new seq database, or delta if appending   */
+  P7_HMMCACHE     *next_hmm_db;
+
+  NUMA_NODE       *nodes;        /* with --numa, the nodes; else NULL         */
+  int              nnodes;
 } WORKER_ENV;
 
 static void process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
+static void process_PreloadCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
+static void process_SwapCmd(HMMD_COMMAND *cmd, WORKER_ENV *env);
 static void process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query);
 static void process_Shutdown(HMMD_COMMAND *cmd, WORKER_ENV *env);
 
@@ -109,6 +160,379 @@ print_timings(int i, double elapsed, P7_PIPELINE *pli)
            i, pli->nseqs, pli->nres, pli->n_past_msv, pli->n_past_bias, pli->n_past_vit, pli->n_past_fwd, buf1);
 }
 
+/* parse_cpulist()
+ * Parse a Linux cpu or node list such as "0-7,16-23" into an array.
+ */
+static int
+parse_cpulist(char *s, int **ret_list, int *ret_n)
+{
+  int  *list  = NULL;
+  int   n     = 0;
+  int   nalloc = 16;
+  int   lo, hi;
+  char *end;
+  void *tmp;
+  int   status;
+
+  ESL_ALLOC(list, sizeof(int) * nalloc);
+  while (*s && *s != '\n') {
+    lo = hi = strtol(s, &end, 10);
+    if (end == s) { status = eslEFORMAT; goto ERROR; }
+    s = end;
+    if (*s == '-') {
+      hi = strtol(++s, &end, 10);
+      if (end == s || hi < lo) { status = eslEFORMAT; goto ERROR; }
+      s = end;
+    }
+    for ( ; lo <= hi; ++lo) {
+      if (n == nalloc) { nalloc *= 2; ESL_RALLOC(list, tmp, sizeof(int) * nalloc); }
+      list[n++] = lo;
+    }
+    if (*s == ',') ++s;
+  }
+
+  *ret_list = list;
+  *ret_n    = n;
+  return eslOK;
+
+ ERROR:
+  if (list != NULL) free(list);
+  return status;
+}
+
+/* numa_topology()
+ * Find the NUMA nodes with cores, from /sys/devices/system/node, for
+ * --numa. Returns eslENOTFOUND if there's no such information.
+ */
+static int
+numa_topology(WORKER_ENV *env)
+{
+  FILE *fp;
+  char  path[128];
+  char  line[4096];
+  int  *ids   = NULL;
+  int   nids  = 0;
+  int   i;
+  int   status;
+
+  env->nodes  = NULL;
+  env->nnodes = 0;
+
+  if ((fp = fopen("/sys/devices/system/node/online", "r")) == NULL) return eslENOTFOUND;
+  if (fgets(line, sizeof(line), fp) == NULL) { fclose(fp); return eslENOTFOUND; }
+  fclose(fp);
+  if ((status = parse_cpulist(line, &ids, &nids)) != eslOK) return status;
+
+  ESL_ALLOC(env->nodes, sizeof(NUMA_NODE) * nids);
+  for (i = 0; i < nids; ++i) {
+    NUMA_NODE *node = env->nodes + env->nnodes;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+    if ((fp = fopen(path, "r")) == NULL) continue;
+    if (fgets(line, sizeof(line), fp) == NULL) line[0] = 0;
+    fclose(fp);
+
+    memset(node, 0, sizeof(NUMA_NODE));
+    node->id = ids[i];
+    if (parse_cpulist(line, &node->cpus, &node->ncpus) != eslOK) continue;
+    if (node->ncpus == 0) { free(node->cpus); continue; } /* memory only */
+    env->nnodes++;
+  }
+  free(ids);
+
+  if (env->nnodes == 0) { free(env->nodes); env->nodes = NULL; return eslENOTFOUND; }
+  return eslOK;
+
+ ERROR:
+  if (ids != NULL) free(ids);
+  return status;
+}
+
+/* pin_thread()
+ * Restrict the calling thread to the cores <cpus[0..ncpus-1]>.
+ */
+static int
+pin_thread(int *cpus, int ncpus)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t set;
+  int       i;
+
+  CPU_ZERO(&set);
+  for (i = 0; i < ncpus; ++i) CPU_SET(cpus[i], &set);
+  return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) ? eslOK : eslFAIL;
+#else
+  return eslEUNIMPLEMENTED;
+#endif
+}
+
+typedef struct {
+  P7_SEQCACHE *cache;
+  NUMA_NODE   *node;
+  int          part;
+  uint32_t     lo;               /* the part is cache->list[lo..hi-1] */
+  uint32_t     hi;
+  int          status;
+  pthread_t    tid;
+} PLACE_ARGS;
+
+/* place_thread()
+ * Copy the residues of one part of a cache into new memory, from a
+ * thread on the part's node: pages go to the node that first touches
+ * them, so that is where the part ends up.
+ */
+static void *
+place_thread(void *arg)
+{
+  PLACE_ARGS  *pa    = (PLACE_ARGS *) arg;
+  P7_SEQCACHE *cache = pa->cache;
+  ESL_DSQ     *res;
+  uint64_t     size  = 1;
+  uint32_t     i;
+
+  pin_thread(pa->node->cpus, pa->node->ncpus);
+
+  for (i = pa->lo; i < pa->hi; ++i) size += cache->list[i].n + 1;
+  if ((res = malloc(size)) == NULL) { pa->status = eslEMEM; return NULL; }
+  cache->part_mem[pa->part] = res;
+
+  /* same layout as residue_mem: neighbours share a sentinel */
+  res[0] = eslDSQ_SENTINEL;
+  for (i = pa->lo; i < pa->hi; ++i) {
+    memcpy(res + 1, cache->list[i].dsq + 1, cache->list[i].n);
+    res[cache->list[i].n + 1] = eslDSQ_SENTINEL;
+    cache->list[i].dsq = res;
+    res += cache->list[i].n + 1;
+  }
+
+  pa->status = eslOK;
+  return NULL;
+}
+
+/* numa_place()
+ * Split the residues of <cache> (not those of deltas appended to it)
+ * into one part per node, of about equal size, each in memory on its
+ * node. Targets then come in node order in every list of the cache;
+ * see numa_ranges(). If a part can't be allocated its residues stay
+ * where they were, and so does the rest of residue_mem.
+ */
+static int
+numa_place(WORKER_ENV *env, P7_SEQCACHE *cache)
+{
+  PLACE_ARGS   *pa     = NULL;
+  P7_SEQCACHE  *delta;
+  uint64_t      total  = 0;
+  uint64_t      sum    = 0;
+  uint32_t      own;
+  uint32_t      i;
+  int           k;
+  int           n;
+  int           status = eslOK;
+
+  if (env->nodes == NULL || cache == NULL || cache->nparts > 0 || cache->residue_mem == NULL) return eslOK;
+
+  own = cache->count;
+  for (delta = cache->next; delta != NULL; delta = delta->next) own -= delta->count;
+  for (i = 0; i < own; ++i) total += cache->list[i].n + 1;
+
+  ESL_ALLOC(pa,              sizeof(PLACE_ARGS) * env->nnodes);
+  ESL_ALLOC(cache->part_end, sizeof(uint32_t)   * env->nnodes);
+  ESL_ALLOC(cache->part_mem, sizeof(void *)     * env->nnodes);
+  for (k = 0; k < env->nnodes; ++k) cache->part_mem[k] = NULL;
+  cache->nparts = env->nnodes;
+
+  i = 0;
+  for (k = 0; k < env->nnodes; ++k) {
+    pa[k].cache  = cache;
+    pa[k].node   = env->nodes + k;
+    pa[k].part   = k;
+    pa[k].lo     = i;
+    while (i < own && (k == env->nnodes - 1 || sum < total * (k + 1) / env->nnodes)) sum += cache->list[i++].n + 1;
+    pa[k].hi     = i;
+    pa[k].status = eslOK;
+    cache->part_end[k] = i;
+  }
+
+  /* one thread per part, all at once, so the copying is spread over the nodes' memory too */
+  for (k = 0; k < env->nnodes; ++k)
+    if ((n = pthread_create(&pa[k].tid, NULL, place_thread, &pa[k])) != 0) LOG_FATAL_MSG("thread create", n);
+  for (k = 0; k < env->nnodes; ++k) {
+    pthread_join(pa[k].tid, NULL);
+    if (pa[k].status != eslOK) status = pa[k].status;
+  }
+
+  if (status == eslOK) {
+    free(cache->residue_mem);
+    cache->residue_mem = NULL;
+  }
+
+  for (k = 0; k < env->nnodes; ++k)
+    printf("Placed %u sequences on node %d%s\n", pa[k].hi - pa[k].lo, env->nodes[k].id, (pa[k].status == eslOK) ? "" : " (failed)");
+  fflush(stdout);
+
+  free(pa);
+  return status;
+
+ ERROR:
+  if (pa != NULL) free(pa);
+  return status;
+}
+
+/* numa_ranges()
+ * Split the targets <sq[0..n-1]> into one range per part of <cache>,
+ * by the node their residues are on, and a last range for the
+ * targets of its deltas. Sub-database lists follow the cache's list
+ * order, deltas last (see p7_seqcache_Append()), so each range is a
+ * single stretch.
+ */
+static void
+numa_ranges(P7_SEQCACHE *cache, HMMER_SEQ **sq, int n, WORK_RANGE *ranges)
+{
+  HMMER_SEQ *base = cache->list;
+  int        i    = 0;
+  int        k;
+
+  for (k = 0; k < cache->nparts; ++k) {
+    ranges[k].start = i;
+    while (i < n && sq[i] >= base && sq[i] < base + cache->part_end[k]) ++i;
+    ranges[k].end   = i;
+  }
+  ranges[k].start = i;
+  ranges[k].end   = n;
+}
+
+/* seq_sorter_by_length()
+ * qsort() comparison of two targets in the cache: longer first.
+ */
+static int
+seq_sorter_by_length(const void *vsq1, const void *vsq2)
+{
+  const HMMER_SEQ *sq1 = *((const HMMER_SEQ **) vsq1);
+  const HMMER_SEQ *sq2 = *((const HMMER_SEQ **) vsq2);
+
+  if      (sq1->n > sq2->n) return -1;
+  else if (sq1->n < sq2->n) return  1;
+  else                      return  0;
+}
+
+/* block_plan()
+ * Choose the first block size for <nthreads> threads sharing <r>, and
+ * how far into it to go before blocks get smaller.
+ */
+static void
+block_plan(WORK_RANGE *r, int nthreads)
+{
+  int n = r->end - r->start;
+  int cnt;
+
+  r->inx = r->start;
+  if (nthreads < 1) nthreads = 1;
+
+  /* try block size of 5000.  we will need enough sequences for four
+   * blocks per thread or better.
+   */
+  r->blk_size = 5000;
+  cnt = n / nthreads / r->blk_size;
+  r->limit = n * 2 / 3;
+  if (cnt < 4) {
+    /* try block size of 1000  */
+    r->blk_size /= 5;
+    cnt = n / nthreads / r->blk_size;
+    if (cnt < 4) {
+      /* still not enough.  just divide it up into one block per thread */
+      r->blk_size = n / nthreads + 1;
+      r->limit = n * 2;
+    }
+  }
+}
+
+/* next_block()
+ * Take the next block of targets for a thread: from its home range
+ * while that lasts, then from the last range (deltas, with --numa),
+ * then from the others. Sets <*ret_inx> to the block's first target;
+ * returns the number of targets in it, 0 once all are handed out.
+ */
+static int
+next_block(WORKER_INFO *info, int *ret_inx)
+{
+  WORK_RANGE *rng;
+  int         count = 0;
+  int         j, r;
+
+  *ret_inx = 0;
+  if (pthread_mutex_lock(info->inx_mutex) != 0) p7_Fail("mutex lock failed");
+  for (j = 0; j <= info->nranges; ++j) {
+    r = (j == 0) ? info->home : info->nranges - j;
+    if (j > 0 && r == info->home) continue;
+
+    rng = info->ranges + r;
+    if (rng->inx >= rng->end) continue;
+
+    if (rng->inx - rng->start > rng->limit) {
+      rng->blk_size /= 5;
+      if (rng->blk_size < 1000) {
+        rng->limit = (rng->end - rng->start) * 2;
+      } else {
+        rng->limit = (rng->inx - rng->start) + (rng->end - rng->inx) * 2 / 3;
+      }
+    }
+
+    *ret_inx  = rng->inx;
+    count     = ESL_MIN(rng->blk_size, rng->end - rng->inx);
+    rng->inx += count;
+    if (r == info->home) info->nlocal++; else info->nremote++;
+    break;
+  }
+  if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
+
+  return count;
+}
+
+/* numa_stats()
+ * Report, per node, the work its threads did in the search just
+ * finished, and add it to the node's totals.
+ */
+static void
+numa_stats(WORKER_ENV *env, WORKER_INFO *info)
+{
+  NUMA_NODE *node;
+  uint64_t   nseqs, nres, nlocal, nremote;
+  double     busy;
+  int        nthreads;
+  int        i, k;
+
+  fprintf(stdout, "Node Threads   Sequences     Residues  Mres/s/thread  Local    Total Mres/s/thread\n");
+  for (k = 0; k < env->nnodes; ++k) {
+    node  = env->nodes + k;
+    nseqs = nres = nlocal = nremote = 0;
+    busy  = 0.0;
+    nthreads = 0;
+
+    for (i = 0; i < env->ncpus; ++i) {
+      if (info[i].node != k) continue;
+      nseqs   += info[i].pli->nseqs;
+      nres    += info[i].pli->nres;
+      nlocal  += info[i].nlocal;
+      nremote += info[i].nremote;
+      busy    += info[i].elapsed;
+      ++nthreads;
+    }
+
+    node->nsearches++;
+    node->nseqs   += nseqs;
+    node->nres    += nres;
+    node->nlocal  += nlocal;
+    node->nremote += nremote;
+    node->busy    += busy;
+
+    fprintf(stdout, "%4d %7d %11" PRIu64 " %12" PRIu64 " %14.1f %5.1f%% %20.1f\n",
+            node->id, nthreads, nseqs, nres,
+            (busy > 0.0) ? nres / busy / 1e6 : 0.0,
+            (nlocal + nremote > 0) ? 100.0 * nlocal / (nlocal + nremote) : 0.0,
+            (node->busy > 0.0) ? node->nres / node->busy / 1e6 : 0.0);
+  }
+}
+
 static int
 read_Command(HMMD_COMMAND **ret_cmd, WORKER_ENV *env)
 {
@@ -145,6 +569,7 @@ worker_process(ESL_GETOPTS *go)
   HMMD_COMMAND *cmd      = NULL;  /* see hmmpgmd.h */
   int           shutdown = 0;
   WORKER_ENV    env;
+  int           i;
   int           status;
    
   QUEUE_DATA      *query      = NULL;   
@@ -156,9 +581,27 @@ worker_process(ESL_GETOPTS *go)
   if (esl_opt_IsOn(go, "--cpu")) env.ncpus = esl_opt_GetInteger(go, "--cpu");
   else esl_threads_CPUCount(&env.ncpus);
 
-  env.hmm_db = NULL;
-  env.seq_db = NULL;
-  env.fd     = setup_masterside_comm(go);
+  env.hmm_db      = NULL;
+  env.seq_db      = NULL;
+  env.loading     = FALSE;
+  env.load_cmd    = NULL;
+  env.next_seq_db = NULL;
+  env.next_hmm_db = NULL;
+  if ((status = pthread_mutex_init(&env.load_mutex, NULL)) != 0) LOG_FATAL_MSG("mutex init", status);
+
+  env.nodes       = NULL;
+  env.nnodes      = 0;
+  if (esl_opt_GetBoolean(go, "--numa")) {
+    if ((status = numa_topology(&env)) != eslOK) {
+      p7_syslog(LOG_ERR,"[%s:%d] - no NUMA topology found (%d); --numa ignored\n", __FILE__, __LINE__, status);
+    } else {
+      printf("NUMA: %d node(s), %d thread(s)\n", env.nnodes, env.ncpus);
+#ifndef HAVE_PTHREAD_SETAFFINITY_NP
+      printf("NUMA: threads can't be pinned on this system\n");
+#endif
+    }
+  }
+  env.fd          = setup_masterside_comm(go);
 
   while (!shutdown) 
     {
@@ -167,6 +610,8 @@ worker_process(ESL_GETOPTS *go)
 
       switch (cmd->hdr.command) {
       case HMMD_CMD_INIT:      process_InitCmd  (cmd, &env);                break;
+      case HMMD_CMD_PRELOAD:   process_PreloadCmd(cmd, &env);               break;
+      case HMMD_CMD_SWAP:      process_SwapCmd  (cmd, &env);                break;
       case HMMD_CMD_SCAN: 
 	  {	  
  		   query = process_QueryCmd(cmd, &env);
@@ -186,8 +631,18 @@ worker_process(ESL_GETOPTS *go)
       cmd = NULL;
     }
 
+  if (env.loading) pthread_join(env.loader, NULL);
+  if (env.load_cmd)    free(env.load_cmd);
+  if (env.next_hmm_db) p7_hmmcache_Close(env.next_hmm_db);
+  if (env.next_seq_db) p7_seqcache_Close(env.next_seq_db);
+  pthread_mutex_destroy(&env.load_mutex);
+
   if (env.hmm_db) p7_hmmcache_Close(env.hmm_db);
   if (env.seq_db) p7_seqcache_Close(env.seq_db);
+  if (env.nodes) {
+    for (i = 0; i < env.nnodes; ++i) free(env.nodes[i].cpus);
+    free(env.nodes);
+  }
   if (env.fd != -1) close(env.fd);
   return;
 }
@@ -196,17 +651,17 @@ worker_process(ESL_GETOPTS *go)
 static void 
 process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
 { 
-  int              i;
-  int              cnt;
-  int              limit;
+  int              i, k;
   int              status;
-  int              blk_size;
   WORKER_INFO     *info       = NULL;
   ESL_ALPHABET    *abc;
   ESL_STOPWATCH   *w;
   ESL_THREADS     *threadObj  = NULL;
   pthread_mutex_t  inx_mutex;
-  int              current_index;
+  WORK_RANGE      *ranges     = NULL;
+  int              nranges    = 1;
+  int              nhome;
+  HMMER_SEQ      **sorted     = NULL;   /* with --lsort, the targets longest first */
   time_t           date;
   char             timestamp[32];
 
@@ -215,6 +670,7 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
 
   if (pthread_mutex_init(&inx_mutex, NULL) != 0) p7_Fail("mutex init failed");
   ESL_ALLOC(info, sizeof(*info) * env->ncpus);
+  ESL_ALLOC(ranges, sizeof(WORK_RANGE) * (env->nnodes + 1));
 
   /* Log the current time (at search start) */
   date = time(NULL);
@@ -248,6 +704,26 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
 
   fprintf(stdout, "\n");
 
+  /* the targets, split by node with --numa */
+  ranges[0].start = 0;
+  ranges[0].end   = query->cnt;
+  if (env->nodes != NULL && query->cmd_type == HMMD_CMD_SEARCH && env->seq_db->nparts > 0) {
+    numa_ranges(env->seq_db, &env->seq_db->db[query->dbx].list[query->inx], query->cnt, ranges);
+    nranges = env->seq_db->nparts + 1;
+  }
+
+  /* with --lsort, hand the targets out longest first, so the long ones
+   * are spread over the threads early instead of trailing the search.
+   * Sorting within each range keeps --numa's targets on their node.
+   */
+  if (query->cmd_type == HMMD_CMD_SEARCH && esl_opt_GetBoolean(query->opts, "--lsort") && query->cnt > 1) {
+    ESL_ALLOC(sorted, sizeof(HMMER_SEQ *) * query->cnt);
+    memcpy(sorted, &env->seq_db->db[query->dbx].list[query->inx], sizeof(HMMER_SEQ *) * query->cnt);
+    for (k = 0; k < nranges; ++k)
+      if (ranges[k].end - ranges[k].start > 1)
+        qsort(sorted + ranges[k].start, ranges[k].end - ranges[k].start, sizeof(HMMER_SEQ *), seq_sorter_by_length);
+  }
+
   /* Create processing pipeline and hit list */
   for (i = 0; i < env->ncpus; ++i) {
     info[i].abc   = query->abc;
@@ -261,13 +737,26 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
     info[i].pli   = NULL;
 
     info[i].inx_mutex = &inx_mutex;
-    info[i].inx       = &current_index;/* this is confusing trickery - to share a single variable across all threads */
-    info[i].blk_size  = &blk_size;     /* ditto */
-    info[i].limit     = &limit;	       /* ditto. TODO: come back and clean this up. */
+    info[i].ranges    = ranges;
+    info[i].nranges   = nranges;
+    info[i].nlocal    = 0;
+    info[i].nremote   = 0;
+
+    /* with --numa, deal threads out over the nodes, and over the cores of each */
+    if (env->nodes != NULL) {
+      k = i % env->nnodes;
+      info[i].home = (nranges > 1) ? k : 0;
+      info[i].node = k;
+      info[i].cpu  = env->nodes[k].cpus[(i / env->nnodes) % env->nodes[k].ncpus];
+    } else {
+      info[i].home = 0;
+      info[i].node = -1;
+      info[i].cpu  = -1;
+    }
 
     if (query->cmd_type == HMMD_CMD_SEARCH) {
       HMMER_SEQ **list  = env->seq_db->db[query->dbx].list;
-      info[i].sq_list   = &list[query->inx];
+      info[i].sq_list   = (sorted != NULL) ? sorted : &list[query->inx];
       info[i].sq_cnt    = query->cnt;
       info[i].db_Z      = env->seq_db->db[query->dbx].K;
       info[i].om_list   = NULL;
@@ -275,7 +764,7 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
     } else {
       info[i].sq_list   = NULL;
       info[i].sq_cnt    = 0;
-      info[i].db_Z      = 0;
+      info[i].db_Z      = env->hmm_db->n;
       info[i].om_list   = &env->hmm_db->list[query->inx];
       info[i].om_cnt    = query->cnt;
     }
@@ -283,23 +772,13 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
     esl_threads_AddThread(threadObj, &info[i]);
   }
 
-  /* try block size of 5000.  we will need enough sequences for four
-   * blocks per thread or better.
-   */
-  blk_size = 5000;
-  cnt = query->cnt / env->ncpus / blk_size;
-  limit = query->cnt * 2 / 3;
-  if (cnt < 4) {
-    /* try block size of 1000  */
-    blk_size /= 5;
-    cnt = query->cnt / env->ncpus / blk_size;
-    if (cnt < 4) {
-      /* still not enough.  just divide it up into one block per thread */
-      blk_size = query->cnt / env->ncpus + 1;
-      limit = query->cnt * 2;
-    }
+  /* size each range's blocks for the threads that start on it; all threads share the last */
+  for (k = 0; k < nranges; ++k) {
+    nhome = env->ncpus;
+    if (k < nranges - 1 || nranges == 1)
+      for (nhome = 0, i = 0; i < env->ncpus; ++i) if (info[i].home == k) ++nhome;
+    block_plan(&ranges[k], nhome);
   }
-  current_index = 0;
 
   esl_threads_WaitForStart(threadObj);
   esl_threads_WaitForFinish(threadObj);
@@ -311,6 +790,8 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
     print_timings(i, info[i].elapsed, info[i].pli);
   }
 #endif
+  if (env->nodes != NULL && query->cmd_type == HMMD_CMD_SEARCH) numa_stats(env, info);
+
   /* merge the results of the search results */
   for (i = 1; i < env->ncpus; ++i) {
     p7_tophits_Merge(info[0].th, info[i].th);
@@ -320,6 +801,18 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
   }
 
   print_timings(99, w->elapsed, info[0].pli);
+
+  /* with --prune or --top, send back only what the master could report.
+   * Reportability by E-value must be judged against the whole
+   * database, not this worker's share of it; the counts from before
+   * the top <n> cut stand in for the dropped hits in the master's totals.
+   */
+  if (esl_opt_GetBoolean(query->opts, "--prune") || esl_opt_IsOn(query->opts, "--top")) {
+    if (info[0].pli->Z_setby == p7_ZSETBY_NTARGETS) info[0].pli->Z = info[0].db_Z;
+    if (p7_tophits_Prune(info[0].th, info[0].pli,
+                         esl_opt_IsOn(query->opts, "--top") ? esl_opt_GetInteger(query->opts, "--top") : 0,
+                         &info[0].th->nreported, &info[0].th->nincluded) != eslOK) LOG_FATAL_MSG("malloc", errno);
+  }
   send_results(env->fd, w, info[0].th, info[0].pli);
 
   /* free the last of the pipeline data */
@@ -329,6 +822,8 @@ process_SearchCmd(HMMD_COMMAND *cmd, WORKER_ENV *env, QUEUE_DATA *query)
   esl_threads_Destroy(threadObj);
 
   pthread_mutex_destroy(&inx_mutex);
+  free(ranges);
+  if (sorted != NULL) free(sorted);
 
   if (info->range_list) {
     if (info->range_list->starts)  free(info->range_list->starts);
@@ -456,71 +951,149 @@ process_Shutdown(HMMD_COMMAND *cmd, WORKER_ENV  *env)
   }
 }
 
-static void
-process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
+/* load_databases()
+ * Open the databases named by an INIT or PRELOAD command <init> and
+ * check them against the counts and ids it gives. Unless the command
+ * is appending, the seq database is opened and any deltas named
+ * after it are appended to it. An appending PRELOAD names one delta,
+ * which is opened and checked as if appended to <live>, the seq
+ * database in use, but left for the SWAP to append. Sets <*ret_sdb>
+ * and <*ret_hdb> to what was opened, NULL where the command names
+ * nothing. Returns eslOK, or the error that stopped the load after
+ * logging it.
+ */
+static int
+load_databases(HMMD_INIT_CMD *init, P7_SEQCACHE *live, P7_SEQCACHE **ret_sdb, P7_HMMCACHE **ret_hdb)
 {
-  char *p;
-  int   n;
-  int   status;
-
-  if (env->hmm_db != NULL) p7_hmmcache_Close(env->hmm_db);
-  if (env->seq_db != NULL) p7_seqcache_Close(env->seq_db);
-
-  env->hmm_db = NULL;
-  env->seq_db = NULL;
+  P7_SEQCACHE *sdb    = NULL;
+  P7_SEQCACHE *delta  = NULL;
+  P7_HMMCACHE *hcache = NULL;
+  uint32_t     count;
+  char         errbuf[eslERRBUFSIZE];
+  char        *p;
+  uint32_t     i;
+  int          status;
+
+  init->sid[MAX_INIT_DESC-1] = 0;
+  init->hid[MAX_INIT_DESC-1] = 0;
 
   /* load the sequence database */
-  if (cmd->init.db_cnt != 0) {
-    P7_SEQCACHE *sdb = NULL;
+  if (init->db_cnt != 0) {
+    if (init->append) {
+      if (live == NULL || init->delta_cnt != 1) {
+        p7_syslog(LOG_ERR,"[%s:%d] - nothing to append %d deltas to\n", __FILE__, __LINE__, init->delta_cnt);
+        status = eslEINVAL;
+        goto ERROR;
+      }
+      p = init->data + init->delta_off;
+    } else {
+      p = init->data + init->seqdb_off;
+    }
 
-    p  = cmd->init.data + cmd->init.seqdb_off;
-    status = p7_seqcache_Open(p, &sdb, NULL);
-    if (status != eslOK) {
+    if ((status = p7_seqcache_Open(p, &sdb, NULL)) != eslOK) {
       p7_syslog(LOG_ERR,"[%s:%d] - p7_seqcache_Open %s error %d\n", __FILE__, __LINE__, p, status);
-      LOG_FATAL_MSG("cache seqdb error", status);
+      goto ERROR;
     }
 
-    /* validate the sequence database */
-    cmd->init.sid[MAX_INIT_DESC-1] = 0;
-    if (strcmp (cmd->init.sid, sdb->id) != 0 || cmd->init.db_cnt != sdb->db_cnt || cmd->init.seq_cnt != sdb->count) {
-      p7_syslog(LOG_ERR,"[%s:%d] - seq db %s: integrity error %s - %s\n", __FILE__, __LINE__, p, cmd->init.sid, sdb->id);
-      LOG_FATAL_MSG("database integrity error", 0);
+    /* a new worker joining after deltas were added gets them all */
+    if (! init->append) {
+      p = init->data + init->delta_off;
+      for (i = 0; i < init->delta_cnt; ++i, p += strlen(p) + 1) {
+        if ((status = p7_seqcache_Open(p, &delta, NULL)) != eslOK) {
+          p7_syslog(LOG_ERR,"[%s:%d] - p7_seqcache_Open %s error %d\n", __FILE__, __LINE__, p, status);
+          goto ERROR;
+        }
+        if ((status = p7_seqcache_Append(sdb, delta, errbuf)) != eslOK) {
+          p7_syslog(LOG_ERR,"[%s:%d] - p7_seqcache_Append %s\n", __FILE__, __LINE__, errbuf);
+          goto ERROR;
+        }
+        delta = NULL;
+      }
     }
 
-    env->seq_db = sdb;
+    /* validate the sequence database */
+    count = (init->append) ? live->count + sdb->count : sdb->count;
+    if (strcmp (init->sid, sdb->id) != 0 || init->db_cnt != sdb->db_cnt || init->seq_cnt != count) {
+      p7_syslog(LOG_ERR,"[%s:%d] - seq db %s: integrity error %s - %s\n", __FILE__, __LINE__, p, init->sid, sdb->id);
+      status = eslEINCOMPAT;
+      goto ERROR;
+    }
   }
 
   /* load the hmm database */
-  if (cmd->init.hmm_cnt != 0) {
-    P7_HMMCACHE *hcache = NULL;
-
-    p  = cmd->init.data + cmd->init.hmmdb_off;
+  if (init->hmm_cnt != 0) {
+    p  = init->data + init->hmmdb_off;
 
     status = p7_hmmcache_Open(p, &hcache, NULL);
     if (status != eslOK) {
       p7_syslog(LOG_ERR,"[%s:%d] - p7_hmmcache_Open %s error %d\n", __FILE__, __LINE__, p, status);
-      LOG_FATAL_MSG("cache hmmdb error", status);
+      goto ERROR;
     }
 
     if ( (status = p7_hmmcache_SetNumericNames(hcache)) != eslOK){
       p7_syslog(LOG_ERR,"[%s:%d] - p7_hmmcache_SetNumericNames %s error %d\n", __FILE__, __LINE__, p, status);
-      LOG_FATAL_MSG("cache hmmdb error", status);
+      goto ERROR;
     }
 
     /* validate the hmm database */
-    cmd->init.hid[MAX_INIT_DESC-1] = 0;
-    /* TODO: come up with a new pressed format with an id to compare - strcmp (cmd->init.hid, hdb->id) != 0 */
-    if (cmd->init.hmm_cnt != 1 || cmd->init.model_cnt != hcache->n) {
+    /* TODO: come up with a new pressed format with an id to compare - strcmp (init->hid, hdb->id) != 0 */
+    if (init->hmm_cnt != 1 || init->model_cnt != hcache->n) {
       p7_syslog(LOG_ERR,"[%s:%d] - hmm db %s: integrity error\n", __FILE__, __LINE__, p);
-      LOG_FATAL_MSG("database integrity error", 0);
+      status = eslEINCOMPAT;
+      goto ERROR;
     }
 
-    env->hmm_db = hcache;
-
     printf("Loaded profile db %s;  models: %d  memory: %" PRId64 "\n",
          p, hcache->n, (uint64_t) p7_hmmcache_Sizeof(hcache));
+  }
+
+  *ret_sdb = sdb;
+  *ret_hdb = hcache;
+  return eslOK;
+
+ ERROR:
+  if (delta  != NULL) p7_seqcache_Close(delta);
+  if (sdb    != NULL) p7_seqcache_Close(sdb);
+  if (hcache != NULL) p7_hmmcache_Close(hcache);
+  *ret_sdb = NULL;
+  *ret_hdb = NULL;
+  return status;
+}
+
+/* reply_status()
+ * Answer a PRELOAD or SWAP with a bare header carrying <status>.
+ */
+static void
+reply_status(HMMD_COMMAND *cmd, WORKER_ENV *env, int status)
+{
+  HMMD_HEADER hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.command = cmd->hdr.command;
+  hdr.length  = 0;
+  hdr.status  = status;
+  if (writen(env->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    LOG_FATAL_MSG("write error", errno);
+  }
+}
+
+static void
+process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
+{
+  int   n;
+  int   status;
 
+  if (env->hmm_db != NULL) p7_hmmcache_Close(env->hmm_db);
+  if (env->seq_db != NULL) p7_seqcache_Close(env->seq_db);
+
+  env->hmm_db = NULL;
+  env->seq_db = NULL;
+
+  cmd->init.append = FALSE;
+  if ((status = load_databases(&cmd->init, NULL, &env->seq_db, &env->hmm_db)) != eslOK) {
+    LOG_FATAL_MSG("cache database error", status);
   }
+  numa_place(env, env->seq_db);
 
   /* if stdout is redirected at the commandline, it causes printf's to be buffered,
    * which means status logging isn't printed. This line strongly requests unbuffering,
@@ -539,6 +1112,115 @@ process_InitCmd(HMMD_COMMAND *cmd, WORKER_ENV  *env)
   }
 }
 
+/* load_thread()
+ * Load the databases of the PRELOAD in <env->load_cmd>, in the
+ * background, and leave them in <env->next_seq_db> and
+ * <env->next_hmm_db> for the SWAP.
+ */
+static void *
+load_thread(void *arg)
+{
+  WORKER_ENV *env = (WORKER_ENV *) arg;
+  int         status;
+  int         n;
+
+  status = load_databases(&env->load_cmd->init, env->seq_db, &env->next_seq_db, &env->next_hmm_db);
+  if (status == eslOK && ! env->load_cmd->init.append) numa_place(env, env->next_seq_db);
+
+  if ((n = pthread_mutex_lock(&env->load_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  env->load_status = status;
+  if ((n = pthread_mutex_unlock(&env->load_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+  printf("Preload %s.\n", (status == eslOK) ? "complete" : "failed");
+  fflush(stdout);
+  return NULL;
+}
+
+/* process_PreloadCmd()
+ * Start loading the databases a PRELOAD names, unless they already
+ * are being loaded, and answer with how far that has got: the master
+ * repeats the PRELOAD until every worker says eslOK.
+ */
+static void
+process_PreloadCmd(HMMD_COMMAND *cmd, WORKER_ENV *env)
+{
+  int status;
+  int n;
+
+  if (! env->loading) {
+    n = MSG_SIZE(cmd);
+    if ((env->load_cmd = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
+    memcpy(env->load_cmd, cmd, n);
+
+    env->load_status = eslENORESULT;
+    env->next_seq_db = NULL;
+    env->next_hmm_db = NULL;
+    if ((n = pthread_create(&env->loader, NULL, load_thread, env)) != 0) LOG_FATAL_MSG("thread create", n);
+    env->loading = TRUE;
+  }
+
+  if ((n = pthread_mutex_lock(&env->load_mutex)) != 0) LOG_FATAL_MSG("mutex lock", n);
+  status = env->load_status;
+  if ((n = pthread_mutex_unlock(&env->load_mutex)) != 0) LOG_FATAL_MSG("mutex unlock", n);
+
+  reply_status(cmd, env, status);
+}
+
+/* process_SwapCmd()
+ * Put the preloaded databases in use, or with a SWAP status other
+ * than eslOK throw them away. Searches run one at a time in this
+ * thread, so no search sees half of a swap. Answers eslOK if the
+ * worker now has what the master asked for.
+ */
+static void
+process_SwapCmd(HMMD_COMMAND *cmd, WORKER_ENV *env)
+{
+  char  errbuf[eslERRBUFSIZE];
+  int   status = eslOK;
+
+  if (! env->loading) {
+    /* joined after the PRELOAD went out; it has the old databases */
+    reply_status(cmd, env, (cmd->hdr.status == eslOK) ? eslENORESULT : eslOK);
+    return;
+  }
+
+  pthread_join(env->loader, NULL);
+  env->loading = FALSE;
+
+  if (cmd->hdr.status == eslOK) {
+    status = env->load_status;
+
+    if (status == eslOK && env->next_seq_db != NULL) {
+      if (env->load_cmd->init.append) {
+        if ((status = p7_seqcache_Append(env->seq_db, env->next_seq_db, errbuf)) != eslOK)
+          p7_syslog(LOG_ERR,"[%s:%d] - p7_seqcache_Append %s\n", __FILE__, __LINE__, errbuf);
+        else
+          env->next_seq_db = NULL;
+      } else {
+        if (env->seq_db != NULL) p7_seqcache_Close(env->seq_db);
+        env->seq_db      = env->next_seq_db;
+        env->next_seq_db = NULL;
+      }
+    }
+    if (status == eslOK && env->next_hmm_db != NULL) {
+      if (env->hmm_db != NULL) p7_hmmcache_Close(env->hmm_db);
+      env->hmm_db      = env->next_hmm_db;
+      env->next_hmm_db = NULL;
+    }
+  }
+
+  if (env->next_seq_db != NULL) p7_seqcache_Close(env->next_seq_db);
+  if (env->next_hmm_db != NULL) p7_hmmcache_Close(env->next_hmm_db);
+  env->next_seq_db = NULL;
+  env->next_hmm_db = NULL;
+  free(env->load_cmd);
+  env->load_cmd = NULL;
+
+  printf("%s preloaded databases.\n", (cmd->hdr.status == eslOK && status == eslOK) ? "Swapped in" : "Discarded");
+  fflush(stdout);
+
+  reply_status(cmd, env, status);
+}
 
 static void 
 search_thread(void *arg)
@@ -558,11 +1240,14 @@ search_thread(void *arg)
   P7_TOPHITS       *th       = NULL;         /* top hit results                */
   P7_PROFILE       *gm       = NULL;         /* generic model                  */
   P7_OPROFILE      *om       = NULL;         /* optimized query profile        */
+  int64_t           L;
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
 
   info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  if (info->cpu >= 0) pin_thread(&info->cpu, 1);
+
   w    = esl_stopwatch_Create();
   bg   = p7_bg_Create(info->abc);
   esl_stopwatch_Start(w);
@@ -614,31 +1299,18 @@ search_thread(void *arg)
   count = 1;
   while (count > 0) {
     int          inx;
-    int          blksz;
     HMMER_SEQ  **sq;
 
     /* grab the next block of sequences */
-    if (pthread_mutex_lock(info->inx_mutex) != 0) p7_Fail("mutex lock failed");
-    inx = *info->inx;
-    blksz = *info->blk_size;
-    if (inx > *info->limit) {
-      blksz /= 5;
-      if (blksz < 1000) {
-        *info->limit = info->sq_cnt * 2;
-      } else {
-        *info->limit = inx + (info->sq_cnt - inx) * 2 / 3; 
-      }
-    }
-    *info->blk_size = blksz;
-    *info->inx += blksz;
-    if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
-
-    sq = info->sq_list + inx;
+    count = next_block(info, &inx);
+    sq    = info->sq_list + inx;
 
-    count = info->sq_cnt - inx;
-    if (count > blksz) count = blksz;
-
-    /* Main loop: */
+    /* Main loop: the length models are set only when the length
+     * changes, which with --lsort is once per run of equal lengths.
+     * The pipeline leaves <om> and <bg> as it found them, so the
+     * results don't depend on the order.
+     */
+    L = -1;
     for (i = 0; i < count; ++i, ++sq) {
       if ( !(info->range_list) || hmmpgmd_IsWithinRanges ((*sq)->idx, info->range_list)) {
         dbsq.name  = (*sq)->name;
@@ -647,8 +1319,11 @@ search_thread(void *arg)
         dbsq.idx   = (*sq)->idx;
         if((*sq)->desc != NULL) dbsq.desc  = (*sq)->desc;
 
-        p7_bg_SetLength(bg, dbsq.n);
-        p7_oprofile_ReconfigLength(om, dbsq.n);
+        if (dbsq.n != L) {
+          L = dbsq.n;
+          p7_bg_SetLength(bg, L);
+          p7_oprofile_ReconfigLength(om, L);
+        }
 
         p7_Pipeline(pli, om, bg, &dbsq, NULL, th);
 
@@ -697,6 +1372,7 @@ scan_thread(void *arg)
   esl_threads_Started(obj, &workeridx);
 
   info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  if (info->cpu >= 0) pin_thread(&info->cpu, 1);
 
   w = esl_stopwatch_Create();
   esl_stopwatch_Start(w);
@@ -714,28 +1390,11 @@ scan_thread(void *arg)
   count = 1;
   while (count > 0) {
     int           inx;
-    int          blksz;
     P7_OPROFILE **om;
 
-    /* grab the next block of sequences */
-    if (pthread_mutex_lock(info->inx_mutex) != 0) p7_Fail("mutex lock failed");
-    inx   = *info->inx;
-    blksz = *info->blk_size;
-    if (inx > *info->limit) {
-      blksz /= 5;
-      if (blksz < 1000) {
-        *info->limit = info->om_cnt * 2;
-      } else {
-        *info->limit = inx + (info->om_cnt - inx) * 2 / 3; 
-      }
-    }
-    *info->blk_size = blksz;
-    *info->inx += blksz;
-    if (pthread_mutex_unlock(info->inx_mutex) != 0) p7_Fail("mutex unlock failed");
-
+    /* grab the next block of models */
+    count = next_block(info, &inx);
     om    = info->om_list + inx;
-    count = info->om_cnt - inx;
-    if (count > blksz) count = blksz;
 
     /* Main loop: */
     for (i = 0; i < count; ++i, ++om) {
@@ -772,12 +1431,9 @@ send_results(int fd, ESL_STOPWATCH *w, P7_TOPHITS *th, P7_PIPELINE *pli)
 {
   HMMD_SEARCH_STATS   stats;
   HMMD_SEARCH_STATUS  status;
-  P7_HIT             *hit;
-  P7_DOMAIN          *dcl;
-  int                 i, j, n;
-  esl_pos_t           offset;
-  char               *pEnd; /* pointer used by strtol to locate the taxonomy id on the description line. */
-
+  char               *buf = NULL;
+  uint64_t            nbuf;
+  int                 n;
 
   memset(&status, 0, sizeof(HMMD_SEARCH_STATUS)); /* silence valgrind errors - zero out entire structure including its padding */
   status.status     = eslOK;
@@ -804,58 +1460,13 @@ send_results(int fd, ESL_STOPWATCH *w, P7_TOPHITS *th, P7_PIPELINE *pli)
   stats.nreported   = th->nreported;
   stats.nincluded   = th->nincluded;
 
-  n = sizeof(P7_HIT) * stats.nhits;
-
-  status.msg_size += n;
-  offset = status.msg_size;
-  if ((hit = malloc(n)) == NULL) LOG_FATAL_MSG("malloc", errno);
-
-  /* get the data in the right format before we send it */
-  for (i = 0; i < stats.nhits; ++i) {
-    P7_HIT *h1 = &hit[i];
-    P7_HIT *h2 = &th->unsrt[i];
-
-    memcpy(h1, h2, sizeof(P7_HIT));
-
-    /* the name will be an integer value of the sequence index */
-    h1->name = (char *) strtol(h2->name, NULL, 10);
-//    h1->acc  = NULL;
-
-    /* We want to override the sequence description as a container
-     * for the domain architecture.
-     * We have already assigned the architecture when generating
-     * the sequence database, and comparing it to the latest version
-     * of Pfam. Copying the example above, convert the string to
-     * a long and cast back to a char. Nasty hack, but at least
-     * then it gets written back out to the socket. rdf
-     */
-    //if(h2->desc != NULL) h1->desc = (char *) strtol(h2->desc, NULL, 10);
-    if (h2->desc != NULL) {
-      h1->desc = (char *) strtol(h2->desc, &pEnd, 10);
-      /* Given the sequence header:
-       * >1 000101001 12343829483298 1234
-       * This will grab the last value (1234) if present and place it in
-       * the acc entry as it is not being used by hmmpgmd. This is the same
-       * way that we hijacked the desc field to pass the architecture
-       * information back. Currently used to pass the taxonomy id to the
-       * hmmer website.
-       */
-       h1->acc  = (char *) strtol(pEnd, &pEnd, 10);
-    }
-
-
-    h1->offset = offset;
-
-    /* figure out how big the domains are and their offset */
-    dcl = h2->dcl;
-    for (j = 0; j < h1->ndom; ++j) {
-      n = sizeof(P7_DOMAIN) + sizeof(P7_ALIDISPLAY) + dcl->ad->memsize;
-      status.msg_size += n;
-      offset += n;
-
-      ++dcl;
-    }
-  }
+  /* The hits go out as one packed block (see p7_tophits_Pack()):
+   * names and descriptions travel as strings, so the sequence index,
+   * architecture and taxonomy id on a hmmpgmd description line reach
+   * the client intact for it to parse.
+   */
+  if (p7_tophits_Pack(th, 0, &buf, &nbuf) != eslOK) LOG_FATAL_MSG("malloc", errno);
+  status.msg_size += nbuf;
 
   /* send back a successful status message */
   n = sizeof(status);
@@ -866,57 +1477,9 @@ send_results(int fd, ESL_STOPWATCH *w, P7_TOPHITS *th, P7_PIPELINE *pli)
   if (writen(fd, &stats, n) != n) LOG_FATAL_MSG("write", errno);
 
   /* send all the hit data */
-  n = sizeof(P7_HIT) * stats.nhits;
-  if (writen(fd, hit, n) != n) LOG_FATAL_MSG("write", errno);
-
-  /* loop through the hit list sending the domains */
-  for (i = 0; i < stats.nhits; ++i) {
-    char *base;
-    P7_HIT *h2 = &th->unsrt[i];
-
-    dcl = h2->dcl;
-
-    n = sizeof(P7_DOMAIN) * h2->ndom;
-    if (writen(fd, dcl, n) != n) LOG_FATAL_MSG("write", errno);
-    base = (char *)NULL + n;
-
-    for (j = 0; j < h2->ndom; ++j) {
-      P7_ALIDISPLAY *ad = NULL;
-
-      /* save off the original mem pointer so all the pointers can be adjusted
-       * to the new block of memory.
-       */
-      base += sizeof(P7_ALIDISPLAY);
-
-      /* readjust all the pointers to the new memory block */
-      ad = dcl->ad;
-      if (ad->rfline  != NULL) ad->rfline  = base + (ad->rfline  - ad->mem);
-      if (ad->mmline  != NULL) ad->mmline  = base + (ad->mmline  - ad->mem);
-      if (ad->csline  != NULL) ad->csline  = base + (ad->csline  - ad->mem);
-      if (ad->model   != NULL) ad->model   = base + (ad->model   - ad->mem);
-      if (ad->mline   != NULL) ad->mline   = base + (ad->mline   - ad->mem);
-      if (ad->aseq    != NULL) ad->aseq    = base + (ad->aseq    - ad->mem);
-      if (ad->ntseq   != NULL) ad->ntseq   = base + (ad->ntseq   - ad->mem);
-      if (ad->ppline  != NULL) ad->ppline  = base + (ad->ppline  - ad->mem);
-      if (ad->hmmname != NULL) ad->hmmname = base + (ad->hmmname - ad->mem);
-      if (ad->hmmacc  != NULL) ad->hmmacc  = base + (ad->hmmacc  - ad->mem);
-      if (ad->hmmdesc != NULL) ad->hmmdesc = base + (ad->hmmdesc - ad->mem);
-      if (ad->sqname  != NULL) ad->sqname  = base + (ad->sqname  - ad->mem);
-      if (ad->sqacc   != NULL) ad->sqacc   = base + (ad->sqacc   - ad->mem);
-      if (ad->sqdesc  != NULL) ad->sqdesc  = base + (ad->sqdesc  - ad->mem);
-
-      n = sizeof(P7_ALIDISPLAY);
-      if (writen(fd, dcl->ad, n) != n) LOG_FATAL_MSG("write", errno);
-
-      n = dcl->ad->memsize;
-      if (writen(fd, dcl->ad->mem, n) != n) LOG_FATAL_MSG("write", errno);
-
-      base += ad->memsize;
-      ++dcl;
-    }
-  }
+  if (writen(fd, buf, nbuf) != nbuf) LOG_FATAL_MSG("write", errno);
 
-  free(hit);
+  free(buf);
   printf("Bytes: %" PRId64 "  hits: %" PRId64 "  sent on socket %d\n", status.msg_size, stats.nhits, fd);
   fflush(stdout);
 }
@@ -962,6 +1525,176 @@ setup_masterside_comm(ESL_GETOPTS *opts)
   return fd;    
 }
 
+
+/*****************************************************************
+ * Test driver
+ *****************************************************************/
+#ifdef p7HMMDWRKR_TESTDRIVE
+/*
+  gcc -o hmmdwrkr_utest -std=gnu99 -g -O2 -I. -L. -I../easel -L../easel -Dp7HMMDWRKR_TESTDRIVE hmmdwrkr.c -lhmmer -leasel -lm -lpthread
+  ./hmmdwrkr_utest
+*/
+static ESL_OPTIONS options[] = {
+  /* name           type      default  env  range toggles reqs incomp  help                                       docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",             0 },
+  {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for the hmmpgmd worker";
+
+/* Cpu and node lists parse as Linux writes them, and malformed
+ * ones are refused.
+ */
+static void
+utest_cpulist(void)
+{
+  char  msg[]      = "hmmdwrkr cpulist unit test failed";
+  char  good[]     = "0-3,8,10-11\n";
+  char  big[]      = "0-99";
+  char  bad1[]     = "3-1";
+  char  bad2[]     = "0,x";
+  int   expect[]   = { 0, 1, 2, 3, 8, 10, 11 };
+  int  *list       = NULL;
+  int   n, i;
+
+  if (parse_cpulist(good, &list, &n) != eslOK) esl_fatal(msg);
+  if (n != sizeof(expect) / sizeof(int))        esl_fatal(msg);
+  for (i = 0; i < n; i++) if (list[i] != expect[i]) esl_fatal(msg);
+  free(list);
+
+  /* more cores than the initial allocation */
+  if (parse_cpulist(big, &list, &n) != eslOK)   esl_fatal(msg);
+  if (n != 100 || list[99] != 99)               esl_fatal(msg);
+  free(list);
+
+  if (parse_cpulist(bad1, &list, &n) != eslEFORMAT) esl_fatal(msg);
+  if (parse_cpulist(bad2, &list, &n) != eslEFORMAT) esl_fatal(msg);
+}
+
+/* Search targets <inx..inx+cnt-1> of a fake cache of <nbase>
+ * sequences split in <nparts> parts, with a delta of <ndelta>
+ * appended, with <nthreads> threads dealt over the parts as
+ * process_SearchCmd() does: numa_ranges() must cut the targets by
+ * part, and next_block() must hand every one of them out exactly
+ * once.
+ */
+static void
+utest_blocks(int nbase, int ndelta, int nparts, int inx, int cnt, int nthreads)
+{
+  char             msg[]    = "hmmdwrkr blocks unit test failed";
+  P7_SEQCACHE      cache;
+  HMMER_SEQ       *base     = NULL;
+  HMMER_SEQ       *delta    = NULL;
+  HMMER_SEQ      **list     = NULL;
+  HMMER_SEQ      **sq;
+  uint32_t        *part_end = NULL;
+  WORK_RANGE      *ranges   = NULL;
+  WORKER_INFO     *info     = NULL;
+  int             *seen     = NULL;
+  pthread_mutex_t  inx_mutex;
+  int              nranges  = nparts + 1;
+  int              i, j, k, n, start, nhome, active;
+  int              status;
+
+  ESL_ALLOC(base,     sizeof(HMMER_SEQ)   * nbase);
+  ESL_ALLOC(delta,    sizeof(HMMER_SEQ)   * ESL_MAX(1, ndelta));
+  ESL_ALLOC(list,     sizeof(HMMER_SEQ *) * (nbase + ndelta));
+  ESL_ALLOC(part_end, sizeof(uint32_t)    * nparts);
+  ESL_ALLOC(ranges,   sizeof(WORK_RANGE)  * nranges);
+  ESL_ALLOC(info,     sizeof(WORKER_INFO) * nthreads);
+  ESL_ALLOC(seen,     sizeof(int)         * cnt);
+  if (pthread_mutex_init(&inx_mutex, NULL) != 0) esl_fatal(msg);
+
+  /* parts of uneven size; the list holds the base, then the delta */
+  memset(&cache, 0, sizeof(P7_SEQCACHE));
+  cache.list     = base;
+  cache.count    = nbase + ndelta;
+  cache.nparts   = nparts;
+  cache.part_end = part_end;
+  for (k = 0; k < nparts; k++) part_end[k] = (uint32_t) ((int64_t) nbase * (k+1) * (k+2) / (nparts * (nparts+1)));
+  for (i = 0; i < nbase;  i++) list[i]         = base + i;
+  for (i = 0; i < ndelta; i++) list[nbase + i] = delta + i;
+  sq = list + inx;
+
+  numa_ranges(&cache, sq, cnt, ranges);
+  if (ranges[0].start != 0 || ranges[nparts].end != cnt) esl_fatal(msg);
+  for (k = 0; k < nranges; k++)
+    {
+      if (k > 0 && ranges[k].start != ranges[k-1].end) esl_fatal(msg);
+      for (i = ranges[k].start; i < ranges[k].end; i++)
+	{
+	  if (k == nparts) { if (sq[i] < delta || sq[i] >= delta + ndelta) esl_fatal(msg); }
+	  else             { if (sq[i] < base + (k == 0 ? 0 : part_end[k-1]) || sq[i] >= base + part_end[k]) esl_fatal(msg); }
+	}
+    }
+
+  for (i = 0; i < nthreads; i++)
+    {
+      info[i].inx_mutex = &inx_mutex;
+      info[i].ranges    = ranges;
+      info[i].nranges   = nranges;
+      info[i].home      = i % nparts;
+      info[i].nlocal    = 0;
+      info[i].nremote   = 0;
+    }
+  for (k = 0; k < nranges; k++)
+    {
+      nhome = nthreads;
+      if (k < nranges - 1)
+	for (nhome = 0, i = 0; i < nthreads; i++) if (info[i].home == k) ++nhome;
+      block_plan(&ranges[k], nhome);
+    }
+
+  /* the threads take turns, until none gets a block */
+  for (i = 0; i < cnt; i++) seen[i] = 0;
+  do {
+    active = 0;
+    for (i = 0; i < nthreads; i++)
+      if ((n = next_block(&info[i], &start)) > 0)
+	{
+	  if (start < 0 || start + n > cnt) esl_fatal(msg);
+	  for (j = start; j < start + n; j++) seen[j]++;
+	  active++;
+	}
+  } while (active > 0);
+
+  for (i = 0; i < cnt; i++) if (seen[i] != 1) esl_fatal(msg);
+
+  pthread_mutex_destroy(&inx_mutex);
+  free(seen);
+  free(info);
+  free(ranges);
+  free(part_end);
+  free(list);
+  free(delta);
+  free(base);
+  return;
+
+ ERROR:
+  esl_fatal(msg);
+}
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS *go = p7_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+
+  utest_cpulist();
+
+  /*           nbase ndelta nparts    inx    cnt  nthreads */
+  utest_blocks(  1000,    0,     1,      0,   1000,  1);   /* one part, no delta         */
+  utest_blocks(  1000,  100,     2,      0,   1100,  3);   /* small: a block per thread  */
+  utest_blocks(100000,    0,     2,      0, 100000,  4);   /* big: blocks shrink         */
+  utest_blocks(100000, 7000,     4,      0, 107000,  7);   /* uneven threads per part    */
+  utest_blocks(100000, 7000,     4,  30000,  50000,  8);   /* a slice: empty parts       */
+  utest_blocks(100000, 7000,     4,  90000,  17000,  2);   /* a slice into the delta     */
+  utest_blocks(    10,    5,     3,      0,     15, 16);   /* more threads than targets  */
+
+  esl_getopts_Destroy(go);
+  return eslOK;
+}
+#endif /*p7HMMDWRKR_TESTDRIVE*/
+
 #endif /*HMMER_THREADS*/
 
 /*****************************************************************
@@ -656,6 +656,7 @@ typedef struct p7_domaindef_s {
   P7_SPENSEMBLE  *sp;		/* an ensemble of sampled segment pairs (domain endpoints) */
   P7_TRACE       *tr;		/* reusable space for a trace of a domain                  */
   P7_TRACE       *gtr;		/* reusable space for a traceback of the entire target seq */
+  int             do_alidisplay; /* TRUE to build full alignment displays; FALSE: coords only */
 
   /* Heuristic thresholds that control the region definition process */
   /* "rt" = "region threshold", for lack of better term  */
@@ -742,6 +743,17 @@ typedef struct p7_hit_s {
 } P7_HIT;
 
 
+/* Structure: P7_EVICTED
+ * What a bounded hit list (--max-hits) remembers of a hit it evicted:
+ * enough to still count it as reported/included when thresholding.
+ */
+typedef struct {
+  double   lnP;		/* log(P-value) of the hit's score          */
+  float    score;	/* bit score of the hit                     */
+  uint32_t flags;	/* p7_IS_REPORTED | p7_IS_INCLUDED | ...    */
+} P7_EVICTED;
+
+
 /* Structure: P7_TOPHITS
  * merging when we prepare to output results. "hit" list is NULL and
  * unavailable until after we do a sort.  
@@ -755,6 +767,15 @@ typedef struct p7_tophits_s {
   uint64_t nincluded;	/* number of hits that are includable       */
   int      is_sorted_by_sortkey; /* TRUE when hits sorted by sortkey and th->hit valid for all N hits */
   int      is_sorted_by_seqidx; /* TRUE when hits sorted by seq_idx, position, and th->hit valid for all N hits */
+
+  /* Optional bound on retained hits (--max-hits); Kmax == 0 means unbounded */
+  uint64_t  Kmax;       /* keep at most this many hits, by sortkey      */
+  uint64_t *heap;       /* min-heap of unsrt[] indices, keyed on sortkey */
+  uint64_t  nheap;      /* # of hits in the heap                         */
+  int64_t   pending;    /* unsrt[] index handed out but not yet in heap; -1 if none */
+  uint64_t  nevicted;   /* # of hits dropped to honor the bound          */
+  P7_EVICTED *evicted;  /* scores of the dropped hits [0..nevicted-1]    */
+  uint64_t  nevalloc;   /* current allocation size of <evicted>          */
 } P7_TOPHITS;
 
 
@@ -816,6 +837,22 @@ typedef struct p7_hmm_window_list_s {
   int       size;
 } P7_HMM_WINDOWLIST;
 
+/* A nucleotide target packed 2 bits/residue for the scanning SSV filter
+ * (p7_packedsq.c). Non-ACGT residues are kept as runs in a side list.
+ */
+typedef struct p7_packedsq_s {
+  uint8_t   *T;           /* packed residues, 4/byte, first residue in high bits */
+  int64_t    L;           /* length of the sequence, in residues                 */
+  int64_t    Talloc;      /* current allocation of T, in bytes                   */
+  int64_t   *amb_start;   /* start (1..L) of each run of ambiguity codes         */
+  int64_t   *amb_len;     /* length of each run                                  */
+  ESL_DSQ   *amb_code;    /* digital code shared by every residue in the run     */
+  int        namb;        /* number of runs                                      */
+  int        ambAlloc;    /* current allocation of the amb_* arrays              */
+  const ESL_DSQ *src;     /* dsq this was packed from; identifies the target     */
+  int        complement;  /* p7_COMPLEMENT if packed as the reverse complement   */
+} P7_PACKEDSQ;
+
 
 
 /*****************************************************************
@@ -1227,6 +1264,8 @@ typedef struct p7_pipeline_s {
   uint64_t      nseqs;	        /* # of sequences searched                  */
   uint64_t      nres;	        /* # of residues searched                   */
   uint64_t      nnodes;	        /* # of model nodes searched                */
+  uint64_t      n_past_fm;      /* # targets w/ FM-index seed (FM prefilter)*/
+  uint64_t      n_msv_skipped;  /* # targets skipped by previous round's MSV bound */
   uint64_t      n_past_msv;	/* # comparisons that pass MSVFilter()      */
   uint64_t      n_past_bias;	/* # comparisons that pass bias filter      */
   uint64_t      n_past_vit;	/* # comparisons that pass ViterbiFilter()  */
@@ -1243,11 +1282,22 @@ typedef struct p7_pipeline_s {
   int           strands;         /*  p7_STRAND_TOPONLY  | p7_STRAND_BOTTOMONLY |  p7_STRAND_BOTH */
   int 		    	W;              /* window length for nhmmer scan - essentially maximum length of model that we expect to find*/
   int           block_length;   /* length of overlapping blocks read in the multi-threaded variant (default MAX_RESIDUE_COUNT) */
+  int           use_fmindex;    /* TRUE if targets are prefiltered by FM-index seed search (hmmsearch/phmmer) */
 
   int           show_accessions;/* TRUE to output accessions not names      */
   int           show_alignments;/* TRUE to output alignments (default)      */
 
+  /* Incremental search: skip targets whose MSV score can't reach F1,
+   * given an upper bound on each one's score from a previous search
+   * with a similar model (jackhmmer --incremental). Indexed by sq->idx.
+   */
+  const float  *msv_prvsc;      /* [1..msv_nsc] bound on last round's MSV scores (nats), or NULL */
+  float        *msv_cursc;      /* [1..msv_nsc] this round's MSV scores (or bounds), or NULL     */
+  int64_t       msv_nsc;        /* size of <msv_prvsc>, <msv_cursc>, minus 1                     */
+  float         msv_gain;       /* per-residue bound on MSV score rise since <msv_prvsc>         */
+
   P7_HMMFILE   *hfp;		/* COPY of open HMM database (if scan mode) */
+  const P7_PACKEDSQ *psq;       /* COPY of 2-bit packed target for SSV (nhmmer), or NULL */
   char          errbuf[eslERRBUFSIZE];
 } P7_PIPELINE;
 
@@ -1258,6 +1308,8 @@ typedef struct p7_pipeline_s {
  *****************************************************************/
 
 #define p7_DEFAULT_WINDOW_BETA  1e-7
+#define p7_BUILDER_MINPARNSEQ   1000  /* MSAs with fewer seqs are weighted/clustered serially */
+#define p7_BUILDER_STREAMCHUNK  1024  /* # of seqs read at a time by p7_StreamBuilder()          */
 
 enum p7_archchoice_e { p7_ARCH_FAST = 0, p7_ARCH_HAND = 1 };
 enum p7_wgtchoice_e  { p7_WGT_NONE  = 0, p7_WGT_GIVEN = 1, p7_WGT_GSC    = 2, p7_WGT_PB       = 3, p7_WGT_BLOSUM = 4 };
@@ -1279,6 +1331,12 @@ typedef struct p7_builder_s {
   double               esigma;		 /* min total rel ent parameter for effn entropy weights   */
   double               eid;		 /* %id threshold for effn clustering                      */
   double               eset;		 /* effective sequence number, if --eset; or -1.0          */
+  int                  eclust_greedy;	 /* TRUE to count greedy, not single linkage, clusters     */
+
+  /* Parallelism within one alignment                                                              */
+  int                  ncpus;		 /* threads for weighting/clustering deep MSAs; 0=serial   */
+  void               (*release_cpus)(void *arg, int n); /* optional: given ncpus-1 back once they're done */
+  void                *release_arg;
 
   /* Run-to-run variation due to random number generation                                          */
   ESL_RANDOMNESS      *r;	         /* RNG for E-value calibration simulations                */
@@ -1311,6 +1369,40 @@ typedef struct p7_builder_s {
 } P7_BUILDER;
 
 
+/* P7_ALISTREAM: one alignment too large to read whole, read in chunks
+ * of sequences, in one or more passes over the file.
+ */
+typedef struct p7_alistream_s {
+  FILE               *fp;
+  char               *filename;
+  int                 format;		 /* eslMSAFILE_STOCKHOLM or eslMSAFILE_AFA                 */
+  const ESL_ALPHABET *abc;
+
+  char               *line;		 /* current input line, for esl_fgets()                    */
+  int                 lalloc;
+  int                 have_line;	 /* TRUE if <line> is an unused AFA > line                 */
+  int64_t             linenumber;
+  char               *seqtxt;		 /* current seq's aligned text, whitespace removed         */
+  int64_t             seqlen;
+  int64_t             seqalloc;
+  char               *sqname;		 /* current seq's name                                     */
+
+  ESL_DSQ           **rows;		 /* [0..nrowalloc-1][0..alen+1] digitized rows, reused     */
+  char              **names;		 /* [0..nrowalloc-1] names for the chunk being read        */
+  int                 nrowalloc;
+
+  int64_t             alen;		 /* aligned length; -1 until the first seq is read         */
+  int                 nseq;		 /* # of seqs read so far in this pass                     */
+  int                 nseq_total;	 /* # of seqs in the alignment; -1 until first pass ends   */
+  int                 block_ended;	 /* TRUE after a blank line ends a Stockholm block         */
+  int                 at_end;		 /* TRUE when this pass is done                            */
+
+  ESL_MSA            *hdr;		 /* no seqs: name, acc, desc, cutoffs, #=GC RF/MM/SS/SA     */
+  char               *setname;		 /* optional name overriding #=GF ID                       */
+  char                errbuf[eslERRBUFSIZE];
+} P7_ALISTREAM;
+
+
 
 /*****************************************************************
  * 18. Routines in HMMER's exposed API.
@@ -1319,6 +1411,8 @@ typedef struct p7_builder_s {
 /* build.c */
 extern int p7_Handmodelmaker(ESL_MSA *msa,                P7_BUILDER *bld, P7_HMM **ret_hmm, P7_TRACE ***ret_tr);
 extern int p7_Fastmodelmaker(ESL_MSA *msa, float symfrac, P7_BUILDER *bld, P7_HMM **ret_hmm, P7_TRACE ***ret_tr);
+extern int p7_MatassignCount   (ESL_MSA *msa, int *matassign, P7_HMM *hmm);
+extern int p7_MatassignAnnotate(ESL_MSA *msa, int *matassign, P7_HMM *hmm);
 
 /* emit.c */
 extern int p7_CoreEmit   (ESL_RANDOMNESS *r, const P7_HMM *hmm,                                        ESL_SQ *sq, P7_TRACE *tr);
@@ -1361,6 +1455,7 @@ extern int p7_GNull2_ByTrace      (const P7_PROFILE *gm, const P7_TRACE *tr, int
 /* generic_optacc.c */
 extern int p7_GOptimalAccuracy(const P7_PROFILE *gm, const P7_GMX *pp,       P7_GMX *gx, float *ret_e);
 extern int p7_GOATrace        (const P7_PROFILE *gm, const P7_GMX *pp, const P7_GMX *gx, P7_TRACE *tr);
+extern int p7_GOATraceCheckpointed(const ESL_DSQ *dsq, int L, const P7_PROFILE *gm, P7_TRACE *tr, float *opt_oasc);
 
 /* generic_stotrace.c */
 extern int p7_GStochasticTrace(ESL_RANDOMNESS *r, const ESL_DSQ *dsq, int L, const P7_PROFILE *gm, const P7_GMX *gx, P7_TRACE *tr);
@@ -1434,6 +1529,15 @@ extern int    p7_MeanPositionRelativeEntropy(const P7_HMM *hmm, const P7_BG *bg,
 extern int    p7_hmm_CompositionKLDist(P7_HMM *hmm, P7_BG *bg, float *ret_KL, float **opt_avp);
 
 
+/* msaweight.c */
+extern int p7_msaweight_PB(ESL_MSA *msa, int ncpus);
+extern int p7_msaweight_BLOSUM(ESL_MSA *msa, double maxid, int ncpus);
+extern int p7_msacluster_SingleLinkage(const ESL_MSA *msa, double maxid, int ncpus, int **opt_c, int **opt_nin, int *ret_nc);
+extern int p7_msacluster_Greedy(const ESL_MSA *msa, double maxid, int ncpus, int *ret_nc);
+extern int p7_msaweight_PBStreamCount (const ESL_MSA *msa, double *colw);
+extern int p7_msaweight_PBStreamFinish(int64_t alen, int K, double *colw);
+extern int p7_msaweight_PBStreamApply (ESL_MSA *msa, const double *colw);
+
 /* mpisupport.c */
 #ifdef HAVE_MPI
 extern int p7_hmm_MPISend(P7_HMM *hmm, int dest, int tag, MPI_Comm comm, char **buf, int *nalloc);
@@ -1463,10 +1567,12 @@ extern int p7_oprofile_MPIRecv(int source, int tag, MPI_Comm comm, char **buf, i
 extern int p7_tracealign_Seqs(ESL_SQ **sq,           P7_TRACE **tr, int nseq, int M,  int optflags, P7_HMM *hmm, ESL_MSA **ret_msa);
 extern int p7_tracealign_MSA (const ESL_MSA *premsa, P7_TRACE **tr,           int M,  int optflags, ESL_MSA **ret_postmsa);
 extern int p7_tracealign_computeTraces(P7_HMM *hmm, ESL_SQ  **sq, int offset, int N, P7_TRACE  **tr);
+extern int p7_tracealign_computeTracesThreaded(P7_HMM *hmm, ESL_SQ **sq, int offset, int N, P7_TRACE **tr, int ncpus, int64_t ramlimit);
 extern int p7_tracealign_getMSAandStats(P7_HMM *hmm, ESL_SQ  **sq, int N, ESL_MSA **ret_msa, float **ret_pp, float **ret_relent, float **ret_scores );
 
 /* p7_alidisplay.c */
 extern P7_ALIDISPLAY *p7_alidisplay_Create(const P7_TRACE *tr, int which, const P7_OPROFILE *om, const ESL_SQ *sq, const ESL_SQ *ntsq);
+extern P7_ALIDISPLAY *p7_alidisplay_CreateCoords(const P7_TRACE *tr, int which, const P7_OPROFILE *om, const ESL_SQ *sq);
 extern P7_ALIDISPLAY *p7_alidisplay_Clone(const P7_ALIDISPLAY *ad);
 extern size_t         p7_alidisplay_Sizeof(const P7_ALIDISPLAY *ad);
 extern int            p7_alidisplay_Serialize(P7_ALIDISPLAY *ad);
@@ -1484,6 +1590,13 @@ extern int            p7_alidisplay_Backconvert(const P7_ALIDISPLAY *ad, const E
 extern int            p7_alidisplay_Dump(FILE *fp, const P7_ALIDISPLAY *ad);
 extern int            p7_alidisplay_Compare(const P7_ALIDISPLAY *ad1, const P7_ALIDISPLAY *ad2);
 
+/* p7_alistream.c */
+extern int  p7_alistream_Open   (const char *filename, const ESL_ALPHABET *abc, int format, char *errbuf, P7_ALISTREAM **ret_as);
+extern int  p7_alistream_SetName(P7_ALISTREAM *as, const char *name);
+extern int  p7_alistream_Read   (P7_ALISTREAM *as, int nmax, ESL_MSA **ret_msa);
+extern int  p7_alistream_Rewind (P7_ALISTREAM *as);
+extern void p7_alistream_Close  (P7_ALISTREAM *as);
+
 /* p7_bg.c */
 extern P7_BG *p7_bg_Create(const ESL_ALPHABET *abc);
 extern P7_BG *p7_bg_CreateUniform(const ESL_ALPHABET *abc);
@@ -1507,6 +1620,7 @@ extern void        p7_builder_Destroy(P7_BUILDER *bld);
 
 extern int p7_Builder      (P7_BUILDER *bld, ESL_MSA *msa, P7_BG *bg, P7_HMM **opt_hmm, P7_TRACE ***opt_trarr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om, ESL_MSA **opt_postmsa, FILE *seqweights_w_fp, FILE *seqweights_e_fp);
 extern int p7_SingleBuilder(P7_BUILDER *bld, ESL_SQ *sq,   P7_BG *bg, P7_HMM **opt_hmm, P7_TRACE  **opt_tr,    P7_PROFILE **opt_gm, P7_OPROFILE **opt_om); 
+extern int p7_StreamBuilder(P7_BUILDER *bld, P7_ALISTREAM *as, P7_BG *bg, P7_HMM **opt_hmm, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om);
 extern int p7_Builder_MaxLength      (P7_HMM *hmm, double emit_thresh);
 
 /* p7_domaindef.c */
@@ -1605,6 +1719,16 @@ extern P7_HMM_WINDOW *p7_hmm_newWindow (P7_HMM_WINDOWLIST *list, uint32_t id, ui
 
 
 
+/* p7_packedsq.c */
+extern P7_PACKEDSQ *p7_packedsq_Create(void);
+extern int          p7_packedsq_Pack(P7_PACKEDSQ *psq, const ESL_ALPHABET *abc, const ESL_DSQ *dsq, int64_t L);
+extern int          p7_packedsq_Decode(const P7_PACKEDSQ *psq, int64_t from, int64_t n, ESL_DSQ *dsq);
+#ifdef eslAUGMENT_ALPHABET
+extern int          p7_packedsq_ReverseComplement(P7_PACKEDSQ *rc, const P7_PACKEDSQ *psq, const ESL_ALPHABET *abc, const ESL_DSQ *dsq);
+#endif
+extern int          p7_packedsq_Reuse(P7_PACKEDSQ *psq);
+extern void         p7_packedsq_Destroy(P7_PACKEDSQ *psq);
+
 /* p7_null3.c */
 extern void p7_null3_score(const ESL_ALPHABET *abc, const ESL_DSQ *dsq, P7_TRACE *tr, int start, int stop, P7_BG *bg, float *ret_sc);
 extern void p7_null3_windowed_score(const ESL_ALPHABET *abc, const ESL_DSQ *dsq, int start, int stop, P7_BG *bg, float *ret_sc);
@@ -1634,6 +1758,9 @@ extern int p7_Pipeline_LongTarget   (P7_PIPELINE *pli, P7_OPROFILE *om, P7_SCORE
                                      , ESL_STOPWATCH *watch_slave
 */
                                      );
+extern int p7_Pipeline_FM           (P7_PIPELINE *pli, P7_OPROFILE *om, P7_SCOREDATA *data,
+                                     P7_BG *bg, P7_TOPHITS *th,
+                                     const FM_DATA *fmf, const FM_DATA *fmb, FM_CFG *fm_cfg, ESL_SQ *sq);
 
 
 
@@ -1678,6 +1805,7 @@ extern void    p7_spensemble_Destroy(P7_SPENSEMBLE *sp);
 /* p7_tophits.c */
 extern P7_TOPHITS *p7_tophits_Create(void);
 extern int         p7_tophits_Grow(P7_TOPHITS *h);
+extern int         p7_tophits_SetMaxHits(P7_TOPHITS *h, uint64_t Kmax);
 extern int         p7_tophits_CreateNextHit(P7_TOPHITS *h, P7_HIT **ret_hit);
 extern int         p7_tophits_Add(P7_TOPHITS *h,
 				  char *name, char *acc, char *desc, 
@@ -1702,6 +1830,7 @@ extern void        p7_tophits_Destroy(P7_TOPHITS *h);
 extern int p7_tophits_ComputeNhmmerEvalues(P7_TOPHITS *th, double N, int W);
 extern int p7_tophits_RemoveDuplicates(P7_TOPHITS *th, int using_bit_cutoffs);
 extern int p7_tophits_Threshold(P7_TOPHITS *th, P7_PIPELINE *pli);
+extern int p7_tophits_Prune(P7_TOPHITS *th, P7_PIPELINE *pli, uint64_t K, uint64_t *opt_nreported, uint64_t *opt_nincluded);
 extern int p7_tophits_CompareRanking(P7_TOPHITS *th, ESL_KEYHASH *kh, int *opt_nnew);
 extern int p7_tophits_Targets(FILE *ofp, P7_TOPHITS *th, P7_PIPELINE *pli, int textw);
 extern int p7_tophits_Domains(FILE *ofp, P7_TOPHITS *th, P7_PIPELINE *pli, int textw);
@@ -1716,6 +1845,10 @@ extern int p7_tophits_TabularXfam(FILE *ofp, char *qname, char *qacc, P7_TOPHITS
 extern int p7_tophits_TabularTail(FILE *ofp, const char *progname, enum p7_pipemodes_e pipemode, 
 				  const char *qfile, const char *tfile, const ESL_GETOPTS *go);
 extern int p7_tophits_AliScores(FILE *ofp, char *qname, P7_TOPHITS *th );
+extern int p7_tophits_Binary(FILE *ofp, char *qname, char *qacc, P7_TOPHITS *th, P7_PIPELINE *pli);
+extern int p7_tophits_ReadBinary(FILE *ifp, char **ret_qname, char **ret_qacc, P7_TOPHITS **ret_th, P7_PIPELINE *pli);
+extern int p7_tophits_Pack(P7_TOPHITS *th, uint64_t nhits, char **ret_buf, uint64_t *ret_n);
+extern int p7_tophits_Unpack(const char *buf, uint64_t n, P7_TOPHITS **ret_th, uint64_t *opt_nread);
 
 /* p7_trace.c */
 extern P7_TRACE *p7_trace_Create(void);
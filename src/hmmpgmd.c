@@ -35,6 +35,11 @@ static ESL_OPTIONS cmdlineOpts[] = {
   { "--seqdb",      eslARG_INFILE,  NULL,     NULL, NULL,           NULL,  NULL,  "--worker",      "protein database to cache for searches",                      12 },
   { "--hmmdb",      eslARG_INFILE,  NULL,     NULL, NULL,           NULL,  NULL,  "--worker",      "hmm database to cache for searches",                          12 },
   { "--cpu",        eslARG_INT,     NULL,"HMMER_NCPU","n>0",        NULL,  NULL,  "--master",      "number of parallel CPU workers to use for multithreads",      12 },
+  { "--numa",       eslARG_NONE,    FALSE,    NULL, NULL,           NULL,  NULL,  "--master",      "place the cached residues and pin threads by NUMA node",      12 },
+  { "--chunks",     eslARG_INT,     "8",      NULL, "n>0",          NULL,  NULL,  "--worker",      "hand out search chunks no smaller than 1/<n> of a worker's share", 12 },
+  { "--rcache_mb",  eslARG_INT,     "256",    NULL, "n>=0",         NULL,  NULL,  "--worker",      "megabytes of recent search results to cache (0: no cache)",   12 },
+  { "--rcache_n",   eslARG_INT,     "10000",  NULL, "n>=0",         NULL,  NULL,  "--worker",      "maximum number of search results to cache",                   12 },
+  { "--climit",     eslARG_INT,     "0",      NULL, "n>=0",         NULL,  NULL,  "--worker",      "most searches a client address may have queued (0: no limit)",12 },
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 
   };
@@ -45,6 +45,8 @@ typedef struct {
 #define HMMD_CMD_INIT       10003
 #define HMMD_CMD_SHUTDOWN   10004
 #define HMMD_CMD_RESET      10005
+#define HMMD_CMD_PRELOAD    10006
+#define HMMD_CMD_SWAP       10007
 
 #define MAX_INIT_DESC 32
 
@@ -70,9 +72,21 @@ typedef struct {
   uint32_t    seq_cnt;              /* sequences in database                    */
   uint32_t    hmm_cnt;              /* total number hmm databases               */
   uint32_t    model_cnt;            /* models in hmm database                   */
+  uint32_t    delta_off;            /* offset to first seq delta name           */
+  uint32_t    delta_cnt;            /* number of seq deltas, names consecutive  */
+  uint32_t    append;               /* deltas add to the loaded seq database    */
   char        data[1];              /* string data                              */
 } HMMD_INIT_CMD;
 
+/* HMMD_CMD_PRELOAD carries an HMMD_INIT_CMD naming the databases to
+ * load in the background, with seq_cnt and sid describing the seq
+ * database once any deltas are appended. The worker answers every
+ * PRELOAD with eslENORESULT while it is still loading, eslOK once the
+ * databases are ready, or the error that stopped it. HMMD_CMD_SWAP
+ * with status eslOK puts the preloaded databases in use; any other
+ * status throws them away.
+ */
+
 /* HMMD_CMD_RESET */
 typedef struct {
   char        ip_addr[1];           /* ip address                               */
@@ -115,6 +129,9 @@ typedef struct queue_data_s {
   int            inx;         /* sequence index to start search */
   int            cnt;         /* number of sequences to search  */
 
+  int            priority;    /* class queued in, 0 served first */
+  double         queued;      /* time queued, seconds           */
+  struct queue_data_s *next;  /* next request in its class      */
 } QUEUE_DATA;
 
 
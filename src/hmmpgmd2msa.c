@@ -29,13 +29,8 @@
  * Purpose:   Given a data stream from HMMPGMD of the form shown
  *            here, produce an MSA:
  *                 HMMD_SEARCH_STATS
- *                 P7_HITS array of size (nhits) from above?
- *                 then repeats of P7_DOMAIN and P7_ALIDISPLAY data
- *                 for the hits, where each hit with d domains
- *                 produces
- *                   d P7_DOMAINs
- *                   then
- *                   d P7_ALIDISPLAYs
+ *                 then the hits, their domains and alignments,
+ *                 as one block packed by p7_tophits_Pack()
  *            ... optionally adding a sequence with length matching
  *            that of the hmm, which will be included in the alignment.
  *
@@ -84,20 +79,13 @@ hmmpgmd2msa(void *data, P7_HMM *hmm, ESL_SQ *qsq, int *incl, int incl_size, int
 
   /* vars used to read from the binary data */
   HMMD_SEARCH_STATS *stats   = NULL;              /* pointer to a single stats object, at the beginning of data */
-  P7_HIT            *hits    = NULL;              /* an array of hits, at the appropriate offset in data */
 
   /* vars used in msa construction */
-  P7_TOPHITS         th;
-  P7_ALIDISPLAY     *ad, *ad2;
+  P7_TOPHITS        *th    = NULL;
   ESL_MSA           *msa   = NULL;
-  P7_DOMAIN         *dom   = NULL;
 
   char              *p     = (char*)data;        /*pointer used to walk along data, must be char* to allow pointer arithmetic */
 
-  th.N = 0;
-  th.unsrt = NULL;
-  th.hit   = NULL;
-
   /* optionally build a faux trace for the query sequence: relative to core model (B->M_1..M_L->E) */
   if (qsq != NULL) {
     if (qsq->n != hmm->M) {
@@ -130,40 +118,22 @@ hmmpgmd2msa(void *data, P7_HMM *hmm, ESL_SQ *qsq, int *incl, int incl_size, int
 
   /* ok, it looks legitimate */
   p    += sizeof(HMMD_SEARCH_STATS);
-  hits  = (P7_HIT*)p;
-  p    += sizeof(P7_HIT) * stats->nhits;
-
-  /* create a tophits object, to be passed to p7_tophits_Alignment() */
-  ESL_ALLOC( th.unsrt, sizeof(P7_HIT) * stats->nhits);
-  memcpy( th.unsrt, hits, sizeof(P7_HIT) * stats->nhits);
-  ESL_ALLOC( th.hit, sizeof(P7_HIT*) * stats->nhits);
-  for (i=0; i<stats->nhits; i++) {
-    th.hit[i] = &(th.unsrt[i]);
-    if (   th.hit[i]->ndom > 10000
-        || th.hit[i]->flags >  p7_IS_INCLUDED + p7_IS_REPORTED + p7_IS_NEW + p7_IS_DROPPED + p7_IS_DUPLICATE
-    ) {
-      status = eslFAIL;
-      goto ERROR;
-    }
-  }
 
-//  th.unsrt     = NULL;
-  th.N         = stats->nhits;
-  th.nreported = 0;
-  th.nincluded = 0;
-  th.is_sorted_by_sortkey = 0;
-  th.is_sorted_by_seqidx  = 0;
+  /* unpack the hits into a tophits object, to be passed to p7_tophits_Alignment() */
+  if ((status = p7_tophits_Unpack(p, 0, &th, NULL)) != eslOK) goto ERROR;
 
-  for (i = 0; i < th.N; i++) {
-    ESL_ALLOC( th.hit[i]->dcl, sizeof(P7_DOMAIN) *  th.hit[i]->ndom);
+  th->nreported = 0;
+  th->nincluded = 0;
+
+  for (i = 0; i < th->N; i++) {
     /* Go through the hits and set to be excluded or included as necessary */
     set_included = 0;
-    if(th.hit[i]->flags & p7_IS_INCLUDED){
+    if(th->hit[i]->flags & p7_IS_INCLUDED){
       if(excl_size > 0){
         for( c = 0; c < excl_size; c++){
-          if(excl[c] == (long)(th.hit[i]->name) ){
-            th.hit[i]->flags = p7_IS_DROPPED;
-            th.hit[i]->nincluded = 0;
+          if(excl[c] == strtol(th->hit[i]->name, NULL, 10) ){
+            th->hit[i]->flags = p7_IS_DROPPED;
+            th->hit[i]->nincluded = 0;
             break;
           }
         }
@@ -171,78 +141,28 @@ hmmpgmd2msa(void *data, P7_HMM *hmm, ESL_SQ *qsq, int *incl, int incl_size, int
     }else{
       if(incl_size > 0){
     	for( c = 0; c < incl_size; c++){
-          if(incl[c] == (long)th.hit[i]->name ){
-            th.hit[i]->flags = p7_IS_INCLUDED;
+          if(incl[c] == strtol(th->hit[i]->name, NULL, 10) ){
+            th->hit[i]->flags = p7_IS_INCLUDED;
             set_included = 1;
           }
         }
       }
     }
-    /* first grab all the P7_DOMAINs for the hit */
-    for (j=0; j < th.hit[i]->ndom; j++) {
-      dom = th.hit[i]->dcl + j;
-      memcpy(dom , (P7_DOMAIN*)p, sizeof(P7_DOMAIN));
-      /* Possibly set domains to be include if being
-       * externally set via incl list*/
-      if(set_included) th.hit[i]->dcl[j].is_included = 1;
-      p += sizeof(P7_DOMAIN);
-    }
-    /* then grab the P7_ALIDISPLAYs for the hit */
-    for (j=0; j < th.hit[i]->ndom; j++) {
-      ad = (P7_ALIDISPLAY*)p;
-      ESL_ALLOC(th.hit[i]->dcl[j].ad, sizeof(P7_ALIDISPLAY));
-      ad2 = th.hit[i]->dcl[j].ad;
-
-      ad2->memsize = ad->memsize;
-      ad2->rfline = ad->rfline;
-      ad2->mmline = ad->mmline;
-      ad2->csline = ad->csline ;
-      ad2->model  = ad->model ;
-      ad2->mline  = ad->mline ;
-      ad2->aseq   = ad->aseq ;
-      ad2->ppline = ad->ppline;
-      ad2->N      = ad->N;
-
-      ad2->hmmname = ad->hmmname;
-      ad2->hmmacc  = ad->hmmacc ;
-      ad2->hmmdesc = ad->hmmdesc;
-      ad2->hmmfrom = ad->hmmfrom;
-      ad2->hmmto   = ad->hmmto;
-      ad2->M       = ad->M;
-
-      ad2->sqname  = ad->sqname;
-      ad2->sqacc   = ad->sqacc ;
-      ad2->sqdesc  = ad->sqdesc;
-      ad2->sqfrom  = ad->sqfrom;
-      ad2->sqto    = ad->sqto;
-      ad2->L       = ad->L;
-
-      p += sizeof(P7_ALIDISPLAY);
-
-      ESL_ALLOC(ad2->mem, ad2->memsize);
-      
-      memcpy(ad2->mem, p, ad->memsize);
-      
-      p += ad2->memsize;
-      p7_alidisplay_Deserialize(ad2);
-    }
+    /* Possibly set domains to be include if being
+     * externally set via incl list*/
+    if(set_included)
+      for (j=0; j < th->hit[i]->ndom; j++)
+        th->hit[i]->dcl[j].is_included = 1;
   }
 
 
   /* use the tophits and trace info above to produce an alignment */
-  if ( (status = p7_tophits_Alignment(&th, hmm->abc, &qsq, &qtr, extra_sqcnt, p7_ALL_CONSENSUS_COLS, &msa)) != eslOK) goto ERROR;
+  if ( (status = p7_tophits_Alignment(th, hmm->abc, &qsq, &qtr, extra_sqcnt, p7_ALL_CONSENSUS_COLS, &msa)) != eslOK) goto ERROR;
 
 
   /* free memory */
   if (qtr != NULL) free(qtr);
-  for (i = 0; i < th.N; i++) {
-    for (j=0; j < th.hit[i]->ndom; j++)
-      p7_alidisplay_Destroy(th.hit[i]->dcl[j].ad);
-
-    if (th.hit[i]->dcl != NULL) free (th.hit[i]->dcl);
-  }
-  if (th.unsrt != NULL) free (th.unsrt);
-  if (th.hit != NULL) free (th.hit);
+  p7_tophits_Destroy(th);
 
   *ret_msa = msa;
   return eslOK;
@@ -250,15 +170,7 @@ hmmpgmd2msa(void *data, P7_HMM *hmm, ESL_SQ *qsq, int *incl, int incl_size, int
 ERROR:
   /* free memory */
   if (qtr != NULL) free(qtr);
-
-  for (i = 0; i < th.N; i++) {
-    for (j=0; j < th.hit[i]->ndom; j++)
-      p7_alidisplay_Destroy(th.hit[i]->dcl[j].ad);
-
-    if (th.hit[i]->dcl != NULL) free (th.hit[i]->dcl);
-  }
-  if (th.unsrt != NULL) free (th.unsrt);
-  if (th.hit != NULL) free (th.hit);
+  if (th  != NULL) p7_tophits_Destroy(th);
 
   return status;
 }
@@ -302,21 +214,15 @@ int hmmpgmd2stats(void *data, P7_HMM *hmm, float** statsOut)
 
   /* vars used to read from the binary data */
   HMMD_SEARCH_STATS *stats   = NULL;              /* pointer to a single stats object, at the beginning of data */
-  P7_HIT            *hits    = NULL;              /* an array of hits, at the appropriate offset in data */
 
-  P7_TOPHITS         th;
-  P7_DOMAIN         *dom;
-  P7_ALIDISPLAY     *ad, *ad2;
+  P7_TOPHITS        *th    = NULL;
+  P7_ALIDISPLAY     *ad2;
 
   int *cover, *id, *similar; //store statistics result per hit
   int readPos, writePos;     //for converting alignment contents into model indexing
 
   char              *p     = (char*)data;        /*pointer used to walk along data, must be char* to allow pointer arithmetic */
 
-  th.N = 0;
-  th.unsrt = NULL;
-  th.hit   = NULL;
-
   //storage for output
   ESL_ALLOC( *statsOut,   sizeof(float) * hmm->M * 3);
 
@@ -350,86 +256,23 @@ int hmmpgmd2stats(void *data, P7_HMM *hmm, float** statsOut)
 
   /* ok, it looks legitimate */
   p    += sizeof(HMMD_SEARCH_STATS);
-  hits  = (P7_HIT*)p;
-  p    += sizeof(P7_HIT) * stats->nhits;
-
-  /* create a tophits object, use it to step through the alignments */
-  ESL_ALLOC( th.unsrt, sizeof(P7_HIT) * stats->nhits);
-  memcpy( th.unsrt, hits, sizeof(P7_HIT) * stats->nhits);
-  ESL_ALLOC( th.hit, sizeof(P7_HIT*) * stats->nhits);
-  for (i=0; i<stats->nhits; i++) {
-    th.hit[i] = &(th.unsrt[i]);
-    if (   th.hit[i]->ndom > 10000
-        || th.hit[i]->flags >  p7_IS_INCLUDED + p7_IS_REPORTED + p7_IS_NEW + p7_IS_DROPPED + p7_IS_DUPLICATE
-    ) {
-      status = eslFAIL;
-      goto ERROR;
-    }
-  }
 
-  th.N         = stats->nhits;
-  th.nreported = 0;
-  th.nincluded = 0;
-  th.is_sorted_by_sortkey = 0;
-  th.is_sorted_by_seqidx  = 0;
+  /* unpack the hits into a tophits object, use it to step through the alignments */
+  if ((status = p7_tophits_Unpack(p, 0, &th, NULL)) != eslOK) goto ERROR;
 
-  for (i = 0; i < th.N; i++) 
+  th->nreported = 0;
+  th->nincluded = 0;
+
+  for (i = 0; i < th->N; i++) 
   {
-    ESL_ALLOC( th.hit[i]->dcl, sizeof(P7_DOMAIN) *  th.hit[i]->ndom);
-   
-    if(th.hit[i]->flags & p7_IS_INCLUDED) th.nincluded++;
+    if(th->hit[i]->flags & p7_IS_INCLUDED) th->nincluded++;
 
-    /* first grab all the P7_DOMAINs for the hit */
-    for (j=0; j < th.hit[i]->ndom; j++) 
+    for (j=0; j < th->hit[i]->ndom; j++) 
     {
-      dom = (P7_DOMAIN*)p;
-      th.hit[i]->dcl[j].is_included = dom->is_included;
-      p += sizeof(P7_DOMAIN);
-    }
-    
-    /* then grab the P7_ALIDISPLAYs for the hit */
-    for (j=0; j < th.hit[i]->ndom; j++) 
-    {
-      ad = (P7_ALIDISPLAY*)p;
-      ESL_ALLOC(th.hit[i]->dcl[j].ad, sizeof(P7_ALIDISPLAY));
-      ad2 = th.hit[i]->dcl[j].ad;
-
-      ad2->memsize = ad->memsize;
-      ad2->rfline = ad->rfline;
-      ad2->mmline = ad->mmline;
-      
-      ad2->csline = ad->csline ;
-      ad2->model  = ad->model ;
-      ad2->mline  = ad->mline ;
-      ad2->aseq   = ad->aseq ;
-      ad2->ppline = ad->ppline;
-      ad2->N      = ad->N;
-
-      ad2->hmmname = ad->hmmname;
-      ad2->hmmacc  = ad->hmmacc ;
-      ad2->hmmdesc = ad->hmmdesc;
-      ad2->hmmfrom = ad->hmmfrom;
-      ad2->hmmto   = ad->hmmto;
-      ad2->M       = ad->M;
-
-      ad2->sqname  = ad->sqname;
-      ad2->sqacc   = ad->sqacc ;
-      ad2->sqdesc  = ad->sqdesc;
-      ad2->sqfrom  = ad->sqfrom;
-      ad2->sqto    = ad->sqto;
-      ad2->L       = ad->L;    
-      
-      p += sizeof(P7_ALIDISPLAY);
-
-      ESL_ALLOC(ad2->mem, ad2->memsize);
-      
-      memcpy(ad2->mem, p, ad->memsize);
-      
-      p += ad2->memsize;
+      ad2 = th->hit[i]->dcl[j].ad;
+      if (ad2 == NULL) continue;
       
-      p7_alidisplay_Deserialize(ad2);
-      
-      if(th.hit[i]->flags & p7_IS_INCLUDED && th.hit[i]->dcl[j].is_included)
+      if(th->hit[i]->flags & p7_IS_INCLUDED && th->hit[i]->dcl[j].is_included)
       {
         writePos = ad2->hmmfrom-1;  
         readPos = 0;
@@ -476,7 +319,7 @@ int hmmpgmd2stats(void *data, P7_HMM *hmm, float** statsOut)
 
   for(i = 0; i < hmm->M*3; i++)
   {
-    (*statsOut)[i] = (*statsOut)[i]/(th.nincluded);
+    (*statsOut)[i] = (*statsOut)[i]/(th->nincluded);
   }
 
   for(i = hmm->M; i < hmm->M*3; i++)
@@ -496,21 +339,8 @@ int hmmpgmd2stats(void *data, P7_HMM *hmm, float** statsOut)
   if (qtr != NULL) free(qtr);
   qtr = NULL;
   
-  for (i = 0; i < th.N; i++) {
-    for (j=0; j < th.hit[i]->ndom; j++)
-      if(th.hit[i]->dcl[j].ad)
-      {
-        p7_alidisplay_Destroy(th.hit[i]->dcl[j].ad);
-        th.hit[i]->dcl[j].ad = NULL;
-      }
-      
-    if (th.hit[i]->dcl != NULL) free (th.hit[i]->dcl);
-    th.hit[i]->dcl = NULL;
-  }
-  if (th.unsrt != NULL) free (th.unsrt);
-  th.unsrt = NULL;
-  if (th.hit != NULL) free (th.hit);
-  th.hit = NULL;
+  if (th != NULL) p7_tophits_Destroy(th);
+  th = NULL;
 
   return eslOK;
 
@@ -519,21 +349,8 @@ ERROR:
   if (qtr != NULL) free(qtr);
   qtr = NULL;
   
-  for (i = 0; i < th.N; i++) {
-    for (j=0; j < th.hit[i]->ndom; j++)
-      if(th.hit[i]->dcl[j].ad)
-      {
-        p7_alidisplay_Destroy(th.hit[i]->dcl[j].ad);
-        th.hit[i]->dcl[j].ad = NULL;
-      }
-      
-    if (th.hit[i]->dcl != NULL) free (th.hit[i]->dcl);
-    th.hit[i]->dcl = NULL;
-  }
-  if (th.unsrt != NULL) free (th.unsrt);
-  th.unsrt = NULL;
-  if (th.hit != NULL) free (th.hit);
-  th.hit = NULL;
+  if (th != NULL) p7_tophits_Destroy(th);
+  th = NULL;
   
 
   return status;
@@ -262,9 +262,7 @@ sub unpackResults {
     my $binaryData = readAndStore( $socket, $messLen, $fh );
 
     #We now process the binary data structure returned by
-    #hmmpgmd. To make the code more readable, we will
-    #unpack section by section, cutting off the front
-    #of the binary and processing just that bit.
+    #hmmpgmd: the search stats, then the hits as one packed block.
 
     my $bit = substr( $binaryData, 0, 120, '' );
 
@@ -272,33 +270,8 @@ sub unpackResults {
     #stats, such as time, number of hits
     my $stats = unpackStats($bit);
 
-    my $hits = [];
+    my $hits = unpackHits( $binaryData, $stats );
 
-    if ( $stats->{nreported} ) {
-
-      #We have at least some hits to unpack....
-      #The first hit section contains all of the sequence matches
-      #but not domain mataches.
-      for ( my $n = 1 ; $n <= $stats->{nreported} ; $n++ ) {
-        $bit = substr( $binaryData, 0, 152, '' );
-        unpackHit( $bit, $hits, $stats->{Z} );
-      }
-
-      #Now, unpack the domain hits for the sequences
-      for ( my $h = 0 ; $h < $stats->{nreported} ; $h++ ) {
-        if ( $hits->[$h]->{ndom} ) {
-          my $dombit = substr( $binaryData, 0, 72 * $hits->[$h]->{ndom}, '' );
-
-          #This gets the fixed size fields
-          unpackDomain( $dombit, $hits, $h, $stats );
-          for ( my $a = 1 ; $a <= $hits->[$h]->{ndom} ; $a++ ) {
-
-            #Now unpack the variable sized fields.
-            unpackAli( \$binaryData, $hits, $h, $a );
-          }
-        }
-      }
-    }
     return ( $stats, $hits );
   }
   else    #There was an error, read the message
@@ -309,62 +282,147 @@ sub unpackResults {
   }
 }
 
+#------------------------------------------------------------------------------
+=head2 unpackHits
+
+  Title    : unpackHits
+  Usage    : unpackHits( $binaryData, $stats );
+  Function : Unpacks the block of hits, domains and alignments that follows
+           : the search stats. The block starts with the magic "p7hw", a
+           : version byte and its size as an 8 byte little-endian integer,
+           : then the number of hits and the hits themselves. Integers are
+           : LEB128 varints (signed ones zigzag coded), floats and doubles
+           : little-endian IEEE754, and strings are sent in full the first
+           : time they are seen and as a reference to that after.
+           : See p7_tophits_Pack() in p7_tophits.c.
+  Args     : The binary data, stats hash ref.
+  Returns  : The hit array reference.
+  
+=cut
+
+sub unpackHits {
+  my ( $binary, $stats ) = @_;
+
+  my ( $magic, $version, $size ) = unpack( "a4 C Q<", $binary );
+  unless ( $magic eq 'p7hw' and $version == 1 and $size <= length($binary) ) {
+    die "Unrecognised hit data from hmmpgmd (version $version)\n";
+  }
+
+  my $r = { buf => $binary, pos => 13, str => [] };
+  my $hits = [];
+  my $nhits = getVarint($r);
+  for ( my $h = 0 ; $h < $nhits ; $h++ ) {
+    unpackHit( $r, $hits, $stats );
+  }
+  return $hits;
+}
+
+#------------------------------------------------------------------------------
+=head2 getVarint, getSvarint, getFloat, getDouble, getBytes, getString
+
+  Usage    : getVarint( $reader );
+  Function : Read the next value of each kind from the packed hit block.
+  Args     : The reader hash ref: the block, the position in it, and the
+           : strings seen so far.
+  Returns  : The value.
+  
+=cut
+
+sub getVarint {
+  my ($r) = @_;
+  my ( $v, $shift ) = ( 0, 0 );
+  while (1) {
+    my $b = ord( substr( $r->{buf}, $r->{pos}++, 1 ) );
+    $v |= ( $b & 0x7f ) << $shift;
+    last unless ( $b & 0x80 );
+    $shift += 7;
+  }
+  return $v;
+}
+
+sub getSvarint {
+  my ($r) = @_;
+  my $v = getVarint($r);
+  return ( $v & 1 ) ? -( ( $v >> 1 ) + 1 ) : ( $v >> 1 );
+}
+
+sub getFloat {
+  my ($r) = @_;
+  my $v = unpack( "f<", substr( $r->{buf}, $r->{pos}, 4 ) );
+  $r->{pos} += 4;
+  return $v;
+}
+
+sub getDouble {
+  my ($r) = @_;
+  my $v = unpack( "d<", substr( $r->{buf}, $r->{pos}, 8 ) );
+  $r->{pos} += 8;
+  return $v;
+}
+
+sub getBytes {
+  my ( $r, $n ) = @_;
+  my $s = substr( $r->{buf}, $r->{pos}, $n );
+  $r->{pos} += $n;
+  return $s;
+}
+
+sub getString {
+  my ($r) = @_;
+  my $code = getVarint($r);
+  return undef if ( $code == 0 );
+  return $r->{str}->[ $code - 2 ] if ( $code > 1 );
+  my $s = getBytes( $r, getVarint($r) );
+  push( @{ $r->{str} }, $s );
+  return $s;
+}
+
 #------------------------------------------------------------------------------
 =head2 unpackAli
 
   Title    : unpackAli
   Incept   : finnr, Apr 22, 2013 7:53:39 PM
-  Usage    : unpackAli( $binaryData, $hits, $hitCount, $domCount);
-  Function : Takes the binary data, gets the alignment data, which in this case
-           : are dynamic fields.  This uses the data found within the hit/domain
-           : information to locate and read the appropriate amount of bytes.
-  Args     : The binary data stream, the hit data structure and the hit and domain
-           : positions.
+  Usage    : unpackAli( $reader, $dom );
+  Function : Reads a domain's alignment: the optional lines present, the
+           : alignment length N, the lines of N characters each, then the
+           : model and sequence names and coordinates.
+  Args     : The reader, the domain hash ref.
   Returns  : 1
   
 =cut
 
 sub unpackAli {
-  my ( $binary, $hits, $h, $a ) = @_;
-
-  my $bit = substr( $$binary, 0, 168, '' );
-  my @aliKeys =
-    qw(rfline mmline csline model mline aseq ppline N hmmname hmmacc hmmdesc
-    hmmfrom hmmto M sqname sqacc sqdesc sqfrom sqto L memsize mem);
-  my @ali = unpack( "Q7 I x4 Q3 I3 x4 Q6 I x4 Q", $bit );
-  my %ali = map { $aliKeys[$_] => $ali[$_] } 0 .. $#aliKeys;
-
-  $bit = substr( $$binary, 0, $ali{memsize}, '' );
-  my @unpackElements = qw(0 1 2 3 4 5 6 8 9 10 14 15 16 20);
-
-  my $offset = 0;
-  for ( my $i = 0 ; $i < $#unpackElements ; $i++ ) {
-    my $e = $unpackElements[$i];
-    next if ( $ali[$e] == 0 );   #Then this element is not defined in the binary
-    my $ne;                      #Store the next defined element.
-    for ( my $j = $i + 1 ; $j <= $#unpackElements ; $j++ ) {
-      if ( $ali[ $unpackElements[$j] ] > 0 ) {
-        $ne = $unpackElements[$j];
-        $j  = $#unpackElements + 1;    #break the loop
-      }
-    }
-
-    #The number of bytes that we need to unpack is:
-    my $l = ( $ali[$ne] - $ali[$e] );
-
-    #Define the unpack template:
-    my $template = $offset > 0 ? "x$offset a$l" : "a$l";
-    my $s = $ali[$e] == 0 ? '' : unpack( $template, $bit );
-    chop($s);    #This removes the \0 - C string terminator
-    $ali{ $aliKeys[$e] } = $s;
-
-    #keep a note of what has aready been unpacked.
-    $offset += $l;
-  }
-
-  foreach my $k (@aliKeys) {
-    next if $k =~ /memsize/;
-    $hits->[$h]->{domains}->[ $a - 1 ]->{ 'ali' . $k } = $ali{$k};
+  my ( $r, $dom ) = @_;
+
+  my $opts = getVarint($r);
+  my $n    = getVarint($r);
+  my %ali  = ( N => $n );
+
+  $ali{rfline} = getBytes( $r, $n ) if ( $opts & 1 );
+  $ali{mmline} = getBytes( $r, $n ) if ( $opts & 2 );
+  $ali{csline} = getBytes( $r, $n ) if ( $opts & 4 );
+  $ali{model}  = getBytes( $r, $n );
+  $ali{mline}  = getBytes( $r, $n );
+  $ali{aseq}   = getBytes( $r, $n );
+  $ali{ntseq}  = getBytes( $r, 3 * $n ) if ( $opts & 16 );
+  $ali{ppline} = getBytes( $r, $n ) if ( $opts & 8 );
+
+  $ali{hmmname} = getString($r);
+  $ali{hmmacc}  = getString($r);
+  $ali{hmmdesc} = getString($r);
+  $ali{hmmfrom} = getSvarint($r);
+  $ali{hmmto}   = $ali{hmmfrom} + getSvarint($r);
+  $ali{M}       = $ali{hmmto} + getSvarint($r);
+
+  $ali{sqname} = getString($r);
+  $ali{sqacc}  = getString($r);
+  $ali{sqdesc} = getString($r);
+  $ali{sqfrom} = getSvarint($r);
+  $ali{sqto}   = $ali{sqfrom} + getSvarint($r);
+  $ali{L}      = $ali{sqto} + getSvarint($r);
+
+  foreach my $k ( keys %ali ) {
+    $dom->{ 'ali' . $k } = $ali{$k};
   }
   return 1;
 }
@@ -374,44 +432,43 @@ sub unpackAli {
 
   Title    : unpackDomain
   Incept   : finnr, Apr 22, 2013 7:59:59 PM
-  Usage    : unpackDomain( $binary, $hits, $h, $stats );
-  Function : unpack the domain hit from the binary string.
-  Args     : binary string, the hit array reference, the sequence position, 
-           : stats hash ref.
-  Returns  : 1
+  Usage    : unpackDomain( $reader, $prevIenv, $stats );
+  Function : unpack a domain hit, and its alignment if it has one. Envelope
+           : starts are sent relative to the previous domain's, and the other
+           : coordinates relative to each other.
+  Args     : The reader, the previous domain's ienv, stats hash ref.
+  Returns  : The domain hash ref.
   
 =cut
 
 sub unpackDomain {
-  my ( $binary, $hits, $h, $stats ) = @_;
-
-  my @dom = unpack( "i4 f5 x4 d i2 Q x8" x $hits->[$h]->{ndom}, $binary );
-  my $noDomKeys = 13;
-
-  #*** If the P7_DOMAIN struc changes, modify these numbers
-  for ( my $d = 0 ; $d < $hits->[$h]->{ndom} ; $d++ ) {
-    my $off = ( $d * $noDomKeys );
-    my $ievalue = sprintf( "%.1e", exp( $dom[ $off + 9 ] ) * $stats->{Z} );
-    $ievalue = $ievalue < 0.0001 ? $ievalue : sprintf( "%.6g", $ievalue );
-    my $cevalue = sprintf( "%.1e", exp( $dom[ $off + 9 ] ) * $stats->{domZ} );
-    $cevalue = $cevalue < 0.0001 ? $cevalue : sprintf( "%.6g", $cevalue );
-    $hits->[$h]->{domains}->[$d] = {
-      ienv     => $dom[$off],
-      jenv     => $dom[ $off + 1 ],
-      iali     => $dom[ $off + 2 ],
-      jali     => $dom[ $off + 3 ],
-      bitscore => $dom[ $off + 8 ],
-      ievalue  => $ievalue,
-      cevalue  => $cevalue,
-      oasc     => sprintf( "%4.2f",
-        ( $dom[ $off + 9 ] / ( 1.0 + abs( $dom[ $off + 1 ] - $dom[$off] ) ) ) ),
-      bias        => sprintf( "%.2f", abs( $dom[ $off + 9 ] * 1.442695041 ) ),
-      is_reported => $dom[ $off + 10 ],
-      is_included => $dom[ $off + 11 ],
-    };
-
-  }
-  return 1;
+  my ( $r, $prevIenv, $stats ) = @_;
+
+  my $flags = getVarint($r);
+  my %dom;
+  $dom{ienv}          = $prevIenv + getSvarint($r);
+  $dom{jenv}          = $dom{ienv} + getSvarint($r);
+  $dom{iali}          = $dom{ienv} + getSvarint($r);
+  $dom{jali}          = $dom{iali} + getSvarint($r);
+  $dom{iorf}          = getSvarint($r);
+  $dom{jorf}          = getSvarint($r);
+  $dom{envsc}         = getFloat($r);
+  $dom{domcorrection} = getFloat($r);
+  $dom{dombias}       = getFloat($r);
+  $dom{oasc}          = sprintf( "%4.2f", getFloat($r) / ( 1.0 + abs( $dom{jali} - $dom{iali} ) ) );
+  $dom{bitscore}      = getFloat($r);
+  $dom{lnP}           = getDouble($r);
+  $dom{is_reported}   = ( $flags & 1 ) ? 1 : 0;
+  $dom{is_included}   = ( $flags & 2 ) ? 1 : 0;
+  $dom{bias}          = sprintf( "%.2f", $dom{dombias} * 1.442695041 );
+
+  my $ievalue = sprintf( "%.1e", exp( $dom{lnP} ) * $stats->{Z} );
+  $dom{ievalue} = $ievalue < 0.0001 ? $ievalue : sprintf( "%.6g", $ievalue );
+  my $cevalue = sprintf( "%.1e", exp( $dom{lnP} ) * $stats->{domZ} );
+  $dom{cevalue} = $cevalue < 0.0001 ? $cevalue : sprintf( "%.6g", $cevalue );
+
+  unpackAli( $r, \%dom ) if ( $flags & 4 );
+  return \%dom;
 }
 
 #------------------------------------------------------------------------------
@@ -419,52 +476,62 @@ sub unpackDomain {
 
   Title    : unpackHit
   Incept   : finnr, Apr 22, 2013 8:22:55 PM
-  Usage    : unpackHit($binary, $hitArray, $dbsize);
-  Function : unpack a single sequence match, pushing the data into the hitArray
-           : reference.  The database size is also passed in to correctly set
-           : the e-value.
-  Args     : Binary data, hit array, int of the database size
+  Usage    : unpackHit($reader, $hitArray, $stats);
+  Function : unpack a single sequence match and its domains, pushing the data
+           : into the hitArray reference. The search stats are also passed in
+           : to correctly set the e-value.
+  Args     : The reader, hit array, stats hash ref.
   Returns  : 1
   
 =cut
 
 sub unpackHit {
-  my ( $binary, $hits, $z ) = @_;
-
-  my @hitKeys =
-    qw(name acc desc window_length sort_key score pre_score sum_score
-    pvalue pre_pvalue sum_pvalue nexpected nregions nclustered noverlaps
-    nenvelopes ndom flags nreported nincluded best_domain seqidx subseq_start dcl offset);
-  my $noHitsKeys = scalar(@hitKeys);
-  my $raw_hits   = [];
-  @{$raw_hits} = unpack( "Q3 I x4 d f3 x4 d3 f I9 Q4", $binary );
-
-  my $evalue = sprintf( "%.1e", exp( $raw_hits->[8] ) * $z );
-  $evalue = $evalue < 0.0001 ? $evalue : sprintf( "%.6g", $evalue );
-
-  my $acc  = $raw_hits->[0];
-  my $desc = $raw_hits->[2];
-
+  my ( $r, $hits, $stats ) = @_;
+
+  my %hit;
+  $hit{name}          = getString($r);
+  $hit{acc}           = getString($r);
+  $hit{desc}          = getString($r);
+  $hit{window_length} = getSvarint($r);
+  $hit{sort_key}      = getDouble($r);
+  $hit{score}         = getFloat($r);
+  $hit{pre_score}     = getFloat($r);
+  $hit{sum_score}     = getFloat($r);
+  $hit{pvalue}        = getDouble($r);
+  $hit{pre_pvalue}    = getDouble($r);
+  $hit{sum_pvalue}    = getDouble($r);
+  $hit{nexpected}     = getFloat($r);
+  $hit{nregions}      = getSvarint($r);
+  $hit{nclustered}    = getSvarint($r);
+  $hit{noverlaps}     = getSvarint($r);
+  $hit{nenvelopes}    = getSvarint($r);
+  $hit{flags}         = getVarint($r);
+  $hit{nreported}     = getSvarint($r);
+  $hit{nincluded}     = getSvarint($r);
+  $hit{best_domain}   = getSvarint($r);
+  $hit{seqidx}        = getSvarint($r);
+  $hit{subseq_start}  = getSvarint($r);
+  $hit{ndom}          = getVarint($r);
+
+  my $evalue = sprintf( "%.1e", exp( $hit{pvalue} ) * $stats->{Z} );
+  $hit{evalue} = $evalue < 0.0001 ? $evalue : sprintf( "%.6g", $evalue );
+  $hit{bias}   = sprintf( "%.1f", abs( $hit{pre_score} - $hit{score} ) );
+  $hit{score}  = sprintf( "%.1f", $hit{score} );
+
+  #The name is the sequence index in the hmmpgmd database; the description
+  #carries the domain architecture and taxonomy id.
   if ($mappings) {
-    ( $acc, $desc ) = split( /\s+/xm, $mappings->[ $raw_hits->[0] ], 2 );
+    ( $hit{name}, $hit{desc} ) = split( /\s+/xm, $mappings->[ $hit{name} ], 2 );
   }
 
-  push @$hits,
-    {
-    name      => $acc,
-    acc       => $raw_hits->[1],
-    desc      => $desc,
-    score     => sprintf( "%.1f", $raw_hits->[5] ),
-    bias      => sprintf( "%.1f", abs( $raw_hits->[6] - $raw_hits->[5] ) ),
-    pvalue    => $raw_hits->[8],
-    nregions  => $raw_hits->[12],
-    ndom      => $raw_hits->[16],
-    flags     => $raw_hits->[17],
-    nreported => $raw_hits->[18],
-    nincluded => $raw_hits->[19],
-    evalue    => $evalue,
-    dcl       => $raw_hits->[23]
-    };
+  my $prevIenv = 0;
+  for ( my $d = 0 ; $d < $hit{ndom} ; $d++ ) {
+    my $dom = unpackDomain( $r, $prevIenv, $stats );
+    push( @{ $hit{domains} }, $dom );
+    $prevIenv = $dom->{ienv};
+  }
+
+  push @$hits, \%hit;
   return 1;
 }
 
@@ -638,8 +705,9 @@ hmmpgmd format database file, using HMMER's hmmpgmd. Steps include:
 (3) Run this client to connect to the master
 
 (4) Submit one query to hmmpgmd for each sequence in the query file, retrieve results 
-    from the master, then unpack the custom (and undocumented) binary. Examples of 
-    unpacking the binary are seen in the unpackXXX() functions.
+    from the master, then unpack the binary: a fixed size status and stats, then
+    the hits packed as described in p7_tophits_Pack(). Examples of unpacking the
+    binary are seen in the unpackXXX() functions.
     
 EOF
 
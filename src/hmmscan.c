@@ -25,40 +25,77 @@
 
 #ifdef HMMER_THREADS
 #include <unistd.h>
+#include <pthread.h>
 #include "esl_threads.h"
 #include "esl_workqueue.h"
 #endif /*HMMER_THREADS*/
 
 #include "hmmer.h"
+#include "p7_hmmcache.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif /*HMMER_THREADS*/
-  ESL_SQ           *qsq;
   P7_BG            *bg;	         /* null model                              */
-  P7_PIPELINE      *pli;         /* work pipeline                           */
-  P7_TOPHITS       *th;          /* top hit results                         */
+  int               cached_models; /* TRUE if models belong to a P7_HMMCACHE: don't free them */
+
+  /* the query's sequences, scanned together model by model */
+  int               nbatch;      /* # of queries in batch (1 without --qbatch)  */
+  ESL_SQ          **bsq;         /* batch queries [0..nbatch-1], input order    */
+  int              *border;      /* order to scan them in: by length            */
+  P7_PIPELINE     **bpli;        /* pipeline for each batch query               */
+  P7_TOPHITS      **bth;         /* hit list for each batch query               */
 } WORKER_INFO;
 
+/* One query sequence (or, with --qbatch, one batch of them), from
+ * setup until its results are output. Worker <i> searches with its
+ * own info[i]. The worker threads persist across queries: while the
+ * last blocks of one query are still being searched, the next
+ * query's blocks are already being queued, so two queries may be in
+ * flight at once.
+ */
+typedef struct {
+  ESL_SQ          **sq;          /* query sequences [0..nq-1], input order   */
+  int              *order;       /* order to scan them in: by length         */
+  int               nq;          /* # of queries in <sq>                     */
+  int               maxq;        /* allocated size of <sq>                   */
+  int               idx;         /* index of sq[0] in <seqfile>, 1..nquery   */
+  P7_HMMFILE       *hfp;         /* this query's open <hmmdb>; NULL w/ --cache */
+  WORKER_INFO      *info;        /* per-worker search state, [0..ninfo-1]    */
+  int               ninfo;
+  ESL_STOPWATCH    *w;           /* timing from setup to output              */
+#ifdef HMMER_THREADS
+  int               nleft;       /* # of blocks queued and not yet searched  */
+  int               queued_all;  /* TRUE once all the query's blocks are queued */
+  pthread_mutex_t   mutex;       /* protects <nleft>, <queued_all>           */
+  pthread_cond_t    done;        /* signaled when the last block is searched */
+#endif /*HMMER_THREADS*/
+} QUERY_INFO;
+
+#ifdef HMMER_THREADS
+/* A unit of work for the thread pool: a block of target profiles,
+ * and the query to scan them with. q == NULL tells a worker to exit.
+ */
+typedef struct {
+  P7_OM_BLOCK      *block;
+  QUERY_INFO       *q;
+} WORK_ITEM;
+#endif /*HMMER_THREADS*/
+
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
 #define DOMREPOPTS  "--domE,--domT,--cut_ga,--cut_nc,--cut_tc"
 #define INCOPTS     "--incE,--incT,--cut_ga,--cut_nc,--cut_tc"
 #define INCDOMOPTS  "--incdomE,--incdomT,--cut_ga,--cut_nc,--cut_tc"
 #define THRESHOPTS  "-E,-T,--domE,--domT,--incE,--incT,--incdomE,--incdomT,--cut_ga,--cut_nc,--cut_tc"
 
-#if defined (HMMER_THREADS) && defined (HAVE_MPI)
-#define CPUOPTS     "--mpi"
-#define MPIOPTS     "--cpu"
+#ifdef HAVE_MPI
+#define CACHEOPTS   "--mpi"
 #else
-#define CPUOPTS     NULL
-#define MPIOPTS     NULL
+#define CACHEOPTS   NULL
 #endif
 
 #ifdef HAVE_MPI
-#define DAEMONOPTS  "-o,--tblout,--domtblout,--pfamtblout,--mpi,--stall"
+#define DAEMONOPTS  "-o,--tblout,--domtblout,--pfamtblout,--binout,--mpi,--stall"
 #else
-#define DAEMONOPTS  "-o,--tblout,--domtblout,--pfamtblout"
+#define DAEMONOPTS  "-o,--tblout,--domtblout,--pfamtblout,--binout"
 #endif
 
 static ESL_OPTIONS options[] = {
@@ -69,8 +106,10 @@ static ESL_OPTIONS options[] = {
   { "--tblout",     eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save parseable table of per-sequence hits to file <f>",         2 },
   { "--domtblout",  eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save parseable table of per-domain hits to file <f>",           2 },
   { "--pfamtblout", eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save table of hits and domains to file, in Pfam format <f>",    2 },
+  { "--binout",     eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save compact binary hit records to file <f> (see hmmbin2tbl)",  2 },
   { "--acc",        eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "prefer accessions over names in output",                        2 },
   { "--noali",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "don't output alignments, so output is smaller",                 2 },
+  { "--max-hits",   eslARG_INT,    FALSE, NULL, "n>0",   NULL,  NULL,  NULL,            "keep only the <n> top-ranked targets per query (bounds memory)", 2 },
   { "--notextw",    eslARG_NONE,    NULL, NULL, NULL,    NULL,  NULL, "--textw",        "unlimit ASCII text output line width",                          2 },
   { "--textw",      eslARG_INT,    "120", NULL, "n>=120",NULL,  NULL, "--notextw",      "set max width of ASCII text output lines",                      2 },
   /* Control of reporting thresholds */
@@ -100,12 +139,14 @@ static ESL_OPTIONS options[] = {
   { "--seed",       eslARG_INT,    "42",  NULL, "n>=0",  NULL,  NULL,  NULL,            "set RNG seed to <n> (if 0: one-time arbitrary seed)",          12 },
   { "--qformat",    eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,  NULL,            "assert input <seqfile> is in format <s>: no autodetection",    12 },
   { "--daemon",     eslARG_NONE,    NULL, NULL, NULL,    NULL,  NULL,  DAEMONOPTS,      "run program as a daemon",                                      12 },
+  { "--cache",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  CACHEOPTS,       "load <hmmdb> into memory once, and scan all queries against it", 12 },
+  { "--qbatch",     eslARG_INT,    FALSE, NULL, "n>0",   NULL,"--cache","--daemon",     "with --cache: scan <n> queries at a time against each model",  12 },
 #ifdef HMMER_THREADS
-  { "--cpu",        eslARG_INT, NULL,"HMMER_NCPU","n>=0",NULL,  NULL,  CPUOPTS,         "number of parallel CPU workers to use for multithreads",       12 },
+  { "--cpu",        eslARG_INT, NULL,"HMMER_NCPU","n>=0",NULL,  NULL,  NULL,            "number of parallel CPU workers to use for multithreads",       12 },
 #endif
 #ifdef HAVE_MPI
   { "--stall",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,"--mpi", NULL,            "arrest after start: for debugging MPI under gdb",              12 },  
-  { "--mpi",        eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  MPIOPTS,         "run as an MPI parallel program",                               12 },
+  { "--mpi",        eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "run as an MPI parallel program (with --cpu: threads per worker)", 12 },
 #endif
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
@@ -123,6 +164,7 @@ struct cfg_s {
   int              do_mpi;            /* TRUE if we're doing MPI parallelization         */
   int              nproc;             /* how many MPI processes, total                   */
   int              my_rank;           /* who am I, in 0..nproc-1                         */
+  int              ncpus;             /* with --mpi: worker threads per worker process, or 0 */
 };
 
 static char usage[]  = "[-options] <hmmdb> <seqfile>";
@@ -130,10 +172,23 @@ static char banner[] = "search sequence(s) against a profile database";
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
 static int  serial_loop  (WORKER_INFO *info, P7_HMMFILE *hfp);
+static int  serial_cache_loop(WORKER_INFO *info, P7_HMMCACHE *hcache);
+static void scan_model(WORKER_INFO *info, P7_OPROFILE *om);
+static QUERY_INFO *new_query(ESL_ALPHABET *abc, int maxq, int ninfo);
+static void start_query (ESL_GETOPTS *go, struct cfg_s *cfg, QUERY_INFO *q, int nq, int idx, P7_HMMCACHE *hcache, int threaded);
+static int  output_query(ESL_GETOPTS *go, QUERY_INFO *q, FILE *ofp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, FILE *binfp, int textw);
+static void free_query  (QUERY_INFO *q);
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, P7_HMMFILE *hfp);
+static int  thread_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, QUERY_INFO *q);
+static int  thread_cache_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, P7_HMMCACHE *hcache, QUERY_INFO *q);
+static void queue_item(ESL_WORK_QUEUE *queue, WORK_ITEM **held, QUERY_INFO *q);
+static void queue_finish(QUERY_INFO *q);
+static void queue_wait(QUERY_INFO *q);
+static void thread_start(int ncpus, ESL_THREADS **ret_obj, ESL_WORK_QUEUE **ret_queue, WORK_ITEM **ret_held);
+static void thread_stop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held);
+static void thread_destroy(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held);
 static void pipeline_thread(void *arg);
 #endif /*HMMER_THREADS*/
 
@@ -222,8 +277,10 @@ output_header(FILE *ofp, ESL_GETOPTS *go, char *hmmfile, char *seqfile)
   if (esl_opt_IsUsed(go, "--tblout")    && fprintf(ofp, "# per-seq hits tabular output:     %s\n",            esl_opt_GetString(go, "--tblout"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--domtblout") && fprintf(ofp, "# per-dom hits tabular output:     %s\n",            esl_opt_GetString(go, "--domtblout")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--pfamtblout")&& fprintf(ofp, "# pfam-style tabular hit output:   %s\n",            esl_opt_GetString(go, "--pfamtblout")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--binout")    && fprintf(ofp, "# binary hit output:               %s\n",            esl_opt_GetString(go, "--binout"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--acc")       && fprintf(ofp, "# prefer accessions over names:    yes\n")                                                 < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--noali")     && fprintf(ofp, "# show alignments in output:       no\n")                                                  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--max-hits")   && fprintf(ofp, "# max hits kept per query:         %d\n",             esl_opt_GetInteger(go, "--max-hits"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--notextw")   && fprintf(ofp, "# max ASCII text line length:      unlimited\n")                                           < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--textw")     && fprintf(ofp, "# max ASCII text line length:      %d\n",            esl_opt_GetInteger(go, "--textw"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
   if (esl_opt_IsUsed(go, "-E")          && fprintf(ofp, "# profile reporting threshold:     E-value <= %g\n", esl_opt_GetReal(go, "-E"))            < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -251,6 +308,8 @@ output_header(FILE *ofp, ESL_GETOPTS *go, char *hmmfile, char *seqfile)
   }
   if (esl_opt_IsUsed(go, "--qformat")   && fprintf(ofp, "# input seqfile format asserted:   %s\n",            esl_opt_GetString(go, "--qformat"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--daemon")    && fprintf(ofp, "run as a daemon process\n")                                                                < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--cache")     && fprintf(ofp, "# profile database held in memory: yes\n")                                                 < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--qbatch")    && fprintf(ofp, "# queries scanned per batch:       %d\n",            esl_opt_GetInteger(go, "--qbatch"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #ifdef HMMER_THREADS
   if (esl_opt_IsUsed(go, "--cpu")       && fprintf(ofp, "# number of worker threads:        %d\n",            esl_opt_GetInteger(go, "--cpu"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
 #endif
@@ -278,6 +337,7 @@ main(int argc, char **argv)
   cfg.do_mpi     = FALSE;	           /* this gets reset below, if we init MPI */
   cfg.nproc      = 0;		           /* this gets reset below, if we init MPI */
   cfg.my_rank    = 0;		           /* this gets reset below, if we init MPI */
+  cfg.ncpus      = 0;		           /* this gets reset below, if --mpi with --cpu */
 
   process_commandline(argc, argv, &go, &cfg.hmmfile, &cfg.seqfile);    
 
@@ -294,7 +354,20 @@ main(int argc, char **argv)
   if (esl_opt_GetBoolean(go, "--mpi")) 
     {
       cfg.do_mpi     = TRUE;
-      MPI_Init(&argc, &argv);
+
+      /* with --cpu, each worker process scans with a pool of threads;
+       * only its main thread makes MPI calls.
+       */
+#ifdef HMMER_THREADS
+      if (esl_opt_IsOn(go, "--cpu")) cfg.ncpus = esl_opt_GetInteger(go, "--cpu");
+#endif
+      if (cfg.ncpus > 0)
+	{
+	  int provided;
+	  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	  if (provided < MPI_THREAD_FUNNELED) p7_Fail("MPI library doesn't support threads; can't use --cpu with --mpi\n");
+	}
+      else MPI_Init(&argc, &argv);
       MPI_Comm_rank(MPI_COMM_WORLD, &(cfg.my_rank));
       MPI_Comm_size(MPI_COMM_WORLD, &(cfg.nproc));
 
@@ -328,33 +401,34 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   FILE            *tblfp    = NULL;		 /* output stream for tabular per-seq (--tblout)    */
   FILE            *domtblfp = NULL;	  	 /* output stream for tabular per-seq (--domtblout) */
   FILE            *pfamtblfp= NULL;              /* output stream for pfam tabular output (--pfamtblout)    */
+  FILE            *binfp    = NULL;              /* output stream for binary hit records (--binout) */
   int              seqfmt   = eslSQFILE_UNKNOWN; /* format of seqfile                               */
   ESL_SQFILE      *sqfp     = NULL;              /* open seqfile                                    */
   P7_HMMFILE      *hfp      = NULL;		 /* open HMM database file                          */
+  P7_HMMCACHE     *hcache   = NULL;              /* resident profile database (--cache)             */
   ESL_ALPHABET    *abc      = NULL;              /* sequence alphabet                               */
   P7_OPROFILE     *om       = NULL;		 /* target profile                                  */
-  ESL_STOPWATCH   *w        = NULL;              /* timing                                          */
-  ESL_SQ          *qsq      = NULL;		 /* query sequence                                  */
+  QUERY_INFO      *q        = NULL;              /* query (or --qbatch batch) being searched        */
+  QUERY_INFO      *prev     = NULL;              /* previous one, awaiting output                   */
+  int              overlap  = FALSE;             /* TRUE to queue the next query before output      */
   int              nquery   = 0;
   int              textw;
   int              status   = eslOK;
   int              hstatus  = eslOK;
   int              sstatus  = eslOK;
-  int              i;
 
   int              ncpus    = 0;
+  int              qbatch   = (esl_opt_IsOn(go, "--qbatch") ? esl_opt_GetInteger(go, "--qbatch") : 0);
+  int              nb;
 
   int              infocnt  = 0;
-  WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  P7_OM_BLOCK     *block    = NULL;
+  WORK_ITEM       *held     = NULL;              /* the reader's empty work item                    */
   ESL_THREADS     *threadObj= NULL;
   ESL_WORK_QUEUE  *queue    = NULL;
 #endif
   char             errbuf[eslERRBUFSIZE];
 
-  w = esl_stopwatch_Create();
-
   if (esl_opt_GetBoolean(go, "--notextw")) textw = 0;
   else                                     textw = esl_opt_GetInteger(go, "--textw");
 
@@ -389,6 +463,19 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   p7_oprofile_Destroy(om);
   p7_hmmfile_Close(hfp);
+  hfp = NULL;
+
+  /* With --cache, read the whole database (MSV and rest) once, now, 
+   * instead of reopening and rereading it for every query.
+   */
+  if (esl_opt_GetBoolean(go, "--cache"))
+    {
+      status = p7_hmmcache_Open(cfg->hmmfile, &hcache, errbuf);
+      if      (status == eslENOTFOUND) p7_Fail("File existence/permissions problem in trying to open HMM file %s.\n%s\n", cfg->hmmfile, errbuf);
+      else if (status == eslEFORMAT)   p7_Fail("File format problem, trying to read HMM file %s.\n%s\n",                 cfg->hmmfile, errbuf);
+      else if (status == eslEINCOMPAT) p7_Fail("HMM file %s contains different alphabets",                              cfg->hmmfile);
+      else if (status != eslOK)        p7_Fail("Unexpected error %d in caching HMM file %s.\n%s\n",              status, cfg->hmmfile, errbuf);
+    }
 
   /* Open the query sequence database */
   status = esl_sqfile_OpenDigital(abc, cfg->seqfile, seqfmt, NULL, &sqfp);
@@ -396,13 +483,13 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   else if (status == eslEFORMAT)   p7_Fail("Sequence file %s is empty or misformatted\n",        cfg->seqfile);
   else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
   else if (status != eslOK)        p7_Fail("Unexpected error %d opening sequence file %s\n", status, cfg->seqfile);
-  qsq = esl_sq_CreateDigital(abc);
 
   /* Open the results output files */
   if (esl_opt_IsOn(go, "-o"))          { if ((ofp      = fopen(esl_opt_GetString(go, "-o"),          "w")) == NULL)  esl_fatal("Failed to open output file %s for writing\n",                 esl_opt_GetString(go, "-o")); }
   if (esl_opt_IsOn(go, "--tblout"))    { if ((tblfp    = fopen(esl_opt_GetString(go, "--tblout"),    "w")) == NULL)  esl_fatal("Failed to open tabular per-seq output file %s for writing\n", esl_opt_GetString(go, "--tblout")); }
   if (esl_opt_IsOn(go, "--domtblout")) { if ((domtblfp = fopen(esl_opt_GetString(go, "--domtblout"), "w")) == NULL)  esl_fatal("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblout")); }
   if (esl_opt_IsOn(go, "--pfamtblout")){ if ((pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)  esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
+  if (esl_opt_IsOn(go, "--binout"))    { if ((binfp    = fopen(esl_opt_GetString(go, "--binout"),    "wb")) == NULL) esl_fatal("Failed to open binary hit output file %s for writing\n", esl_opt_GetString(go, "--binout")); }
 
   output_header(ofp, go, cfg->hmmfile, cfg->seqfile);
 
@@ -411,161 +498,294 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (esl_opt_IsOn(go, "--cpu")) ncpus = esl_opt_GetInteger(go, "--cpu");
   else                           esl_threads_CPUCount(&ncpus);
 
-  if (ncpus > 0)
-    {
-      threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
-    }
+  /* The worker threads are started once, and serve all the queries */
+  if (ncpus > 0) thread_start(ncpus, &threadObj, &queue, &held);
 #endif
 
   infocnt = (ncpus == 0) ? 1 : ncpus;
-  ESL_ALLOC(info, sizeof(*info) * infocnt);
 
-  for (i = 0; i < infocnt; ++i)
+  /* A daemon's client waits for each result before sending the next
+   * query, so results can't be held back for the next query to be read.
+   * With --cache, two queries' blocks would hold the same resident
+   * profiles, and two workers would reconfigure one profile to different
+   * target lengths at once: each query must finish before the next starts.
+   */
+  overlap = (ncpus > 0 && seqfmt != eslSQFILE_DAEMON && hcache == NULL);
+
+  /* Outside loop: over each query sequence in <seqfile>; or with
+   * --qbatch, over batches of <qbatch> query sequences. The workers
+   * scan every query of a batch against a model before moving on to
+   * the next model, so each model is fetched into cache once per
+   * batch rather than once per query. Results are output per query
+   * in input order, as usual; the timing reported for each query is
+   * that of its whole batch.
+   */
+  while (sstatus == eslOK)
     {
-      info[i].bg    = p7_bg_Create(abc);
+      q = new_query(abc, (qbatch > 0 ? qbatch : 1), infocnt);
+      for (nb = 0; nb < q->maxq && (sstatus = esl_sqio_Read(sqfp, q->sq[nb])) == eslOK; nb++) ;
+      if (nb == 0) { free_query(q); q = NULL; break; }
+
+      start_query(go, cfg, q, nb, nquery+1, hcache, (ncpus > 0));
+      nquery += nb;
+
 #ifdef HMMER_THREADS
-      info[i].queue = queue;
+      if      (ncpus > 0 && hcache) hstatus = thread_cache_loop(queue, &held, hcache, q);
+      else if (ncpus > 0)           hstatus = thread_loop(queue, &held, q);
+      else if (hcache)              hstatus = serial_cache_loop(q->info, hcache);
+      else                          hstatus = serial_loop(q->info, q->hfp);
+#else
+      if (hcache) hstatus = serial_cache_loop(q->info, hcache);
+      else        hstatus = serial_loop(q->info, q->hfp);
 #endif
+      switch(hstatus)
+	{
+	case eslEFORMAT:   p7_Fail("bad file format in HMM file %s",             cfg->hmmfile);	  break;
+	case eslEINCOMPAT: p7_Fail("HMM file %s contains different alphabets",   cfg->hmmfile);	  break;
+	case eslEOF: 	  /* do nothing */                                                 	  break;
+	default: 	   p7_Fail("Unexpected error in reading HMMs from %s",   cfg->hmmfile); 
+	}
+
+      /* With worker threads, <q> is still being searched. The previous
+       * query has finished (or is finishing) meanwhile: output it now,
+       * so results come out in query order.
+       */
+      if (prev != NULL) {
+	if ((status = output_query(go, prev, ofp, tblfp, domtblfp, pfamtblfp, binfp, textw)) != eslOK) goto ERROR;
+	free_query(prev);
+	prev = NULL;
+      }
+      if (overlap) prev = q;
+      else {
+	if ((status = output_query(go, q, ofp, tblfp, domtblfp, pfamtblfp, binfp, textw)) != eslOK) goto ERROR;
+	free_query(q);
+      }
+      q = NULL;
     }
+  if (prev != NULL) {
+    if ((status = output_query(go, prev, ofp, tblfp, domtblfp, pfamtblfp, binfp, textw)) != eslOK) goto ERROR;
+    free_query(prev);
+    prev = NULL;
+  }
+  if      (sstatus == eslEFORMAT) esl_fatal("Parse failed (sequence file %s):\n%s\n",
+					    sqfp->filename, esl_sqfile_GetErrorBuf(sqfp));
+  else if (sstatus != eslEOF)     esl_fatal("Unexpected error %d reading sequence file %s",
+					    sstatus, sqfp->filename);
+
+  /* Terminate outputs - any last words?
+   */
+  if (tblfp)    p7_tophits_TabularTail(tblfp,    "hmmscan", p7_SCAN_MODELS, cfg->seqfile, cfg->hmmfile, go);
+  if (domtblfp) p7_tophits_TabularTail(domtblfp, "hmmscan", p7_SCAN_MODELS, cfg->seqfile, cfg->hmmfile, go);
+  if (pfamtblfp)p7_tophits_TabularTail(pfamtblfp,"hmmscan", p7_SEARCH_SEQS, cfg->seqfile, cfg->hmmfile, go);
+  if (ofp)      { if (fprintf(ofp, "[ok]\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
 
+  /* Cleanup - prepare for successful exit
+   */
 #ifdef HMMER_THREADS
-  for (i = 0; i < ncpus * 2; ++i)
-    {
-      block = p7_oprofile_CreateBlock(BLOCK_SIZE);
-      if (block == NULL)    esl_fatal("Failed to allocate sequence block");
+  if (threadObj != NULL) thread_destroy(threadObj, queue, held);
+#endif
 
-      status = esl_workqueue_Init(queue, block);
-      if (status != eslOK)  esl_fatal("Failed to add block to work queue");
+  p7_hmmcache_Close(hcache);
+  esl_alphabet_Destroy(abc);
+  esl_sqfile_Close(sqfp);
+
+  if (ofp != stdout) fclose(ofp);
+  if (tblfp)         fclose(tblfp);
+  if (domtblfp)      fclose(domtblfp);
+  if (pfamtblfp)     fclose(pfamtblfp);
+  if (binfp)         fclose(binfp);
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* new_query()
+ * Allocate a query of up to <maxq> sequences in alphabet <abc>,
+ * with search state for <ninfo> workers. Errors are fatal.
+ */
+static QUERY_INFO *
+new_query(ESL_ALPHABET *abc, int maxq, int ninfo)
+{
+  QUERY_INFO *q = NULL;
+  int         i;
+  int         status;
+
+  ESL_ALLOC(q, sizeof(QUERY_INFO));
+  q->maxq  = maxq;
+  q->nq    = 0;
+  q->idx   = 0;
+  q->hfp   = NULL;
+  q->ninfo = ninfo;
+  q->w     = esl_stopwatch_Create();
+  ESL_ALLOC(q->sq,    sizeof(ESL_SQ *) * maxq);
+  ESL_ALLOC(q->order, sizeof(int)      * maxq);
+  ESL_ALLOC(q->info,  sizeof(WORKER_INFO) * ninfo);
+  for (i = 0; i < maxq; i++) q->sq[i] = esl_sq_CreateDigital(abc);
+
+  for (i = 0; i < ninfo; ++i)
+    {
+      q->info[i].bg            = p7_bg_Create(abc);
+      q->info[i].cached_models = FALSE;
+      q->info[i].nbatch        = 0;
+      q->info[i].bsq           = q->sq;
+      q->info[i].border        = q->order;
+      ESL_ALLOC(q->info[i].bpli, sizeof(P7_PIPELINE *) * maxq);
+      ESL_ALLOC(q->info[i].bth,  sizeof(P7_TOPHITS *)  * maxq);
     }
+
+#ifdef HMMER_THREADS
+  q->nleft      = 0;
+  q->queued_all = FALSE;
+  if (pthread_mutex_init(&q->mutex, NULL) != 0) esl_fatal("mutex init failed");
+  if (pthread_cond_init (&q->done,  NULL) != 0) esl_fatal("cond init failed");
 #endif
+  return q;
 
-  /* Outside loop: over each query sequence in <seqfile>. */
-  while ((sstatus = esl_sqio_Read(sqfp, qsq)) == eslOK)
-    {
-      nquery++;
-      esl_stopwatch_Start(w);	                          
+ ERROR:
+  esl_fatal("allocation failed");
+  return NULL;
+}
 
-      /* Open the target profile database */
-      status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, NULL);
+/* start_query()
+ * Set up the search of the first <nq> sequences read into <q>,
+ * the first of which is query <idx> in <seqfile>: open the target
+ * profile database, unless it's resident in <hcache>, and create
+ * a pipeline and hit list per query per worker. If <threaded>,
+ * the open database is locked, because workers share it for the
+ * second stage of two-stage input. Errors are fatal.
+ */
+static void
+start_query(ESL_GETOPTS *go, struct cfg_s *cfg, QUERY_INFO *q, int nq, int idx, P7_HMMCACHE *hcache, int threaded)
+{
+  int i, k, r;
+  int status;
+
+  esl_stopwatch_Start(q->w);
+  q->nq  = nq;
+  q->idx = idx;
+
+  /* Open the target profile database, unless it's resident */
+  if (hcache == NULL)
+    {
+      status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &(q->hfp), NULL);
       if (status != eslOK)        p7_Fail("Unexpected error %d in opening hmm file %s.\n",           status, cfg->hmmfile);  
   
 #ifdef HMMER_THREADS
       /* if we are threaded, create a lock to prevent multiple readers */
-      if (ncpus > 0)
+      if (threaded)
 	{
-	  status = p7_hmmfile_CreateLock(hfp);
+	  status = p7_hmmfile_CreateLock(q->hfp);
 	  if (status != eslOK) p7_Fail("Unexpected error %d creating lock\n", status);
 	}
 #endif
+    }
 
-      if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->acc[0]  != 0 && fprintf(ofp, "Accession:   %s\n", qsq->acc)     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->desc[0] != 0 && fprintf(ofp, "Description: %s\n", qsq->desc)    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  /* scan in order of length, so consecutive queries often leave a model's length config unchanged */
+  for (k = 0; k < nq; k++)
+    {
+      for (r = k; r > 0 && q->sq[q->order[r-1]]->n > q->sq[k]->n; r--) q->order[r] = q->order[r-1];
+      q->order[r] = k;
+    }
 
-      for (i = 0; i < infocnt; ++i)
+  for (i = 0; i < q->ninfo; ++i)
+    {
+      for (k = 0; k < nq; k++)
 	{
 	  /* Create processing pipeline and hit list */
-	  info[i].th  = p7_tophits_Create(); 
-	  info[i].pli = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
-	  info[i].pli->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
+	  q->info[i].bth[k]  = p7_tophits_Create();
+	  if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(q->info[i].bth[k], esl_opt_GetInteger(go, "--max-hits"));
+	  q->info[i].bpli[k] = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
+	  if (esl_opt_GetBoolean(go, "--noali")) q->info[i].bpli[k]->ddef->do_alidisplay = FALSE;
+	  q->info[i].bpli[k]->hfp = q->hfp;  /* for two-stage input, pipeline needs <hfp>; NULL if models are resident and complete */
+	  p7_pli_NewSeq(q->info[i].bpli[k], q->sq[k]);
+	}
+      q->info[i].nbatch        = nq;
+      q->info[i].cached_models = (hcache != NULL);
+    }
+}
 
-	  p7_pli_NewSeq(info[i].pli, qsq);
-	  info[i].qsq = qsq;
+/* output_query()
+ * Wait for the search of <q> to finish, merge its workers' results,
+ * and output them, one query sequence at a time in input order.
+ */
+static int
+output_query(ESL_GETOPTS *go, QUERY_INFO *q, FILE *ofp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, FILE *binfp, int textw)
+{
+  WORKER_INFO *info = q->info;
+  ESL_SQ      *qsq;
+  int          i, k;
 
 #ifdef HMMER_THREADS
-	  if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
+  queue_wait(q);
 #endif
-	}
+  esl_stopwatch_Stop(q->w);
 
-#ifdef HMMER_THREADS
-      if (ncpus > 0)  hstatus = thread_loop(threadObj, queue, hfp);
-      else	      hstatus = serial_loop(info, hfp);
-#else
-      hstatus = serial_loop(info, hfp);
-#endif
-      switch(hstatus)
-	{
-	case eslEFORMAT:   p7_Fail("bad file format in HMM file %s",             cfg->hmmfile);	  break;
-	case eslEINCOMPAT: p7_Fail("HMM file %s contains different alphabets",   cfg->hmmfile);	  break;
-	case eslEOF: 	  /* do nothing */                                                 	  break;
-	default: 	   p7_Fail("Unexpected error in reading HMMs from %s",   cfg->hmmfile); 
-	}
+  for (k = 0; k < q->nq; k++)
+    {
+      qsq = q->sq[k];
 
       /* merge the results of the search results */
-      for (i = 1; i < infocnt; ++i)
+      for (i = 1; i < q->ninfo; ++i)
 	{
-	  p7_tophits_Merge(info[0].th, info[i].th);
-	  p7_pipeline_Merge(info[0].pli, info[i].pli);
-
-	  p7_pipeline_Destroy(info[i].pli);
-	  p7_tophits_Destroy(info[i].th);
+	  p7_tophits_Merge(info[0].bth[k], info[i].bth[k]);
+	  p7_pipeline_Merge(info[0].bpli[k], info[i].bpli[k]);
 	}
 
+      if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      if (qsq->acc[0]  != 0 && fprintf(ofp, "Accession:   %s\n", qsq->acc)     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      if (qsq->desc[0] != 0 && fprintf(ofp, "Description: %s\n", qsq->desc)    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+
       /* Print results */
-      p7_tophits_SortBySortkey(info->th);
-      p7_tophits_Threshold(info->th, info->pli);
+      p7_tophits_SortBySortkey(info->bth[k]);
+      p7_tophits_Threshold(info->bth[k], info->bpli[k]);
 
-      p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      p7_tophits_Targets(ofp, info->bth[k], info->bpli[k], textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      p7_tophits_Domains(ofp, info->bth[k], info->bpli[k], textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 
-      if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->th, info->pli);
+      if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->bth[k], info->bpli[k], (q->idx+k == 1));
+      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->bth[k], info->bpli[k], (q->idx+k == 1));
+      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->bth[k], info->bpli[k]);
+      if (binfp)     p7_tophits_Binary(binfp, qsq->name, qsq->acc, info->bth[k], info->bpli[k]);
 
-      esl_stopwatch_Stop(w);
-      p7_pli_Statistics(ofp, info->pli, w);
+      p7_pli_Statistics(ofp, info->bpli[k], q->w);
       if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
       fflush(ofp);
-
-      p7_hmmfile_Close(hfp);
-      p7_pipeline_Destroy(info->pli);
-      p7_tophits_Destroy(info->th);
-      esl_sq_Reuse(qsq);
     }
-  if      (sstatus == eslEFORMAT) esl_fatal("Parse failed (sequence file %s):\n%s\n",
-					    sqfp->filename, esl_sqfile_GetErrorBuf(sqfp));
-  else if (sstatus != eslEOF)     esl_fatal("Unexpected error %d reading sequence file %s",
-					    sstatus, sqfp->filename);
-
-  /* Terminate outputs - any last words?
-   */
-  if (tblfp)    p7_tophits_TabularTail(tblfp,    "hmmscan", p7_SCAN_MODELS, cfg->seqfile, cfg->hmmfile, go);
-  if (domtblfp) p7_tophits_TabularTail(domtblfp, "hmmscan", p7_SCAN_MODELS, cfg->seqfile, cfg->hmmfile, go);
-  if (pfamtblfp)p7_tophits_TabularTail(pfamtblfp,"hmmscan", p7_SEARCH_SEQS, cfg->seqfile, cfg->hmmfile, go);
-  if (ofp)      { if (fprintf(ofp, "[ok]\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+  return eslOK;
+}
 
-  /* Cleanup - prepare for successful exit
-   */
-  for (i = 0; i < infocnt; ++i)
-    p7_bg_Destroy(info[i].bg);
+/* free_query()
+ * Free a query, once its results are output.
+ */
+static void
+free_query(QUERY_INFO *q)
+{
+  int i, k;
 
-#ifdef HMMER_THREADS
-  if (ncpus > 0)
+  if (q == NULL) return;
+  for (i = 0; i < q->ninfo; ++i)
     {
-      esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	p7_oprofile_DestroyBlock(block);
-      esl_workqueue_Destroy(queue);
-      esl_threads_Destroy(threadObj);
+      for (k = 0; k < q->info[i].nbatch; k++)
+	{
+	  p7_pipeline_Destroy(q->info[i].bpli[k]);
+	  p7_tophits_Destroy(q->info[i].bth[k]);
+	}
+      free(q->info[i].bpli);
+      free(q->info[i].bth);
+      p7_bg_Destroy(q->info[i].bg);
     }
+#ifdef HMMER_THREADS
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->done);
 #endif
-
-  free(info);
-
-  esl_sq_Destroy(qsq);
-  esl_stopwatch_Destroy(w);
-  esl_alphabet_Destroy(abc);
-  esl_sqfile_Close(sqfp);
-
-  if (ofp != stdout) fclose(ofp);
-  if (tblfp)         fclose(tblfp);
-  if (domtblfp)      fclose(domtblfp);
-  if (pfamtblfp)     fclose(pfamtblfp);
-  return eslOK;
-
- ERROR:
-  return status;
+  for (k = 0; k < q->maxq; k++) esl_sq_Destroy(q->sq[k]);
+  if (q->hfp) p7_hmmfile_Close(q->hfp);
+  esl_stopwatch_Destroy(q->w);
+  free(q->sq);
+  free(q->order);
+  free(q->info);
+  free(q);
 }
 
 #ifdef HAVE_MPI
@@ -644,8 +864,9 @@ typedef struct {
  * of the block.  These blocks are passed as work units to the
  * MPI workers.  If multiple hmm's are in the query file, the
  * blocks are reused without parsing the database a second time.
+ * Blocks stop growing once they reach <max_length> bytes.
  */
-int next_block(P7_HMMFILE *hfp, BLOCK_LIST *list, MSV_BLOCK *block)
+int next_block(P7_HMMFILE *hfp, BLOCK_LIST *list, MSV_BLOCK *block, uint64_t max_length)
 {
   P7_OPROFILE   *om       = NULL;
   ESL_ALPHABET  *abc      = NULL;
@@ -680,7 +901,7 @@ int next_block(P7_HMMFILE *hfp, BLOCK_LIST *list, MSV_BLOCK *block)
   block->length = 0;
   block->count = 0;
 
-  while (block->length < MAX_BLOCK_SIZE && (status = p7_oprofile_ReadInfoMSV(hfp, &abc, &om)) == eslOK)
+  while (block->length < max_length && (status = p7_oprofile_ReadInfoMSV(hfp, &abc, &om)) == eslOK)
     {
       if (block->count == 0) block->offset = om->roff;
       block->length = om->eoff - block->offset + 1;
@@ -740,6 +961,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   FILE            *tblfp    = NULL;		 /* output stream for tabular per-seq (--tblout)    */
   FILE            *domtblfp = NULL;	  	 /* output stream for tabular per-seq (--domtblout) */
   FILE            *pfamtblfp= NULL;              /* output stream for pfam-style tabular output  (--pfamtblout) */
+  FILE            *binfp    = NULL;              /* output stream for binary hit records (--binout) */
   int              seqfmt   = eslSQFILE_UNKNOWN; /* format of seqfile                               */
   P7_BG           *bg       = NULL;	         /* null model                                      */
   ESL_SQFILE      *sqfp     = NULL;              /* open seqfile                                    */
@@ -759,6 +981,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   int              mpi_size = 0;                 /* size of the allocated buffer */
   BLOCK_LIST      *list     = NULL;
   MSV_BLOCK        block;
+  uint64_t         max_length;                   /* bytes of MSV profile file per block            */
 
   int              i;
   int              size;
@@ -767,6 +990,9 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   w = esl_stopwatch_Create();
 
+  /* workers with threads get a block per thread at a time */
+  max_length = (uint64_t) MAX_BLOCK_SIZE * ESL_MAX(1, cfg->ncpus);
+
   if (esl_opt_GetBoolean(go, "--notextw")) textw = 0;
   else                                     textw = esl_opt_GetInteger(go, "--textw");
 
@@ -807,6 +1033,8 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
     mpi_failure("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblfp"));
   if (esl_opt_IsOn(go, "--pfamtblout") && (pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)
     mpi_failure("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout"));
+  if (esl_opt_IsOn(go, "--binout") && (binfp = fopen(esl_opt_GetString(go, "--binout"), "wb")) == NULL)
+    mpi_failure("Failed to open binary hit output file %s for writing\n", esl_opt_GetString(go, "--binout"));
  
   ESL_ALLOC(list, sizeof(MSV_BLOCK));
   list->complete = 0;
@@ -842,13 +1070,15 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
       /* Create processing pipeline and hit list */
       th  = p7_tophits_Create(); 
+      if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(th, esl_opt_GetInteger(go, "--max-hits"));
       pli = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
+      if (esl_opt_GetBoolean(go, "--noali")) pli->ddef->do_alidisplay = FALSE;
       pli->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
 
       p7_pli_NewSeq(pli, qsq);
 
       /* Main loop: */
-      while ((hstatus = next_block(hfp, list, &block)) == eslOK)
+      while ((hstatus = next_block(hfp, list, &block, max_length)) == eslOK)
 	{
 	  if (MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &mpistatus) != 0) 
 	    mpi_failure("MPI error %d receiving message from %d\n", mpistatus.MPI_SOURCE);
@@ -889,7 +1119,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       block.length = 0;
       block.count  = 0;
 
-      /* wait for all workers to finish up their work blocks */
+      /* collect each worker's request for another block */
       for (i = 1; i < cfg->nproc; ++i)
 	{
 	  if (MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &mpistatus) != 0) 
@@ -943,6 +1173,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, th, pli, (nquery == 1));
       if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, th, pli, (nquery == 1));
       if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp,   qsq->name, qsq->acc, th, pli);
+      if (binfp)     p7_tophits_Binary(binfp, qsq->name, qsq->acc, th, pli);
 
       esl_stopwatch_Stop(w);
       p7_pli_Statistics(ofp, pli, w);
@@ -1002,6 +1233,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (tblfp)         fclose(tblfp);
   if (domtblfp)      fclose(domtblfp);
   if (pfamtblfp)     fclose(pfamtblfp);
+  if (binfp)         fclose(binfp);
 
   return eslOK;
 
@@ -1009,6 +1241,49 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return status;
 }
 
+#ifdef HMMER_THREADS
+/* mpi_queue_block()
+ * Read the MSV parts of the target profiles of <block> from <q->hfp>,
+ * already positioned at its start, and queue them to the worker
+ * threads as blocks of query <q>, checking the block is the one the
+ * master parsed. The threads read the rest of each profile they
+ * need themselves.
+ */
+static void
+mpi_queue_block(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_ALPHABET *abc, MSV_BLOCK *block, QUERY_INFO *q, char *hmmfile)
+{
+  P7_OM_BLOCK  *omb;
+  uint64_t      length  = 0;
+  uint64_t      count   = block->count;
+  int           hstatus = eslOK;
+
+  while (count > 0 && hstatus == eslOK)
+    {
+      omb = (*held)->block;
+      for (omb->count = 0; omb->count < omb->listSize && count > 0; omb->count++, count--)
+	if ((hstatus = p7_oprofile_ReadMSV(q->hfp, &abc, &(omb->list[omb->count]))) != eslOK) break;
+      if (omb->count == 0) break;
+
+      length = omb->list[omb->count-1]->eoff - block->offset + 1;
+      queue_item(queue, held, q);
+    }
+
+  /* lets do a little bit of sanity checking here to make sure the blocks are the same */
+  if (count > 0)
+    {
+      switch(hstatus)
+	{
+	case eslEFORMAT:   mpi_failure("bad file format in HMM file %s",           hmmfile);                                   break;
+	case eslEINCOMPAT: mpi_failure("HMM file %s contains different alphabets", hmmfile);                                   break;
+	case eslOK:
+	case eslEOF:       mpi_failure("Block count mismatch - expected %ld found %ld at offset %ld\n", block->count, block->count-count, block->offset); break;
+	default:           mpi_failure("Unexpected error %d in reading HMMs from %s", hstatus, hmmfile);
+	}
+    }
+  if (block->length != length)
+    mpi_failure("Block length mismatch - expected %ld found %ld at offset %ld\n", block->length, length, block->offset);
+}
+#endif /*HMMER_THREADS*/
 
 static int
 mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
@@ -1030,6 +1305,12 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   MPI_Status       mpistatus;
   char             errbuf[eslERRBUFSIZE];
+#ifdef HMMER_THREADS
+  WORK_ITEM       *held     = NULL;              /* the reader's empty work item                    */
+  ESL_THREADS     *threadObj= NULL;
+  ESL_WORK_QUEUE  *queue    = NULL;
+  int              i;
+#endif
 
   w = esl_stopwatch_Create();
 
@@ -1057,12 +1338,18 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   qsq = esl_sq_CreateDigital(abc);
   bg = p7_bg_Create(abc);
+#ifdef HMMER_THREADS
+  if (cfg->ncpus > 0) thread_start(cfg->ncpus, &threadObj, &queue, &held);
+#endif
 
   /* Outside loop: over each query sequence in <seqfile>. */
   while ((sstatus = esl_sqio_Read(sqfp, qsq)) == eslOK)
     {
       P7_PIPELINE     *pli     = NULL;		/* processing pipeline                      */
       P7_TOPHITS      *th      = NULL;        	/* top-scoring sequence hits                */
+#ifdef HMMER_THREADS
+      QUERY_INFO      *q       = NULL;          /* with --cpu: the query, as the threads see it */
+#endif
 
       MSV_BLOCK        block;
 
@@ -1071,84 +1358,132 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
       status = 0;
       MPI_Send(&status, 1, MPI_INT, 0, HMMER_READY_TAG, MPI_COMM_WORLD);
 
-      /* Open the target profile database */
-      status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, NULL);
-      if (status != eslOK) mpi_failure("Unexpected error %d in opening hmm file %s.\n", status, cfg->hmmfile);  
+#ifdef HMMER_THREADS
+      if (threadObj != NULL)
+	{
+	  q = new_query(abc, 1, cfg->ncpus);
+	  esl_sq_Copy(qsq, q->sq[0]);
+	  start_query(go, cfg, q, 1, 1, NULL, TRUE);  /* opens and locks its own <hfp> */
+	}
+      else
+#endif
+	{
+	  /* Open the target profile database */
+	  status = p7_hmmfile_OpenE(cfg->hmmfile, p7_HMMDBENV, &hfp, NULL);
+	  if (status != eslOK) mpi_failure("Unexpected error %d in opening hmm file %s.\n", status, cfg->hmmfile);  
   
-      /* Create processing pipeline and hit list */
-      th  = p7_tophits_Create(); 
-      pli = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
-      pli->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
+	  /* Create processing pipeline and hit list */
+	  th  = p7_tophits_Create(); 
+	  if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(th, esl_opt_GetInteger(go, "--max-hits"));
+	  pli = p7_pipeline_Create(go, 100, 100, FALSE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
+	  if (esl_opt_GetBoolean(go, "--noali")) pli->ddef->do_alidisplay = FALSE;
+	  pli->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
 
-      p7_pli_NewSeq(pli, qsq);
+	  p7_pli_NewSeq(pli, qsq);
+	}
 
       /* receive a sequence block from the master */
       MPI_Recv(&block, 3, MPI_LONG_LONG_INT, 0, HMMER_BLOCK_TAG, MPI_COMM_WORLD, &mpistatus);
       while (block.count > 0)
 	{
-	  uint64_t length = 0;
-	  uint64_t count  = block.count;
+	  /* ask for the next block right away, so it's already here
+	   * when we finish this one
+	   */
+	  status = 0;
+	  MPI_Send(&status, 1, MPI_INT, 0, HMMER_READY_TAG, MPI_COMM_WORLD);
 
-	  hstatus = p7_oprofile_Position(hfp, block.offset);
-	  if (hstatus != eslOK) mpi_failure("Cannot position optimized model to %ld\n", block.offset);
+#ifdef HMMER_THREADS
+	  if (q != NULL)
+	    {
+	      hstatus = p7_oprofile_Position(q->hfp, block.offset);
+	      if (hstatus != eslOK) mpi_failure("Cannot position optimized model to %ld\n", block.offset);
 
-	  while (count > 0 && (hstatus = p7_oprofile_ReadMSV(hfp, &abc, &om)) == eslOK)
+	      mpi_queue_block(queue, &held, abc, &block, q, cfg->hmmfile);
+	    }
+	  else
+#endif
 	    {
-	      length = om->eoff - block.offset + 1;
+	      uint64_t length = 0;
+	      uint64_t count  = block.count;
+
+	      hstatus = p7_oprofile_Position(hfp, block.offset);
+	      if (hstatus != eslOK) mpi_failure("Cannot position optimized model to %ld\n", block.offset);
 
-	      p7_pli_NewModel(pli, om, bg);
-	      p7_bg_SetLength(bg, qsq->n);
-	      p7_oprofile_ReconfigLength(om, qsq->n);
+	      while (count > 0 && (hstatus = p7_oprofile_ReadMSV(hfp, &abc, &om)) == eslOK)
+		{
+		  length = om->eoff - block.offset + 1;
+
+		  p7_pli_NewModel(pli, om, bg);
+		  p7_bg_SetLength(bg, qsq->n);
+		  p7_oprofile_ReconfigLength(om, qsq->n);
 	      
-	      p7_Pipeline(pli, om, bg, qsq, NULL, th);
+		  p7_Pipeline(pli, om, bg, qsq, NULL, th);
 	      
-	      p7_oprofile_Destroy(om);
-	      p7_pipeline_Reuse(pli);
+		  p7_oprofile_Destroy(om);
+		  p7_pipeline_Reuse(pli);
 
-	      --count;
-	    }
+		  --count;
+		}
 
-	  /* check the status of reading the hmm */
+	      /* check the status of reading the hmm */
 
-	  /* lets do a little bit of sanity checking here to make sure the blocks are the same */
-	  if (count > 0)              
-	    {
-	      switch(hstatus)
+	      /* lets do a little bit of sanity checking here to make sure the blocks are the same */
+	      if (count > 0)              
 		{
-		case eslEFORMAT:
-		  mpi_failure("bad file format in HMM file %s",              cfg->hmmfile);
-		  break;
-		case eslEINCOMPAT:
-		  mpi_failure("HMM file %s contains different alphabets",    cfg->hmmfile);
-		  break;
-		case eslOK:
-		case eslEOF:
-		  mpi_failure("Block count mismatch - expected %ld found %ld at offset %ld\n", block.count, block.count-count, block.offset);
-		  break;
-		default:
-		  mpi_failure("Unexpected error %d in reading HMMs from %s", hstatus, cfg->hmmfile); 
+		  switch(hstatus)
+		    {
+		    case eslEFORMAT:
+		      mpi_failure("bad file format in HMM file %s",              cfg->hmmfile);
+		      break;
+		    case eslEINCOMPAT:
+		      mpi_failure("HMM file %s contains different alphabets",    cfg->hmmfile);
+		      break;
+		    case eslOK:
+		    case eslEOF:
+		      mpi_failure("Block count mismatch - expected %ld found %ld at offset %ld\n", block.count, block.count-count, block.offset);
+		      break;
+		    default:
+		      mpi_failure("Unexpected error %d in reading HMMs from %s", hstatus, cfg->hmmfile); 
+		    }
 		}
+	      if (block.length != length) 
+		mpi_failure("Block length mismatch - expected %ld found %ld at offset %ld\n", block.length, length, block.offset);
 	    }
-	  if (block.length != length) 
-	    mpi_failure("Block length mismatch - expected %ld found %ld at offset %ld\n", block.length, length, block.offset);
-
-	  /* inform the master we need another block of sequences */
-	  status = 0;
-	  MPI_Send(&status, 1, MPI_INT, 0, HMMER_READY_TAG, MPI_COMM_WORLD);
 
 	  /* wait for the next block of sequences */
 	  MPI_Recv(&block, 3, MPI_LONG_LONG_INT, 0, HMMER_BLOCK_TAG, MPI_COMM_WORLD, &mpistatus);
 	}
 
+#ifdef HMMER_THREADS
+      if (q != NULL)
+	{
+	  queue_finish(q);
+	  queue_wait(q);
+	  for (i = 1; i < q->ninfo; ++i)
+	    {
+	      p7_tophits_Merge(q->info[0].bth[0], q->info[i].bth[0]);
+	      p7_pipeline_Merge(q->info[0].bpli[0], q->info[i].bpli[0]);
+	    }
+	  th  = q->info[0].bth[0];
+	  pli = q->info[0].bpli[0];
+	}
+#endif
+
       esl_stopwatch_Stop(w);
 
       /* Send the top hits back to the master. */
       p7_tophits_MPISend(th, 0, HMMER_TOPHITS_TAG, MPI_COMM_WORLD,  &mpi_buf, &mpi_size);
       p7_pipeline_MPISend(pli, 0, HMMER_PIPELINE_TAG, MPI_COMM_WORLD,  &mpi_buf, &mpi_size);
 
-      p7_hmmfile_Close(hfp);
-      p7_pipeline_Destroy(pli);
-      p7_tophits_Destroy(th);
+#ifdef HMMER_THREADS
+      if (q != NULL) free_query(q);   /* closes its <hfp> too */
+      else
+#endif
+	{
+	  p7_hmmfile_Close(hfp);
+	  p7_pipeline_Destroy(pli);
+	  p7_tophits_Destroy(th);
+	}
       esl_sq_Reuse(qsq);
     } /* end outer loop over query HMMs */
   if (sstatus == eslEFORMAT) 
@@ -1159,6 +1494,9 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
   status = 0;
   MPI_Send(&status, 1, MPI_INT, 0, HMMER_TERMINATING_TAG, MPI_COMM_WORLD);
 
+#ifdef HMMER_THREADS
+  if (threadObj != NULL) thread_destroy(threadObj, queue, held);
+#endif
   if (mpi_buf != NULL) free(mpi_buf);
 
   p7_bg_Destroy(bg);
@@ -1183,14 +1521,8 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
   /* Main loop: */
   while ((status = p7_oprofile_ReadMSV(hfp, &abc, &om)) == eslOK)
     {
-      p7_pli_NewModel(info->pli, om, info->bg);
-      p7_bg_SetLength(info->bg, info->qsq->n);
-      p7_oprofile_ReconfigLength(om, info->qsq->n);
-
-      p7_Pipeline(info->pli, om, info->bg, info->qsq, NULL, info->th);
-
+      scan_model(info, om);
       p7_oprofile_Destroy(om);
-      p7_pipeline_Reuse(info->pli);
     }
 
   esl_alphabet_Destroy(abc);
@@ -1198,53 +1530,223 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
   return status;
 }
 
+/* serial_cache_loop()
+ * Same as serial_loop(), over the resident profiles of <hcache>.
+ * The profiles are complete (no ReadRest needed) and belong to
+ * the cache, so they aren't freed here.
+ */
+static int
+serial_cache_loop(WORKER_INFO *info, P7_HMMCACHE *hcache)
+{
+  P7_OPROFILE   *om;
+  uint32_t       i;
+
+  for (i = 0; i < hcache->n; i++)
+    {
+      om = hcache->list[i];
+      scan_model(info, om);
+    }
+  return eslEOF;
+}
+
+/* scan_model()
+ * Run the pipeline on one model <om> against each query of the
+ * worker's batch in turn, while <om> is hot in cache. Without
+ * --qbatch, the batch is a single query.
+ */
+static void
+scan_model(WORKER_INFO *info, P7_OPROFILE *om)
+{
+  ESL_SQ *sq;
+  int     q;
+
+  for (q = 0; q < info->nbatch; q++)
+    {
+      sq = info->bsq[info->border[q]];
+
+      p7_pli_NewModel(info->bpli[info->border[q]], om, info->bg);
+      p7_bg_SetLength(info->bg, sq->n);
+      if (q == 0 || sq->n != info->bsq[info->border[q-1]]->n) p7_oprofile_ReconfigLength(om, sq->n);
+
+      p7_Pipeline(info->bpli[info->border[q]], om, info->bg, sq, NULL, info->bth[info->border[q]]);
+      p7_pipeline_Reuse(info->bpli[info->border[q]]);
+    }
+}
+
 #ifdef HMMER_THREADS
+/* queue_item()
+ * Hand the filled work item <*held> for query <q> to the workers,
+ * counting it as outstanding for <q>, and take back an empty one.
+ */
+static void
+queue_item(ESL_WORK_QUEUE *queue, WORK_ITEM **held, QUERY_INFO *q)
+{
+  void *newItem;
+
+  if (pthread_mutex_lock(&q->mutex)   != 0) esl_fatal("mutex lock failed");
+  q->nleft++;
+  if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+
+  (*held)->q = q;
+  if (esl_workqueue_ReaderUpdate(queue, *held, &newItem) != eslOK) esl_fatal("Work queue reader failed");
+  *held = (WORK_ITEM *) newItem;
+}
+
+/* queue_finish()
+ * Mark all of query <q>'s blocks as queued.
+ */
+static void
+queue_finish(QUERY_INFO *q)
+{
+  if (pthread_mutex_lock(&q->mutex)   != 0) esl_fatal("mutex lock failed");
+  q->queued_all = TRUE;
+  if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+}
+
+/* queue_wait()
+ * Wait for the workers to finish scanning all of query <q>'s blocks.
+ */
+static void
+queue_wait(QUERY_INFO *q)
+{
+  if (pthread_mutex_lock(&q->mutex) != 0) esl_fatal("mutex lock failed");
+  while (! q->queued_all || q->nleft > 0)
+    if (pthread_cond_wait(&q->done, &q->mutex) != 0) esl_fatal("cond wait failed");
+  if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+}
+
+/* thread_loop()
+ * Queue the blocks of target profiles read from <q->hfp> to the
+ * worker threads. Return as soon as the last block is queued,
+ * without waiting for the search to finish; queue_wait() waits
+ * for that. <*held> is the reader's empty work item, kept from one
+ * query to the next.
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, P7_HMMFILE *hfp)
+thread_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, QUERY_INFO *q)
 {
-  int  status   = eslOK;
-  int  sstatus  = eslOK;
-  int  eofCount = 0;
+  int            sstatus = eslOK;
+  ESL_ALPHABET  *abc     = NULL;
+
+  /* Main loop: */
+  while ((sstatus = p7_oprofile_ReadBlockMSV(q->hfp, &abc, (*held)->block)) == eslOK)
+    queue_item(queue, held, q);
+  queue_finish(q);
+
+  esl_alphabet_Destroy(abc);
+  return sstatus;
+}
+
+/* thread_cache_loop()
+ * Same as thread_loop(), but the blocks handed to the workers
+ * hold pointers to the resident profiles of <hcache> instead of
+ * profiles freshly read from disk; workers must not free them
+ * (see <info->cached_models>).
+ */
+static int
+thread_cache_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, P7_HMMCACHE *hcache, QUERY_INFO *q)
+{
+  uint32_t       next = 0;
   P7_OM_BLOCK   *block;
-  ESL_ALPHABET  *abc = NULL;
-  void          *newBlock;
 
-  esl_workqueue_Reset(queue);
+  /* Main loop: */
+  while (next < hcache->n)
+    {
+      block = (*held)->block;
+      for (block->count = 0; block->count < block->listSize && next < hcache->n; block->count++)
+	block->list[block->count] = hcache->list[next++];
+      queue_item(queue, held, q);
+    }
+  queue_finish(q);
+
+  return eslEOF;
+}
+
+/* thread_start()
+ * Start <ncpus> worker threads, serving a work queue of <2*ncpus>
+ * blocks of target profiles. The threads persist across queries.
+ * Returns the threads and the queue, and the reader's first empty
+ * work item in <*ret_held>. Errors are fatal.
+ */
+static void
+thread_start(int ncpus, ESL_THREADS **ret_obj, ESL_WORK_QUEUE **ret_queue, WORK_ITEM **ret_held)
+{
+  ESL_THREADS    *obj   = esl_threads_Create(&pipeline_thread);
+  ESL_WORK_QUEUE *queue = esl_workqueue_Create(ncpus * 2);
+  WORK_ITEM      *item  = NULL;
+  int             i;
+  int             status;
+
+  for (i = 0; i < ncpus * 2; ++i)
+    {
+      ESL_ALLOC(item, sizeof(WORK_ITEM));
+      item->q     = NULL;
+      item->block = p7_oprofile_CreateBlock(BLOCK_SIZE);
+      if (item->block == NULL)    esl_fatal("Failed to allocate sequence block");
+
+      status = esl_workqueue_Init(queue, item);
+      if (status != eslOK)        esl_fatal("Failed to add block to work queue");
+    }
+
+  for (i = 0; i < ncpus; ++i) esl_threads_AddThread(obj, queue);
   esl_threads_WaitForStart(obj);
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
+  status = esl_workqueue_ReaderUpdate(queue, NULL, (void **) ret_held);
   if (status != eslOK) esl_fatal("Work queue reader failed");
-      
-  /* Main loop: */
-  while (sstatus == eslOK)
+
+  *ret_obj   = obj;
+  *ret_queue = queue;
+  return;
+
+ ERROR:
+  esl_fatal("allocation failed");
+}
+
+/* thread_stop()
+ * After the last query: send each worker an empty work item, telling
+ * it to exit, and wait for them all to finish.
+ */
+static void
+thread_stop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held)
+{
+  int   nworkers = esl_threads_GetWorkerCount(obj);
+  void *newItem;
+  int   i;
+
+  for (i = 0; i < nworkers; i++)
     {
-      block = (P7_OM_BLOCK *) newBlock;
-      sstatus = p7_oprofile_ReadBlockMSV(hfp, &abc, block);
-      if (sstatus == eslEOF)
-	{
-	  if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-	  ++eofCount;
-	}
-	  
-      if (sstatus == eslOK)
-	{
-	  status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-	  if (status != eslOK) esl_fatal("Work queue reader failed");
-	}
+      held->q            = NULL;
+      held->block->count = 0;
+      if (i < nworkers-1) {
+	if (esl_workqueue_ReaderUpdate(queue, held, &newItem) != eslOK) esl_fatal("Work queue reader failed");
+	held = (WORK_ITEM *) newItem;
+      } else {
+	if (esl_workqueue_ReaderUpdate(queue, held, NULL)     != eslOK) esl_fatal("Work queue reader failed");
+      }
     }
 
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
+  esl_threads_WaitForFinish(obj);
+  esl_workqueue_Complete(queue);
+}
 
-  if (sstatus == eslEOF)
+/* thread_destroy()
+ * Stop the worker threads, if <held> says they were started, and
+ * free them, their work queue and its items.
+ */
+static void
+thread_destroy(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held)
+{
+  WORK_ITEM *item;
+
+  if (held != NULL) thread_stop(obj, queue, held);
+  esl_workqueue_Reset(queue);
+  while (esl_workqueue_Remove(queue, (void **) &item) == eslOK)
     {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
+      p7_oprofile_DestroyBlock(item->block);
+      free(item);
     }
-  
-  esl_alphabet_Destroy(abc);
-  return sstatus;
+  esl_workqueue_Destroy(queue);
+  esl_threads_Destroy(obj);
 }
 
 static void 
@@ -1253,49 +1755,53 @@ pipeline_thread(void *arg)
   int i;
   int status;
   int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
-  P7_OM_BLOCK   *block;
-  void          *newBlock;
+  WORKER_INFO    *info;
+  ESL_THREADS    *obj;
+  ESL_WORK_QUEUE *queue;
+  QUERY_INFO     *q;
+  WORK_ITEM      *item;
+  void           *newItem;
   
   impl_Init();
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
 
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  queue = (ESL_WORK_QUEUE *) esl_threads_GetData(obj, workeridx);
 
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
+  status = esl_workqueue_WorkerUpdate(queue, NULL, &newItem);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
-  /* loop until all blocks have been processed */
-  block = (P7_OM_BLOCK *) newBlock;
-  while (block->count > 0)
+  /* loop until told to exit; each block may be for a different query */
+  item = (WORK_ITEM *) newItem;
+  while (item->q != NULL)
     {
+      q    = item->q;
+      info = &(q->info[workeridx]);
+
       /* Main loop: */
-      for (i = 0; i < block->count; ++i)
+      for (i = 0; i < item->block->count; ++i)
 	{
-	  P7_OPROFILE *om = block->list[i];
-
-	  p7_pli_NewModel(info->pli, om, info->bg);
-	  p7_bg_SetLength(info->bg, info->qsq->n);
-	  p7_oprofile_ReconfigLength(om, info->qsq->n);
+	  P7_OPROFILE *om = item->block->list[i];
 
-	  p7_Pipeline(info->pli, om, info->bg, info->qsq, NULL, info->th);
+	  scan_model(info, om);
+	  if (! info->cached_models) p7_oprofile_Destroy(om);
 
-	  p7_oprofile_Destroy(om);
-	  p7_pipeline_Reuse(info->pli);
-
-	  block->list[i] = NULL;
+	  item->block->list[i] = NULL;
 	}
 
-      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
+      /* <q> may be freed as soon as its last block is counted off; don't touch it after */
+      if (pthread_mutex_lock(&q->mutex) != 0) esl_fatal("mutex lock failed");
+      if (--q->nleft == 0 && q->queued_all) pthread_cond_signal(&q->done);
+      if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+
+      status = esl_workqueue_WorkerUpdate(queue, item, &newItem);
       if (status != eslOK) esl_fatal("Work queue worker failed");
 
-      block = (P7_OM_BLOCK *) newBlock;
+      item = (WORK_ITEM *) newItem;
     }
 
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
+  status = esl_workqueue_WorkerUpdate(queue, item, NULL);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
   esl_threads_Finished(obj, workeridx);
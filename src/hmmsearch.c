@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "easel.h"
 #include "esl_alphabet.h"
@@ -27,6 +28,7 @@
 
 #ifdef HMMER_THREADS
 #include <unistd.h>
+#include <pthread.h>
 #include "esl_threads.h"
 #include "esl_workqueue.h"
 #endif /*HMMER_THREADS*/
@@ -34,29 +36,51 @@
 #include "hmmer.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif /*HMMER_THREADS*/
   P7_BG            *bg;	         /* null model                              */
   P7_PIPELINE      *pli;         /* work pipeline                           */
   P7_TOPHITS       *th;          /* top hit results                         */
   P7_OPROFILE      *om;          /* optimized query profile                 */
+  FM_CFG           *fm_cfg;      /* global data for FM-index target (--tformat hmmerdb) */
+  P7_SCOREDATA     *scoredata;   /* SSV scores for FM seed finding/extension */
 } WORKER_INFO;
 
+/* One query, from setup until its results are output. Worker <i>
+ * searches with its own info[i]. The worker threads persist across
+ * queries: while the last blocks of one query are still being
+ * searched, the next query's blocks are already being queued, so two
+ * queries may be in flight at once.
+ */
+typedef struct {
+  P7_HMM           *hmm;         /* query HMM                               */
+  int               idx;         /* index of query in <hmmfile>, 1..nquery  */
+  WORKER_INFO      *info;        /* per-worker search state, [0..ninfo-1]   */
+  int               ninfo;
+  P7_SCOREDATA     *scoredata;   /* SSV scores for FM seeds, or NULL        */
+  ESL_STOPWATCH    *w;           /* timing from setup to output             */
+#ifdef HMMER_THREADS
+  int               nleft;       /* # of blocks queued and not yet searched */
+  int               queued_all;  /* TRUE once all the query's blocks are queued */
+  pthread_mutex_t   mutex;       /* protects <nleft>, <queued_all>          */
+  pthread_cond_t    done;        /* signaled when the last block is searched */
+#endif /*HMMER_THREADS*/
+} QUERY_INFO;
+
+#ifdef HMMER_THREADS
+/* A unit of work for the thread pool: a block of target sequences,
+ * and the query to search them with. q == NULL tells a worker to exit.
+ */
+typedef struct {
+  ESL_SQ_BLOCK     *block;
+  QUERY_INFO       *q;
+} WORK_ITEM;
+#endif /*HMMER_THREADS*/
+
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
 #define DOMREPOPTS  "--domE,--domT,--cut_ga,--cut_nc,--cut_tc"
 #define INCOPTS     "--incE,--incT,--cut_ga,--cut_nc,--cut_tc"
 #define INCDOMOPTS  "--incdomE,--incdomT,--cut_ga,--cut_nc,--cut_tc"
 #define THRESHOPTS  "-E,-T,--domE,--domT,--incE,--incT,--incdomE,--incdomT,--cut_ga,--cut_nc,--cut_tc"
 
-#if defined (HMMER_THREADS) && defined (HAVE_MPI)
-#define CPUOPTS     "--mpi"
-#define MPIOPTS     "--cpu"
-#else
-#define CPUOPTS     NULL
-#define MPIOPTS     NULL
-#endif
-
 static ESL_OPTIONS options[] = {
   /* name           type      default  env  range     toggles   reqs   incomp              help                                                      docgroup*/
   { "-h",           eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "show brief help on version and usage",                         1 },
@@ -66,8 +90,10 @@ static ESL_OPTIONS options[] = {
   { "--tblout",     eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save parseable table of per-sequence hits to file <f>",        2 },
   { "--domtblout",  eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save parseable table of per-domain hits to file <f>",          2 },
   { "--pfamtblout", eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save table of hits and domains to file, in Pfam format <f>",   2 },
+  { "--binout",     eslARG_OUTFILE, NULL, NULL, NULL,    NULL,  NULL,  NULL,            "save compact binary hit records to file <f> (see hmmbin2tbl)",  2 },
   { "--acc",        eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "prefer accessions over names in output",                       2 },
   { "--noali",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "don't output alignments, so output is smaller",                2 },
+  { "--max-hits",   eslARG_INT,    FALSE, NULL, "n>0",   NULL,  NULL,  NULL,            "keep only the <n> top-ranked targets per query (bounds memory)", 2 },
   { "--notextw",    eslARG_NONE,    NULL, NULL, NULL,    NULL,  NULL, "--textw",        "unlimit ASCII text output line width",                         2 },
   { "--textw",      eslARG_INT,    "120", NULL, "n>=120",NULL,  NULL, "--notextw",      "set max width of ASCII text output lines",                     2 },
   /* Control of reporting thresholds */
@@ -91,6 +117,18 @@ static ESL_OPTIONS options[] = {
   { "--F3",         eslARG_REAL,  "1e-5", NULL, NULL,    NULL,  NULL, "--max",          "Stage 3 (Fwd) threshold: promote hits w/ P <= F3",             7 },
   { "--nobias",     eslARG_NONE,   NULL,  NULL, NULL,    NULL,  NULL, "--max",          "turn off composition bias filter",                             7 },
 
+#if defined (p7_IMPL_SSE)
+  /* Control of FM seed prefilter (only used with --tformat hmmerdb) */
+  { "--seed_max_depth",    eslARG_INT,          "15", NULL, NULL,    NULL,  NULL, NULL,          "seed length at which bit threshold must be met",             9 },
+  { "--seed_sc_thresh",    eslARG_REAL,         "15", NULL, NULL,    NULL,  NULL, NULL,          "Default req. score for FM seed (bits)",                      9 },
+  { "--seed_sc_density",   eslARG_REAL,        "0.8", NULL, NULL,    NULL,  NULL, NULL,          "seed must maintain this bit density from one of two ends",   9 },
+  { "--seed_drop_max_len", eslARG_INT,           "4", NULL, NULL,    NULL,  NULL, NULL,          "maximum run length with score under (max - [fm_drop_lim])",  9 },
+  { "--seed_drop_lim",     eslARG_REAL,        "0.3", NULL, NULL,    NULL,  NULL, NULL,          "in seed, max drop in a run of length [fm_drop_max_len]",     9 },
+  { "--seed_req_pos",      eslARG_INT,           "5", NULL, NULL,    NULL,  NULL, NULL,          "minimum number consecutive positive scores in seed" ,        9 },
+  { "--seed_consens_match", eslARG_INT,         "11", NULL, NULL,    NULL,  NULL, NULL,          "<n> consecutive matches to consensus will override score threshold" , 9 },
+  { "--seed_ssv_length",   eslARG_INT,          "70", NULL, NULL,    NULL,  NULL, NULL,          "length of window around FM seed to get full SSV diagonal",   9 },
+#endif
+
 /* Other options */
   { "--nonull2",    eslARG_NONE,   NULL,  NULL, NULL,    NULL,  NULL,  NULL,            "turn off biased composition score corrections",               12 },
   { "-Z",           eslARG_REAL,   FALSE, NULL, "x>0",   NULL,  NULL,  NULL,            "set # of comparisons done, for E-value calculation",          12 },
@@ -99,11 +137,12 @@ static ESL_OPTIONS options[] = {
   { "--tformat",    eslARG_STRING,  NULL, NULL, NULL,    NULL,  NULL,  NULL,            "assert target <seqfile> is in format <s>: no autodetection",  12 },
 
 #ifdef HMMER_THREADS 
-  { "--cpu",        eslARG_INT, NULL,"HMMER_NCPU","n>=0",NULL,  NULL,  CPUOPTS,         "number of parallel CPU workers to use for multithreads",      12 },
+  { "--cpu",        eslARG_INT, NULL,"HMMER_NCPU","n>=0",NULL,  NULL,  NULL,            "number of parallel CPU workers to use for multithreads",      12 },
+  { "--lsort",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "load targets in memory, search longest first (needs --cpu>0)", 12 },
 #endif
 #ifdef HAVE_MPI
   { "--stall",      eslARG_NONE,   FALSE, NULL, NULL,    NULL,"--mpi", NULL,            "arrest after start: for debugging MPI under gdb",             12 },  
-  { "--mpi",        eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  MPIOPTS,         "run as an MPI parallel program",                              12 },
+  { "--mpi",        eslARG_NONE,   FALSE, NULL, NULL,    NULL,  NULL,  NULL,            "run as an MPI parallel program (with --cpu: threads per worker)", 12 },
 #endif
 
   /* Restrict search to subset of database - hidden because these flags are
@@ -133,6 +172,7 @@ struct cfg_s {
   int              do_mpi;            /* TRUE if we're doing MPI parallelization         */
   int              nproc;             /* how many MPI processes, total                   */
   int              my_rank;           /* who am I, in 0..nproc-1                         */
+  int              ncpus;             /* with --mpi: worker threads per worker process, or 0 */
 
   char             *firstseq_key;     /* name of the first sequence in the restricted db range */
   int              n_targetseq;       /* number of sequences in the restricted range */
@@ -140,10 +180,24 @@ struct cfg_s {
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
 static int  serial_loop  (WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs);
+#if defined (p7_IMPL_SSE)
+static int  serial_loop_FM(WORKER_INFO *info);
+#endif
+static QUERY_INFO *new_query(ESL_GETOPTS *go, P7_HMM *hmm, int idx, int ninfo, int dbfmt, FM_CFG *fm_cfg);
+static int  output_query(ESL_GETOPTS *go, QUERY_INFO *q, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, FILE *binfp, int textw);
+static void free_query  (QUERY_INFO *q);
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs);
+static void thread_start(int ncpus, ESL_ALPHABET *abc, ESL_THREADS **ret_obj, ESL_WORK_QUEUE **ret_queue, WORK_ITEM **ret_held);
+static int  thread_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQFILE *dbfp, int n_targetseqs, QUERY_INFO *q);
+static int  read_targets(ESL_SQFILE *dbfp, ESL_ALPHABET *abc, int n_targetseqs, ESL_SQ ***ret_tsq, int *ret_ntsq);
+static void sorted_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQ **tsq, int ntsq, QUERY_INFO *q);
+static void queue_item(ESL_WORK_QUEUE *queue, WORK_ITEM **held, QUERY_INFO *q);
+static void queue_finish(QUERY_INFO *q);
+static void queue_wait(QUERY_INFO *q);
+static void thread_stop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held);
+static void thread_destroy(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held);
 static void pipeline_thread(void *arg);
 #endif /*HMMER_THREADS*/
 
@@ -186,6 +240,11 @@ process_commandline(int argc, char **argv, ESL_GETOPTS **ret_go, char **ret_hmmf
       if (puts("\nOptions controlling acceleration heuristics:")             < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed");
       esl_opt_DisplayHelp(stdout, go, 7, 2, 80); 
 
+#if defined (p7_IMPL_SSE)
+      if (puts("\nOptions controlling FM-index seed search (--tformat hmmerdb):") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed");
+      esl_opt_DisplayHelp(stdout, go, 9, 2, 80);
+#endif
+
       if (puts("\nOther expert options:")                                    < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed");
       esl_opt_DisplayHelp(stdout, go, 12, 2, 80); 
       exit(0);
@@ -227,8 +286,10 @@ output_header(FILE *ofp, const ESL_GETOPTS *go, char *hmmfile, char *seqfile)
   if (esl_opt_IsUsed(go, "--tblout")     && fprintf(ofp, "# per-seq hits tabular output:     %s\n",             esl_opt_GetString(go, "--tblout"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--domtblout")  && fprintf(ofp, "# per-dom hits tabular output:     %s\n",             esl_opt_GetString(go, "--domtblout"))  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--pfamtblout") && fprintf(ofp, "# pfam-style tabular hit output:   %s\n",             esl_opt_GetString(go, "--pfamtblout")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--binout")    && fprintf(ofp, "# binary hit output:               %s\n",            esl_opt_GetString(go, "--binout"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--acc")        && fprintf(ofp, "# prefer accessions over names:    yes\n")                                                   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--noali")      && fprintf(ofp, "# show alignments in output:       no\n")                                                    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--max-hits")   && fprintf(ofp, "# max hits kept per query:         %d\n",             esl_opt_GetInteger(go, "--max-hits"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--notextw")    && fprintf(ofp, "# max ASCII text line length:      unlimited\n")                                             < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--textw")      && fprintf(ofp, "# max ASCII text line length:      %d\n",             esl_opt_GetInteger(go, "--textw"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "-E")           && fprintf(ofp, "# sequence reporting threshold:    E-value <= %g\n",  esl_opt_GetReal(go, "-E"))             < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -261,6 +322,7 @@ output_header(FILE *ofp, const ESL_GETOPTS *go, char *hmmfile, char *seqfile)
   if (esl_opt_IsUsed(go, "--tformat")    && fprintf(ofp, "# targ <seqfile> format asserted:  %s\n",             esl_opt_GetString(go, "--tformat"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #ifdef HMMER_THREADS
   if (esl_opt_IsUsed(go, "--cpu")        && fprintf(ofp, "# number of worker threads:        %d\n",             esl_opt_GetInteger(go, "--cpu"))       < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
+  if (esl_opt_IsUsed(go, "--lsort")      && fprintf(ofp, "# targets searched by length:      longest first\n")                                       < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #endif
 #ifdef HAVE_MPI
   if (esl_opt_IsUsed(go, "--mpi")        && fprintf(ofp, "# MPI:                             on\n")                                                    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -286,6 +348,7 @@ main(int argc, char **argv)
   cfg.do_mpi     = FALSE;	           /* this gets reset below, if we init MPI */
   cfg.nproc      = 0;		           /* this gets reset below, if we init MPI */
   cfg.my_rank    = 0;		           /* this gets reset below, if we init MPI */
+  cfg.ncpus      = 0;		           /* this gets reset below, if --mpi with --cpu */
   cfg.firstseq_key = NULL;
   cfg.n_targetseq  = -1;
 
@@ -322,7 +385,24 @@ main(int argc, char **argv)
   if (esl_opt_GetBoolean(go, "--mpi")) 
     {
       cfg.do_mpi     = TRUE;
-      MPI_Init(&argc, &argv);
+
+#ifdef HMMER_THREADS
+      if (esl_opt_GetBoolean(go, "--lsort")) p7_Fail("--lsort can't be used with --mpi\n");
+#endif
+
+      /* with --cpu, each worker process searches with a pool of threads;
+       * only its main thread makes MPI calls.
+       */
+#ifdef HMMER_THREADS
+      if (esl_opt_IsOn(go, "--cpu")) cfg.ncpus = esl_opt_GetInteger(go, "--cpu");
+#endif
+      if (cfg.ncpus > 0)
+	{
+	  int provided;
+	  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	  if (provided < MPI_THREAD_FUNNELED) p7_Fail("MPI library doesn't support threads; can't use --cpu with --mpi\n");
+	}
+      else MPI_Init(&argc, &argv);
       MPI_Comm_rank(MPI_COMM_WORLD, &(cfg.my_rank));
       MPI_Comm_size(MPI_COMM_WORLD, &(cfg.nproc));
 
@@ -360,32 +440,36 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   FILE            *tblfp    = NULL;              /* output stream for tabular per-seq (--tblout)    */
   FILE            *domtblfp = NULL;              /* output stream for tabular per-dom (--domtblout) */
   FILE            *pfamtblfp= NULL;              /* output stream for pfam tabular output (--pfamtblout)    */
+  FILE            *binfp    = NULL;              /* output stream for binary hit records (--binout) */
   P7_HMMFILE      *hfp      = NULL;              /* open input HMM file                             */
   ESL_SQFILE      *dbfp     = NULL;              /* open input sequence file                        */
   P7_HMM          *hmm      = NULL;              /* one HMM query                                   */
   ESL_ALPHABET    *abc      = NULL;              /* digital alphabet                                */
   int              dbfmt    = eslSQFILE_UNKNOWN; /* format code for sequence database file          */
-  ESL_STOPWATCH   *w;
+  FM_CFG          *fm_cfg   = NULL;              /* FM-index config, if target is --tformat hmmerdb */
+  FM_METADATA     *fm_meta  = NULL;
+  fpos_t           fm_basepos;
+  QUERY_INFO      *q        = NULL;              /* query being set up and searched                 */
+  QUERY_INFO      *prev     = NULL;              /* previous query, awaiting output                 */
   int              textw    = 0;
   int              nquery   = 0;
   int              status   = eslOK;
   int              hstatus  = eslOK;
   int              sstatus  = eslOK;
-  int              i;
 
   int              ncpus    = 0;
 
   int              infocnt  = 0;
-  WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  ESL_SQ_BLOCK    *block    = NULL;
+  WORK_ITEM       *held     = NULL;              /* the reader's empty work item                    */
   ESL_THREADS     *threadObj= NULL;
   ESL_WORK_QUEUE  *queue    = NULL;
 #endif
+  ESL_SQ         **tsq      = NULL;              /* with --lsort, all targets, longest first        */
+  int              ntsq     = 0;
+  int              i;
   char             errbuf[eslERRBUFSIZE];
 
-  w = esl_stopwatch_Create();
-
   if (esl_opt_GetBoolean(go, "--notextw")) textw = 0;
   else                                     textw = esl_opt_GetInteger(go, "--textw");
 
@@ -394,19 +478,48 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
     if (dbfmt == eslSQFILE_UNKNOWN) p7_Fail("%s is not a recognized sequence database file format\n", esl_opt_GetString(go, "--tformat"));
   }
 
-  /* Open the target sequence database */
-  status = esl_sqfile_Open(cfg->dbfile, dbfmt, p7_SEQDBENV, &dbfp);
-  if      (status == eslENOTFOUND) p7_Fail("Failed to open sequence file %s for reading\n",          cfg->dbfile);
-  else if (status == eslEFORMAT)   p7_Fail("Sequence file %s is empty or misformatted\n",            cfg->dbfile);
-  else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
-  else if (status != eslOK)        p7_Fail("Unexpected error %d opening sequence file %s\n", status, cfg->dbfile);  
+  if (dbfmt == eslSQFILE_FMINDEX) {
+#if !defined (p7_IMPL_SSE)
+    p7_Fail("%s is a valid sequence database file format only on systems supporting SSE vector instructions\n", esl_opt_GetString(go, "--tformat"));
+#else
+    /* As in nhmmer, the FM-index is read through its own path, not esl_sqfile_Open() */
+    if (esl_opt_IsOn(go, "--max"))
+      p7_Fail("--max flag is incompatible with the FMINDEX target type\n");
+    if (esl_opt_IsUsed(go, "--restrictdb_stkey") || esl_opt_IsUsed(go, "--restrictdb_n"))
+      p7_Fail("--restrictdb_x options are incompatible with the FMINDEX target type\n");
 
+    fm_configAlloc(&fm_cfg);
+    fm_meta = fm_cfg->meta;
 
-  if (esl_opt_IsUsed(go, "--restrictdb_stkey") || esl_opt_IsUsed(go, "--restrictdb_n")) {
-    if (esl_opt_IsUsed(go, "--ssifile"))
-      esl_sqfile_OpenSSI(dbfp, esl_opt_GetString(go, "--ssifile"));
-    else
-      esl_sqfile_OpenSSI(dbfp, NULL);
+    if((fm_meta->fp = fopen(cfg->dbfile, "rb")) == NULL)
+      p7_Fail("Failed to open target sequence database %s for reading\n",      cfg->dbfile);
+
+    if ( (status = fm_readFMmeta(fm_meta)) != eslOK)
+      p7_Fail("Failed to read FM meta data from target sequence database %s\n",      cfg->dbfile);
+
+    if ( (status = fm_configInit(fm_cfg, go)) != eslOK)
+      p7_Fail("Failed to initialize FM configuration for target sequence database %s\n",      cfg->dbfile);
+
+    if ( (status = fm_alphabetCreate(fm_meta, NULL)) != eslOK)
+      p7_Fail("Failed to create FM alphabet for target sequence database %s\n",      cfg->dbfile);
+
+    fgetpos( fm_meta->fp, &fm_basepos);
+#endif
+  } else {
+    /* Open the target sequence database */
+    status = esl_sqfile_Open(cfg->dbfile, dbfmt, p7_SEQDBENV, &dbfp);
+    if      (status == eslENOTFOUND) p7_Fail("Failed to open sequence file %s for reading\n",          cfg->dbfile);
+    else if (status == eslEFORMAT)   p7_Fail("Sequence file %s is empty or misformatted\n",            cfg->dbfile);
+    else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
+    else if (status != eslOK)        p7_Fail("Unexpected error %d opening sequence file %s\n", status, cfg->dbfile);  
+
+
+    if (esl_opt_IsUsed(go, "--restrictdb_stkey") || esl_opt_IsUsed(go, "--restrictdb_n")) {
+      if (esl_opt_IsUsed(go, "--ssifile"))
+        esl_sqfile_OpenSSI(dbfp, esl_opt_GetString(go, "--ssifile"));
+      else
+        esl_sqfile_OpenSSI(dbfp, NULL);
+    }
   }
 
 
@@ -423,21 +536,21 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (esl_opt_IsOn(go, "--tblout"))    { if ((tblfp    = fopen(esl_opt_GetString(go, "--tblout"),    "w")) == NULL)  esl_fatal("Failed to open tabular per-seq output file %s for writing\n", esl_opt_GetString(go, "--tblout")); }
   if (esl_opt_IsOn(go, "--domtblout")) { if ((domtblfp = fopen(esl_opt_GetString(go, "--domtblout"), "w")) == NULL)  esl_fatal("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblout")); }
   if (esl_opt_IsOn(go, "--pfamtblout")){ if ((pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)  esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
+  if (esl_opt_IsOn(go, "--binout"))    { if ((binfp    = fopen(esl_opt_GetString(go, "--binout"),    "wb")) == NULL) esl_fatal("Failed to open binary hit output file %s for writing\n", esl_opt_GetString(go, "--binout")); }
 
 #ifdef HMMER_THREADS
   /* initialize thread data */
   if (esl_opt_IsOn(go, "--cpu")) ncpus = esl_opt_GetInteger(go, "--cpu");
   else                                   esl_threads_CPUCount(&ncpus);
 
-  if (ncpus > 0)
-    {
-      threadObj = esl_threads_Create(&pipeline_thread);
-      queue = esl_workqueue_Create(ncpus * 2);
-    }
+  if (dbfmt == eslSQFILE_FMINDEX) ncpus = 0; /* FM-index blocks are searched serially */
+
+  /* --lsort orders the targets for the threads to share out */
+  if (esl_opt_GetBoolean(go, "--lsort") && ncpus == 0)
+    p7_Fail("--lsort needs worker threads (--cpu > 0), and a sequence file target\n");
 #endif
 
   infocnt = (ncpus == 0) ? 1 : ncpus;
-  ESL_ALLOC(info, sizeof(*info) * infocnt);
 
   /* <abc> is not known 'til first HMM is read. */
   hstatus = p7_hmmfile_Read(hfp, &abc, &hmm);
@@ -445,39 +558,42 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
     {
       /* One-time initializations after alphabet <abc> becomes known */
       output_header(ofp, go, cfg->hmmfile, cfg->dbfile);
-      esl_sqfile_SetDigital(dbfp, abc); //ReadBlock requires knowledge of the alphabet to decide how best to read blocks
+      if (dbfmt == eslSQFILE_FMINDEX) {
+        if (abc->type != eslAMINO || fm_meta->alph_type != fm_AMINO)
+          p7_Fail("FMINDEX target search in hmmsearch requires a protein query and a protein FM-index\n");
+      }
+      else
+        esl_sqfile_SetDigital(dbfp, abc); //ReadBlock requires knowledge of the alphabet to decide how best to read blocks
 
-      for (i = 0; i < infocnt; ++i)
-	{
-	  info[i].bg    = p7_bg_Create(abc);
 #ifdef HMMER_THREADS
-	  info[i].queue = queue;
-#endif
-	}
+      /* The worker threads are started once, and serve all the queries */
+      if (ncpus > 0) thread_start(ncpus, abc, &threadObj, &queue, &held);
 
-#ifdef HMMER_THREADS
-      for (i = 0; i < ncpus * 2; ++i)
-	{
-	  block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
-	  if (block == NULL) 	      esl_fatal("Failed to allocate sequence block");
+      /* With --lsort, read the targets once, for all the queries */
+      if (esl_opt_GetBoolean(go, "--lsort")) {
+        if (cfg->firstseq_key != NULL && esl_sqfile_PositionByKey(dbfp, cfg->firstseq_key) != eslOK)
+          p7_Fail("Failure setting restrictdb_stkey to %s\n", cfg->firstseq_key);
 
- 	  status = esl_workqueue_Init(queue, block);
-	  if (status != eslOK)	      esl_fatal("Failed to add block to work queue");
-	}
+        sstatus = read_targets(dbfp, abc, cfg->n_targetseq, &tsq, &ntsq);
+        if      (sstatus == eslEFORMAT) esl_fatal("Parse failed (sequence file %s):\n%s\n", dbfp->filename, esl_sqfile_GetErrorBuf(dbfp));
+        else if (sstatus != eslOK)      esl_fatal("Unexpected error %d reading sequence file %s", sstatus, cfg->dbfile);
+      }
 #endif
     }
 
   /* Outer loop: over each query HMM in <hmmfile>. */
   while (hstatus == eslOK) 
     {
-      P7_PROFILE      *gm      = NULL;
-      P7_OPROFILE     *om      = NULL;       /* optimized query profile                  */
-
       nquery++;
-      esl_stopwatch_Start(w);
 
       /* seqfile may need to be rewound (multiquery mode) */
-      if (nquery > 1)
+      if (tsq != NULL)
+        ; /* --lsort: the targets are already in memory */
+      else if (nquery > 1 && dbfmt == eslSQFILE_FMINDEX)
+      {
+        if (fsetpos(fm_meta->fp, &fm_basepos) != 0)  ESL_EXCEPTION(eslESYS, "rewind via fsetpos() failed");
+      }
+      else if (nquery > 1)
       {
         if (! esl_sqfile_IsRewindable(dbfp))
           esl_fatal("Target sequence file %s isn't rewindable; can't search it with multiple queries", cfg->dbfile);
@@ -486,105 +602,71 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
           esl_sqfile_Position(dbfp, 0); //only re-set current position to 0 if we're not planning to set it in a moment
       }
 
-      if ( cfg->firstseq_key != NULL ) { //it's tempting to want to do this once and capture the offset position for future passes, but ncbi files make this non-trivial, so this keeps it general
+      if ( cfg->firstseq_key != NULL && tsq == NULL ) { //it's tempting to want to do this once and capture the offset position for future passes, but ncbi files make this non-trivial, so this keeps it general
         sstatus = esl_sqfile_PositionByKey(dbfp, cfg->firstseq_key);
         if (sstatus != eslOK)
           p7_Fail("Failure setting restrictdb_stkey to %d\n", cfg->firstseq_key);
       }
 
-      if (fprintf(ofp, "Query:       %s  [M=%d]\n", hmm->name, hmm->M)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (hmm->acc)  { if (fprintf(ofp, "Accession:   %s\n", hmm->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
-      if (hmm->desc) { if (fprintf(ofp, "Description: %s\n", hmm->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+      /* FM seed extension needs a window length; older HMM files may not carry one */
+      if (dbfmt == eslSQFILE_FMINDEX && hmm->max_length == -1)
+        p7_Builder_MaxLength(hmm, p7_DEFAULT_WINDOW_BETA);
 
-      /* Convert to an optimized model */
-      gm = p7_profile_Create (hmm->M, abc);
-      om = p7_oprofile_Create(hmm->M, abc);
-      p7_ProfileConfig(hmm, info->bg, gm, 100, p7_LOCAL); /* 100 is a dummy length for now; and MSVFilter requires local mode */
-      p7_oprofile_Convert(gm, om);                  /* <om> is now p7_LOCAL, multihit */
-
-      for (i = 0; i < infocnt; ++i)
-      {
-        /* Create processing pipeline and hit list */
-        info[i].th  = p7_tophits_Create();
-        info[i].om  = p7_oprofile_Clone(om);
-        info[i].pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
-        p7_pli_NewModel(info[i].pli, info[i].om, info[i].bg);
+      q   = new_query(go, hmm, nquery, infocnt, dbfmt, fm_cfg);
+      hmm = NULL;                 /* <q> owns it now */
 
-#ifdef HMMER_THREADS
-        if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
+#if defined (p7_IMPL_SSE)
+      if (dbfmt == eslSQFILE_FMINDEX)
+        sstatus = serial_loop_FM(q->info);
+      else
 #endif
-      }
-
 #ifdef HMMER_THREADS
-      if (ncpus > 0)  sstatus = thread_loop(threadObj, queue, dbfp, cfg->n_targetseq);
-      else            sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      if (tsq != NULL) { sorted_loop(queue, &held, tsq, ntsq, q); sstatus = eslOK; }
+      else if (ncpus > 0)  sstatus = thread_loop(queue, &held, dbfp, cfg->n_targetseq, q);
+      else            sstatus = serial_loop(q->info, dbfp, cfg->n_targetseq);
 #else
-      sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      sstatus = serial_loop(q->info, dbfp, cfg->n_targetseq);
 #endif
       switch(sstatus)
       {
       case eslEFORMAT:
+        if (dbfp == NULL) esl_fatal("Parse failed (FM-index file %s)\n", cfg->dbfile);   /* FM path has no sqfile */
         esl_fatal("Parse failed (sequence file %s):\n%s\n",
             dbfp->filename, esl_sqfile_GetErrorBuf(dbfp));
         break;
       case eslEOF:
+      case eslOK:
         /* do nothing */
         break;
       default:
-        esl_fatal("Unexpected error %d reading sequence file %s", sstatus, dbfp->filename);
+        esl_fatal("Unexpected error %d reading sequence file %s", sstatus, cfg->dbfile);
       }
 
-      /* merge the results of the search results */
-      for (i = 1; i < infocnt; ++i)
-      {
-        p7_tophits_Merge(info[0].th, info[i].th);
-        p7_pipeline_Merge(info[0].pli, info[i].pli);
-
-        p7_pipeline_Destroy(info[i].pli);
-        p7_tophits_Destroy(info[i].th);
-        p7_oprofile_Destroy(info[i].om);
+      /* With worker threads, <q> is still being searched. The previous
+       * query has finished (or is finishing) meanwhile: output it now,
+       * so results come out in query order.
+       */
+      if (prev != NULL) {
+        if ((status = output_query(go, prev, ofp, afp, tblfp, domtblfp, pfamtblfp, binfp, textw)) != eslOK) goto ERROR;
+        free_query(prev);
+        prev = NULL;
       }
-
-      /* Print the results.  */
-      p7_tophits_SortBySortkey(info->th);
-      p7_tophits_Threshold(info->th, info->pli);
-      p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-
-      if (tblfp)     p7_tophits_TabularTargets(tblfp,    hmm->name, hmm->acc, info->th, info->pli, (nquery == 1));
-      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, hmm->name, hmm->acc, info->th, info->pli, (nquery == 1));
-      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, hmm->name, hmm->acc, info->th, info->pli);
-  
-      esl_stopwatch_Stop(w);
-      p7_pli_Statistics(ofp, info->pli, w);
-      if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-
-      /* Output the results in an MSA (-A option) */
-      if (afp) {
-	ESL_MSA *msa = NULL;
-
-	if (p7_tophits_Alignment(info->th, abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK)
-	  {
-	    if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
-	    else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
-	  
-	    if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-	  } 
-	else { if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
-	  
-	esl_msa_Destroy(msa);
+      if (ncpus > 0) prev = q;
+      else {
+        if ((status = output_query(go, q, ofp, afp, tblfp, domtblfp, pfamtblfp, binfp, textw)) != eslOK) goto ERROR;
+        free_query(q);
       }
-
-      p7_pipeline_Destroy(info->pli);
-      p7_tophits_Destroy(info->th);
-      p7_oprofile_Destroy(info->om);
-      p7_oprofile_Destroy(om);
-      p7_profile_Destroy(gm);
-      p7_hmm_Destroy(hmm);
+      q = NULL;
 
       hstatus = p7_hmmfile_Read(hfp, &abc, &hmm);
     } /* end outer loop over query HMMs */
 
+  if (prev != NULL) {
+    if ((status = output_query(go, prev, ofp, afp, tblfp, domtblfp, pfamtblfp, binfp, textw)) != eslOK) goto ERROR;
+    free_query(prev);
+    prev = NULL;
+  }
+
   switch(hstatus) {
   case eslEOD:       p7_Fail("read failed, HMM file %s may be truncated?", cfg->hmmfile);      break;
   case eslEFORMAT:   p7_Fail("bad file format in HMM file %s",             cfg->hmmfile);      break;
@@ -603,31 +685,27 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   /* Cleanup - prepare for exit
    */
-  for (i = 0; i < infocnt; ++i)
-    p7_bg_Destroy(info[i].bg);
-
 #ifdef HMMER_THREADS
-  if (ncpus > 0)
-    {
-      esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	esl_sq_DestroyBlock(block);
-      esl_workqueue_Destroy(queue);
-      esl_threads_Destroy(threadObj);
-    }
+  if (threadObj != NULL) thread_destroy(threadObj, queue, held);
 #endif
+  for (i = 0; i < ntsq; i++) esl_sq_Destroy(tsq[i]);
+  if (tsq != NULL) free(tsq);
 
-  free(info);
   p7_hmmfile_Close(hfp);
-  esl_sqfile_Close(dbfp);
+  if (dbfp) esl_sqfile_Close(dbfp);
   esl_alphabet_Destroy(abc);
-  esl_stopwatch_Destroy(w);
+
+  if (fm_cfg) {
+    fclose(fm_meta->fp);
+    fm_configDestroy(fm_cfg); // will cascade to destroy meta and alphabet, too
+  }
 
   if (ofp != stdout) fclose(ofp);
   if (afp)           fclose(afp);
   if (tblfp)         fclose(tblfp);
   if (domtblfp)      fclose(domtblfp);
   if (pfamtblfp)     fclose(pfamtblfp);
+  if (binfp)         fclose(binfp);
 
   return eslOK;
 
@@ -635,6 +713,175 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return eslFAIL;
 }
 
+/* new_query()
+ * Set up the search of query <hmm>, which the new QUERY_INFO takes
+ * ownership of: configure its profile, and create the null models,
+ * pipelines, hit lists and profile copies for <ninfo> workers.
+ * <idx> is the query's index in <hmmfile>, 1..nquery. Errors are
+ * fatal.
+ */
+static QUERY_INFO *
+new_query(ESL_GETOPTS *go, P7_HMM *hmm, int idx, int ninfo, int dbfmt, FM_CFG *fm_cfg)
+{
+  QUERY_INFO  *q  = NULL;
+  P7_PROFILE  *gm = NULL;
+  P7_OPROFILE *om = NULL;       /* optimized query profile                  */
+  int          i;
+  int          status;
+
+  ESL_ALLOC(q, sizeof(QUERY_INFO));
+  q->hmm       = hmm;
+  q->idx       = idx;
+  q->ninfo     = ninfo;
+  q->scoredata = NULL;
+  q->w         = esl_stopwatch_Create();
+  ESL_ALLOC(q->info, sizeof(WORKER_INFO) * ninfo);
+  esl_stopwatch_Start(q->w);
+
+  for (i = 0; i < ninfo; ++i)
+    q->info[i].bg = p7_bg_Create(hmm->abc);
+
+  /* Convert to an optimized model */
+  gm = p7_profile_Create (hmm->M, hmm->abc);
+  om = p7_oprofile_Create(hmm->M, hmm->abc);
+  p7_ProfileConfig(hmm, q->info[0].bg, gm, 100, p7_LOCAL); /* 100 is a dummy length for now; and MSVFilter requires local mode */
+  p7_oprofile_Convert(gm, om);                  /* <om> is now p7_LOCAL, multihit */
+
+#if defined (p7_IMPL_SSE)
+  if (dbfmt == eslSQFILE_FMINDEX) {
+    /* seed score threshold scaled by score density, as nhmmer does; see nhmmer.c */
+    float best_sc_avg = 0;
+    int k, j;
+    for (k = 1; k <= om->M; k++) {
+      float max_score = 0;
+      for (j=0; j<hmm->abc->K; j++)
+        if (gm->rsc[j][k * p7P_NR + p7P_MSC] > max_score) max_score = gm->rsc[j][k * p7P_NR + p7P_MSC];
+      best_sc_avg += max_score;
+    }
+    best_sc_avg /= sqrt((double) om->M);
+    best_sc_avg  = ESL_MAX(5.0, best_sc_avg);
+
+    fm_cfg->sc_thresh_ratio = ESL_MIN(best_sc_avg/7.0, 1.0);
+    q->scoredata = p7_hmm_ScoreDataCreate(om, gm);
+  }
+#endif
+
+  for (i = 0; i < ninfo; ++i)
+    {
+      /* Create processing pipeline and hit list */
+      q->info[i].th  = p7_tophits_Create();
+      if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(q->info[i].th, esl_opt_GetInteger(go, "--max-hits"));
+      q->info[i].om  = p7_oprofile_Clone(om);
+      q->info[i].pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+      if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A")) q->info[i].pli->ddef->do_alidisplay = FALSE;
+      p7_pli_NewModel(q->info[i].pli, q->info[i].om, q->info[i].bg);
+      q->info[i].fm_cfg    = fm_cfg;
+      q->info[i].scoredata = q->scoredata;
+    }
+
+#ifdef HMMER_THREADS
+  q->nleft      = 0;
+  q->queued_all = FALSE;
+  if (pthread_mutex_init(&q->mutex, NULL) != 0) esl_fatal("mutex init failed");
+  if (pthread_cond_init (&q->done,  NULL) != 0) esl_fatal("cond init failed");
+#endif
+
+  p7_oprofile_Destroy(om);
+  p7_profile_Destroy(gm);
+  return q;
+
+ ERROR:
+  esl_fatal("allocation failed");
+  return NULL;
+}
+
+/* output_query()
+ * Wait for the search of query <q> to finish, merge its workers'
+ * results, and output them.
+ */
+static int
+output_query(ESL_GETOPTS *go, QUERY_INFO *q, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, FILE *binfp, int textw)
+{
+  WORKER_INFO *info = q->info;
+  P7_HMM      *hmm  = q->hmm;
+  int          i;
+
+#ifdef HMMER_THREADS
+  queue_wait(q);
+#endif
+
+  /* merge the results of the search results */
+  for (i = 1; i < q->ninfo; ++i)
+    {
+      p7_tophits_Merge(info[0].th, info[i].th);
+      p7_pipeline_Merge(info[0].pli, info[i].pli);
+    }
+
+  if (fprintf(ofp, "Query:       %s  [M=%d]\n", hmm->name, hmm->M)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (hmm->acc)  { if (fprintf(ofp, "Accession:   %s\n", hmm->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+  if (hmm->desc) { if (fprintf(ofp, "Description: %s\n", hmm->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+
+  /* Print the results.  */
+  p7_tophits_SortBySortkey(info->th);
+  p7_tophits_Threshold(info->th, info->pli);
+  p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+
+  if (tblfp)     p7_tophits_TabularTargets(tblfp,    hmm->name, hmm->acc, info->th, info->pli, (q->idx == 1));
+  if (domtblfp)  p7_tophits_TabularDomains(domtblfp, hmm->name, hmm->acc, info->th, info->pli, (q->idx == 1));
+  if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, hmm->name, hmm->acc, info->th, info->pli);
+  if (binfp)     p7_tophits_Binary(binfp, hmm->name, hmm->acc, info->th, info->pli);
+
+  esl_stopwatch_Stop(q->w);
+  p7_pli_Statistics(ofp, info->pli, q->w);
+  if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+
+  /* Output the results in an MSA (-A option) */
+  if (afp) {
+    ESL_MSA *msa = NULL;
+
+    if (p7_tophits_Alignment(info->th, hmm->abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK)
+      {
+	if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
+	else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
+
+	if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      } 
+    else { if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
+
+    esl_msa_Destroy(msa);
+  }
+
+  return eslOK;
+}
+
+/* free_query()
+ * Free a query, once its results are output.
+ */
+static void
+free_query(QUERY_INFO *q)
+{
+  int i;
+
+  if (q == NULL) return;
+  for (i = 0; i < q->ninfo; ++i)
+    {
+      p7_pipeline_Destroy(q->info[i].pli);
+      p7_tophits_Destroy(q->info[i].th);
+      p7_oprofile_Destroy(q->info[i].om);
+      p7_bg_Destroy(q->info[i].bg);
+    }
+#ifdef HMMER_THREADS
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->done);
+#endif
+  if (q->scoredata) p7_hmm_ScoreDataDestroy(q->scoredata);
+  esl_stopwatch_Destroy(q->w);
+  p7_hmm_Destroy(q->hmm);
+  free(q->info);
+  free(q);
+}
+
 #ifdef HAVE_MPI
 
 /* Define common tags used by the MPI master/slave processes */
@@ -711,8 +958,9 @@ typedef struct {
  * of the block.  These blocks are passed as work units to the
  * MPI workers.  If multiple hmm's are in the query file, the
  * blocks are reused without parsing the database a second time.
+ * Blocks stop growing once they reach <max_length> bytes.
  */
-int next_block(ESL_SQFILE *sqfp, ESL_SQ *sq, BLOCK_LIST *list, SEQ_BLOCK *block, int n_targetseqs)
+int next_block(ESL_SQFILE *sqfp, ESL_SQ *sq, BLOCK_LIST *list, SEQ_BLOCK *block, int n_targetseqs, uint64_t max_length)
 {
   int      status   = eslOK;
 
@@ -747,7 +995,7 @@ int next_block(ESL_SQFILE *sqfp, ESL_SQ *sq, BLOCK_LIST *list, SEQ_BLOCK *block,
 
   esl_sq_Reuse(sq);
   if (n_targetseqs == 0) status = eslEOF; //this is to handle the end-case of a restrictdb scenario, where no more targets are required, and we want to mark the list as complete
-  while (block->length < MAX_BLOCK_SIZE && (n_targetseqs <0 || block->count < n_targetseqs) && (status = esl_sqio_ReadInfo(sqfp, sq)) == eslOK)
+  while (block->length < max_length && (n_targetseqs <0 || block->count < n_targetseqs) && (status = esl_sqio_ReadInfo(sqfp, sq)) == eslOK)
     {
       if (block->count == 0) block->offset = sq->roff;
       block->length = sq->eoff - block->offset + 1;
@@ -810,6 +1058,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   FILE            *tblfp    = NULL;              /* output stream for tabular per-seq (--tblout)    */
   FILE            *domtblfp = NULL;              /* output stream for tabular per-dom (--domtblout) */
   FILE            *pfamtblfp= NULL;              /* output stream for pfam-style tabular output  (--pfamtblout) */
+  FILE            *binfp    = NULL;              /* output stream for binary hit records (--binout) */
   P7_BG           *bg       = NULL;	         /* null model                                      */
   P7_HMMFILE      *hfp      = NULL;              /* open input HMM file                             */
   ESL_SQFILE      *dbfp     = NULL;              /* open input sequence file                        */
@@ -829,6 +1078,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   int              mpi_size = 0;                 /* size of the allocated buffer */
   BLOCK_LIST      *list     = NULL;
   SEQ_BLOCK        block;
+  uint64_t         max_length;                   /* bytes of sequence file per block               */
 
   int              i;
   int              size;
@@ -839,12 +1089,16 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   w = esl_stopwatch_Create();
 
+  /* workers with threads get a block per thread at a time */
+  max_length = (uint64_t) MAX_BLOCK_SIZE * ESL_MAX(1, cfg->ncpus);
+
   if (esl_opt_GetBoolean(go, "--notextw")) textw = 0;
   else                                     textw = esl_opt_GetInteger(go, "--textw");
 
   if (esl_opt_IsOn(go, "--tformat")) {
     dbfmt = esl_sqio_EncodeFormat(esl_opt_GetString(go, "--tformat"));
     if (dbfmt == eslSQFILE_UNKNOWN) mpi_failure("%s is not a recognized sequence database file format\n", esl_opt_GetString(go, "--tformat"));
+    if (dbfmt == eslSQFILE_FMINDEX) mpi_failure("FMINDEX target format is not supported with --mpi\n");
   }
 
   /* Open the target sequence database */
@@ -883,6 +1137,8 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   if (esl_opt_IsOn(go, "--pfamtblout") && (pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)
     mpi_failure("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout"));
+  if (esl_opt_IsOn(go, "--binout") && (binfp = fopen(esl_opt_GetString(go, "--binout"), "wb")) == NULL)
+    mpi_failure("Failed to open binary hit output file %s for writing\n", esl_opt_GetString(go, "--binout"));
 
   ESL_ALLOC(list, sizeof(BLOCK_LIST));
   list->complete = 0;
@@ -936,11 +1192,13 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
       /* Create processing pipeline and hit list */
       th  = p7_tophits_Create(); 
+      if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(th, esl_opt_GetInteger(go, "--max-hits"));
       pli = p7_pipeline_Create(go, hmm->M, 100, FALSE, p7_SEARCH_SEQS);
+      if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A")) pli->ddef->do_alidisplay = FALSE;
       p7_pli_NewModel(pli, om, bg);
 
       /* Main loop: */
-      while ((n_targets==-1 || seq_cnt<=n_targets) && (sstatus = next_block(dbfp, dbsq, list, &block, n_targets-seq_cnt)) == eslOK )
+      while ((n_targets==-1 || seq_cnt<=n_targets) && (sstatus = next_block(dbfp, dbsq, list, &block, n_targets-seq_cnt, max_length)) == eslOK )
       {
         seq_cnt += block.count;
 
@@ -983,7 +1241,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       block.length = 0;
       block.count  = 0;
 
-      /* wait for all workers to finish up their work blocks */
+      /* collect each worker's request for another block */
       for (i = 1; i < cfg->nproc; ++i)
 	{
 	  if (MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &mpistatus) != 0) 
@@ -1037,6 +1295,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       if (tblfp)    p7_tophits_TabularTargets(tblfp,    hmm->name, hmm->acc, th, pli, (nquery == 1));
       if (domtblfp) p7_tophits_TabularDomains(domtblfp, hmm->name, hmm->acc, th, pli, (nquery == 1));
       if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, hmm->name, hmm->acc, th, pli);
+      if (binfp)     p7_tophits_Binary(binfp, hmm->name, hmm->acc, th, pli);
 
       esl_stopwatch_Stop(w);
       p7_pli_Statistics(ofp, pli, w);
@@ -1119,6 +1378,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (tblfp)         fclose(tblfp);
   if (domtblfp)      fclose(domtblfp);
   if (pfamtblfp)     fclose(pfamtblfp);
+  if (binfp)         fclose(binfp);
 
   return eslOK;
 
@@ -1126,6 +1386,35 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return eslEMEM;
 }
 
+#ifdef HMMER_THREADS
+/* mpi_queue_block()
+ * Read the target sequences of <block> from <dbfp>, already
+ * positioned at its start, and queue them to the worker threads
+ * as blocks of query <q>, checking the block is the one the master
+ * parsed.
+ */
+static void
+mpi_queue_block(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQFILE *dbfp, SEQ_BLOCK *block, QUERY_INFO *q)
+{
+  ESL_SQ_BLOCK *sqb;
+  uint64_t      length = 0;
+  uint64_t      count  = block->count;
+
+  while (count > 0)
+    {
+      sqb = (*held)->block;
+      if (esl_sqio_ReadBlock(dbfp, sqb, -1, (int) ESL_MIN(count, (uint64_t) sqb->listSize), FALSE) != eslOK) break;
+      count -= sqb->count;
+      length = sqb->list[sqb->count-1].eoff - block->offset + 1;
+
+      queue_item(queue, held, q);
+    }
+
+  /* lets do a little bit of sanity checking here to make sure the blocks are the same */
+  if (count > 0)               mpi_failure("Block count mismatch - expected %ld found %ld at offset %ld\n",  block->count,  block->count - count, block->offset);
+  if (block->length != length) mpi_failure("Block length mismatch - expected %ld found %ld at offset %ld\n", block->length, length,               block->offset);
+}
+#endif /*HMMER_THREADS*/
 
 static int
 mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
@@ -1147,6 +1436,12 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   MPI_Status       mpistatus;
   char             errbuf[eslERRBUFSIZE];
+#ifdef HMMER_THREADS
+  WORK_ITEM       *held     = NULL;              /* the reader's empty work item                    */
+  ESL_THREADS     *threadObj= NULL;
+  ESL_WORK_QUEUE  *queue    = NULL;
+  int              i;
+#endif
 
   w = esl_stopwatch_Create();
 
@@ -1171,6 +1466,9 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
       dbsq = esl_sq_CreateDigital(abc);
       bg = p7_bg_Create(abc);
       esl_sqfile_SetDigital(dbfp, abc);
+#ifdef HMMER_THREADS
+      if (cfg->ncpus > 0) thread_start(cfg->ncpus, abc, &threadObj, &queue, &held);
+#endif
     }
   
   /* Outer loop: over each query HMM in <hmmfile>. */
@@ -1180,6 +1478,9 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
       P7_OPROFILE     *om      = NULL;       /* optimized query profile                  */
       P7_PIPELINE     *pli     = NULL;
       P7_TOPHITS      *th      = NULL;
+#ifdef HMMER_THREADS
+      QUERY_INFO      *q       = NULL;       /* with --cpu: the query, as the threads see it */
+#endif
 
       SEQ_BLOCK        block;
 
@@ -1188,62 +1489,103 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
       status = 0;
       MPI_Send(&status, 1, MPI_INT, 0, HMMER_READY_TAG, MPI_COMM_WORLD);
 
-      /* Convert to an optimized model */
-      gm = p7_profile_Create (hmm->M, abc);
-      om = p7_oprofile_Create(hmm->M, abc);
-      p7_ProfileConfig(hmm, bg, gm, 100, p7_LOCAL);
-      p7_oprofile_Convert(gm, om);
-
-      th  = p7_tophits_Create(); 
-      pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
-      p7_pli_NewModel(pli, om, bg);
+#ifdef HMMER_THREADS
+      if (threadObj != NULL)
+	{
+	  q   = new_query(go, hmm, 0, cfg->ncpus, dbfmt, NULL);
+	  hmm = NULL;                 /* <q> owns it now */
+	}
+      else
+#endif
+	{
+	  /* Convert to an optimized model */
+	  gm = p7_profile_Create (hmm->M, abc);
+	  om = p7_oprofile_Create(hmm->M, abc);
+	  p7_ProfileConfig(hmm, bg, gm, 100, p7_LOCAL);
+	  p7_oprofile_Convert(gm, om);
+
+	  th  = p7_tophits_Create(); 
+	  if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(th, esl_opt_GetInteger(go, "--max-hits"));
+	  pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+	  if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A")) pli->ddef->do_alidisplay = FALSE;
+	  p7_pli_NewModel(pli, om, bg);
+	}
 
       /* receive a sequence block from the master */
       MPI_Recv(&block, 3, MPI_LONG_LONG_INT, 0, HMMER_BLOCK_TAG, MPI_COMM_WORLD, &mpistatus);
       while (block.count > 0)
 	{
-	  uint64_t length = 0;
-	  uint64_t count  = block.count;
+	  /* ask for the next block of sequences right away, so it's
+	   * already here when we finish this one
+	   */
+	  status = 0;
+	  MPI_Send(&status, 1, MPI_INT, 0, HMMER_READY_TAG, MPI_COMM_WORLD);
 
 	  status = esl_sqfile_Position(dbfp, block.offset);
 	  if (status != eslOK) mpi_failure("Cannot position sequence database to %ld\n", block.offset);
 
-	  while (count > 0 && (sstatus = esl_sqio_Read(dbfp, dbsq)) == eslOK)
+#ifdef HMMER_THREADS
+	  if (q != NULL) mpi_queue_block(queue, &held, dbfp, &block, q);
+	  else
+#endif
 	    {
-	      length = dbsq->eoff - block.offset + 1;
+	      uint64_t length = 0;
+	      uint64_t count  = block.count;
 
-	      p7_pli_NewSeq(pli, dbsq);
-	      p7_bg_SetLength(bg, dbsq->n);
-	      p7_oprofile_ReconfigLength(om, dbsq->n);
-      
-	      p7_Pipeline(pli, om, bg, dbsq, NULL, th);
+	      while (count > 0 && (sstatus = esl_sqio_Read(dbfp, dbsq)) == eslOK)
+		{
+		  length = dbsq->eoff - block.offset + 1;
 
-	      esl_sq_Reuse(dbsq);
-	      p7_pipeline_Reuse(pli);
+		  p7_pli_NewSeq(pli, dbsq);
+		  p7_bg_SetLength(bg, dbsq->n);
+		  p7_oprofile_ReconfigLength(om, dbsq->n);
+      
+		  p7_Pipeline(pli, om, bg, dbsq, NULL, th);
 
-	      --count;
-	    }
+		  esl_sq_Reuse(dbsq);
+		  p7_pipeline_Reuse(pli);
 
-	  /* lets do a little bit of sanity checking here to make sure the blocks are the same */
-	  if (count > 0)              mpi_failure("Block count mismatch - expected %ld found %ld at offset %ld\n",  block.count,  block.count - count, block.offset);
-	  if (block.length != length) mpi_failure("Block length mismatch - expected %ld found %ld at offset %ld\n", block.length, length,              block.offset);
+		  --count;
+		}
 
-	  /* inform the master we need another block of sequences */
-	  status = 0;
-	  MPI_Send(&status, 1, MPI_INT, 0, HMMER_READY_TAG, MPI_COMM_WORLD);
+	      /* lets do a little bit of sanity checking here to make sure the blocks are the same */
+	      if (count > 0)              mpi_failure("Block count mismatch - expected %ld found %ld at offset %ld\n",  block.count,  block.count - count, block.offset);
+	      if (block.length != length) mpi_failure("Block length mismatch - expected %ld found %ld at offset %ld\n", block.length, length,              block.offset);
+	    }
 
 	  /* wait for the next block of sequences */
 	  MPI_Recv(&block, 3, MPI_LONG_LONG_INT, 0, HMMER_BLOCK_TAG, MPI_COMM_WORLD, &mpistatus);
 	}
 
+#ifdef HMMER_THREADS
+      if (q != NULL)
+	{
+	  queue_finish(q);
+	  queue_wait(q);
+	  for (i = 1; i < q->ninfo; ++i)
+	    {
+	      p7_tophits_Merge(q->info[0].th, q->info[i].th);
+	      p7_pipeline_Merge(q->info[0].pli, q->info[i].pli);
+	    }
+	  th  = q->info[0].th;
+	  pli = q->info[0].pli;
+	}
+#endif
+
       esl_stopwatch_Stop(w);
 
       /* Send the top hits back to the master. */
       p7_tophits_MPISend(th, 0, HMMER_TOPHITS_TAG, MPI_COMM_WORLD,  &mpi_buf, &mpi_size);
       p7_pipeline_MPISend(pli, 0, HMMER_PIPELINE_TAG, MPI_COMM_WORLD,  &mpi_buf, &mpi_size);
 
-      p7_pipeline_Destroy(pli);
-      p7_tophits_Destroy(th);
+#ifdef HMMER_THREADS
+      if (q != NULL) free_query(q);
+      else
+#endif
+	{
+	  p7_pipeline_Destroy(pli);
+	  p7_tophits_Destroy(th);
+	}
       p7_oprofile_Destroy(om);
       p7_profile_Destroy(gm);
       p7_hmm_Destroy(hmm);
@@ -1269,6 +1611,9 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
   status = 0;
   MPI_Send(&status, 1, MPI_INT, 0, HMMER_TERMINATING_TAG, MPI_COMM_WORLD);
 
+#ifdef HMMER_THREADS
+  if (threadObj != NULL) thread_destroy(threadObj, queue, held);
+#endif
   if (mpi_buf != NULL) free(mpi_buf);
 
   p7_hmmfile_Close(hfp);
@@ -1313,96 +1658,324 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs)
   return sstatus;
 }
 
-#ifdef HMMER_THREADS
+#if defined (p7_IMPL_SSE)
+/* serial_loop_FM()
+ * Search each block of a protein FM-index in turn. FM seeds decide
+ * which targets go on to the regular pipeline; see p7_Pipeline_FM().
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs)
+serial_loop_FM(WORKER_INFO *info)
 {
-  int  status  = eslOK;
-  int  sstatus = eslOK;
-  int  eofCount = 0;
-  ESL_SQ_BLOCK *block;
-  void         *newBlock;
+  int          status = eslOK;
+  int          i;
+  FM_DATA      fmf;
+  FM_DATA      fmb;
+  FM_METADATA *meta = info->fm_cfg->meta;
+  ESL_SQ      *dbsq = esl_sq_CreateDigital(info->om->abc);
+
+  for (i = 0; i < meta->block_count; i++)
+  {
+    if ((status = fm_FM_read(&fmf, meta, TRUE))  != eslOK) break;
+    if ((status = fm_FM_read(&fmb, meta, FALSE)) != eslOK) { fm_FM_destroy(&fmf, 1); break; }
 
-  esl_workqueue_Reset(queue);
-  esl_threads_WaitForStart(obj);
+    fmb.SA = fmf.SA;
+    fmb.T  = fmf.T;
+
+    status = p7_Pipeline_FM(info->pli, info->om, info->scoredata, info->bg, info->th,
+                            &fmf, &fmb, info->fm_cfg, dbsq);
+
+    fm_FM_destroy(&fmf, 1);
+    fm_FM_destroy(&fmb, 0);
+    if (status != eslOK) break;
+  }
+
+  esl_sq_Destroy(dbsq);
+  return status;
+}
+#endif /*p7_IMPL_SSE*/
+
+#ifdef HMMER_THREADS
+/* thread_loop()
+ * Queue the target sequence blocks for query <q> to the worker
+ * threads. Return as soon as the last block is queued, without
+ * waiting for the search to finish; queue_wait() waits for that.
+ * <*held> is the reader's empty work item, kept from one query to
+ * the next.
+ */
+static int
+thread_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQFILE *dbfp, int n_targetseqs, QUERY_INFO *q)
+{
+  int sstatus = eslOK;
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
-  if (status != eslOK) esl_fatal("Work queue reader failed");
-      
   /* Main loop: */
-  while (sstatus == eslOK )
+  while (n_targetseqs != 0)
     {
-      block = (ESL_SQ_BLOCK *) newBlock;
+      sstatus = esl_sqio_ReadBlock(dbfp, (*held)->block, -1, n_targetseqs, FALSE);
+      if (sstatus != eslOK) break;
+      n_targetseqs -= (*held)->block->count;
 
-      if (n_targetseqs == 0)
-      {
-        block->count = 0;
-        sstatus = eslEOF;
-      } else {
-        sstatus = esl_sqio_ReadBlock(dbfp, block, -1, n_targetseqs, FALSE);
-        n_targetseqs -= block->count;
-      }
+      queue_item(queue, held, q);
+    }
+  queue_finish(q);
 
-      if (sstatus == eslEOF)
-      {
-        if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-        ++eofCount;
-      }
+  return sstatus;
+}
 
-      if (sstatus == eslOK)
-      {
-        status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-        if (status != eslOK) esl_fatal("Work queue reader failed");
+/* sq_sorter_by_length()
+ * qsort() comparison of two target sequences: longer first.
+ */
+static int
+sq_sorter_by_length(const void *vsq1, const void *vsq2)
+{
+  const ESL_SQ *sq1 = *((const ESL_SQ **) vsq1);
+  const ESL_SQ *sq2 = *((const ESL_SQ **) vsq2);
+
+  if      (sq1->n > sq2->n) return -1;
+  else if (sq1->n < sq2->n) return  1;
+  else                      return  0;
+}
+
+/* read_targets()
+ * For --lsort: read the (first <n_targetseqs>, or all, if -1)
+ * sequences of <dbfp> into memory, and sort them by length, longest
+ * first. Return them in <*ret_tsq>, and their number in <*ret_ntsq>.
+ * Returns <eslOK>, or the error status of the sequence file read.
+ */
+static int
+read_targets(ESL_SQFILE *dbfp, ESL_ALPHABET *abc, int n_targetseqs, ESL_SQ ***ret_tsq, int *ret_ntsq)
+{
+  ESL_SQ **tsq    = NULL;
+  int      ntsq   = 0;
+  int      nalloc = 0;
+  int      sstatus = eslOK;
+  void    *p;
+  int      status;
+
+  while (n_targetseqs == -1 || ntsq < n_targetseqs)
+    {
+      if (ntsq == nalloc) {
+        nalloc = (nalloc ? nalloc * 2 : BLOCK_SIZE);
+        ESL_RALLOC(tsq, p, sizeof(ESL_SQ *) * nalloc);
       }
+      tsq[ntsq] = esl_sq_CreateDigital(abc);
+      sstatus   = esl_sqio_Read(dbfp, tsq[ntsq]);
+      if (sstatus != eslOK) { esl_sq_Destroy(tsq[ntsq]); break; }
+      ntsq++;
+    }
+  if (sstatus == eslEOF) sstatus = eslOK;
+
+  if (ntsq > 1) qsort(tsq, ntsq, sizeof(ESL_SQ *), sq_sorter_by_length);
+
+  *ret_tsq  = tsq;
+  *ret_ntsq = ntsq;
+  return sstatus;
+
+ ERROR:
+  esl_fatal("allocation failed");
+  return status;
+}
+
+/* sorted_loop()
+ * Like thread_loop(), for --lsort: queue the in-memory targets
+ * <tsq[0..ntsq-1]>, which are sorted longest first, in blocks of
+ * <BLOCK_SIZE>. Whichever threads are free take the longest targets
+ * first, so no thread is left with a long one at the end.
+ */
+static void
+sorted_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQ **tsq, int ntsq, QUERY_INFO *q)
+{
+  ESL_SQ_BLOCK *block;
+  int           i = 0;
+
+  while (i < ntsq)
+    {
+      block = (*held)->block;
+      for (block->count = 0; block->count < block->listSize && i < ntsq; block->count++, i++)
+	{
+	  esl_sq_Reuse(block->list + block->count);
+	  esl_sq_Copy(tsq[i], block->list + block->count);
+	}
+      queue_item(queue, held, q);
+    }
+  queue_finish(q);
+}
+
+/* queue_item()
+ * Hand the filled work item <*held> for query <q> to the workers,
+ * counting it as outstanding for <q>, and take back an empty one.
+ */
+static void
+queue_item(ESL_WORK_QUEUE *queue, WORK_ITEM **held, QUERY_INFO *q)
+{
+  void *newItem;
+
+  if (pthread_mutex_lock(&q->mutex)   != 0) esl_fatal("mutex lock failed");
+  q->nleft++;
+  if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+
+  (*held)->q = q;
+  if (esl_workqueue_ReaderUpdate(queue, *held, &newItem) != eslOK) esl_fatal("Work queue reader failed");
+  *held = (WORK_ITEM *) newItem;
+}
+
+/* queue_finish()
+ * Mark all of query <q>'s blocks as queued.
+ */
+static void
+queue_finish(QUERY_INFO *q)
+{
+  if (pthread_mutex_lock(&q->mutex)   != 0) esl_fatal("mutex lock failed");
+  q->queued_all = TRUE;
+  if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+}
+
+/* queue_wait()
+ * Wait for the workers to finish searching all of query <q>'s blocks.
+ */
+static void
+queue_wait(QUERY_INFO *q)
+{
+  if (pthread_mutex_lock(&q->mutex) != 0) esl_fatal("mutex lock failed");
+  while (! q->queued_all || q->nleft > 0)
+    if (pthread_cond_wait(&q->done, &q->mutex) != 0) esl_fatal("cond wait failed");
+  if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+}
+
+/* thread_start()
+ * Start <ncpus> worker threads, serving a work queue of <2*ncpus>
+ * blocks of target sequences in alphabet <abc>. The threads persist
+ * across queries. Returns the threads and the queue, and the reader's
+ * first empty work item in <*ret_held>. Errors are fatal.
+ */
+static void
+thread_start(int ncpus, ESL_ALPHABET *abc, ESL_THREADS **ret_obj, ESL_WORK_QUEUE **ret_queue, WORK_ITEM **ret_held)
+{
+  ESL_THREADS    *obj   = esl_threads_Create(&pipeline_thread);
+  ESL_WORK_QUEUE *queue = esl_workqueue_Create(ncpus * 2);
+  WORK_ITEM      *item  = NULL;
+  int             i;
+  int             status;
+
+  for (i = 0; i < ncpus * 2; ++i)
+    {
+      ESL_ALLOC(item, sizeof(WORK_ITEM));
+      item->q     = NULL;
+      item->block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
+      if (item->block == NULL)    esl_fatal("Failed to allocate sequence block");
+
+      status = esl_workqueue_Init(queue, item);
+      if (status != eslOK)	  esl_fatal("Failed to add block to work queue");
     }
 
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
+  for (i = 0; i < ncpus; ++i) esl_threads_AddThread(obj, queue);
+  esl_threads_WaitForStart(obj);
+
+  status = esl_workqueue_ReaderUpdate(queue, NULL, (void **) ret_held);
   if (status != eslOK) esl_fatal("Work queue reader failed");
 
-  if (sstatus == eslEOF)
+  *ret_obj   = obj;
+  *ret_queue = queue;
+  return;
+
+ ERROR:
+  esl_fatal("allocation failed");
+}
+
+/* thread_stop()
+ * After the last query: send each worker an empty work item, telling
+ * it to exit, and wait for them all to finish.
+ */
+static void
+thread_stop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held)
+{
+  int   nworkers = esl_threads_GetWorkerCount(obj);
+  void *newItem;
+  int   i;
+
+  for (i = 0; i < nworkers; i++)
     {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
+      held->q            = NULL;
+      held->block->count = 0;
+      if (i < nworkers-1) {
+	if (esl_workqueue_ReaderUpdate(queue, held, &newItem) != eslOK) esl_fatal("Work queue reader failed");
+	held = (WORK_ITEM *) newItem;
+      } else {
+	if (esl_workqueue_ReaderUpdate(queue, held, NULL)     != eslOK) esl_fatal("Work queue reader failed");
+      }
     }
 
-  return sstatus;
+  esl_threads_WaitForFinish(obj);
+  esl_workqueue_Complete(queue);
+}
+
+/* thread_destroy()
+ * Stop the worker threads, if <held> says they were started, and
+ * free them, their work queue and its items.
+ */
+static void
+thread_destroy(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held)
+{
+  WORK_ITEM *item;
+
+  if (held != NULL) thread_stop(obj, queue, held);
+  esl_workqueue_Reset(queue);
+  while (esl_workqueue_Remove(queue, (void **) &item) == eslOK)
+    {
+      esl_sq_DestroyBlock(item->block);
+      free(item);
+    }
+  esl_workqueue_Destroy(queue);
+  esl_threads_Destroy(obj);
 }
 
 static void 
 pipeline_thread(void *arg)
 {
   int i;
+  int64_t L;
   int status;
   int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
+  WORKER_INFO    *info;
+  ESL_THREADS    *obj;
+  ESL_WORK_QUEUE *queue;
+  QUERY_INFO     *q;
 
-  ESL_SQ_BLOCK  *block = NULL;
-  void          *newBlock;
+  WORK_ITEM      *item = NULL;
+  void           *newItem;
   
   impl_Init();
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
 
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  queue = (ESL_WORK_QUEUE *) esl_threads_GetData(obj, workeridx);
 
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
+  status = esl_workqueue_WorkerUpdate(queue, NULL, &newItem);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
-  /* loop until all blocks have been processed */
-  block = (ESL_SQ_BLOCK *) newBlock;
-  while (block->count > 0)
+  /* loop until told to exit; each block may be for a different query */
+  item = (WORK_ITEM *) newItem;
+  while (item->q != NULL)
     {
-      /* Main loop: */
-      for (i = 0; i < block->count; ++i)
+      q    = item->q;
+      info = &(q->info[workeridx]);
+
+      /* Main loop: the length models are set only when the length
+       * changes, which with --lsort is once per run of equal lengths.
+       * The pipeline leaves <om> and <bg> set for the length it was
+       * given, so results are the same in any order.
+       */
+      L = -1;
+      for (i = 0; i < item->block->count; ++i)
 	{
-	  ESL_SQ *dbsq = block->list + i;
+	  ESL_SQ *dbsq = item->block->list + i;
 
 	  p7_pli_NewSeq(info->pli, dbsq);
-	  p7_bg_SetLength(info->bg, dbsq->n);
-	  p7_oprofile_ReconfigLength(info->om, dbsq->n);
+	  if (dbsq->n != L) {
+	    L = dbsq->n;
+	    p7_bg_SetLength(info->bg, L);
+	    p7_oprofile_ReconfigLength(info->om, L);
+	  }
 	  
 	  p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
 	  
@@ -1410,13 +1983,18 @@ pipeline_thread(void *arg)
 	  p7_pipeline_Reuse(info->pli);
 	}
 
-      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
+      /* <q> may be freed as soon as its last block is counted off; don't touch it after */
+      if (pthread_mutex_lock(&q->mutex) != 0) esl_fatal("mutex lock failed");
+      if (--q->nleft == 0 && q->queued_all) pthread_cond_signal(&q->done);
+      if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+
+      status = esl_workqueue_WorkerUpdate(queue, item, &newItem);
       if (status != eslOK) esl_fatal("Work queue worker failed");
 
-      block = (ESL_SQ_BLOCK *) newBlock;
+      item = (WORK_ITEM *) newItem;
     }
 
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
+  status = esl_workqueue_WorkerUpdate(queue, item, NULL);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
   esl_threads_Finished(obj, workeridx);
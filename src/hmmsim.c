@@ -14,6 +14,12 @@
 #include "mpi.h"
 #endif 
 
+#if defined (HAVE_MPI) && defined (HMMER_THREADS)
+#include <pthread.h>
+#include "esl_threads.h"
+#include "esl_workqueue.h"
+#endif
+
 #include "easel.h"
 #include "esl_alphabet.h"
 #include "esl_stats.h"
@@ -43,6 +49,9 @@ static ESL_OPTIONS options[] = {
   { "-N",        eslARG_INT,   "1000", NULL, "n>0",     NULL,  NULL, NULL, "number of random target seqs",                      1 },
 #ifdef HAVE_MPI
   { "--mpi",     eslARG_NONE,   FALSE, NULL, NULL,      NULL,  NULL, NULL, "run as an MPI parallel program",                    1 },
+#endif
+#if defined (HAVE_MPI) && defined (HMMER_THREADS)
+  { "--cpu",     eslARG_INT,     NULL, NULL, "n>=0",    NULL,"--mpi",NULL, "with --mpi: number of threads per worker process",  1 },
 #endif
   { "-o",        eslARG_OUTFILE, NULL, NULL, NULL,      NULL,  NULL, NULL, "direct output to file <f>, not stdout",             2 },
   { "--afile",   eslARG_OUTFILE, NULL, NULL, NULL,      NULL, "-a",  NULL, "output alignment lengths to file <f>",              2 },
@@ -108,6 +117,8 @@ struct cfg_s {
   int             do_stall;	/* TRUE to stall for MPI debugging */
   int             N;		/* number of simulated seqs per HMM */
   int             L;		/* length of simulated seqs */
+  int             ncpus;	/* with --mpi: threads per worker process, or 0 */
+  int             nslots;	/* with --mpi: # of HMMs a worker process holds at once */
 
   /* Masters only (i/o streams) */
   P7_HMMFILE     *hfp;		/* open input HMM file stream */
@@ -119,6 +130,31 @@ struct cfg_s {
   FILE           *alfp;		/* optional output for alignment lengths */
 };
 
+#if defined (HAVE_MPI) && defined (HMMER_THREADS)
+/* With --mpi --cpu, a worker process's main thread hands each HMM
+ * it receives to its threads as a WORK_ITEM, and gets it back with
+ * the results filled in. hmm == NULL tells a thread to exit.
+ */
+typedef struct {
+  P7_HMM  *hmm;
+  int      seqno;		/* # of HMMs this process received before this one */
+  int      status;
+  double  *xv;			/* result: array of N scores */
+  int     *av;			/* optional result: array of N alignment lengths */
+  double   mu, lambda;
+  char     errbuf[eslERRBUFSIZE];
+} WORK_ITEM;
+
+/* Each thread has its own copy of the configuration, with its own
+ * randomness source and null model: process_workunit() changes both.
+ */
+typedef struct {
+  ESL_GETOPTS    *go;
+  struct cfg_s    cfg;
+  ESL_WORK_QUEUE *queue;
+} WORKER_INFO;
+#endif
+
 
 static int  init_master_cfg(ESL_GETOPTS *go, struct cfg_s *cfg, char *errbuf);
 
@@ -126,7 +162,12 @@ static void serial_master  (ESL_GETOPTS *go, struct cfg_s *cfg);
 #ifdef HAVE_MPI
 static void mpi_master     (ESL_GETOPTS *go, struct cfg_s *cfg);
 static void mpi_worker     (ESL_GETOPTS *go, struct cfg_s *cfg);
+static void send_result    (ESL_GETOPTS *go, struct cfg_s *cfg, char *wbuf, int wn, int seqno, int status, char *errbuf, double *xv, int *av, double mu, double lambda);
 #endif 
+#if defined (HAVE_MPI) && defined (HMMER_THREADS)
+static void mpi_thread_worker(ESL_GETOPTS *go, struct cfg_s *cfg);
+static void simulate_thread  (void *arg);
+#endif
 static int process_workunit   (ESL_GETOPTS *go, struct cfg_s *cfg, char *errbuf, P7_HMM *hmm, double *scores, int *alilens, double *ret_mu, double *ret_lambda);
 static int output_result      (ESL_GETOPTS *go, struct cfg_s *cfg, char *errbuf, P7_HMM *hmm, double *scores, int *alilens, double mu, double lambda);
 static int output_filter_power(ESL_GETOPTS *go, struct cfg_s *cfg, char *errbuf, P7_HMM *hmm, double *scores, double mu, double lambda);
@@ -202,6 +243,8 @@ main(int argc, char **argv)
   cfg.do_stall = esl_opt_GetBoolean(go, "--stall");
   cfg.N        = esl_opt_GetInteger(go, "-N");
   cfg.L        = esl_opt_GetInteger(go, "-L");
+  cfg.ncpus    = 0;		/* --mpi --cpu will change this (below) if necessary */
+  cfg.nslots   = 1;
   cfg.hfp      = NULL;
   cfg.ofp      = NULL;
   cfg.survfp   = NULL;
@@ -232,13 +275,32 @@ main(int argc, char **argv)
        * this show (proc 0) or working in it (procs >0).
        */
       cfg.do_mpi = TRUE;
-      MPI_Init(&argc, &argv);
+
+      /* With --cpu, each worker process simulates with a pool of
+       * threads, and holds one more HMM than it has threads, so the
+       * threads don't wait on the master; only its main thread makes
+       * MPI calls.
+       */
+#ifdef HMMER_THREADS
+      if (esl_opt_IsOn(go, "--cpu")) cfg.ncpus = esl_opt_GetInteger(go, "--cpu");
+#endif
+      if (cfg.ncpus > 0)
+	{
+	  int provided;
+	  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	  if (provided < MPI_THREAD_FUNNELED) p7_Fail("MPI library doesn't support threads; can't use --cpu with --mpi\n");
+	  cfg.nslots = cfg.ncpus + 1;
+	}
+      else MPI_Init(&argc, &argv);
       MPI_Comm_rank(MPI_COMM_WORLD, &(cfg.my_rank));
       MPI_Comm_size(MPI_COMM_WORLD, &(cfg.nproc));
       if (cfg.my_rank == 0 && cfg.nproc < 2) p7_Fail("Need at least 2 MPI processes to run --mpi mode.");
 
-      if (cfg.my_rank > 0)   mpi_worker(go, &cfg);
-      else                   mpi_master(go, &cfg);
+      if      (cfg.my_rank == 0)  mpi_master(go, &cfg);
+#ifdef HMMER_THREADS
+      else if (cfg.ncpus > 0)     mpi_thread_worker(go, &cfg);
+#endif
+      else                        mpi_worker(go, &cfg);
 
       esl_stopwatch_Stop(w);
       esl_stopwatch_MPIReduce(w, 0, MPI_COMM_WORLD);
@@ -417,15 +479,22 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 {
   int              xstatus       = eslOK; /* changes in the event of a recoverable error */
   P7_HMM          *hmm           = NULL;  /* query HMM                                 */
-  P7_HMM         **hmmlist       = NULL;  /* queue of HMMs being worked on, 1..nproc-1 */
+  P7_HMM         **hmmlist       = NULL;  /* HMMs being worked on: <nslots> per worker 1..nproc-1; NULL=free slot */
+  int             *seqlist       = NULL;  /* each slot's HMM's arrival # at its worker */
+  int             *nbusy         = NULL;  /* # of HMMs each worker is working on       */
+  int             *nsent         = NULL;  /* # of HMMs sent to each worker so far      */
+  int             *told          = NULL;  /* TRUE once a worker is told there's no more work */
   char            *wbuf          = NULL;  /* working buffer for sending packed profiles and receiving packed results. */
   int              wn            = 0;
   double          *xv            = NULL;  /* results: array of N scores */
   int             *av            = NULL;  /* optional results: array of N alignment lengths */
   int              have_work     = TRUE;
-  int              nproc_working = 0;
+  int              nproc_working = 0;     /* # of HMMs out with workers                */
   int              wi;
+  int              i;
   int              pos;
+  int              seqno;
+  int              slot;
   double           mu, lambda;
   char             errbuf[eslERRBUFSIZE];
   int              status;
@@ -439,11 +508,19 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   ESL_ALLOC(xv,      sizeof(double)   * cfg->N);
   if (esl_opt_GetBoolean(go, "-a"))
     ESL_ALLOC(av,    sizeof(int)      * cfg->N);
-  ESL_ALLOC(hmmlist, sizeof(P7_HMM *) * cfg->nproc);
-  for (wi = 0; wi < cfg->nproc; wi++) hmmlist[wi] = NULL;
-
-  /* Standard design pattern for data parallelization in a master/worker model. (J1/78-79).  */
-  wi = 1;
+  ESL_ALLOC(hmmlist, sizeof(P7_HMM *) * cfg->nproc * cfg->nslots);
+  ESL_ALLOC(seqlist, sizeof(int)      * cfg->nproc * cfg->nslots);
+  ESL_ALLOC(nbusy,   sizeof(int)      * cfg->nproc);
+  ESL_ALLOC(nsent,   sizeof(int)      * cfg->nproc);
+  ESL_ALLOC(told,    sizeof(int)      * cfg->nproc);
+  for (i = 0; i < cfg->nproc * cfg->nslots; i++) hmmlist[i] = NULL;
+  esl_vec_ISet(nbusy, cfg->nproc, 0);
+  esl_vec_ISet(nsent, cfg->nproc, 0);
+  esl_vec_ISet(told,  cfg->nproc, FALSE);
+
+  /* Standard design pattern for data parallelization in a master/worker model. (J1/78-79).
+   * Each worker holds up to <nslots> HMMs at once (one per thread, plus one queued).
+   */
   while (have_work || nproc_working)
     {
       /* Get next work unit: one HMM, <hmm> */
@@ -469,17 +546,25 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       /* If we have work but no free workers, or we have no work but workers
        * are still working, then wait for a result to return from any worker.
        */
-      if ( (have_work && nproc_working == cfg->nproc-1) || (! have_work && nproc_working > 0))
+      if ( (have_work && nproc_working == (cfg->nproc-1) * cfg->nslots) || (! have_work && nproc_working > 0))
 	{
 	  if (MPI_Recv(wbuf, wn, MPI_PACKED, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &mpistatus) != 0) p7_Fail("mpi recv failed");
 	  wi = mpistatus.MPI_SOURCE;
+
+	  /* results come back labeled with the HMM's arrival # at the
+	   * worker, in whatever order its threads finish them
+	   */
+	  pos = 0;
+	  if (MPI_Unpack(wbuf, wn, &pos, &seqno, 1, MPI_INT, MPI_COMM_WORLD) != 0) p7_Fail("mpi unpack failed");
+	  for (slot = wi * cfg->nslots; slot < (wi+1) * cfg->nslots; slot++)
+	    if (hmmlist[slot] != NULL && seqlist[slot] == seqno) break;
+	  if (slot == (wi+1) * cfg->nslots) p7_Fail("worker %d returned a result for an HMM it wasn't sent", wi);
 	  
 	  /* Check the xstatus before printing results.
            * If we're in a recoverable error state, we're only clearing worker results, prior to a clean failure
 	   */
 	  if (xstatus == eslOK)	
 	    {
-	      pos = 0;
 	      if (MPI_Unpack(wbuf, wn, &pos, &xstatus, 1, MPI_INT, MPI_COMM_WORLD)     != 0)     p7_Fail("mpi unpack failed");
 	      if (xstatus == eslOK) /* worker reported success. Get the results. */
 		{
@@ -488,7 +573,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 		      MPI_Unpack(wbuf, wn, &pos, av,     cfg->N, MPI_INT,    MPI_COMM_WORLD) != 0)   p7_Fail("alilen vector unpack failed");
 		  if (MPI_Unpack(wbuf, wn, &pos, &mu,         1, MPI_DOUBLE, MPI_COMM_WORLD) != 0)   p7_Fail("mu param unpack failed");
 		  if (MPI_Unpack(wbuf, wn, &pos, &lambda,     1, MPI_DOUBLE, MPI_COMM_WORLD) != 0)   p7_Fail("lambda param unpack failed");
-		  if ((status = output_result(go, cfg, errbuf, hmmlist[wi], xv, av, mu, lambda))  != eslOK) xstatus = status;
+		  if ((status = output_result(go, cfg, errbuf, hmmlist[slot], xv, av, mu, lambda)) != eslOK) xstatus = status;
 		}
 	      else	/* worker reported a user error. Get the errbuf. */
 		{
@@ -497,27 +582,46 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 		  p7_hmm_Destroy(hmm);
 		}
 	    }
-	  p7_hmm_Destroy(hmmlist[wi]);
-	  hmmlist[wi] = NULL;
+	  p7_hmm_Destroy(hmmlist[slot]);
+	  hmmlist[slot] = NULL;
+	  nbusy[wi]--;
 	  nproc_working--;
 	}
 	
-      /* If we have work, assign it to a free worker; else, terminate the free worker. */
+      /* If we have work, assign it to the least busy worker. */
       if (have_work) 
 	{
+	  for (wi = 1, i = 2; i < cfg->nproc; i++)
+	    if (nbusy[i] < nbusy[wi]) wi = i;
+
+	  for (slot = wi * cfg->nslots; hmmlist[slot] != NULL; slot++) ;  /* nbusy[wi] < nslots, so there's a free one */
+
 	  p7_hmm_MPISend(hmm, wi, 0, MPI_COMM_WORLD, &wbuf, &wn);
-	  hmmlist[wi] = hmm;
-	  wi++;
+	  hmmlist[slot] = hmm;
+	  seqlist[slot] = nsent[wi]++;
+	  nbusy[wi]++;
 	  nproc_working++;
 	}
+      /* Else, tell each worker with a free slot (so it's waiting on a
+       * recv) to finish up by sending it a NULL workunit. It still
+       * returns the results it owes.
+       */
+      else
+	{
+	  for (wi = 1; wi < cfg->nproc; wi++)
+	    if (! told[wi] && nbusy[wi] < cfg->nslots)
+	      {
+		if (p7_hmm_MPISend(NULL, wi, 0, MPI_COMM_WORLD, &wbuf, &wn) != eslOK) p7_Fail("MPI HMM send failed");	
+		told[wi] = TRUE;
+	      }
+	}
     }
 
-  /* Tell all the workers (1..nproc-1) to shut down by sending them a NULL workunit. */
-  for (wi = 1; wi < cfg->nproc; wi++)
-    if (p7_hmm_MPISend(NULL, wi, 0, MPI_COMM_WORLD, &wbuf, &wn) != eslOK) p7_Fail("MPI HMM send failed");	
-
-
   free(hmmlist);
+  free(seqlist);
+  free(nbusy);
+  free(nsent);
+  free(told);
   free(wbuf);
   free(xv);
   if (av != NULL) free(av);
@@ -526,6 +630,10 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
  ERROR:
   if (hmmlist != NULL) free(hmmlist);
+  if (seqlist != NULL) free(seqlist);
+  if (nbusy   != NULL) free(nbusy);
+  if (nsent   != NULL) free(nsent);
+  if (told    != NULL) free(told);
   if (wbuf    != NULL) free(wbuf);
   if (xv      != NULL) free(xv);
   if (av      != NULL) free(av);
@@ -546,8 +654,8 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
   double         *xv      = NULL; /* result: array of N scores */
   int            *av      = NULL; /* optional result: array of N alignment lengths */
   int             wn      = 0;
+  int             seqno   = 0;    /* # of HMMs received so far */
   char            errbuf[eslERRBUFSIZE];
-  int             pos;
   double          mu, lambda;
  
   /* Worker initializes */
@@ -560,17 +668,14 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
   /* Main worker loop */
   while (p7_hmm_MPIRecv(0, 0, MPI_COMM_WORLD, &wbuf, &wn, &(cfg->abc), &hmm) == eslOK) 
     {
-      if ((status = process_workunit(go, cfg, errbuf, hmm, xv, av, &mu, &lambda)) != eslOK) goto CLEANERROR;
-
-      pos = 0;
-      MPI_Pack(&status, 1,      MPI_INT,    wbuf, wn, &pos, MPI_COMM_WORLD);
-      MPI_Pack(xv,      cfg->N, MPI_DOUBLE, wbuf, wn, &pos, MPI_COMM_WORLD);
-      if (esl_opt_GetBoolean(go, "-a"))
-	MPI_Pack(av,    cfg->N, MPI_INT,    wbuf, wn, &pos, MPI_COMM_WORLD);
-      MPI_Pack(&mu,     1,      MPI_DOUBLE, wbuf, wn, &pos, MPI_COMM_WORLD);
-      MPI_Pack(&lambda, 1,      MPI_DOUBLE, wbuf, wn, &pos, MPI_COMM_WORLD);
-      MPI_Send(wbuf, pos, MPI_PACKED, 0, 0, MPI_COMM_WORLD);
+      if (cfg->bg == NULL) {	/* first time only: now we know the alphabet */
+        if (esl_opt_GetBoolean(go, "--bgflat")) cfg->bg = p7_bg_CreateUniform(cfg->abc);
+        else                                    cfg->bg = p7_bg_Create(cfg->abc);
+        p7_bg_SetLength(cfg->bg, esl_opt_GetInteger(go, "-L"));
+      }
 
+      if ((status = process_workunit(go, cfg, errbuf, hmm, xv, av, &mu, &lambda)) != eslOK) goto CLEANERROR;
+      send_result(go, cfg, wbuf, wn, seqno++, status, NULL, xv, av, mu, lambda);
       p7_hmm_Destroy(hmm);
     }
 
@@ -580,10 +685,7 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
   return;
 
  CLEANERROR:
-  pos = 0;
-  MPI_Pack(&status, 1,                MPI_INT,  wbuf, wn, &pos, MPI_COMM_WORLD);
-  MPI_Pack(errbuf,  eslERRBUFSIZE,    MPI_CHAR, wbuf, wn, &pos, MPI_COMM_WORLD);
-  MPI_Send(wbuf, pos, MPI_PACKED, 0, 0, MPI_COMM_WORLD);
+  send_result(go, cfg, wbuf, wn, seqno, status, errbuf, NULL, NULL, 0., 0.);
   if (wbuf != NULL) free(wbuf);
   if (hmm  != NULL) p7_hmm_Destroy(hmm);
   if (xv   != NULL) free(xv);
@@ -593,6 +695,202 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
  ERROR:
   p7_Fail("Allocation error in mpi_worker");
 }
+
+/* send_result()
+ * Packs and sends one result to the master: the HMM's arrival # at
+ * this worker, the status, and then either the results (eslOK) or
+ * the error message.
+ */
+static void
+send_result(ESL_GETOPTS *go, struct cfg_s *cfg, char *wbuf, int wn, int seqno, int status, char *errbuf, double *xv, int *av, double mu, double lambda)
+{
+  int pos = 0;
+
+  MPI_Pack(&seqno,    1,             MPI_INT,    wbuf, wn, &pos, MPI_COMM_WORLD);
+  MPI_Pack(&status,   1,             MPI_INT,    wbuf, wn, &pos, MPI_COMM_WORLD);
+  if (status == eslOK)
+    {
+      MPI_Pack(xv,      cfg->N,        MPI_DOUBLE, wbuf, wn, &pos, MPI_COMM_WORLD);
+      if (esl_opt_GetBoolean(go, "-a"))
+	MPI_Pack(av,    cfg->N,        MPI_INT,    wbuf, wn, &pos, MPI_COMM_WORLD);
+      MPI_Pack(&mu,     1,             MPI_DOUBLE, wbuf, wn, &pos, MPI_COMM_WORLD);
+      MPI_Pack(&lambda, 1,             MPI_DOUBLE, wbuf, wn, &pos, MPI_COMM_WORLD);
+    }
+  else
+    MPI_Pack(errbuf,    eslERRBUFSIZE, MPI_CHAR,   wbuf, wn, &pos, MPI_COMM_WORLD);
+  MPI_Send(wbuf, pos, MPI_PACKED, 0, 0, MPI_COMM_WORLD);
+}
+
+#ifdef HMMER_THREADS
+/* mpi_thread_worker()
+ * The main control for an MPI worker process run with --cpu.
+ *
+ * The main thread makes all the MPI calls. It keeps up to <nslots>
+ * (ncpus+1) HMMs in the work queue, so a thread that finishes one
+ * can start on the next while the result goes back to the master.
+ * When the queue is full (or the master has sent its NULL workunit),
+ * it waits for a finished HMM and sends the result back, labeled
+ * with the HMM's arrival #.
+ */
+static void
+mpi_thread_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
+{
+  ESL_THREADS    *threadObj = NULL;
+  ESL_WORK_QUEUE *queue     = NULL;
+  WORKER_INFO    *info      = NULL;
+  WORK_ITEM     **spare     = NULL; /* empty items, not in the worker queue */
+  WORK_ITEM      *item      = NULL;
+  P7_HMM         *hmm       = NULL;
+  char           *wbuf      = NULL;
+  int             wn        = 0;
+  int             nspare    = 0;
+  int             nqueued   = 0;    /* # of HMMs given to the threads and not sent back yet */
+  int             seqno     = 0;    /* # of HMMs received so far */
+  int             more      = TRUE; /* FALSE once the master sends its NULL workunit */
+  int             seed      = esl_opt_GetInteger(go, "--seed");
+  int             i;
+  int             status;
+
+  if (minimum_mpi_working_buffer(go, cfg->N, &wn) != eslOK) p7_Fail("mpi pack sizes must have failed");
+  ESL_ALLOC(wbuf,  sizeof(char)        * wn);
+  ESL_ALLOC(info,  sizeof(WORKER_INFO) * cfg->ncpus);
+  ESL_ALLOC(spare, sizeof(WORK_ITEM *) * cfg->nslots);
+
+  if ((queue = esl_workqueue_Create(cfg->nslots)) == NULL) goto ERROR;
+  for (i = 0; i < cfg->nslots; i++)
+    {
+      ESL_ALLOC(item, sizeof(WORK_ITEM));
+      item->hmm = NULL;
+      item->av  = NULL;
+      ESL_ALLOC(item->xv, sizeof(double) * cfg->N);
+      if (esl_opt_GetBoolean(go, "-a"))
+	ESL_ALLOC(item->av, sizeof(int) * cfg->N);
+      if (esl_workqueue_Init(queue, item) != eslOK) goto ERROR;
+      item = NULL;
+    }
+
+  if ((threadObj = esl_threads_Create(&simulate_thread)) == NULL) goto ERROR;
+  for (i = 0; i < cfg->ncpus; i++)
+    {
+      info[i].go    = go;
+      info[i].cfg   = *cfg;
+      info[i].cfg.r = esl_randomness_Create(seed == 0 ? 0 : seed + i);
+      info[i].cfg.bg = NULL;
+      info[i].queue = queue;
+      esl_threads_AddThread(threadObj, &info[i]);
+    }
+  esl_threads_WaitForStart(threadObj);
+
+  /* the reader queue now holds only empty items; take them all, so it
+   * only hands back finished ones from here on
+   */
+  for (nspare = 0; nspare < cfg->nslots; nspare++)
+    if (esl_workqueue_ReaderUpdate(queue, NULL, (void **) &spare[nspare]) != eslOK) goto ERROR;
+
+  while (more || nqueued > 0)
+    {
+      if (more && nqueued < cfg->nslots)
+	{
+	  if (p7_hmm_MPIRecv(0, 0, MPI_COMM_WORLD, &wbuf, &wn, &(cfg->abc), &hmm) != eslOK) { more = FALSE; continue; }
+
+	  if (info[0].cfg.bg == NULL)	/* first time only: now we know the alphabet */
+	    for (i = 0; i < cfg->ncpus; i++)
+	      {
+		info[i].cfg.abc = cfg->abc;
+		if (esl_opt_GetBoolean(go, "--bgflat")) info[i].cfg.bg = p7_bg_CreateUniform(cfg->abc);
+		else                                    info[i].cfg.bg = p7_bg_Create(cfg->abc);
+		p7_bg_SetLength(info[i].cfg.bg, esl_opt_GetInteger(go, "-L"));
+	      }
+
+	  item        = spare[--nspare];
+	  item->hmm   = hmm;
+	  item->seqno = seqno++;
+	  if (esl_workqueue_ReaderUpdate(queue, item, NULL) != eslOK) goto ERROR;
+	  nqueued++;
+	}
+      else
+	{
+	  if (esl_workqueue_ReaderUpdate(queue, NULL, (void **) &item) != eslOK) goto ERROR;
+	  send_result(go, cfg, wbuf, wn, item->seqno, item->status, item->errbuf, item->xv, item->av, item->mu, item->lambda);
+	  p7_hmm_Destroy(item->hmm);
+	  item->hmm       = NULL;
+	  spare[nspare++] = item;
+	  nqueued--;
+	}
+    }
+
+  /* tell each thread to exit with an empty item; then every item is
+   * either back in the queue or still spare
+   */
+  for (i = 0; i < cfg->ncpus; i++)
+    if (esl_workqueue_ReaderUpdate(queue, spare[--nspare], NULL) != eslOK) goto ERROR;
+  esl_threads_WaitForFinish(threadObj);
+  esl_workqueue_Complete(queue);
+  esl_workqueue_Reset(queue);
+  while (esl_workqueue_Remove(queue, (void **) &item) == eslOK)
+    spare[nspare++] = item;
+  for (i = 0; i < nspare; i++)
+    {
+      free(spare[i]->xv);
+      if (spare[i]->av != NULL) free(spare[i]->av);
+      free(spare[i]);
+    }
+  esl_workqueue_Destroy(queue);
+  esl_threads_Destroy(threadObj);
+
+  for (i = 0; i < cfg->ncpus; i++)
+    {
+      esl_randomness_Destroy(info[i].cfg.r);
+      if (info[i].cfg.bg != NULL) p7_bg_Destroy(info[i].cfg.bg);
+    }
+  free(info);
+  free(spare);
+  free(wbuf);
+  return;
+
+ ERROR:
+  p7_Fail("Fatal error in mpi_thread_worker");
+}
+
+/* simulate_thread()
+ * Each thread takes HMMs from the work queue, runs process_workunit()
+ * on them, and hands them back with the results; an empty item (hmm
+ * == NULL) tells it to exit.
+ */
+static void
+simulate_thread(void *arg)
+{
+  int             workeridx;
+  WORKER_INFO    *info;
+  ESL_THREADS    *obj;
+  WORK_ITEM      *item = NULL;
+  void           *newItem;
+
+  impl_Init();
+
+  obj = (ESL_THREADS *) arg;
+  esl_threads_Started(obj, &workeridx);
+
+  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+
+  if (esl_workqueue_WorkerUpdate(info->queue, NULL, &newItem) != eslOK) esl_fatal("Work queue worker failed");
+  item = (WORK_ITEM *) newItem;
+
+  while (item->hmm != NULL)
+    {
+      item->status = process_workunit(info->go, &info->cfg, item->errbuf, item->hmm, item->xv, item->av, &item->mu, &item->lambda);
+
+      if (esl_workqueue_WorkerUpdate(info->queue, item, &newItem) != eslOK) esl_fatal("Work queue worker failed");
+      item = (WORK_ITEM *) newItem;
+    }
+
+  /* hand the empty item back */
+  if (esl_workqueue_WorkerUpdate(info->queue, item, NULL) != eslOK) esl_fatal("Work queue worker failed");
+
+  esl_threads_Finished(obj, workeridx);
+  return;
+}
+#endif /*HMMER_THREADS*/
 #endif /*HAVE_MPI*/
 
 
@@ -928,9 +1226,9 @@ minimum_mpi_working_buffer(ESL_GETOPTS *go, int N, int *ret_wn)
   }
   if (MPI_Pack_size(1,             MPI_DOUBLE, MPI_COMM_WORLD, &n)  != 0) return eslESYS;   nresult += n*2; /* mu, lambda */
 
-  /* add the shared status code to the max of the two possible kinds of packets */
+  /* add the shared arrival # and status code to the max of the two possible kinds of packets */
   *ret_wn =  ESL_MAX(nresult, nerr);
-  if (MPI_Pack_size(1,             MPI_INT,    MPI_COMM_WORLD, &n)  != 0) return eslESYS;   *ret_wn += n;   /* status code */
+  if (MPI_Pack_size(1,             MPI_INT,    MPI_COMM_WORLD, &n)  != 0) return eslESYS;   *ret_wn += n*2; /* arrival #, status code */
   return eslOK;
 }
 #endif
@@ -564,6 +564,38 @@ p7_oprofile_Compare(P7_OPROFILE *om1, P7_OPROFILE *om2, float tol, char *errmsg)
 }
 
 
+/* Function:  p7_oprofile_MSVScoreGain()
+ * Synopsis:  Bound how much MSV scores can rise from one profile to another.
+ *
+ * Purpose:   For an old profile <om1> and a new one <om2>, calculate
+ *            <*ret_gain>, an upper bound in nats on how much the
+ *            <p7_MSVFilter()> score of any target can rise per residue
+ *            when it's scored with <om2> instead of <om1>: the largest
+ *            increase of any match emission score. See the SSE
+ *            implementation for the argument.
+ *
+ * Returns:   <eslOK> on success, and <*ret_gain> is >= 0.
+ *            <eslEINCOMPAT> if the profiles differ in <M>, <nj> or
+ *            alphabet, and <*ret_gain> is -1.
+ */
+int
+p7_oprofile_MSVScoreGain(const P7_OPROFILE *om1, const P7_OPROFILE *om2, float *ret_gain)
+{
+  float dmax = 0.0;
+  int   k, x;
+
+  if (om1->M != om2->M || om1->nj != om2->nj || om1->abc->type != om2->abc->type)
+    { *ret_gain = -1.0; return eslEINCOMPAT; }
+
+  for (x = 0; x < om1->abc->Kp; x++)
+    for (k = 1; k <= om1->M; k++)
+      dmax = ESL_MAX(dmax, p7P_MSC(om2, k, x) - p7P_MSC(om1, k, x));
+
+  *ret_gain = dmax;
+  return eslOK;
+}
+
+
 /* Function:  p7_profile_SameAsMF()
  * Synopsis:  Set a generic profile's scores to give MSV scores.
  * Incept:    MSF Tue Nov 3, 2009 [Janelia]
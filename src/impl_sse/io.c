@@ -33,6 +33,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_PREAD
+#include <unistd.h>
+#endif
 #ifdef HMMER_THREADS
 #include <pthread.h>
 #endif
@@ -460,6 +463,92 @@ p7_oprofile_ReadBlockMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OM_BLOCK *h
   return status;
 }
 
+/* A RESTREADER is the input stream for p7_oprofile_ReadRest().
+ * Where pread() is available, each call has its own file offset and a
+ * small private buffer, so concurrent ReadRest() calls on one shared
+ * <hfp> (as in threaded hmmscan) neither lock <hfp->readMutex> nor
+ * touch the stdio position of <hfp->pfp>. Big reads (the score
+ * vectors) bypass the buffer and land directly in the profile.
+ * Without pread() it falls back to fseeko()/fread() on <hfp->pfp>,
+ * and the caller has to serialize.
+ */
+#define p7_RESTBUFSIZE 4096
+
+typedef struct {
+  FILE    *fp;
+#ifdef HAVE_PREAD
+  int      fd;
+  off_t    off;			/* file offset of the byte after buf[n-1] */
+  size_t   n;			/* number of valid bytes in buf[]         */
+  size_t   pos;			/* next unconsumed byte in buf[]          */
+  char     buf[p7_RESTBUFSIZE];
+#endif
+} RESTREADER;
+
+static int
+rest_open(RESTREADER *rd, FILE *fp, off_t offset)
+{
+  rd->fp  = fp;
+#ifdef HAVE_PREAD
+  rd->fd  = fileno(fp);
+  rd->off = offset;
+  rd->n   = 0;
+  rd->pos = 0;
+  return eslOK;
+#else
+  return (fseeko(fp, offset, SEEK_SET) == 0 ? eslOK : eslESYS);
+#endif
+}
+
+/* rest_fread(): same contract as fread(): returns the number of
+ * complete items read, so a short read is caught by the same tests.
+ */
+static size_t
+rest_fread(void *ptr, size_t size, size_t nitems, RESTREADER *rd)
+{
+#ifdef HAVE_PREAD
+  char    *p      = (char *) ptr;
+  size_t   nbytes = size * nitems;
+  size_t   avail  = rd->n - rd->pos;
+  ssize_t  got;
+
+  if (avail >= nbytes)
+    {
+      memcpy(p, rd->buf + rd->pos, nbytes);
+      rd->pos += nbytes;
+      return nitems;
+    }
+  memcpy(p, rd->buf + rd->pos, avail);
+  p      += avail;
+  nbytes -= avail;
+  rd->n = rd->pos = 0;
+
+  if (nbytes >= p7_RESTBUFSIZE) 
+    {				/* big read: straight into <ptr> */
+      while (nbytes > 0)
+	{
+	  if ((got = pread(rd->fd, p, nbytes, rd->off)) <= 0) return 0;
+	  p       += got;
+	  nbytes  -= got;
+	  rd->off += got;
+	}
+      return nitems;
+    }
+
+  while (rd->n < nbytes)
+    {
+      if ((got = pread(rd->fd, rd->buf + rd->n, p7_RESTBUFSIZE - rd->n, rd->off)) <= 0) return 0;
+      rd->n   += got;
+      rd->off += got;
+    }
+  memcpy(p, rd->buf, nbytes);
+  rd->pos = nbytes;
+  return nitems;
+#else
+  return fread(ptr, size, nitems, rd->fp);
+#endif
+}
+
 /* Function:  p7_oprofile_ReadRest()
  * Synopsis:  Read the rest of an optimized profile.
  *
@@ -472,6 +561,12 @@ p7_oprofile_ReadBlockMSV(P7_HMMFILE *hfp, ESL_ALPHABET **byp_abc, P7_OM_BLOCK *h
  *            successful <p7_oprofile_ReadMSV()> call on the same
  *            open <hfp>.
  *
+ *            Where <pread()> is available, this reads at <om>'s
+ *            stored offset without moving <hfp->pfp>, and many
+ *            threads may call it concurrently on one shared <hfp>
+ *            without locking. Otherwise it serializes on
+ *            <hfp->readMutex> when <hfp> is synchronized.
+ *
  * Args:      hfp - open HMM file, from which we've previously
  *                  called <p7_oprofile_ReadMSV()>.
  *            om  - optimized profile that was successfully
@@ -496,12 +591,13 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   int           M, Q4, Q8;
   int           x,n;
   char         *name = NULL;
+  RESTREADER    rd;
   int           alphatype;
   int           status;
 
-#ifdef HMMER_THREADS
-  /* lock the mutex to prevent other threads from reading from the optimized
-   * profile at the same time.
+#if defined(HMMER_THREADS) && !defined(HAVE_PREAD)
+  /* without pread(), lock the mutex to prevent other threads from 
+   * moving the shared position of <hfp->pfp> under us.
    */
   if (hfp->syncRead)
     {
@@ -512,10 +608,10 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   if (hfp->errbuf != NULL) hfp->errbuf[0] = '\0';
   if (hfp->pfp == NULL) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no MSV profile file; hmmpress probably wasn't run");
  
-  /* Position the <hfp->pfp> using offset stored in <om> */
-  if (fseeko(hfp->pfp, om->offs[p7_POFFSET], SEEK_SET) != 0)                       ESL_EXCEPTION(eslESYS, "fseeko() failed");
+  /* Position the reader using offset stored in <om> */
+  if (rest_open(&rd, hfp->pfp, om->offs[p7_POFFSET]) != eslOK)                     ESL_EXCEPTION(eslESYS, "fseeko() failed");
    
-  if (! fread( (char *) &magic,          sizeof(uint32_t), 1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read magic");
+  if (! rest_fread( (char *) &magic,          sizeof(uint32_t), 1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read magic");
   if (magic == v3a_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/a); please hmmpress your HMM file again");
   if (magic == v3b_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/b); please hmmpress your HMM file again");
   if (magic == v3c_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/c); please hmmpress your HMM file again");
@@ -523,61 +619,61 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
   if (magic == v3e_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "binary auxfiles are in an outdated HMMER format (3/e); please hmmpress your HMM file again");
   if (magic != v3f_pmagic) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad magic; not an HMM database file?");
 
-  if (! fread( (char *) &M,              sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
-  if (! fread( (char *) &alphatype,      sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");  
-  if (! fread( (char *) &n,              sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name length");  
+  if (! rest_fread( (char *) &M,              sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read model size M");
+  if (! rest_fread( (char *) &alphatype,      sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read alphabet type");  
+  if (! rest_fread( (char *) &n,              sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name length");  
   if (M         != om->M)                                                          ESL_XFAIL(eslEFORMAT, hfp->errbuf, "p/f model length mismatch");
   if (alphatype != om->abc->type)                                                  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "p/f alphabet type mismatch");
 
   ESL_ALLOC(name, sizeof(char) * (n+1));
-  if (! fread( (char *) name,            sizeof(char),     n+1,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name");  
+  if (! rest_fread( (char *) name,            sizeof(char),     n+1,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read name");  
   if (strcmp(name, om->name) != 0)                                                 ESL_XFAIL(eslEFORMAT, hfp->errbuf, "p/f name mismatch");  
   
-  if (! fread((char *) &n,               sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read accession length");
+  if (! rest_fread((char *) &n,               sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read accession length");
   if (n > 0) {
     ESL_ALLOC(om->acc, sizeof(char) * (n+1));
-    if (! fread( (char *) om->acc,       sizeof(char),     n+1,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read accession");      
+    if (! rest_fread( (char *) om->acc,       sizeof(char),     n+1,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read accession");      
   }
-  if (! fread((char *) &n,               sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read description length");
+  if (! rest_fread((char *) &n,               sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read description length");
   if (n > 0) {
     ESL_ALLOC(om->desc, sizeof(char) * (n+1));
-    if (! fread( (char *) om->desc,      sizeof(char),     n+1,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read description");      
+    if (! rest_fread( (char *) om->desc,      sizeof(char),     n+1,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read description");      
   }
 
-  if (! fread((char *) om->rf,           sizeof(char),     M+2,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read rf annotation");
-  if (! fread((char *) om->mm,           sizeof(char),     M+2,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mm annotation");
-  if (! fread((char *) om->cs,           sizeof(char),     M+2,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read cs annotation");
-  if (! fread((char *) om->consensus,    sizeof(char),     M+2,         hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read consensus annotation");
+  if (! rest_fread((char *) om->rf,           sizeof(char),     M+2,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read rf annotation");
+  if (! rest_fread((char *) om->mm,           sizeof(char),     M+2,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mm annotation");
+  if (! rest_fread((char *) om->cs,           sizeof(char),     M+2,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read cs annotation");
+  if (! rest_fread((char *) om->consensus,    sizeof(char),     M+2,         &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read consensus annotation");
 
   Q4  = p7O_NQF(om->M);
   Q8  = p7O_NQW(om->M);
 
-  if (! fread((char *) om->twv,             sizeof(__m128i),  8*Q8,        hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tu>, vitfilter transitions");
+  if (! rest_fread((char *) om->twv,             sizeof(__m128i),  8*Q8,        &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tu>, vitfilter transitions");
   for (x = 0; x < om->abc->Kp; x++)
-    if (! fread( (char *) om->rwv[x],       sizeof(__m128i),  Q8,          hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <ru>[%d], vitfilter emissions for sym %c", x, om->abc->sym[x]);
+    if (! rest_fread( (char *) om->rwv[x],       sizeof(__m128i),  Q8,          &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <ru>[%d], vitfilter emissions for sym %c", x, om->abc->sym[x]);
   for (x = 0; x < p7O_NXSTATES; x++)
-    if (! fread( (char *) om->xw[x],        sizeof(int16_t),  p7O_NXTRANS, hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <xu>[%d], vitfilter special transitions", x);
-  if (! fread((char *) &(om->scale_w),      sizeof(float),    1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read scale_w");
-  if (! fread((char *) &(om->base_w),       sizeof(int16_t),  1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read base_w");
-  if (! fread((char *) &(om->ddbound_w),    sizeof(int16_t),  1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
-  if (! fread((char *) &(om->ncj_roundoff), sizeof(float),    1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
+    if (! rest_fread( (char *) om->xw[x],        sizeof(int16_t),  p7O_NXTRANS, &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <xu>[%d], vitfilter special transitions", x);
+  if (! rest_fread((char *) &(om->scale_w),      sizeof(float),    1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read scale_w");
+  if (! rest_fread((char *) &(om->base_w),       sizeof(int16_t),  1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read base_w");
+  if (! rest_fread((char *) &(om->ddbound_w),    sizeof(int16_t),  1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
+  if (! rest_fread((char *) &(om->ncj_roundoff), sizeof(float),    1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read ddbound_w");
 
-  if (! fread((char *) om->tfv,          sizeof(__m128),   8*Q4,        hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tf> transitions");
+  if (! rest_fread((char *) om->tfv,          sizeof(__m128),   8*Q4,        &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <tf> transitions");
   for (x = 0; x < om->abc->Kp; x++)
-    if (! fread( (char *) om->rfv[x],    sizeof(__m128),   Q4,          hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <rf>[%d] emissions for sym %c", x, om->abc->sym[x]);
+    if (! rest_fread( (char *) om->rfv[x],    sizeof(__m128),   Q4,          &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <rf>[%d] emissions for sym %c", x, om->abc->sym[x]);
   for (x = 0; x < p7O_NXSTATES; x++)
-    if (! fread( (char *) om->xf[x],     sizeof(float),    p7O_NXTRANS, hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <xf>[%d] special transitions", x);
+    if (! rest_fread( (char *) om->xf[x],     sizeof(float),    p7O_NXTRANS, &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read <xf>[%d] special transitions", x);
 
-  if (! fread((char *)   om->cutoff,     sizeof(float),    p7_NCUTOFFS, hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read Pfam score cutoffs");
-  if (! fread((char *) &(om->nj),        sizeof(float),    1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read nj");
-  if (! fread((char *) &(om->mode),      sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mode");
-  if (! fread((char *) &(om->L)   ,      sizeof(int),      1,           hfp->pfp)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read L");
+  if (! rest_fread((char *)   om->cutoff,     sizeof(float),    p7_NCUTOFFS, &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read Pfam score cutoffs");
+  if (! rest_fread((char *) &(om->nj),        sizeof(float),    1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read nj");
+  if (! rest_fread((char *) &(om->mode),      sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read mode");
+  if (! rest_fread((char *) &(om->L)   ,      sizeof(int),      1,           &rd)) ESL_XFAIL(eslEFORMAT, hfp->errbuf, "failed to read L");
 
   /* record ends with magic sentinel, for detecting binary file corruption */
-  if (! fread( (char *) &magic,     sizeof(uint32_t), 1, hfp->pfp))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no sentinel magic: .h3p file corrupted?");
+  if (! rest_fread( (char *) &magic,     sizeof(uint32_t), 1, &rd))  ESL_XFAIL(eslEFORMAT, hfp->errbuf, "no sentinel magic: .h3p file corrupted?");
   if (magic != v3f_pmagic)                                           ESL_XFAIL(eslEFORMAT, hfp->errbuf, "bad sentinel magic; .h3p file corrupted?");
 
-#ifdef HMMER_THREADS
+#if defined(HMMER_THREADS) && !defined(HAVE_PREAD)
   if (hfp->syncRead)
     {
       if (pthread_mutex_unlock (&hfp->readMutex) != 0) ESL_EXCEPTION(eslESYS, "mutex unlock failed");
@@ -589,7 +685,7 @@ p7_oprofile_ReadRest(P7_HMMFILE *hfp, P7_OPROFILE *om)
 
  ERROR:
 
-#ifdef HMMER_THREADS
+#if defined(HMMER_THREADS) && !defined(HAVE_PREAD)
   if (hfp->syncRead)
     {
       if (pthread_mutex_unlock (&hfp->readMutex) != 0) ESL_EXCEPTION(eslESYS, "mutex unlock failed");
@@ -709,15 +805,23 @@ p7_oprofile_Position(P7_HMMFILE *hfp, off_t offset)
  *****************************************************************/
 #ifdef p7IO_BENCHMARK
 /*
-  gcc  -g -Wall    -o benchmark-io -I.. -L.. -I../../easel -L../../easel -Dp7IO_BENCHMARK io.c -lhmmer -leasel -lm 
-  icc  -O3 -static -o benchmark-io -I.. -L.. -I../../easel -L../../easel -Dp7IO_BENCHMARK io.c -lhmmer -leasel -lm 
+  gcc  -g -Wall    -o benchmark-io -I.. -L.. -I../../easel -L../../easel -Dp7IO_BENCHMARK io.c -lhmmer -leasel -lm -lpthread
+  icc  -O3 -static -o benchmark-io -I.. -L.. -I../../easel -L../../easel -Dp7IO_BENCHMARK io.c -lhmmer -leasel -lm -lpthread
 
-  ./benchmark-io Pfam.msv
+  ./benchmark-io Pfam                  # serial MSV read, then serial ReadRest()
+  ./benchmark-io --cpu 8 Pfam          # ReadRest() of all models from 8 threads sharing one <hfp>
+
+  The second form is the access pattern of threaded hmmscan when
+  every model passes the MSV filter (e.g. a repeat-rich query);
+  compare wall time across --cpu to see whether ReadRest() scales.
  */
 #include "p7_config.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#ifdef HMMER_THREADS
+#include <pthread.h>
+#endif
 
 #include "easel.h"
 #include "esl_getopts.h"
@@ -726,51 +830,125 @@ p7_oprofile_Position(P7_HMMFILE *hfp, off_t offset)
 #include "hmmer.h"
 
 static ESL_OPTIONS options[] = {
-  /* name           type      default  env  range toggles reqs incomp  help                                  docgroup*/
-  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",  0 },
+  /* name           type      default  env  range toggles reqs incomp  help                                         docgroup*/
+  { "-h",        eslARG_NONE,   FALSE, NULL, NULL,  NULL,  NULL, NULL, "show brief help on version and usage",         0 },
+#ifdef HMMER_THREADS
+  { "--cpu",     eslARG_INT,      "1", NULL, "n>0", NULL,  NULL, NULL, "number of threads calling ReadRest()",         0 },
+#endif
   {  0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
 };
-static char usage[]  = "[-options] <HMM MSV profile file>";
+static char usage[]  = "[-options] <pressed HMM database>";
 static char banner[] = "benchmark driver for profile input";
 
+struct rest_thread_s {
+  P7_HMMFILE   *hfp;
+  P7_OPROFILE **om;
+  int           nmodel;
+  int           tid;
+  int           ncpu;
+  int           status;
+};
+
+static void *
+rest_thread(void *arg)
+{
+  struct rest_thread_s *rt = (struct rest_thread_s *) arg;
+  int i;
+
+  rt->status = eslOK;
+  for (i = rt->tid; i < rt->nmodel; i += rt->ncpu)
+    if ((rt->status = p7_oprofile_ReadRest(rt->hfp, rt->om[i])) != eslOK) return NULL;
+  return NULL;
+}
+
 int 
 main(int argc, char **argv)
 {
-  ESL_GETOPTS   *go      = p7_CreateDefaultApp(options, 1, argc, argv, banner, usage);
-  ESL_STOPWATCH *w       = esl_stopwatch_Create();
-  ESL_ALPHABET  *abc     = NULL;
-  char          *msvfile = esl_opt_GetArg(go, 1);
-  FILE          *msvfp   = NULL;
-  P7_OPROFILE   *om      = NULL;
-  int            nmodel  = 0;
-  uint64_t       totM    = 0;
-  int            status;
-
-  esl_stopwatch_Start(w);
+  ESL_GETOPTS          *go      = p7_CreateDefaultApp(options, 1, argc, argv, banner, usage);
+  ESL_STOPWATCH        *w       = esl_stopwatch_Create();
+  ESL_ALPHABET         *abc     = NULL;
+  char                 *hmmfile = esl_opt_GetArg(go, 1);
+  P7_HMMFILE           *hfp     = NULL;
+  P7_OPROFILE         **om      = NULL;
+  P7_OPROFILE          *tmp     = NULL;
+  void                 *p;
+  struct rest_thread_s *rt      = NULL;
+  int                   ncpu    = 1;
+  int                   nalloc  = 0;
+  int                   nmodel  = 0;
+  uint64_t              totM    = 0;
+  int                   i,t;
+  int                   status;
+  char                  errbuf[eslERRBUFSIZE];
+#ifdef HMMER_THREADS
+  pthread_t            *tid     = NULL;
+  ncpu = esl_opt_GetInteger(go, "--cpu");
+#endif
 
-  if ((msvfp = fopen(msvfile, "r")) == NULL) p7_Fail("Failed to open MSV file %s for reading.\n", msvfile);
+  if (p7_hmmfile_OpenE(hmmfile, NULL, &hfp, errbuf) != eslOK) p7_Fail("Failed to open HMM database %s:\n%s\n", hmmfile, errbuf);
+  if (hfp->ffp == NULL || hfp->pfp == NULL)                   p7_Fail("%s isn't pressed; run hmmpress first\n", hmmfile);
 
-  while ((status = p7_oprofile_ReadMSV(msvfp, &abc, NULL, &om)) == eslOK)
+  esl_stopwatch_Start(w);
+  while ((status = p7_oprofile_ReadMSV(hfp, &abc, &tmp)) == eslOK)
     {
-      nmodel++;
-      totM += om->M;
+      if (nmodel == nalloc) {
+	nalloc = (nalloc ? nalloc * 2 : 1024);
+	ESL_RALLOC(om, p, sizeof(P7_OPROFILE *) * nalloc);
+      }
+      om[nmodel++] = tmp;
+      totM        += tmp->M;
+    }
+  if      (status == eslEFORMAT)   p7_Fail("bad file format in profile file %s",           hmmfile);
+  else if (status == eslEINCOMPAT) p7_Fail("profile file %s contains different alphabets", hmmfile);
+  else if (status != eslEOF)       p7_Fail("Unexpected error in reading profiles from %s", hmmfile);
+  esl_stopwatch_Stop(w);
+  esl_stopwatch_Display(stdout, w, "# ReadMSV  CPU time: ");
 
-      p7_oprofile_Destroy(om);
+  ESL_ALLOC(rt, sizeof(struct rest_thread_s) * ncpu);
+  for (t = 0; t < ncpu; t++)
+    {
+      rt[t].hfp    = hfp;
+      rt[t].om     = om;
+      rt[t].nmodel = nmodel;
+      rt[t].tid    = t;
+      rt[t].ncpu   = ncpu;
     }
-  if      (status == eslEFORMAT)   p7_Fail("bad file format in profile file %s",           msvfile);
-  else if (status == eslEINCOMPAT) p7_Fail("profile file %s contains different alphabets", msvfile);
-  else if (status != eslEOF)       p7_Fail("Unexpected error in reading profiles from %s", msvfile);
 
+  esl_stopwatch_Start(w);
+#ifdef HMMER_THREADS
+  if (ncpu > 1) p7_hmmfile_CreateLock(hfp);
+  ESL_ALLOC(tid, sizeof(pthread_t) * ncpu);
+  for (t = 0; t < ncpu; t++) 
+    if (pthread_create(&tid[t], NULL, rest_thread, &rt[t]) != 0) p7_Fail("pthread_create() failed");
+  for (t = 0; t < ncpu; t++) 
+    pthread_join(tid[t], NULL);
+#else
+  rest_thread(&rt[0]);
+#endif
   esl_stopwatch_Stop(w);
-  esl_stopwatch_Display(stdout, w, "# CPU time: ");
-  printf("# number of models: %d\n", nmodel);
-  printf("# total M:          %" PRId64 "\n", totM);
+  for (t = 0; t < ncpu; t++)
+    if (rt[t].status != eslOK) p7_Fail("ReadRest() failed:\n%s\n", hfp->errbuf);
+
+  esl_stopwatch_Display(stdout, w, "# ReadRest CPU time: ");
+  printf("# number of threads: %d\n", ncpu);
+  printf("# number of models:  %d\n", nmodel);
+  printf("# total M:           %" PRId64 "\n", totM);
   
-  fclose(msvfp);
+  for (i = 0; i < nmodel; i++) p7_oprofile_Destroy(om[i]);
+#ifdef HMMER_THREADS
+  free(tid);
+#endif
+  free(rt);
+  free(om);
+  p7_hmmfile_Close(hfp);
   esl_alphabet_Destroy(abc);
   esl_stopwatch_Destroy(w);
   esl_getopts_Destroy(go);
   return 0;
+
+ ERROR:
+  p7_Fail("allocation failed");
+  return 1;
 }
 #endif /*IO_BENCHMARK*/
 /*---------------- end, benchmark driver ------------------------*/
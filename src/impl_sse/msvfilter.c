@@ -7,7 +7,7 @@
  * to obtain the score by another (probably slower) method.
  * 
  * Contents:
- *   1. p7_MSVFilter() implementation
+ *   1. p7_MSVFilter() implementation, and the longtarget SSV filters
  *   2. Benchmark driver
  *   3. Unit tests
  *   4. Test driver
@@ -212,6 +212,88 @@ p7_MSVFilter(const ESL_DSQ *dsq, int L, const P7_OPROFILE *om, P7_OMX *ox, float
 
 
 
+/* ssvfilter_capture_window()
+ *
+ * Shared by the longtarget SSV filters: once row <i> has a model state
+ * <end> whose score <rem_sc> crossed threshold, walk back along the
+ * diagonal to find where it started, extend it forward with a
+ * single-diagonal extension, and add the resulting window to
+ * <windowlist>. Residue x of the target is <dsq[x-off]>, so the
+ * packed-target filter can pass a small decoded window around <i>
+ * instead of the whole sequence. Returns the target position at
+ * which the captured diagonal ends, where the caller resumes.
+ */
+static int
+ssvfilter_capture_window(const P7_OPROFILE *om, const P7_SCOREDATA *ssvdata, const ESL_DSQ *dsq, int off,
+                         int i, int L, int end, int rem_sc, P7_HMM_WINDOWLIST *windowlist)
+{
+  int   k, n;
+  int   start;
+  int   target_end;
+  int   target_start;
+  int   max_end;
+  int   max_sc;
+  int   sc;
+  int   pos_since_max;
+  float ret_sc;
+
+  //recover the diagonal that hit threshold
+  start = end;                    // model position
+  target_end = target_start = i;  // target position
+  sc = rem_sc;
+  while (rem_sc > om->base_b - om->tjb_b - om->tbm_b) {
+    rem_sc -= om->bias_b -  ssvdata->ssv_scores[start*om->abc->Kp + dsq[target_start-off]];
+    --start;
+    --target_start;
+  }
+  start++;
+  target_start++;
+
+
+  //extend diagonal further with single diagonal extension
+  k = end+1;
+  n = target_end+1;
+  max_end = target_end;
+  max_sc = sc;
+  pos_since_max = 0;
+  while (k<om->M && n<=L) {
+    sc += om->bias_b -  ssvdata->ssv_scores[k*om->abc->Kp + dsq[n-off]];
+
+    if (sc >= max_sc) {
+      max_sc = sc;
+      max_end = n;
+      pos_since_max=0;
+    } else {
+      pos_since_max++;
+      if (pos_since_max == 5)
+        break;
+    }
+    k++;
+    n++;
+  }
+
+  end  +=  (max_end - target_end);
+  target_end = max_end;
+
+  ret_sc = ((float) (max_sc - om->tjb_b) - (float) om->base_b);
+  ret_sc /= om->scale_b;
+  ret_sc -= 3.0; // that's ~ L \log \frac{L}{L+3}, for our NN,CC,JJ
+
+  p7_hmmwindow_new(  windowlist,
+                     0,                  // sequence_id; used in the FM-based filter, but not here
+                     target_start,       // position in the target at which the diagonal starts
+                     0,                  // position in the target fm_index at which diagonal starts;  not used here, just in FM-based filter
+                     end,                // position in the model at which the diagonal ends
+                     end-start+1 ,       // length of diagonal
+                     ret_sc,             // score of diagonal
+                     p7_NOCOMPLEMENT,    // always p7_NOCOMPLEMENT here;  varies in FM-based filter
+                     L
+                   );
+
+  return target_end;
+}
+
+
 /* Function:  p7_SSVFilter_longtarget()
  * Synopsis:  Finds windows with SSV scores above some threshold (vewy vewy fast, in limited precision)
  *
@@ -275,17 +357,8 @@ p7_SSVFilter_longtarget(const ESL_DSQ *dsq, int L, P7_OPROFILE *om, P7_OMX *ox,
   __m128i tempv;                   /* work vector                                               */
   int cmp;
   int k;
-  int n;
   int end;
   int rem_sc;
-  int start;
-  int target_end;
-  int target_start;
-  int max_end;
-  int max_sc;
-  int sc;
-  int pos_since_max;
-  float ret_sc;
 
   union { __m128i v; uint8_t b[16]; } u;
 
@@ -379,61 +452,7 @@ p7_SSVFilter_longtarget(const ESL_DSQ *dsq, int L, P7_OPROFILE *om, P7_OMX *ox,
           dp[q] = _mm_set1_epi8(0); // while we're here ... this will cause values to get reset to xB in next dp iteration
 	    }
 
-	    //recover the diagonal that hit threshold
-	    start = end;                    // model position
-	    target_end = target_start = i;  // target position
-	    sc = rem_sc;
-	    while (rem_sc > om->base_b - om->tjb_b - om->tbm_b) {
-	      rem_sc -= om->bias_b -  ssvdata->ssv_scores[start*om->abc->Kp + dsq[target_start]];
-	      --start;
-	      --target_start;
-	    }
-	    start++;
-	    target_start++;
-
-
-	    //extend diagonal further with single diagonal extension
-	    k = end+1;
-	    n = target_end+1;
-	    max_end = target_end;
-	    max_sc = sc;
-	    pos_since_max = 0;
-	    while (k<om->M && n<=L) {
-	      sc += om->bias_b -  ssvdata->ssv_scores[k*om->abc->Kp + dsq[n]];
-
-	      if (sc >= max_sc) {
-	        max_sc = sc;
-	        max_end = n;
-	        pos_since_max=0;
-	      } else {
-	        pos_since_max++;
-	        if (pos_since_max == 5)
-	          break;
-	      }
-	      k++;
-	      n++;
-	    }
-
-	    end  +=  (max_end - target_end);
-      //k    +=  (max_end - target_end);
-      target_end = max_end;
-
-      ret_sc = ((float) (max_sc - om->tjb_b) - (float) om->base_b);
-      ret_sc /= om->scale_b;
-      ret_sc -= 3.0; // that's ~ L \log \frac{L}{L+3}, for our NN,CC,JJ
-
-      p7_hmmwindow_new(  windowlist,
-                         0,                  // sequence_id; used in the FM-based filter, but not here
-                         target_start,       // position in the target at which the diagonal starts
-                         0,                  // position in the target fm_index at which diagonal starts;  not used here, just in FM-based filter
-                         end,                // position in the model at which the diagonal ends
-                         end-start+1 ,       // length of diagonal
-                         ret_sc,             // score of diagonal
-                         p7_NOCOMPLEMENT,    // always p7_NOCOMPLEMENT here;  varies in FM-based filter
-                         L
-                       );
-
-      i = target_end; // skip forward
+      i = ssvfilter_capture_window(om, ssvdata, dsq, 0, i, L, end, rem_sc, windowlist); // skip forward
 	  }
 
 
@@ -445,6 +464,182 @@ p7_SSVFilter_longtarget(const ESL_DSQ *dsq, int L, P7_OPROFILE *om, P7_OMX *ox,
 /*------------------ end, p7_SSVFilter_longtarget() ------------------------*/
 
 
+/* packed_decode64()
+ *
+ * Decode 16 bytes of a P7_PACKEDSQ (64 residues, 4/byte, first residue
+ * in the high bits) into 64 digital residues in <out>. Each byte is
+ * shifted and masked four ways to pull out residues 0..3 of every byte
+ * into separate vectors, then those are interleaved back into
+ * sequence order with byte- and word-wide unpacks.
+ */
+static inline void
+packed_decode64(const uint8_t *T, __m128i *out)
+{
+  __m128i mask = _mm_set1_epi8(0x03);
+  __m128i v    = _mm_loadu_si128((const __m128i *) T);
+  __m128i a    = _mm_and_si128(_mm_srli_epi16(v, 6), mask);  /* residue 0 of each byte */
+  __m128i b    = _mm_and_si128(_mm_srli_epi16(v, 4), mask);  /* residue 1 */
+  __m128i c    = _mm_and_si128(_mm_srli_epi16(v, 2), mask);  /* residue 2 */
+  __m128i d    = _mm_and_si128(v,                    mask);  /* residue 3 */
+  __m128i ab_lo = _mm_unpacklo_epi8(a, b);
+  __m128i ab_hi = _mm_unpackhi_epi8(a, b);
+  __m128i cd_lo = _mm_unpacklo_epi8(c, d);
+  __m128i cd_hi = _mm_unpackhi_epi8(c, d);
+
+  out[0] = _mm_unpacklo_epi16(ab_lo, cd_lo);
+  out[1] = _mm_unpackhi_epi16(ab_lo, cd_lo);
+  out[2] = _mm_unpacklo_epi16(ab_hi, cd_hi);
+  out[3] = _mm_unpackhi_epi16(ab_hi, cd_hi);
+}
+
+
+/* Function:  p7_SSVFilter_longtarget_packed()
+ * Synopsis:  p7_SSVFilter_longtarget() on a 2-bit packed target.
+ *
+ * Purpose:   Same as <p7_SSVFilter_longtarget()>, but reads the target
+ *            from packed sequence <psq> rather than from a digital
+ *            sequence, decoding 64 residues at a time into a small
+ *            buffer as the scan goes (and patching in any ambiguity
+ *            runs that overlap the block). This streams a quarter of
+ *            the bytes through the filter's inner loop that the
+ *            unpacked version does. Windows captured are identical.
+ *
+ * Args:      psq        - packed target sequence, 1..psq->L
+ *            om         - optimized profile
+ *            ox         - DP matrix
+ *            ssvdata    - compact representation of substitution scores, for backtracking diagonals
+ *            bg         - the background model, required for translating a P-value threshold into a score threshold
+ *            P          - p-value below which a region is captured as being above threshold
+ *            windowlist - preallocated container for all hits (resized if necessary)
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <ox> allocation is too small.
+ *            <eslEMEM> on allocation failure.
+ */
+int
+p7_SSVFilter_longtarget_packed(const P7_PACKEDSQ *psq, P7_OPROFILE *om, P7_OMX *ox, const P7_SCOREDATA *ssvdata,
+                               P7_BG *bg, double P, P7_HMM_WINDOWLIST *windowlist)
+{
+  register __m128i mpv;            /* previous row values                                       */
+  register __m128i xEv;		   /* E state: keeps max for Mk->E for a single iteration       */
+  register __m128i xBv;		   /* B state: splatted vector of B[i-1] for B->Mk calculations */
+  register __m128i sv;		   /* temp storage of 1 curr row value in progress              */
+  register __m128i biasv;	   /* emission bias in a vector                                 */
+  int L        = psq->L;
+  int i;			   /* counter over sequence positions 1..L                      */
+  int q;			   /* counter over vectors 0..nq-1                              */
+  int Q        = p7O_NQB(om->M);   /* segment length: # of vectors                              */
+  __m128i *dp  = ox->dpb[0];	   /* we're going to use dp[0][0..q..Q-1], not {MDI}MX(q) macros*/
+  __m128i *rsc;			   /* will point at om->rbv[x] for residue x[i]                 */
+  __m128i tjbmv;                   /* vector for J->B move cost + B->M move costs               */
+  __m128i basev;                   /* offset for scores                                         */
+  __m128i ceilingv;                /* saturated simd value used to test for overflow           */
+  __m128i tempv;                   /* work vector                                               */
+  union { __m128i v[4]; ESL_DSQ x[64]; } blk;  /* current block of decoded residues             */
+  int      blk_start = 1;          /* target position of blk.x[0]                               */
+  int      blk_end   = 0;          /* target position of blk.x[63]; 0 = nothing decoded yet     */
+  int      a         = 0;          /* first ambiguity run that may overlap the current block    */
+  int      b;
+  int64_t  j;
+  ESL_DSQ *win       = NULL;       /* decoded window around a hit, for diagonal recovery        */
+  int      lo;
+  int cmp;
+  int k;
+  int end;
+  int rem_sc;
+  float nullsc;
+  __m128i sc_threshv;
+  uint8_t sc_thresh;
+  float invP = esl_gumbel_invsurv(P, om->evparam[p7_MMU],  om->evparam[p7_MLAMBDA]);
+  int   status;
+
+  union { __m128i v; uint8_t b[16]; } u;
+
+  /* Check that the DP matrix is ok for us. */
+  if (Q > ox->allocQ16)  ESL_EXCEPTION(eslEINVAL, "DP matrix allocated too small");
+  ox->M   = om->M;
+
+  ESL_ALLOC(win, sizeof(ESL_DSQ) * (2*om->M + 3));
+
+  /* score threshold: see p7_SSVFilter_longtarget() */
+  p7_bg_SetLength(bg, om->max_length);
+  p7_oprofile_ReconfigMSVLength(om, om->max_length);
+  p7_bg_NullOne  (bg, NULL, om->max_length, &nullsc);
+
+  sc_thresh = (int) ceil( ( ( nullsc  + (invP * eslCONST_LOG2) + 3.0 )  * om->scale_b ) + om->base_b +  om->tec_b  + om->tjb_b );
+  sc_threshv = _mm_set1_epi8((int8_t) 255 - sc_thresh);
+
+  biasv = _mm_set1_epi8((int8_t) om->bias_b);
+  ceilingv = _mm_cmpeq_epi8(biasv, biasv);
+  for (q = 0; q < Q; q++) dp[q] = _mm_setzero_si128();
+
+  basev = _mm_set1_epi8((int8_t) om->base_b);
+  tjbmv = _mm_set1_epi8((int8_t) om->tjb_b + (int8_t) om->tbm_b);
+
+  xBv = _mm_subs_epu8(basev, tjbmv);
+
+  for (i = 1; i <= L; i++) {
+    if (i > blk_end) {  /* decode the 64-residue block holding i, then patch ambiguities into it */
+      blk_start = ((i-1) & ~63) + 1;
+      blk_end   = blk_start + 63;
+      packed_decode64(psq->T + (blk_start-1)/4, blk.v);
+
+      while (a < psq->namb && psq->amb_start[a] + psq->amb_len[a] <= blk_start) a++;
+      for (b = a; b < psq->namb && psq->amb_start[b] <= blk_end; b++)
+        for (j = ESL_MAX(blk_start, psq->amb_start[b]); j < ESL_MIN(blk_end+1, psq->amb_start[b] + psq->amb_len[b]); j++)
+          blk.x[j-blk_start] = psq->amb_code[b];
+    }
+
+    rsc = om->rbv[blk.x[i-blk_start]];
+    xEv = _mm_setzero_si128();
+
+    mpv = _mm_slli_si128(dp[Q-1], 1);
+    for (q = 0; q < Q; q++) {
+      sv   = _mm_max_epu8(mpv, xBv);
+      sv   = _mm_adds_epu8(sv, biasv);
+      sv   = _mm_subs_epu8(sv, *rsc);   rsc++;
+      xEv  = _mm_max_epu8(xEv, sv);
+
+      mpv   = dp[q];
+      dp[q] = sv;
+    }
+
+    tempv = _mm_adds_epu8(xEv, sc_threshv);
+    tempv = _mm_cmpeq_epi8(tempv, ceilingv);
+    cmp = _mm_movemask_epi8(tempv);
+
+    if (cmp != 0) {  //hit pthresh, so add position to list and reset values
+      end = -1;
+      rem_sc = -1;
+      for (q = 0; q < Q; q++) {
+        u.v = dp[q];
+        for (k = 0; k < 16; k++) {
+          if (u.b[k] >= sc_thresh && u.b[k] > rem_sc && (q+Q*k+1) <= om->M) {
+            end = (q+Q*k+1);
+            rem_sc = u.b[k];
+          }
+        }
+        dp[q] = _mm_set1_epi8(0);
+      }
+
+      /* the diagonal reaches at most M back and M forward of i; decode just that */
+      lo = i - om->M - 1;
+      p7_packedsq_Decode(psq, lo, 2*om->M + 3, win);
+      i = ssvfilter_capture_window(om, ssvdata, win, lo, i, L, end, rem_sc, windowlist); // skip forward
+    }
+  } /* end loop over sequence residues 1..L */
+
+  free(win);
+  return eslOK;
+
+ ERROR:
+  if (win) free(win);
+  return status;
+}
+/*------------------ end, p7_SSVFilter_longtarget_packed() ------------------*/
+
+
 
 
 /*****************************************************************
@@ -654,6 +849,42 @@ utest_msv_filter(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M, int L,
   p7_profile_Destroy(gm);
   p7_oprofile_Destroy(om);
 }
+/* utest_msv_gain()
+ * p7_oprofile_MSVScoreGain() gives 0 for a profile against itself,
+ * and for two random profiles of the same length <M>, the new
+ * profile's MSV score of any sequence of length <L> is no more than
+ * the old one's plus L*gain (the bound jackhmmer --incremental relies on).
+ */
+static void
+utest_msv_gain(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M, int L, int N)
+{
+  P7_OPROFILE *om1 = NULL;
+  P7_OPROFILE *om2 = NULL;
+  ESL_DSQ     *dsq = malloc(sizeof(ESL_DSQ) * (L+2));
+  P7_OMX      *ox  = p7_omx_Create(M, 0, 0);
+  float        gain;
+  float        sc1, sc2;
+
+  p7_oprofile_Sample(r, abc, bg, M, L, NULL, NULL, &om1);
+  p7_oprofile_Sample(r, abc, bg, M, L, NULL, NULL, &om2);
+
+  if (p7_oprofile_MSVScoreGain(om1, om1, &gain) != eslOK) esl_fatal("msv gain unit test failed: profile not comparable to itself");
+  if (gain != 0.0)                                         esl_fatal("msv gain unit test failed: nonzero gain %f against itself", gain);
+  if (p7_oprofile_MSVScoreGain(om1, om2, &gain) != eslOK) esl_fatal("msv gain unit test failed: same-length profiles not comparable");
+
+  while (N--)
+    {
+      esl_rsq_xfIID(r, bg->f, abc->K, L, dsq);
+      if (p7_MSVFilter(dsq, L, om1, ox, &sc1) == eslERANGE) continue; /* overflow: no bound to test */
+      if (p7_MSVFilter(dsq, L, om2, ox, &sc2) == eslERANGE) continue;
+      if (sc2 > sc1 + (float) L * gain + 0.001) esl_fatal("msv gain unit test failed: %.2f > %.2f + %d * %.4f", sc2, sc1, L, gain);
+    }
+
+  free(dsq);
+  p7_omx_Destroy(ox);
+  p7_oprofile_Destroy(om1);
+  p7_oprofile_Destroy(om2);
+}
 #endif /*p7MSVFILTER_TESTDRIVE*/
 /*-------------------- end, unit tests --------------------------*/
 
@@ -709,6 +940,7 @@ main(int argc, char **argv)
   utest_msv_filter(r, abc, bg, M, L, N);   /* normal sized models */
   utest_msv_filter(r, abc, bg, 1, L, 10);  /* size 1 models       */
   utest_msv_filter(r, abc, bg, M, 1, 10);  /* size 1 sequences    */
+  utest_msv_gain  (r, abc, bg, M, L, N);
 
   esl_alphabet_Destroy(abc);
   p7_bg_Destroy(bg);
@@ -720,6 +952,7 @@ main(int argc, char **argv)
   utest_msv_filter(r, abc, bg, M, L, N);   
   utest_msv_filter(r, abc, bg, 1, L, 10);  
   utest_msv_filter(r, abc, bg, M, 1, 10);  
+  utest_msv_gain  (r, abc, bg, M, L, N);
 
   esl_alphabet_Destroy(abc);
   p7_bg_Destroy(bg);
@@ -1881,6 +1881,67 @@ p7_oprofile_Compare(const P7_OPROFILE *om1, const P7_OPROFILE *om2, float tol, c
 }
 
 
+/* Function:  p7_oprofile_MSVScoreGain()
+ * Synopsis:  Bound how much MSV scores can rise from one profile to another.
+ *
+ * Purpose:   For an old profile <om1> and a new one <om2>, calculate
+ *            <*ret_gain>, an upper bound in nats on how much the
+ *            <p7_MSVFilter()> score of any target can rise per residue
+ *            when it's scored with <om2> instead of <om1>. For a
+ *            target of length <L>, <sc2 <= sc1 + L * gain>.
+ *
+ *            MSV paths are ungapped, so each residue is emitted by at
+ *            most one match state; each DP cell in row <i> can then
+ *            rise by at most <i> times the largest increase of any
+ *            biased match emission byte, <(bias2 - rbv2) - (bias1 - rbv1)>,
+ *            over real positions <1..M>. Flooring at 0 keeps that
+ *            true; saturating at 255 is an overflow, which
+ *            <p7_MSVFilter()> reports as a pass anyway.
+ *
+ *            The transitions have to be the same for the bound to
+ *            hold, so the profiles must have the same <M>, <nj> and
+ *            byte scale, base and transition costs, and be configured
+ *            for the same target length when they're used.
+ *
+ * Returns:   <eslOK> on success, and <*ret_gain> is >= 0.
+ *            <eslEINCOMPAT> if the profiles aren't comparable, and
+ *            <*ret_gain> is -1.
+ */
+int
+p7_oprofile_MSVScoreGain(const P7_OPROFILE *om1, const P7_OPROFILE *om2, float *ret_gain)
+{
+  int Q16  = p7O_NQB(om1->M);
+  int dmax = 0;
+  int d;
+  int x, q, z;
+  union { __m128i v; uint8_t c[16]; } a16, b16;
+
+  if (om1->M         != om2->M         ||
+      om1->nj        != om2->nj        ||
+      om1->abc->type != om2->abc->type ||
+      om1->scale_b   != om2->scale_b   ||
+      om1->base_b    != om2->base_b    ||
+      om1->tbm_b     != om2->tbm_b     ||
+      om1->tec_b     != om2->tec_b)
+    { *ret_gain = -1.0; return eslEINCOMPAT; }
+
+  for (x = 0; x < om1->abc->Kp; x++)
+    for (q = 0; q < Q16; q++)
+      {
+	a16.v = om1->rbv[x][q]; b16.v = om2->rbv[x][q];
+	for (z = 0; z < 16; z++)
+	  {
+	    if (z*Q16 + q + 1 > om1->M) continue; /* striping pad: -inf in both */
+	    d    = ((int) om2->bias_b - (int) b16.c[z]) - ((int) om1->bias_b - (int) a16.c[z]);
+	    dmax = ESL_MAX(dmax, d);
+	  }
+      }
+
+  *ret_gain = (float) dmax / om1->scale_b;
+  return eslOK;
+}
+
+
 /* Function:  p7_profile_SameAsMF()
  * Synopsis:  Set a generic profile's scores to give MSV scores.
  * Incept:    SRE, Wed Jul 30 13:42:49 2008 [Janelia]
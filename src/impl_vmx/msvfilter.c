@@ -449,6 +449,37 @@ p7_SSVFilter_longtarget(const ESL_DSQ *dsq, int L, P7_OPROFILE *om, P7_OMX *ox,
 /*------------------ end, p7_SSVFilter_longtarget() ------------------------*/
 
 
+/* Function:  p7_SSVFilter_longtarget_packed()
+ * Synopsis:  p7_SSVFilter_longtarget() on a 2-bit packed target.
+ *
+ * Purpose:   Unpack <psq> into a temporary digital sequence and run
+ *            <p7_SSVFilter_longtarget()> on it. There's no VMX
+ *            decoder for packed targets yet, so this saves nothing;
+ *            it exists so that callers can use packed targets with
+ *            any implementation.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_SSVFilter_longtarget_packed(const P7_PACKEDSQ *psq, P7_OPROFILE *om, P7_OMX *ox, const P7_SCOREDATA *ssvdata,
+                               P7_BG *bg, double P, P7_HMM_WINDOWLIST *windowlist)
+{
+  ESL_DSQ *dsq = NULL;
+  int      status;
+
+  ESL_ALLOC(dsq, sizeof(ESL_DSQ) * (psq->L+2));
+  p7_packedsq_Decode(psq, 0, psq->L+2, dsq);
+  status = p7_SSVFilter_longtarget(dsq, psq->L, om, ox, ssvdata, bg, P, windowlist);
+  free(dsq);
+  return status;
+
+ ERROR:
+  return status;
+}
+
+
 /*****************************************************************
  * 2. Benchmark driver.
  *****************************************************************/
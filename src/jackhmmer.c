@@ -17,6 +17,7 @@
 #include "esl_sq.h"
 #include "esl_sqio.h"
 #include "esl_stopwatch.h"
+#include "esl_vectorops.h"
 
 #ifdef HAVE_MPI
 #include "mpi.h"
@@ -30,6 +31,7 @@
 #endif /*HMMER_THREADS*/
 
 #include "hmmer.h"
+#include "cachedb.h"
 
 typedef struct {
 #ifdef HMMER_THREADS
@@ -39,8 +41,19 @@ typedef struct {
   P7_PIPELINE      *pli;
   P7_TOPHITS       *th;
   P7_OPROFILE      *om;
+  P7_SEQCACHE      *tcache;	/* resident target database (--cache), or NULL */
 } WORKER_INFO;
 
+#ifdef HMMER_THREADS
+/* With --cache, work units are runs of sequences in the resident
+ * target database, not blocks of freshly parsed sequences.
+ */
+typedef struct {
+  uint32_t          start;	/* first sequence, index in tcache->list */
+  uint32_t          count;	/* number of sequences; 0 = no more work */
+} CACHE_BLOCK;
+#endif
+
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
 #define DOMREPOPTS  "--domE,--domT,--cut_ga,--cut_nc,--cut_tc"
 #define INCOPTS     "--incE,--incT,--cut_ga,--cut_nc,--cut_tc"
@@ -58,6 +71,12 @@ typedef struct {
 #define MPIOPTS     NULL
 #endif
 
+#ifdef HAVE_MPI
+#define CACHEOPTS   "--mpi"
+#else
+#define CACHEOPTS   NULL
+#endif
+
 static ESL_OPTIONS options[] = {
   /* name           type              default   env  range   toggles     reqs   incomp                             help                                                  docgroup*/
   { "-h",           eslARG_NONE,        FALSE, NULL, NULL,      NULL,    NULL,  NULL,            "show brief help on version and usage",                         1 },
@@ -137,6 +156,8 @@ static ESL_OPTIONS options[] = {
   { "--seed",       eslARG_INT,          "42", NULL, "n>=0",    NULL,    NULL,  NULL,            "set RNG seed to <n> (if 0: one-time arbitrary seed)",         12 },
   { "--qformat",    eslARG_STRING,       NULL, NULL, NULL,      NULL,    NULL,  NULL,            "assert query <seqfile> is in format <s>: no autodetection",   12 },
   { "--tformat",    eslARG_STRING,       NULL, NULL, NULL,      NULL,    NULL,  NULL,            "assert target <seqdb> is in format <s>>: no autodetection",   12 },
+  { "--cache",      eslARG_NONE,        FALSE, NULL, NULL,      NULL,    NULL,  CACHEOPTS,       "load <seqdb> into memory once, and search it in every round", 12 },
+  { "--incremental",eslARG_NONE,        FALSE, NULL, NULL,      NULL,"--cache", NULL,            "skip targets whose last MSV score provably can't pass F1",    12 },
 
 #ifdef HMMER_THREADS
   { "--cpu",        eslARG_INT,       NULL,"HMMER_NCPU","n>=0", NULL,    NULL,  CPUOPTS,         "number of parallel CPU workers to use for multithreads",      12 },
@@ -169,11 +190,15 @@ struct cfg_s {
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
 static int  serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp);
+static int  serial_cache_loop(WORKER_INFO *info, P7_SEQCACHE *tcache);
+static void scan_cached_seq(WORKER_INFO *info, HMMER_SEQ *hs, ESL_SQ *dbsq);
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
 static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp);
+static int  thread_cache_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, P7_SEQCACHE *tcache);
 static void pipeline_thread(void *arg);
+static void cache_pipeline_thread(void *arg);
 #endif /*HMMER_THREADS*/
 
 #ifdef HAVE_MPI
@@ -338,6 +363,8 @@ output_header(FILE *ofp, ESL_GETOPTS *go, char *qfile, char *dbfile)
     }
   if (esl_opt_IsUsed(go, "--qformat")    && fprintf(ofp, "# query <seqfile> format asserted: %s\n",             esl_opt_GetString(go, "--qformat"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--tformat")    && fprintf(ofp, "# target <seqdb> format asserted:  %s\n",             esl_opt_GetString(go, "--tformat"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--cache")      && fprintf(ofp, "# target database held in memory:  yes\n")                                                  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--incremental")&& fprintf(ofp, "# skip targets by MSV score bound: yes\n")                                                  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #ifdef HMMER_THREADS
   if (esl_opt_IsUsed(go, "--cpu")        && fprintf(ofp, "# number of worker threads:        %d\n",             esl_opt_GetInteger(go, "--cpu"))      < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
 #endif
@@ -420,6 +447,7 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   int              dbformat = eslSQFILE_UNKNOWN;  /* format of dbfile                                */
   ESL_SQFILE      *qfp      = NULL;		  /* open qfile                                      */
   ESL_SQFILE      *dbfp     = NULL;               /* open dbfile                                     */
+  P7_SEQCACHE     *tcache   = NULL;               /* resident target database (--cache)              */
   ESL_ALPHABET    *abc      = NULL;               /* sequence alphabet                               */
   P7_BG           *bg       = NULL;		  /* null model                                      */
   P7_BUILDER      *bld      = NULL;               /* HMM construction configuration                  */
@@ -438,11 +466,20 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   int              i;
   int              ncpus    = 0;
+  char             errbuf[eslERRBUFSIZE];
+
+  int              do_incr  = esl_opt_GetBoolean(go, "--incremental");
+  P7_OPROFILE     *prv_om   = NULL;               /* last round's model (--incremental)              */
+  float           *msvsc[2] = { NULL, NULL };     /* per-target MSV scores: last round, this round   */
+  float           *swapsc;
+  float            msv_gain = -1.0;
 
   int              infocnt  = 0;
   WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
   ESL_SQ_BLOCK    *block    = NULL;
+  CACHE_BLOCK     *cblock   = NULL;
+  void            *qblock   = NULL;
   ESL_THREADS     *threadObj= NULL;
   ESL_WORK_QUEUE  *queue    = NULL;
 #endif
@@ -497,8 +534,31 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
   else if (status != eslOK)        p7_Fail("Unexpected error %d opening target sequence database file %s\n", status, cfg->dbfile);
   
-  if (! esl_sqfile_IsRewindable(dbfp)) 
-    p7_Fail("Target sequence file %s isn't rewindable; jackhmmer requires that it is", cfg->dbfile);
+  /* With --cache, parse and digitize the targets once, now, and search
+   * the resident copy in every round; then the file needn't be
+   * rewindable (stdin and .gz are fine).
+   */
+  if (esl_opt_GetBoolean(go, "--cache"))
+    {
+      status = p7_seqcache_Read(dbfp, &tcache, errbuf);
+      if      (status == eslEFORMAT) p7_Fail("Parse failed (sequence file %s):\n%s\n", cfg->dbfile, errbuf);
+      else if (status != eslOK)      p7_Fail("Unexpected error %d caching sequence file %s", status, cfg->dbfile);
+      esl_sqfile_Close(dbfp);
+      dbfp = NULL;
+
+      /* --incremental keeps each target's MSV score (or an upper bound
+       * on it) from one round to bound it in the next. 
+       */
+      if (do_incr)
+	{
+	  ESL_ALLOC(msvsc[0], sizeof(float) * (tcache->count+1));
+	  ESL_ALLOC(msvsc[1], sizeof(float) * (tcache->count+1));
+	  esl_vec_FSet(msvsc[0], tcache->count+1, eslINFINITY);
+	  esl_vec_FSet(msvsc[1], tcache->count+1, eslINFINITY);
+	}
+    }
+  else if (! esl_sqfile_IsRewindable(dbfp)) 
+    p7_Fail("Target sequence file %s isn't rewindable; jackhmmer requires that it is (or use --cache)", cfg->dbfile);
 
   /* Open the query sequence file  */
   status = esl_sqfile_OpenDigital(abc, cfg->qfile, qformat, NULL, &qfp);
@@ -515,7 +575,7 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   if (ncpus > 0)
     {
-      threadObj = esl_threads_Create(&pipeline_thread);
+      threadObj = esl_threads_Create(tcache ? &cache_pipeline_thread : &pipeline_thread);
       queue = esl_workqueue_Create(ncpus * 2);
     }
 #endif
@@ -532,6 +592,7 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
       info[i].th    = NULL;
       info[i].om    = NULL;
       info[i].bg    = p7_bg_Clone(bg);
+      info[i].tcache = tcache;
 #ifdef HMMER_THREADS
       info[i].queue = queue;
 #endif
@@ -540,13 +601,23 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 #ifdef HMMER_THREADS
   for (i = 0; i < ncpus * 2; ++i)
     {
-      block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
-      if (block == NULL) 
+      if (tcache)
 	{
-	  p7_Fail("Failed to allocate sequence block");
+	  ESL_ALLOC(cblock, sizeof(CACHE_BLOCK));
+	  cblock->start = cblock->count = 0;
+	  qblock = cblock;
+	}
+      else
+	{
+	  block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
+	  if (block == NULL) 
+	    {
+	      p7_Fail("Failed to allocate sequence block");
+	    }
+	  qblock = block;
 	}
 
-      status = esl_workqueue_Init(queue, block);
+      status = esl_workqueue_Init(queue, qblock);
       if (status != eslOK) 
 	{
 	  p7_Fail("Failed to add block to work queue");
@@ -577,7 +648,10 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	{       /* We enter each iteration with an optimized profile. */
 	  esl_stopwatch_Start(w);
 
-	  if (om        != NULL) p7_oprofile_Destroy(om);
+	  if (prv_om    != NULL) p7_oprofile_Destroy(prv_om);
+	  prv_om = NULL;
+	  if (om        != NULL && do_incr) prv_om = om; /* keep it, to bound score changes against the new model */
+	  else if (om   != NULL) p7_oprofile_Destroy(om);
 	  if (info->pli != NULL) p7_pipeline_Destroy(info->pli);
 	  if (info->th  != NULL) p7_tophits_Destroy(info->th);
 	  if (info->om  != NULL) p7_oprofile_Destroy(info->om);
@@ -614,6 +688,12 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	    hmm = NULL;
 	  }
 
+	  /* With --incremental, bound how far MSV scores can have risen
+	   * since last round. Only possible if the model kept its
+	   * length; otherwise this round scores every target afresh.
+	   */
+	  if (prv_om != NULL && p7_oprofile_MSVScoreGain(prv_om, om, &msv_gain) != eslOK) msv_gain = -1.0;
+
 	  /* Create new processing pipeline and top hits list; destroy old. (TODO: reuse rather than recreate) */
 	  for (i = 0; i < infocnt; ++i)
 	    {
@@ -621,6 +701,13 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	      info[i].om  = p7_oprofile_Clone(om);
 	      info[i].pli = p7_pipeline_Create(go, om->M, 400, FALSE, p7_SEARCH_SEQS); /* 400 is a dummy length for now */
 	      p7_pli_NewModel(info[i].pli, info[i].om, info[i].bg);
+	      if (do_incr)
+		{
+		  info[i].pli->msv_prvsc = (prv_om != NULL && msv_gain >= 0.0) ? msvsc[0] : NULL;
+		  info[i].pli->msv_cursc = msvsc[1];
+		  info[i].pli->msv_nsc   = tcache->count;
+		  info[i].pli->msv_gain  = msv_gain;
+		}
 
 #ifdef HMMER_THREADS
 	      if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
@@ -628,10 +715,13 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	    }
 
 #ifdef HMMER_THREADS
-	  if (ncpus > 0) sstatus = thread_loop(threadObj, queue, dbfp);
-	  else           sstatus = serial_loop(info, dbfp);
+	  if      (ncpus > 0 && tcache) sstatus = thread_cache_loop(threadObj, queue, tcache);
+	  else if (ncpus > 0)           sstatus = thread_loop(threadObj, queue, dbfp);
+	  else if (tcache)              sstatus = serial_cache_loop(info, tcache);
+	  else                          sstatus = serial_loop(info, dbfp);
 #else
-	  sstatus = serial_loop(info, dbfp);
+	  if (tcache) sstatus = serial_cache_loop(info, tcache);
+	  else        sstatus = serial_loop(info, dbfp);
 #endif
 	  switch(sstatus)
 	    {
@@ -658,6 +748,9 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	      p7_oprofile_Destroy(info[i].om);
 	    }
 
+	  /* This round's MSV scores are the next round's starting point */
+	  if (do_incr) { swapsc = msvsc[0]; msvsc[0] = msvsc[1]; msvsc[1] = swapsc; }
+
 	  /* Print the results. */
 	  p7_tophits_SortBySortkey(info->th);
 	  p7_tophits_Threshold(info->th, info->pli);
@@ -693,7 +786,7 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 	  else if (iteration < maxiterations)
 	    { if (fprintf(ofp, "@@ Continuing to next round.\n\n")           < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed"); }
 
-	  esl_sqfile_Position(dbfp, 0);
+	  if (dbfp) esl_sqfile_Position(dbfp, 0);
 	} /* end iteration loop */
 
       /* Because we destroy/create the hitlist, om, pipeline, and msa above, rather than create/destroy,
@@ -721,10 +814,12 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
       esl_msa_Destroy(msa);
       p7_oprofile_Destroy(om);
+      if (prv_om) p7_oprofile_Destroy(prv_om);
+      prv_om = NULL;
       p7_trace_Destroy(qtr);
       esl_sq_Reuse(qsq);
       esl_keyhash_Reuse(kh);
-      esl_sqfile_Position(dbfp, 0);
+      if (dbfp) esl_sqfile_Position(dbfp, 0);
     }
   if      (qstatus == eslEFORMAT) p7_Fail("Parse failed (sequence file %s):\n%s\n",
 					    qfp->filename, esl_sqfile_GetErrorBuf(qfp));
@@ -746,8 +841,11 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (ncpus > 0)
     {
       esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	esl_sq_DestroyBlock(block);
+      while (esl_workqueue_Remove(queue, &qblock) == eslOK)
+	{
+	  if (tcache) free(qblock);
+	  else        esl_sq_DestroyBlock((ESL_SQ_BLOCK *) qblock);
+	}
       esl_workqueue_Destroy(queue);
       esl_threads_Destroy(threadObj);
     }
@@ -757,7 +855,10 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   esl_keyhash_Destroy(kh);
   esl_sqfile_Close(qfp);
-  esl_sqfile_Close(dbfp);
+  if (dbfp)   esl_sqfile_Close(dbfp);
+  if (tcache) p7_seqcache_Close(tcache);
+  if (msvsc[0]) free(msvsc[0]);
+  if (msvsc[1]) free(msvsc[1]);
   esl_sq_Destroy(qsq);  
   esl_stopwatch_Destroy(w);
   p7_builder_Destroy(bld);
@@ -1604,6 +1705,50 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp)
   return sstatus;
 }
 
+/* serial_cache_loop()
+ * Same as serial_loop(), over the resident sequences of <tcache>.
+ */
+static int
+serial_cache_loop(WORKER_INFO *info, P7_SEQCACHE *tcache)
+{
+  ESL_SQ    dbsq;
+  uint32_t  i;
+
+  for (i = 0; i < tcache->count; i++)
+    scan_cached_seq(info, &tcache->list[i], &dbsq);
+  return eslEOF;
+}
+
+/* scan_cached_seq()
+ * Run the pipeline on one resident target <hs>. <dbsq> is caller's
+ * scratch ESL_SQ shell; it's pointed at the cache's name, accession,
+ * description and residues, so nothing is copied or freed.
+ */
+static void
+scan_cached_seq(WORKER_INFO *info, HMMER_SEQ *hs, ESL_SQ *dbsq)
+{
+  memset(dbsq, 0, sizeof(ESL_SQ));
+  dbsq->name   = hs->name;
+  dbsq->acc    = hs->acc;
+  dbsq->desc   = hs->desc;
+  dbsq->source = "";
+  dbsq->dsq    = hs->dsq;
+  dbsq->n      = hs->n;
+  dbsq->L      = hs->n;
+  dbsq->start  = 1;
+  dbsq->end    = hs->n;
+  dbsq->idx    = hs->idx;
+  dbsq->abc    = info->om->abc;
+
+  p7_pli_NewSeq(info->pli, dbsq);
+  p7_bg_SetLength(info->bg, dbsq->n);
+  p7_oprofile_ReconfigLength(info->om, dbsq->n);
+
+  p7_Pipeline(info->pli, info->om, info->bg, dbsq, NULL, info->th);
+
+  p7_pipeline_Reuse(info->pli);
+}
+
 #ifdef HMMER_THREADS
 static int
 thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp)
@@ -1705,6 +1850,100 @@ pipeline_thread(void *arg)
   esl_threads_Finished(obj, workeridx);
   return;
 }
+
+/* thread_cache_loop()
+ * Same as thread_loop(), but instead of parsing blocks of sequences
+ * the reader just hands out runs of up to BLOCK_SIZE sequences of
+ * the resident <tcache>.
+ */
+static int
+thread_cache_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, P7_SEQCACHE *tcache)
+{
+  int          status   = eslOK;
+  int          sstatus  = eslOK;
+  int          eofCount = 0;
+  uint32_t     next     = 0;
+  CACHE_BLOCK *block;
+  void        *newBlock;
+
+  esl_workqueue_Reset(queue);
+  esl_threads_WaitForStart(obj);
+
+  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
+  if (status != eslOK) p7_Fail("Work queue reader failed");
+
+  /* Main loop: */
+  while (sstatus == eslOK)
+    {
+      block        = (CACHE_BLOCK *) newBlock;
+      block->start = next;
+      block->count = ESL_MIN(BLOCK_SIZE, tcache->count - next);
+      next        += block->count;
+
+      if (block->count == 0)
+	{
+	  if (eofCount >= esl_threads_GetWorkerCount(obj)) sstatus = eslEOF;
+	  ++eofCount;
+	}
+
+      if (sstatus == eslOK)
+	{
+	  status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
+	  if (status != eslOK) p7_Fail("Work queue reader failed");
+	}
+    }
+
+  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
+  if (status != eslOK) p7_Fail("Work queue reader failed");
+
+  /* wait for all the threads to complete */
+  esl_threads_WaitForFinish(obj);
+  esl_workqueue_Complete(queue);  
+  return sstatus;
+}
+
+static void 
+cache_pipeline_thread(void *arg)
+{
+  uint32_t       i;
+  int            status;
+  int            workeridx;
+  WORKER_INFO   *info;
+  ESL_THREADS   *obj;
+  ESL_SQ         dbsq;
+
+  CACHE_BLOCK   *block = NULL;
+  void          *newBlock;
+
+  impl_Init();
+
+  obj = (ESL_THREADS *) arg;
+  esl_threads_Started(obj, &workeridx);
+
+  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+
+  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
+  if (status != eslOK) p7_Fail("Work queue worker failed");
+
+  /* loop until all blocks have been processed */
+  block = (CACHE_BLOCK *) newBlock;
+  while (block->count > 0)
+    {
+      for (i = block->start; i < block->start + block->count; ++i)
+	scan_cached_seq(info, &info->tcache->list[i], &dbsq);
+
+      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
+      if (status != eslOK) p7_Fail("Work queue worker failed");
+
+      block = (CACHE_BLOCK *) newBlock;
+    }
+
+  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
+  if (status != eslOK) p7_Fail("Work queue worker failed");
+
+  esl_threads_Finished(obj, workeridx);
+  return;
+}
 #endif   /* HMMER_THREADS */
 
 
@@ -833,6 +833,10 @@ p7_pipeline_MPIRecv(int source, int tag, MPI_Comm comm, char **buf, int *nalloc,
  *            
  *            After the TOPHITS <th> information has been sent, send
  *            the each hit as an indepentant message.
+ *
+ *            If <th> is bounded and has evicted hits, their P-values,
+ *            scores and flags follow in one more message, so the
+ *            receiver can still count them.
  *            
  * Returns:   <eslOK> on success; <*buf> may have been reallocated and
  *            <*nalloc> may have been increased.
@@ -847,6 +851,7 @@ p7_tophits_MPISend(P7_TOPHITS *th, int dest, int tag, MPI_Comm comm, char **buf,
   int   status;
   int   sz, n, pos;
   int   i, j, inx;
+  int   nev;
 
   P7_DOMAIN *dcl = NULL;
   P7_HIT    *hit = NULL;
@@ -874,9 +879,20 @@ p7_tophits_MPISend(P7_TOPHITS *th, int dest, int tag, MPI_Comm comm, char **buf,
     }
   }
 
-  if (MPI_Pack_size(3, MPI_LONG_LONG_INT, comm, &sz) != 0) ESL_XEXCEPTION(eslESYS, "pack size failed");
+  if (MPI_Pack_size(4, MPI_LONG_LONG_INT, comm, &sz) != 0) ESL_XEXCEPTION(eslESYS, "pack size failed");
   n = (n > sz) ? n : sz;
 
+  /* the evicted hits' message, if any, has to fit too */
+  nev = (int) th->nevicted;
+  if (nev > 0) {
+    int sz1, sz2, sz3;
+    if (MPI_Pack_size(nev, MPI_DOUBLE,   comm, &sz1) != 0) ESL_XEXCEPTION(eslESYS, "pack size failed");
+    if (MPI_Pack_size(nev, MPI_FLOAT,    comm, &sz2) != 0) ESL_XEXCEPTION(eslESYS, "pack size failed");
+    if (MPI_Pack_size(nev, MPI_UNSIGNED, comm, &sz3) != 0) ESL_XEXCEPTION(eslESYS, "pack size failed");
+    sz = sz1 + sz2 + sz3;
+    n = (n > sz) ? n : sz;
+  }
+
   /* Make sure the buffer is allocated appropriately */
   if (*buf == NULL || n > *nalloc) {
     void *tmp;
@@ -888,9 +904,21 @@ p7_tophits_MPISend(P7_TOPHITS *th, int dest, int tag, MPI_Comm comm, char **buf,
   if (MPI_Pack(&th->N,         1, MPI_LONG_LONG_INT, *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
   if (MPI_Pack(&th->nreported, 1, MPI_LONG_LONG_INT, *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
   if (MPI_Pack(&th->nincluded, 1, MPI_LONG_LONG_INT, *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
+  if (MPI_Pack(&th->nevicted,  1, MPI_LONG_LONG_INT, *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
 
   /* Send the packed tophits information */
   if (MPI_Send(*buf, n, MPI_PACKED, dest, tag, comm) != 0) ESL_XEXCEPTION(eslESYS, "mpi send failed");
+
+  /* then what we know of the hits a bounded list evicted */
+  if (nev > 0) {
+    pos = 0;
+    for (i = 0; i < nev; ++i) {
+      if (MPI_Pack(&th->evicted[i].lnP,   1, MPI_DOUBLE,   *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
+      if (MPI_Pack(&th->evicted[i].score, 1, MPI_FLOAT,    *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
+      if (MPI_Pack(&th->evicted[i].flags, 1, MPI_UNSIGNED, *buf, n, &pos, comm) != 0) ESL_XEXCEPTION(eslESYS, "pack failed"); 
+    }
+    if (MPI_Send(*buf, pos, MPI_PACKED, dest, tag, comm) != 0) ESL_XEXCEPTION(eslESYS, "mpi send failed");
+  }
   if (th->N == 0) return eslOK;
 
   /* loop through the hit list sending to dest */
@@ -935,6 +963,7 @@ p7_tophits_MPIRecv(int source, int tag, MPI_Comm comm, char **buf, int *nalloc,
   MPI_Status  mpistatus;
 
   uint64_t    nhits;
+  uint64_t    nevicted;
   uint64_t    inx;
 
   /* Probe first, because we need to know if our buffer is big enough.
@@ -972,6 +1001,29 @@ p7_tophits_MPIRecv(int source, int tag, MPI_Comm comm, char **buf, int *nalloc,
   if (MPI_Unpack(*buf, n, &pos, &nhits,         1, MPI_LONG_LONG_INT, comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
   if (MPI_Unpack(*buf, n, &pos, &th->nreported, 1, MPI_LONG_LONG_INT, comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
   if (MPI_Unpack(*buf, n, &pos, &th->nincluded, 1, MPI_LONG_LONG_INT, comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
+  if (MPI_Unpack(*buf, n, &pos, &nevicted,      1, MPI_LONG_LONG_INT, comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
+
+  /* the sender's evicted hits, if it was bounded */
+  if (nevicted > 0) {
+    MPI_Probe(source, tag, comm, &mpistatus);
+    MPI_Get_count(&mpistatus, MPI_PACKED, &n);
+    if (n > *nalloc) {
+      void *tmp;
+      ESL_RALLOC(*buf, tmp, sizeof(char) * n); 
+      *nalloc = n; 
+    }
+    MPI_Recv(*buf, n, MPI_PACKED, source, tag, comm, &mpistatus);
+
+    ESL_ALLOC(th->evicted, sizeof(P7_EVICTED) * nevicted);
+    th->nevalloc = nevicted;
+    pos = 0;
+    for (inx = 0; inx < nevicted; ++inx) {
+      if (MPI_Unpack(*buf, n, &pos, &th->evicted[inx].lnP,   1, MPI_DOUBLE,   comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
+      if (MPI_Unpack(*buf, n, &pos, &th->evicted[inx].score, 1, MPI_FLOAT,    comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
+      if (MPI_Unpack(*buf, n, &pos, &th->evicted[inx].flags, 1, MPI_UNSIGNED, comm) != 0) ESL_XEXCEPTION(eslESYS, "unpack failed");
+    }
+    th->nevicted = nevicted;
+  }
 
   /* loop through all of the hits sent */
   for (inx = 0; inx < nhits; ++inx) {
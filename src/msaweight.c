@@ -0,0 +1,953 @@
+/* Relative sequence weighting and clustering for deep alignments.
+ *
+ * For a single very deep alignment (tens or hundreds of thousands of
+ * sequences), relative weighting and the single linkage clustering
+ * used by --eclust and BLOSUM weights dominate model construction
+ * time, because hmmbuild otherwise parallelizes only across
+ * alignments. The routines here split those stages across worker
+ * threads within one alignment. Each gives the same result as its
+ * serial Easel counterpart, whatever the number of threads; with
+ * <ncpus> <= 1 (or in a build without threads) they simply call
+ * Easel.
+ *
+ * p7_msacluster_Greedy() is a cheaper alternative to single linkage
+ * for counting clusters: each sequence is compared only to the
+ * cluster representatives chosen so far, longest sequences first.
+ *
+ * The p7_msaweight_PBStream*() routines give the same PB weights for
+ * an alignment too big to hold in memory, read in chunks of
+ * sequences by p7_StreamBuilder().
+ *
+ * Contents:
+ *    1. Relative sequence weights.
+ *    2. Clustering.
+ *    3. Internal functions: running a stage on worker threads.
+ *    4. Unit tests.
+ *    5. Test driver.
+ *    6. Copyright and license information.
+ */
+#include "p7_config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_distance.h"
+#include "esl_msa.h"
+#include "esl_msacluster.h"
+#include "esl_msaweight.h"
+#include "esl_vectorops.h"
+
+#ifdef HMMER_THREADS
+#include "esl_threads.h"
+#endif /*HMMER_THREADS*/
+
+#include "hmmer.h"
+
+/* Each parallel stage is a function <work(data, w, nw)> that does
+ * worker <w>'s share (of <nw>) of the job described by <data>.
+ * Shares are fixed by <w>, not claimed dynamically, so that results
+ * never depend on thread scheduling.
+ */
+typedef void (*STAGE_FUNC)(void *data, int w, int nw);
+
+#ifdef HMMER_THREADS
+typedef struct {
+  STAGE_FUNC  work;
+  void       *data;
+  int         nw;
+} STAGE_INFO;
+
+static void stage_thread(void *arg);
+#endif /*HMMER_THREADS*/
+
+static int  run_stage(STAGE_FUNC work, void *data, int nw);
+
+static void pb_columns(void *data, int w, int nw);
+static void pb_seqs   (void *data, int w, int nw);
+static void sl_rows   (void *data, int w, int nw);
+static void gr_batch  (void *data, int w, int nw);
+
+static void sort_by_length(int *idx, const int64_t *len, int n);
+static int  uf_find (int *p, int x);
+static void uf_union(int *p, int x, int y);
+static int  is_linked(const ESL_MSA *msa, int i, int j, double maxid, int *ret_link);
+
+/* position-based weights */
+typedef struct {
+  ESL_MSA *msa;
+  int     *nres;	/* nres[(apos-1)*K + a]: # of residue a in column apos   */
+  double  *colw;	/* colw[(apos-1)*K + a]: PB weight contribution of that a */
+} PB_DATA;
+
+/* single linkage clustering */
+typedef struct {
+  const ESL_MSA *msa;
+  double         maxid;
+  int          **uf;		/* uf[w][0..nseq-1]: worker w's union-find parents */
+  int           *status;	/* status[w]: worker w's return status             */
+} SL_DATA;
+
+/* greedy clustering, one batch of candidates at a time */
+typedef struct {
+  const ESL_MSA *msa;
+  double         maxid;
+  int           *order;		/* seq indices, longest first                      */
+  int           *rep;		/* representatives chosen so far                   */
+  int            nrep;		/* # of reps visible to workers in this batch      */
+  int            b, e;		/* this batch is order[b..e-1]                     */
+  int           *hit;		/* hit[s-b]: TRUE if order[s] links to a rep       */
+  int           *status;	/* status[w]: worker w's return status             */
+} GR_DATA;
+
+
+/*****************************************************************
+ * 1. Relative sequence weights.
+ *****************************************************************/
+
+/* Function:  p7_msaweight_PB()
+ * Synopsis:  Henikoff position-based weights, using worker threads.
+ *
+ * Purpose:   Calculate Henikoff position-based weights for the
+ *            digital alignment <msa>, storing them in <msa->wgt>,
+ *            exactly as <esl_msaweight_PB()> does, splitting the
+ *            work across <ncpus> worker threads: first by column
+ *            (residue counts), then by sequence (weight sums).
+ *            Each sequence's terms are summed in column order,
+ *            so the weights are the same as Easel's.
+ *
+ *            If <ncpus> <= 1, or <msa> is in text mode, just calls
+ *            <esl_msaweight_PB()>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> if threads
+ *            can't be created.
+ */
+int
+p7_msaweight_PB(ESL_MSA *msa, int ncpus)
+{
+  PB_DATA d;
+  int     status;
+
+  if (ncpus <= 1 || ! (msa->flags & eslMSA_DIGITAL)) return esl_msaweight_PB(msa);
+
+  d.msa  = msa;
+  d.nres = NULL;
+  d.colw = NULL;
+  ESL_ALLOC(d.nres, sizeof(int)    * msa->alen * msa->abc->K);
+  ESL_ALLOC(d.colw, sizeof(double) * msa->alen * msa->abc->K);
+
+  if ((status = run_stage(pb_columns, &d, ncpus)) != eslOK) goto ERROR;
+  if ((status = run_stage(pb_seqs,    &d, ncpus)) != eslOK) goto ERROR;
+
+  /* Normalize to sum to nseq. In the pathological case where no seq
+   * has any canonical residue, all weights become 1.0.
+   */
+  if (esl_vec_DSum(msa->wgt, msa->nseq) > 0.) esl_vec_DNorm(msa->wgt, msa->nseq);
+  else                                         esl_vec_DSet (msa->wgt, msa->nseq, 1.);
+  esl_vec_DScale(msa->wgt, msa->nseq, (double) msa->nseq);
+  msa->flags |= eslMSA_HASWGTS;
+
+  free(d.nres);
+  free(d.colw);
+  return eslOK;
+
+ ERROR:
+  if (d.nres) free(d.nres);
+  if (d.colw) free(d.colw);
+  return status;
+}
+
+
+/* Function:  p7_msaweight_BLOSUM()
+ * Synopsis:  BLOSUM filtering weights, using worker threads.
+ *
+ * Purpose:   Calculate BLOSUM weights for the digital alignment
+ *            <msa> at fractional identity threshold <maxid>: each
+ *            sequence in a single linkage cluster of size <n> gets
+ *            weight <1/n>, then weights are normalized to sum to
+ *            <nseq>. Same as <esl_msaweight_BLOSUM()>, but the
+ *            clustering is done by <p7_msacluster_SingleLinkage()>
+ *            on <ncpus> threads.
+ *
+ *            If <ncpus> <= 1, or <msa> is in text mode, just calls
+ *            <esl_msaweight_BLOSUM()>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> if threads
+ *            can't be created.
+ */
+int
+p7_msaweight_BLOSUM(ESL_MSA *msa, double maxid, int ncpus)
+{
+  int *c   = NULL;
+  int *nin = NULL;
+  int  nc;
+  int  i;
+  int  status;
+
+  if (ncpus <= 1 || ! (msa->flags & eslMSA_DIGITAL)) return esl_msaweight_BLOSUM(msa, maxid);
+  if (msa->nseq == 1) { msa->wgt[0] = 1.0; return eslOK; }
+
+  if ((status = p7_msacluster_SingleLinkage(msa, maxid, ncpus, &c, &nin, &nc)) != eslOK) goto ERROR;
+  for (i = 0; i < msa->nseq; i++) msa->wgt[i] = 1. / (double) nin[c[i]];
+
+  esl_vec_DNorm (msa->wgt, msa->nseq);
+  esl_vec_DScale(msa->wgt, msa->nseq, (double) msa->nseq);
+  msa->flags |= eslMSA_HASWGTS;
+
+  free(nin);
+  free(c);
+  return eslOK;
+
+ ERROR:
+  if (nin) free(nin);
+  if (c)   free(c);
+  return status;
+}
+
+
+/* Function:  p7_msaweight_PBStreamCount()
+ * Synopsis:  Accumulate PB residue counts from one chunk of an alignment.
+ *
+ * Purpose:   Position-based weights for an alignment that's read in
+ *            chunks of sequences (see <p7_StreamBuilder()>) take
+ *            two passes. In the first, call
+ *            <p7_msaweight_PBStreamCount()> on each chunk to add
+ *            its canonical residue counts to <colw>, an array of
+ *            <alen*K> doubles (indexed <(apos-1)*K + a>) that the
+ *            caller zeroes before the first chunk. Then call
+ *            <p7_msaweight_PBStreamFinish()> once. In the second
+ *            pass, <p7_msaweight_PBStreamApply()> sets the weights
+ *            of each chunk.
+ *
+ *            Weights come out the same as <esl_msaweight_PB()>
+ *            would give for the whole alignment, except that they
+ *            aren't normalized; the caller scales them by
+ *            <nseq / sum>, after summing them over all chunks.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_msaweight_PBStreamCount(const ESL_MSA *msa, double *colw)
+{
+  int     K = msa->abc->K;
+  int     idx;
+  int64_t apos;
+
+  for (idx = 0; idx < msa->nseq; idx++)
+    for (apos = 1; apos <= msa->alen; apos++)
+      if (esl_abc_XIsCanonical(msa->abc, msa->ax[idx][apos]))
+	colw[(apos-1)*K + msa->ax[idx][apos]] += 1.;
+  return eslOK;
+}
+
+/* Function:  p7_msaweight_PBStreamFinish()
+ * Synopsis:  Turn streamed PB residue counts into per-residue weight terms.
+ *
+ * Purpose:   Convert the residue counts accumulated in <colw>
+ *            (<alen> columns of <K> residues) to the weight each
+ *            residue contributes: <1/(ntypes * count)>, where
+ *            <ntypes> is the number of residue types in its column.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_msaweight_PBStreamFinish(int64_t alen, int K, double *colw)
+{
+  double *c;
+  int64_t apos;
+  int     a, ntypes;
+
+  for (apos = 1; apos <= alen; apos++)
+    {
+      c = colw + (apos-1) * K;
+      for (ntypes = 0, a = 0; a < K; a++) if (c[a] > 0.) ntypes++;
+      for (a = 0; a < K; a++)
+	c[a] = (c[a] > 0.) ? 1. / ((double) ntypes * c[a]) : 0.;
+    }
+  return eslOK;
+}
+
+/* Function:  p7_msaweight_PBStreamApply()
+ * Synopsis:  Set unnormalized PB weights on one chunk of an alignment.
+ *
+ * Purpose:   Set <msa->wgt> for a chunk of an alignment, from the
+ *            per-residue terms in <colw> that
+ *            <p7_msaweight_PBStreamFinish()> made. Weights are left
+ *            unnormalized.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_msaweight_PBStreamApply(ESL_MSA *msa, const double *colw)
+{
+  PB_DATA d;
+
+  d.msa  = msa;
+  d.nres = NULL;
+  d.colw = (double *) colw;
+  pb_seqs(&d, 0, 1);
+  msa->flags |= eslMSA_HASWGTS;
+  return eslOK;
+}
+/*------------------ end, relative weights ----------------------*/
+
+
+
+/*****************************************************************
+ * 2. Clustering.
+ *****************************************************************/
+
+/* Function:  p7_msacluster_SingleLinkage()
+ * Synopsis:  Single linkage clustering of an MSA, using worker threads.
+ *
+ * Purpose:   Single linkage clustering of the sequences in digital
+ *            alignment <msa> at fractional pairwise identity
+ *            <maxid>, using <ncpus> worker threads. Arguments and
+ *            results are as for <esl_msacluster_SingleLinkage()>:
+ *            <*ret_nc> is the number of clusters; optionally,
+ *            <*opt_c> is the cluster assignment <0..nc-1> of each
+ *            sequence, and <*opt_nin> the size of each cluster.
+ *            Clusters are numbered in order of their first member,
+ *            which is how Easel numbers them too.
+ *
+ *            Worker <w> of <nw> compares rows <i = w, w+nw, ...>
+ *            of the pairwise triangle, skipping any pair its own
+ *            union-find already has connected; the workers'
+ *            partitions are then merged.
+ *
+ *            If <ncpus> <= 1, or <msa> is in text mode, just calls
+ *            <esl_msacluster_SingleLinkage()>.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> if threads
+ *            can't be created. Errors from the pairwise identity
+ *            calculation are passed back as is.
+ */
+int
+p7_msacluster_SingleLinkage(const ESL_MSA *msa, double maxid, int ncpus, int **opt_c, int **opt_nin, int *ret_nc)
+{
+  SL_DATA d;
+  int    *c   = NULL;
+  int    *nin = NULL;
+  int     nc  = 0;
+  int     i, w;
+  int     status;
+
+  if (ncpus <= 1 || ! (msa->flags & eslMSA_DIGITAL)) return esl_msacluster_SingleLinkage(msa, maxid, opt_c, opt_nin, ret_nc);
+
+  d.msa    = msa;
+  d.maxid  = maxid;
+  d.uf     = NULL;
+  d.status = NULL;
+  ESL_ALLOC(d.status, sizeof(int)   * ncpus);
+  ESL_ALLOC(d.uf,     sizeof(int *) * ncpus);
+  for (w = 0; w < ncpus; w++) d.uf[w] = NULL;
+  for (w = 0; w < ncpus; w++)
+    {
+      ESL_ALLOC(d.uf[w], sizeof(int) * msa->nseq);
+      for (i = 0; i < msa->nseq; i++) d.uf[w][i] = i;
+      d.status[w] = eslOK;
+    }
+
+  if ((status = run_stage(sl_rows, &d, ncpus)) != eslOK) goto ERROR;
+  for (w = 0; w < ncpus; w++)
+    if (d.status[w] != eslOK) { status = d.status[w]; goto ERROR; }
+
+  /* Merge into worker 0's partition. Union keeps the smallest index as
+   * root, so a seq is the root of its cluster iff it's the first member.
+   */
+  for (w = 1; w < ncpus; w++)
+    for (i = 0; i < msa->nseq; i++)
+      uf_union(d.uf[0], i, uf_find(d.uf[w], i));
+
+  ESL_ALLOC(c, sizeof(int) * msa->nseq);
+  for (i = 0; i < msa->nseq; i++)
+    c[i] = (uf_find(d.uf[0], i) == i) ? nc++ : c[d.uf[0][i]];
+
+  if (opt_nin)
+    {
+      ESL_ALLOC(nin, sizeof(int) * nc);
+      esl_vec_ISet(nin, nc, 0);
+      for (i = 0; i < msa->nseq; i++) nin[c[i]]++;
+    }
+
+  for (w = 0; w < ncpus; w++) free(d.uf[w]);
+  free(d.uf);
+  free(d.status);
+  if (opt_c)   *opt_c   = c;   else free(c);
+  if (opt_nin) *opt_nin = nin;
+  *ret_nc = nc;
+  return eslOK;
+
+ ERROR:
+  if (d.uf) { for (w = 0; w < ncpus; w++) if (d.uf[w]) free(d.uf[w]); free(d.uf); }
+  if (d.status) free(d.status);
+  if (c)        free(c);
+  if (nin)      free(nin);
+  if (opt_c)    *opt_c   = NULL;
+  if (opt_nin)  *opt_nin = NULL;
+  *ret_nc = 0;
+  return status;
+}
+
+
+/* Function:  p7_msacluster_Greedy()
+ * Synopsis:  Count greedy representative clusters in an MSA.
+ *
+ * Purpose:   Cluster the sequences in digital alignment <msa> by
+ *            greedy incremental clustering at fractional pairwise
+ *            identity <maxid>, and return the number of clusters in
+ *            <*ret_nc>. Sequences are visited longest first (ties in
+ *            input order); each one that is not at least <maxid>
+ *            identical to an existing representative becomes a new
+ *            representative.
+ *
+ *            This takes about N * nc comparisons instead of single
+ *            linkage's N^2 (worst case), and every pair of
+ *            representatives is below <maxid>. Since every sequence
+ *            shares a single linkage cluster with its representative,
+ *            <*ret_nc> is at least the number of single linkage
+ *            clusters.
+ *
+ *            Candidates are taken in batches; each batch is compared
+ *            to the current representatives on <ncpus> worker
+ *            threads, then the survivors are checked in order against
+ *            the representatives added within the batch. The result
+ *            is the same for any <ncpus>, including 0.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <eslESYS> if threads
+ *            can't be created; <eslEINVAL> if <msa> isn't digital.
+ *            Errors from the pairwise identity calculation are passed
+ *            back as is.
+ */
+int
+p7_msacluster_Greedy(const ESL_MSA *msa, double maxid, int ncpus, int *ret_nc)
+{
+  GR_DATA  d;
+  int64_t *rlen  = NULL;
+  int      nw    = ESL_MAX(1, ncpus);
+  int      B     = 64 * nw;	/* batch size */
+  int      i, s, r, w;
+  int      islinked;
+  int      status;
+
+  d.order  = NULL;
+  d.rep    = NULL;
+  d.hit    = NULL;
+  d.status = NULL;
+  if (! (msa->flags & eslMSA_DIGITAL)) ESL_XEXCEPTION(eslEINVAL, "greedy clustering needs a digital MSA");
+
+  ESL_ALLOC(rlen,     sizeof(int64_t) * msa->nseq);
+  ESL_ALLOC(d.order,  sizeof(int)     * msa->nseq);
+  ESL_ALLOC(d.rep,    sizeof(int)     * msa->nseq);
+  ESL_ALLOC(d.hit,    sizeof(int)     * B);
+  ESL_ALLOC(d.status, sizeof(int)     * nw);
+
+  for (i = 0; i < msa->nseq; i++) { rlen[i] = esl_abc_dsqrlen(msa->abc, msa->ax[i]); d.order[i] = i; }
+  sort_by_length(d.order, rlen, msa->nseq);
+
+  d.msa   = msa;
+  d.maxid = maxid;
+  d.nrep  = 0;
+  for (d.b = 0; d.b < msa->nseq; d.b = d.e)
+    {
+      d.e = ESL_MIN(d.b + B, msa->nseq);
+      for (w = 0; w < nw; w++) d.status[w] = eslOK;
+
+      if ((status = run_stage(gr_batch, &d, nw)) != eslOK) goto ERROR;
+      for (w = 0; w < nw; w++)
+	if (d.status[w] != eslOK) { status = d.status[w]; goto ERROR; }
+
+      /* Survivors vs. reps added earlier in this same batch */
+      r = d.nrep;
+      for (s = d.b; s < d.e; s++)
+	{
+	  if (d.hit[s-d.b]) continue;
+	  for (i = d.nrep; i < r; i++)
+	    {
+	      if ((status = is_linked(msa, d.order[s], d.rep[i], maxid, &islinked)) != eslOK) goto ERROR;
+	      if (islinked) break;
+	    }
+	  if (i == r) d.rep[r++] = d.order[s];
+	}
+      d.nrep = r;
+    }
+
+  *ret_nc = d.nrep;
+  free(d.status);
+  free(d.hit);
+  free(d.rep);
+  free(d.order);
+  free(rlen);
+  return eslOK;
+
+ ERROR:
+  if (d.status) free(d.status);
+  if (d.hit)    free(d.hit);
+  if (d.rep)    free(d.rep);
+  if (d.order)  free(d.order);
+  if (rlen)     free(rlen);
+  *ret_nc = 0;
+  return status;
+}
+
+
+/*---------------------- end, clustering ------------------------*/
+
+
+
+/*****************************************************************
+ * 3. Internal functions: running a stage on worker threads.
+ *****************************************************************/
+
+/* run_stage()
+ * Run <work> as <nw> workers on <data>, and wait for all of them.
+ * Without threads, or with <nw> <= 1, just runs the one share.
+ */
+static int
+run_stage(STAGE_FUNC work, void *data, int nw)
+{
+#ifdef HMMER_THREADS
+  ESL_THREADS *threadObj = NULL;
+  STAGE_INFO   info;
+  int          w;
+
+  if (nw > 1)
+    {
+      info.work = work;
+      info.data = data;
+      info.nw   = nw;
+
+      if ((threadObj = esl_threads_Create(&stage_thread)) == NULL) ESL_EXCEPTION(eslESYS, "failed to create thread object");
+      for (w = 0; w < nw; w++)
+	esl_threads_AddThread(threadObj, &info);
+      esl_threads_WaitForStart(threadObj);
+      esl_threads_WaitForFinish(threadObj);
+      esl_threads_Destroy(threadObj);
+      return eslOK;
+    }
+#endif /*HMMER_THREADS*/
+
+  (*work)(data, 0, 1);
+  return eslOK;
+}
+
+#ifdef HMMER_THREADS
+static void
+stage_thread(void *arg)
+{
+  ESL_THREADS *obj = (ESL_THREADS *) arg;
+  STAGE_INFO  *info;
+  int          workeridx;
+
+  esl_threads_Started(obj, &workeridx);
+  info = (STAGE_INFO *) esl_threads_GetData(obj, workeridx);
+  (*info->work)(info->data, workeridx, info->nw);
+  esl_threads_Finished(obj, workeridx);
+  return;
+}
+#endif /*HMMER_THREADS*/
+
+
+/* pb_columns()
+ * Count canonical residues in columns apos = w+1, w+1+nw, ...;
+ * then each residue's term 1/(ntypes * nres[a]), as Easel has it.
+ */
+static void
+pb_columns(void *data, int w, int nw)
+{
+  PB_DATA *d   = (PB_DATA *) data;
+  ESL_MSA *msa = d->msa;
+  int      K   = msa->abc->K;
+  int     *nres;
+  double  *colw;
+  int      apos, idx, a, ntypes;
+
+  for (apos = w+1; apos <= msa->alen; apos += nw)
+    {
+      nres = d->nres + (apos-1) * K;
+      colw = d->colw + (apos-1) * K;
+
+      esl_vec_ISet(nres, K, 0);
+      for (idx = 0; idx < msa->nseq; idx++)
+	if (esl_abc_XIsCanonical(msa->abc, msa->ax[idx][apos]))
+	  nres[msa->ax[idx][apos]]++;
+
+      for (ntypes = 0, a = 0; a < K; a++) if (nres[a] > 0) ntypes++;
+      for (a = 0; a < K; a++)
+	colw[a] = (nres[a] > 0) ? 1. / (double) (ntypes * nres[a]) : 0.;
+    }
+}
+
+/* pb_seqs()
+ * Sum the PB terms of seqs idx = w, w+nw, ..., in column order,
+ * then divide by the number of canonical residues in the seq.
+ */
+static void
+pb_seqs(void *data, int w, int nw)
+{
+  PB_DATA *d   = (PB_DATA *) data;
+  ESL_MSA *msa = d->msa;
+  int      K   = msa->abc->K;
+  int      idx, apos, rlen;
+  ESL_DSQ  x;
+
+  for (idx = w; idx < msa->nseq; idx += nw)
+    {
+      msa->wgt[idx] = 0.;
+      for (rlen = 0, apos = 1; apos <= msa->alen; apos++)
+	{
+	  x = msa->ax[idx][apos];
+	  if (esl_abc_XIsCanonical(msa->abc, x)) { msa->wgt[idx] += d->colw[(apos-1)*K + x]; rlen++; }
+	}
+      if (rlen > 0) msa->wgt[idx] /= (double) rlen;
+    }
+}
+
+/* sl_rows()
+ * Worker w's rows of the single linkage pairwise triangle.
+ */
+static void
+sl_rows(void *data, int w, int nw)
+{
+  SL_DATA *d  = (SL_DATA *) data;
+  int     *uf = d->uf[w];
+  int      i, j;
+  int      islinked;
+  int      status;
+
+  for (i = w; i < d->msa->nseq; i += nw)
+    for (j = i+1; j < d->msa->nseq; j++)
+      {
+	if (uf_find(uf, i) == uf_find(uf, j)) continue;
+	if ((status = is_linked(d->msa, i, j, d->maxid, &islinked)) != eslOK) { d->status[w] = status; return; }
+	if (islinked) uf_union(uf, i, j);
+      }
+}
+
+/* gr_batch()
+ * For worker w's candidates in the current batch, is there
+ * a link to any representative chosen in earlier batches?
+ */
+static void
+gr_batch(void *data, int w, int nw)
+{
+  GR_DATA *d = (GR_DATA *) data;
+  int      s, r;
+  int      islinked;
+  int      status;
+
+  for (s = d->b + w; s < d->e; s += nw)
+    {
+      d->hit[s-d->b] = FALSE;
+      for (r = 0; r < d->nrep; r++)
+	{
+	  if ((status = is_linked(d->msa, d->order[s], d->rep[r], d->maxid, &islinked)) != eslOK) { d->status[w] = status; return; }
+	  if (islinked) { d->hit[s-d->b] = TRUE; break; }
+	}
+    }
+}
+
+/* sort_by_length()
+ * Stable sort of seq indices <idx[0..n-1]> into decreasing <len[idx[]]>.
+ * Bottom-up merge sort; insertion sort if no room for the buffer.
+ */
+static void
+sort_by_length(int *idx, const int64_t *len, int n)
+{
+  int *tmp = NULL;
+  int  width, lo, mid, hi, a, b, k;
+  int  i, j, x;
+
+  if ((tmp = malloc(sizeof(int) * ESL_MAX(n, 1))) == NULL)
+    {
+      for (i = 1; i < n; i++)
+	{
+	  x = idx[i];
+	  for (j = i; j > 0 && len[idx[j-1]] < len[x]; j--) idx[j] = idx[j-1];
+	  idx[j] = x;
+	}
+      return;
+    }
+
+  for (width = 1; width < n; width *= 2)
+    {
+      for (lo = 0; lo < n; lo += 2*width)
+	{
+	  mid = ESL_MIN(lo + width,   n);
+	  hi  = ESL_MIN(lo + 2*width, n);
+	  for (a = lo, b = mid, k = lo; k < hi; k++)
+	    tmp[k] = (a < mid && (b >= hi || len[idx[a]] >= len[idx[b]])) ? idx[a++] : idx[b++];
+	}
+      for (k = 0; k < n; k++) idx[k] = tmp[k];
+    }
+  free(tmp);
+}
+
+/* union-find, with path halving; union keeps the smaller root */
+static int
+uf_find(int *p, int x)
+{
+  while (p[x] != x) { p[x] = p[p[x]]; x = p[x]; }
+  return x;
+}
+
+static void
+uf_union(int *p, int x, int y)
+{
+  x = uf_find(p, x);
+  y = uf_find(p, y);
+  if      (x < y) p[y] = x;
+  else if (y < x) p[x] = y;
+}
+
+/* is_linked()
+ * Same linkage criterion as Easel's MSA clustering.
+ */
+static int
+is_linked(const ESL_MSA *msa, int i, int j, double maxid, int *ret_link)
+{
+  double pid;
+  int    status;
+
+  if ((status = esl_dst_XPairId(msa->abc, msa->ax[i], msa->ax[j], &pid, NULL, NULL)) != eslOK) return status;
+  *ret_link = (pid >= maxid ? TRUE : FALSE);
+  return eslOK;
+}
+/*------------------ end, internal functions --------------------*/
+
+
+
+/*****************************************************************
+ * 4. Unit tests.
+ *****************************************************************/
+#ifdef p7MSAWEIGHT_TESTDRIVE
+#include "esl_random.h"
+
+/* Make a digital MSA of <nseq> x <alen> that has some cluster
+ * structure: each seq is a mutated copy of one of <nanc> random
+ * ancestors, with gaps.
+ */
+static ESL_MSA *
+make_clustered_msa(ESL_RANDOMNESS *r, const ESL_ALPHABET *abc, int nseq, int alen, int nanc)
+{
+  ESL_MSA  *msa = esl_msa_CreateDigital(abc, nseq, alen);
+  ESL_DSQ **anc = malloc(sizeof(ESL_DSQ *) * nanc);
+  int       i, a, apos;
+
+  if (msa == NULL || anc == NULL) esl_fatal("allocation failed");
+  for (a = 0; a < nanc; a++)
+    {
+      if ((anc[a] = malloc(sizeof(ESL_DSQ) * (alen+2))) == NULL) esl_fatal("allocation failed");
+      for (apos = 1; apos <= alen; apos++) anc[a][apos] = esl_rnd_Roll(r, abc->K);
+    }
+
+  msa->nseq = nseq;
+  for (i = 0; i < nseq; i++)
+    {
+      a = esl_rnd_Roll(r, nanc);
+      msa->ax[i][0] = msa->ax[i][alen+1] = eslDSQ_SENTINEL;
+      for (apos = 1; apos <= alen; apos++)
+	{
+	  if      (esl_random(r) < 0.10) msa->ax[i][apos] = esl_abc_XGetGap(abc);
+	  else if (esl_random(r) < 0.25) msa->ax[i][apos] = esl_rnd_Roll(r, abc->K);
+	  else                           msa->ax[i][apos] = anc[a][apos];
+	}
+    }
+
+  for (a = 0; a < nanc; a++) free(anc[a]);
+  free(anc);
+  return msa;
+}
+
+/* utest_weights()
+ * PB and BLOSUM weights from threads match Easel's.
+ */
+static void
+utest_weights(ESL_RANDOMNESS *r, const ESL_ALPHABET *abc, int nseq, int alen, int ncpus)
+{
+  char     msg[] = "msaweight weights unit test failed";
+  ESL_MSA *msa1  = make_clustered_msa(r, abc, nseq, alen, 1 + nseq / 10);
+  ESL_MSA *msa2  = esl_msa_Clone(msa1);
+
+  if (msa2 == NULL) esl_fatal(msg);
+
+  if (esl_msaweight_PB(msa1)                    != eslOK) esl_fatal(msg);
+  if (p7_msaweight_PB(msa2, ncpus)              != eslOK) esl_fatal(msg);
+  if (esl_vec_DCompare(msa1->wgt, msa2->wgt, nseq, 1e-9) != eslOK) esl_fatal(msg);
+
+  if (esl_msaweight_BLOSUM(msa1, 0.62)          != eslOK) esl_fatal(msg);
+  if (p7_msaweight_BLOSUM(msa2, 0.62, ncpus)    != eslOK) esl_fatal(msg);
+  if (esl_vec_DCompare(msa1->wgt, msa2->wgt, nseq, 1e-9) != eslOK) esl_fatal(msg);
+
+  esl_msa_Destroy(msa1);
+  esl_msa_Destroy(msa2);
+}
+
+/* utest_stream()
+ * PB weights computed chunk by chunk, as p7_StreamBuilder() does,
+ * match Easel's once normalized.
+ */
+static void
+utest_stream(ESL_RANDOMNESS *r, const ESL_ALPHABET *abc, int nseq, int alen, int chunksize)
+{
+  char     msg[]  = "msaweight stream unit test failed";
+  ESL_MSA *msa    = make_clustered_msa(r, abc, nseq, alen, 1 + nseq / 10);
+  ESL_MSA *chunk  = NULL;
+  double  *colw   = malloc(sizeof(double) * alen * abc->K);
+  double  *wgt    = malloc(sizeof(double) * nseq);
+  int     *useme  = malloc(sizeof(int)    * nseq);
+  int      pass, b, i;
+
+  if (colw == NULL || wgt == NULL || useme == NULL) esl_fatal(msg);
+  esl_vec_DSet(colw, alen * abc->K, 0.);
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (b = 0; b < nseq; b += chunksize)
+	{
+	  for (i = 0; i < nseq; i++) useme[i] = (i >= b && i < b + chunksize) ? TRUE : FALSE;
+	  if (esl_msa_SequenceSubset(msa, useme, &chunk) != eslOK) esl_fatal(msg);
+	  if (pass == 0 && p7_msaweight_PBStreamCount(chunk, colw) != eslOK) esl_fatal(msg);
+	  if (pass == 1)
+	    {
+	      if (p7_msaweight_PBStreamApply(chunk, colw) != eslOK) esl_fatal(msg);
+	      for (i = 0; i < chunk->nseq; i++) wgt[b+i] = chunk->wgt[i];
+	    }
+	  esl_msa_Destroy(chunk);
+	}
+      if (pass == 0 && p7_msaweight_PBStreamFinish(alen, abc->K, colw) != eslOK) esl_fatal(msg);
+    }
+  esl_vec_DNorm (wgt, nseq);
+  esl_vec_DScale(wgt, nseq, (double) nseq);
+
+  if (esl_msaweight_PB(msa) != eslOK) esl_fatal(msg);
+  if (esl_vec_DCompare(msa->wgt, wgt, nseq, 1e-9) != eslOK) esl_fatal(msg);
+
+  free(useme);
+  free(wgt);
+  free(colw);
+  esl_msa_Destroy(msa);
+}
+
+/* utest_clusters()
+ * Threaded single linkage gives Easel's clusters, numbered the same;
+ * greedy clustering is independent of the thread count, and gives
+ * no fewer clusters than single linkage.
+ */
+static void
+utest_clusters(ESL_RANDOMNESS *r, const ESL_ALPHABET *abc, int nseq, int alen, int ncpus)
+{
+  char     msg[] = "msaweight clusters unit test failed";
+  ESL_MSA *msa   = make_clustered_msa(r, abc, nseq, alen, 1 + nseq / 10);
+  int     *c1    = NULL;
+  int     *c2    = NULL;
+  int     *nin1  = NULL;
+  int     *nin2  = NULL;
+  int      nc1, nc2, ngr1, ngr2;
+  double   maxid;
+  int      i;
+
+  for (maxid = 0.3; maxid < 1.0; maxid += 0.3)
+    {
+      if (esl_msacluster_SingleLinkage(msa, maxid, &c1, &nin1, &nc1)              != eslOK) esl_fatal(msg);
+      if (p7_msacluster_SingleLinkage (msa, maxid, ncpus, &c2, &nin2, &nc2)       != eslOK) esl_fatal(msg);
+      if (nc1 != nc2) esl_fatal(msg);
+      for (i = 0; i < nseq; i++) if (c1[i]   != c2[i])   esl_fatal(msg);
+      for (i = 0; i < nc1;  i++) if (nin1[i] != nin2[i]) esl_fatal(msg);
+
+      if (p7_msacluster_Greedy(msa, maxid, 0,     &ngr1) != eslOK) esl_fatal(msg);
+      if (p7_msacluster_Greedy(msa, maxid, ncpus, &ngr2) != eslOK) esl_fatal(msg);
+      if (ngr1 != ngr2 || ngr1 < nc1 || ngr1 > nseq) esl_fatal(msg);
+
+      free(c1);   free(c2);
+      free(nin1); free(nin2);
+    }
+  esl_msa_Destroy(msa);
+}
+
+/* utest_sort()
+ * sort_by_length() is a stable sort into decreasing length.
+ */
+static void
+utest_sort(ESL_RANDOMNESS *r, int n)
+{
+  char     msg[] = "msaweight sort unit test failed";
+  int64_t *len   = malloc(sizeof(int64_t) * n);
+  int     *idx   = malloc(sizeof(int)     * n);
+  int      i;
+
+  if (len == NULL || idx == NULL) esl_fatal(msg);
+  for (i = 0; i < n; i++) { len[i] = esl_rnd_Roll(r, 10); idx[i] = i; }
+  sort_by_length(idx, len, n);
+  for (i = 1; i < n; i++)
+    {
+      if (len[idx[i-1]] <  len[idx[i]])                         esl_fatal(msg);
+      if (len[idx[i-1]] == len[idx[i]] && idx[i-1] > idx[i])    esl_fatal(msg);
+    }
+  free(len);
+  free(idx);
+}
+#endif /*p7MSAWEIGHT_TESTDRIVE*/
+/*-------------------- end, unit tests --------------------------*/
+
+
+
+/*****************************************************************
+ * 5. Test driver.
+ *****************************************************************/
+#ifdef p7MSAWEIGHT_TESTDRIVE
+#include "esl_getopts.h"
+
+static ESL_OPTIONS options[] = {
+   /* name  type         default  env   range togs  reqs  incomp  help                        docgrp */
+  {"-h",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show help and usage",                            0},
+  {"-s",  eslARG_INT,       "0", NULL, NULL, NULL, NULL, NULL, "set random number seed to <n>",                  0},
+  {"-v",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show verbose commentary/output",                 0},
+  {"-L",  eslARG_INT,      "80", NULL,"n>0", NULL, NULL, NULL, "alignment length",                               0},
+  {"-N",  eslARG_INT,     "300", NULL,"n>1", NULL, NULL, NULL, "number of sequences",                            0},
+  {"-T",  eslARG_INT,       "4", NULL,"n>1", NULL, NULL, NULL, "number of worker threads",                       0},
+  { 0,0,0,0,0,0,0,0,0,0},
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for msaweight.c";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go         = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng        = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc        = esl_alphabet_Create(eslAMINO);
+  int             L          = esl_opt_GetInteger(go, "-L");
+  int             N          = esl_opt_GetInteger(go, "-N");
+  int             T          = esl_opt_GetInteger(go, "-T");
+  int             be_verbose = esl_opt_GetBoolean(go, "-v");
+
+  if (be_verbose) printf("msaweight unit test: rng seed %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  utest_weights (rng, abc, N, L, T);
+  utest_weights (rng, abc, N, L, 2);
+  utest_stream  (rng, abc, N, L, 7);
+  utest_clusters(rng, abc, N, L, T);
+  utest_sort    (rng, 1000);
+
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*p7MSAWEIGHT_TESTDRIVE*/
+/*-------------------- end, test driver -------------------------*/
+
+
+/*****************************************************************
+ * @LICENSE@
+ *****************************************************************/
@@ -902,6 +902,7 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
           info[i].th  = p7_tophits_Create();
           info[i].om = p7_oprofile_Copy(om);
           info[i].pli = p7_pipeline_Create(go, om->M, 100, TRUE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+          if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A") && ! esl_opt_IsOn(go, "--aliscoresout")) info[i].pli->ddef->do_alidisplay = FALSE;
 
           //set method specific --F1, if it wasn't set at command line
           if (!esl_opt_IsOn(go, "--F1") ) {
@@ -1226,8 +1227,10 @@ serial_loop(WORKER_INFO *info, ID_LENGTH_LIST *id_length_list, ESL_SQFILE *dbfp,
   int      wstatus = eslOK;
   int seq_id = 0;
   ESL_SQ   *dbsq   =  esl_sq_CreateDigital(info->om->abc);
+  P7_PACKEDSQ *psq        = p7_packedsq_Create();   /* 2-bit copies of each window, for the SSV filter */
+  P7_PACKEDSQ *psq_revcmp = p7_packedsq_Create();
 #ifdef eslAUGMENT_ALPHABET
-  ESL_SQ   *dbsq_revcmp;
+  ESL_SQ   *dbsq_revcmp = NULL;
 
 
   if (dbsq->abc->complement != NULL)
@@ -1240,6 +1243,10 @@ serial_loop(WORKER_INFO *info, ID_LENGTH_LIST *id_length_list, ESL_SQFILE *dbfp,
       dbsq->idx = seq_id;
       p7_pli_NewSeq(info->pli, dbsq);
 
+      /* pack the window once, as it's read; the reverse strand is derived
+       * from the packed copy. A window we can't pack is scanned unpacked. */
+      info->pli->psq = (psq != NULL && p7_packedsq_Pack(psq, dbsq->abc, dbsq->dsq, dbsq->n) == eslOK) ? psq : NULL;
+
       if (info->pli->strands != p7_STRAND_BOTTOMONLY) {
 
         info->pli->nres -= dbsq->C; // to account for overlapping region of windows
@@ -1255,6 +1262,10 @@ serial_loop(WORKER_INFO *info, ID_LENGTH_LIST *id_length_list, ESL_SQFILE *dbfp,
       {
           esl_sq_Copy(dbsq,dbsq_revcmp);
           esl_sq_ReverseComplement(dbsq_revcmp);
+          if (info->pli->psq != NULL && psq_revcmp != NULL && p7_packedsq_ReverseComplement(psq_revcmp, psq, dbsq->abc, dbsq_revcmp->dsq) == eslOK)
+            info->pli->psq = psq_revcmp;
+          else
+            info->pli->psq = NULL;
           p7_Pipeline_LongTarget(info->pli, info->om, info->scoredata, info->bg, info->th, info->pli->nseqs, dbsq_revcmp, p7_COMPLEMENT, NULL, NULL, NULL/*, ssv_watch_master, postssv_watch_master, watch_slave*/);
           p7_pipeline_Reuse(info->pli); // prepare for next search
 
@@ -1277,6 +1288,9 @@ serial_loop(WORKER_INFO *info, ID_LENGTH_LIST *id_length_list, ESL_SQFILE *dbfp,
     }
 
 
+  info->pli->psq = NULL;
+  p7_packedsq_Destroy(psq);
+  p7_packedsq_Destroy(psq_revcmp);
   if (dbsq) esl_sq_Destroy(dbsq);
   if (dbsq_revcmp) esl_sq_Destroy(dbsq_revcmp);
 
@@ -1438,6 +1452,8 @@ pipeline_thread(void *arg)
   ESL_THREADS   *obj;
   ESL_SQ_BLOCK  *block = NULL;
   void          *newBlock;
+  P7_PACKEDSQ   *psq        = NULL;   /* 2-bit copies of each target, for the SSV filter */
+  P7_PACKEDSQ   *psq_revcmp = NULL;
   
   impl_Init();
 
@@ -1445,6 +1461,8 @@ pipeline_thread(void *arg)
   esl_threads_Started(obj, &workeridx);
 
   info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  psq        = p7_packedsq_Create();
+  psq_revcmp = p7_packedsq_Create();
 
   status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
   if (status != eslOK) esl_fatal("Work queue worker failed");
@@ -1462,6 +1480,12 @@ pipeline_thread(void *arg)
 
       p7_pli_NewSeq(info->pli, dbsq);
 
+      /* Pack each target once, as this worker takes it from the block;
+       * packing in the reader thread would serialize it. The reverse
+       * strand is derived from the packed copy. A target we can't pack
+       * is scanned unpacked. */
+      info->pli->psq = (psq != NULL && p7_packedsq_Pack(psq, dbsq->abc, dbsq->dsq, dbsq->n) == eslOK) ? psq : NULL;
+
       if (info->pli->strands != p7_STRAND_BOTTOMONLY) {
         info->pli->nres -= dbsq->C; // to account for overlapping region of windows
 
@@ -1477,6 +1501,10 @@ pipeline_thread(void *arg)
       if (info->pli->strands != p7_STRAND_TOPONLY && dbsq->abc->complement != NULL)
       {
           esl_sq_ReverseComplement(dbsq);
+          if (info->pli->psq != NULL && psq_revcmp != NULL && p7_packedsq_ReverseComplement(psq_revcmp, psq, dbsq->abc, dbsq->dsq) == eslOK)
+            info->pli->psq = psq_revcmp;
+          else
+            info->pli->psq = NULL;
           p7_Pipeline_LongTarget(info->pli, info->om, info->scoredata, info->bg, info->th, block->first_seqidx + i, dbsq, p7_COMPLEMENT, NULL, NULL, NULL/*, NULL, NULL, NULL*/);
           p7_pipeline_Reuse(info->pli); // prepare for next search
 
@@ -1497,6 +1525,10 @@ pipeline_thread(void *arg)
   status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
+  info->pli->psq = NULL;
+  p7_packedsq_Destroy(psq);
+  p7_packedsq_Destroy(psq_revcmp);
+
   esl_threads_Finished(obj, workeridx);
   return;
 }
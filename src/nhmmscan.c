@@ -478,6 +478,7 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
         /* Create processing pipeline and hit list */
         info[i].th  = p7_tophits_Create();
         info[i].pli = p7_pipeline_Create(go, 100, 100, TRUE, p7_SCAN_MODELS); /* M_hint = 100, L_hint = 100 are just dummies for now */
+        if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "--aliscoresout")) info[i].pli->ddef->do_alidisplay = FALSE;
         info[i].pli->hfp = hfp;  /* for two-stage input, pipeline needs <hfp> */
 
         p7_pli_NewSeq(info[i].pli, qsq);
@@ -636,6 +637,11 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
   P7_OPROFILE   *om        = NULL;
   P7_SCOREDATA  *scoredata = NULL;   /* hmm-specific data used by nhmmer */
   ESL_ALPHABET  *abc = NULL;
+  P7_PACKEDSQ   *psq        = p7_packedsq_Create();  /* 2-bit copies of the query, packed once for all models */
+  P7_PACKEDSQ   *psq_revcmp = p7_packedsq_Create();
+
+  /* a query we can't pack (NULL psq) is scanned unpacked */
+  if (psq != NULL && p7_packedsq_Pack(psq, info->qsq->abc, info->qsq->dsq, info->qsq->n) != eslOK) { p7_packedsq_Destroy(psq); psq = NULL; }
 
 #ifdef eslAUGMENT_ALPHABET
   ESL_SQ        *sq_revcmp = NULL;
@@ -643,6 +649,7 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
     sq_revcmp =  esl_sq_CreateDigital(info->qsq->abc);
     esl_sq_Copy(info->qsq,sq_revcmp);
     esl_sq_ReverseComplement(sq_revcmp);
+    if (psq == NULL || psq_revcmp == NULL || p7_packedsq_ReverseComplement(psq_revcmp, psq, sq_revcmp->abc, sq_revcmp->dsq) != eslOK) { p7_packedsq_Destroy(psq_revcmp); psq_revcmp = NULL; }
 
     info->pli->nres += info->qsq->n;
   }
@@ -679,6 +686,7 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
       //reverse complement
       if (info->pli->strands != p7_STRAND_TOPONLY && info->qsq->abc->complement != NULL )
       {
+        info->pli->psq = psq_revcmp;
         p7_Pipeline_LongTarget(info->pli, om, scoredata, info->bg, info->th, 0, sq_revcmp, p7_COMPLEMENT, NULL, NULL, NULL/*, NULL, NULL, NULL*/);
         p7_pipeline_Reuse(info->pli); // prepare for next search
         seq_len = info->qsq->n;
@@ -687,6 +695,7 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
 
 
       if (info->pli->strands != p7_STRAND_BOTTOMONLY) {
+        info->pli->psq = psq;
         p7_Pipeline_LongTarget(info->pli, om, scoredata, info->bg, info->th, 0, info->qsq, p7_NOCOMPLEMENT, NULL, NULL, NULL/*, NULL, NULL, NULL*/);
         p7_pipeline_Reuse(info->pli);
         seq_len += info->qsq->n;
@@ -714,6 +723,9 @@ serial_loop(WORKER_INFO *info, P7_HMMFILE *hfp)
 #ifdef eslAUGMENT_ALPHABET
   esl_sq_Destroy(sq_revcmp);
 #endif
+  info->pli->psq = NULL;
+  p7_packedsq_Destroy(psq);
+  p7_packedsq_Destroy(psq_revcmp);
 
   if (info->fwd_emissions != NULL) free(info->fwd_emissions);
 
@@ -788,6 +800,8 @@ pipeline_thread(void *arg)
 
   int seq_len = 0;
   int prev_hit_cnt = 0;
+  P7_PACKEDSQ   *psq        = NULL;  /* 2-bit copies of the query, packed once for all models */
+  P7_PACKEDSQ   *psq_revcmp = NULL;
 
 #ifdef eslAUGMENT_ALPHABET
   ESL_SQ        *sq_revcmp = NULL;
@@ -804,12 +818,18 @@ pipeline_thread(void *arg)
   status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
   if (status != eslOK) esl_fatal("Work queue worker failed");
 
+  psq        = p7_packedsq_Create();
+  psq_revcmp = p7_packedsq_Create();
+  /* a query we can't pack (NULL psq) is scanned unpacked */
+  if (psq != NULL && p7_packedsq_Pack(psq, info->qsq->abc, info->qsq->dsq, info->qsq->n) != eslOK) { p7_packedsq_Destroy(psq); psq = NULL; }
+
 #ifdef eslAUGMENT_ALPHABET
   //reverse complement
   if (info->pli->strands != p7_STRAND_TOPONLY && info->qsq->abc->complement != NULL ) {
     sq_revcmp =  esl_sq_CreateDigital(info->qsq->abc);
     esl_sq_Copy(info->qsq,sq_revcmp);
     esl_sq_ReverseComplement(sq_revcmp);
+    if (psq == NULL || psq_revcmp == NULL || p7_packedsq_ReverseComplement(psq_revcmp, psq, sq_revcmp->abc, sq_revcmp->dsq) != eslOK) { p7_packedsq_Destroy(psq_revcmp); psq_revcmp = NULL; }
     info->pli->nres += info->qsq->n;
   }
 #endif /*eslAUGMENT_ALPHABET*/
@@ -851,12 +871,14 @@ pipeline_thread(void *arg)
         //reverse complement
         if (info->pli->strands != p7_STRAND_TOPONLY && info->qsq->abc->complement != NULL )
         {
+          info->pli->psq = psq_revcmp;
           p7_Pipeline_LongTarget(info->pli, om, scoredata, info->bg, info->th, 0, sq_revcmp, p7_COMPLEMENT, NULL, NULL, NULL/*, NULL, NULL, NULL*/);
           p7_pipeline_Reuse(info->pli); // prepare for next search
           seq_len = info->qsq->n;
         }
 #endif
         if (info->pli->strands != p7_STRAND_BOTTOMONLY) {
+          info->pli->psq = psq;
           p7_Pipeline_LongTarget(info->pli, om, scoredata, info->bg, info->th, 0, info->qsq, p7_NOCOMPLEMENT, NULL, NULL, NULL/*, NULL, NULL, NULL*/);
           p7_pipeline_Reuse(info->pli);
           seq_len += info->qsq->n;
@@ -886,6 +908,9 @@ pipeline_thread(void *arg)
 #ifdef eslAUGMENT_ALPHABET
   esl_sq_Destroy(sq_revcmp);
 #endif
+  info->pli->psq = NULL;
+  p7_packedsq_Destroy(psq);
+  p7_packedsq_Destroy(psq_revcmp);
 
   if (info->fwd_emissions != NULL) free(info->fwd_emissions);
 
@@ -27,6 +27,36 @@
  *****************************************************************/
 
 
+/* alidisplay_find_span()
+ * Find the piece z1..z2 of trace <tr> (first match to last match)
+ * that represents domain number <which>. Returns <eslOK>, or
+ * <eslFAIL> if there's no such domain or the trace is corrupt.
+ */
+static int
+alidisplay_find_span(const P7_TRACE *tr, int which, int *ret_z1, int *ret_z2)
+{
+  int z1, z2;
+
+  if (tr->ndom > 0) {		/* if we have an index, this is a little faster: */
+    for (z1 = tr->tfrom[which]; z1 < tr->N; z1++) if (tr->st[z1] == p7T_M) break;  /* find next M state      */
+    if (z1 == tr->N) return eslFAIL;                                               /* no M? corrupt trace    */
+    for (z2 = tr->tto[which];   z2 >= 0 ;   z2--) if (tr->st[z2] == p7T_M) break;  /* find prev M state      */
+    if (z2 == -1) return eslFAIL;                                                  /* no M? corrupt trace    */
+  } else {			/* without an index, we can still do it fine:    */
+    for (z1 = 0; which >= 0 && z1 < tr->N; z1++) if (tr->st[z1] == p7T_B) which--; /* find the right B state */
+    if (z1 == tr->N) return eslFAIL;                                               /* no such domain <which> */
+    for (; z1 < tr->N; z1++) if (tr->st[z1] == p7T_M) break;                       /* find next M state      */
+    if (z1 == tr->N) return eslFAIL;                                               /* no M? corrupt trace    */
+    for (z2 = z1; z2 < tr->N; z2++) if (tr->st[z2] == p7T_E) break;                /* find the next E state  */
+    for (; z2 >= 0;    z2--) if (tr->st[z2] == p7T_M) break;                       /* find prev M state      */
+    if (z2 == -1) return eslFAIL;                                                  /* no M? corrupt trace    */
+  }
+  *ret_z1 = z1;
+  *ret_z2 = z2;
+  return eslOK;
+}
+
+
 /* Function:  p7_alidisplay_Create()
  * Synopsis:  Create an alignment display, from trace and oprofile.
  *
@@ -74,20 +104,7 @@ p7_alidisplay_Create(const P7_TRACE *tr, int which, const P7_OPROFILE *om, const
   /* First figure out which piece of the trace (from first match to last match) 
    * we're going to represent, and how big it is.
    */
-  if (tr->ndom > 0) {		/* if we have an index, this is a little faster: */
-    for (z1 = tr->tfrom[which]; z1 < tr->N; z1++) if (tr->st[z1] == p7T_M) break;  /* find next M state      */
-    if (z1 == tr->N) return NULL;                                                  /* no M? corrupt trace    */
-    for (z2 = tr->tto[which];   z2 >= 0 ;   z2--) if (tr->st[z2] == p7T_M) break;  /* find prev M state      */
-    if (z2 == -1) return NULL;                                                     /* no M? corrupt trace    */
-  } else {			/* without an index, we can still do it fine:    */
-    for (z1 = 0; which >= 0 && z1 < tr->N; z1++) if (tr->st[z1] == p7T_B) which--; /* find the right B state */
-    if (z1 == tr->N) return NULL;                                                  /* no such domain <which> */
-    for (; z1 < tr->N; z1++) if (tr->st[z1] == p7T_M) break;                       /* find next M state      */
-    if (z1 == tr->N) return NULL;                                                  /* no M? corrupt trace    */
-    for (z2 = z1; z2 < tr->N; z2++) if (tr->st[z2] == p7T_E) break;                /* find the next E state  */
-    for (; z2 >= 0;    z2--) if (tr->st[z2] == p7T_M) break;                       /* find prev M state      */
-    if (z2 == -1) return NULL;                                                     /* no M? corrupt trace    */
-  }
+  if (alidisplay_find_span(tr, which, &z1, &z2) != eslOK) return NULL;
 
   /* Now we know that z1..z2 in the trace will be represented in the
    * alidisplay; that's z2-z1+1 positions. We need a \0 trailer on all
@@ -227,6 +244,94 @@ p7_alidisplay_Create(const P7_TRACE *tr, int which, const P7_OPROFILE *om, const
 }
 
 
+/* Function:  p7_alidisplay_CreateCoords()
+ * Synopsis:  Create a coordinate-only alignment display.
+ *
+ * Purpose:   Same as <p7_alidisplay_Create()>, but record only what
+ *            tabular and domain-table output need: the model and
+ *            sequence names and the hit coordinates <hmmfrom..hmmto>,
+ *            <sqfrom..sqto>, <M>, <L>. The alignment lines are
+ *            left empty (<N> is 0; <model>, <mline>, <aseq> are "";
+ *            optional lines are <NULL>).
+ *
+ *            The pipeline uses this when alignments will never be
+ *            shown or saved (<--noali> without <-A>), saving the
+ *            time and memory of building display strings for every
+ *            domain of every hit that passes Forward. The result
+ *            is a valid, serialized <P7_ALIDISPLAY>, so it can be
+ *            cloned, sent, and destroyed like any other; but it
+ *            can't be printed or back-converted to a trace.
+ *
+ * Args:      tr       - traceback
+ *            which    - domain number, 0..tr->ndom-1
+ *            om       - optimized profile (query)
+ *            sq       - digital sequence (target)
+ *
+ * Returns:   ptr to the new <P7_ALIDISPLAY>.
+ *
+ * Throws:    <NULL> on allocation failure, or if something's internally corrupt
+ *            in the data.
+ */
+P7_ALIDISPLAY *
+p7_alidisplay_CreateCoords(const P7_TRACE *tr, int which, const P7_OPROFILE *om, const ESL_SQ *sq)
+{
+  P7_ALIDISPLAY *ad = NULL;
+  int            z1, z2;
+  int            n, pos;
+  int            hmm_namelen, hmm_acclen, hmm_desclen;
+  int            sq_namelen,  sq_acclen,  sq_desclen;
+  int            status;
+
+  if (alidisplay_find_span(tr, which, &z1, &z2) != eslOK) return NULL;
+
+  n = 3;			/* empty model, mline, aseq */
+  hmm_namelen = strlen(om->name);                           n += hmm_namelen + 1;
+  hmm_acclen  = (om->acc  != NULL ? strlen(om->acc)  : 0);  n += hmm_acclen  + 1;
+  hmm_desclen = (om->desc != NULL ? strlen(om->desc) : 0);  n += hmm_desclen + 1;
+  sq_namelen  = strlen(sq->name);                           n += sq_namelen  + 1;
+  sq_acclen   = strlen(sq->acc);                            n += sq_acclen   + 1;
+  sq_desclen  = strlen(sq->desc);                           n += sq_desclen  + 1;
+
+  ESL_ALLOC(ad, sizeof(P7_ALIDISPLAY));
+  ad->mem     = NULL;
+  ad->memsize = sizeof(char) * n;
+  ESL_ALLOC(ad->mem, ad->memsize);
+
+  pos = 0;
+  ad->rfline  = ad->mmline = ad->csline = ad->ppline = ad->ntseq = NULL;
+  ad->model   = ad->mem + pos;  pos += 1;
+  ad->mline   = ad->mem + pos;  pos += 1;
+  ad->aseq    = ad->mem + pos;  pos += 1;
+  ad->hmmname = ad->mem + pos;  pos += hmm_namelen +1;
+  ad->hmmacc  = ad->mem + pos;  pos += hmm_acclen +1;
+  ad->hmmdesc = ad->mem + pos;  pos += hmm_desclen +1;
+  ad->sqname  = ad->mem + pos;  pos += sq_namelen +1;
+  ad->sqacc   = ad->mem + pos;  pos += sq_acclen +1;
+  ad->sqdesc  = ad->mem + pos;  pos += sq_desclen +1;
+
+  ad->model[0] = ad->mline[0] = ad->aseq[0] = '\0';
+  strcpy(ad->hmmname, om->name);
+  if (om->acc  != NULL) strcpy(ad->hmmacc,  om->acc);  else ad->hmmacc[0]  = 0;
+  if (om->desc != NULL) strcpy(ad->hmmdesc, om->desc); else ad->hmmdesc[0] = 0;
+  strcpy(ad->sqname,  sq->name);
+  strcpy(ad->sqacc,   sq->acc);
+  strcpy(ad->sqdesc,  sq->desc);
+
+  ad->hmmfrom = tr->k[z1];
+  ad->hmmto   = tr->k[z2];
+  ad->M       = om->M;
+  ad->sqfrom  = tr->i[z1];
+  ad->sqto    = tr->i[z2];
+  ad->L       = sq->n;
+  ad->N       = 0;
+  return ad;
+
+ ERROR:
+  p7_alidisplay_Destroy(ad);
+  return NULL;
+}
+
+
 /* Function:  p7_alidisplay_Clone()
  * Synopsis:  Make a duplicate of an ALIDISPLAY.
  *
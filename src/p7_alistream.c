@@ -0,0 +1,740 @@
+/* The P7_ALISTREAM object: reading one very large alignment in chunks.
+ *
+ * <esl_msafile_Read()> reads a whole alignment into memory, which
+ * isn't possible for alignments of many millions of sequences. A
+ * P7_ALISTREAM instead hands out the alignment a chunk of sequences
+ * at a time, each as an ordinary digital <ESL_MSA> of the full
+ * alignment length, and can be rewound to make another pass over
+ * the file. <p7_StreamBuilder()> uses it to build a model in
+ * bounded memory.
+ *
+ * Two formats can be streamed, because in each of them every aligned
+ * sequence is one contiguous record:
+ *   - aligned FASTA;
+ *   - Stockholm with each sequence on one line (Pfam format).
+ *     Interleaved, multiblock Stockholm would need the whole
+ *     alignment in memory, and is rejected with a message saying so.
+ *
+ * Alignment-wide annotation (Stockholm #=GF ID/AC/DE/GA/TC/NC, and
+ * #=GC RF/MM/SS_cons/SA_cons) is collected in a header <ESL_MSA>
+ * that has no sequences. Since #=GC lines usually follow the
+ * sequences, the header is only complete once the first pass is
+ * done. Only one alignment per file can be streamed.
+ *
+ * Contents:
+ *   1. The P7_ALISTREAM object.
+ *   2. Internal functions: parsing.
+ *   3. Unit tests.
+ *   4. Test driver.
+ *   5. Copyright and license.
+ */
+#include "p7_config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+#include "esl_msa.h"
+#include "esl_msafile.h"
+
+#include "hmmer.h"
+
+static int next_stockholm(P7_ALISTREAM *as);
+static int next_afa      (P7_ALISTREAM *as);
+static int parse_markup  (P7_ALISTREAM *as, char *s);
+static int parse_cutoffs (P7_ALISTREAM *as, char *s, int which1, int which2);
+static int clear_text    (P7_ALISTREAM *as);
+static int append_text   (P7_ALISTREAM *as, const char *s);
+static int finish_pass   (P7_ALISTREAM *as);
+static int is_blank      (const char *s);
+
+
+/*****************************************************************
+ *# 1. The P7_ALISTREAM object.
+ *****************************************************************/
+
+/* Function:  p7_alistream_Open()
+ * Synopsis:  Open an alignment file for streaming.
+ *
+ * Purpose:   Open alignment file <filename> to be read in chunks, in
+ *            digital alphabet <abc>. <format> is <eslMSAFILE_AFA>,
+ *            <eslMSAFILE_STOCKHOLM> or <eslMSAFILE_PFAM> (the last
+ *            two are treated alike), or <eslMSAFILE_UNKNOWN> to
+ *            decide from the first nonblank line of the file.
+ *
+ *            The file is rewound for each pass, so it must be a
+ *            real file, not stdin or a pipe.
+ *
+ * Returns:   <eslOK> on success, and <*ret_as> is the new stream.
+ *
+ *            <eslENOTFOUND> if the file can't be opened;
+ *            <eslEFORMAT> if it doesn't look like Stockholm or
+ *            aligned FASTA; <eslEINVAL> if <filename> is "-" or
+ *            <format> can't be streamed. On these normal errors,
+ *            <errbuf> (if non-<NULL>) contains a message, and
+ *            <*ret_as> is <NULL>.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_alistream_Open(const char *filename, const ESL_ALPHABET *abc, int format, char *errbuf, P7_ALISTREAM **ret_as)
+{
+  P7_ALISTREAM *as = NULL;
+  int           status;
+
+  if (errbuf) errbuf[0] = '\0';
+  if (strcmp(filename, "-") == 0) ESL_XFAIL(eslEINVAL, errbuf, "can't stream an alignment from stdin; it has to be read more than once");
+
+  ESL_ALLOC(as, sizeof(P7_ALISTREAM));
+  as->fp          = NULL;
+  as->filename    = NULL;
+  as->format      = format;
+  as->abc         = abc;
+  as->line        = NULL;
+  as->lalloc      = 0;
+  as->have_line   = FALSE;
+  as->linenumber  = 0;
+  as->seqtxt      = NULL;
+  as->seqlen      = 0;
+  as->seqalloc    = 0;
+  as->sqname      = NULL;
+  as->rows        = NULL;
+  as->names       = NULL;
+  as->nrowalloc   = 0;
+  as->alen        = -1;
+  as->nseq        = 0;
+  as->nseq_total  = -1;
+  as->block_ended = FALSE;
+  as->at_end      = FALSE;
+  as->hdr         = NULL;
+  as->setname     = NULL;
+  as->errbuf[0]   = '\0';
+
+  if ((status = esl_strdup(filename, -1, &(as->filename))) != eslOK) goto ERROR;
+  if ((as->hdr = esl_msa_CreateDigital(abc, 16, -1)) == NULL) { status = eslEMEM; goto ERROR; }
+  if ((as->fp  = fopen(filename, "r"))               == NULL) ESL_XFAIL(eslENOTFOUND, errbuf, "failed to open alignment file %s", filename);
+
+  if (format == eslMSAFILE_UNKNOWN)
+    {
+      while ((status = esl_fgets(&(as->line), &(as->lalloc), as->fp)) == eslOK && is_blank(as->line)) ;
+      if      (status == eslOK && strncmp(as->line, "# STOCKHOLM", 11) == 0) as->format = eslMSAFILE_STOCKHOLM;
+      else if (status == eslOK && as->line[0] == '>')                      as->format = eslMSAFILE_AFA;
+      else if (status == eslEMEM) goto ERROR;
+      else ESL_XFAIL(eslEFORMAT, errbuf, "%s doesn't look like a Stockholm or aligned FASTA file", filename);
+      rewind(as->fp);
+    }
+  else if (format == eslMSAFILE_PFAM) as->format = eslMSAFILE_STOCKHOLM;
+  else if (format != eslMSAFILE_STOCKHOLM && format != eslMSAFILE_AFA)
+    ESL_XFAIL(eslEINVAL, errbuf, "only Stockholm/Pfam or aligned FASTA alignments can be streamed");
+
+  *ret_as = as;
+  return eslOK;
+
+ ERROR:
+  p7_alistream_Close(as);
+  *ret_as = NULL;
+  return status;
+}
+
+
+/* Function:  p7_alistream_SetName()
+ * Synopsis:  Name the streamed alignment.
+ *
+ * Purpose:   Name the alignment <name>, in place of any #=GF ID name
+ *            in the file. The name takes effect when the first pass
+ *            ends, so call this before then. Without a name from
+ *            either source, the alignment is named for the file,
+ *            without its suffix.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_alistream_SetName(P7_ALISTREAM *as, const char *name)
+{
+  if (as->setname) free(as->setname);
+  as->setname = NULL;
+  return esl_strdup(name, -1, &(as->setname));
+}
+
+
+/* Function:  p7_alistream_Read()
+ * Synopsis:  Read the next chunk of aligned sequences.
+ *
+ * Purpose:   Read up to <nmax> more aligned sequences, and return
+ *            them in <*ret_msa> as a new digital <ESL_MSA> of <n>
+ *            sequences (<1 <= n <= nmax>) and the full alignment
+ *            length, with sequence names and uniform weights but no
+ *            other annotation. Caller frees it with
+ *            <esl_msa_Destroy()>.
+ *
+ *            When the current pass is over, returns <eslEOF>. After
+ *            the first pass, <as->hdr> holds the alignment's name
+ *            and annotation (and its <alen>), and <as->nseq_total>
+ *            is the number of sequences.
+ *
+ *            The caller should use the same <nmax> on every call;
+ *            <nmax> rows of the alignment are kept for reuse.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEOF> if no sequences remain in this pass.
+ *            <eslEFORMAT> on a parse error, including interleaved
+ *            Stockholm, sequences of unequal aligned length, or a
+ *            file that changed between passes. <as->errbuf> contains
+ *            a message.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_alistream_Read(P7_ALISTREAM *as, int nmax, ESL_MSA **ret_msa)
+{
+  ESL_MSA *msa = NULL;
+  ESL_DSQ *tmp;
+  void    *p;
+  int      n   = 0;
+  int      i;
+  int      status;
+
+  *ret_msa = NULL;
+  if (as->at_end) return eslEOF;
+
+  while (n < nmax)
+    {
+      status = (as->format == eslMSAFILE_AFA) ? next_afa(as) : next_stockholm(as);
+      if      (status == eslEOF) break;
+      else if (status != eslOK)  goto ERROR;
+
+      if (as->alen == -1) as->alen = as->seqlen;
+      if (as->seqlen != as->alen)
+	ESL_XFAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": aligned length of %s (%" PRId64 ") differs from the first sequence's (%" PRId64 ")", as->linenumber, as->sqname, as->seqlen, as->alen);
+
+      if (nmax > as->nrowalloc)
+	{
+	  ESL_RALLOC(as->rows,  p, sizeof(ESL_DSQ *) * nmax);
+	  ESL_RALLOC(as->names, p, sizeof(char *)    * nmax);
+	  for (i = as->nrowalloc; i < nmax; i++) { as->rows[i] = NULL; as->names[i] = NULL; }
+	  for (i = as->nrowalloc; i < nmax; i++) ESL_ALLOC(as->rows[i], sizeof(ESL_DSQ) * (as->alen+2));
+	  as->nrowalloc = nmax;
+	}
+      if (esl_abc_Digitize(as->abc, as->seqtxt, as->rows[n]) != eslOK)
+	ESL_XFAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": sequence %s has characters that aren't in the alphabet", as->linenumber, as->sqname);
+      as->names[n] = as->sqname;
+      as->sqname   = NULL;
+      n++;
+      as->nseq++;
+    }
+
+  if (n == 0)
+    {
+      if ((status = finish_pass(as)) != eslOK) goto ERROR;
+      return eslEOF;
+    }
+
+  /* Hand the digitized rows over to the new MSA, taking its freshly
+   * allocated rows (of the same size) in exchange for next time.
+   */
+  if ((msa = esl_msa_CreateDigital(as->abc, n, as->alen)) == NULL) { status = eslEMEM; goto ERROR; }
+  msa->nseq = n;
+  for (i = 0; i < n; i++)
+    {
+      tmp            = msa->ax[i];
+      msa->ax[i]     = as->rows[i];
+      as->rows[i]    = tmp;
+      msa->sqname[i] = as->names[i];
+      as->names[i]   = NULL;
+      msa->wgt[i]    = 1.0;
+    }
+  if ((status = esl_msa_SetName(msa, (as->hdr->name ? as->hdr->name : as->filename), -1)) != eslOK) goto ERROR;
+
+  *ret_msa = msa;
+  return eslOK;
+
+ ERROR:
+  for (i = 0; i < n; i++)
+    if (as->names[i]) { free(as->names[i]); as->names[i] = NULL; }
+  if (msa) esl_msa_Destroy(msa);
+  return status;
+}
+
+
+/* Function:  p7_alistream_Rewind()
+ * Synopsis:  Start another pass over the alignment.
+ *
+ * Purpose:   Rewind the stream to its first sequence. Annotation
+ *            collected in <as->hdr> on the first pass is kept.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslESYS> if the file can't be rewound.
+ */
+int
+p7_alistream_Rewind(P7_ALISTREAM *as)
+{
+  if (fseek(as->fp, 0L, SEEK_SET) != 0) ESL_EXCEPTION_SYS(eslESYS, "failed to rewind alignment file");
+  as->have_line   = FALSE;
+  as->linenumber  = 0;
+  as->nseq        = 0;
+  as->block_ended = FALSE;
+  as->at_end      = FALSE;
+  return eslOK;
+}
+
+
+/* Function:  p7_alistream_Close()
+ * Synopsis:  Close an alignment stream.
+ */
+void
+p7_alistream_Close(P7_ALISTREAM *as)
+{
+  int i;
+
+  if (as == NULL) return;
+  if (as->fp)       fclose(as->fp);
+  if (as->filename) free(as->filename);
+  if (as->line)     free(as->line);
+  if (as->seqtxt)   free(as->seqtxt);
+  if (as->sqname)   free(as->sqname);
+  if (as->rows)   { for (i = 0; i < as->nrowalloc; i++) if (as->rows[i])  free(as->rows[i]);  free(as->rows);  }
+  if (as->names)  { for (i = 0; i < as->nrowalloc; i++) if (as->names[i]) free(as->names[i]); free(as->names); }
+  if (as->hdr)      esl_msa_Destroy(as->hdr);
+  if (as->setname)  free(as->setname);
+  free(as);
+}
+/*------------------ end, P7_ALISTREAM object -------------------*/
+
+
+
+/*****************************************************************
+ *# 2. Internal functions: parsing.
+ *****************************************************************/
+
+/* next_stockholm(), next_afa()
+ * Read the next aligned sequence: its name into <as->sqname>, its
+ * aligned text (whitespace removed) into <as->seqtxt>. Return
+ * <eslEOF> at the end of the alignment.
+ */
+static int
+next_stockholm(P7_ALISTREAM *as)
+{
+  char *s, *name, *text;
+  int   status;
+
+  while ((status = esl_fgets(&(as->line), &(as->lalloc), as->fp)) == eslOK)
+    {
+      as->linenumber++;
+      s = as->line;
+
+      if (is_blank(s))
+	{
+	  if (as->nseq > 0) as->block_ended = TRUE;
+	  continue;
+	}
+      if (strncmp(s, "//", 2) == 0)
+	{
+	  if (as->nseq_total == -1)
+	    while ((status = esl_fgets(&(as->line), &(as->lalloc), as->fp)) == eslOK)
+	      if (! is_blank(as->line)) ESL_FAIL(eslEFORMAT, as->errbuf, "%s contains more than one alignment; only one can be streamed", as->filename);
+	  return eslEOF;
+	}
+      if (*s == '#')
+	{
+	  if (as->nseq_total == -1 && (status = parse_markup(as, s)) != eslOK) return status;
+	  continue;
+	}
+
+      if (as->block_ended)
+	ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": %s is interleaved (multiblock) Stockholm, which can't be streamed; reformat it to Pfam format, one line per sequence", as->linenumber, as->filename);
+      if (esl_strtok(&s, " \t\n\r", &name) != eslOK) ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": no sequence name", as->linenumber);
+      if (esl_strtok(&s, " \t\n\r", &text) != eslOK) ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": no aligned sequence for %s", as->linenumber, name);
+
+      if (as->sqname) free(as->sqname);
+      as->sqname = NULL;
+      if ((status = esl_strdup(name, -1, &(as->sqname))) != eslOK) return status;
+      if ((status = clear_text(as))                       != eslOK) return status;
+      return append_text(as, text);
+    }
+  if (status != eslEOF) return status;
+  ESL_FAIL(eslEFORMAT, as->errbuf, "%s ended without a // line", as->filename);
+}
+
+static int
+next_afa(P7_ALISTREAM *as)
+{
+  char *s, *name;
+  int   status;
+
+  if (! as->have_line)
+    do {
+      if ((status = esl_fgets(&(as->line), &(as->lalloc), as->fp)) != eslOK) return status; /* eslEOF: end of the alignment */
+      as->linenumber++;
+    } while (is_blank(as->line));
+  as->have_line = FALSE;
+
+  s = as->line;
+  if (*s != '>')                                 ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": expected a > name line", as->linenumber);
+  s++;
+  if (esl_strtok(&s, " \t\n\r", &name) != eslOK) ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": no sequence name", as->linenumber);
+
+  if (as->sqname) free(as->sqname);
+  as->sqname = NULL;
+  if ((status = esl_strdup(name, -1, &(as->sqname))) != eslOK) return status;
+  if ((status = clear_text(as))                       != eslOK) return status;
+
+  while ((status = esl_fgets(&(as->line), &(as->lalloc), as->fp)) == eslOK)
+    {
+      as->linenumber++;
+      if (as->line[0] == '>') { as->have_line = TRUE; break; }
+      if ((status = append_text(as, as->line)) != eslOK) return status;
+    }
+  return (status == eslEOF ? eslOK : status);
+}
+
+
+/* parse_markup()
+ * Collect the #=GF and #=GC annotation we need into <as->hdr>.
+ * Everything else (#=GS, #=GR, comments) is skipped.
+ */
+static int
+parse_markup(P7_ALISTREAM *as, char *s)
+{
+  ESL_MSA *hdr  = as->hdr;
+  char    *gx, *tag, *text;
+  char   **dest = NULL;
+  int      status;
+
+  if (esl_strtok(&s, " \t\n\r", &gx)  != eslOK) return eslOK;
+  if (strcmp(gx, "#=GF") != 0 && strcmp(gx, "#=GC") != 0) return eslOK;
+  if (esl_strtok(&s, " \t\n\r", &tag) != eslOK) ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": %s line with no tag", as->linenumber, gx);
+
+  if (strcmp(gx, "#=GF") == 0)
+    {
+      if      (strcmp(tag, "GA") == 0) return parse_cutoffs(as, s, eslMSA_GA1, eslMSA_GA2);
+      else if (strcmp(tag, "TC") == 0) return parse_cutoffs(as, s, eslMSA_TC1, eslMSA_TC2);
+      else if (strcmp(tag, "NC") == 0) return parse_cutoffs(as, s, eslMSA_NC1, eslMSA_NC2);
+      else if (strcmp(tag, "DE") == 0)
+	{ /* free text: keep all of it, joining continuation lines with a space */
+	  while (*s == ' ' || *s == '\t') s++;
+	  esl_strchop(s, -1);
+	  if (hdr->desc && (status = esl_strcat(&(hdr->desc), -1, " ", 1)) != eslOK) return status;
+	  return esl_strcat(&(hdr->desc), -1, s, -1);
+	}
+      if (esl_strtok(&s, " \t\n\r", &text) != eslOK) return eslOK;
+      if      (strcmp(tag, "ID") == 0) return esl_msa_SetName     (hdr, text, -1);
+      else if (strcmp(tag, "AC") == 0) return esl_msa_SetAccession(hdr, text, -1);
+      return eslOK;
+    }
+
+  if      (strcmp(tag, "RF")      == 0) dest = &(hdr->rf);
+  else if (strcmp(tag, "MM")      == 0) dest = &(hdr->mm);
+  else if (strcmp(tag, "SS_cons") == 0) dest = &(hdr->ss_cons);
+  else if (strcmp(tag, "SA_cons") == 0) dest = &(hdr->sa_cons);
+  else return eslOK;
+
+  if (*dest != NULL)                            ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": second #=GC %s line; %s is interleaved (multiblock) Stockholm, which can't be streamed", as->linenumber, tag, as->filename);
+  if (esl_strtok(&s, " \t\n\r", &text) != eslOK) ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": #=GC %s line has no annotation", as->linenumber, tag);
+  return esl_strdup(text, -1, dest);
+}
+
+/* parse_cutoffs()
+ * A GA/TC/NC line has one or two scores, as "25.0 25.0;".
+ */
+static int
+parse_cutoffs(P7_ALISTREAM *as, char *s, int which1, int which2)
+{
+  ESL_MSA *hdr = as->hdr;
+  char    *tok;
+
+  if (esl_strtok(&s, " \t\n\r;", &tok) != eslOK || ! esl_str_IsReal(tok))
+    ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": expected a score cutoff", as->linenumber);
+  hdr->cutoff[which1] = atof(tok);
+  hdr->cutset[which1] = TRUE;
+
+  if (esl_strtok(&s, " \t\n\r;", &tok) == eslOK)
+    {
+      if (! esl_str_IsReal(tok)) ESL_FAIL(eslEFORMAT, as->errbuf, "line %" PRId64 ": expected a score cutoff", as->linenumber);
+      hdr->cutoff[which2] = atof(tok);
+      hdr->cutset[which2] = TRUE;
+    }
+  return eslOK;
+}
+
+/* clear_text(), append_text()
+ * Build up the current sequence's aligned text in <as->seqtxt>,
+ * leaving out whitespace.
+ */
+static int
+clear_text(P7_ALISTREAM *as)
+{
+  int status;
+
+  if (as->seqalloc == 0)
+    {
+      ESL_ALLOC(as->seqtxt, sizeof(char) * 256);
+      as->seqalloc = 256;
+    }
+  as->seqtxt[0] = '\0';
+  as->seqlen    = 0;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+static int
+append_text(P7_ALISTREAM *as, const char *s)
+{
+  void *p;
+  int   status;
+
+  for (; *s != '\0'; s++)
+    {
+      if (isspace((int) *s)) continue;
+      if (as->seqlen + 1 >= as->seqalloc)
+	{
+	  ESL_RALLOC(as->seqtxt, p, sizeof(char) * as->seqalloc * 2);
+	  as->seqalloc *= 2;
+	}
+      as->seqtxt[as->seqlen++] = *s;
+    }
+  as->seqtxt[as->seqlen] = '\0';
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* finish_pass()
+ * At the end of the first pass, complete the header: alignment
+ * length, name, and a check that #=GC lines match the alignment.
+ * On later passes, make sure we saw the same number of sequences.
+ */
+static int
+finish_pass(P7_ALISTREAM *as)
+{
+  ESL_MSA *hdr  = as->hdr;
+  char    *tail = NULL;
+  int      status;
+
+  as->at_end = TRUE;
+
+  if (as->nseq_total != -1)
+    {
+      if (as->nseq != as->nseq_total) ESL_FAIL(eslEFORMAT, as->errbuf, "%s changed while being read: %d sequences, not %d as before", as->filename, as->nseq, as->nseq_total);
+      return eslOK;
+    }
+
+  if (as->nseq == 0) ESL_FAIL(eslEFORMAT, as->errbuf, "no aligned sequences found in %s", as->filename);
+  if ((hdr->rf      && strlen(hdr->rf)      != as->alen) ||
+      (hdr->mm      && strlen(hdr->mm)      != as->alen) ||
+      (hdr->ss_cons && strlen(hdr->ss_cons) != as->alen) ||
+      (hdr->sa_cons && strlen(hdr->sa_cons) != as->alen))
+    ESL_FAIL(eslEFORMAT, as->errbuf, "#=GC annotation in %s isn't the same length as the alignment (%" PRId64 ")", as->filename, as->alen);
+
+  as->nseq_total = as->nseq;
+  hdr->alen      = as->alen;
+
+  if (as->setname)
+    status = esl_msa_SetName(hdr, as->setname, -1);
+  else if (hdr->name == NULL)
+    {
+      if ((status = esl_FileTail(as->filename, TRUE, &tail)) != eslOK) return status; /* TRUE=nosuffix */
+      status = esl_msa_SetName(hdr, tail, -1);
+      free(tail);
+    }
+  else status = eslOK;
+  return status;
+}
+
+static int
+is_blank(const char *s)
+{
+  for (; *s != '\0'; s++)
+    if (! isspace((int) *s)) return FALSE;
+  return TRUE;
+}
+/*------------------- end, parsing ------------------------------*/
+
+
+
+/*****************************************************************
+ * 3. Unit tests.
+ *****************************************************************/
+#ifdef p7ALISTREAM_TESTDRIVE
+
+/* Stream the same alignment, in Stockholm and in aligned FASTA,
+ * in chunks of <nmax>, twice over; every chunk must match the
+ * corresponding rows of the alignment as Easel reads it.
+ */
+static void
+utest_chunks(ESL_ALPHABET *abc, int nmax)
+{
+  char          msg[]       = "p7_alistream chunks unit test failed";
+  char          stofile[16] = "p7tmpXXXXXX";
+  char          afafile[16] = "p7tmpXXXXXX";
+  char         *files[2];
+  FILE         *ofp         = NULL;
+  ESL_MSAFILE  *afp         = NULL;
+  ESL_MSA      *msa         = NULL;
+  ESL_MSA      *chunk       = NULL;
+  P7_ALISTREAM *as          = NULL;
+  int           f, pass, idx, i, status;
+
+  if (esl_tmpfile_named(stofile, &ofp) != eslOK) esl_fatal(msg);
+  fprintf(ofp, "# STOCKHOLM 1.0\n");
+  fprintf(ofp, "#=GF ID   test\n");
+  fprintf(ofp, "#=GF DE   a test\n");
+  fprintf(ofp, "#=GF DE   alignment\n");
+  fprintf(ofp, "#=GF GA   25.0 20.0;\n");
+  fprintf(ofp, "seq1    --ACDEFGHIKLMNPZXS-TVW-Yyy\n");
+  fprintf(ofp, "#=GS seq1 DE first\n");
+  fprintf(ofp, "seq2    aaACDEFGHIKLMNPQRS-TVWw---\n");
+  fprintf(ofp, "seq3    aaAC-EFGHIKLMNPQRS-TVW-Y--\n");
+  fprintf(ofp, "seq4    aaAC-EFGHIKLMNPQRS-TVW-Y--\n");
+  fprintf(ofp, "seq5    ~~AC-EFGHIKLMNPQRS-TVW-Y~~\n");
+  fprintf(ofp, "#=GC RF --xxxxxxxxxxxxxxxx-xxx-x--\n");
+  fprintf(ofp, "//\n");
+  fclose(ofp);
+
+  if (esl_tmpfile_named(afafile, &ofp) != eslOK) esl_fatal(msg);
+  fprintf(ofp, ">seq1 first\n--ACDEFGHIKLM\nNPZXS-TVW-Yyy\n");
+  fprintf(ofp, ">seq2\naaACDEFGHIKLMNPQRS-TVWw---\n");
+  fprintf(ofp, ">seq3\naaAC-EFGHIKLMNPQRS-TVW-Y--\n\n");
+  fprintf(ofp, ">seq4\naaAC-EFGHIKLMNPQRS-TVW-Y--\n");
+  fprintf(ofp, ">seq5\n~~AC-EFGHIKLMNPQRS-TVW-Y~~\n");
+  fclose(ofp);
+
+  if (esl_msafile_Open(&abc, stofile, NULL, eslMSAFILE_STOCKHOLM, NULL, &afp) != eslOK) esl_fatal(msg);
+  if (esl_msafile_Read(afp, &msa)                                              != eslOK) esl_fatal(msg);
+  esl_msafile_Close(afp);
+
+  files[0] = stofile;
+  files[1] = afafile;
+  for (f = 0; f < 2; f++)
+    {
+      if (p7_alistream_Open(files[f], abc, eslMSAFILE_UNKNOWN, NULL, &as) != eslOK) esl_fatal(msg);
+      for (pass = 0; pass < 2; pass++)
+	{
+	  idx = 0;
+	  while ((status = p7_alistream_Read(as, nmax, &chunk)) == eslOK)
+	    {
+	      if (chunk->nseq < 1 || chunk->nseq > nmax || chunk->alen != msa->alen) esl_fatal(msg);
+	      for (i = 0; i < chunk->nseq; i++, idx++)
+		{
+		  if (strcmp(chunk->sqname[i], msa->sqname[idx]) != 0)                          esl_fatal(msg);
+		  if (memcmp(chunk->ax[i], msa->ax[idx], sizeof(ESL_DSQ) * (msa->alen+2)) != 0) esl_fatal(msg);
+		}
+	      esl_msa_Destroy(chunk);
+	    }
+	  if (status != eslEOF || idx != msa->nseq || as->nseq_total != msa->nseq) esl_fatal(msg);
+	  if (p7_alistream_Rewind(as) != eslOK) esl_fatal(msg);
+	}
+
+      if (as->hdr->alen != msa->alen) esl_fatal(msg);
+      if (f == 0)
+	{
+	  if (strcmp(as->hdr->name, "test")             != 0) esl_fatal(msg);
+	  if (strcmp(as->hdr->desc, "a test alignment") != 0) esl_fatal(msg);
+	  if (strcmp(as->hdr->rf,   msa->rf)            != 0) esl_fatal(msg);
+	  if (! as->hdr->cutset[eslMSA_GA2] || as->hdr->cutoff[eslMSA_GA2] != 20.0) esl_fatal(msg);
+	}
+      p7_alistream_Close(as);
+    }
+
+  esl_msa_Destroy(msa);
+  remove(stofile);
+  remove(afafile);
+}
+
+/* Interleaved Stockholm, and sequences of unequal length, are
+ * format errors.
+ */
+static void
+utest_rejects(ESL_ALPHABET *abc)
+{
+  char          msg[]       = "p7_alistream rejects unit test failed";
+  char          tmpfile[16] = "p7tmpXXXXXX";
+  FILE         *ofp         = NULL;
+  ESL_MSA      *chunk       = NULL;
+  P7_ALISTREAM *as          = NULL;
+  int           status;
+
+  if (esl_tmpfile_named(tmpfile, &ofp) != eslOK) esl_fatal(msg);
+  fprintf(ofp, "# STOCKHOLM 1.0\n\n");
+  fprintf(ofp, "seq1    ACDEFGHIKL\n");
+  fprintf(ofp, "seq2    ACDEFGHIKL\n\n");
+  fprintf(ofp, "seq1    MNPQRSTVWY\n");
+  fprintf(ofp, "seq2    MNPQRSTVWY\n");
+  fprintf(ofp, "//\n");
+  fclose(ofp);
+
+  if (p7_alistream_Open(tmpfile, abc, eslMSAFILE_UNKNOWN, NULL, &as) != eslOK) esl_fatal(msg);
+  while ((status = p7_alistream_Read(as, 1, &chunk)) == eslOK) esl_msa_Destroy(chunk);
+  if (status != eslEFORMAT) esl_fatal(msg);
+  p7_alistream_Close(as);
+  remove(tmpfile);
+
+  strcpy(tmpfile, "p7tmpXXXXXX");
+  if (esl_tmpfile_named(tmpfile, &ofp) != eslOK) esl_fatal(msg);
+  fprintf(ofp, ">seq1\nACDEFGHIKL\n>seq2\nACDEFGHIK\n");
+  fclose(ofp);
+
+  if (p7_alistream_Open(tmpfile, abc, eslMSAFILE_AFA, NULL, &as) != eslOK) esl_fatal(msg);
+  while ((status = p7_alistream_Read(as, 1, &chunk)) == eslOK) esl_msa_Destroy(chunk);
+  if (status != eslEFORMAT) esl_fatal(msg);
+  p7_alistream_Close(as);
+  remove(tmpfile);
+}
+#endif /*p7ALISTREAM_TESTDRIVE*/
+/*-------------------- end, unit tests --------------------------*/
+
+
+
+/*****************************************************************
+ * 4. Test driver.
+ *****************************************************************/
+#ifdef p7ALISTREAM_TESTDRIVE
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_getopts.h"
+
+#include "hmmer.h"
+
+static ESL_OPTIONS options[] = {
+   /* name  type         default  env   range togs  reqs  incomp  help                docgrp */
+  {"-h",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show help and usage",                            0},
+  {"-v",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show verbose commentary/output",                 0},
+  { 0,0,0,0,0,0,0,0,0,0},
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for p7_alistream";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS  *go         = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_ALPHABET *abc        = esl_alphabet_Create(eslAMINO);
+  int           be_verbose = esl_opt_GetBoolean(go, "-v");
+
+  if (be_verbose) printf("p7_alistream unit test\n");
+
+  utest_chunks(abc, 1);
+  utest_chunks(abc, 2);
+  utest_chunks(abc, 100);
+  utest_rejects(abc);
+
+  esl_alphabet_Destroy(abc);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /*p7ALISTREAM_TESTDRIVE*/
+
+/************************************************************
+ * @LICENSE@
+ ************************************************************/
@@ -64,6 +64,10 @@ p7_builder_Create(const ESL_GETOPTS *go, const ESL_ALPHABET *abc)
   bld->Q            = NULL;
   bld->eset         = -1.0;	/* -1.0 = unset; must be set if effn_strategy is p7_EFFN_SET */
   bld->re_target    = -1.0;
+  bld->eclust_greedy = FALSE;	/* hmmbuild-specific options; callers set these after Create() */
+  bld->ncpus         = 0;
+  bld->release_cpus  = NULL;
+  bld->release_arg   = NULL;
 
   if (go == NULL) 
     {
@@ -383,10 +387,16 @@ static int    validate_msa         (P7_BUILDER *bld, ESL_MSA *msa);
 static int    relative_weights     (P7_BUILDER *bld, ESL_MSA *msa);
 static int    build_model          (P7_BUILDER *bld, ESL_MSA *msa, P7_HMM **ret_hmm, P7_TRACE ***opt_tr);
 static int    effective_seqnumber  (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, const P7_BG *bg);
+static void   release_cpus         (P7_BUILDER *bld);
 static int    parameterize         (P7_BUILDER *bld, P7_HMM *hmm);
 static int    annotate             (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm);
 static int    calibrate            (P7_BUILDER *bld, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om);
 static int    make_post_msa        (P7_BUILDER *bld, const ESL_MSA *premsa, const P7_HMM *hmm, P7_TRACE **tr, ESL_MSA **opt_postmsa);
+static int    finish_model         (P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om);
+static int    stream_weights       (P7_BUILDER *bld, ESL_MSA *chunk, const double *colw, double wscale);
+static int    stream_occupancy     (P7_BUILDER *bld, P7_ALISTREAM *as, const double *colw, double *ret_sumw, double *r, double *totwgt);
+static void   checksum_add         (const ESL_MSA *msa, uint32_t *val);
+static void   checksum_finish      (uint32_t *val);
 
 /* Function:  p7_Builder()
  * Synopsis:  Build a new HMM from an MSA.
@@ -429,7 +439,7 @@ p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, P7_BG *bg,
 	   P7_HMM **opt_hmm, P7_TRACE ***opt_trarr, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om,
 	   ESL_MSA **opt_postmsa, FILE *seqweights_w_fp, FILE *seqweights_e_fp)
 {
-  int i,j;
+  int i;
   uint32_t    checksum = 0;	/* checksum calculated for the input MSA. hmmalign --mapali verifies against this. */
   P7_HMM     *hmm      = NULL;
   P7_TRACE  **tr       = NULL;
@@ -454,28 +464,14 @@ p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, P7_BG *bg,
       hmm->t[i][p7H_II] = ESL_MIN(hmm->t[i][p7H_II], bld->max_insert_len*hmm->t[i][p7H_MI]);
 
   if ((status =  effective_seqnumber  (bld, msa, hmm, bg))              != eslOK) goto ERROR;
+  release_cpus(bld);
   if (seqweights_e_fp != NULL) {
     for (i = 0; i < msa->nseq; i++)
       fprintf( seqweights_e_fp, "%.4f  %s\n", msa->wgt[i], msa->sqname[i]) ;
   }
-  if ((status =  parameterize         (bld, hmm))                       != eslOK) goto ERROR;
-  if ((status =  annotate             (bld, msa, hmm))                  != eslOK) goto ERROR;
-  if ((status =  calibrate            (bld, hmm, bg, opt_gm, opt_om))   != eslOK) goto ERROR;
+  if ((status =  finish_model         (bld, msa, hmm, bg, opt_gm, opt_om)) != eslOK) goto ERROR;
   if ((status =  make_post_msa        (bld, msa, hmm, tr, opt_postmsa)) != eslOK) goto ERROR;
 
-  //force masked positions to background  (it'll be close already, so no relevant impact on weighting)
-  if (hmm->mm != NULL)
-    for (i=1; i<hmm->M; i++ )
-      if (hmm->mm[i] == 'm')
-        for (j=0; j<hmm->abc->K; j++)
-          hmm->mat[i][j] = bg->f[j];
-
-  if ( bld->abc->type == eslDNA ||  bld->abc->type == eslRNA ) {
-	  if (bld->w_len > 0)           hmm->max_length = bld->w_len;
-	  else if (bld->w_beta == 0.0)  hmm->max_length = hmm->M *4;
-	  else if ( (status =  p7_Builder_MaxLength(hmm, bld->w_beta)) != eslOK) goto ERROR;
-  }
-
   hmm->checksum = checksum;
   hmm->flags   |= p7H_CHKSUM;
 
@@ -492,6 +488,187 @@ p7_Builder(P7_BUILDER *bld, ESL_MSA *msa, P7_BG *bg,
 }
 
 
+/* Function:  p7_StreamBuilder()
+ * Synopsis:  Build a new HMM from an alignment too large to read whole.
+ *
+ * Purpose:   Build a new HMM, as <p7_Builder()> does, from the
+ *            alignment open on stream <as>, reading it
+ *            <p7_BUILDER_STREAMCHUNK> sequences at a time so that
+ *            memory use doesn't grow with the number of sequences.
+ *            The alignment is read two to four times:
+ *
+ *              1. validate sequences, checksum, and collect PB
+ *                 residue counts per column (and the annotation);
+ *              2. sum the relative weights and, for <--fast>
+ *                 architecture, the weighted residue occupancy of
+ *                 each column (skipped for <--hand> with no
+ *                 weighting), once more in the rare case that PB
+ *                 weights are all zero and fall back to uniform;
+ *              3. count the normalized, weighted faux traces into
+ *                 the new model.
+ *
+ *            The result is the same model <p7_Builder()> would make
+ *            from the whole alignment, up to floating point
+ *            roundoff in the summations.
+ *
+ *            Only relative weights that need one column at a time
+ *            can be streamed: PB (the default) or none. GSC, BLOSUM
+ *            and given weights, and <--eclust> effective sequence
+ *            number, need all the sequences at once and are
+ *            rejected.
+ *
+ *            Any name set with <p7_alistream_SetName()> must be set
+ *            before calling this.
+ *
+ * Args:      bld         - build configuration
+ *            as          - open alignment stream, not yet read
+ *            bg          - null model
+ *            opt_hmm     - optRETURN: new HMM
+ *            opt_gm      - optRETURN: profile corresponding to <hmm>
+ *            opt_om      - optRETURN: optimized profile corresponding to <gm>
+ *
+ * Returns:   <eslOK> on success.
+ *
+ *            Returns <eslENORESULT> if no consensus columns were
+ *            annotated; <eslEFORMAT> on alignment format problems,
+ *            including a missing RF line for hand architecture;
+ *            <eslEINVAL> if <bld> asks for weighting or effective
+ *            sequence number that can't be streamed. On any
+ *            returned error, <bld->errbuf> contains an informative
+ *            message.
+ *
+ * Throws:    <eslEMEM> on allocation error.
+ *            <eslESYS> if the alignment file can't be rewound.
+ */
+int
+p7_StreamBuilder(P7_BUILDER *bld, P7_ALISTREAM *as, P7_BG *bg, P7_HMM **opt_hmm, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om)
+{
+  uint32_t   checksum  = 0;
+  ESL_MSA   *chunk     = NULL;
+  ESL_MSA   *hdr       = as->hdr;   /* alignment's annotation; no seqs */
+  P7_HMM    *hmm       = NULL;
+  double    *colw      = NULL;      /* PB residue counts, then weight terms: [(apos-1)*K + a] */
+  double    *r         = NULL;      /* weighted residue count in each column 1..alen, for --fast */
+  double    *totwgt    = NULL;      /* weighted residue+gap count in each column                 */
+  int       *matassign = NULL;      /* MAT state assignments if 1; 1..alen                       */
+  double     sumw      = 0.;
+  double     wscale    = 1.;
+  int        K         = bld->abc->K;
+  int64_t    apos;
+  int        M;
+  int        i;
+  int        status;
+
+  if (opt_hmm != NULL) *opt_hmm = NULL;
+  if (bld->wgt_strategy  != p7_WGT_PB && bld->wgt_strategy != p7_WGT_NONE)
+    ESL_XFAIL(eslEINVAL, bld->errbuf, "only PB weights, or none, can be used when streaming an alignment");
+  if (bld->effn_strategy == p7_EFFN_CLUST)
+    ESL_XFAIL(eslEINVAL, bld->errbuf, "clustering for effective seq number can't be used when streaming an alignment");
+
+  /* Pass 1: validate; checksum; PB residue counts. */
+  while ((status = p7_alistream_Read(as, p7_BUILDER_STREAMCHUNK, &chunk)) == eslOK)
+    {
+      if (bld->wgt_strategy == p7_WGT_PB && colw == NULL)
+	{
+	  ESL_ALLOC(colw, sizeof(double) * chunk->alen * K);
+	  esl_vec_DSet(colw, chunk->alen * K, 0.);
+	}
+      if ((status = validate_msa(bld, chunk)) != eslOK) goto ERROR;
+      checksum_add(chunk, &checksum);
+      if (colw) p7_msaweight_PBStreamCount(chunk, colw);
+      esl_msa_Destroy(chunk);
+      chunk = NULL;
+    }
+  if (status != eslEOF) ESL_XFAIL(status, bld->errbuf, "%s", as->errbuf);
+  checksum_finish(&checksum);
+  if (colw) p7_msaweight_PBStreamFinish(hdr->alen, K, colw);
+
+  /* Pass 2: sum of relative weights; column occupancy for --fast. */
+  ESL_ALLOC(matassign, sizeof(int) * (hdr->alen+1));
+  if (bld->arch_strategy == p7_ARCH_FAST)
+    {
+      ESL_ALLOC(r,      sizeof(double) * (hdr->alen+1));
+      ESL_ALLOC(totwgt, sizeof(double) * (hdr->alen+1));
+    }
+  if (colw != NULL || r != NULL)
+    {
+      if ((status = stream_occupancy(bld, as, colw, &sumw, r, totwgt)) != eslOK) goto ERROR;
+      if (colw != NULL && sumw == 0.)
+	{ /* no seq has a canonical residue: PB falls back to uniform weights */
+	  free(colw);
+	  colw = NULL;
+	  if (r != NULL && (status = stream_occupancy(bld, as, colw, &sumw, r, totwgt)) != eslOK) goto ERROR;
+	}
+      if (colw != NULL) wscale = (double) as->nseq_total / sumw;
+    }
+
+  if (bld->arch_strategy == p7_ARCH_FAST)
+    {
+      for (apos = 1; apos <= hdr->alen; apos++)
+	matassign[apos] = (r[apos] > 0. && r[apos] / totwgt[apos] >= bld->symfrac) ? TRUE : FALSE;
+    }
+  else
+    {
+      if (hdr->rf == NULL) ESL_XFAIL(eslEFORMAT, bld->errbuf, "Alignment %s has no reference annotation line\n", hdr->name);
+      for (apos = 1; apos <= hdr->alen; apos++)
+	matassign[apos] = (esl_abc_CIsGap(hdr->abc, hdr->rf[apos-1])? FALSE : TRUE);
+    }
+  for (M = 0, apos = 1; apos <= hdr->alen; apos++)
+    if (matassign[apos]) M++;
+  if (M == 0)
+    {
+      if (bld->arch_strategy == p7_ARCH_FAST) ESL_XFAIL(eslENORESULT, bld->errbuf, "Alignment %s has no consensus columns w/ > %d%% residues - can't build a model.\n", hdr->name, (int) (100 * bld->symfrac));
+      else                                    ESL_XFAIL(eslENORESULT, bld->errbuf, "Alignment %s has no annotated consensus columns - can't build a model.\n", hdr->name);
+    }
+
+  /* Pass 3: count weighted faux traces into the new model. */
+  if ((hmm    = p7_hmm_Create(M, bld->abc)) == NULL)  ESL_XFAIL(eslEMEM, bld->errbuf, "Memory allocation failure in model construction.\n");
+  if ((status = p7_hmm_Zero(hmm))           != eslOK) goto ERROR;
+  if ((status = p7_alistream_Rewind(as))    != eslOK) goto ERROR;
+  while ((status = p7_alistream_Read(as, p7_BUILDER_STREAMCHUNK, &chunk)) == eslOK)
+    {
+      if ((status = stream_weights(bld, chunk, colw, wscale)) != eslOK) goto ERROR;
+      if (hdr->mm && (status = esl_strdup(hdr->mm, hdr->alen, &(chunk->mm))) != eslOK) goto ERROR;
+      if ((status = p7_MatassignCount(chunk, matassign, hmm)) != eslOK) ESL_XFAIL(status, bld->errbuf, "internal error in model construction.\n");
+      esl_msa_Destroy(chunk);
+      chunk = NULL;
+    }
+  if (status != eslEOF) ESL_XFAIL(status, bld->errbuf, "%s", as->errbuf);
+
+  hmm->nseq     = as->nseq_total;
+  hmm->eff_nseq = as->nseq_total;
+  if ((status = p7_MatassignAnnotate(hdr, matassign, hmm)) != eslOK) goto ERROR;
+
+  //Ensures that the weighted-average I->I count <=  bld->max_insert_len
+  if (bld->max_insert_len>0)
+    for (i=1; i<hmm->M; i++ )
+      hmm->t[i][p7H_II] = ESL_MIN(hmm->t[i][p7H_II], bld->max_insert_len*hmm->t[i][p7H_MI]);
+
+  if ((status =  effective_seqnumber  (bld, hdr, hmm, bg))              != eslOK) goto ERROR;
+  release_cpus(bld);
+  if ((status =  finish_model         (bld, hdr, hmm, bg, opt_gm, opt_om)) != eslOK) goto ERROR;
+
+  hmm->checksum = checksum;
+  hmm->flags   |= p7H_CHKSUM;
+
+  if (opt_hmm != NULL) *opt_hmm = hmm; else p7_hmm_Destroy(hmm);
+  free(matassign);
+  if (colw)   free(colw);
+  if (r)      free(r);
+  if (totwgt) free(totwgt);
+  return eslOK;
+
+ ERROR:
+  if (chunk)     esl_msa_Destroy(chunk);
+  if (hmm)       p7_hmm_Destroy(hmm);
+  if (matassign) free(matassign);
+  if (colw)      free(colw);
+  if (r)         free(r);
+  if (totwgt)    free(totwgt);
+  return status;
+}
+
+
 /* Function:  p7_SingleBuilder()
  * Synopsis:  Build a new HMM from a single sequence.
  *
@@ -826,17 +1003,19 @@ validate_msa(P7_BUILDER *bld, ESL_MSA *msa)
 
 /* set_relative_weights():
  * Set msa->wgt vector, using user's choice of relative weighting algorithm.
+ * For deep MSAs, PB and BLOSUM weights use <bld->ncpus> threads.
  */
 static int
 relative_weights(P7_BUILDER *bld, ESL_MSA *msa)
 {
+  int ncpus  = (msa->nseq >= p7_BUILDER_MINPARNSEQ) ? bld->ncpus : 0;
   int status = eslOK;
 
   if      (bld->wgt_strategy == p7_WGT_NONE)                    { esl_vec_DSet(msa->wgt, msa->nseq, 1.); }
   else if (bld->wgt_strategy == p7_WGT_GIVEN)                   ;
-  else if (bld->wgt_strategy == p7_WGT_PB)                      status = esl_msaweight_PB(msa); 
+  else if (bld->wgt_strategy == p7_WGT_PB)                      status = p7_msaweight_PB(msa, ncpus); 
   else if (bld->wgt_strategy == p7_WGT_GSC)                     status = esl_msaweight_GSC(msa); 
-  else if (bld->wgt_strategy == p7_WGT_BLOSUM)                  status = esl_msaweight_BLOSUM(msa, bld->wid); 
+  else if (bld->wgt_strategy == p7_WGT_BLOSUM)                  status = p7_msaweight_BLOSUM(msa, bld->wid, ncpus); 
   else ESL_EXCEPTION(eslEINCONCEIVABLE, "no such weighting strategy");
 
   if (status != eslOK) ESL_FAIL(status, bld->errbuf, "failed to set relative weights in alignment");
@@ -886,7 +1065,7 @@ build_model(P7_BUILDER *bld, ESL_MSA *msa, P7_HMM **ret_hmm, P7_TRACE ***opt_tr)
  * number". 
  *
  * <msa> is needed because we may need to see the sequences in order 
- * to determine effective seq #. (for --eclust)
+ * to determine effective seq #. (for --eclust; threaded for deep MSAs)
  *
  * <prior> is needed because we may need to parameterize test models
  * looking for the right relative entropy. (for --eent, the default)
@@ -919,15 +1098,17 @@ effective_seqnumber(P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, const P7_B
 
   } else {
 
-    if      (bld->effn_strategy == p7_EFFN_NONE)    hmm->eff_nseq = msa->nseq;
+    if      (bld->effn_strategy == p7_EFFN_NONE)    hmm->eff_nseq = hmm->nseq;
     else if (bld->effn_strategy == p7_EFFN_SET)     hmm->eff_nseq = bld->eset;
     else if (bld->effn_strategy == p7_EFFN_CLUST)
     {
         int nclust;
+        int ncpus = (msa->nseq >= p7_BUILDER_MINPARNSEQ) ? bld->ncpus : 0;
 
-        status = esl_msacluster_SingleLinkage(msa, bld->eid, NULL, NULL, &nclust);
+        if (bld->eclust_greedy) status = p7_msacluster_Greedy       (msa, bld->eid, ncpus, &nclust);
+        else                    status = p7_msacluster_SingleLinkage(msa, bld->eid, ncpus, NULL, NULL, &nclust);
         if      (status == eslEMEM) ESL_XFAIL(status, bld->errbuf, "memory allocation failed");
-        else if (status != eslOK)   ESL_XFAIL(status, bld->errbuf, "single linkage clustering algorithm (at %d%% id) failed", (int)(100 * bld->eid));
+        else if (status != eslOK)   ESL_XFAIL(status, bld->errbuf, "%s clustering algorithm (at %d%% id) failed", (bld->eclust_greedy ? "greedy" : "single linkage"), (int)(100 * bld->eid));
 
         hmm->eff_nseq = (double) nclust;
     }
@@ -959,6 +1140,21 @@ effective_seqnumber(P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, const P7_B
 }
 
 
+/* release_cpus()
+ * Weighting and clustering are the only threaded steps; once they're
+ * done, give all but one of <bld->ncpus> back to the caller, through
+ * its optional <bld->release_cpus> callback, rather than hold them
+ * through the serial calibration.
+ */
+static void
+release_cpus(P7_BUILDER *bld)
+{
+  if (bld->release_cpus == NULL || bld->ncpus <= 1) return;
+  (*bld->release_cpus)(bld->release_arg, bld->ncpus - 1);
+  bld->ncpus = 1;
+}
+
+
 /* parameterize()
  * Converts counts to probability parameters.
  */
@@ -1007,6 +1203,136 @@ annotate(P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm)
   return status;
 }
 
+/* finish_model()
+ * The steps after effective sequence number that are common to
+ * p7_Builder() and p7_StreamBuilder(): parameterize, annotate and
+ * calibrate <hmm>, then apply the model mask and (for nucleic acid
+ * models) set the maximum length.
+ */
+static int
+finish_model(P7_BUILDER *bld, const ESL_MSA *msa, P7_HMM *hmm, P7_BG *bg, P7_PROFILE **opt_gm, P7_OPROFILE **opt_om)
+{
+  int i,j;
+  int status;
+
+  if ((status =  parameterize         (bld, hmm))                       != eslOK) return status;
+  if ((status =  annotate             (bld, msa, hmm))                  != eslOK) return status;
+  if ((status =  calibrate            (bld, hmm, bg, opt_gm, opt_om))   != eslOK) return status;
+
+  //force masked positions to background  (it'll be close already, so no relevant impact on weighting)
+  if (hmm->mm != NULL)
+    for (i=1; i<hmm->M; i++ )
+      if (hmm->mm[i] == 'm')
+        for (j=0; j<hmm->abc->K; j++)
+          hmm->mat[i][j] = bg->f[j];
+
+  if ( bld->abc->type == eslDNA ||  bld->abc->type == eslRNA ) {
+	  if (bld->w_len > 0)           hmm->max_length = bld->w_len;
+	  else if (bld->w_beta == 0.0)  hmm->max_length = hmm->M *4;
+	  else if ( (status =  p7_Builder_MaxLength(hmm, bld->w_beta)) != eslOK) return status;
+  }
+  return eslOK;
+}
+
+
+/* stream_weights()
+ * Set relative weights on one chunk of a streamed alignment: PB
+ * weights from <colw> scaled by <wscale>, or uniform weights if
+ * <colw> is <NULL>. Then mark fragments, as p7_Builder() does.
+ */
+static int
+stream_weights(P7_BUILDER *bld, ESL_MSA *chunk, const double *colw, double wscale)
+{
+  if (colw != NULL)
+    {
+      p7_msaweight_PBStreamApply(chunk, colw);
+      esl_vec_DScale(chunk->wgt, chunk->nseq, wscale);
+    }
+  else esl_vec_DSet(chunk->wgt, chunk->nseq, 1.);
+
+  return esl_msa_MarkFragments(chunk, bld->fragthresh);
+}
+
+
+/* stream_occupancy()
+ * One pass over a streamed alignment, with unnormalized weights:
+ * return the sum of the weights in <*ret_sumw> and, if <r> and
+ * <totwgt> aren't <NULL>, the weighted residue and residue+gap count
+ * of each column <1..alen> in them, as p7_Fastmodelmaker() counts
+ * them (missing data ignored). Scaling the weights doesn't change
+ * which columns pass the <symfrac> threshold.
+ */
+static int
+stream_occupancy(P7_BUILDER *bld, P7_ALISTREAM *as, const double *colw, double *ret_sumw, double *r, double *totwgt)
+{
+  ESL_MSA *chunk = NULL;
+  double   sumw  = 0.;
+  int64_t  apos;
+  int      idx;
+  int      status;
+
+  if (r != NULL)
+    {
+      esl_vec_DSet(r,      as->hdr->alen+1, 0.);
+      esl_vec_DSet(totwgt, as->hdr->alen+1, 0.);
+    }
+  if ((status = p7_alistream_Rewind(as)) != eslOK) goto ERROR;
+  while ((status = p7_alistream_Read(as, p7_BUILDER_STREAMCHUNK, &chunk)) == eslOK)
+    {
+      if ((status = stream_weights(bld, chunk, colw, 1.0)) != eslOK) goto ERROR;
+      sumw += esl_vec_DSum(chunk->wgt, chunk->nseq);
+
+      if (r != NULL)
+	for (idx = 0; idx < chunk->nseq; idx++)
+	  for (apos = 1; apos <= chunk->alen; apos++)
+	    {
+	      if      (esl_abc_XIsResidue(chunk->abc, chunk->ax[idx][apos])) { r[apos] += chunk->wgt[idx]; totwgt[apos] += chunk->wgt[idx]; }
+	      else if (esl_abc_XIsGap    (chunk->abc, chunk->ax[idx][apos])) {                              totwgt[apos] += chunk->wgt[idx]; }
+	    }
+      esl_msa_Destroy(chunk);
+      chunk = NULL;
+    }
+  if (status != eslEOF) ESL_XFAIL(status, bld->errbuf, "%s", as->errbuf);
+
+  *ret_sumw = sumw;
+  return eslOK;
+
+ ERROR:
+  if (chunk) esl_msa_Destroy(chunk);
+  return status;
+}
+
+
+/* checksum_add(), checksum_finish()
+ * The same checksum as esl_msa_Checksum() (Jenkins' one-at-a-time
+ * hash of the digital residues, row by row), accumulated over the
+ * chunks of a streamed alignment, so hmmalign --mapali can verify
+ * the alignment a streamed model was built from.
+ */
+static void
+checksum_add(const ESL_MSA *msa, uint32_t *val)
+{
+  int     idx;
+  int64_t apos;
+
+  for (idx = 0; idx < msa->nseq; idx++)
+    for (apos = 1; apos <= msa->alen; apos++)
+      {
+	*val += msa->ax[idx][apos];
+	*val += (*val << 10);
+	*val ^= (*val >>  6);
+      }
+}
+
+static void
+checksum_finish(uint32_t *val)
+{
+  *val += (*val <<  3);
+  *val ^= (*val >> 11);
+  *val += (*val << 15);
+}
+
+
 /* calibrate()
  * 
  * Sets the E value parameters of the model with two short simulations.
@@ -124,6 +124,8 @@ p7_domaindef_Create(ESL_RANDOMNESS *r)
   /* keep a copy of ptr to the RNG */
   ddef->r            = r;  
   ddef->do_reseeding = TRUE;
+
+  ddef->do_alidisplay = TRUE;
   return ddef;
   
  ERROR:
@@ -858,7 +860,7 @@ rescore_isolated_domain(P7_DOMAINDEF *ddef, P7_OPROFILE *om, const ESL_SQ *sq, c
     ddef->nalloc *= 2;
   }
   dom = &(ddef->dcl[ddef->ndom]);
-  dom->ad             = p7_alidisplay_Create(ddef->tr, 0, om, sq, ntsq);
+  dom->ad             = (ddef->do_alidisplay ? p7_alidisplay_Create(ddef->tr, 0, om, sq, ntsq) : p7_alidisplay_CreateCoords(ddef->tr, 0, om, sq));
   dom->scores_per_pos = NULL;
 
 
@@ -905,7 +907,7 @@ rescore_isolated_domain(P7_DOMAINDEF *ddef, P7_OPROFILE *om, const ESL_SQ *sq, c
 
        /* store the results in it, first destroying the old alidisplay object */
        p7_alidisplay_Destroy(dom->ad);
-       dom->ad            = p7_alidisplay_Create(ddef->tr, 0, om, sq, NULL);
+       dom->ad            = (ddef->do_alidisplay ? p7_alidisplay_Create(ddef->tr, 0, om, sq, NULL) : p7_alidisplay_CreateCoords(ddef->tr, 0, om, sq));
     }
 
     /* Estimate bias correction, by computing what the score would've been without
@@ -0,0 +1,542 @@
+/* The P7_PACKEDSQ object: a 2-bit packed nucleotide target sequence,
+ * used by nhmmer's scanning SSV filter.
+ *
+ * The SSV filter is the only stage of the nhmmer pipeline that reads
+ * every residue of the target; it is memory-bandwidth bound once the
+ * model is small. Packing four A/C/G/T residues per byte cuts the
+ * bytes streamed through the filter by 4x. Residues that aren't one
+ * of the four canonical nucleotides (N runs, IUPAC degeneracies) are
+ * kept in a short side list of runs, in the same spirit as the
+ * FM-index's FM_AMBIGLIST, and patched back in when a block is
+ * decoded.
+ *
+ * Layout: residue i (1..L) is stored in byte (i-1)/4 of <T>, in bits
+ * 7-6 for (i-1)%4 == 0, then 5-4, 3-2, 1-0 - the same first-residue-
+ * in-high-bits convention used by the FM-index's packed BWT. The
+ * 2-bit value is the residue's digital code (A=0,C=1,G=2,T/U=3).
+ * <T> is padded so that an unaligned 16-byte load starting at any
+ * byte of the sequence stays inside the allocation.
+ *
+ * Contents:
+ *   1. The P7_PACKEDSQ object: allocation, packing, decoding.
+ *   2. Unit tests.
+ *   3. Test driver.
+ *   4. Copyright and license.
+ */
+#include "p7_config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "easel.h"
+#include "esl_alphabet.h"
+
+#include "hmmer.h"
+
+
+/*********************************************************************
+ *# 1. The P7_PACKEDSQ object: allocation, packing, decoding.
+ *********************************************************************/
+
+/* Function:  p7_packedsq_Create()
+ * Synopsis:  Create an empty <P7_PACKEDSQ>.
+ *
+ * Purpose:   Allocate an empty packed sequence. Storage grows as
+ *            needed on each call to <p7_packedsq_Pack()>, so one
+ *            object can be reused across all the windows of a
+ *            target database.
+ *
+ * Returns:   a pointer to the new <P7_PACKEDSQ>.
+ *
+ * Throws:    <NULL> on allocation failure.
+ */
+P7_PACKEDSQ *
+p7_packedsq_Create(void)
+{
+  P7_PACKEDSQ *psq = NULL;
+  int          status;
+
+  ESL_ALLOC(psq, sizeof(P7_PACKEDSQ));
+  psq->T          = NULL;
+  psq->amb_start  = NULL;
+  psq->amb_len    = NULL;
+  psq->amb_code   = NULL;
+  psq->L          = 0;
+  psq->Talloc     = 0;
+  psq->namb       = 0;
+  psq->ambAlloc   = 0;
+  psq->src        = NULL;
+  psq->complement = p7_NOCOMPLEMENT;
+
+  psq->Talloc   = 4096;
+  psq->ambAlloc = 16;
+  ESL_ALLOC(psq->T,         sizeof(uint8_t) * psq->Talloc);
+  ESL_ALLOC(psq->amb_start, sizeof(int64_t) * psq->ambAlloc);
+  ESL_ALLOC(psq->amb_len,   sizeof(int64_t) * psq->ambAlloc);
+  ESL_ALLOC(psq->amb_code,  sizeof(ESL_DSQ) * psq->ambAlloc);
+  return psq;
+
+ ERROR:
+  p7_packedsq_Destroy(psq);
+  return NULL;
+}
+
+
+/* Function:  p7_packedsq_Pack()
+ * Synopsis:  Pack a digital nucleotide sequence, 2 bits per residue.
+ *
+ * Purpose:   Pack digital sequence <dsq> (1..L, in nucleotide
+ *            alphabet <abc>) into <psq>, replacing whatever it held.
+ *            Each maximal run of positions holding the same
+ *            non-canonical code (anything with code >= <abc->K>)
+ *            is recorded in the side list; those positions are
+ *            stored as 0 in the packed array.
+ *
+ *            <psq> remembers <dsq> as the sequence it stands for,
+ *            on the forward strand; <p7_Pipeline_LongTarget()> only
+ *            uses a packed copy whose source and strand match the
+ *            target it's given.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <abc> is not a 4-letter alphabet.
+ *            <eslEMEM> on allocation failure.
+ */
+int
+p7_packedsq_Pack(P7_PACKEDSQ *psq, const ESL_ALPHABET *abc, const ESL_DSQ *dsq, int64_t L)
+{
+  int64_t  nbytes = (L+3)/4 + 16;   /* +16: room for a trailing unaligned SSE load */
+  int64_t  i;
+  uint8_t  x;
+  void    *p;
+  int      status;
+
+  if (abc->K != 4) ESL_EXCEPTION(eslEINVAL, "packed sequences require a nucleotide alphabet");
+
+  if (nbytes > psq->Talloc) {
+    ESL_RALLOC(psq->T, p, sizeof(uint8_t) * nbytes);
+    psq->Talloc = nbytes;
+  }
+  memset(psq->T, 0, sizeof(uint8_t) * nbytes);
+  psq->L          = L;
+  psq->namb       = 0;
+  psq->src        = dsq;
+  psq->complement = p7_NOCOMPLEMENT;
+
+  for (i = 1; i <= L; i++)
+    {
+      x = dsq[i];
+      if (x < 4) {
+        psq->T[(i-1)/4] |= x << (6 - 2*((i-1)%4));
+        continue;
+      }
+
+      /* extend the current run, or start a new one */
+      if (psq->namb > 0 && psq->amb_code[psq->namb-1] == x && psq->amb_start[psq->namb-1] + psq->amb_len[psq->namb-1] == i) {
+        psq->amb_len[psq->namb-1]++;
+        continue;
+      }
+      if (psq->namb == psq->ambAlloc) {
+        psq->ambAlloc *= 2;
+        ESL_RALLOC(psq->amb_start, p, sizeof(int64_t) * psq->ambAlloc);
+        ESL_RALLOC(psq->amb_len,   p, sizeof(int64_t) * psq->ambAlloc);
+        ESL_RALLOC(psq->amb_code,  p, sizeof(ESL_DSQ) * psq->ambAlloc);
+      }
+      psq->amb_start[psq->namb] = i;
+      psq->amb_len[psq->namb]   = 1;
+      psq->amb_code[psq->namb]  = x;
+      psq->namb++;
+    }
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+
+#ifdef eslAUGMENT_ALPHABET
+/* Function:  p7_packedsq_ReverseComplement()
+ * Synopsis:  Reverse complement a packed sequence without unpacking it.
+ *
+ * Purpose:   Set <rc> to the reverse complement of packed sequence
+ *            <psq>, replacing whatever <rc> held. <dsq> is the digital
+ *            sequence <rc> stands for - the caller's reverse
+ *            complemented copy of the target, or the target itself if
+ *            it was reverse complemented in place - and is only
+ *            recorded, not read.
+ *
+ *            Canonical residues complement as 3-x in the 2-bit code;
+ *            the ambiguity runs are reversed and their codes
+ *            complemented through <abc->complement>. The result is
+ *            identical to packing the reverse complemented <dsq>, but
+ *            reads a quarter of the bytes.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <rc> is <psq>, or <abc> has no complement.
+ *            <eslEMEM> on allocation failure.
+ */
+int
+p7_packedsq_ReverseComplement(P7_PACKEDSQ *rc, const P7_PACKEDSQ *psq, const ESL_ALPHABET *abc, const ESL_DSQ *dsq)
+{
+  int64_t  L      = psq->L;
+  int64_t  nbytes = (L+3)/4 + 16;
+  int64_t  i, j;
+  int      a, b;
+  uint8_t  x;
+  void    *p;
+  int      status;
+
+  if (rc == psq)               ESL_EXCEPTION(eslEINVAL, "can't reverse complement a packed sequence in place");
+  if (abc->complement == NULL) ESL_EXCEPTION(eslEINVAL, "alphabet has no complement");
+
+  if (nbytes > rc->Talloc) {
+    ESL_RALLOC(rc->T, p, sizeof(uint8_t) * nbytes);
+    rc->Talloc = nbytes;
+  }
+  if (psq->namb > rc->ambAlloc) {
+    rc->ambAlloc = psq->namb;
+    ESL_RALLOC(rc->amb_start, p, sizeof(int64_t) * rc->ambAlloc);
+    ESL_RALLOC(rc->amb_len,   p, sizeof(int64_t) * rc->ambAlloc);
+    ESL_RALLOC(rc->amb_code,  p, sizeof(ESL_DSQ) * rc->ambAlloc);
+  }
+  memset(rc->T, 0, sizeof(uint8_t) * nbytes);
+
+  for (i = 1, j = L; i <= L; i++, j--)
+    {
+      x = 3 - ((psq->T[(j-1)/4] >> (6 - 2*((j-1)%4))) & 0x3);
+      rc->T[(i-1)/4] |= x << (6 - 2*((i-1)%4));
+    }
+
+  /* complement is a bijection, so the reversed runs are still maximal */
+  for (a = 0, b = psq->namb-1; b >= 0; a++, b--)
+    {
+      rc->amb_start[a] = L - (psq->amb_start[b] + psq->amb_len[b] - 1) + 1;
+      rc->amb_len[a]   = psq->amb_len[b];
+      rc->amb_code[a]  = abc->complement[psq->amb_code[b]];
+      for (i = rc->amb_start[a]; i < rc->amb_start[a] + rc->amb_len[a]; i++)  /* stored as 0, as Pack() leaves them */
+        rc->T[(i-1)/4] &= ~(0x3 << (6 - 2*((i-1)%4)));
+    }
+
+  rc->L          = L;
+  rc->namb       = psq->namb;
+  rc->src        = dsq;
+  rc->complement = (psq->complement == p7_COMPLEMENT ? p7_NOCOMPLEMENT : p7_COMPLEMENT);
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+#endif /*eslAUGMENT_ALPHABET*/
+
+
+/* Function:  p7_packedsq_Decode()
+ * Synopsis:  Unpack a range of a packed sequence into digital residues.
+ *
+ * Purpose:   Decode residues <from>..<from>+<n>-1 of <psq> into
+ *            <dsq[0..n-1]>, including any ambiguity codes. Positions
+ *            outside 1..L are written as <eslDSQ_SENTINEL>, so a caller
+ *            can decode a window that runs off either end and still see
+ *            the same sentinels an unpacked <ESL_DSQ> would have.
+ *
+ *            This is the scalar decoder, used for diagonal recovery
+ *            and for implementations without a vector decoder; the
+ *            SSE SSV filter decodes 64 residues at a time on its own.
+ *
+ * Returns:   <eslOK> on success.
+ */
+int
+p7_packedsq_Decode(const P7_PACKEDSQ *psq, int64_t from, int64_t n, ESL_DSQ *dsq)
+{
+  int64_t i, j;
+  int     a;
+
+  for (j = 0, i = from; j < n; j++, i++)
+    dsq[j] = (i < 1 || i > psq->L) ? eslDSQ_SENTINEL : (psq->T[(i-1)/4] >> (6 - 2*((i-1)%4))) & 0x3;
+
+  /* patch in the ambiguity runs that overlap <from..from+n-1> */
+  for (a = 0; a < psq->namb; a++)
+    {
+      if (psq->amb_start[a] + psq->amb_len[a] <= from) continue;
+      if (psq->amb_start[a] >= from + n)             break;
+      for (i = ESL_MAX(from, psq->amb_start[a]); i < ESL_MIN(from + n, psq->amb_start[a] + psq->amb_len[a]); i++)
+        dsq[i-from] = psq->amb_code[a];
+    }
+  return eslOK;
+}
+
+
+/* Function:  p7_packedsq_Reuse()
+ * Synopsis:  Reinitialize a <P7_PACKEDSQ> for a new sequence.
+ *
+ * Returns:   <eslOK>.
+ */
+int
+p7_packedsq_Reuse(P7_PACKEDSQ *psq)
+{
+  psq->L          = 0;
+  psq->namb       = 0;
+  psq->src        = NULL;
+  psq->complement = p7_NOCOMPLEMENT;
+  return eslOK;
+}
+
+
+/* Function:  p7_packedsq_Destroy()
+ * Synopsis:  Free a <P7_PACKEDSQ>.
+ */
+void
+p7_packedsq_Destroy(P7_PACKEDSQ *psq)
+{
+  if (psq == NULL) return;
+  if (psq->T)         free(psq->T);
+  if (psq->amb_start) free(psq->amb_start);
+  if (psq->amb_len)   free(psq->amb_len);
+  if (psq->amb_code)  free(psq->amb_code);
+  free(psq);
+}
+/*------------------ end, P7_PACKEDSQ object --------------------*/
+
+
+
+/*****************************************************************
+ * 2. Unit tests
+ *****************************************************************/
+#ifdef p7PACKEDSQ_TESTDRIVE
+#include "esl_random.h"
+#include "esl_randomseq.h"
+#include "esl_sq.h"
+
+/* Pack random DNA sequences salted with runs of N and scattered IUPAC
+ * codes, and check that decoding any range (including ranges that run
+ * off both ends) gives back exactly the original residues.
+ */
+static void
+utest_roundtrip(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, int L, int N)
+{
+  char         msg[] = "packedsq roundtrip unit test failed";
+  P7_PACKEDSQ *psq   = p7_packedsq_Create();
+  ESL_DSQ     *dsq   = malloc(sizeof(ESL_DSQ) * (L+2));
+  ESL_DSQ     *buf   = malloc(sizeof(ESL_DSQ) * (L+20));
+  float        f[4]  = { 0.25, 0.25, 0.25, 0.25 };
+  int64_t      from, n, i;
+  int          j;
+
+  if (psq == NULL || dsq == NULL || buf == NULL) esl_fatal(msg);
+
+  while (N--)
+    {
+      esl_rsq_xfIID(r, f, abc->K, L, dsq);
+      for (j = 0; j < 3; j++) {            /* a few N runs */
+        from = 1 + esl_rnd_Roll(r, L);
+        n    = ESL_MIN(L - from + 1, esl_rnd_Roll(r, 40));
+        for (i = from; i < from + n; i++) dsq[i] = esl_abc_DigitizeSymbol(abc, 'N');
+      }
+      for (j = 0; j < 5; j++)              /* isolated degeneracies */
+        dsq[1 + esl_rnd_Roll(r, L)] = abc->K + 1 + esl_rnd_Roll(r, abc->Kp - abc->K - 4);
+
+      if (p7_packedsq_Pack(psq, abc, dsq, L) != eslOK) esl_fatal(msg);
+      if (psq->L != L)                                 esl_fatal(msg);
+
+      p7_packedsq_Decode(psq, 1, L, buf);
+      for (i = 1; i <= L; i++)
+        if (buf[i-1] != dsq[i]) esl_fatal(msg);
+
+      from = esl_rnd_Roll(r, L+2) - 5;
+      n    = esl_rnd_Roll(r, 15);
+      p7_packedsq_Decode(psq, from, n, buf);
+      for (i = from; i < from + n; i++)
+        if (buf[i-from] != ((i < 1 || i > L) ? eslDSQ_SENTINEL : dsq[i])) esl_fatal(msg);
+
+      p7_packedsq_Reuse(psq);
+    }
+
+  free(buf);
+  free(dsq);
+  p7_packedsq_Destroy(psq);
+}
+
+#ifdef eslAUGMENT_ALPHABET
+/* utest_ssv()
+ *
+ * Scan random DNA targets - planted with core emissions of a sampled
+ * model, salted with N runs and IUPAC codes - with the SSV filter on
+ * both strands, unpacked and packed, and check that both give the same
+ * windows. The reverse strand is packed with
+ * p7_packedsq_ReverseComplement(), which must match packing the
+ * reverse complemented digital sequence exactly.
+ */
+static void
+utest_ssv(ESL_RANDOMNESS *r, ESL_ALPHABET *abc, P7_BG *bg, int M, int L, int N)
+{
+  char               msg[]   = "packedsq SSV unit test failed";
+  P7_HMM            *hmm     = NULL;
+  P7_PROFILE        *gm      = NULL;
+  P7_OPROFILE       *om      = NULL;
+  P7_OMX            *ox      = p7_omx_Create(M, 0, 0);
+  P7_SCOREDATA      *ssvdata = NULL;
+  P7_PACKEDSQ       *psq     = p7_packedsq_Create();
+  P7_PACKEDSQ       *psq_rc  = p7_packedsq_Create();
+  P7_PACKEDSQ       *psq_chk = p7_packedsq_Create();
+  ESL_SQ            *sq      = esl_sq_CreateDigital(abc);
+  ESL_DSQ           *dsq     = malloc(sizeof(ESL_DSQ) * (L+2));
+  ESL_DSQ           *rc      = malloc(sizeof(ESL_DSQ) * (L+2));
+  ESL_DSQ           *buf     = malloc(sizeof(ESL_DSQ) * (L+2));
+  P7_HMM_WINDOWLIST  w1, w2;
+  float              f[4]    = { 0.25, 0.25, 0.25, 0.25 };
+  double             P       = 0.02;
+  int64_t            from, n, i;
+  int                j, strand;
+  int                nwin    = 0;
+
+  if (ox == NULL || psq == NULL || psq_rc == NULL || psq_chk == NULL || sq == NULL) esl_fatal(msg);
+  if (dsq == NULL || rc == NULL || buf == NULL)                                      esl_fatal(msg);
+
+  if (p7_oprofile_Sample(r, abc, bg, M, L, &hmm, &gm, &om) != eslOK) esl_fatal(msg);
+  om->max_length          = 4*M;        /* Sample() doesn't calibrate; make up nhmmer-like settings */
+  om->evparam[p7_MMU]     = -9.0;
+  om->evparam[p7_MLAMBDA] = 0.693;
+  if ((ssvdata = p7_hmm_ScoreDataCreate(om, NULL)) == NULL) esl_fatal(msg);
+
+  while (N--)
+    {
+      esl_rsq_xfIID(r, f, abc->K, L, dsq);
+      for (j = 0; j < 2; j++) {            /* plant a couple of homologs */
+        if (p7_CoreEmit(r, hmm, sq, NULL) != eslOK) esl_fatal(msg);
+        if (sq->n < L) {
+          from = 1 + esl_rnd_Roll(r, L - sq->n + 1);
+          memcpy(dsq + from, sq->dsq + 1, sizeof(ESL_DSQ) * sq->n);
+        }
+        esl_sq_Reuse(sq);
+      }
+      for (j = 0; j < 3; j++) {            /* a few N runs */
+        from = 1 + esl_rnd_Roll(r, L);
+        n    = ESL_MIN(L - from + 1, esl_rnd_Roll(r, 40));
+        for (i = from; i < from + n; i++) dsq[i] = esl_abc_DigitizeSymbol(abc, 'N');
+      }
+      for (j = 0; j < 5; j++)              /* isolated degeneracies */
+        dsq[1 + esl_rnd_Roll(r, L)] = abc->K + 1 + esl_rnd_Roll(r, abc->Kp - abc->K - 4);
+
+      rc[0] = rc[L+1] = eslDSQ_SENTINEL;
+      for (i = 1; i <= L; i++) rc[i] = abc->complement[dsq[L-i+1]];
+
+      if (p7_packedsq_Pack(psq, abc, dsq, L)                       != eslOK)  esl_fatal(msg);
+      if (p7_packedsq_ReverseComplement(psq_rc, psq, abc, rc)       != eslOK)  esl_fatal(msg);
+      if (psq->src    != dsq || psq->complement    != p7_NOCOMPLEMENT)         esl_fatal(msg);
+      if (psq_rc->src != rc  || psq_rc->complement != p7_COMPLEMENT)           esl_fatal(msg);
+
+      /* the packed reverse complement is exactly what packing <rc> gives */
+      if (p7_packedsq_Pack(psq_chk, abc, rc, L)                    != eslOK)  esl_fatal(msg);
+      if (psq_rc->L != psq_chk->L || psq_rc->namb != psq_chk->namb)            esl_fatal(msg);
+      if (memcmp(psq_rc->T, psq_chk->T, sizeof(uint8_t) * ((L+3)/4)) != 0)     esl_fatal(msg);
+      for (j = 0; j < psq_rc->namb; j++)
+        if (psq_rc->amb_start[j] != psq_chk->amb_start[j] || psq_rc->amb_len[j] != psq_chk->amb_len[j] ||
+            psq_rc->amb_code[j]  != psq_chk->amb_code[j])                      esl_fatal(msg);
+      p7_packedsq_Decode(psq_rc, 1, L, buf);
+      for (i = 1; i <= L; i++)
+        if (buf[i-1] != rc[i]) esl_fatal(msg);
+
+      for (strand = 0; strand < 2; strand++)
+        {
+          p7_hmmwindow_init(&w1);
+          p7_hmmwindow_init(&w2);
+          if (p7_SSVFilter_longtarget       (strand ? rc     : dsq, L, om, ox, ssvdata, bg, P, &w1) != eslOK) esl_fatal(msg);
+          if (p7_SSVFilter_longtarget_packed(strand ? psq_rc : psq,    om, ox, ssvdata, bg, P, &w2) != eslOK) esl_fatal(msg);
+
+          if (w1.count != w2.count) esl_fatal(msg);
+          for (j = 0; j < w1.count; j++)
+            if (w1.windows[j].n      != w2.windows[j].n      ||
+                w1.windows[j].length != w2.windows[j].length ||
+                w1.windows[j].k      != w2.windows[j].k      ||
+                w1.windows[j].score  != w2.windows[j].score)  esl_fatal(msg);
+          nwin += w1.count;
+
+          free(w1.windows);
+          free(w2.windows);
+        }
+
+      p7_packedsq_Reuse(psq);
+      p7_packedsq_Reuse(psq_rc);
+      p7_packedsq_Reuse(psq_chk);
+    }
+  if (nwin == 0) esl_fatal(msg);      /* the planted homologs must give the filter something to compare */
+
+  free(buf);
+  free(rc);
+  free(dsq);
+  esl_sq_Destroy(sq);
+  p7_packedsq_Destroy(psq_chk);
+  p7_packedsq_Destroy(psq_rc);
+  p7_packedsq_Destroy(psq);
+  p7_hmm_ScoreDataDestroy(ssvdata);
+  p7_omx_Destroy(ox);
+  p7_oprofile_Destroy(om);
+  p7_profile_Destroy(gm);
+  p7_hmm_Destroy(hmm);
+}
+#endif /*eslAUGMENT_ALPHABET*/
+#endif /*p7PACKEDSQ_TESTDRIVE*/
+/*-------------------- end, unit tests --------------------------*/
+
+
+/*****************************************************************
+ * 3. Test driver
+ *****************************************************************/
+#ifdef p7PACKEDSQ_TESTDRIVE
+#include "esl_config.h"
+
+#include <stdio.h>
+
+#include "easel.h"
+#include "esl_getopts.h"
+#include "esl_random.h"
+
+#include "hmmer.h"
+
+static ESL_OPTIONS options[] = {
+   /* name  type         default  env   range togs  reqs  incomp  help                docgrp */
+  {"-h",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show help and usage",                            0},
+  {"-s",  eslARG_INT,       "0", NULL, NULL, NULL, NULL, NULL, "set random number seed to <n>",                  0},
+  {"-v",  eslARG_NONE,    FALSE, NULL, NULL, NULL, NULL, NULL, "show verbose commentary/output",                 0},
+  {"-L",  eslARG_INT,    "1000", NULL,"n>0", NULL, NULL, NULL, "length of random target seqs",                   0},
+  {"-M",  eslARG_INT,      "60", NULL,"n>0", NULL, NULL, NULL, "length of sampled model, for the SSV test",      0},
+  {"-N",  eslARG_INT,     "100", NULL,"n>0", NULL, NULL, NULL, "number of random target seqs",                   0},
+  { 0,0,0,0,0,0,0,0,0,0},
+};
+static char usage[]  = "[-options]";
+static char banner[] = "test driver for p7_packedsq";
+
+int
+main(int argc, char **argv)
+{
+  ESL_GETOPTS    *go          = esl_getopts_CreateDefaultApp(options, 0, argc, argv, banner, usage);
+  ESL_RANDOMNESS *rng         = esl_randomness_CreateFast(esl_opt_GetInteger(go, "-s"));
+  ESL_ALPHABET   *abc         = esl_alphabet_Create(eslDNA);
+  P7_BG          *bg          = p7_bg_Create(abc);
+  int             M           = esl_opt_GetInteger(go, "-M");
+  int             L           = esl_opt_GetInteger(go, "-L");
+  int             N           = esl_opt_GetInteger(go, "-N");
+  int             be_verbose  = esl_opt_GetBoolean(go, "-v");
+
+  if (be_verbose) printf("p7_packedsq unit test: rng seed %" PRIu32 "\n", esl_randomness_GetSeed(rng));
+
+  utest_roundtrip(rng, abc, L, N);
+  utest_roundtrip(rng, abc, 1, 10);   /* shorter than one packed byte */
+  utest_roundtrip(rng, abc, 67, 10);  /* straddles a 64-residue decode block */
+#ifdef eslAUGMENT_ALPHABET
+  utest_ssv(rng, abc, bg, M, L, N);
+  utest_ssv(rng, abc, bg, 20, 67, 10); /* straddles a 64-residue decode block */
+#endif
+
+  p7_bg_Destroy(bg);
+  esl_alphabet_Destroy(abc);
+  esl_randomness_Destroy(rng);
+  esl_getopts_Destroy(go);
+  return 0;
+}
+#endif /* p7PACKEDSQ_TESTDRIVE */
+
+/************************************************************
+ * @LICENSE@
+ ************************************************************/
@@ -238,6 +238,8 @@ p7_pipeline_Create(ESL_GETOPTS *go, int M_hint, int L_hint, int long_targets, en
   pli->nseqs           = 0;
   pli->nres            = 0;
   pli->nnodes          = 0;
+  pli->n_past_fm       = 0;
+  pli->n_msv_skipped   = 0;
   pli->n_past_msv      = 0;
   pli->n_past_bias     = 0;
   pli->n_past_vit      = 0;
@@ -247,9 +249,15 @@ p7_pipeline_Create(ESL_GETOPTS *go, int M_hint, int L_hint, int long_targets, en
   pli->pos_past_vit    = 0;
   pli->pos_past_fwd    = 0;
   pli->mode            = mode;
+  pli->use_fmindex     = FALSE;
   pli->show_accessions = (go && esl_opt_GetBoolean(go, "--acc")   ? TRUE  : FALSE);
   pli->show_alignments = (go && esl_opt_GetBoolean(go, "--noali") ? FALSE : TRUE);
+  pli->msv_prvsc       = NULL;
+  pli->msv_cursc       = NULL;
+  pli->msv_nsc         = 0;
+  pli->msv_gain        = 0.0;
   pli->hfp             = NULL;
+  pli->psq             = NULL;
   pli->errbuf[0]       = '\0';
 
   return pli;
@@ -613,6 +621,8 @@ p7_pipeline_Merge(P7_PIPELINE *p1, P7_PIPELINE *p2)
       p1->nnodes  += p2->nnodes;
     }
 
+  p1->n_past_fm   += p2->n_past_fm;
+  p1->n_msv_skipped += p2->n_msv_skipped;
   p1->n_past_msv  += p2->n_past_msv;
   p1->n_past_bias += p2->n_past_bias;
   p1->n_past_vit  += p2->n_past_vit;
@@ -688,8 +698,25 @@ p7_Pipeline(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, const ESL_SQ *sq, cons
   /* Base null model score (we could calculate this in NewSeq(), for a scan pipeline) */
   p7_bg_NullOne  (bg, sq->dsq, sq->n, &nullsc);
 
+  /* Incremental search: if even the bound on this target's MSV score
+   * fails F1, skip it, and carry the bound forward as its score.
+   */
+  if (pli->msv_prvsc != NULL && sq->idx >= 1 && sq->idx <= pli->msv_nsc)
+    {
+      usc       = pli->msv_prvsc[sq->idx] + (float) sq->n * pli->msv_gain;
+      seq_score = (usc - nullsc) / eslCONST_LOG2;
+      P = esl_gumbel_surv(seq_score,  om->evparam[p7_MMU],  om->evparam[p7_MLAMBDA]);
+      if (P > pli->F1) 
+	{
+	  if (pli->msv_cursc) pli->msv_cursc[sq->idx] = usc;
+	  pli->n_msv_skipped++;
+	  return eslOK;
+	}
+    }
+
   /* First level filter: the MSV filter, multihit with <om> */
   p7_MSVFilter(sq->dsq, sq->n, om, pli->oxf, &usc);
+  if (pli->msv_cursc != NULL && sq->idx >= 1 && sq->idx <= pli->msv_nsc) pli->msv_cursc[sq->idx] = usc;
   seq_score = (usc - nullsc) / eslCONST_LOG2;
   P = esl_gumbel_surv(seq_score,  om->evparam[p7_MMU],  om->evparam[p7_MLAMBDA]);
   if (P > pli->F1) return eslOK;
@@ -1424,6 +1451,13 @@ p7_pli_postSSV_LongTarget(P7_PIPELINE *pli, P7_OPROFILE *om, P7_BG *bg, P7_TOPHI
  *              diagonals using the FM-index, and extends them to maximum-
  *              scoring diagonals subjected to the SSV filter thresholds
  *
+ *            If the caller has set <pli->psq> to a 2-bit packed copy
+ *            of <sq>, the scanning SSV filter reads the packed copy;
+ *            later stages always use <sq> itself. The packed copy is
+ *            only used if it was packed from <sq->dsq>, on the strand
+ *            given by <complementarity>; anything else (a stale copy
+ *            left from another target) is ignored.
+ *
  *            Windows passing the appropriate SSV filter are then passed
  *            to the remainder of the pipeline. The pipeline accumulates
  *            bean counting information about how many comparisons and
@@ -1523,6 +1557,8 @@ p7_Pipeline_LongTarget(P7_PIPELINE *pli, P7_OPROFILE *om, P7_SCOREDATA *data,
 
   if (fmf) // using an FM-index
     p7_SSVFM_longlarget(om, 2.0, bg, pli->F1, fmf, fmb, fm_cfg, data, pli->strands, &msv_windowlist );
+  else if (pli->psq && pli->psq->src == sq->dsq && pli->psq->L == sq->n && pli->psq->complement == complementarity) // caller packed this target 2 bits/residue
+    p7_SSVFilter_longtarget_packed(pli->psq, om, pli->oxf, data, bg, pli->F1, &msv_windowlist);
   else // compare directly to sequence
     p7_SSVFilter_longtarget(sq->dsq, sq->n, om, pli->oxf, data, bg, pli->F1, &msv_windowlist);
 /*  if (watch_slave) {
@@ -1698,6 +1734,111 @@ ERROR:
 }
 
 
+/* Function:  p7_Pipeline_FM()
+ * Synopsis:  Protein pipeline over one block of an FM-indexed target database.
+ *
+ * Purpose:   Run the standard (non-long-target) pipeline on the
+ *            target sequences held in one block of an amino acid
+ *            FM-index, <fmf> and <fmb>, using FM seed finding and
+ *            extension (<p7_SSVFM_longlarget()>) as a prefilter ahead
+ *            of MSV. Only targets that contain at least one seed
+ *            diagonal passing the SSV threshold are extracted from the
+ *            index into <sq> and passed through <p7_Pipeline()>.
+ *
+ *            Targets without a seed are never scored, but they are
+ *            still counted in <pli->nseqs> and <pli->nres>, so
+ *            E-values are the same as for a full search. The number
+ *            of seeded targets is accumulated in <pli->n_past_fm>,
+ *            and reported by <p7_pli_Statistics()>.
+ *
+ *            Caller has set <fm_cfg->sc_thresh_ratio>, and created
+ *            <data> with <p7_hmm_ScoreDataCreate(om, gm)>, exactly as
+ *            nhmmer does for FM-index targets; <om->max_length> must
+ *            be set. <sq> is a digital sequence in <om>'s alphabet
+ *            that we use as workspace.
+ *
+ * Args:      pli     - the main pipeline object
+ *            om      - optimized profile (query)
+ *            data    - compact SSV scores for seed finding/extension
+ *            bg      - background model
+ *            th      - pointer to hit storage bin (already allocated)
+ *            fmf     - the FM_DATA for forward traversal of this block
+ *            fmb     - the FM_DATA for backward traversal of this block
+ *            fm_cfg  - general FM configuration
+ *            sq      - digital sequence workspace
+ *
+ * Returns:   <eslOK> on success. Hits are added to <th>.
+ *
+ * Throws:    <eslEMEM> on allocation failure. Other errors from
+ *            <p7_Pipeline()> are passed up.
+ */
+int
+p7_Pipeline_FM(P7_PIPELINE *pli, P7_OPROFILE *om, P7_SCOREDATA *data,
+               P7_BG *bg, P7_TOPHITS *th,
+               const FM_DATA *fmf, const FM_DATA *fmb, FM_CFG *fm_cfg, ESL_SQ *sq)
+{
+  FM_METADATA       *meta   = fm_cfg->meta;
+  FM_SEQDATA        *seqdata;
+  P7_HMM_WINDOWLIST  windowlist;
+  char              *seeded = NULL;
+  uint32_t           i;
+  int                status;
+
+  windowlist.windows = NULL;
+  pli->use_fmindex   = TRUE;
+  if (fmf->seq_cnt == 0) return eslOK;
+
+  ESL_ALLOC(seeded, sizeof(char) * fmf->seq_cnt);
+  for (i = 0; i < fmf->seq_cnt; i++) seeded[i] = FALSE;
+
+  /* Seed and extend. Protein indexes hold a single strand. */
+  p7_hmmwindow_init(&windowlist);
+  status = p7_SSVFM_longlarget(om, 2.0, bg, pli->F1, fmf, fmb, fm_cfg, data, p7_STRAND_TOPONLY, &windowlist);
+  if (status != eslOK && status != eslEOF) goto ERROR;
+
+  for (i = 0; i < windowlist.count; i++)
+    seeded[windowlist.windows[i].id - fmf->seq_offset] = TRUE;
+
+  for (i = 0; i < fmf->seq_cnt; i++)
+  {
+    seqdata = meta->seq_data + fmf->seq_offset + i;
+
+    if (! seeded[i]) {
+      /* never reaches MSV, but still part of the search space */
+      pli->nseqs++;
+      pli->nres += seqdata->length;
+      if (pli->Z_setby == p7_ZSETBY_NTARGETS && pli->mode == p7_SEARCH_SEQS) pli->Z = pli->nseqs;
+      continue;
+    }
+
+    pli->n_past_fm++;
+
+    fm_convertRange2DSQ(fmf, meta, seqdata->fm_start, seqdata->length, p7_NOCOMPLEMENT, sq, FALSE);
+    esl_sq_SetName(sq, seqdata->name);
+    if (seqdata->acc_length  > 0) esl_sq_SetAccession(sq, seqdata->acc);
+    if (seqdata->desc_length > 0) esl_sq_SetDesc     (sq, seqdata->desc);
+
+    p7_pli_NewSeq(pli, sq);
+    p7_bg_SetLength(bg, sq->n);
+    p7_oprofile_ReconfigLength(om, sq->n);
+
+    if ((status = p7_Pipeline(pli, om, bg, sq, NULL, th)) != eslOK) goto ERROR;
+
+    esl_sq_Reuse(sq);
+    p7_pipeline_Reuse(pli);
+  }
+
+  free(windowlist.windows);
+  free(seeded);
+  return eslOK;
+
+ ERROR:
+  if (windowlist.windows) free(windowlist.windows);
+  if (seeded)             free(seeded);
+  return status;
+}
+
+
 /* Function:  p7_pli_Statistics()
  * Synopsis:  Final statistics output from a processing pipeline.
  *
@@ -1762,6 +1903,17 @@ p7_pli_Statistics(FILE *ofp, P7_PIPELINE *pli, ESL_STOPWATCH *w)
 
   } else { // typical case output
 
+      if (pli->use_fmindex)
+        fprintf(ofp, "Passed FM seed filter:       %15" PRId64 "  (%.6g); %.1f%% of targets skipped MSV\n",
+            pli->n_past_fm,
+            (double) pli->n_past_fm / ntargets,
+            100.0 * (1.0 - (double) pli->n_past_fm / ntargets));
+
+      if (pli->msv_prvsc)
+        fprintf(ofp, "Skipped by MSV bound:        %15" PRId64 "  (%.6g); previous round's scores can't pass F1\n",
+            pli->n_msv_skipped,
+            (double) pli->n_msv_skipped / ntargets);
+
       fprintf(ofp, "Passed MSV filter:           %15" PRId64 "  (%.6g); expected %.1f (%.6g)\n",
           pli->n_past_msv,
           (double) pli->n_past_msv / ntargets,
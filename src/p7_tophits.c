@@ -4,15 +4,19 @@
  *    1. The P7_TOPHITS object.
  *    2. Standard (human-readable) output of pipeline results.
  *    3. Tabular (parsable) output of pipeline results.
- *    4. Benchmark driver.
- *    5. Test driver.
- *    6. Copyright and license information.
+ *    4. Binary (compact, fixed-width) output of pipeline results.
+ *    5. Packed, portable serialization of hit lists.
+ *    6. Benchmark driver.
+ *    7. Test driver.
+ *    8. Copyright and license information.
  */
 #include "p7_config.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "easel.h"
 #include "hmmer.h"
@@ -49,6 +53,13 @@ p7_tophits_Create(void)
   h->is_sorted_by_sortkey = TRUE; /* but only because there's 0 hits */
   h->is_sorted_by_seqidx  = FALSE;
   h->hit[0]    = h->unsrt;        /* if you're going to call it "sorted" when it contains just one hit, you need this */
+  h->Kmax      = 0;               /* 0 = unbounded; see p7_tophits_SetMaxHits() */
+  h->heap      = NULL;
+  h->nheap     = 0;
+  h->pending   = -1;
+  h->nevicted  = 0;
+  h->evicted   = NULL;
+  h->nevalloc  = 0;
   return h;
 
  ERROR:
@@ -99,6 +110,223 @@ p7_tophits_Grow(P7_TOPHITS *h)
 }
 
 
+/* Function:  p7_tophits_SetMaxHits()
+ * Synopsis:  Bound a hit list to its <Kmax> top-ranked hits.
+ *
+ * Purpose:   Put the (empty) hit list <h> in bounded mode: from now
+ *            on it retains at most <Kmax> hits, the ones with the
+ *            highest <sortkey>. When a new hit would exceed the bound,
+ *            the lowest-ranked hit is evicted, its name, accession,
+ *            description, domain list and alignment displays are
+ *            freed, and its slot is reused for the new hit. Memory
+ *            for a search is thus O(<Kmax>), not O(number of hits).
+ *
+ *            Because the caller fills in a hit's <sortkey> only after
+ *            <p7_tophits_CreateNextHit()> returns it, the most
+ *            recently created hit is held aside as "pending", and
+ *            enters the ranking on the next <CreateNextHit()> or sort
+ *            call. The list may therefore briefly hold <Kmax>+1 hits.
+ *
+ *            The count of evicted hits is kept in <h->nevicted>.
+ *            Each evicted hit's score, P-value and flags are kept in
+ *            <h->evicted>, so <p7_tophits_Threshold()> still counts
+ *            the reportable ones in <nreported> and <nincluded>, and
+ *            <domZ> (when it's set by the number of reported targets)
+ *            is the same as without a bound. Only the hits' output
+ *            is lost.
+ *
+ *            <Kmax> of 0 means unbounded, the default.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEINVAL> if <h> already contains hits.
+ *            <eslEMEM> on allocation failure.
+ */
+int
+p7_tophits_SetMaxHits(P7_TOPHITS *h, uint64_t Kmax)
+{
+  void *p;
+  int   status;
+
+  if (h->N > 0) ESL_EXCEPTION(eslEINVAL, "hit list must be empty to set a bound on it");
+
+  if (Kmax > 0) {
+    if (h->heap == NULL) ESL_ALLOC (h->heap,    sizeof(uint64_t) * (Kmax+1));
+    else                 ESL_RALLOC(h->heap, p, sizeof(uint64_t) * (Kmax+1));
+  }
+  h->Kmax     = Kmax;
+  h->nheap    = 0;
+  h->pending  = -1;
+  h->nevicted = 0;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* tophits_hit_Free()
+ * Free the memory that hit <hit> owns (but not <hit> itself).
+ */
+static void
+tophits_hit_Free(P7_HIT *hit)
+{
+  int j;
+
+  if (hit->name != NULL) free(hit->name);
+  if (hit->acc  != NULL) free(hit->acc);
+  if (hit->desc != NULL) free(hit->desc);
+  if (hit->dcl  != NULL) {
+    for (j = 0; j < hit->ndom; j++) {
+      if (hit->dcl[j].ad             != NULL) p7_alidisplay_Destroy(hit->dcl[j].ad);
+      if (hit->dcl[j].scores_per_pos != NULL) free(hit->dcl[j].scores_per_pos);
+    }
+    free(hit->dcl);
+  }
+  hit->name = hit->acc = hit->desc = NULL;
+  hit->dcl  = NULL;
+  hit->ndom = 0;
+}
+
+/* tophits_evict_Record()
+ * Remember the P-value, score and flags of a hit that bounded list
+ * <h> is about to evict; see tophits_evicted_Count().
+ */
+static int
+tophits_evict_Record(P7_TOPHITS *h, double lnP, float score, uint32_t flags)
+{
+  void    *p;
+  uint64_t n;
+  int      status;
+
+  if (h->nevicted == h->nevalloc)
+    {
+      n = (h->nevalloc ? h->nevalloc * 2 : 256);
+      if (h->evicted == NULL) ESL_ALLOC (h->evicted,    sizeof(P7_EVICTED) * n);
+      else                    ESL_RALLOC(h->evicted, p, sizeof(P7_EVICTED) * n);
+      h->nevalloc = n;
+    }
+  h->evicted[h->nevicted].lnP   = lnP;
+  h->evicted[h->nevicted].score = score;
+  h->evicted[h->nevicted].flags = flags;
+  h->nevicted++;
+  return eslOK;
+
+ ERROR:
+  return status;
+}
+
+/* tophits_evicted_Count()
+ * Count the evicted hits of <h> that pass the reporting and
+ * inclusion thresholds of <pli>, decided the same way
+ * p7_tophits_Threshold() decides them for retained hits.
+ */
+static void
+tophits_evicted_Count(const P7_TOPHITS *h, P7_PIPELINE *pli, uint64_t *ret_nreported, uint64_t *ret_nincluded)
+{
+  const P7_EVICTED *e;
+  uint64_t          nreported = 0;
+  uint64_t          nincluded = 0;
+  uint64_t          i;
+
+  for (i = 0; i < h->nevicted; i++)
+    {
+      e = &(h->evicted[i]);
+      if (pli->use_bit_cutoffs)
+	{
+	  if (e->flags & p7_IS_REPORTED) nreported++;
+	  if (e->flags & p7_IS_INCLUDED) nincluded++;
+	}
+      else if (! (e->flags & p7_IS_DUPLICATE) && p7_pli_TargetReportable(pli, e->score, e->lnP))
+	{
+	  nreported++;
+	  if (p7_pli_TargetIncludable(pli, e->score, e->lnP)) nincluded++;
+	}
+    }
+  *ret_nreported = nreported;
+  *ret_nincluded = nincluded;
+}
+
+/* tophits_heap_push(), tophits_heap_pop()
+ * Binary min-heap of indices into <h->unsrt>, keyed on <sortkey>,
+ * so the root is the lowest-ranked retained hit. Capacity Kmax+1.
+ */
+static void
+tophits_heap_push(P7_TOPHITS *h, uint64_t idx)
+{
+  uint64_t i = h->nheap++;
+  uint64_t parent;
+
+  while (i > 0) {
+    parent = (i-1) / 2;
+    if (h->unsrt[h->heap[parent]].sortkey <= h->unsrt[idx].sortkey) break;
+    h->heap[i] = h->heap[parent];
+    i = parent;
+  }
+  h->heap[i] = idx;
+}
+
+static uint64_t
+tophits_heap_pop(P7_TOPHITS *h)
+{
+  uint64_t top  = h->heap[0];
+  uint64_t last = h->heap[--h->nheap];
+  uint64_t i    = 0;
+  uint64_t c;
+
+  while ((c = 2*i+1) < h->nheap) {
+    if (c+1 < h->nheap && h->unsrt[h->heap[c+1]].sortkey < h->unsrt[h->heap[c]].sortkey) c++;
+    if (h->unsrt[last].sortkey <= h->unsrt[h->heap[c]].sortkey) break;
+    h->heap[i] = h->heap[c];
+    i = c;
+  }
+  if (h->nheap > 0) h->heap[i] = last;
+  return top;
+}
+
+/* tophits_heap_Rebuild()
+ * Rebuild the heap over all <h->N> hits, after they've been moved.
+ */
+static void
+tophits_heap_Rebuild(P7_TOPHITS *h)
+{
+  uint64_t i;
+
+  h->nheap   = 0;
+  h->pending = -1;
+  for (i = 0; i < h->N; i++) tophits_heap_push(h, i);
+}
+
+/* tophits_bound_Finish()
+ * In a bounded list, rank the pending hit, and if that takes the
+ * list over <Kmax>, evict the lowest-ranked hit and compact <unsrt>
+ * by moving the last hit into the hole. Called before any sort,
+ * because sorts see all <h->N> hits.
+ */
+static int
+tophits_bound_Finish(P7_TOPHITS *h)
+{
+  uint64_t m;
+  int      status;
+
+  if (h->Kmax == 0 || h->pending < 0) return eslOK;
+
+  tophits_heap_push(h, h->pending);
+  h->pending = -1;
+  if (h->nheap > h->Kmax)
+    {
+      if ((status = tophits_evict_Record(h, h->unsrt[h->heap[0]].lnP, h->unsrt[h->heap[0]].score, h->unsrt[h->heap[0]].flags)) != eslOK) return status;
+      m = tophits_heap_pop(h);
+      tophits_hit_Free(&(h->unsrt[m]));
+      if (m != h->N-1) h->unsrt[m] = h->unsrt[h->N-1];
+      h->N--;
+      if (m != h->N)   tophits_heap_Rebuild(h); /* the moved hit's index changed */
+      h->is_sorted_by_seqidx  = FALSE;
+      h->is_sorted_by_sortkey = FALSE;
+    }
+  return eslOK;
+}
+
+
 /* Function:  p7_tophits_CreateNextHit()
  * Synopsis:  Get pointer to new structure for recording a hit.
  *
@@ -108,6 +336,11 @@ p7_tophits_Grow(P7_TOPHITS *h)
  *            this new <P7_HIT> structure for data to be filled
  *            in by the caller.
  *
+ *            If <h> is bounded (<p7_tophits_SetMaxHits()>), the
+ *            previously created hit is ranked now; if the list is
+ *            full, the lowest-ranked hit is evicted and its slot is
+ *            returned for the new hit.
+ *
  * Returns:   <eslOK> on success.
  *
  * Throws:    <eslEMEM> on allocation error.
@@ -115,13 +348,33 @@ p7_tophits_Grow(P7_TOPHITS *h)
 int
 p7_tophits_CreateNextHit(P7_TOPHITS *h, P7_HIT **ret_hit)
 {
-  P7_HIT *hit = NULL;
-  int     status;
+  P7_HIT  *hit = NULL;
+  uint64_t m;
+  int      status;
 
-  if ((status = p7_tophits_Grow(h)) != eslOK) goto ERROR;
-  
-  hit = &(h->unsrt[h->N]);
-  h->N++;
+  if (h->Kmax > 0 && h->pending >= 0)
+    {
+      /* The caller has finished filling in the pending hit: rank it. */
+      tophits_heap_push(h, h->pending);
+      h->pending = -1;
+    }
+
+  if (h->Kmax > 0 && h->nheap > h->Kmax)
+    {
+      /* Over the bound: evict the lowest-ranked hit, reuse its slot. */
+      if ((status = tophits_evict_Record(h, h->unsrt[h->heap[0]].lnP, h->unsrt[h->heap[0]].score, h->unsrt[h->heap[0]].flags)) != eslOK) goto ERROR;
+      m = tophits_heap_pop(h);
+      tophits_hit_Free(&(h->unsrt[m]));
+      hit = &(h->unsrt[m]);
+      h->pending = m;
+    }
+  else
+    {
+      if ((status = p7_tophits_Grow(h)) != eslOK) goto ERROR;
+      hit = &(h->unsrt[h->N]);
+      if (h->Kmax > 0) h->pending = h->N;
+      h->N++;
+    }
   if (h->N >= 2) 
   {
       h->is_sorted_by_seqidx = FALSE;
@@ -326,7 +579,9 @@ int
 p7_tophits_SortBySortkey(P7_TOPHITS *h)
 {
   int i;
+  int status;
 
+  if ((status = tophits_bound_Finish(h)) != eslOK) return status;
   if (h->is_sorted_by_sortkey)  return eslOK;
   for (i = 0; i < h->N; i++) h->hit[i] = h->unsrt + i;
   if (h->N > 1)  qsort(h->hit, h->N, sizeof(P7_HIT *), hit_sorter_by_sortkey);
@@ -350,7 +605,9 @@ int
 p7_tophits_SortBySeqidxAndAlipos(P7_TOPHITS *h)
 {
   int i;
+  int status;
 
+  if ((status = tophits_bound_Finish(h)) != eslOK) return status;
   if (h->is_sorted_by_seqidx)  return eslOK;
   for (i = 0; i < h->N; i++) h->hit[i] = h->unsrt + i;
   if (h->N > 1)  qsort(h->hit, h->N, sizeof(P7_HIT *), hit_sorter_by_seqidx_aliposition);
@@ -373,7 +630,9 @@ int
 p7_tophits_SortByModelnameAndAlipos(P7_TOPHITS *h)
 {
   int i;
+  int status;
 
+  if ((status = tophits_bound_Finish(h)) != eslOK) return status;
   if (h->is_sorted_by_seqidx)  return eslOK;
   for (i = 0; i < h->N; i++) h->hit[i] = h->unsrt + i;
   if (h->N > 1)  qsort(h->hit, h->N, sizeof(P7_HIT *), hit_sorter_by_modelname_aliposition);
@@ -383,6 +642,49 @@ p7_tophits_SortByModelnameAndAlipos(P7_TOPHITS *h)
 }
 
 
+/* tophits_bound_Truncate()
+ * Cut a bounded list <h>, sorted by sortkey, back to its top <Kmax>
+ * hits, and shrink its allocation to Kmax+1 hits. Used after a
+ * merge, which can temporarily hold the sum of two bounded lists.
+ */
+static int
+tophits_bound_Truncate(P7_TOPHITS *h)
+{
+  P7_HIT  *new_unsrt = NULL;
+  P7_HIT **new_hit   = NULL;
+  uint64_t i;
+  int      status;
+
+  if (h->N > h->Kmax)
+    {
+      ESL_ALLOC(new_unsrt, sizeof(P7_HIT)   * (h->Kmax+1));
+      ESL_ALLOC(new_hit,   sizeof(P7_HIT *) * (h->Kmax+1));
+
+      for (i = h->Kmax; i < h->N; i++)
+	if ((status = tophits_evict_Record(h, h->hit[i]->lnP, h->hit[i]->score, h->hit[i]->flags)) != eslOK) goto ERROR;
+      for (i = h->Kmax; i < h->N; i++) tophits_hit_Free(h->hit[i]);
+
+      for (i = 0; i < h->Kmax; i++) {
+        new_unsrt[i] = *(h->hit[i]);
+        new_hit[i]   = new_unsrt + i;
+      }
+      free(h->unsrt);
+      free(h->hit);
+      h->unsrt  = new_unsrt;
+      h->hit    = new_hit;
+      h->N      = h->Kmax;
+      h->Nalloc = h->Kmax+1;
+    }
+  tophits_heap_Rebuild(h);
+  return eslOK;
+
+ ERROR:
+  if (new_unsrt) free(new_unsrt);
+  if (new_hit)   free(new_hit);
+  return status;
+}
+
+
 /* Function:  p7_tophits_Merge()
  * Synopsis:  Merge two top hits lists.
  *
@@ -392,6 +694,9 @@ p7_tophits_SortByModelnameAndAlipos(P7_TOPHITS *h)
  *            not access it further, and may as well free
  *            it immediately.
  *
+ *            If <h1> is bounded (<p7_tophits_SetMaxHits()>),
+ *            only its top <Kmax> hits are kept after the merge.
+ *
  * Returns:   <eslOK> on success.
  *
  * Throws:    <eslEMEM> on allocation failure, and
@@ -405,9 +710,15 @@ p7_tophits_Merge(P7_TOPHITS *h1, P7_TOPHITS *h2)
   P7_HIT  *ori1    = h1->unsrt;    /* original base of h1's data */
   P7_HIT  *new2;
   int      i,j,k;
+  uint64_t e;
   uint64_t Nalloc = h1->Nalloc + h2->Nalloc;
   int      status;
 
+  /* h1 takes over what h2 remembers of the hits it evicted */
+  for (e = 0; e < h2->nevicted; e++)
+    if ((status = tophits_evict_Record(h1, h2->evicted[e].lnP, h2->evicted[e].score, h2->evicted[e].flags)) != eslOK) goto ERROR;
+  h2->nevicted = 0;
+
   if(h2->N <= 0) return eslOK;
   
   /* Make sure the two lists are sorted */
@@ -448,6 +759,9 @@ p7_tophits_Merge(P7_TOPHITS *h1, P7_TOPHITS *h2)
   h1->Nalloc = Nalloc;
   h1->N     += h2->N;
   /* and is_sorted is TRUE, as a side effect of p7_tophits_Sort() above. */
+
+  /* A bounded h1 stays bounded: drop the merged tail beyond Kmax. */
+  if (h1->Kmax > 0 && (status = tophits_bound_Truncate(h1)) != eslOK) return status;
   return eslOK;
   
  ERROR:
@@ -599,6 +913,9 @@ p7_tophits_Reuse(P7_TOPHITS *h)
   h->is_sorted_by_seqidx = FALSE;
   h->is_sorted_by_sortkey = TRUE;  /* because there are 0 hits */
   h->hit[0]    = h->unsrt;
+  h->nheap     = 0;
+  h->pending   = -1;
+  h->nevicted  = 0;
   return eslOK;
 }
 
@@ -610,7 +927,9 @@ p7_tophits_Destroy(P7_TOPHITS *h)
 {
   int i,j;
   if (h == NULL) return;
-  if (h->hit   != NULL) free(h->hit);
+  if (h->hit     != NULL) free(h->hit);
+  if (h->heap    != NULL) free(h->heap);
+  if (h->evicted != NULL) free(h->evicted);
   if (h->unsrt != NULL) 
   {
     for (i = 0; i < h->N; i++)
@@ -861,13 +1180,18 @@ p7_tophits_RemoveDuplicates(P7_TOPHITS *th, int using_bit_cutoffs)
  *            applied in the pipeline. In this case all we're
  *            responsible for here is counting them (setting
  *            nreported, nincluded counters).
+ *
+ *            If <th> is bounded (<p7_tophits_SetMaxHits()>), the
+ *            hits it evicted are counted in <nreported>, <nincluded>
+ *            and <domZ> as if they had been kept.
  *            
  * Returns:   <eslOK> on success.
  */
 int
 p7_tophits_Threshold(P7_TOPHITS *th, P7_PIPELINE *pli)
 {
-  int h, d;    /* counters over sequence hits, domains in sequences */
+  int      h, d;    /* counters over sequence hits, domains in sequences */
+  uint64_t nreported, nincluded;
   
   /* Flag reported, included targets (if we're using general thresholds) */
   if (! pli->use_bit_cutoffs) 
@@ -898,6 +1222,11 @@ p7_tophits_Threshold(P7_TOPHITS *th, P7_PIPELINE *pli)
       if (th->hit[h]->flags & p7_IS_REPORTED)  th->nreported++;
       if (th->hit[h]->flags & p7_IS_INCLUDED)  th->nincluded++;
   }
+
+  /* Hits evicted from a bounded list (--max-hits) still count */
+  tophits_evicted_Count(th, pli, &nreported, &nincluded);
+  th->nreported += nreported;
+  th->nincluded += nincluded;
   
   /* Now we can determined domZ, the effective search space in which additional domains are found */
   if (pli->domZ_setby == p7_ZSETBY_NTARGETS) pli->domZ = (double) th->nreported;
@@ -941,6 +1270,98 @@ p7_tophits_Threshold(P7_TOPHITS *th, P7_PIPELINE *pli)
 }
 
 
+/* Function:  p7_tophits_Prune()
+ * Synopsis:  Drop hits that can't be reported, keeping the top <K>.
+ *
+ * Purpose:   For a partial hit list <th> -- one worker's share of a
+ *            search that another process will merge and threshold --
+ *            throw away every hit that can't pass the reporting
+ *            threshold of pipeline <pli>, and if <K> is nonzero, all
+ *            but the <K> best of the reportable ones. <th> is left
+ *            sorted by sortkey.
+ *
+ *            Reportability is decided the same way
+ *            <p7_tophits_Threshold()> decides it, so <pli->Z> must
+ *            already be the size of the whole search space, not of
+ *            this share of it. No flags are set; the merged list is
+ *            thresholded as usual.
+ *
+ *            Optionally return in <*opt_nreported> and
+ *            <*opt_nincluded> the number of reportable and includable
+ *            hits in <th> before the top-<K> cut, so the merging side
+ *            can still report the true totals, and size <domZ> by
+ *            them. If <th> is bounded, the hits it evicted are
+ *            included in these counts, and its record of them is
+ *            cleared.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <th> is unchanged.
+ */
+int
+p7_tophits_Prune(P7_TOPHITS *th, P7_PIPELINE *pli, uint64_t K, uint64_t *opt_nreported, uint64_t *opt_nincluded)
+{
+  P7_HIT  *new_unsrt = NULL;
+  P7_HIT **new_hit   = NULL;
+  P7_HIT  *hit;
+  uint64_t nreported = 0;
+  uint64_t nincluded = 0;
+  uint64_t nkeep     = 0;
+  uint64_t nevrep, nevinc;
+  uint64_t h;
+  int      is_reported;
+  int      status;
+
+  p7_tophits_SortBySortkey(th);
+
+  ESL_ALLOC(new_unsrt, sizeof(P7_HIT)   * ESL_MAX(th->N, 1));
+  ESL_ALLOC(new_hit,   sizeof(P7_HIT *) * ESL_MAX(th->N, 1));
+
+  for (h = 0; h < th->N; h++)
+    {
+      hit = th->hit[h];
+      if (pli->use_bit_cutoffs) is_reported = (hit->flags & p7_IS_REPORTED);
+      else                      is_reported = (! (hit->flags & p7_IS_DUPLICATE) && p7_pli_TargetReportable(pli, hit->score, hit->lnP));
+
+      if (is_reported) {
+        nreported++;
+        if (pli->use_bit_cutoffs ? (hit->flags & p7_IS_INCLUDED) : p7_pli_TargetIncludable(pli, hit->score, hit->lnP)) nincluded++;
+      }
+
+      if (is_reported && (K == 0 || nkeep < K)) {
+        new_unsrt[nkeep] = *hit;
+        new_hit[nkeep]   = new_unsrt + nkeep;
+        nkeep++;
+      }
+      else tophits_hit_Free(hit);
+    }
+
+  free(th->unsrt);
+  free(th->hit);
+  th->unsrt    = new_unsrt;
+  th->hit      = new_hit;
+  th->Nalloc   = ESL_MAX(th->N, 1);
+  th->N        = nkeep;
+  th->is_sorted_by_sortkey = TRUE;
+  th->is_sorted_by_seqidx  = FALSE;
+  if (th->Kmax > 0) tophits_heap_Rebuild(th);
+
+  tophits_evicted_Count(th, pli, &nevrep, &nevinc);
+  th->nevicted = 0;
+
+  if (opt_nreported) *opt_nreported = nreported + nevrep;
+  if (opt_nincluded) *opt_nincluded = nincluded + nevinc;
+  return eslOK;
+
+ ERROR:
+  if (new_unsrt) free(new_unsrt);
+  if (new_hit)   free(new_hit);
+  if (opt_nreported) *opt_nreported = 0;
+  if (opt_nincluded) *opt_nincluded = 0;
+  return status;
+}
+
+
 
 
 
@@ -2005,9 +2426,962 @@ p7_tophits_TabularTail(FILE *ofp, const char *progname, enum p7_pipemodes_e pipe
 
 
 
+/*****************************************************************
+ * 4. Binary (compact, fixed-width) output of pipeline results.
+ *****************************************************************/
+
+/* For very large runs (metagenome-scale hmmscan, say) formatting every
+ * --tblout/--domtblout field with fprintf(), and then parsing it all
+ * back in again downstream, is a real cost. The binary format writes
+ * one block per query: a fixed-size header, one fixed-width record per
+ * reported target, one fixed-width record per domain of those targets,
+ * then a string table of NUL-terminated names/accessions/descriptions
+ * that the records index by byte offset. Blocks are simply
+ * concatenated, like tabular output for multiple queries.
+ *
+ * Records are written in native byte order; the magic number at the
+ * head of each block lets a reader detect a file from a machine with
+ * the other byte order (which we reject rather than swap).
+ * p7_tophits_ReadBinary() reconstructs a P7_TOPHITS from each block,
+ * so any of the tabular writers above can render it.
+ */
+#define p7_HITBIN_MAGIC   0xe8b0e1f1   /* "p7 hits binary, v1": 'h' 'i' 'b' '1' with high bits set */
+#define p7_HITBIN_NOSTR   UINT32_MAX   /* string offset for an absent (NULL) acc or desc        */
+#define p7_HITBIN_BADSTR(off, strsize)  ((off) != p7_HITBIN_NOSTR && (off) >= (strsize))  /* offset outside the string table? */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t nhits;          /* # of target records that follow       */
+  uint32_t ndoms;          /* # of domain records that follow those  */
+  uint32_t strsize;        /* size of the string table, in bytes    */
+  uint32_t qname;          /* offset of query name in string table  */
+  uint32_t qacc;           /* offset of query accession, or NOSTR   */
+  int32_t  mode;           /* p7_SEARCH_SEQS | p7_SCAN_MODELS       */
+  int32_t  long_targets;   /* TRUE for nhmmer/nhmmscan results      */
+  double   Z;
+  double   domZ;
+} P7_HITBIN_HEADER;
+
+typedef struct {
+  double   lnP;
+  float    score;
+  float    pre_score;
+  float    nexpected;
+  int32_t  nregions;
+  int32_t  nclustered;
+  int32_t  noverlaps;
+  int32_t  nenvelopes;
+  int32_t  ndom;           /* this hit's domains are the next <ndom> domain records */
+  int32_t  nreported;
+  int32_t  nincluded;
+  int32_t  best_domain;
+  uint32_t flags;
+  uint32_t name;
+  uint32_t acc;
+  uint32_t desc;
+} P7_HITBIN_TARGET;
+
+typedef struct {
+  double   lnP;
+  float    bitscore;
+  float    dombias;
+  float    oasc;
+  int32_t  ienv, jenv;
+  int32_t  iali, jali;
+  int32_t  hmmfrom, hmmto;
+  int32_t  M;
+  int32_t  is_reported;
+  int32_t  is_included;
+  int64_t  sqfrom, sqto;
+  int64_t  L;
+} P7_HITBIN_DOMAIN;
+
+
+/* Function:  p7_tophits_Binary()
+ * Synopsis:  Output compact binary records of per-sequence and per-domain hits.
+ *
+ * Purpose:   Write one binary block for the reportable hits in sorted
+ *            tophits list <th> (and all their domains) to stream
+ *            <ofp>, along with query name <qname>, accession <qacc>,
+ *            and the final pipeline accounting in <pli> needed to
+ *            compute E-values. The block carries everything
+ *            <p7_tophits_TabularTargets()> and
+ *            <p7_tophits_TabularDomains()> print; use
+ *            <p7_tophits_ReadBinary()> to get it back.
+ *
+ *            Designed to be concatenated for multiple queries and
+ *            multiple top hits list.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ *            <eslEWRITE> if a write to <ofp> fails.
+ */
+int
+p7_tophits_Binary(FILE *ofp, char *qname, char *qacc, P7_TOPHITS *th, P7_PIPELINE *pli)
+{
+  P7_HITBIN_HEADER  hdr;
+  P7_HITBIN_TARGET *tgt  = NULL;
+  P7_HITBIN_DOMAIN *dom  = NULL;
+  char             *str  = NULL;
+  uint32_t          n    = 0;
+  int               h, d, i;
+  int               status;
+
+  /* size everything first, so each section is one allocation and one fwrite() */
+  hdr.magic   = p7_HITBIN_MAGIC;
+  hdr.nhits   = 0;
+  hdr.ndoms   = 0;
+  hdr.strsize = strlen(qname) + 1 + ((qacc && qacc[0] != '\0') ? strlen(qacc) + 1 : 0);
+  for (h = 0; h < th->N; h++)
+    if (th->hit[h]->flags & p7_IS_REPORTED)
+      {
+        hdr.nhits++;
+        hdr.ndoms   += th->hit[h]->ndom;
+        hdr.strsize += strlen(th->hit[h]->name) + 1;
+        if (th->hit[h]->acc)  hdr.strsize += strlen(th->hit[h]->acc)  + 1;
+        if (th->hit[h]->desc) hdr.strsize += strlen(th->hit[h]->desc) + 1;
+      }
+  hdr.mode         = pli->mode;
+  hdr.long_targets = pli->long_targets;
+  hdr.Z            = pli->Z;
+  hdr.domZ         = pli->domZ;
+
+  ESL_ALLOC(tgt, sizeof(P7_HITBIN_TARGET) * ESL_MAX(1, hdr.nhits));
+  ESL_ALLOC(dom, sizeof(P7_HITBIN_DOMAIN) * ESL_MAX(1, hdr.ndoms));
+  ESL_ALLOC(str, sizeof(char)             * hdr.strsize);
+
+#define p7_HITBIN_ADDSTR(s, off) do { (off) = n; strcpy(str+n, (s)); n += strlen(s) + 1; } while (0)
+
+  p7_HITBIN_ADDSTR(qname, hdr.qname);
+  if (qacc && qacc[0] != '\0') p7_HITBIN_ADDSTR(qacc, hdr.qacc); else hdr.qacc = p7_HITBIN_NOSTR;
+
+  for (i = 0, d = 0, h = 0; h < th->N; h++)
+    if (th->hit[h]->flags & p7_IS_REPORTED)
+      {
+        P7_HIT *hit = th->hit[h];
+        int     k;
+
+        tgt[i].lnP         = hit->lnP;
+        tgt[i].score       = hit->score;
+        tgt[i].pre_score   = hit->pre_score;
+        tgt[i].nexpected   = hit->nexpected;
+        tgt[i].nregions    = hit->nregions;
+        tgt[i].nclustered  = hit->nclustered;
+        tgt[i].noverlaps   = hit->noverlaps;
+        tgt[i].nenvelopes  = hit->nenvelopes;
+        tgt[i].ndom        = hit->ndom;
+        tgt[i].nreported   = hit->nreported;
+        tgt[i].nincluded   = hit->nincluded;
+        tgt[i].best_domain = hit->best_domain;
+        tgt[i].flags       = hit->flags;
+        p7_HITBIN_ADDSTR(hit->name, tgt[i].name);
+        if (hit->acc)  p7_HITBIN_ADDSTR(hit->acc,  tgt[i].acc);  else tgt[i].acc  = p7_HITBIN_NOSTR;
+        if (hit->desc) p7_HITBIN_ADDSTR(hit->desc, tgt[i].desc); else tgt[i].desc = p7_HITBIN_NOSTR;
+        i++;
+
+        for (k = 0; k < hit->ndom; k++, d++)
+          {
+            dom[d].lnP         = hit->dcl[k].lnP;
+            dom[d].bitscore    = hit->dcl[k].bitscore;
+            dom[d].dombias     = hit->dcl[k].dombias;
+            dom[d].oasc        = hit->dcl[k].oasc;
+            dom[d].ienv        = hit->dcl[k].ienv;
+            dom[d].jenv        = hit->dcl[k].jenv;
+            dom[d].iali        = hit->dcl[k].iali;
+            dom[d].jali        = hit->dcl[k].jali;
+            dom[d].is_reported = hit->dcl[k].is_reported;
+            dom[d].is_included = hit->dcl[k].is_included;
+            dom[d].hmmfrom     = hit->dcl[k].ad->hmmfrom;
+            dom[d].hmmto       = hit->dcl[k].ad->hmmto;
+            dom[d].M           = hit->dcl[k].ad->M;
+            dom[d].sqfrom      = hit->dcl[k].ad->sqfrom;
+            dom[d].sqto        = hit->dcl[k].ad->sqto;
+            dom[d].L           = hit->dcl[k].ad->L;
+          }
+      }
+#undef p7_HITBIN_ADDSTR
+
+  if (fwrite(&hdr, sizeof(P7_HITBIN_HEADER), 1,         ofp) != 1)         ESL_XEXCEPTION_SYS(eslEWRITE, "binary hit output: write failed");
+  if (fwrite(tgt,  sizeof(P7_HITBIN_TARGET), hdr.nhits, ofp) != hdr.nhits) ESL_XEXCEPTION_SYS(eslEWRITE, "binary hit output: write failed");
+  if (fwrite(dom,  sizeof(P7_HITBIN_DOMAIN), hdr.ndoms, ofp) != hdr.ndoms) ESL_XEXCEPTION_SYS(eslEWRITE, "binary hit output: write failed");
+  if (fwrite(str,  sizeof(char), hdr.strsize, ofp)         != hdr.strsize) ESL_XEXCEPTION_SYS(eslEWRITE, "binary hit output: write failed");
+
+  free(tgt);
+  free(dom);
+  free(str);
+  return eslOK;
+
+ ERROR:
+  if (tgt) free(tgt);
+  if (dom) free(dom);
+  if (str) free(str);
+  return status;
+}
+
+
+/* Function:  p7_tophits_ReadBinary()
+ * Synopsis:  Read the next block of binary hit output.
+ *
+ * Purpose:   Read the next block written by <p7_tophits_Binary()>
+ *            from stream <ifp>. Return a new top hits list in
+ *            <*ret_th>, sorted in the order the hits were written,
+ *            and the query name and accession (or NULL) in
+ *            <*ret_qname> and <*ret_qacc>; caller frees all three.
+ *
+ *            The pipeline fields the tabular writers need (<Z>,
+ *            <domZ>, <mode>, <long_targets>) are set in <pli>, which
+ *            doesn't need to be a fully created pipeline; a zeroed
+ *            <P7_PIPELINE> on the stack will do.
+ *
+ *            Reconstructed domains have alignment displays with
+ *            coordinates and lengths but no alignment strings, so
+ *            they're suitable for tabular output, not for
+ *            <p7_tophits_Domains()>.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEOF> if there are no more blocks in <ifp>.
+ *            <eslEFORMAT> if the block is truncated or isn't in the
+ *            expected format (including the wrong byte order).
+ *
+ * Throws:    <eslEMEM> on allocation failure.
+ */
+int
+p7_tophits_ReadBinary(FILE *ifp, char **ret_qname, char **ret_qacc, P7_TOPHITS **ret_th, P7_PIPELINE *pli)
+{
+  P7_HITBIN_HEADER  hdr;
+  P7_HITBIN_TARGET *tgt   = NULL;
+  P7_HITBIN_DOMAIN *dom   = NULL;
+  char             *str   = NULL;
+  P7_TOPHITS       *th    = NULL;
+  P7_HIT           *hit   = NULL;
+  char             *qname = NULL;
+  char             *qacc  = NULL;
+  uint32_t          h, d;
+  int               k;
+  int               status;
+
+  if (fread(&hdr, sizeof(P7_HITBIN_HEADER), 1, ifp) != 1) { status = eslEOF; goto ERROR; }
+  if (hdr.magic != p7_HITBIN_MAGIC)                       { status = eslEFORMAT; goto ERROR; }
+
+  ESL_ALLOC(tgt, sizeof(P7_HITBIN_TARGET) * ESL_MAX(1, hdr.nhits));
+  ESL_ALLOC(dom, sizeof(P7_HITBIN_DOMAIN) * ESL_MAX(1, hdr.ndoms));
+  ESL_ALLOC(str, sizeof(char)             * ESL_MAX(1, hdr.strsize));
+  if (fread(tgt, sizeof(P7_HITBIN_TARGET), hdr.nhits, ifp) != hdr.nhits)   { status = eslEFORMAT; goto ERROR; }
+  if (fread(dom, sizeof(P7_HITBIN_DOMAIN), hdr.ndoms, ifp) != hdr.ndoms)   { status = eslEFORMAT; goto ERROR; }
+  if (fread(str, sizeof(char), hdr.strsize, ifp)           != hdr.strsize) { status = eslEFORMAT; goto ERROR; }
+  if (hdr.strsize == 0 || str[hdr.strsize-1] != '\0')                      { status = eslEFORMAT; goto ERROR; }
+  if (hdr.qname == p7_HITBIN_NOSTR || p7_HITBIN_BADSTR(hdr.qname, hdr.strsize) || p7_HITBIN_BADSTR(hdr.qacc, hdr.strsize)) { status = eslEFORMAT; goto ERROR; }
+
+  if ((status = esl_strdup(str + hdr.qname, -1, &qname)) != eslOK) goto ERROR;
+  if (hdr.qacc != p7_HITBIN_NOSTR && (status = esl_strdup(str + hdr.qacc, -1, &qacc)) != eslOK) goto ERROR;
+
+  if ((th = p7_tophits_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+  for (d = 0, h = 0; h < hdr.nhits; h++)
+    {
+      if (d + tgt[h].ndom > hdr.ndoms) { status = eslEFORMAT; goto ERROR; }
+      if (tgt[h].name == p7_HITBIN_NOSTR          || p7_HITBIN_BADSTR(tgt[h].name, hdr.strsize) ||
+          p7_HITBIN_BADSTR(tgt[h].acc, hdr.strsize) || p7_HITBIN_BADSTR(tgt[h].desc, hdr.strsize)) { status = eslEFORMAT; goto ERROR; }
+      if ((status = p7_tophits_CreateNextHit(th, &hit)) != eslOK) goto ERROR;
+
+      hit->sortkey     = (double) (hdr.nhits - h);  /* preserves the written order */
+      hit->lnP         = tgt[h].lnP;
+      hit->score       = tgt[h].score;
+      hit->pre_score   = tgt[h].pre_score;
+      hit->nexpected   = tgt[h].nexpected;
+      hit->nregions    = tgt[h].nregions;
+      hit->nclustered  = tgt[h].nclustered;
+      hit->noverlaps   = tgt[h].noverlaps;
+      hit->nenvelopes  = tgt[h].nenvelopes;
+      hit->nreported   = tgt[h].nreported;
+      hit->nincluded   = tgt[h].nincluded;
+      hit->best_domain = tgt[h].best_domain;
+      hit->flags       = tgt[h].flags;
+      if ((status = esl_strdup(str + tgt[h].name, -1, &(hit->name))) != eslOK) goto ERROR;
+      if (tgt[h].acc  != p7_HITBIN_NOSTR && (status = esl_strdup(str + tgt[h].acc,  -1, &(hit->acc)))  != eslOK) goto ERROR;
+      if (tgt[h].desc != p7_HITBIN_NOSTR && (status = esl_strdup(str + tgt[h].desc, -1, &(hit->desc))) != eslOK) goto ERROR;
+
+      ESL_ALLOC(hit->dcl, sizeof(P7_DOMAIN) * ESL_MAX(1, tgt[h].ndom));
+      for (k = 0; k < tgt[h].ndom; k++)
+        {
+          hit->dcl[k].ad             = NULL;
+          hit->dcl[k].scores_per_pos = NULL;
+        }
+      hit->ndom = tgt[h].ndom;    /* only now, so p7_tophits_Destroy() sees initialized dcl's on error */
+
+      for (k = 0; k < hit->ndom; k++, d++)
+        {
+          hit->dcl[k].lnP         = dom[d].lnP;
+          hit->dcl[k].bitscore    = dom[d].bitscore;
+          hit->dcl[k].dombias     = dom[d].dombias;
+          hit->dcl[k].oasc        = dom[d].oasc;
+          hit->dcl[k].ienv        = dom[d].ienv;
+          hit->dcl[k].jenv        = dom[d].jenv;
+          hit->dcl[k].iali        = dom[d].iali;
+          hit->dcl[k].jali        = dom[d].jali;
+          hit->dcl[k].is_reported = dom[d].is_reported;
+          hit->dcl[k].is_included = dom[d].is_included;
+
+          ESL_ALLOC(hit->dcl[k].ad, sizeof(P7_ALIDISPLAY));
+          memset(hit->dcl[k].ad, 0, sizeof(P7_ALIDISPLAY));
+          hit->dcl[k].ad->hmmfrom = dom[d].hmmfrom;
+          hit->dcl[k].ad->hmmto   = dom[d].hmmto;
+          hit->dcl[k].ad->M       = dom[d].M;
+          hit->dcl[k].ad->sqfrom  = dom[d].sqfrom;
+          hit->dcl[k].ad->sqto    = dom[d].sqto;
+          hit->dcl[k].ad->L       = dom[d].L;
+        }
+
+      if (hit->flags & p7_IS_REPORTED) th->nreported++;
+      if (hit->flags & p7_IS_INCLUDED) th->nincluded++;
+    }
+  p7_tophits_SortBySortkey(th);
+
+  pli->mode         = hdr.mode;
+  pli->long_targets = hdr.long_targets;
+  pli->Z            = hdr.Z;
+  pli->domZ         = hdr.domZ;
+
+  free(tgt);
+  free(dom);
+  free(str);
+  *ret_qname = qname;
+  *ret_qacc  = qacc;
+  *ret_th    = th;
+  return eslOK;
+
+ ERROR:
+  if (tgt)   free(tgt);
+  if (dom)   free(dom);
+  if (str)   free(str);
+  if (qname) free(qname);
+  if (qacc)  free(qacc);
+  if (th)    p7_tophits_Destroy(th);
+  *ret_qname = NULL;
+  *ret_qacc  = NULL;
+  *ret_th    = NULL;
+  return status;
+}
+/*------------------- end, binary output ------------------------*/
+
+
+
+/*****************************************************************
+ * 5. Packed, portable serialization of hit lists.
+ *****************************************************************/
+
+/* hmmpgmd's workers, master, and clients pass hit lists over
+ * sockets. Sending the structures themselves ties the wire format to
+ * struct layout, padding, and pointer size, so a worker and a master
+ * (or a client) from different builds can't talk to each other; and
+ * much of what's sent is pointers and padding. The packed format
+ * fixes both:
+ *
+ *   - integers are LEB128 varints, signed ones zigzag-coded first;
+ *   - floats and doubles are their IEEE754 bits, little-endian;
+ *   - strings are interned as they go: the first time a string
+ *     appears it's sent in full and gets the next index, and after
+ *     that only its index is sent. Every alignment display carries
+ *     the query's name, accession and description, so in a search
+ *     these go once instead of once per domain;
+ *   - domain and alignment coordinates are sent relative to each
+ *     other (jenv as jenv-ienv, and so on), which keeps them small;
+ *   - alignment display lines are sent as <N> bytes, unterminated,
+ *     and optional lines only if present.
+ *
+ * A block is the 4-byte magic "p7hw", a version byte, the block's
+ * total size as a fixed 8-byte little-endian integer (so a block can
+ * be handed around without its size, as to hmmpgmd2msa()), the
+ * number of hits, and the hits in rank order, each followed by its
+ * domains. Blocks of another version are rejected, so bump
+ * p7_HITPACK_VERSION whenever the encoding changes.
+ *
+ * Per-position scores (nhmmer's <scores_per_pos>) aren't carried,
+ * as in the MPI messages.
+ */
+#define p7_HITPACK_VERSION  1
+#define p7_HITPACK_HDRSIZE  13   /* magic[4] + version[1] + size[8] */
+
+static const char p7_HITPACK_MAGIC[4] = { 'p', '7', 'h', 'w' };
+
+/* optional lines present in an alignment display */
+#define p7_HITPACK_RFLINE   (1<<0)
+#define p7_HITPACK_MMLINE   (1<<1)
+#define p7_HITPACK_CSLINE   (1<<2)
+#define p7_HITPACK_PPLINE   (1<<3)
+#define p7_HITPACK_NTSEQ    (1<<4)
+
+/* per-domain flags */
+#define p7_HITPACK_REPORTED (1<<0)
+#define p7_HITPACK_INCLUDED (1<<1)
+#define p7_HITPACK_HASALI   (1<<2)
+
+typedef struct {
+  char        *buf;
+  uint64_t     n;        /* bytes written so far                       */
+  uint64_t     nalloc;
+  ESL_KEYHASH *kh;       /* strings sent so far; keyhash index = string index */
+  int          status;   /* eslOK, or the first error; after one, puts do nothing */
+} P7_HITPACK;
+
+typedef struct {
+  const char  *buf;
+  uint64_t     n;        /* size of the block                          */
+  uint64_t     pos;      /* next byte to read                          */
+  char       **str;      /* strings seen so far, [0..nstr-1]           */
+  int          nstr;
+  int          stralloc;
+  int          status;   /* eslOK, or the first error; after one, gets return 0/NULL */
+} P7_HITUNPACK;
+
+
+/* hitpack_bytes(), hitpack_fixed(), hitpack_varint(), hitpack_svarint(),
+ * hitpack_float(), hitpack_double()
+ * Append raw bytes, an <nbytes> little-endian integer, a varint, a
+ * zigzag-coded signed varint, a float, or a double to <p>.
+ */
+static void
+hitpack_bytes(P7_HITPACK *p, const void *s, uint64_t len)
+{
+  void *tmp;
+
+  if (p->status != eslOK) return;
+  if (p->n + len > p->nalloc)
+    {
+      p->nalloc = ESL_MAX(p->nalloc * 2, p->n + len);
+      if ((tmp = realloc(p->buf, p->nalloc)) == NULL) { p->status = eslEMEM; return; }
+      p->buf = tmp;
+    }
+  memcpy(p->buf + p->n, s, len);
+  p->n += len;
+}
+
+static void
+hitpack_fixed(P7_HITPACK *p, uint64_t x, int nbytes)
+{
+  unsigned char b[8];
+  int           i;
+
+  for (i = 0; i < nbytes; i++) { b[i] = x & 0xff; x >>= 8; }
+  hitpack_bytes(p, b, nbytes);
+}
+
+static void
+hitpack_varint(P7_HITPACK *p, uint64_t x)
+{
+  unsigned char b[10];
+  int           i = 0;
+
+  while (x >= 0x80) { b[i++] = (x & 0x7f) | 0x80; x >>= 7; }
+  b[i++] = x;
+  hitpack_bytes(p, b, i);
+}
+
+static void
+hitpack_svarint(P7_HITPACK *p, int64_t x)
+{
+  hitpack_varint(p, ((uint64_t) x << 1) ^ (uint64_t) (x >> 63));
+}
+
+static void
+hitpack_float(P7_HITPACK *p, float x)
+{
+  union { float f; uint32_t u; } v;
+
+  v.f = x;
+  hitpack_fixed(p, v.u, 4);
+}
+
+static void
+hitpack_double(P7_HITPACK *p, double x)
+{
+  union { double d; uint64_t u; } v;
+
+  v.d = x;
+  hitpack_fixed(p, v.u, 8);
+}
+
+/* hitpack_string()
+ * Append string <s>, or NULL: as 0 for NULL; as 1, its length, and
+ * its bytes the first time it's seen; and as its index + 2 after that.
+ */
+static void
+hitpack_string(P7_HITPACK *p, const char *s)
+{
+  int idx;
+  int status;
+
+  if (p->status != eslOK) return;
+  if (s == NULL) { hitpack_varint(p, 0); return; }
+
+  status = esl_keyhash_Store(p->kh, s, -1, &idx);
+  if      (status == eslEDUP) hitpack_varint(p, (uint64_t) idx + 2);
+  else if (status == eslOK)   { hitpack_varint(p, 1); hitpack_varint(p, strlen(s)); hitpack_bytes(p, s, strlen(s)); }
+  else                        p->status = status;
+}
+
+/* hitpack_alidisplay()
+ * Append alignment display <ad> to <p>.
+ */
+static void
+hitpack_alidisplay(P7_HITPACK *p, const P7_ALIDISPLAY *ad)
+{
+  uint32_t opts = 0;
+
+  if (ad->rfline) opts |= p7_HITPACK_RFLINE;
+  if (ad->mmline) opts |= p7_HITPACK_MMLINE;
+  if (ad->csline) opts |= p7_HITPACK_CSLINE;
+  if (ad->ppline) opts |= p7_HITPACK_PPLINE;
+  if (ad->ntseq)  opts |= p7_HITPACK_NTSEQ;
+
+  hitpack_varint(p, opts);
+  hitpack_varint(p, ad->N);
+  if (ad->rfline) hitpack_bytes(p, ad->rfline, ad->N);
+  if (ad->mmline) hitpack_bytes(p, ad->mmline, ad->N);
+  if (ad->csline) hitpack_bytes(p, ad->csline, ad->N);
+  hitpack_bytes(p, ad->model, ad->N);
+  hitpack_bytes(p, ad->mline, ad->N);
+  hitpack_bytes(p, ad->aseq,  ad->N);
+  if (ad->ntseq)  hitpack_bytes(p, ad->ntseq,  3 * ad->N);
+  if (ad->ppline) hitpack_bytes(p, ad->ppline, ad->N);
+
+  hitpack_string (p, ad->hmmname);
+  hitpack_string (p, ad->hmmacc);
+  hitpack_string (p, ad->hmmdesc);
+  hitpack_svarint(p, ad->hmmfrom);
+  hitpack_svarint(p, (int64_t) ad->hmmto - ad->hmmfrom);
+  hitpack_svarint(p, (int64_t) ad->M     - ad->hmmto);
+
+  hitpack_string (p, ad->sqname);
+  hitpack_string (p, ad->sqacc);
+  hitpack_string (p, ad->sqdesc);
+  hitpack_svarint(p, ad->sqfrom);
+  hitpack_svarint(p, (int64_t) ad->sqto - ad->sqfrom);
+  hitpack_svarint(p, (int64_t) ad->L    - ad->sqto);
+}
+
+
+/* hitunpack_bytes(), hitunpack_fixed(), hitunpack_varint(), hitunpack_svarint(),
+ * hitunpack_float(), hitunpack_double()
+ * The reverse of the puts above. Reading past the end of the block,
+ * or an overlong varint, sets <u->status> to <eslEFORMAT>.
+ */
+static const char *
+hitunpack_bytes(P7_HITUNPACK *u, uint64_t len)
+{
+  const char *s;
+
+  if (u->status != eslOK) return NULL;
+  if (len > u->n - u->pos) { u->status = eslEFORMAT; return NULL; }
+  s       = u->buf + u->pos;
+  u->pos += len;
+  return s;
+}
+
+static uint64_t
+hitunpack_fixed(P7_HITUNPACK *u, int nbytes)
+{
+  const unsigned char *b = (const unsigned char *) hitunpack_bytes(u, nbytes);
+  uint64_t             x = 0;
+  int                  i;
+
+  if (b == NULL) return 0;
+  for (i = nbytes-1; i >= 0; i--) x = (x << 8) | b[i];
+  return x;
+}
+
+static uint64_t
+hitunpack_varint(P7_HITUNPACK *u)
+{
+  const unsigned char *b;
+  uint64_t             x     = 0;
+  int                  shift = 0;
+
+  do {
+    if ((b = (const unsigned char *) hitunpack_bytes(u, 1)) == NULL) return 0;
+    if (shift > 63) { u->status = eslEFORMAT; return 0; }
+    x     |= (uint64_t) (*b & 0x7f) << shift;
+    shift += 7;
+  } while (*b & 0x80);
+  return x;
+}
+
+static int64_t
+hitunpack_svarint(P7_HITUNPACK *u)
+{
+  uint64_t x = hitunpack_varint(u);
+  return (int64_t) (x >> 1) ^ -(int64_t) (x & 1);
+}
+
+static float
+hitunpack_float(P7_HITUNPACK *u)
+{
+  union { float f; uint32_t u; } v;
+
+  v.u = hitunpack_fixed(u, 4);
+  return v.f;
+}
+
+static double
+hitunpack_double(P7_HITUNPACK *u)
+{
+  union { double d; uint64_t u; } v;
+
+  v.u = hitunpack_fixed(u, 8);
+  return v.d;
+}
+
+/* hitunpack_string()
+ * Read a string (or NULL) appended by hitpack_string(), and return a
+ * copy of it in <*ret_s> for the caller to free.
+ */
+static void
+hitunpack_string(P7_HITUNPACK *u, char **ret_s)
+{
+  uint64_t    code = hitunpack_varint(u);
+  uint64_t    len;
+  const char *s;
+  void       *tmp;
+  int         status;
+
+  *ret_s = NULL;
+  if (u->status != eslOK || code == 0) return;
+
+  if (code == 1)
+    {
+      len = hitunpack_varint(u);
+      if ((s = hitunpack_bytes(u, len)) == NULL) return;
+      if (u->nstr == u->stralloc)
+        {
+          u->stralloc = ESL_MAX(2 * u->stralloc, 64);
+          if ((tmp = realloc(u->str, sizeof(char *) * u->stralloc)) == NULL) { u->status = eslEMEM; return; }
+          u->str = tmp;
+        }
+      if ((status = esl_strdup(s, len, &(u->str[u->nstr]))) != eslOK) { u->status = status; return; }
+      code = (u->nstr++) + 2;
+    }
+  if (code - 2 >= (uint64_t) u->nstr) { u->status = eslEFORMAT; return; }
+  if ((status = esl_strdup(u->str[code-2], -1, ret_s)) != eslOK) u->status = status;
+}
+
+/* hitunpack_line()
+ * Read <len> bytes of an alignment display line into a new string.
+ */
+static void
+hitunpack_line(P7_HITUNPACK *u, char **ret_line, uint64_t len)
+{
+  const char *s = hitunpack_bytes(u, len);
+  int         status;
+
+  *ret_line = NULL;
+  if (s != NULL && (status = esl_strdup(s, len, ret_line)) != eslOK) u->status = status;
+}
+
+/* hitunpack_alidisplay()
+ * Read an alignment display appended by hitpack_alidisplay() into a
+ * new, deserialized P7_ALIDISPLAY in <*ret_ad>. <*ret_ad> is set even
+ * if the read fails, so the caller can free what was built.
+ */
+static void
+hitunpack_alidisplay(P7_HITUNPACK *u, P7_ALIDISPLAY **ret_ad)
+{
+  P7_ALIDISPLAY *ad = NULL;
+  uint32_t       opts;
+  uint64_t       N;
+
+  *ret_ad = NULL;
+  if (u->status != eslOK) return;
+  if ((ad = malloc(sizeof(P7_ALIDISPLAY))) == NULL) { u->status = eslEMEM; return; }
+  memset(ad, 0, sizeof(P7_ALIDISPLAY));   /* deserialized: mem = NULL, memsize = 0 */
+  *ret_ad = ad;
+
+  opts = hitunpack_varint(u);
+  N    = hitunpack_varint(u);
+  if (N > u->n - u->pos) { u->status = eslEFORMAT; return; }
+  ad->N = N;
+
+  if (opts & p7_HITPACK_RFLINE) hitunpack_line(u, &(ad->rfline), N);
+  if (opts & p7_HITPACK_MMLINE) hitunpack_line(u, &(ad->mmline), N);
+  if (opts & p7_HITPACK_CSLINE) hitunpack_line(u, &(ad->csline), N);
+  hitunpack_line(u, &(ad->model), N);
+  hitunpack_line(u, &(ad->mline), N);
+  hitunpack_line(u, &(ad->aseq),  N);
+  if (opts & p7_HITPACK_NTSEQ)  hitunpack_line(u, &(ad->ntseq),  3 * N);
+  if (opts & p7_HITPACK_PPLINE) hitunpack_line(u, &(ad->ppline), N);
+
+  hitunpack_string(u, &(ad->hmmname));
+  hitunpack_string(u, &(ad->hmmacc));
+  hitunpack_string(u, &(ad->hmmdesc));
+  ad->hmmfrom = hitunpack_svarint(u);
+  ad->hmmto   = ad->hmmfrom + hitunpack_svarint(u);
+  ad->M       = ad->hmmto   + hitunpack_svarint(u);
+
+  hitunpack_string(u, &(ad->sqname));
+  hitunpack_string(u, &(ad->sqacc));
+  hitunpack_string(u, &(ad->sqdesc));
+  ad->sqfrom  = hitunpack_svarint(u);
+  ad->sqto    = ad->sqfrom  + hitunpack_svarint(u);
+  ad->L       = ad->sqto    + hitunpack_svarint(u);
+
+  /* the name, acc, desc fields of a display are never NULL, just "" */
+  if (u->status == eslOK && (ad->hmmname == NULL || ad->hmmacc == NULL || ad->hmmdesc == NULL ||
+                             ad->sqname  == NULL || ad->sqacc  == NULL || ad->sqdesc  == NULL))
+    u->status = eslEFORMAT;
+}
+
+
+/* Function:  p7_tophits_Pack()
+ * Synopsis:  Pack a hit list into a portable byte buffer.
+ *
+ * Purpose:   Pack the top <nhits> hits of <th> by sortkey (all of
+ *            them, if <nhits> is 0 or more than <th> holds), with
+ *            their domains and alignment displays, into a new buffer
+ *            <*ret_buf> of <*ret_n> bytes. Caller frees <*ret_buf>.
+ *
+ *            The packed block doesn't depend on struct layout,
+ *            pointer size or byte order; <p7_tophits_Unpack()> reads
+ *            it back on any build that knows its version.
+ *
+ * Returns:   <eslOK> on success.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <*ret_buf> is NULL and
+ *            <*ret_n> is 0.
+ */
+int
+p7_tophits_Pack(P7_TOPHITS *th, uint64_t nhits, char **ret_buf, uint64_t *ret_n)
+{
+  P7_HITPACK p;
+  P7_HIT    *hit;
+  P7_DOMAIN *dom;
+  uint64_t   h;
+  int        prv_ienv;
+  int        i, d;
+  int        status;
+
+  p.buf    = NULL;
+  p.n      = 0;
+  p.nalloc = 0;
+  p.status = eslOK;
+  if ((p.kh = esl_keyhash_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+
+  if ((status = p7_tophits_SortBySortkey(th)) != eslOK) goto ERROR;
+  if (nhits == 0 || nhits > th->N) nhits = th->N;
+
+  hitpack_bytes (&p, p7_HITPACK_MAGIC, 4);
+  hitpack_fixed (&p, p7_HITPACK_VERSION, 1);
+  hitpack_fixed (&p, 0, 8);                  /* block size, filled in at the end */
+  hitpack_varint(&p, nhits);
+
+  for (h = 0; h < nhits; h++)
+    {
+      hit = th->hit[h];
+
+      hitpack_string (&p, hit->name);
+      hitpack_string (&p, hit->acc);
+      hitpack_string (&p, hit->desc);
+      hitpack_svarint(&p, hit->window_length);
+      hitpack_double (&p, hit->sortkey);
+      hitpack_float  (&p, hit->score);
+      hitpack_float  (&p, hit->pre_score);
+      hitpack_float  (&p, hit->sum_score);
+      hitpack_double (&p, hit->lnP);
+      hitpack_double (&p, hit->pre_lnP);
+      hitpack_double (&p, hit->sum_lnP);
+      hitpack_float  (&p, hit->nexpected);
+      hitpack_svarint(&p, hit->nregions);
+      hitpack_svarint(&p, hit->nclustered);
+      hitpack_svarint(&p, hit->noverlaps);
+      hitpack_svarint(&p, hit->nenvelopes);
+      hitpack_varint (&p, hit->flags);
+      hitpack_svarint(&p, hit->nreported);
+      hitpack_svarint(&p, hit->nincluded);
+      hitpack_svarint(&p, hit->best_domain);
+      hitpack_svarint(&p, hit->seqidx);
+      hitpack_svarint(&p, hit->subseq_start);
+      hitpack_varint (&p, hit->ndom);
+
+      for (prv_ienv = 0, d = 0; d < hit->ndom; d++)
+        {
+          dom = &(hit->dcl[d]);
+          hitpack_varint (&p, (dom->is_reported ? p7_HITPACK_REPORTED : 0) |
+                              (dom->is_included ? p7_HITPACK_INCLUDED : 0) |
+                              (dom->ad != NULL  ? p7_HITPACK_HASALI   : 0));
+          hitpack_svarint(&p, (int64_t) dom->ienv - prv_ienv);
+          hitpack_svarint(&p, (int64_t) dom->jenv - dom->ienv);
+          hitpack_svarint(&p, (int64_t) dom->iali - dom->ienv);
+          hitpack_svarint(&p, (int64_t) dom->jali - dom->iali);
+          hitpack_svarint(&p, dom->iorf);
+          hitpack_svarint(&p, dom->jorf);
+          hitpack_float  (&p, dom->envsc);
+          hitpack_float  (&p, dom->domcorrection);
+          hitpack_float  (&p, dom->dombias);
+          hitpack_float  (&p, dom->oasc);
+          hitpack_float  (&p, dom->bitscore);
+          hitpack_double (&p, dom->lnP);
+          if (dom->ad != NULL) hitpack_alidisplay(&p, dom->ad);
+          prv_ienv = dom->ienv;
+        }
+    }
+  if ((status = p.status) != eslOK) goto ERROR;
+
+  for (i = 0; i < 8; i++) p.buf[5+i] = (p.n >> (8*i)) & 0xff;
+
+  esl_keyhash_Destroy(p.kh);
+  *ret_buf = p.buf;
+  *ret_n   = p.n;
+  return eslOK;
+
+ ERROR:
+  if (p.kh)  esl_keyhash_Destroy(p.kh);
+  if (p.buf) free(p.buf);
+  *ret_buf = NULL;
+  *ret_n   = 0;
+  return status;
+}
+
+
+/* Function:  p7_tophits_Unpack()
+ * Synopsis:  Unpack a hit list packed by <p7_tophits_Pack()>.
+ *
+ * Purpose:   Read the packed block at the start of buffer <buf> of
+ *            <n> bytes, and return it as a new hit list in <*ret_th>,
+ *            sorted in the order the hits were packed, with
+ *            <nreported> and <nincluded> counted from the hits'
+ *            flags. If <n> is 0, the size recorded in the block is
+ *            trusted, for callers given a buffer but not its size.
+ *            Optionally return the block's size in <*opt_nread>.
+ *
+ *            Alignment displays come back deserialized.
+ *
+ * Returns:   <eslOK> on success.
+ *            <eslEFORMAT> if <buf> doesn't start with a packed block
+ *            of a version we read, or the block is truncated or
+ *            corrupt; <*ret_th> is NULL.
+ *
+ * Throws:    <eslEMEM> on allocation failure; <*ret_th> is NULL.
+ */
+int
+p7_tophits_Unpack(const char *buf, uint64_t n, P7_TOPHITS **ret_th, uint64_t *opt_nread)
+{
+  P7_HITUNPACK u;
+  P7_TOPHITS  *th  = NULL;
+  P7_HIT      *hit = NULL;
+  P7_DOMAIN   *dom;
+  uint64_t     nhits, ndom;
+  uint64_t     size;
+  uint64_t     h;
+  uint32_t     dflags;
+  int          prv_ienv;
+  int          i, d;
+  int          status;
+
+  u.buf      = buf;
+  u.str      = NULL;
+  u.nstr     = 0;
+  u.stralloc = 0;
+  u.status   = eslOK;
+
+  /* header */
+  if (n != 0 && n < p7_HITPACK_HDRSIZE)                              { status = eslEFORMAT; goto ERROR; }
+  if (memcmp(buf, p7_HITPACK_MAGIC, 4) != 0)                         { status = eslEFORMAT; goto ERROR; }
+  if ((unsigned char) buf[4] != p7_HITPACK_VERSION)                  { status = eslEFORMAT; goto ERROR; }
+  for (size = 0, i = 7; i >= 0; i--) size = (size << 8) | (unsigned char) buf[5+i];
+  if (size < p7_HITPACK_HDRSIZE || (n != 0 && size > n))             { status = eslEFORMAT; goto ERROR; }
+  u.n   = size;
+  u.pos = p7_HITPACK_HDRSIZE;
+
+  nhits = hitunpack_varint(&u);
+  if (u.status != eslOK || nhits > u.n - u.pos)                      { status = eslEFORMAT; goto ERROR; }
+
+  if ((th = p7_tophits_Create()) == NULL) { status = eslEMEM; goto ERROR; }
+  for (h = 0; h < nhits && u.status == eslOK; h++)
+    {
+      if ((status = p7_tophits_CreateNextHit(th, &hit)) != eslOK) goto ERROR;
+
+      hitunpack_string(&u, &(hit->name));
+      hitunpack_string(&u, &(hit->acc));
+      hitunpack_string(&u, &(hit->desc));
+      hit->window_length = hitunpack_svarint(&u);
+      hit->sortkey       = hitunpack_double (&u);
+      hit->score         = hitunpack_float  (&u);
+      hit->pre_score     = hitunpack_float  (&u);
+      hit->sum_score     = hitunpack_float  (&u);
+      hit->lnP           = hitunpack_double (&u);
+      hit->pre_lnP       = hitunpack_double (&u);
+      hit->sum_lnP       = hitunpack_double (&u);
+      hit->nexpected     = hitunpack_float  (&u);
+      hit->nregions      = hitunpack_svarint(&u);
+      hit->nclustered    = hitunpack_svarint(&u);
+      hit->noverlaps     = hitunpack_svarint(&u);
+      hit->nenvelopes    = hitunpack_svarint(&u);
+      hit->flags         = hitunpack_varint (&u);
+      hit->nreported     = hitunpack_svarint(&u);
+      hit->nincluded     = hitunpack_svarint(&u);
+      hit->best_domain   = hitunpack_svarint(&u);
+      hit->seqidx        = hitunpack_svarint(&u);
+      hit->subseq_start  = hitunpack_svarint(&u);
+
+      ndom = hitunpack_varint(&u);
+      if (u.status != eslOK) break;
+      if (ndom > u.n - u.pos || ndom > INT_MAX) { u.status = eslEFORMAT; break; }
+
+      ESL_ALLOC(hit->dcl, sizeof(P7_DOMAIN) * ESL_MAX(1, ndom));
+      for (d = 0; d < ndom; d++)
+        {
+          hit->dcl[d].ad             = NULL;
+          hit->dcl[d].scores_per_pos = NULL;
+        }
+      hit->ndom = ndom;    /* only now, so p7_tophits_Destroy() sees initialized dcl's on error */
+
+      for (prv_ienv = 0, d = 0; d < hit->ndom; d++)
+        {
+          dom = &(hit->dcl[d]);
+          dflags             = hitunpack_varint (&u);
+          dom->is_reported   = (dflags & p7_HITPACK_REPORTED) ? TRUE : FALSE;
+          dom->is_included   = (dflags & p7_HITPACK_INCLUDED) ? TRUE : FALSE;
+          dom->ienv          = prv_ienv  + hitunpack_svarint(&u);
+          dom->jenv          = dom->ienv + hitunpack_svarint(&u);
+          dom->iali          = dom->ienv + hitunpack_svarint(&u);
+          dom->jali          = dom->iali + hitunpack_svarint(&u);
+          dom->iorf          = hitunpack_svarint(&u);
+          dom->jorf          = hitunpack_svarint(&u);
+          dom->envsc         = hitunpack_float  (&u);
+          dom->domcorrection = hitunpack_float  (&u);
+          dom->dombias       = hitunpack_float  (&u);
+          dom->oasc          = hitunpack_float  (&u);
+          dom->bitscore      = hitunpack_float  (&u);
+          dom->lnP           = hitunpack_double (&u);
+          if (dflags & p7_HITPACK_HASALI) hitunpack_alidisplay(&u, &(dom->ad));
+          prv_ienv = dom->ienv;
+        }
+
+      if (hit->flags & p7_IS_REPORTED) th->nreported++;
+      if (hit->flags & p7_IS_INCLUDED) th->nincluded++;
+    }
+  if ((status = u.status) != eslOK) goto ERROR;
+  p7_tophits_SortBySortkey(th);
+
+  for (i = 0; i < u.nstr; i++) free(u.str[i]);
+  if (u.str) free(u.str);
+  *ret_th = th;
+  if (opt_nread) *opt_nread = size;
+  return eslOK;
+
+ ERROR:
+  for (i = 0; i < u.nstr; i++) free(u.str[i]);
+  if (u.str) free(u.str);
+  if (th)    p7_tophits_Destroy(th);
+  *ret_th = NULL;
+  if (opt_nread) *opt_nread = 0;
+  return status;
+}
+/*------------------- end, packed serialization -----------------*/
+
+
+
 
 /*****************************************************************
- * 4. Benchmark driver
+ * 6. Benchmark driver
  *****************************************************************/
 #ifdef p7TOPHITS_BENCHMARK
 /* 
@@ -2098,7 +3472,7 @@ main(int argc, char **argv)
 
 
 /*****************************************************************
- * 5. Test driver
+ * 7. Test driver
  *****************************************************************/
 
 #ifdef p7TOPHITS_TESTDRIVE
@@ -2126,6 +3500,348 @@ static ESL_OPTIONS options[] = {
 static char usage[]  = "[-options]";
 static char banner[] = "test driver for P7_TOPHITS";
 
+/* Write a random hit list with p7_tophits_Binary() and read it back
+ * with p7_tophits_ReadBinary(): reported hits (and only those) must
+ * come back in the same order with the same values.
+ */
+static void
+utest_binary(ESL_RANDOMNESS *r, int N)
+{
+  char         msg[] = "binary hit output unit test failed";
+  FILE        *fp    = tmpfile();
+  P7_TOPHITS  *th    = p7_tophits_Create();
+  P7_TOPHITS  *th2   = NULL;
+  P7_HIT      *hit   = NULL;
+  P7_PIPELINE  pli, pli2;
+  char         name[32];
+  char        *qname = NULL;
+  char        *qacc  = NULL;
+  uint32_t     bad;
+  int          i, j, k, d;
+
+  if (fp == NULL || th == NULL) esl_fatal(msg);
+  memset(&pli,  0, sizeof(P7_PIPELINE));
+  memset(&pli2, 0, sizeof(P7_PIPELINE));
+  pli.mode = p7_SCAN_MODELS;
+  pli.Z    = 1234.;
+  pli.domZ = 56.;
+
+  for (i = 0; i < N; i++)
+    {
+      p7_tophits_CreateNextHit(th, &hit);
+      snprintf(name, 32, "target%d", i);
+      esl_strdup(name, -1, &(hit->name));
+      if (i % 2) esl_strdup("a description", -1, &(hit->desc));
+      hit->sortkey     = esl_random(r);
+      hit->score       = 100. * hit->sortkey;
+      hit->lnP         = -hit->score;
+      hit->flags       = (esl_random(r) < 0.7 ? p7_IS_REPORTED : 0);
+      hit->ndom        = 1 + esl_rnd_Roll(r, 3);
+      hit->best_domain = 0;
+      hit->dcl         = malloc(sizeof(P7_DOMAIN) * hit->ndom);
+      for (d = 0; d < hit->ndom; d++)
+        {
+          memset(&(hit->dcl[d]), 0, sizeof(P7_DOMAIN));
+          hit->dcl[d].bitscore    = hit->score / (d+1);
+          hit->dcl[d].ienv        = d * 100 + 1;
+          hit->dcl[d].jenv        = d * 100 + 90;
+          hit->dcl[d].is_reported = TRUE;
+          hit->dcl[d].ad          = calloc(1, sizeof(P7_ALIDISPLAY));
+          hit->dcl[d].ad->sqfrom  = d * 100 + 5;
+          hit->dcl[d].ad->sqto    = d * 100 + 85;
+          hit->dcl[d].ad->L       = 1000;
+        }
+    }
+  p7_tophits_SortBySortkey(th);
+
+  if (p7_tophits_Binary(fp, "query", NULL, th, &pli)                       != eslOK) esl_fatal(msg);
+  rewind(fp);
+  if (p7_tophits_ReadBinary(fp, &qname, &qacc, &th2, &pli2)                 != eslOK) esl_fatal(msg);
+  if (strcmp(qname, "query") != 0 || qacc != NULL)                                   esl_fatal(msg);
+  if (pli2.mode != pli.mode || pli2.Z != pli.Z || pli2.domZ != pli.domZ)             esl_fatal(msg);
+
+  for (j = 0, i = 0; i < th->N; i++)
+    {
+      if (! (th->hit[i]->flags & p7_IS_REPORTED)) continue;
+      if (j >= th2->N)                                              esl_fatal(msg);
+      if (strcmp(th->hit[i]->name, th2->hit[j]->name) != 0)         esl_fatal(msg);
+      if ((th->hit[i]->desc == NULL) != (th2->hit[j]->desc == NULL)) esl_fatal(msg);
+      if (th->hit[i]->score != th2->hit[j]->score)                  esl_fatal(msg);
+      if (th->hit[i]->ndom  != th2->hit[j]->ndom)                   esl_fatal(msg);
+      for (k = 0; k < th->hit[i]->ndom; k++)
+        if (th->hit[i]->dcl[k].ienv       != th2->hit[j]->dcl[k].ienv       ||
+            th->hit[i]->dcl[k].ad->sqto   != th2->hit[j]->dcl[k].ad->sqto   ||
+            th->hit[i]->dcl[k].bitscore   != th2->hit[j]->dcl[k].bitscore)  esl_fatal(msg);
+      j++;
+    }
+  if (j != th2->N) esl_fatal(msg);
+  p7_tophits_Destroy(th2);
+  free(qname);
+
+  if (p7_tophits_ReadBinary(fp, &qname, &qacc, &th2, &pli2) != eslEOF) esl_fatal(msg);
+
+  /* a string offset past the end of the string table must be rejected, not followed */
+  bad = UINT32_MAX - 1;
+  if (fseek(fp, offsetof(P7_HITBIN_HEADER, qname), SEEK_SET)    != 0)    esl_fatal(msg);
+  if (fwrite(&bad, sizeof(uint32_t), 1, fp)                     != 1)    esl_fatal(msg);
+  rewind(fp);
+  if (p7_tophits_ReadBinary(fp, &qname, &qacc, &th2, &pli2) != eslEFORMAT) esl_fatal(msg);
+
+  fclose(fp);
+  p7_tophits_Destroy(th);
+}
+
+/* Fill a bounded list and an unbounded one with the same random
+ * hits: the bounded one must hold exactly the unbounded one's top K,
+ * in the same order, both directly and after merging two bounded lists.
+ */
+static void
+utest_maxhits(ESL_RANDOMNESS *r, int N)
+{
+  char        msg[] = "bounded top hits unit test failed";
+  P7_TOPHITS *th    = p7_tophits_Create();
+  P7_TOPHITS *bh    = p7_tophits_Create();
+  P7_TOPHITS *bh2   = p7_tophits_Create();
+  P7_HIT     *hit   = NULL;
+  P7_HIT     *bhit  = NULL;
+  P7_PIPELINE pli;
+  int         K     = ESL_MAX(1, N/4);
+  char        name[32];
+  int         i;
+
+  memset(&pli, 0, sizeof(P7_PIPELINE));
+  pli.by_E       = FALSE;
+  pli.T          = 50.;
+  pli.inc_by_E   = FALSE;
+  pli.incT       = 75.;
+  pli.domZ_setby = p7_ZSETBY_NTARGETS;
+
+  if (p7_tophits_SetMaxHits(bh,  K) != eslOK) esl_fatal(msg);
+  if (p7_tophits_SetMaxHits(bh2, K) != eslOK) esl_fatal(msg);
+
+  for (i = 0; i < 2*N; i++)
+    {
+      p7_tophits_CreateNextHit(th, &hit);
+      p7_tophits_CreateNextHit((i < N ? bh : bh2), &bhit);
+      snprintf(name, 32, "target%d", i);
+      esl_strdup(name, -1, &(hit->name));
+      esl_strdup(name, -1, &(bhit->name));
+      hit->sortkey = bhit->sortkey = esl_random(r);
+      hit->score   = bhit->score   = 100. * hit->sortkey;
+      hit->lnP     = bhit->lnP     = -hit->score;
+      hit->ndom    = bhit->ndom    = 1;
+      hit->dcl     = calloc(1, sizeof(P7_DOMAIN));
+      bhit->dcl    = calloc(1, sizeof(P7_DOMAIN));
+      bhit->dcl[0].ad = calloc(1, sizeof(P7_ALIDISPLAY)); /* evictions must free these */
+    }
+  p7_tophits_SortBySortkey(bh);
+  if (bh->N != ESL_MIN(K, N))                                  esl_fatal(msg);
+  if (bh->nevicted + bh->N != N)                               esl_fatal(msg);
+  for (i = 1; i < bh->N; i++)
+    if (bh->hit[i]->sortkey > bh->hit[i-1]->sortkey)           esl_fatal(msg);
+
+  p7_tophits_Merge(bh, bh2);
+  p7_tophits_SortBySortkey(th);
+  if (bh->N != ESL_MIN(K, 2*N))                                esl_fatal(msg);
+  for (i = 0; i < bh->N; i++)
+    if (strcmp(bh->hit[i]->name, th->hit[i]->name) != 0)       esl_fatal(msg);
+
+  /* evicted hits still count toward the totals, and so toward domZ */
+  if (bh->nevicted + bh->N != 2*N)                             esl_fatal(msg);
+  p7_tophits_Threshold(th, &pli);
+  p7_tophits_Threshold(bh, &pli);
+  if (bh->nreported != th->nreported)                          esl_fatal(msg);
+  if (bh->nincluded != th->nincluded)                          esl_fatal(msg);
+  if (pli.domZ      != (double) th->nreported)                 esl_fatal(msg);
+
+  p7_tophits_Destroy(bh2);
+  p7_tophits_Destroy(bh);
+  p7_tophits_Destroy(th);
+}
+
+/* Split random hits between two lists, as two workers would, prune
+ * each to its top K reportable hits, and merge: the merged list must
+ * hold the top K of the thresholded whole, and the per-list counts
+ * must sum to the whole's reported and included totals.
+ */
+static void
+utest_prune(ESL_RANDOMNESS *r, int N)
+{
+  char         msg[] = "top hits pruning unit test failed";
+  P7_TOPHITS  *th    = p7_tophits_Create();
+  P7_TOPHITS  *ph1   = p7_tophits_Create();
+  P7_TOPHITS  *ph2   = p7_tophits_Create();
+  P7_HIT      *hit   = NULL;
+  P7_HIT      *phit  = NULL;
+  P7_PIPELINE  pli;
+  uint64_t     K     = ESL_MAX(1, N/8);
+  uint64_t     nrep1, ninc1, nrep2, ninc2;
+  char         name[32];
+  int          i;
+
+  memset(&pli, 0, sizeof(P7_PIPELINE));
+  pli.by_E       = FALSE;
+  pli.T          = 50.;
+  pli.inc_by_E   = FALSE;
+  pli.incT       = 75.;
+  pli.domZ_setby = p7_ZSETBY_NTARGETS;
+
+  for (i = 0; i < 2*N; i++)
+    {
+      p7_tophits_CreateNextHit(th, &hit);
+      p7_tophits_CreateNextHit((i % 2 ? ph1 : ph2), &phit);
+      snprintf(name, 32, "target%d", i);
+      esl_strdup(name, -1, &(hit->name));
+      esl_strdup(name, -1, &(phit->name));
+      hit->sortkey = phit->sortkey = esl_random(r);
+      hit->score   = phit->score   = 100. * hit->sortkey;
+      hit->lnP     = phit->lnP     = -hit->score;
+      hit->ndom    = phit->ndom    = 1;
+      hit->dcl     = calloc(1, sizeof(P7_DOMAIN));
+      phit->dcl    = calloc(1, sizeof(P7_DOMAIN));
+      phit->dcl[0].ad = calloc(1, sizeof(P7_ALIDISPLAY)); /* pruning must free these */
+    }
+
+  if (p7_tophits_Prune(ph1, &pli, K, &nrep1, &ninc1) != eslOK) esl_fatal(msg);
+  if (p7_tophits_Prune(ph2, &pli, K, &nrep2, &ninc2) != eslOK) esl_fatal(msg);
+  if (ph1->N > K || ph2->N > K)                                  esl_fatal(msg);
+  for (i = 0; i < ph1->N; i++)
+    if (ph1->hit[i]->score < pli.T)                              esl_fatal(msg);
+
+  p7_tophits_SortBySortkey(th);
+  p7_tophits_Threshold(th, &pli);
+  if (nrep1 + nrep2 != th->nreported)                            esl_fatal(msg);
+  if (ninc1 + ninc2 != th->nincluded)                            esl_fatal(msg);
+
+  p7_tophits_Merge(ph1, ph2);
+  for (i = 0; i < ESL_MIN(K, th->nreported); i++)
+    if (strcmp(ph1->hit[i]->name, th->hit[i]->name) != 0)        esl_fatal(msg);
+
+  p7_tophits_Destroy(ph1);
+  p7_tophits_Destroy(ph2);
+  p7_tophits_Destroy(th);
+}
+
+/* Pack a random hit list with p7_tophits_Pack() and unpack it with
+ * p7_tophits_Unpack(): every hit, domain, and alignment must come
+ * back intact and in the same order; truncated or mislabeled buffers
+ * must be rejected; and a limit on <nhits> must send only the top hits.
+ */
+static void
+utest_pack(ESL_RANDOMNESS *r, int N)
+{
+  char           msg[] = "packed hit list unit test failed";
+  P7_TOPHITS    *th    = p7_tophits_Create();
+  P7_TOPHITS    *th2   = NULL;
+  P7_HIT        *hit   = NULL;
+  P7_ALIDISPLAY *ad    = NULL;
+  char          *buf   = NULL;
+  uint64_t       n, nread;
+  char           name[32];
+  int            i, d, k;
+
+  for (i = 0; i < N; i++)
+    {
+      p7_tophits_CreateNextHit(th, &hit);
+      snprintf(name, 32, "%d", i);
+      esl_strdup(name, -1, &(hit->name));
+      if (i % 3) esl_strdup("a description", -1, &(hit->desc));
+      hit->sortkey     = esl_random(r);
+      hit->score       = 100. * hit->sortkey;
+      hit->lnP         = -hit->score;
+      hit->flags       = (esl_random(r) < 0.7 ? p7_IS_REPORTED : 0);
+      hit->seqidx      = i;
+      hit->ndom        = esl_rnd_Roll(r, 4);
+      hit->best_domain = (hit->ndom ? 0 : -1);
+      hit->dcl         = calloc(ESL_MAX(1, hit->ndom), sizeof(P7_DOMAIN));
+      for (d = 0; d < hit->ndom; d++)
+        {
+          hit->dcl[d].ienv        = 1 + esl_rnd_Roll(r, 10000);
+          hit->dcl[d].jenv        = hit->dcl[d].ienv + esl_rnd_Roll(r, 100);
+          hit->dcl[d].iali        = hit->dcl[d].ienv;
+          hit->dcl[d].jali        = hit->dcl[d].jenv;
+          hit->dcl[d].bitscore    = hit->score / (d+1);
+          hit->dcl[d].lnP         = hit->lnP;
+          hit->dcl[d].is_reported = TRUE;
+          hit->dcl[d].is_included = d % 2;
+          if (d == 2) continue;	/* exercise a domain without an alignment */
+
+          ad = hit->dcl[d].ad = calloc(1, sizeof(P7_ALIDISPLAY));
+          ad->N     = esl_rnd_Roll(r, 100);
+          ad->model = malloc(ad->N + 1);
+          ad->mline = malloc(ad->N + 1);
+          ad->aseq  = malloc(ad->N + 1);
+          for (k = 0; k < ad->N; k++)
+            {
+              ad->model[k] = 'a' + esl_rnd_Roll(r, 26);
+              ad->mline[k] = '+';
+              ad->aseq[k]  = 'A' + esl_rnd_Roll(r, 26);
+            }
+          ad->model[ad->N] = ad->mline[ad->N] = ad->aseq[ad->N] = '\0';
+          if (d == 1) esl_strdup(ad->mline, -1, &(ad->ppline));
+          esl_strdup("Pkinase",       -1, &(ad->hmmname));
+          esl_strdup("PF00069.1",     -1, &(ad->hmmacc));
+          esl_strdup("Protein kinase",-1, &(ad->hmmdesc));
+          esl_strdup(name,            -1, &(ad->sqname));
+          esl_strdup("",              -1, &(ad->sqacc));
+          esl_strdup("",              -1, &(ad->sqdesc));
+          ad->hmmfrom = 1;
+          ad->hmmto   = ad->N;
+          ad->M       = 250;
+          ad->sqfrom  = hit->dcl[d].iali;
+          ad->sqto    = hit->dcl[d].jali;
+          ad->L       = 20000;
+        }
+    }
+
+  if (p7_tophits_Pack(th, 0, &buf, &n)             != eslOK) esl_fatal(msg);
+  if (p7_tophits_Unpack(buf, n, &th2, &nread)      != eslOK) esl_fatal(msg);
+  if (nread != n || th2->N != th->N)                         esl_fatal(msg);
+  for (i = 0; i < th->N; i++)
+    {
+      if (strcmp(th->hit[i]->name, th2->hit[i]->name) != 0)          esl_fatal(msg);
+      if (esl_strcmp(th->hit[i]->desc, th2->hit[i]->desc) != eslOK)  esl_fatal(msg);
+      if (th->hit[i]->sortkey     != th2->hit[i]->sortkey)           esl_fatal(msg);
+      if (th->hit[i]->score       != th2->hit[i]->score)             esl_fatal(msg);
+      if (th->hit[i]->lnP         != th2->hit[i]->lnP)               esl_fatal(msg);
+      if (th->hit[i]->flags       != th2->hit[i]->flags)             esl_fatal(msg);
+      if (th->hit[i]->seqidx      != th2->hit[i]->seqidx)            esl_fatal(msg);
+      if (th->hit[i]->best_domain != th2->hit[i]->best_domain)       esl_fatal(msg);
+      if (th->hit[i]->ndom        != th2->hit[i]->ndom)              esl_fatal(msg);
+      for (d = 0; d < th->hit[i]->ndom; d++)
+        {
+          if (th->hit[i]->dcl[d].ienv        != th2->hit[i]->dcl[d].ienv)        esl_fatal(msg);
+          if (th->hit[i]->dcl[d].jali        != th2->hit[i]->dcl[d].jali)        esl_fatal(msg);
+          if (th->hit[i]->dcl[d].bitscore    != th2->hit[i]->dcl[d].bitscore)    esl_fatal(msg);
+          if (th->hit[i]->dcl[d].is_included != th2->hit[i]->dcl[d].is_included) esl_fatal(msg);
+          if ((th->hit[i]->dcl[d].ad == NULL) != (th2->hit[i]->dcl[d].ad == NULL)) esl_fatal(msg);
+          if (th->hit[i]->dcl[d].ad &&
+              p7_alidisplay_Compare(th->hit[i]->dcl[d].ad, th2->hit[i]->dcl[d].ad) != eslOK) esl_fatal(msg);
+        }
+    }
+  p7_tophits_Destroy(th2);
+
+  /* the header's own size is trusted when no size is given */
+  if (p7_tophits_Unpack(buf, 0, &th2, &nread) != eslOK || nread != n) esl_fatal(msg);
+  p7_tophits_Destroy(th2);
+
+  /* short buffers and unknown versions are format errors */
+  if (p7_tophits_Unpack(buf, n-1, &th2, NULL) != eslEFORMAT) esl_fatal(msg);
+  buf[4]++;
+  if (p7_tophits_Unpack(buf, n,   &th2, NULL) != eslEFORMAT) esl_fatal(msg);
+  free(buf);
+
+  if (p7_tophits_Pack(th, 1 + N/4, &buf, &n)       != eslOK) esl_fatal(msg);
+  if (p7_tophits_Unpack(buf, n, &th2, NULL)        != eslOK) esl_fatal(msg);
+  if (th2->N != 1 + N/4)                                     esl_fatal(msg);
+  for (i = 0; i < th2->N; i++)
+    if (strcmp(th->hit[i]->name, th2->hit[i]->name) != 0)    esl_fatal(msg);
+
+  free(buf);
+  p7_tophits_Destroy(th2);
+  p7_tophits_Destroy(th);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -2171,6 +3887,11 @@ main(int argc, char **argv)
   
   if (p7_tophits_GetMaxNameLength(h3) != strlen(name)) esl_fatal("GetMaxNameLength() failed");
 
+  utest_binary(r, N);
+  utest_maxhits(r, N);
+  utest_prune(r, N);
+  utest_pack(r, N);
+
   p7_tophits_Destroy(h1);
   p7_tophits_Destroy(h2);
   p7_tophits_Destroy(h3);
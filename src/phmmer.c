@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "easel.h"
 #include "esl_alphabet.h"
@@ -24,6 +25,7 @@
 
 #ifdef HMMER_THREADS
 #include <unistd.h>
+#include <pthread.h>
 #include "esl_threads.h"
 #include "esl_workqueue.h"
 #endif /*HMMER_THREADS*/
@@ -31,15 +33,44 @@
 #include "hmmer.h"
 
 typedef struct {
-#ifdef HMMER_THREADS
-  ESL_WORK_QUEUE   *queue;
-#endif /*HMMER_THREADS*/
   P7_BG            *bg;
   P7_PIPELINE      *pli;
   P7_TOPHITS       *th;
   P7_OPROFILE      *om;
+  FM_CFG           *fm_cfg;      /* global data for FM-index target (--tformat hmmerdb) */
+  P7_SCOREDATA     *scoredata;   /* SSV scores for FM seed finding/extension */
 } WORKER_INFO;
 
+/* One query, from setup until its results are output. Worker <i>
+ * searches with its own info[i]. As in hmmsearch, the worker threads
+ * persist across queries, and the next query's blocks are queued
+ * while the last blocks of this one are still being searched.
+ */
+typedef struct {
+  ESL_SQ           *qsq;         /* query sequence                          */
+  int               idx;         /* index of query in <seqfile>, 1..nquery  */
+  WORKER_INFO      *info;        /* per-worker search state, [0..ninfo-1]   */
+  int               ninfo;
+  P7_SCOREDATA     *scoredata;   /* SSV scores for FM seeds, or NULL        */
+  ESL_STOPWATCH    *w;           /* timing from setup to output             */
+#ifdef HMMER_THREADS
+  int               nleft;       /* # of blocks queued and not yet searched */
+  int               queued_all;  /* TRUE once all the query's blocks are queued */
+  pthread_mutex_t   mutex;       /* protects <nleft>, <queued_all>          */
+  pthread_cond_t    done;        /* signaled when the last block is searched */
+#endif /*HMMER_THREADS*/
+} QUERY_INFO;
+
+#ifdef HMMER_THREADS
+/* A block of target sequences, and the query to search them with.
+ * q == NULL tells a worker to exit.
+ */
+typedef struct {
+  ESL_SQ_BLOCK     *block;
+  QUERY_INFO       *q;
+} WORK_ITEM;
+#endif /*HMMER_THREADS*/
+
 #define REPOPTS     "-E,-T,--cut_ga,--cut_nc,--cut_tc"
 #define DOMREPOPTS  "--domE,--domT,--cut_ga,--cut_nc,--cut_tc"
 #define INCOPTS     "--incE,--incT,--cut_ga,--cut_nc,--cut_tc"
@@ -71,6 +102,7 @@ static ESL_OPTIONS options[] = {
   { "--pfamtblout", eslARG_OUTFILE,      NULL, NULL, NULL,      NULL,  NULL,  NULL,              "save table of hits and domains to file, in Pfam format <f>",   2 },
   { "--acc",        eslARG_NONE,        FALSE, NULL, NULL,      NULL,  NULL,  NULL,              "prefer accessions over names in output",                       2 },
   { "--noali",      eslARG_NONE,        FALSE, NULL, NULL,      NULL,  NULL,  NULL,              "don't output alignments, so output is smaller",                2 },
+  { "--max-hits",   eslARG_INT,         FALSE, NULL, "n>0",     NULL,  NULL,  NULL,              "keep only the <n> top-ranked targets per query (bounds memory)", 2 },
   { "--notextw",    eslARG_NONE,         NULL, NULL, NULL,      NULL,  NULL, "--textw",          "unlimit ASCII text output line width",                         2 },
   { "--textw",      eslARG_INT,         "120", NULL, "n>=120",  NULL,  NULL, "--notextw",        "set max width of ASCII text output lines",                     2 },
 /* Control of scoring system */
@@ -98,6 +130,17 @@ static ESL_OPTIONS options[] = {
   { "--F2",         eslARG_REAL,       "1e-3", NULL, NULL,      NULL,  NULL, "--max",            "Stage 2 (Vit) threshold: promote hits w/ P <= F2",             7 },
   { "--F3",         eslARG_REAL,       "1e-5", NULL, NULL,      NULL,  NULL, "--max",            "Stage 3 (Fwd) threshold: promote hits w/ P <= F3",             7 },
   { "--nobias",     eslARG_NONE,        NULL,  NULL, NULL,      NULL,  NULL, "--max",            "turn off composition bias filter",                             7 },
+#if defined (p7_IMPL_SSE)
+/* Control of FM seed prefilter (only used with --tformat hmmerdb) */
+  { "--seed_max_depth",    eslARG_INT,          "15", NULL, NULL,    NULL,  NULL, NULL,            "seed length at which bit threshold must be met",               9 },
+  { "--seed_sc_thresh",    eslARG_REAL,         "15", NULL, NULL,    NULL,  NULL, NULL,            "Default req. score for FM seed (bits)",                        9 },
+  { "--seed_sc_density",   eslARG_REAL,        "0.8", NULL, NULL,    NULL,  NULL, NULL,            "seed must maintain this bit density from one of two ends",     9 },
+  { "--seed_drop_max_len", eslARG_INT,           "4", NULL, NULL,    NULL,  NULL, NULL,            "maximum run length with score under (max - [fm_drop_lim])",    9 },
+  { "--seed_drop_lim",     eslARG_REAL,        "0.3", NULL, NULL,    NULL,  NULL, NULL,            "in seed, max drop in a run of length [fm_drop_max_len]",       9 },
+  { "--seed_req_pos",      eslARG_INT,           "5", NULL, NULL,    NULL,  NULL, NULL,            "minimum number consecutive positive scores in seed" ,          9 },
+  { "--seed_consens_match", eslARG_INT,         "11", NULL, NULL,    NULL,  NULL, NULL,            "<n> consecutive matches to consensus will override score threshold" , 9 },
+  { "--seed_ssv_length",   eslARG_INT,          "70", NULL, NULL,    NULL,  NULL, NULL,            "length of window around FM seed to get full SSV diagonal",     9 },
+#endif
 /* Control of E-value calibration */
   { "--EmL",        eslARG_INT,         "200", NULL,"n>0",      NULL,  NULL,  NULL,              "length of sequences for MSV Gumbel mu fit",                   11 },   
   { "--EmN",        eslARG_INT,         "200", NULL,"n>0",      NULL,  NULL,  NULL,              "number of sequences for MSV Gumbel mu fit",                   11 },   
@@ -156,10 +199,17 @@ struct cfg_s {
 
 static int  serial_master(ESL_GETOPTS *go, struct cfg_s *cfg);
 static int  serial_loop  (WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs);
+#if defined (p7_IMPL_SSE)
+static int  serial_loop_FM(WORKER_INFO *info);
+#endif
+static QUERY_INFO *new_query(ESL_GETOPTS *go, P7_BUILDER *bld, const P7_BG *bg, ESL_SQ *qsq, int idx, int ninfo, int dbformat, FM_CFG *fm_cfg);
+static int  output_query(ESL_GETOPTS *go, QUERY_INFO *q, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, int textw);
+static void free_query  (QUERY_INFO *q);
 #ifdef HMMER_THREADS
 #define BLOCK_SIZE 1000
 
-static int  thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs);
+static int  thread_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQFILE *dbfp, int n_targetseqs, QUERY_INFO *q);
+static void thread_stop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held);
 static void pipeline_thread(void *arg);
 #endif /*HMMER_THREADS*/
 
@@ -205,6 +255,11 @@ process_commandline(int argc, char **argv, ESL_GETOPTS **ret_go, char **ret_qfil
       if (puts("\nOptions controlling acceleration heuristics:")             < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed");
       esl_opt_DisplayHelp(stdout, go, 7, 2, 80); 
 
+#if defined (p7_IMPL_SSE)
+      if (puts("\nOptions controlling FM-index seed search (--tformat hmmerdb):") < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed");
+      esl_opt_DisplayHelp(stdout, go, 9, 2, 80);
+#endif
+
       if (puts("\nOptions controlling E value calibration:")                 < 0) ESL_XEXCEPTION_SYS(eslEWRITE, "write failed");
       esl_opt_DisplayHelp(stdout, go, 11, 2, 80); 
 
@@ -252,6 +307,7 @@ output_header(FILE *ofp, ESL_GETOPTS *go, char *qfile, char *dbfile)
   if (esl_opt_IsUsed(go, "--pfamtblout")&& fprintf(ofp, "# pfam-style tabular hit output:   %s\n",             esl_opt_GetString(go, "--pfamtblout")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--acc")       && fprintf(ofp, "# prefer accessions over names:    yes\n")                                                  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--noali")     && fprintf(ofp, "# show alignments in output:       no\n")                                                   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (esl_opt_IsUsed(go, "--max-hits")   && fprintf(ofp, "# max hits kept per query:         %d\n",             esl_opt_GetInteger(go, "--max-hits"))   < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--notextw")   && fprintf(ofp, "# max ASCII text line length:      unlimited\n")                                            < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
   if (esl_opt_IsUsed(go, "--textw")     && fprintf(ofp, "# max ASCII text line length:      %d\n",             esl_opt_GetInteger(go, "--textw"))    < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
   if (esl_opt_IsUsed(go, "--popen")     && fprintf(ofp, "# gap open probability:            %f\n",             esl_opt_GetReal  (go, "--popen"))     < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
@@ -403,10 +459,15 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   ESL_SQ          *qsq      = NULL;               /* query sequence                                   */
   int              dbformat = eslSQFILE_UNKNOWN;  /* format of dbfile                                 */
   ESL_SQFILE      *dbfp     = NULL;               /* open dbfile                                      */
+  FM_CFG          *fm_cfg   = NULL;               /* FM-index config, if dbfile is --tformat hmmerdb  */
+  FM_METADATA     *fm_meta  = NULL;
+  fpos_t           fm_basepos;
   ESL_ALPHABET    *abc      = NULL;               /* sequence alphabet                                */
   P7_BG           *bg       = NULL;		  /* null model (copies made of this into threads)    */
   P7_BUILDER      *bld      = NULL;               /* HMM construction configuration                   */
-  ESL_STOPWATCH   *w        = NULL;               /* for timing                                       */
+  QUERY_INFO      *q        = NULL;               /* query being set up and searched                  */
+  QUERY_INFO      *prev     = NULL;               /* previous query, awaiting output                  */
+  int              overlap  = FALSE;              /* TRUE to queue the next query before output       */
   int              nquery   = 0;
   int              seed;
   int              textw;
@@ -416,16 +477,15 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   int              i;
   int              ncpus    = 0;
   int              infocnt  = 0;
-  WORKER_INFO     *info     = NULL;
 #ifdef HMMER_THREADS
-  ESL_SQ_BLOCK    *block    = NULL;
+  WORK_ITEM       *item     = NULL;
+  WORK_ITEM       *held     = NULL;               /* the reader's empty work item                     */
   ESL_THREADS     *threadObj= NULL;
   ESL_WORK_QUEUE  *queue    = NULL;
 #endif
 
   /* Initializations */
   abc     = esl_alphabet_Create(eslAMINO);
-  w       = esl_stopwatch_Create();
   textw   = (esl_opt_GetBoolean(go, "--notextw") ? 0 : esl_opt_GetInteger(go, "--textw"));
   bg      = p7_bg_Create(abc);
 
@@ -479,19 +539,51 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (esl_opt_IsOn(go, "--domtblout")) { if ((domtblfp = fopen(esl_opt_GetString(go, "--domtblout"), "w")) == NULL)  p7_Fail("Failed to open tabular per-dom output file %s for writing\n", esl_opt_GetString(go, "--domtblfp")); }
   if (esl_opt_IsOn(go, "--pfamtblout")){ if ((pfamtblfp = fopen(esl_opt_GetString(go, "--pfamtblout"), "w")) == NULL)  esl_fatal("Failed to open pfam-style tabular output file %s for writing\n", esl_opt_GetString(go, "--pfamtblout")); }
 
-  /* Open the target sequence database for sequential access. */
-  status =  esl_sqfile_OpenDigital(abc, cfg->dbfile, dbformat, p7_SEQDBENV, &dbfp);
-  if      (status == eslENOTFOUND) p7_Fail("Failed to open target sequence database %s for reading\n",      cfg->dbfile);
-  else if (status == eslEFORMAT)   p7_Fail("Target sequence database file %s is empty or misformatted\n",   cfg->dbfile);
-  else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
-  else if (status != eslOK)        p7_Fail("Unexpected error %d opening target sequence database file %s\n", status, cfg->dbfile);
+  if (dbformat == eslSQFILE_FMINDEX) {
+#if !defined (p7_IMPL_SSE)
+    p7_Fail("%s is a valid sequence database file format only on systems supporting SSE vector instructions\n", esl_opt_GetString(go, "--tformat"));
+#else
+    /* As in nhmmer, the FM-index is read through its own path, not esl_sqfile_Open() */
+    if (esl_opt_IsOn(go, "--max"))
+      p7_Fail("--max flag is incompatible with the FMINDEX target type\n");
+    if (esl_opt_IsUsed(go, "--restrictdb_stkey") || esl_opt_IsUsed(go, "--restrictdb_n"))
+      p7_Fail("--restrictdb_x options are incompatible with the FMINDEX target type\n");
 
+    fm_configAlloc(&fm_cfg);
+    fm_meta = fm_cfg->meta;
 
-  if (esl_opt_IsUsed(go, "--restrictdb_stkey") || esl_opt_IsUsed(go, "--restrictdb_n")) {
-    if (esl_opt_IsUsed(go, "--ssifile"))
-      esl_sqfile_OpenSSI(dbfp, esl_opt_GetString(go, "--ssifile"));
-    else
-      esl_sqfile_OpenSSI(dbfp, NULL);
+    if((fm_meta->fp = fopen(cfg->dbfile, "rb")) == NULL)
+      p7_Fail("Failed to open target sequence database %s for reading\n",      cfg->dbfile);
+
+    if ( (status = fm_readFMmeta(fm_meta)) != eslOK)
+      p7_Fail("Failed to read FM meta data from target sequence database %s\n",      cfg->dbfile);
+
+    if ( fm_meta->alph_type != fm_AMINO)
+      p7_Fail("Target sequence database %s is not a protein FM-index\n",      cfg->dbfile);
+
+    if ( (status = fm_configInit(fm_cfg, go)) != eslOK)
+      p7_Fail("Failed to initialize FM configuration for target sequence database %s\n",      cfg->dbfile);
+
+    if ( (status = fm_alphabetCreate(fm_meta, NULL)) != eslOK)
+      p7_Fail("Failed to create FM alphabet for target sequence database %s\n",      cfg->dbfile);
+
+    fgetpos( fm_meta->fp, &fm_basepos);
+#endif
+  } else {
+    /* Open the target sequence database for sequential access. */
+    status =  esl_sqfile_OpenDigital(abc, cfg->dbfile, dbformat, p7_SEQDBENV, &dbfp);
+    if      (status == eslENOTFOUND) p7_Fail("Failed to open target sequence database %s for reading\n",      cfg->dbfile);
+    else if (status == eslEFORMAT)   p7_Fail("Target sequence database file %s is empty or misformatted\n",   cfg->dbfile);
+    else if (status == eslEINVAL)    p7_Fail("Can't autodetect format of a stdin or .gz seqfile");
+    else if (status != eslOK)        p7_Fail("Unexpected error %d opening target sequence database file %s\n", status, cfg->dbfile);
+
+
+    if (esl_opt_IsUsed(go, "--restrictdb_stkey") || esl_opt_IsUsed(go, "--restrictdb_n")) {
+      if (esl_opt_IsUsed(go, "--ssifile"))
+        esl_sqfile_OpenSSI(dbfp, esl_opt_GetString(go, "--ssifile"));
+      else
+        esl_sqfile_OpenSSI(dbfp, NULL);
+    }
   }
 
 
@@ -508,6 +600,8 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (esl_opt_IsOn(go, "--cpu")) ncpus = esl_opt_GetInteger(go, "--cpu");
   else                           esl_threads_CPUCount(&ncpus);
 
+  if (dbformat == eslSQFILE_FMINDEX) ncpus = 0; /* FM-index blocks are searched serially */
+
   if (ncpus > 0)
     {
       threadObj = esl_threads_Create(&pipeline_thread);
@@ -516,51 +610,56 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 #endif
 
   infocnt = (ncpus == 0) ? 1 : ncpus;
-  ESL_ALLOC(info, sizeof(*info) * infocnt);
+
+  /* A daemon's client waits for each result before sending the next
+   * query, so results can't be held back for the next query to be read.
+   */
+  overlap = (ncpus > 0 && qformat != eslSQFILE_DAEMON);
 
   /* Show header output */
   output_header(ofp, go, cfg->qfile, cfg->dbfile);
 
-  for (i = 0; i < infocnt; ++i)
-    {
-      info[i].pli   = NULL;
-      info[i].th    = NULL;
-      info[i].om    = NULL;
-      info[i].bg    = p7_bg_Clone(bg);
-#ifdef HMMER_THREADS
-      info[i].queue = queue;
-#endif
-    }
-
 #ifdef HMMER_THREADS
-  for (i = 0; i < ncpus * 2; ++i)
+  /* The worker threads are started once, and serve all the queries */
+  if (ncpus > 0)
     {
-      block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
-      if (block == NULL) 
+      for (i = 0; i < ncpus * 2; ++i)
 	{
-	  p7_Fail("Failed to allocate sequence block");
-	}
+	  ESL_ALLOC(item, sizeof(WORK_ITEM));
+	  item->q     = NULL;
+	  item->block = esl_sq_CreateDigitalBlock(BLOCK_SIZE, abc);
+	  if (item->block == NULL) 
+	    {
+	      p7_Fail("Failed to allocate sequence block");
+	    }
 
-      status = esl_workqueue_Init(queue, block);
-      if (status != eslOK) 
-	{
-	  p7_Fail("Failed to add block to work queue");
+	  status = esl_workqueue_Init(queue, item);
+	  if (status != eslOK) 
+	    {
+	      p7_Fail("Failed to add block to work queue");
+	    }
 	}
+
+      for (i = 0; i < ncpus; ++i) esl_threads_AddThread(threadObj, queue);
+      esl_threads_WaitForStart(threadObj);
+
+      status = esl_workqueue_ReaderUpdate(queue, NULL, (void **) &held);
+      if (status != eslOK) p7_Fail("Work queue reader failed");
     }
 #endif
 
   /* Outer loop over sequence queries */
   while ((qstatus = esl_sqio_Read(qfp, qsq)) == eslOK)
     {
-      P7_OPROFILE     *om       = NULL;           /* optimized query profile                  */
-
       nquery++;
       if (qsq->n == 0) continue; /* skip zero length seqs as if they aren't even present */
 
-      esl_stopwatch_Start(w);
-
       /* seqfile may need to be rewound (multiquery mode) */
-      if (nquery > 1)
+      if (nquery > 1 && dbformat == eslSQFILE_FMINDEX)
+      {
+        if (fsetpos(fm_meta->fp, &fm_basepos) != 0)  ESL_EXCEPTION(eslESYS, "rewind via fsetpos() failed");
+      }
+      else if (nquery > 1)
       {
         if (! esl_sqfile_IsRewindable(dbfp)) p7_Fail("Target sequence file %s isn't rewindable; can't search it with multiple queries", cfg->dbfile);
 
@@ -574,33 +673,19 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
           p7_Fail("Failure setting restrictdb_stkey to %d\n", cfg->firstseq_key);
       }
 
+      q   = new_query(go, bld, bg, qsq, nquery, infocnt, dbformat, fm_cfg);
+      qsq = esl_sq_CreateDigital(abc); /* <q> owns the query now */
 
-      if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->acc[0]  != '\0' && fprintf(ofp, "Accession:   %s\n", qsq->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      if (qsq->desc[0] != '\0' && fprintf(ofp, "Description: %s\n", qsq->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
-
-
-      /* Build the model */
-      p7_SingleBuilder(bld, qsq, info[0].bg, NULL, NULL, NULL, &om); /* bypass HMM - only need model */
-
-      for (i = 0; i < infocnt; ++i)
-      {
-        /* Create processing pipeline and hit list */
-        info[i].th  = p7_tophits_Create();
-        info[i].om  = p7_oprofile_Clone(om);
-        info[i].pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
-        p7_pli_NewModel(info[i].pli, info[i].om, info[i].bg);
-
-#ifdef HMMER_THREADS
-        if (ncpus > 0) esl_threads_AddThread(threadObj, &info[i]);
+#if defined (p7_IMPL_SSE)
+      if (dbformat == eslSQFILE_FMINDEX)
+        sstatus = serial_loop_FM(q->info);
+      else
 #endif
-      }
-
 #ifdef HMMER_THREADS
-      if (ncpus > 0) sstatus = thread_loop(threadObj, queue, dbfp, cfg->n_targetseq);
-      else           sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      if (ncpus > 0) sstatus = thread_loop(queue, &held, dbfp, cfg->n_targetseq, q);
+      else           sstatus = serial_loop(q->info, dbfp, cfg->n_targetseq);
 #else
-      sstatus = serial_loop(info, dbfp, cfg->n_targetseq);
+      sstatus = serial_loop(q->info, dbfp, cfg->n_targetseq);
 #endif
       switch(sstatus)
       {
@@ -609,67 +694,41 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
             dbfp->filename, esl_sqfile_GetErrorBuf(dbfp));
         break;
       case eslEOF:
+      case eslOK:
         /* do nothing */
         break;
       default:
         p7_Fail("Unexpected error %d reading sequence file %s",
-            sstatus, dbfp->filename);
+            sstatus, cfg->dbfile);
       }
 
-
-      /* merge the results of the search results */
-      for (i = 1; i < infocnt; ++i)
-      {
-        p7_tophits_Merge(info[0].th, info[i].th);
-        p7_pipeline_Merge(info[0].pli, info[i].pli);
-
-        p7_pipeline_Destroy(info[i].pli);
-        p7_tophits_Destroy(info[i].th);
-        p7_oprofile_Destroy(info[i].om);
+      /* With worker threads, <q> is still being searched. The previous
+       * query has finished (or is finishing) meanwhile: output it now,
+       * so results come out in query order.
+       */
+      if (prev != NULL) {
+        if ((status = output_query(go, prev, ofp, afp, tblfp, domtblfp, pfamtblfp, textw)) != eslOK) goto ERROR;
+        free_query(prev);
+        prev = NULL;
       }
-
-      /* Print the results.  */
-      p7_tophits_SortBySortkey(info->th);
-      p7_tophits_Threshold(info->th, info->pli);
-      p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-  
-      if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->th, info->pli, (nquery == 1));
-      if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->th, info->pli);
-
-      esl_stopwatch_Stop(w);
-      p7_pli_Statistics(ofp, info->pli, w);
-      if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-      fflush(ofp);
-
-      /* Output the results in an MSA (-A option) */
-      if (afp) {
-	ESL_MSA *msa = NULL;
-
-	if ( p7_tophits_Alignment(info->th, abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK) 
-	  {
-	    if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
-	    else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
-
-	    if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-	  }
-	else if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
-	  
-	esl_msa_Destroy(msa);
+      if (overlap) prev = q;
+      else {
+        if ((status = output_query(go, q, ofp, afp, tblfp, domtblfp, pfamtblfp, textw)) != eslOK) goto ERROR;
+        free_query(q);
       }
-
-      p7_tophits_Destroy(info->th);
-      p7_pipeline_Destroy(info->pli);
-      p7_oprofile_Destroy(info->om);
-      p7_oprofile_Destroy(om);
-      esl_sq_Reuse(qsq);
+      q = NULL;
     } /* end outer loop over query sequences */
   if      (qstatus == eslEFORMAT) p7_Fail("Parse failed (sequence file %s):\n%s\n",
 					    qfp->filename, esl_sqfile_GetErrorBuf(qfp));
   else if (qstatus != eslEOF)     p7_Fail("Unexpected error %d reading sequence file %s",
 					    qstatus, qfp->filename);
 
+  if (prev != NULL) {
+    if ((status = output_query(go, prev, ofp, afp, tblfp, domtblfp, pfamtblfp, textw)) != eslOK) goto ERROR;
+    free_query(prev);
+    prev = NULL;
+  }
+
 
   /* Terminate outputs - any last words?
    */
@@ -680,29 +739,33 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
   /* Cleanup - prepare for successful exit
    */
-  for (i = 0; i < infocnt; ++i)
-    p7_bg_Destroy(info[i].bg);
-
 #ifdef HMMER_THREADS
   if (ncpus > 0)
     {
+      if (held != NULL) thread_stop(threadObj, queue, held);
       esl_workqueue_Reset(queue);
-      while (esl_workqueue_Remove(queue, (void **) &block) == eslOK)
-	esl_sq_DestroyBlock(block);
+      while (esl_workqueue_Remove(queue, (void **) &item) == eslOK)
+	{
+	  esl_sq_DestroyBlock(item->block);
+	  free(item);
+	}
       esl_workqueue_Destroy(queue);
       esl_threads_Destroy(threadObj);
     }
 #endif
 
-  free(info);
-  esl_sqfile_Close(dbfp);
+  if (dbfp) esl_sqfile_Close(dbfp);
   esl_sqfile_Close(qfp);
-  esl_stopwatch_Destroy(w);
   esl_sq_Destroy(qsq);
   p7_bg_Destroy(bg);
   p7_builder_Destroy(bld);
   esl_alphabet_Destroy(abc);
 
+  if (fm_cfg) {
+    fclose(fm_meta->fp);
+    fm_configDestroy(fm_cfg); // will cascade to destroy meta and alphabet, too
+  }
+
   if (ofp      != stdout) fclose(ofp);
   if (afp      != NULL)   fclose(afp);
   if (tblfp    != NULL)   fclose(tblfp);
@@ -714,6 +777,178 @@ serial_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   return status;
 }
 
+/* new_query()
+ * Set up the search of query sequence <qsq>, which the new QUERY_INFO
+ * takes ownership of: build its profile with <bld>, and create the
+ * null models, pipelines, hit lists and profile copies for <ninfo>
+ * workers. <idx> is the query's index in <seqfile>, 1..nquery. Errors
+ * are fatal.
+ */
+static QUERY_INFO *
+new_query(ESL_GETOPTS *go, P7_BUILDER *bld, const P7_BG *bg, ESL_SQ *qsq, int idx, int ninfo, int dbformat, FM_CFG *fm_cfg)
+{
+  QUERY_INFO  *q  = NULL;
+  P7_OPROFILE *om = NULL;           /* optimized query profile                  */
+  P7_PROFILE  *gm = NULL;           /* generic profile; only kept for FM seeds  */
+  int          i;
+  int          status;
+
+  ESL_ALLOC(q, sizeof(QUERY_INFO));
+  q->qsq       = qsq;
+  q->idx       = idx;
+  q->ninfo     = ninfo;
+  q->scoredata = NULL;
+  q->w         = esl_stopwatch_Create();
+  ESL_ALLOC(q->info, sizeof(WORKER_INFO) * ninfo);
+  esl_stopwatch_Start(q->w);
+
+  for (i = 0; i < ninfo; ++i)
+    q->info[i].bg = p7_bg_Clone(bg);
+
+  /* Build the model */
+#if defined (p7_IMPL_SSE)
+  if (dbformat == eslSQFILE_FMINDEX) {
+    /* FM seeds need the generic profile too; seed score threshold scaled by score density, as in nhmmer */
+    float best_sc_avg = 0;
+    int k, j;
+
+    p7_SingleBuilder(bld, qsq, q->info[0].bg, NULL, NULL, &gm, &om);
+
+    for (k = 1; k <= om->M; k++) {
+      float max_score = 0;
+      for (j=0; j<qsq->abc->K; j++)
+        if (gm->rsc[j][k * p7P_NR + p7P_MSC] > max_score) max_score = gm->rsc[j][k * p7P_NR + p7P_MSC];
+      best_sc_avg += max_score;
+    }
+    best_sc_avg /= sqrt((double) om->M);
+    best_sc_avg  = ESL_MAX(5.0, best_sc_avg);
+
+    fm_cfg->sc_thresh_ratio = ESL_MIN(best_sc_avg/7.0, 1.0);
+    q->scoredata = p7_hmm_ScoreDataCreate(om, gm);
+  }
+  else
+#endif
+    p7_SingleBuilder(bld, qsq, q->info[0].bg, NULL, NULL, NULL, &om); /* bypass HMM - only need model */
+
+  for (i = 0; i < ninfo; ++i)
+    {
+      /* Create processing pipeline and hit list */
+      q->info[i].th  = p7_tophits_Create();
+      if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(q->info[i].th, esl_opt_GetInteger(go, "--max-hits"));
+      q->info[i].om  = p7_oprofile_Clone(om);
+      q->info[i].pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+      if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A")) q->info[i].pli->ddef->do_alidisplay = FALSE;
+      p7_pli_NewModel(q->info[i].pli, q->info[i].om, q->info[i].bg);
+      q->info[i].fm_cfg    = fm_cfg;
+      q->info[i].scoredata = q->scoredata;
+    }
+
+#ifdef HMMER_THREADS
+  q->nleft      = 0;
+  q->queued_all = FALSE;
+  if (pthread_mutex_init(&q->mutex, NULL) != 0) p7_Fail("mutex init failed");
+  if (pthread_cond_init (&q->done,  NULL) != 0) p7_Fail("cond init failed");
+#endif
+
+  p7_oprofile_Destroy(om);
+  if (gm) p7_profile_Destroy(gm);
+  return q;
+
+ ERROR:
+  p7_Fail("allocation failed");
+  return NULL;
+}
+
+/* output_query()
+ * Wait for the search of query <q> to finish, merge its workers'
+ * results, and output them.
+ */
+static int
+output_query(ESL_GETOPTS *go, QUERY_INFO *q, FILE *ofp, FILE *afp, FILE *tblfp, FILE *domtblfp, FILE *pfamtblfp, int textw)
+{
+  WORKER_INFO *info = q->info;
+  ESL_SQ      *qsq  = q->qsq;
+  int          i;
+
+#ifdef HMMER_THREADS
+  if (pthread_mutex_lock(&q->mutex) != 0) p7_Fail("mutex lock failed");
+  while (! q->queued_all || q->nleft > 0)
+    if (pthread_cond_wait(&q->done, &q->mutex) != 0) p7_Fail("cond wait failed");
+  if (pthread_mutex_unlock(&q->mutex) != 0) p7_Fail("mutex unlock failed");
+#endif
+
+  /* merge the results of the search results */
+  for (i = 1; i < q->ninfo; ++i)
+    {
+      p7_tophits_Merge(info[0].th, info[i].th);
+      p7_pipeline_Merge(info[0].pli, info[i].pli);
+    }
+
+  if (fprintf(ofp, "Query:       %s  [L=%ld]\n", qsq->name, (long) qsq->n) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (qsq->acc[0]  != '\0' && fprintf(ofp, "Accession:   %s\n", qsq->acc)  < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  if (qsq->desc[0] != '\0' && fprintf(ofp, "Description: %s\n", qsq->desc) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");  
+
+  /* Print the results.  */
+  p7_tophits_SortBySortkey(info->th);
+  p7_tophits_Threshold(info->th, info->pli);
+  p7_tophits_Targets(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  p7_tophits_Domains(ofp, info->th, info->pli, textw); if (fprintf(ofp, "\n\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  
+  if (tblfp)     p7_tophits_TabularTargets(tblfp,    qsq->name, qsq->acc, info->th, info->pli, (q->idx == 1));
+  if (domtblfp)  p7_tophits_TabularDomains(domtblfp, qsq->name, qsq->acc, info->th, info->pli, (q->idx == 1));
+  if (pfamtblfp) p7_tophits_TabularXfam(pfamtblfp, qsq->name, qsq->acc, info->th, info->pli);
+
+  esl_stopwatch_Stop(q->w);
+  p7_pli_Statistics(ofp, info->pli, q->w);
+  if (fprintf(ofp, "//\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+  fflush(ofp);
+
+  /* Output the results in an MSA (-A option) */
+  if (afp) {
+    ESL_MSA *msa = NULL;
+
+    if ( p7_tophits_Alignment(info->th, qsq->abc, NULL, NULL, 0, p7_ALL_CONSENSUS_COLS, &msa) == eslOK) 
+      {
+	if (textw > 0) esl_msafile_Write(afp, msa, eslMSAFILE_STOCKHOLM);
+	else           esl_msafile_Write(afp, msa, eslMSAFILE_PFAM);
+
+	if (fprintf(ofp, "# Alignment of %d hits satisfying inclusion thresholds saved to: %s\n", msa->nseq, esl_opt_GetString(go, "-A")) < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+      }
+    else if (fprintf(ofp, "# No hits satisfy inclusion thresholds; no alignment saved\n") < 0) ESL_EXCEPTION_SYS(eslEWRITE, "write failed");
+	  
+    esl_msa_Destroy(msa);
+  }
+
+  return eslOK;
+}
+
+/* free_query()
+ * Free a query, once its results are output.
+ */
+static void
+free_query(QUERY_INFO *q)
+{
+  int i;
+
+  if (q == NULL) return;
+  for (i = 0; i < q->ninfo; ++i)
+    {
+      p7_tophits_Destroy(q->info[i].th);
+      p7_pipeline_Destroy(q->info[i].pli);
+      p7_oprofile_Destroy(q->info[i].om);
+      p7_bg_Destroy(q->info[i].bg);
+    }
+#ifdef HMMER_THREADS
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->done);
+#endif
+  if (q->scoredata) p7_hmm_ScoreDataDestroy(q->scoredata);
+  esl_stopwatch_Destroy(q->w);
+  esl_sq_Destroy(q->qsq);
+  free(q->info);
+  free(q);
+}
+
 #ifdef HAVE_MPI
 
 /* Define common tags used by the MPI master/slave processes */
@@ -936,6 +1171,7 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
   if (esl_opt_IsOn(go, "--tformat")) {
     dbformat = esl_sqio_EncodeFormat(esl_opt_GetString(go, "--tformat"));
     if (dbformat == eslSQFILE_UNKNOWN) p7_Fail("%s is not a recognized sequence database file format\n", esl_opt_GetString(go, "--tformat"));
+    if (dbformat == eslSQFILE_FMINDEX) p7_Fail("FMINDEX target format is not supported with --mpi\n");
   }
 
   bg = p7_bg_Create(abc);
@@ -1043,7 +1279,9 @@ mpi_master(ESL_GETOPTS *go, struct cfg_s *cfg)
 
       /* Create processing pipeline and hit list */
       th  = p7_tophits_Create(); 
+      if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(th, esl_opt_GetInteger(go, "--max-hits"));
       pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+      if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A")) pli->ddef->do_alidisplay = FALSE;
       p7_pli_NewModel(pli, om, bg);
 
       /* Main loop: */
@@ -1329,7 +1567,9 @@ mpi_worker(ESL_GETOPTS *go, struct cfg_s *cfg)
 
       /* Create processing pipeline and hit list */
       th  = p7_tophits_Create(); 
+      if (esl_opt_IsOn(go, "--max-hits")) p7_tophits_SetMaxHits(th, esl_opt_GetInteger(go, "--max-hits"));
       pli = p7_pipeline_Create(go, om->M, 100, FALSE, p7_SEARCH_SEQS); /* L_hint = 100 is just a dummy for now */
+      if (esl_opt_GetBoolean(go, "--noali") && ! esl_opt_IsOn(go, "-A")) pli->ddef->do_alidisplay = FALSE;
       p7_pli_NewModel(pli, om, bg);
 
       /* receive a sequence block from the master */
@@ -1436,60 +1676,108 @@ serial_loop(WORKER_INFO *info, ESL_SQFILE *dbfp, int n_targetseqs)
   return sstatus;
 }
 
-#ifdef HMMER_THREADS
+#if defined (p7_IMPL_SSE)
+/* serial_loop_FM()
+ * Search each block of a protein FM-index in turn. FM seeds decide
+ * which targets go on to the regular pipeline; see p7_Pipeline_FM().
+ */
 static int
-thread_loop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, ESL_SQFILE *dbfp, int n_targetseqs)
+serial_loop_FM(WORKER_INFO *info)
 {
-  int  status  = eslOK;
-  int  sstatus = eslOK;
-  int  eofCount = 0;
-  ESL_SQ_BLOCK *block;
-  void         *newBlock;
+  int          status = eslOK;
+  int          i;
+  FM_DATA      fmf;
+  FM_DATA      fmb;
+  FM_METADATA *meta = info->fm_cfg->meta;
+  ESL_SQ      *dbsq = esl_sq_CreateDigital(info->om->abc);
+
+  for (i = 0; i < meta->block_count; i++)
+  {
+    if ((status = fm_FM_read(&fmf, meta, TRUE))  != eslOK) break;
+    if ((status = fm_FM_read(&fmb, meta, FALSE)) != eslOK) { fm_FM_destroy(&fmf, 1); break; }
 
-  esl_workqueue_Reset(queue);
-  esl_threads_WaitForStart(obj);
+    fmb.SA = fmf.SA;
+    fmb.T  = fmf.T;
+
+    status = p7_Pipeline_FM(info->pli, info->om, info->scoredata, info->bg, info->th,
+                            &fmf, &fmb, info->fm_cfg, dbsq);
+
+    fm_FM_destroy(&fmf, 1);
+    fm_FM_destroy(&fmb, 0);
+    if (status != eslOK) break;
+  }
+
+  esl_sq_Destroy(dbsq);
+  return status;
+}
+#endif /*p7_IMPL_SSE*/
+
+#ifdef HMMER_THREADS
+/* thread_loop()
+ * Queue the target sequence blocks for query <q> to the worker
+ * threads. Return as soon as the last block is queued, without
+ * waiting for the search to finish; output_query() waits for that.
+ * <*held> is the reader's empty work item, kept from one query to
+ * the next.
+ */
+static int
+thread_loop(ESL_WORK_QUEUE *queue, WORK_ITEM **held, ESL_SQFILE *dbfp, int n_targetseqs, QUERY_INFO *q)
+{
+  int        status  = eslOK;
+  int        sstatus = eslOK;
+  WORK_ITEM *item    = *held;
+  void      *newItem;
 
-  status = esl_workqueue_ReaderUpdate(queue, NULL, &newBlock);
-  if (status != eslOK) p7_Fail("Work queue reader failed");
-      
   /* Main loop: */
-  while (sstatus == eslOK)
+  while (n_targetseqs != 0)
     {
-      block = (ESL_SQ_BLOCK *) newBlock;
+      sstatus = esl_sqio_ReadBlock(dbfp, item->block, -1, n_targetseqs, FALSE);
+      if (sstatus != eslOK) break;
+      n_targetseqs -= item->block->count;
+
+      if (pthread_mutex_lock(&q->mutex)   != 0) p7_Fail("mutex lock failed");
+      q->nleft++;
+      if (pthread_mutex_unlock(&q->mutex) != 0) p7_Fail("mutex unlock failed");
+
+      item->q = q;
+      status = esl_workqueue_ReaderUpdate(queue, item, &newItem);
+      if (status != eslOK) p7_Fail("Work queue reader failed");
+      item = (WORK_ITEM *) newItem;
+    }
+  *held = item;
 
-      if (n_targetseqs == 0)
-      {
-        block->count = 0;
-        sstatus = eslEOF;
-      } else {
-        sstatus = esl_sqio_ReadBlock(dbfp, block, -1, n_targetseqs, FALSE);
-        n_targetseqs -= block->count;
-      }
+  if (pthread_mutex_lock(&q->mutex)   != 0) p7_Fail("mutex lock failed");
+  q->queued_all = TRUE;
+  if (pthread_mutex_unlock(&q->mutex) != 0) p7_Fail("mutex unlock failed");
 
-      if (sstatus == eslEOF)
-      {
-        if (eofCount < esl_threads_GetWorkerCount(obj)) sstatus = eslOK;
-        ++eofCount;
-      }
-	  
-      if (sstatus == eslOK)
-      {
-        status = esl_workqueue_ReaderUpdate(queue, block, &newBlock);
-        if (status != eslOK) p7_Fail("Work queue reader failed");
-      }
-    }
+  return sstatus;
+}
 
-  status = esl_workqueue_ReaderUpdate(queue, block, NULL);
-  if (status != eslOK) p7_Fail("Work queue reader failed");
+/* thread_stop()
+ * After the last query: send each worker an empty work item, telling
+ * it to exit, and wait for them all to finish.
+ */
+static void
+thread_stop(ESL_THREADS *obj, ESL_WORK_QUEUE *queue, WORK_ITEM *held)
+{
+  int   nworkers = esl_threads_GetWorkerCount(obj);
+  void *newItem;
+  int   i;
 
-  if (sstatus == eslEOF)
+  for (i = 0; i < nworkers; i++)
     {
-      /* wait for all the threads to complete */
-      esl_threads_WaitForFinish(obj);
-      esl_workqueue_Complete(queue);  
+      held->q            = NULL;
+      held->block->count = 0;
+      if (i < nworkers-1) {
+	if (esl_workqueue_ReaderUpdate(queue, held, &newItem) != eslOK) p7_Fail("Work queue reader failed");
+	held = (WORK_ITEM *) newItem;
+      } else {
+	if (esl_workqueue_ReaderUpdate(queue, held, NULL)     != eslOK) p7_Fail("Work queue reader failed");
+      }
     }
 
-  return sstatus;
+  esl_threads_WaitForFinish(obj);
+  esl_workqueue_Complete(queue);
 }
 
 static void 
@@ -1498,29 +1786,35 @@ pipeline_thread(void *arg)
   int i;
   int status;
   int workeridx;
-  WORKER_INFO   *info;
-  ESL_THREADS   *obj;
-  ESL_SQ_BLOCK  *block = NULL;
-  void          *newBlock;
+  WORKER_INFO    *info;
+  ESL_THREADS    *obj;
+  ESL_WORK_QUEUE *queue;
+  QUERY_INFO     *q;
+
+  WORK_ITEM      *item = NULL;
+  void           *newItem;
   
   impl_Init();
 
   obj = (ESL_THREADS *) arg;
   esl_threads_Started(obj, &workeridx);
 
-  info = (WORKER_INFO *) esl_threads_GetData(obj, workeridx);
+  queue = (ESL_WORK_QUEUE *) esl_threads_GetData(obj, workeridx);
 
-  status = esl_workqueue_WorkerUpdate(info->queue, NULL, &newBlock);
+  status = esl_workqueue_WorkerUpdate(queue, NULL, &newItem);
   if (status != eslOK) p7_Fail("Work queue worker failed");
 
-  /* loop until all blocks have been processed */
-  block = (ESL_SQ_BLOCK *) newBlock;
-  while (block->count > 0)
+  /* loop until told to exit; each block may be for a different query */
+  item = (WORK_ITEM *) newItem;
+  while (item->q != NULL)
     {
+      q    = item->q;
+      info = &(q->info[workeridx]);
+
       /* Main loop: */
-      for (i = 0; i < block->count; ++i)
+      for (i = 0; i < item->block->count; ++i)
 	{
-	  ESL_SQ *dbsq = block->list + i;
+	  ESL_SQ *dbsq = item->block->list + i;
 
 	  p7_pli_NewSeq(info->pli, dbsq);
 	  p7_bg_SetLength(info->bg, dbsq->n);
@@ -1532,13 +1826,18 @@ pipeline_thread(void *arg)
 	  p7_pipeline_Reuse(info->pli);
 	}
 
-      status = esl_workqueue_WorkerUpdate(info->queue, block, &newBlock);
+      /* <q> may be freed as soon as its last block is counted off; don't touch it after */
+      if (pthread_mutex_lock(&q->mutex) != 0) p7_Fail("mutex lock failed");
+      if (--q->nleft == 0 && q->queued_all) pthread_cond_signal(&q->done);
+      if (pthread_mutex_unlock(&q->mutex) != 0) p7_Fail("mutex unlock failed");
+
+      status = esl_workqueue_WorkerUpdate(queue, item, &newItem);
       if (status != eslOK) p7_Fail("Work queue worker failed");
 
-      block = (ESL_SQ_BLOCK *) newBlock;
+      item = (WORK_ITEM *) newItem;
     }
 
-  status = esl_workqueue_WorkerUpdate(info->queue, block, NULL);
+  status = esl_workqueue_WorkerUpdate(queue, item, NULL);
   if (status != eslOK) p7_Fail("Work queue worker failed");
 
   esl_threads_Finished(obj, workeridx);
@@ -14,8 +14,44 @@
 #include "easel.h"
 #include "esl_vectorops.h"
 
+#ifdef HMMER_THREADS
+#include <pthread.h>
+#include "esl_threads.h"
+#endif /*HMMER_THREADS*/
+
 #include "hmmer.h"
 
+/* Everything needed to compute one OA trace; one per thread. */
+typedef struct {
+  P7_PROFILE  *gm;		/* generic profile, for the overflow failover path */
+  P7_OPROFILE *om;		/* optimized profile (a clone, in threaded mode)    */
+  P7_OMX      *oxf;		/* optimized Forward matrix                         */
+  P7_OMX      *oxb;		/* optimized Backward matrix                        */
+  P7_GMX      *gxf;		/* generic Forward mx for failover; created lazily  */
+  P7_GMX      *gxb;		/* generic Backward mx for failover; created lazily */
+  int64_t      ramlimit;	/* seqs needing more for full matrices use checkpointed OA; 0=no limit */
+} TRACE_WORKSPACE;
+
+#ifdef HMMER_THREADS
+typedef struct {
+  ESL_SQ        **sq;
+  P7_TRACE      **tr;
+  int             next;		/* index of next sequence to be claimed  */
+  int             end;		/* one past the last sequence to align   */
+  pthread_mutex_t mutex;	/* protects <next>                       */
+} TRACE_QUEUE;
+
+typedef struct {
+  TRACE_QUEUE     *q;
+  TRACE_WORKSPACE  ws;
+} TRACE_WORKER;
+
+static void    trace_thread(void *arg);
+#endif /*HMMER_THREADS*/
+
+static int     compute_traces_serial(P7_HMM *hmm, ESL_SQ **sq, int offset, int N, P7_TRACE **tr, int64_t ramlimit);
+static int     compute_trace(TRACE_WORKSPACE *ws, const ESL_SQ *sq, P7_TRACE *tr);
+static int64_t full_mx_size(int M, int L);
 static int     map_new_msa(P7_TRACE **tr, int nseq, int M, int optflags, int **ret_inscount, int **ret_matuse, int **ret_matmap, int *ret_alen);
 static ESL_DSQ get_dsq_z(ESL_SQ **sq, const ESL_MSA *premsa, P7_TRACE **tr, int idx, int z);
 static int     make_digital_msa(ESL_SQ **sq, const ESL_MSA *premsa, P7_TRACE **tr, int nseq, const int *matuse, const int *matmap, int M, int alen, int optflags, ESL_MSA **ret_msa);
@@ -237,135 +273,144 @@ p7_tracealign_MSA(const ESL_MSA *premsa, P7_TRACE **tr, int M, int optflags, ESL
 int
 p7_tracealign_computeTraces(P7_HMM *hmm, ESL_SQ  **sq, int offset, int N, P7_TRACE  **tr)
 {
+  return compute_traces_serial(hmm, sq, offset, N, tr, 0);
+}
 
-  P7_OMX       *oxf     = NULL; /* optimized Forward matrix        */
-  P7_OMX       *oxb     = NULL; /* optimized Backward matrix       */
-  P7_GMX       *gxf     = NULL; /* generic Forward mx for failover */
-  P7_GMX       *gxb     = NULL; /* generic Backward mx for failover*/
-  P7_PROFILE   *gm      = NULL;
-  P7_OPROFILE  *om      = NULL;
-  P7_BG        *bg      = NULL;
-  int tfrom, tto;
 
-  int           idx;
-  float         fwdsc;    /* Forward score                   */
-  float         oasc;   /* optimal accuracy score          */
-  int status;
+/* Function: p7_tracealign_computeTracesThreaded()
+ *
+ * Synopsis: Compute traces for a collection of sequences, using
+ *           <ncpus> worker threads.
+ *
+ * Purpose:  Same as <p7_tracealign_computeTraces()>, but the <N>
+ *           sequences are shared out among <ncpus> threads. Each
+ *           thread has its own clone of the optimized profile (so it
+ *           can reconfigure length independently), its own copy of
+ *           the generic profile for the overflow failover path, and
+ *           its own DP matrices. Threads claim the next unaligned
+ *           sequence from a shared counter.
+ *
+ *           Every trace is written to its own slot <tr[idx]>, and the
+ *           trace for a sequence doesn't depend on which thread
+ *           computed it or in what order, so the resulting alignment
+ *           is identical to the serial one.
+ *
+ *           Sequences whose full DP matrices would take more than
+ *           <ramlimit> bytes are aligned with
+ *           <p7_GOATraceCheckpointed()> instead, in O(M sqrt(L))
+ *           memory. The limit applies to each thread. <ramlimit=0>
+ *           means no limit, as in <p7_tracealign_computeTraces()>.
+ *
+ *           If <ncpus> is 1 or less, or HMMER was built without
+ *           thread support, the sequences are aligned serially.
+ *
+ * Returns:  <eslOK> on success.
+ *
+ * Throws:   <eslEMEM> on allocation failure; <eslESYS> if a thread
+ *           or mutex can't be created.
+ */
+int
+p7_tracealign_computeTracesThreaded(P7_HMM *hmm, ESL_SQ **sq, int offset, int N, P7_TRACE **tr, int ncpus, int64_t ramlimit)
+{
+#ifdef HMMER_THREADS
+  ESL_THREADS    *threadObj = NULL;
+  TRACE_WORKER   *info      = NULL;
+  TRACE_QUEUE     q;
+  P7_BG          *bg        = NULL;
+  P7_PROFILE     *gm        = NULL;
+  P7_OPROFILE    *om        = NULL;
+  int             have_mutex = FALSE;
+  int             L0;		/* initial matrix allocation, in rows */
+  int             i;
+  int             status;
+
+  if (ncpus > N) ncpus = N;
+  if (ncpus <= 1) return compute_traces_serial(hmm, sq, offset, N, tr, ramlimit);
 
   bg = p7_bg_Create(hmm->abc);
   gm = p7_profile_Create (hmm->M, hmm->abc);
   om = p7_oprofile_Create(hmm->M, hmm->abc);
+  if (bg == NULL || gm == NULL || om == NULL) { status = eslEMEM; goto ERROR; }
 
   p7_ProfileConfig(hmm, bg, gm, sq[offset]->n, p7_UNILOCAL);
   p7_oprofile_Convert(gm, om);
 
+  L0 = sq[offset]->n;
+  if (ramlimit > 0 && full_mx_size(hmm->M, L0) > ramlimit) L0 = 0;
 
-  oxf = p7_omx_Create(hmm->M, sq[offset]->n, sq[offset]->n);
-  oxb = p7_omx_Create(hmm->M, sq[offset]->n, sq[offset]->n);
-
-  /* Collect an OA trace for each sequence that needs to be aligned
-   */
-  for (idx = offset; idx < offset+ N; idx++)
-  {
-    /* special case: a sequence of length 0. HMMER model can't generate 0 length seq. Set tr->N == 0 as a flag. (bug #h100 fix) */
-    if (sq[idx]->n == 0) { tr[idx]->N = 0; continue; }
-
-    p7_omx_GrowTo(oxf, hmm->M, sq[idx]->n, sq[idx]->n);
-    p7_omx_GrowTo(oxb, hmm->M, sq[idx]->n, sq[idx]->n);
-
-    p7_oprofile_ReconfigLength(om, sq[idx]->n);
-
-    p7_Forward (sq[idx]->dsq, sq[idx]->n, om,      oxf, &fwdsc);
-    p7_Backward(sq[idx]->dsq, sq[idx]->n, om, oxf, oxb, NULL);
-
-    status = p7_Decoding(om, oxf, oxb, oxb);      /* <oxb> is now overwritten with post probabilities     */
-
-    if (status == eslOK)
-      {
-        p7_OptimalAccuracy(om, oxb, oxf, &oasc);      /* <oxf> is now overwritten with OA scores              */
-        p7_OATrace        (om, oxb, oxf, tr[idx]);    /* tr[idx] is now an OA traceback for seq #idx          */
-      }
-    else if (status == eslERANGE)
-      {
-        /* Work around the numeric overflow problem in Decoding()
-         * xref J3/119-121 for commentary;
-         * also the note in impl_sse/decoding.c::p7_Decoding().
-         *
-         * In short: p7_Decoding() can overflow in cases where the
-         * model is in unilocal mode (expects to see a single
-         * "domain") but the target contains more than one domain.
-         * In searches, I believe this only happens on repetitive
-         * garbage, because the domain postprocessor is very good
-         * about identifying single domains before doing posterior
-         * decoding. But in hmmalign, we're in unilocal mode
-         * to begin with, and the user can definitely give us a
-         * multidomain protein.
-         *
-         * We need to make this far more robust; but that's probably
-         * an issue to deal with when we really spend some time
-         * looking hard at hmmalign performance. For now (Nov 2009;
-         * in beta tests leading up to 3.0 release) I'm more
-         * concerned with stabilizing the search programs.
-         *
-         * The workaround is to detect the overflow and fail over to
-         * slow generic routines.
-         */
-        if (gxf == NULL) gxf = p7_gmx_Create(hmm->M, sq[idx]->n);
-        else             p7_gmx_GrowTo(gxf,  hmm->M, sq[idx]->n);
-
-        if (gxb == NULL) gxb = p7_gmx_Create(hmm->M, sq[idx]->n);
-        else             p7_gmx_GrowTo(gxb,  hmm->M, sq[idx]->n);
-
-        p7_ReconfigLength(gm, sq[idx]->n);
-
-        p7_GForward (sq[idx]->dsq, sq[idx]->n, gm, gxf, &fwdsc);
-        p7_GBackward(sq[idx]->dsq, sq[idx]->n, gm, gxb, NULL);
-        p7_GDecoding(gm, gxf, gxb, gxb);
-        p7_GOptimalAccuracy(gm, gxb, gxf, &oasc);
-        p7_GOATrace        (gm, gxb, gxf, tr[idx]);
-        p7_gmx_Reuse(gxf);
-        p7_gmx_Reuse(gxb);
-      }
-
-
-    /* the above steps aren't storing the tfrom/tto values in the trace,
-     * which are required for downstream processing in this case, so
-     * hack them here. Note - this treats the whole thing as one domain,
-     * even if there are really multiple domains.
-     */
-    // skip the parts of the trace that precede the first match state
-    tfrom = 2;
-    while (tr[idx]->st[tfrom] != p7T_M)   tfrom++;
-
-    tto = tfrom + 1;
-    //run until the model is exited
-    while (tr[idx]->st[tto] != p7T_E)     tto++;
+  q.sq   = sq;
+  q.tr   = tr;
+  q.next = offset;
+  q.end  = offset + N;
+  if (pthread_mutex_init(&q.mutex, NULL) != 0) ESL_XEXCEPTION(eslESYS, "mutex init failed");
+  have_mutex = TRUE;
 
-    tr[idx]->tfrom[0]  = tfrom;
-    tr[idx]->tto[0]    = tto - 1;
-
-
-    p7_omx_Reuse(oxf);
-    p7_omx_Reuse(oxb);
-  }
+  ESL_ALLOC(info, sizeof(TRACE_WORKER) * ncpus);
+  for (i = 0; i < ncpus; i++)
+    {
+      info[i].q      = &q;
+      info[i].ws.gm  = NULL;
+      info[i].ws.om  = NULL;
+      info[i].ws.oxf = info[i].ws.oxb = NULL;
+      info[i].ws.gxf = info[i].ws.gxb = NULL;
+      info[i].ws.ramlimit = ramlimit;
+    }
 
-#if 0
-  for (idx = 0; idx < nseq; idx++)
-    p7_trace_Dump(stdout, tr[idx], gm, sq[idx]->dsq);
-#endif
+  if ((threadObj = esl_threads_Create(&trace_thread)) == NULL) ESL_XEXCEPTION(eslESYS, "failed to create thread object");
+  for (i = 0; i < ncpus; i++)
+    {
+      if ((info[i].ws.gm  = p7_profile_Clone(gm))                                    == NULL) { status = eslEMEM; goto ERROR; }
+      if ((info[i].ws.om  = p7_oprofile_Clone(om))                                   == NULL) { status = eslEMEM; goto ERROR; }
+      if ((info[i].ws.oxf = p7_omx_Create(hmm->M, L0, L0))                           == NULL) { status = eslEMEM; goto ERROR; }
+      if ((info[i].ws.oxb = p7_omx_Create(hmm->M, L0, L0))                           == NULL) { status = eslEMEM; goto ERROR; }
+    }
 
+  /* AddThread() starts each worker; everything they need is allocated by now */
+  for (i = 0; i < ncpus; i++)
+    esl_threads_AddThread(threadObj, &info[i]);
 
+  esl_threads_WaitForStart(threadObj);
+  esl_threads_WaitForFinish(threadObj);
+  esl_threads_Destroy(threadObj);
 
-  p7_omx_Destroy(oxf);
-  p7_omx_Destroy(oxb);
-  p7_gmx_Destroy(gxf);
-  p7_gmx_Destroy(gxb);
-  p7_bg_Destroy(bg);
-  p7_profile_Destroy(gm);
+  for (i = 0; i < ncpus; i++)
+    {
+      p7_omx_Destroy(info[i].ws.oxf);
+      p7_omx_Destroy(info[i].ws.oxb);
+      p7_gmx_Destroy(info[i].ws.gxf);
+      p7_gmx_Destroy(info[i].ws.gxb);
+      p7_profile_Destroy(info[i].ws.gm);
+      p7_oprofile_Destroy(info[i].ws.om);   /* clones: releases only the shell */
+    }
+  free(info);
+  pthread_mutex_destroy(&q.mutex);
   p7_oprofile_Destroy(om);
-
-
+  p7_profile_Destroy(gm);
+  p7_bg_Destroy(bg);
   return eslOK;
+
+ ERROR:
+  /* we only get here before any worker thread has been started */
+  if (threadObj) esl_threads_Destroy(threadObj);
+  if (info)
+    {
+      for (i = 0; i < ncpus; i++)
+	{
+	  if (info[i].ws.oxf) p7_omx_Destroy(info[i].ws.oxf);
+	  if (info[i].ws.oxb) p7_omx_Destroy(info[i].ws.oxb);
+	  if (info[i].ws.gm)  p7_profile_Destroy(info[i].ws.gm);
+	  if (info[i].ws.om)  p7_oprofile_Destroy(info[i].ws.om);
+	}
+      free(info);
+    }
+  if (have_mutex) pthread_mutex_destroy(&q.mutex);
+  if (om) p7_oprofile_Destroy(om);
+  if (gm) p7_profile_Destroy(gm);
+  if (bg) p7_bg_Destroy(bg);
+  return status;
+#else
+  return compute_traces_serial(hmm, sq, offset, N, tr, ramlimit);
+#endif /*HMMER_THREADS*/
 }
 
 
@@ -470,6 +515,212 @@ ERROR:
  * 2. Internal functions used by the API
  *****************************************************************/
 
+/* compute_traces_serial()
+ * The work of p7_tracealign_computeTraces(), and of
+ * p7_tracealign_computeTracesThreaded() when it has only one thread:
+ * OA traces for sq[offset..offset+N-1], in one workspace.
+ */
+static int
+compute_traces_serial(P7_HMM *hmm, ESL_SQ **sq, int offset, int N, P7_TRACE **tr, int64_t ramlimit)
+{
+  TRACE_WORKSPACE ws;
+  P7_BG          *bg      = NULL;
+  int             idx;
+  int             L0;		/* initial matrix allocation, in rows */
+  int             status  = eslOK;
+
+  bg    = p7_bg_Create(hmm->abc);
+  ws.gm = p7_profile_Create (hmm->M, hmm->abc);
+  ws.om = p7_oprofile_Create(hmm->M, hmm->abc);
+
+  p7_ProfileConfig(hmm, bg, ws.gm, sq[offset]->n, p7_UNILOCAL);
+  p7_oprofile_Convert(ws.gm, ws.om);
+
+  L0 = sq[offset]->n;
+  if (ramlimit > 0 && full_mx_size(hmm->M, L0) > ramlimit) L0 = 0;
+
+  ws.oxf      = p7_omx_Create(hmm->M, L0, L0);
+  ws.oxb      = p7_omx_Create(hmm->M, L0, L0);
+  ws.gxf      = NULL;
+  ws.gxb      = NULL;
+  ws.ramlimit = ramlimit;
+
+  /* Collect an OA trace for each sequence that needs to be aligned
+   */
+  for (idx = offset; idx < offset+ N; idx++)
+    if ((status = compute_trace(&ws, sq[idx], tr[idx])) != eslOK) break;
+
+#if 0
+  for (idx = 0; idx < nseq; idx++)
+    p7_trace_Dump(stdout, tr[idx], gm, sq[idx]->dsq);
+#endif
+
+  p7_omx_Destroy(ws.oxf);
+  p7_omx_Destroy(ws.oxb);
+  p7_gmx_Destroy(ws.gxf);
+  p7_gmx_Destroy(ws.gxb);
+  p7_bg_Destroy(bg);
+  p7_profile_Destroy(ws.gm);
+  p7_oprofile_Destroy(ws.om);
+
+  return status;
+}
+
+/* full_mx_size()
+ * Approximate size in bytes of the two full DP matrices (optimized,
+ * or generic on failover) that compute_trace() needs for an M x L
+ * alignment.
+ */
+static int64_t
+full_mx_size(int M, int L)
+{
+  return (int64_t) 2 * (int64_t) (L+1) * (int64_t) (M+1) * p7G_NSCELLS * sizeof(float);
+}
+
+/* compute_trace()
+ * Collect an OA trace <tr> for one sequence <sq>, using the profiles
+ * and matrices in <ws>. The optimized profile's length model is
+ * reconfigured for <sq>, and the matrices are grown as needed.
+ */
+static int
+compute_trace(TRACE_WORKSPACE *ws, const ESL_SQ *sq, P7_TRACE *tr)
+{
+  int   M = ws->om->M;
+  float fwdsc;			/* Forward score                   */
+  float oasc;			/* optimal accuracy score          */
+  int   tfrom, tto;
+  int   status;
+
+  /* special case: a sequence of length 0. HMMER model can't generate 0 length seq. Set tr->N == 0 as a flag. (bug #h100 fix) */
+  if (sq->n == 0) { tr->N = 0; return eslOK; }
+
+  if (ws->ramlimit > 0 && full_mx_size(M, sq->n) > ws->ramlimit)
+    {
+      /* Full matrices for this one would exceed the memory limit:
+       * align it in checkpointed memory, using the generic routines.
+       */
+      p7_ReconfigLength(ws->gm, sq->n);
+      if ((status = p7_GOATraceCheckpointed(sq->dsq, sq->n, ws->gm, tr, &oasc)) != eslOK) return status;
+    }
+  else
+    {
+      p7_omx_GrowTo(ws->oxf, M, sq->n, sq->n);
+      p7_omx_GrowTo(ws->oxb, M, sq->n, sq->n);
+
+      p7_oprofile_ReconfigLength(ws->om, sq->n);
+
+      p7_Forward (sq->dsq, sq->n, ws->om,          ws->oxf, &fwdsc);
+      p7_Backward(sq->dsq, sq->n, ws->om, ws->oxf, ws->oxb, NULL);
+
+      status = p7_Decoding(ws->om, ws->oxf, ws->oxb, ws->oxb);      /* <oxb> is now overwritten with post probabilities     */
+
+      if (status == eslOK)
+        {
+          p7_OptimalAccuracy(ws->om, ws->oxb, ws->oxf, &oasc);      /* <oxf> is now overwritten with OA scores              */
+          p7_OATrace        (ws->om, ws->oxb, ws->oxf, tr);         /* <tr> is now an OA traceback for <sq>                 */
+        }
+      else if (status == eslERANGE)
+        {
+          /* Work around the numeric overflow problem in Decoding()
+           * xref J3/119-121 for commentary;
+           * also the note in impl_sse/decoding.c::p7_Decoding().
+           *
+           * In short: p7_Decoding() can overflow in cases where the
+           * model is in unilocal mode (expects to see a single
+           * "domain") but the target contains more than one domain.
+           * In searches, I believe this only happens on repetitive
+           * garbage, because the domain postprocessor is very good
+           * about identifying single domains before doing posterior
+           * decoding. But in hmmalign, we're in unilocal mode
+           * to begin with, and the user can definitely give us a
+           * multidomain protein.
+           *
+           * We need to make this far more robust; but that's probably
+           * an issue to deal with when we really spend some time
+           * looking hard at hmmalign performance. For now (Nov 2009;
+           * in beta tests leading up to 3.0 release) I'm more
+           * concerned with stabilizing the search programs.
+           *
+           * The workaround is to detect the overflow and fail over to
+           * slow generic routines.
+           */
+          if (ws->gxf == NULL) ws->gxf = p7_gmx_Create(M, sq->n);
+          else                 p7_gmx_GrowTo(ws->gxf,  M, sq->n);
+
+          if (ws->gxb == NULL) ws->gxb = p7_gmx_Create(M, sq->n);
+          else                 p7_gmx_GrowTo(ws->gxb,  M, sq->n);
+
+          p7_ReconfigLength(ws->gm, sq->n);
+
+          p7_GForward (sq->dsq, sq->n, ws->gm, ws->gxf, &fwdsc);
+          p7_GBackward(sq->dsq, sq->n, ws->gm, ws->gxb, NULL);
+          p7_GDecoding(ws->gm, ws->gxf, ws->gxb, ws->gxb);
+          p7_GOptimalAccuracy(ws->gm, ws->gxb, ws->gxf, &oasc);
+          p7_GOATrace        (ws->gm, ws->gxb, ws->gxf, tr);
+          p7_gmx_Reuse(ws->gxf);
+          p7_gmx_Reuse(ws->gxb);
+        }
+    }
+
+  /* the above steps aren't storing the tfrom/tto values in the trace,
+   * which are required for downstream processing in this case, so
+   * hack them here. Note - this treats the whole thing as one domain,
+   * even if there are really multiple domains.
+   */
+  // skip the parts of the trace that precede the first match state
+  tfrom = 2;
+  while (tr->st[tfrom] != p7T_M)   tfrom++;
+
+  tto = tfrom + 1;
+  //run until the model is exited
+  while (tr->st[tto] != p7T_E)     tto++;
+
+  tr->tfrom[0]  = tfrom;
+  tr->tto[0]    = tto - 1;
+
+  p7_omx_Reuse(ws->oxf);
+  p7_omx_Reuse(ws->oxb);
+  return eslOK;
+}
+
+#ifdef HMMER_THREADS
+/* trace_thread()
+ * Worker for p7_tracealign_computeTracesThreaded(): claim sequence
+ * indices from the shared queue one at a time until none are left,
+ * writing each trace into its own slot of the trace array.
+ */
+static void
+trace_thread(void *arg)
+{
+  ESL_THREADS  *obj = (ESL_THREADS *) arg;
+  TRACE_WORKER *info;
+  TRACE_QUEUE  *q;
+  int           workeridx;
+  int           idx;
+
+  impl_Init();
+
+  esl_threads_Started(obj, &workeridx);
+  info = (TRACE_WORKER *) esl_threads_GetData(obj, workeridx);
+  q    = info->q;
+
+  while (1)
+    {
+      if (pthread_mutex_lock(&q->mutex)   != 0) esl_fatal("mutex lock failed");
+      idx = q->next;
+      if (idx < q->end) q->next++;
+      if (pthread_mutex_unlock(&q->mutex) != 0) esl_fatal("mutex unlock failed");
+
+      if (idx >= q->end) break;
+      if (compute_trace(&info->ws, q->sq[idx], q->tr[idx]) != eslOK) esl_fatal("failed to align sequence %s", q->sq[idx]->name);
+    }
+
+  esl_threads_Finished(obj, workeridx);
+  return;
+}
+#endif /*HMMER_THREADS*/
+
+
 /* map_new_msa()
  *
  * Construct <inscount[0..M]>, <matuse[1..M]>, and <matmap[1..M]>
@@ -0,0 +1,35 @@
+#! /usr/bin/perl
+
+# hmmscan thread scaling benchmark
+#
+# Usage:     ./hmmscan-threads.pl <top_builddir> <pressed HMM db> <seqfile> [<ncpu>...]
+# Example:   ./hmmscan-threads.pl ../build-icc Pfam-A.hmm repeats.fa 1 2 4 8 > hmmscan-threads.out
+#
+# Runs hmmscan on the same queries with increasing --cpu and reports
+# wall clock time and speedup relative to the first run. Use queries
+# that pass many models through the MSV filter (repeat-rich proteins,
+# e.g. titin or WD40/LRR/ankyrin-rich sequences): then every surviving
+# model costs a p7_oprofile_ReadRest() call, and that is where worker
+# threads used to serialize on the profile file.
+#
+# Also see impl_sse/io.c's benchmark driver (--cpu), which times
+# ReadRest() alone.
+
+use Time::HiRes qw(gettimeofday tv_interval);
+
+$top_builddir = shift;
+$hmmdb        = shift;
+$seqfile      = shift;
+@ncpus        = @ARGV ? @ARGV : (1, 2, 4, 8);
+
+printf("%-6s %10s %8s\n", "#cpu", "wall(s)", "speedup");
+printf("%-6s %10s %8s\n", "#----", "----------", "--------");
+foreach $ncpu (@ncpus)
+{
+    $t0 = [gettimeofday];
+    system("${top_builddir}/src/hmmscan --cpu $ncpu -o /dev/null --tblout /dev/null $hmmdb $seqfile") == 0
+	or die "hmmscan --cpu $ncpu failed";
+    $elapsed = tv_interval($t0);
+    $base    = $elapsed unless defined $base;
+    printf("%-6d %10.2f %8.2f\n", $ncpu, $elapsed, $base / $elapsed);
+}
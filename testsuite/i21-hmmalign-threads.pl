@@ -0,0 +1,56 @@
+#! /usr/bin/perl
+
+# Test that hmmalign --cpu gives the same alignment as the serial code:
+# traces are computed in worker threads but land in sequence order, so
+# the output must be identical for any number of threads, with and
+# without checkpointed DP (--mxsize).
+#
+# Usage:   ./i21-hmmalign-threads.pl <builddir> <srcdir> <tmpfile prefix>
+# Example: ./i21-hmmalign-threads.pl ..         ..       tmpfoo
+#
+# SVN $Id$
+
+$builddir  = shift;
+$srcdir    = shift;
+$tmppfx    = shift;
+
+# The test makes use of the following files:
+#
+# globins4.hmm          <hmm>     a globin model
+# globins45.fa          <seqfile> 45 globin sequences
+#
+# It creates the following files:
+# $tmppfx.0             <msa>     hmmalign --cpu 0 output
+# $tmppfx.N             <msa>     hmmalign --cpu N output
+
+$hmmfile = "$srcdir/tutorial/globins4.hmm";
+$seqfile = "$srcdir/tutorial/globins45.fa";
+
+# Verify that we have all the executables and datafiles we need for the test.
+if (! -x "$builddir/src/hmmalign") { die "FAIL: didn't find hmmalign binary in $builddir/src\n"; }
+if (! -r $hmmfile)                 { die "FAIL: can't read $hmmfile\n"; }
+if (! -r $seqfile)                 { die "FAIL: can't read $seqfile\n"; }
+
+# --cpu only exists with thread support; nothing to compare without it.
+$output = `$builddir/src/hmmalign -h 2>&1`;
+if ($output !~ /--cpu/) { print "ok\n"; exit 0; }
+
+foreach $mxopt ("", "--mxsize 0.01")
+{
+    `$builddir/src/hmmalign --cpu 0 $mxopt -o $tmppfx.0 $hmmfile $seqfile 2>&1`;
+    if ($? != 0) { die "FAIL: hmmalign --cpu 0 $mxopt failed\n"; }
+
+    foreach $ncpu (1, 2, 4, 7)
+    {
+	`$builddir/src/hmmalign --cpu $ncpu $mxopt -o $tmppfx.N $hmmfile $seqfile 2>&1`;
+	if ($? != 0) { die "FAIL: hmmalign --cpu $ncpu $mxopt failed\n"; }
+
+	`diff $tmppfx.0 $tmppfx.N 2>&1`;
+	if ($? != 0) { die "FAIL: hmmalign --cpu $ncpu $mxopt alignment differs from --cpu 0\n"; }
+    }
+}
+
+print "ok\n";
+unlink "$tmppfx.0";
+unlink "$tmppfx.N";
+exit 0;
@@ -0,0 +1,107 @@
+#! /usr/bin/perl
+
+# Test that hmmsearch --lsort finds the same hits as a search without
+# it: targets are only handed to the worker threads in a different
+# order, so hits, scores and E-values must be identical, for several
+# queries and any number of threads. Also check that --lsort is
+# refused without worker threads.
+#
+# Usage:   ./i22-hmmsearch-lsort.pl <builddir> <srcdir> <tmpfile prefix>
+# Example: ./i22-hmmsearch-lsort.pl ..         ..       tmpfoo
+#
+# SVN $Id$
+
+$builddir  = shift;
+$srcdir    = shift;
+$tmppfx    = shift;
+
+# The test makes use of the following files:
+#
+# minifam               <hmmfile>  three models: globins4, fn3, Pkinase
+# globins45.fa          <seqfile>  45 globin sequences
+# 7LESS_DROME           <seqfile>  one long target with fn3 and kinase domains
+#
+# It creates the following files:
+# $tmppfx.db            <seqfile>  the targets, short and long mixed
+# $tmppfx.0, $tmppfx.1  <tblout>   results without and with --lsort
+# $tmppfx.d0, $tmppfx.d1 <domtblout> per-domain results, likewise
+# $tmppfx.o0, $tmppfx.o1 <output>  main output, likewise
+
+$hmmfile = "$srcdir/tutorial/minifam";
+@seqfiles = ("$srcdir/tutorial/globins45.fa", "$srcdir/tutorial/7LESS_DROME");
+
+# Verify that we have all the executables and datafiles we need for the test.
+if (! -x "$builddir/src/hmmsearch") { die "FAIL: didn't find hmmsearch binary in $builddir/src\n"; }
+if (! -r $hmmfile)                  { die "FAIL: can't read $hmmfile\n"; }
+foreach $f (@seqfiles) { if (! -r $f) { die "FAIL: can't read $f\n"; } }
+
+# --lsort only exists with thread support; nothing to compare without it.
+$output = `$builddir/src/hmmsearch -h 2>&1`;
+if ($output !~ /--lsort/) { print "ok\n"; exit 0; }
+
+# put the long target in the middle of the short ones
+open(DB, ">$tmppfx.db") || die "FAIL: couldn't open $tmppfx.db for writing";
+open(SEQ, $seqfiles[0]) || die "FAIL: couldn't open $seqfiles[0]";
+@lines = <SEQ>;
+close SEQ;
+$half = 0;
+for ($i = 0; $i <= $#lines; $i++) {
+    if ($lines[$i] =~ /^>/ && ++$half == 23) {
+	# 7LESS_DROME is in UniProt format; copy its sequence out as FASTA
+	open(LONG, $seqfiles[1]) || die "FAIL: couldn't open $seqfiles[1]";
+	$inseq = 0;
+	print DB ">7LESS_DROME\n";
+	while (<LONG>) {
+	    if    (/^SQ/)  { $inseq = 1; next; }
+	    elsif (/^\/\//) { $inseq = 0; }
+	    if ($inseq) { s/[\s\d]//g; print DB "$_\n"; }
+	}
+	close LONG;
+    }
+    print DB $lines[$i];
+}
+close DB;
+
+`$builddir/src/hmmsearch --cpu 0 --lsort $hmmfile $tmppfx.db 2>&1`;
+if ($? == 0) { die "FAIL: hmmsearch --lsort should need worker threads (--cpu 0)\n"; }
+
+foreach $ncpu (1, 2, 4)
+{
+    `$builddir/src/hmmsearch --cpu $ncpu         --tblout $tmppfx.0 --domtblout $tmppfx.d0 -o $tmppfx.o0 $hmmfile $tmppfx.db 2>&1`;
+    if ($? != 0) { die "FAIL: hmmsearch --cpu $ncpu failed\n"; }
+    `$builddir/src/hmmsearch --cpu $ncpu --lsort --tblout $tmppfx.1 --domtblout $tmppfx.d1 -o $tmppfx.o1 $hmmfile $tmppfx.db 2>&1`;
+    if ($? != 0) { die "FAIL: hmmsearch --cpu $ncpu --lsort failed\n"; }
+
+    # comment lines carry the command line, options and timings
+    foreach $pair (["$tmppfx.0", "$tmppfx.1"], ["$tmppfx.d0", "$tmppfx.d1"], ["$tmppfx.o0", "$tmppfx.o1"])
+    {
+	if (&strip_comments($$pair[0]) ne &strip_comments($$pair[1])) {
+	    die "FAIL: hmmsearch --cpu $ncpu --lsort results differ from the unsorted search ($$pair[1])\n";
+	}
+    }
+}
+
+print "ok\n";
+unlink "$tmppfx.db";
+unlink "$tmppfx.0";
+unlink "$tmppfx.1";
+unlink "$tmppfx.d0";
+unlink "$tmppfx.d1";
+unlink "$tmppfx.o0";
+unlink "$tmppfx.o1";
+exit 0;
+
+
+sub strip_comments
+{
+    my ($file) = @_;
+    my $text   = "";
+
+    open(F, $file) || die "FAIL: couldn't open $file";
+    while (<F>) {
+	next if /^\#/;
+	$text .= $_;
+    }
+    close F;
+    return $text;
+}
@@ -0,0 +1,247 @@
+#! /usr/bin/perl
+
+# Test that an hmmpgmd search survives a worker that dies in the
+# middle of it: the master must hand the dead worker's chunk to the
+# surviving worker, even when that one has already run out of chunks
+# and is idle, and the search must find the same hits as a search
+# where no worker failed.
+#
+# Worker B is stopped shortly after the search starts, holding a
+# chunk; worker A searches the rest of the database and goes idle;
+# then B is killed. If the requeued chunk isn't picked up, the search
+# never finishes, and we time out.
+#
+# Usage:   ./i23-hmmpgmd-failover.pl <builddir> <srcdir> <tmpfile prefix>
+# Example: ./i23-hmmpgmd-failover.pl ..         ..       tmpfoo
+#
+# SVN $Id$
+
+use IO::Socket;
+use POSIX ":sys_wait_h";
+
+$SIG{INT} = \&catch_sigint;
+
+$builddir = shift;
+$srcdir   = shift;
+$tmppfx   = shift;
+
+$host    = "127.0.0.1";
+$cport   = 51375;               # nondefault ports, not those of i19, nor of
+$wport   = 51376;               # a running hmmpgmd daemon on the same machine
+$nrandom = 100000;              # random sequences in the test database
+$timeout = 300;                 # seconds to wait for the search that loses a worker
+
+# The test makes use of the following files:
+#
+# globins45.fa          <seqfile>  45 globin sequences, planted in the database
+#
+# It creates the following files:
+# $tmppfx.db            <seqdb>    hmmpgmd sequence database
+# $tmppfx.in, .in2      <script>   hmmc2 scripts
+# $tmppfx.out, .out2    <output>   hmmc2 output, without and with a failed worker
+# $tmppfx.pid           <pidfile>  hmmpgmd master pid
+
+$seqfile = "$srcdir/tutorial/globins45.fa";
+
+# Verify that we have all the executables and datafiles we need for the test.
+@h3progs = ("hmmpgmd", "hmmc2");
+foreach $h3prog  (@h3progs) { if (! -x "$builddir/src/$h3prog") { die "FAIL: didn't find $h3prog executable in $builddir/src\n"; } }
+if (! -r $seqfile) { die "FAIL: can't read $seqfile\n"; }
+
+# hmmpgmd needs threads; if they aren't enabled, there's nothing to test.
+$have_threads = `cat $builddir/src/p7_config.h | grep "^#define HMMER_THREADS"`;
+if ($have_threads eq "") {
+    printf("HMMER_THREADS not defined in p7_config.h\n");
+    exit 0;
+}
+
+# Verify that the wport and cport are CLOSED.
+if (IO::Socket::INET->new(PeerHost => $host, PeerPort => $wport, Proto => 'tcp')) { die "FAIL: worker port $wport already in use"; }
+if (IO::Socket::INET->new(PeerHost => $host, PeerPort => $cport, Proto => 'tcp')) { die "FAIL: client port $cport already in use"; }
+
+&create_test_seqdb("$tmppfx.db");
+&create_test_script("$tmppfx.in",  0);
+&create_test_script("$tmppfx.in2", 1);
+
+$daemon_active = 0;
+system("$builddir/src/hmmpgmd --master --wport $wport --cport $cport --seqdb $tmppfx.db --pid $tmppfx.pid  > /dev/null 2>&1 &");
+if ($?) { die "FAIL: hmmpgmd master failed to start";  }
+$daemon_active = 1;
+sleep 2;
+$worker_a = &start_worker();
+$worker_b = &start_worker();
+sleep 5;                        # let the workers load the database
+
+# the reference search, both workers alive
+$start = time();
+&run_client("$tmppfx.in", "$tmppfx.out", $timeout);
+$elapsed = time() - $start + 1;
+@expected = &hit_lines("$tmppfx.out");
+if (scalar(@expected) == 0) { &tear_down(); die "FAIL: reference search found no hits\n"; }
+
+# the same search, losing worker B along the way
+$client = &start_client("$tmppfx.in2", "$tmppfx.out2");
+select(undef, undef, undef, 0.3);
+kill 'STOP', $worker_b;
+sleep(2 * $elapsed + 2);        # long enough for worker A to run out of chunks
+kill 'KILL', $worker_b;
+waitpid($worker_b, 0);
+
+if (! &wait_client($client, $timeout)) {
+    kill 'KILL', $client;
+    &tear_down();
+    die "FAIL: search did not finish after a worker died\n";
+}
+$daemon_active = 0;             # the script ended with !shutdown
+waitpid($worker_a, 0);
+
+@found = &hit_lines("$tmppfx.out2");
+if (join("", @found) ne join("", @expected)) { &tear_down(); die "FAIL: hits differ after a worker died\n"; }
+
+&tear_down();
+print "ok\n";
+exit 0;
+
+
+sub start_worker
+{
+    my $pid = fork();
+    if (! defined $pid) { &tear_down(); die "FAIL: fork failed"; }
+    if ($pid == 0) {
+	open(STDOUT, ">/dev/null");
+	open(STDERR, ">/dev/null");
+	exec("$builddir/src/hmmpgmd", "--worker", $host, "--wport", $wport, "--cpu", "1");
+	exit 1;
+    }
+    return $pid;
+}
+
+sub start_client
+{
+    my ($scriptfile, $outfile) = @_;
+    my $pid = fork();
+    if (! defined $pid) { &tear_down(); die "FAIL: fork failed"; }
+    if ($pid == 0) {
+	open(STDIN,  "<$scriptfile");
+	open(STDOUT, ">$outfile");
+	open(STDERR, ">&STDOUT");
+	exec("$builddir/src/hmmc2", "-i", $host, "-p", $cport, "-S");
+	exit 1;
+    }
+    return $pid;
+}
+
+# wait_client(pid, seconds): TRUE if the client exited in time
+sub wait_client
+{
+    my ($pid, $secs) = @_;
+    my $deadline = time() + $secs;
+
+    while (time() < $deadline) {
+	if (waitpid($pid, WNOHANG) == $pid) { return 1; }
+	select(undef, undef, undef, 0.2);
+    }
+    return 0;
+}
+
+sub run_client
+{
+    my ($scriptfile, $outfile, $secs) = @_;
+    my $pid = &start_client($scriptfile, $outfile);
+    if (! &wait_client($pid, $secs)) { kill 'KILL', $pid; &tear_down(); die "FAIL: reference search did not finish\n"; }
+}
+
+# hit_lines(file): the per-sequence hit lines of an hmmc2 output
+sub hit_lines
+{
+    my ($file) = @_;
+    my @lines  = ();
+    my $in_data = 0;
+
+    open(F, $file) || die "FAIL: couldn't open $file";
+    while (<F>) {
+	if (/^Scores for complete sequence/)          { $in_data = 1; }
+	if (/^Internal pipeline statistics summary:/) { $in_data = 0; }
+	if ($in_data && /^\s+(\S+)\s+(\d+\.\d+)/)   { push(@lines, $_); }
+    }
+    close F;
+    return @lines;
+}
+
+sub tear_down
+{
+    if ($daemon_active) {
+        open PID, "<$tmppfx.pid";
+        my $pid = <PID>;
+        close PID;
+        `kill $pid`;
+	$daemon_active = 0;
+    }
+    foreach $pid ($worker_a, $worker_b) { if ($pid) { kill 'KILL', $pid; } }
+    unlink "$tmppfx.db";
+    unlink "$tmppfx.in";
+    unlink "$tmppfx.in2";
+    unlink "$tmppfx.out";
+    unlink "$tmppfx.out2";
+    unlink "$tmppfx.pid";
+}
+
+sub catch_sigint
+{
+    tear_down();
+    die "sigint signal captured; killed daemons\n";
+}
+
+# create_test_seqdb(file): an hmmpgmd database of random sequences,
+# with the globins planted through it.
+sub create_test_seqdb
+{
+    my ($dbfile) = @_;
+    my @aa      = split(//, "ACDEFGHIKLMNPQRSTVWY");
+    my @globins = ();
+    my ($seq, $i, $j, $n, $nres);
+
+    open(SEQ, $seqfile) || die "FAIL: couldn't open $seqfile";
+    while (<SEQ>) {
+	if (/^>/) { push(@globins, ""); next; }
+	chomp; $globins[$#globins] .= $_;
+    }
+    close SEQ;
+
+    srand(42);
+    @seqs = ();
+    $nres = 0;
+    $j    = 0;
+    for ($i = 0; $i < $nrandom; $i++) {
+	if ($j <= $#globins && $i % int($nrandom / scalar(@globins)) == 0) { push(@seqs, $globins[$j++]); }
+	$seq = "";
+	for ($n = 0; $n < 300; $n++) { $seq .= $aa[int(rand(20))]; }
+	push(@seqs, $seq);
+    }
+    foreach $seq (@seqs) { $nres += length($seq); }
+
+    open(DB, ">$dbfile") || die "FAIL: couldn't write $dbfile\n";
+    $n = scalar(@seqs);
+    print DB "#$nres $n 1 $n 1 i23-hmmpgmd-failover\n";
+    for ($i = 0; $i < $n; $i++) {
+	printf DB (">%09d 1\n%s\n", $i+1, $seqs[$i]);
+    }
+    close DB;
+    1;
+}
+
+sub create_test_script
+{
+    my ($scriptfile, $shutdown) = @_;
+    open(SCRIPTFILE, ">$scriptfile") || die "FAIL: couldn't create the test script";
+    print SCRIPTFILE <<"EOF";
+\@--seqdb 1
+>MYG_PHYCA
+VLSEGEWQLVLHVWAKVEADVAGHGQDILIRLFKSHPETLEKFDRVKHLKTEAEMKASEDLKKHGVTVLTALGAILKKKGHHEAELKPLAQSHATKHKIPIKYLEFISEAIIHVLHSRHPGDFGADAQGAMNKALELFRKDIAAKYKELGYQG
+//
+EOF
+    if ($shutdown) { print SCRIPTFILE "!shutdown\n//\n"; }
+    else           { print SCRIPTFILE "//\n"; }
+    close SCRIPTFILE;
+    1;
+}
@@ -0,0 +1,85 @@
+#! /usr/bin/perl
+
+# Test that hmmscan --cache with worker threads gives the same results
+# as the serial code, for several queries in a row: the queries share
+# the resident profiles, which must not be scanned by two queries at
+# once.
+#
+# Usage:   ./i24-hmmscan-cache.pl <builddir> <srcdir> <tmpfile prefix>
+# Example: ./i24-hmmscan-cache.pl ..         ..       tmpfoo
+#
+# SVN $Id$
+
+$builddir  = shift;
+$srcdir    = shift;
+$tmppfx    = shift;
+
+# The test makes use of the following files:
+#
+# minifam               <hmmfile>  three models: globins4, fn3, Pkinase
+# globins45.fa          <seqfile>  45 globin sequences, the queries
+#
+# It creates the following files:
+# $tmppfx.hmm           <hmmfile>  copy of minifam, pressed
+# $tmppfx.hmm.h3{mifp}             hmmpress auxfiles for .hmm file
+# $tmppfx.0, $tmppfx.1  <tblout>   results with --cpu 0, and with threads
+# $tmppfx.d0, $tmppfx.d1 <domtblout> per-domain results, likewise
+# $tmppfx.o0, $tmppfx.o1 <output>  main output, likewise
+
+$hmmfile = "$srcdir/tutorial/minifam";
+$seqfile = "$srcdir/tutorial/globins45.fa";
+
+# Verify that we have all the executables and datafiles we need for the test.
+@h3progs = ("hmmscan", "hmmpress");
+foreach $h3prog  (@h3progs) { if (! -x "$builddir/src/$h3prog") { die "FAIL: didn't find $h3prog executable in $builddir/src\n"; } }
+if (! -r $hmmfile) { die "FAIL: can't read $hmmfile\n"; }
+if (! -r $seqfile) { die "FAIL: can't read $seqfile\n"; }
+
+# --cpu only exists with thread support; nothing to compare without it.
+$output = `$builddir/src/hmmscan -h 2>&1`;
+if ($output !~ /--cpu/) { print "ok\n"; exit 0; }
+
+`cp $hmmfile $tmppfx.hmm`;
+`$builddir/src/hmmpress -f $tmppfx.hmm 2>&1`;  if ($?) { die "FAIL: hmmpress"; }
+
+`$builddir/src/hmmscan --cache --cpu 0 --tblout $tmppfx.0 --domtblout $tmppfx.d0 -o $tmppfx.o0 $tmppfx.hmm $seqfile 2>&1`;
+if ($? != 0) { die "FAIL: hmmscan --cache --cpu 0 failed\n"; }
+
+foreach $ncpu (2, 4)
+{
+    `$builddir/src/hmmscan --cache --cpu $ncpu --tblout $tmppfx.1 --domtblout $tmppfx.d1 -o $tmppfx.o1 $tmppfx.hmm $seqfile 2>&1`;
+    if ($? != 0) { die "FAIL: hmmscan --cache --cpu $ncpu failed\n"; }
+
+    # comment lines carry the command line, options and timings
+    foreach $pair (["$tmppfx.0", "$tmppfx.1"], ["$tmppfx.d0", "$tmppfx.d1"], ["$tmppfx.o0", "$tmppfx.o1"])
+    {
+	if (&strip_comments($$pair[0]) ne &strip_comments($$pair[1])) {
+	    die "FAIL: hmmscan --cache --cpu $ncpu results differ from --cpu 0 ($$pair[1])\n";
+	}
+    }
+}
+
+print "ok\n";
+unlink <$tmppfx.hmm*>;
+unlink "$tmppfx.0";
+unlink "$tmppfx.1";
+unlink "$tmppfx.d0";
+unlink "$tmppfx.d1";
+unlink "$tmppfx.o0";
+unlink "$tmppfx.o1";
+exit 0;
+
+
+sub strip_comments
+{
+    my ($file) = @_;
+    my $text   = "";
+
+    open(F, $file) || die "FAIL: couldn't open $file";
+    while (<F>) {
+	next if /^\#/;
+	$text .= $_;
+    }
+    close F;
+    return $text;
+}